@@ -0,0 +1,385 @@
+/******************************************************************************\
+*  ufs_bench.c                                                                 *
+*                                                                              *
+*  Benchmarks ufs.h operations against registered backends.                    *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Usage: ufs_bench [-b backend]... [-o opts] [-x extra opts] [-d dirs]      */
+/*                  [-f files per dir] [-a areas] [-l lookups]                */
+/* Without -b every registered backend runs. Without -o each backend gets     */
+/* path=<temporary path> plus whatever -x adds. The defaults fit the default  */
+/* image sizes, larger runs size the image backend through -x, e.g:           */
+/*   ufs_bench -d 64 -f 512 -x files=65536,nodes=32768,strbytes=1048576       */
+/* Each phase prints one line: backend, phase, operations, ns/op, ops/s.      */
+
+#define _GNU_SOURCE
+
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ufs.h"
+#include "ufs_backend.h"
+#include "ufs_defs.h"
+
+#define BENCH_MAX_BACKENDS (UFS_BACKEND_MAX)
+#define BENCH_NAME_SIZE (64)
+#define BENCH_OPTS_SIZE (4096)
+
+struct benchConfigStruct {
+    const char *backends[ BENCH_MAX_BACKENDS ];
+    uint64_t numBackends;
+    const char *opts;
+    const char *extraOpts;
+    uint64_t numDirs,
+             numFiles,
+             numAreas,
+             numLookups;
+};
+
+struct benchStateStruct {
+    ufsType ufs;
+    ufsIdentifierType *dirs,
+                      *files,
+                      *areas;
+    uint64_t numFiles;
+};
+
+struct phaseStruct {
+    const char *name;
+    uint64_t (*run)( struct benchStateStruct *state,
+                     struct benchConfigStruct *config );
+};
+
+static uint64_t nowNs( void );
+static void usage( const char *prog );
+static bool runBackend( const char *name, struct benchConfigStruct *config );
+static uint64_t addDirs( struct benchStateStruct *state,
+                         struct benchConfigStruct *config );
+static uint64_t addFiles( struct benchStateStruct *state,
+                          struct benchConfigStruct *config );
+static uint64_t addMappings( struct benchStateStruct *state,
+                             struct benchConfigStruct *config );
+static uint64_t getFiles( struct benchStateStruct *state,
+                          struct benchConfigStruct *config );
+static uint64_t resolve( struct benchStateStruct *state,
+                         struct benchConfigStruct *config );
+static uint64_t iterate( struct benchStateStruct *state,
+                         struct benchConfigStruct *config );
+static ufsStatusType countIter( ufsIdentifierType storage, uint64_t currEntry,
+                                uint64_t numEntries, void *userData );
+static int removeEntry( const char *path, const struct stat *sb, int flag,
+                        struct FTW *ftw );
+
+static const struct phaseStruct phases[] = {
+    { "add-dirs", addDirs },
+    { "add-files", addFiles },
+    { "add-mappings", addMappings },
+    { "get-file", getFiles },
+    { "resolve", resolve },
+    { "iterate", iterate },
+};
+
+int main( int argc, char **argv )
+{
+    struct benchConfigStruct config = {
+        .numDirs = 4,
+        .numFiles = 32,
+        .numAreas = 4,
+        .numLookups = 100000,
+    };
+    uint64_t i;
+    int opt;
+    bool ok;
+
+    while ( ( opt = getopt( argc, argv, "b:o:x:d:f:a:l:h" ) ) != -1 ) {
+        switch ( opt ) {
+        case 'b':
+            if ( config.numBackends == BENCH_MAX_BACKENDS ) {
+                usage( argv[0] );
+                return 1;
+            }
+            config.backends[ config.numBackends++ ] = optarg;
+            break;
+        case 'o':
+            config.opts = optarg;
+            break;
+        case 'x':
+            config.extraOpts = optarg;
+            break;
+        case 'd':
+            config.numDirs = strtoull( optarg, NULL, 10 );
+            break;
+        case 'f':
+            config.numFiles = strtoull( optarg, NULL, 10 );
+            break;
+        case 'a':
+            config.numAreas = strtoull( optarg, NULL, 10 );
+            break;
+        case 'l':
+            config.numLookups = strtoull( optarg, NULL, 10 );
+            break;
+        default:
+            usage( argv[0] );
+            return opt != 'h';
+        }
+    }
+
+    if ( !config.numDirs || !config.numFiles || !config.numAreas ) {
+        usage( argv[0] );
+        return 1;
+    }
+
+    if ( !config.numBackends ) {
+        for ( i = 0; i < ufsBackendCount(); i++ )
+            config.backends[ config.numBackends++ ] = ufsBackendGet( i ) -> name;
+    }
+
+    printf( "%-12s %-14s %12s %12s %14s\n",
+            "backend", "phase", "ops", "ns/op", "ops/s" );
+
+    ok = true;
+    for ( i = 0; i < config.numBackends; i++ )
+        ok = runBackend( config.backends[i], &config ) && ok;
+
+    return ok ? 0 : 1;
+}
+
+static uint64_t nowNs( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage( const char *prog )
+{
+    fprintf( stderr, "usage: %s [-b backend]... [-o opts] [-x extra opts] "
+                     "[-d dirs] [-f files per dir] [-a areas] [-l lookups]\n",
+             prog );
+}
+
+static bool runBackend( const char *name, struct benchConfigStruct *config )
+{
+    struct benchStateStruct state = { 0 };
+    char path[] = "/tmp/ufsBenchXXXXXX", opts[ BENCH_OPTS_SIZE ];
+    uint64_t i, ops, start, elapsed;
+    bool ok;
+
+    if ( config -> opts ) {
+        snprintf( opts, sizeof( opts ), "%s", config -> opts );
+        path[0] = '\0';
+    } else {
+        /* Backends create what path names, a file or a directory, inside a   */
+        /* private directory removed as a whole afterwards.                   */
+        if ( !mkdtemp( path ) ) {
+            perror( "mkdtemp" );
+            return false;
+        }
+
+        snprintf( opts, sizeof( opts ), "path=%s/store%s%s", path,
+                  config -> extraOpts ? "," : "",
+                  config -> extraOpts ? config -> extraOpts : "" );
+    }
+
+    state.ufs = ufsInitWithBackend( name, opts );
+    if ( !state.ufs ) {
+        fprintf( stderr, "%s: init failed: %s\n", name,
+                 ufsErrno <= UFS_UNKNOWN_ERROR ? ufsStatusStrings[ ufsErrno ]
+                                               : "internal error" );
+        if ( *path )
+            nftw( path, removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+        return false;
+    }
+
+    state.dirs = calloc( config -> numDirs, sizeof( *state.dirs ) );
+    state.files = calloc( config -> numDirs * config -> numFiles,
+                          sizeof( *state.files ) );
+    state.areas = calloc( config -> numAreas, sizeof( *state.areas ) );
+
+    ok = state.dirs && state.files && state.areas;
+    for ( i = 0; ok && i < sizeof( phases ) / sizeof( phases[0] ); i++ ) {
+        start = nowNs();
+        ops = phases[i].run( &state, config );
+        elapsed = nowNs() - start;
+
+        if ( ops == UINT64_MAX ) {
+            fprintf( stderr, "%s: %s failed: %s\n", name, phases[i].name,
+                     ufsErrno <= UFS_UNKNOWN_ERROR ?
+                     ufsStatusStrings[ ufsErrno ] : "internal error" );
+            ok = false;
+            break;
+        }
+
+        printf( "%-12s %-14s %12lu %12.1f %14.0f\n", name, phases[i].name,
+                ops, ops ? (double) elapsed / ops : 0.0,
+                elapsed ? ops * 1e9 / elapsed : 0.0 );
+    }
+
+    ufsDestroy( state.ufs );
+    free( state.dirs );
+    free( state.files );
+    free( state.areas );
+
+    if ( *path )
+        nftw( path, removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+
+    return ok;
+}
+
+static uint64_t addDirs( struct benchStateStruct *state,
+                         struct benchConfigStruct *config )
+{
+    char name[ BENCH_NAME_SIZE ];
+    uint64_t i;
+
+    for ( i = 0; i < config -> numDirs; i++ ) {
+        snprintf( name, sizeof( name ), "/bench/dir%lu", i );
+        state -> dirs[i] = ufsAddDirectory( state -> ufs, name );
+        if ( state -> dirs[i] < 0 )
+            return UINT64_MAX;
+    }
+
+    return config -> numDirs;
+}
+
+static uint64_t addFiles( struct benchStateStruct *state,
+                          struct benchConfigStruct *config )
+{
+    char name[ BENCH_NAME_SIZE ];
+    uint64_t i, j;
+
+    for ( i = 0; i < config -> numDirs; i++ ) {
+        for ( j = 0; j < config -> numFiles; j++ ) {
+            snprintf( name, sizeof( name ), "f%lu", j );
+            state -> files[ state -> numFiles ] =
+                ufsAddFile( state -> ufs, state -> dirs[i], name );
+            if ( state -> files[ state -> numFiles++ ] < 0 )
+                return UINT64_MAX;
+        }
+    }
+
+    return state -> numFiles;
+}
+
+/* Every file goes to one area, every other one to a second area as well.   */
+static uint64_t addMappings( struct benchStateStruct *state,
+                             struct benchConfigStruct *config )
+{
+    char name[ BENCH_NAME_SIZE ];
+    uint64_t i, ops;
+
+    for ( i = 0; i < config -> numAreas; i++ ) {
+        snprintf( name, sizeof( name ), "area%lu", i );
+        state -> areas[i] = ufsAddArea( state -> ufs, name );
+        if ( state -> areas[i] < 0 )
+            return UINT64_MAX;
+    }
+
+    ops = 0;
+    for ( i = 0; i < state -> numFiles; i++ ) {
+        if ( ufsAddMapping( state -> ufs, state -> areas[ i % config -> numAreas ],
+                            state -> files[i] ) != UFS_NO_ERROR )
+            return UINT64_MAX;
+        ops++;
+
+        if ( i % 2 || config -> numAreas < 2 )
+            continue;
+
+        if ( ufsAddMapping( state -> ufs,
+                            state -> areas[ ( i + 1 ) % config -> numAreas ],
+                            state -> files[i] ) != UFS_NO_ERROR )
+            return UINT64_MAX;
+        ops++;
+    }
+
+    return ops;
+}
+
+static uint64_t getFiles( struct benchStateStruct *state,
+                          struct benchConfigStruct *config )
+{
+    char name[ BENCH_NAME_SIZE ];
+    uint64_t i, dir, file;
+
+    srand( 1 );
+    for ( i = 0; i < config -> numLookups; i++ ) {
+        dir = rand() % config -> numDirs;
+        file = rand() % config -> numFiles;
+        snprintf( name, sizeof( name ), "f%lu", file );
+
+        if ( ufsGetFile( state -> ufs, state -> dirs[ dir ], name ) !=
+             state -> files[ dir * config -> numFiles + file ] )
+            return UINT64_MAX;
+    }
+
+    return config -> numLookups;
+}
+
+/* The view holds every area, in reverse, followed by BASE.                  */
+static uint64_t resolve( struct benchStateStruct *state,
+                         struct benchConfigStruct *config )
+{
+    ufsViewType view;
+    uint64_t i, numAreas;
+
+    numAreas = config -> numAreas < UFS_VIEW_MAX_SIZE - 1 ?
+               config -> numAreas : UFS_VIEW_MAX_SIZE - 2;
+    for ( i = 0; i < numAreas; i++ )
+        view[i] = state -> areas[ numAreas - 1 - i ];
+    view[ numAreas ] = 0;
+    view[ numAreas + 1 ] = UFS_VIEW_TERMINATOR;
+
+    srand( 2 );
+    for ( i = 0; i < config -> numLookups; i++ ) {
+        if ( ufsResolveStorageInView( state -> ufs, view,
+                 state -> files[ rand() % state -> numFiles ] ) < 0 )
+            return UINT64_MAX;
+    }
+
+    return config -> numLookups;
+}
+
+/* Ops are directory entries visited.                                        */
+static uint64_t iterate( struct benchStateStruct *state,
+                         struct benchConfigStruct *config )
+{
+    ufsViewType view;
+    uint64_t i, entries;
+
+    view[0] = state -> areas[0];
+    view[1] = 0;
+    view[2] = UFS_VIEW_TERMINATOR;
+
+    entries = 0;
+    for ( i = 0; i < config -> numDirs; i++ ) {
+        if ( ufsIterateDirInView( state -> ufs, view, state -> dirs[i],
+                                  countIter, &entries ) != UFS_NO_ERROR )
+            return UINT64_MAX;
+    }
+
+    return entries;
+}
+
+static ufsStatusType countIter( ufsIdentifierType storage, uint64_t currEntry,
+                                uint64_t numEntries, void *userData )
+{
+    (void) storage; (void) currEntry; (void) numEntries;
+    (*(uint64_t*)userData)++;
+    return UFS_NO_ERROR;
+}
+
+static int removeEntry( const char *path, const struct stat *sb, int flag,
+                        struct FTW *ftw )
+{
+    (void) sb; (void) flag; (void) ftw;
+    return remove( path );
+}
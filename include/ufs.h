@@ -103,6 +103,12 @@
 /*                     If the last area happens to be BASE the changes are    */
 /*                     applied to the external filesystem.                    */
 /*                                                                            */
+/* Scratch area: An area that lives in memory only and goes away with the     */
+/*               ufs instance, it is never synced. Otherwise it is an area    */
+/*               like any other, views, mappings and collapse treat it the    */
+/*               same. ufsPersistArea turns it into a regular area. Scratch   */
+/*               areas are optional, an implementation may refuse them.       */
+/*                                                                            */
 /* About files and mappings: Files should always exist in a mapping, to       */
 /* satisfy this constraint we define two types of mappings:                   */
 /*   * An explicit mapping added view ufsAddMapping                           */
@@ -127,6 +133,7 @@
     UFS_X(UFS_DOES_NOT_EXIST) \
     UFS_X(UFS_DIRECTORY_IS_NOT_EMPTY) \
     UFS_X(UFS_CANNOT_RESOLVE_STORAGE) \
+    UFS_X(UFS_MAPPING_DOES_NOT_EXIST) \
     UFS_X(UFS_UNKNOWN_ERROR)
 
 enum {
@@ -135,11 +142,8 @@ enum {
 #undef UFS_X
 };
 
-const char *ufsStatusStrings[] = {
-#define UFS_X(name) #name,
-    UFS_STATUS_LIST
-#undef UFS_X
-};
+/* Indexed by status, defined once by the implementation.                    */
+extern const char *ufsStatusStrings[];
 
 typedef uint8_t ufsStatusType;
 typedef int64_t ufsIdentifierType;
@@ -151,7 +155,8 @@ typedef ufsStatusType (*ufsDirIter)( ufsIdentifierType storage,
                                      void *userData);
 typedef ufsIdentifierType ufsViewType[ UFS_VIEW_MAX_SIZE ];
 
-extern ufsStatusType ufsErrno;
+/* Like errno, each thread has its own.                                      */
+extern _Thread_local ufsStatusType ufsErrno;
 
 /******************************************************************************\
 * ufsInit                                                                      *
@@ -552,4 +557,58 @@ ufsStatusType ufsIterateDirInView( ufsType ufs,
 ufsStatusType ufsCollapse( ufsType ufs,
                            ufsViewType view );
 
+/******************************************************************************\
+* ufsAddScratchArea                                                            *
+*                                                                              *
+*  Adds a scratch area to ufs, it is lost when ufs is destroyed.               *
+*                                                                              *
+*  Possible errors:                                                            *
+*   -UFS_BAD_CALL: The function received bad arguments or the implementation   *
+*                  has no scratch areas.                                       *
+*   -UFS_ALREADY_EXISTS: An area with that name already exists.                *
+*   -UFS_OUT_OF_MEMORY: The system is out of memory.                           *
+*   -UFS_UNKNOWN_ERROR: Any error not specified above.                         *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -ufs: The ufs instance, must not be NULL.                                   *
+*  -name: The name of the area, must not be NULL.                              *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsIdentifierType: The unique identifier of the new area.                  *
+*                      If a negative value is returned, check ufsErrno.        *
+*                                                                              *
+\******************************************************************************/
+ufsIdentifierType ufsAddScratchArea( ufsType ufs,
+                                     const char *name );
+
+/******************************************************************************\
+* ufsPersistArea                                                               *
+*                                                                              *
+*  Turns a scratch area into a regular area with the same name and mappings.   *
+*  The scratch area's identifier is no longer valid on success, on error the   *
+*  scratch area is left as it was.                                             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   -UFS_BAD_CALL: The function received bad arguments, area is not a scratch  *
+*                  area or the implementation has no scratch areas.            *
+*   -UFS_DOES_NOT_EXIST: The area does not exist in ufs.                       *
+*   -UFS_OUT_OF_MEMORY: There is no room for the area or its mappings.         *
+*   -UFS_UNKNOWN_ERROR: Any error not specified above.                         *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -ufs: The ufs instance, must not be NULL.                                   *
+*  -area: the scratch area's unique identifier, must be greater than 0.        *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsIdentifierType: The unique identifier of the regular area.              *
+*                      If a negative value is returned, check ufsErrno.        *
+*                                                                              *
+\******************************************************************************/
+ufsIdentifierType ufsPersistArea( ufsType ufs,
+                                  ufsIdentifierType area );
+
 #endif /* UFS_H */
@@ -0,0 +1,243 @@
+/******************************************************************************\
+*  ufs_backend.h                                                               *
+*                                                                              *
+*  Contains the definitions for pluggable ufs backends.                        *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* ufs.h is a spec, a backend is one implementation of it. A ufsType handed  */
+/* out by ufsInit or ufsInitWithBackend remembers its backend and every ufs.h */
+/* call is forwarded to it, so the engine under a daemon is picked at run     */
+/* time, e.g: UFS_BACKEND=image UFS_BACKEND_OPTS=path=/x ./ufs                */
+/*                                                                            */
+/* Backends receive their own state as first argument, never NULL, the rest  */
+/* of the arguments are passed as is and must be checked by the backend. The */
+/* semantics and errors of each operation are those of the matching ufs.h    */
+/* function.                                                                  */
+/*                                                                            */
+/* Options are a string of comma separated key=value pairs, a key may repeat. */
+/* Every backend understands path=, the location of its data, the rest is    */
+/* backend specific. NULL options ask for the backend defaults.              */
+/*                                                                            */
+/* Operations after collapse are optional and may be NULL, the matching ufs.h */
+/* calls are then bad calls.                                                  */
+/*                                                                            */
+/* The registry is not thread safe, register backends before the first init. */
+
+#ifndef UFS_BACKEND_H
+#define UFS_BACKEND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs.h"
+
+#define UFS_BACKEND_MAX (16)
+#define UFS_BACKEND_DEFAULT ("image")
+/* Read by ufsInit, to select the backend and its options.                   */
+#define UFS_BACKEND_ENV ("UFS_BACKEND")
+#define UFS_BACKEND_OPTS_ENV ("UFS_BACKEND_OPTS")
+
+struct ufsBackendOps {
+    const char *name;
+
+    void *(*init)( const char *opts );
+    void (*destroy)( void *backend );
+
+    ufsIdentifierType (*addDirectory)( void *backend, const char *name );
+    ufsIdentifierType (*addFile)( void *backend,
+                                  ufsIdentifierType directory,
+                                  const char *name );
+    ufsIdentifierType (*addArea)( void *backend, const char *name );
+
+    ufsIdentifierType (*getDirectory)( void *backend, const char *name );
+    ufsIdentifierType (*getFile)( void *backend,
+                                  ufsIdentifierType directory,
+                                  char *name );
+    ufsIdentifierType (*getArea)( void *backend, const char *name );
+
+    ufsStatusType (*removeDirectory)( void *backend,
+                                      ufsIdentifierType directory );
+    ufsStatusType (*removeFile)( void *backend, ufsIdentifierType file );
+    ufsStatusType (*removeArea)( void *backend, ufsIdentifierType area );
+
+    ufsStatusType (*addMapping)( void *backend,
+                                 ufsIdentifierType area,
+                                 ufsIdentifierType storage );
+    ufsStatusType (*probeMapping)( void *backend,
+                                   ufsIdentifierType area,
+                                   ufsIdentifierType storage );
+
+    ufsIdentifierType (*resolveStorageInView)( void *backend,
+                                               ufsViewType view,
+                                               ufsIdentifierType storage );
+    ufsStatusType (*iterateDirInView)( void *backend,
+                                       ufsViewType view,
+                                       ufsIdentifierType directory,
+                                       ufsDirIter iterator,
+                                       void *userData );
+    ufsStatusType (*collapse)( void *backend, ufsViewType view );
+
+    ufsIdentifierType (*addScratchArea)( void *backend, const char *name );
+    ufsIdentifierType (*persistArea)( void *backend,
+                                      ufsIdentifierType area );
+};
+
+/* The mmap image backend, see ufs_tiers.h for its options.                  */
+extern const struct ufsBackendOps ufsImageBackendOps;
+/* The SQLite backend, its options are path= and batch=, the number of      */
+/* writes committed per transaction.                                          */
+extern const struct ufsBackendOps ufsSqliteBackendOps;
+/* The log structured backend, its options are path= and the tuning of its  */
+/* engine: memtable=, block=, l0runs=, ratio=, threads= and sync=.           */
+extern const struct ufsBackendOps ufsLsmBackendOps;
+/* The sharded image backend, see ufs_shards.h for its options.             */
+extern const struct ufsBackendOps ufsShardedBackendOps;
+
+/******************************************************************************\
+* ufsInitWithBackend                                                           *
+*                                                                              *
+*  Initialise a ufs over the backend registered as name.                       *
+*  NOTE: this function DOES not mount ufs, it just returns an instance of it.  *
+*                                                                              *
+*  Possible errors:                                                            *
+*   -UFS_BAD_CALL: name is NULL or the options are bad.                        *
+*   -UFS_DOES_NOT_EXIST: No backend is registered as name.                     *
+*   -UFS_OUT_OF_MEMORY: The system is out of memory and can't create ufs.      *
+*   -UFS_UNKNOWN_ERROR: Any error not specified above.                         *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -name: The name of the backend.                                             *
+*  -opts: The options of the backend, can be NULL.                             *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsType: a new ufs instance, NULL on error.                                *
+*                                                                              *
+\******************************************************************************/
+ufsType ufsInitWithBackend( const char *name, const char *opts );
+
+/******************************************************************************\
+* ufsBackendWrap                                                               *
+*                                                                              *
+*  Wraps an initialised backend state into a ufs instance, for backends that   *
+*  offer their own init functions ( e.g: ufsInitTiered ).                      *
+*  On failure the backend state is destroyed.                                  *
+*                                                                              *
+*  Possible errors:                                                            *
+*   -UFS_BAD_CALL: ops or backend are NULL.                                    *
+*   -UFS_OUT_OF_MEMORY: The system is out of memory and can't create ufs.      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -ops: The backend.                                                          *
+*  -backend: The state returned by the init of ops.                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsType: a new ufs instance, NULL on error.                                *
+*                                                                              *
+\******************************************************************************/
+ufsType ufsBackendWrap( const struct ufsBackendOps *ops, void *backend );
+
+/******************************************************************************\
+* ufsBackendRegister                                                           *
+*                                                                              *
+*  Registers a backend, the ops must outlive every use of the registry.        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   -UFS_BAD_CALL: ops, its name or one of its functions are NULL.             *
+*   -UFS_ALREADY_EXISTS: A backend with the same name is registered.           *
+*   -UFS_OUT_OF_MEMORY: UFS_BACKEND_MAX backends are registered.               *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -ops: The backend.                                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsStatusType: The status of this call, errno is also set.                 *
+*                                                                              *
+\******************************************************************************/
+ufsStatusType ufsBackendRegister( const struct ufsBackendOps *ops );
+
+/******************************************************************************\
+* ufsBackendFind                                                               *
+*                                                                              *
+*  Finds a registered backend by name.                                         *
+*                                                                              *
+*  Possible errors:                                                            *
+*   -UFS_BAD_CALL: name is NULL.                                               *
+*   -UFS_DOES_NOT_EXIST: No backend is registered as name.                     *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -name: The name of the backend.                                             *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -const struct ufsBackendOps*: The backend, NULL on error.                   *
+*                                                                              *
+\******************************************************************************/
+const struct ufsBackendOps *ufsBackendFind( const char *name );
+
+/******************************************************************************\
+* ufsBackendCount                                                              *
+*                                                                              *
+*  Returns the number of registered backends, the built in ones included.      *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The number of backends.                                          *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsBackendCount( void );
+
+/******************************************************************************\
+* ufsBackendGet                                                                *
+*                                                                              *
+*  Returns the registered backend at index, in registration order.             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   -UFS_BAD_CALL: index is out of range.                                      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -index: Smaller than ufsBackendCount().                                     *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -const struct ufsBackendOps*: The backend, NULL on error.                   *
+*                                                                              *
+\******************************************************************************/
+const struct ufsBackendOps *ufsBackendGet( uint64_t index );
+
+/******************************************************************************\
+* ufsBackendOption                                                             *
+*                                                                              *
+*  Copies the value of the index-th occurrence of key in opts to buff.         *
+*                                                                              *
+*  Possible errors:                                                            *
+*   -UFS_BAD_CALL: key or buff are NULL, or the value does not fit buff.       *
+*   -UFS_DOES_NOT_EXIST: opts has no such occurrence of key.                   *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -opts: The options, can be NULL.                                            *
+*  -key: The key to look for.                                                  *
+*  -index: Which occurrence of key, 0 for the first one.                       *
+*  -buff: Where to copy the value to, NUL terminated.                          *
+*  -buffSize: The size of buff.                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the value was copied, false otherwise.                       *
+*                                                                              *
+\******************************************************************************/
+bool ufsBackendOption( const char *opts, const char *key, uint64_t index,
+                       char *buff, uint64_t buffSize );
+
+#endif /* UFS_BACKEND_H */
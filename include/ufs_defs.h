@@ -13,42 +13,54 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+#include "ufs.h"
 
 /* Increment on every ufs update, used to validate compatibility.             */
-#define UFS_VERSION (1) 
+#define UFS_VERSION (8)
 
 /* contains the word ufs followed by 0, sanity check for corruption.          */
 #define UFS_MAGIC_NUMBER (0x00736675)
-#define UFS_DIRECTORY (".ufs")
-#define UFS_IMAGE_FILE UFS_DIRECTORY ("ufs_index")
+#define UFS_DIRECTORY ".ufs"
+#define UFS_IMAGE_FILE UFS_DIRECTORY "/ufs_index"
+#define UFS_SQLITE_FILE UFS_DIRECTORY "/ufs_sqlite"
+#define UFS_LSM_DIR UFS_DIRECTORY "/ufs_lsm"
+#define UFS_SHARDS_DIR UFS_DIRECTORY "/ufs_shards"
+#define UFS_BLOB_DIR UFS_DIRECTORY "/ufs_blobs"
+#define UFS_EXTENT_DIR UFS_DIRECTORY "/ufs_extents"
+#define UFS_COLD_DIR UFS_DIRECTORY "/ufs_cold"
 
+/* Internal statuses, these extend the statuses of the spec in ufs.h.        */
+/* UFS_NO_ERROR, UFS_BAD_CALL, UFS_OUT_OF_MEMORY etc... come from there.      */
 enum {
-    UFS_NO_ERROR = 0,
-    UFS_IMAGE_DOES_NOT_EXIST,
+    UFS_IMAGE_DOES_NOT_EXIST = UFS_UNKNOWN_ERROR + 1,
     UFS_IMAGE_IS_CORRUPTED,
     UFS_VERSION_MISMATCH,
-    UFS_BAD_CALL,
     UFS_AREA_ALREADY_EXISTS,
-    UFS_OUT_OF_MEMORY,
     UFS_AREA_DOES_NOT_EXIST,
     UFS_FILE_ALREADY_EXISTS,
     UFS_FILE_DOES_NOT_EXIST,
     UFS_MAPPING_ALREADY_EXISTS,
     UFS_CANT_CREATE_FILE,
-    UFS_UNKNOWN_ERROR,
     UFS_IMAGE_TOO_SMALL,
     UFS_IMAGE_COULD_NOT_SYNC,
     UFS_IMAGE_BAD_SIZE,
+    UFS_IMAGE_IS_SEALED,
+    UFS_IMAGE_IS_SNAPSHOT,
+    UFS_SNAPSHOT_DOES_NOT_EXIST,
+    UFS_IMAGE_IS_REPLICA,
+    UFS_STREAM_IS_CORRUPTED,
+    UFS_STREAM_DOES_NOT_APPLY,
+    UFS_REPLICA_DISCONNECTED,
 };
 
-typedef uint8_t ufsStatusType;
-extern ufsStatusType ufsErrno;
-
 enum ufsTyepesEnum {
     UFS_TYPES_FILE = 0,
     UFS_TYPES_AREA,
     UFS_TYPES_NODE,
     UFS_TYPES_STRING,
+    UFS_TYPES_BASE,
+    UFS_TYPES_DATA,
+    UFS_TYPES_EXTENT,
     UFS_TYPES_COUNT,
 };
 
@@ -29,7 +29,7 @@ typedef void *ufsImagePtr;
 *                                                                              *
 *  Possible errors:                                                            *
 *    On error, will return NULL and set ufsErrno to one of the following:      *
-*    * UFS_DOES_NOT_EXIST: Ufs image does not exist( bad filepath... )         *
+*    * UFS_IMAGE_DOES_NOT_EXIST: Ufs image does not exist( bad filepath... )   *
 *    * UFS_IMAGE_TOO_SMALL: The loaded image is too small.                     *
 *                          the check for this is done by checking that it fits *
 *                          the size metadata.                                  *
@@ -44,6 +44,59 @@ typedef void *ufsImagePtr;
 \******************************************************************************/
 ufsImagePtr ufsImageOpen( const char *filePath );
 
+/******************************************************************************\
+* ufsImageOpenReadOnly                                                         *
+*                                                                              *
+*  Opens an existing ufs image for reading only and returns it.                *
+*  The mapping is shared and read only, so every process that opens the same   *
+*  image shares its pages through the page cache.                              *
+*                                                                              *
+*  Possible errors:                                                            *
+*    On error, will return NULL and set ufsErrno to one of the following:      *
+*    * UFS_IMAGE_DOES_NOT_EXIST: Ufs image does not exist( bad filepath... )   *
+*    * UFS_IMAGE_TOO_SMALL: The loaded image is too small.                     *
+*    * UFS_IMAGE_BAD_SIZE: The size metadata does not match the file, since    *
+*                          the image can't be written it can't be fixed up.    *
+*                                                                              *
+*  NOTE: Writing to the returned image is undefined behaviour (SIGSEGV).       *
+*        ufsImageSync has nothing to write back for such images.               *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -filePath: The path of the image file.                                      *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsImagePtr: The opened ufs image.                                         *
+*                                                                              *
+\******************************************************************************/
+ufsImagePtr ufsImageOpenReadOnly( const char *filePath );
+
+/******************************************************************************\
+* ufsImageOpenPrivate                                                          *
+*                                                                              *
+*  Opens an existing ufs image as a private copy on write mapping.             *
+*  Writes stay in this process and are never written back to the file,         *
+*  pages this process did not write keep following the file as others          *
+*  change it.                                                                  *
+*                                                                              *
+*  Possible errors:                                                            *
+*    On error, will return NULL and set ufsErrno to one of the following:      *
+*    * UFS_IMAGE_DOES_NOT_EXIST: Ufs image does not exist( bad filepath... )   *
+*    * UFS_IMAGE_TOO_SMALL: The loaded image is too small.                     *
+*    * UFS_IMAGE_BAD_SIZE: The size metadata does not match the file.          *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -filePath: The path of the image file.                                      *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsImagePtr: The opened ufs image.                                         *
+*                                                                              *
+\******************************************************************************/
+ufsImagePtr ufsImageOpenPrivate( const char *filePath );
+
 /******************************************************************************\
 * ufsImageCreate                                                               *
 *                                                                              *
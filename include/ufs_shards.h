@@ -0,0 +1,73 @@
+/******************************************************************************\
+*  ufs_shards.h                                                                *
+*                                                                              *
+*  Contains the definitions for ufs instances sharded by area.                 *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* A sharded ufs spreads areas, and the mappings they hold, over K images so */
+/* sandboxes writing to different areas don't wait on one image. Directories */
+/* and files live in a shared image, shard 0, an area lives in shard          */
+/* 1 + hash( name ) % K along with its mappings. Every shard is an image of   */
+/* its own with its own allocator, lock and msync.                            */
+/*                                                                            */
+/* Area identifiers carry their shard in their top bits, storage identifiers */
+/* are those of the shared image.                                             */
+/*                                                                            */
+/* Unlike the other backends a sharded ufs may be used by many threads. Each */
+/* shard has a read-write lock, the shared image is locked before any area   */
+/* shard and area shards in increasing order. Adding mappings to areas of     */
+/* different shards runs in parallel, adding or removing storage excludes     */
+/* everything else. Directory listings probe the shards of the view in        */
+/* parallel, a single storage is resolved in view order, which is cheaper     */
+/* than handing the probes to workers.                                        */
+/*                                                                            */
+/* Removing storage first removes its mappings from the area shards, then the */
+/* storage, a crash in between leaves storage that BASE holds, never mappings */
+/* of an identifier that was handed out again.                                */
+/*                                                                            */
+/* This is the "sharded" backend of ufs_backend.h, its options are:          */
+/*   path=<directory>, shards=<K>, threads=<probe workers>                   */
+/*   files=, areas=, nodes=, strbytes=: section sizes of new shards.          */
+/* The number of shards of an existing directory can't change.               */
+
+#ifndef UFS_SHARDS_H
+#define UFS_SHARDS_H
+
+#include <stdint.h>
+#include "ufs.h"
+
+/* Area shards, the shared image is not counted.                             */
+#define UFS_SHARDS_MAX (64)
+#define UFS_SHARDS_DEFAULT (4)
+#define UFS_SHARDS_SHIFT (48)
+
+/******************************************************************************\
+* ufsInitSharded                                                               *
+*                                                                              *
+*  Initialise a ufs over numShards area shards and a shared image, all kept in *
+*  directory. The directory and the images are created if they don't exist.    *
+*  NOTE: this function DOES not mount ufs, it just returns an instance of it.  *
+*                                                                              *
+*  Possible errors:                                                            *
+*   -UFS_BAD_CALL: directory is NULL, numShards is 0 or above UFS_SHARDS_MAX   *
+*                  or directory holds a different number of shards.            *
+*   -UFS_OUT_OF_MEMORY: The system is out of memory and can't create ufs.      *
+*   -UFS_UNKNOWN_ERROR: An image could not be opened or is corrupted.          *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -directory: The directory of the shards.                                    *
+*  -numShards: The number of area shards.                                      *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsType: a new ufs instance, NULL on error.                                *
+*                                                                              *
+\******************************************************************************/
+ufsType ufsInitSharded( const char *directory, uint64_t numShards );
+
+#endif /* UFS_SHARDS_H */
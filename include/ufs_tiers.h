@@ -0,0 +1,81 @@
+/******************************************************************************\
+*  ufs_tiers.h                                                                 *
+*                                                                              *
+*  Contains the definitions for tiered ufs instances.                          *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* A tiered ufs stacks a single read-write image on top of N sealed images.   */
+/* Sealed images are mapped read only and shared, so every daemon that stacks */
+/* the same base image shares its pages through the page cache, the per       */
+/* sandbox image only holds what the sandbox added on top ( its delta ).      */
+/*                                                                            */
+/* Identifiers carry the tier they live in, in their top bits. Tier 0 is the */
+/* read-write image, so its identifiers are plain image identifiers.          */
+/*                                                                            */
+/* Everything added through ufs.h goes to the read-write image, this includes */
+/* files added to directories of sealed images and mappings that add storage  */
+/* to areas of sealed images. Records of sealed images can't be removed.      */
+/* Lookups walk the read-write image first and then the sealed images in the  */
+/* order they were given, views resolve areas in view order as usual, each    */
+/* area answering from the images it lives in.                                */
+/* Top level directory names are resolved by the first tier that has them,   */
+/* sealed images are expected not to share directory names.                  */
+/*                                                                            */
+/* Scratch areas are kept by the instance in memory, a bitmap of the storage  */
+/* of the read-write image and a hash set of the storage of sealed images.    */
+/* Their identifiers carry the tier UFS_TIERS_SCRATCH, which holds no image.  */
+/*                                                                            */
+/* This is the "image" backend of ufs_backend.h, its options are:             */
+/*   path=<read-write image>, sealed=<sealed image> ( repeated, in order )   */
+/*   files=, areas=, nodes=, strbytes=: section sizes of a new image.         */
+/*   inlinebytes=: the bytes of its slots for tiny files, none by default.    */
+/*   extents=: the records of its extent store, none by default.              */
+/*   estimate=<dir>: sizes a new image for the tree under dir, the sizes      */
+/*   above win over it.                                                       */
+
+#ifndef UFS_TIERS_H
+#define UFS_TIERS_H
+
+#include <stdint.h>
+#include "ufs.h"
+
+/* The read-write image counts as a tier.                                    */
+#define UFS_TIERS_MAX (64)
+#define UFS_TIERS_SHIFT (48)
+/* The tier of scratch areas.                                                 */
+#define UFS_TIERS_SCRATCH (UFS_TIERS_MAX)
+
+/******************************************************************************\
+* ufsInitTiered                                                                *
+*                                                                              *
+*  Initialise a ufs over a read-write image and a list of sealed images.       *
+*  The read-write image is created if it does not exist.                       *
+*  NOTE: this function DOES not mount ufs, it just returns an instance of it.  *
+*                                                                              *
+*  Possible errors:                                                            *
+*   -UFS_BAD_CALL: imagePath is NULL, sealedPaths is NULL while numSealed is   *
+*                  not 0, there are too many tiers or a sealed image is not    *
+*                  sealed.                                                     *
+*   -UFS_OUT_OF_MEMORY: The system is out of memory and can't create ufs.      *
+*   -UFS_UNKNOWN_ERROR: An image could not be opened or is corrupted.          *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -imagePath: The path of the read-write image.                               *
+*  -sealedPaths: The paths of the sealed images, in lookup order.              *
+*  -numSealed: The number of sealed images.                                    *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsType: a new ufs instance, NULL on error.                                *
+*                                                                              *
+\******************************************************************************/
+ufsType ufsInitTiered( const char *imagePath,
+                       const char **sealedPaths,
+                       uint64_t numSealed );
+
+#endif /* UFS_TIERS_H */
@@ -0,0 +1,435 @@
+/******************************************************************************\
+*  ufs.c                                                                       *
+*                                                                              *
+*  Contains the definitions of ufs.h, forwarding every call to a backend.      *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ufs.h"
+#include "ufs_backend.h"
+#include "ufs_defs.h"
+
+struct ufsStruct {
+    const struct ufsBackendOps *ops;
+    void *backend;
+};
+
+static const struct ufsBackendOps *registry[ UFS_BACKEND_MAX ] = {
+    &ufsImageBackendOps,
+    &ufsSqliteBackendOps,
+    &ufsLsmBackendOps,
+    &ufsShardedBackendOps,
+};
+static uint64_t registrySize = 4;
+
+static bool isComplete( const struct ufsBackendOps *ops );
+
+ufsType ufsInit()
+{
+    const char *name;
+
+    name = getenv( UFS_BACKEND_ENV );
+    return ufsInitWithBackend( name ? name : UFS_BACKEND_DEFAULT,
+                               getenv( UFS_BACKEND_OPTS_ENV ) );
+}
+
+ufsType ufsInitWithBackend( const char *name, const char *opts )
+{
+    const struct ufsBackendOps *ops;
+    void *backend;
+
+    ops = ufsBackendFind( name );
+    if ( !ops )
+        return NULL;
+
+    backend = ops -> init( opts );
+    if ( !backend )
+        return NULL;
+
+    return ufsBackendWrap( ops, backend );
+}
+
+ufsType ufsBackendWrap( const struct ufsBackendOps *ops, void *backend )
+{
+    struct ufsStruct *ufs;
+
+    if ( !ops || !backend ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    ufs = malloc( sizeof( *ufs ) );
+    if ( !ufs ) {
+        ops -> destroy( backend );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    ufs -> ops = ops;
+    ufs -> backend = backend;
+
+    ufsErrno = UFS_NO_ERROR;
+    return ufs;
+}
+
+ufsStatusType ufsBackendRegister( const struct ufsBackendOps *ops )
+{
+    if ( !ops || !ops -> name || !isComplete( ops ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return ufsErrno;
+    }
+
+    if ( ufsBackendFind( ops -> name ) ) {
+        ufsErrno = UFS_ALREADY_EXISTS;
+        return ufsErrno;
+    }
+
+    if ( registrySize == UFS_BACKEND_MAX ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return ufsErrno;
+    }
+
+    registry[ registrySize++ ] = ops;
+
+    ufsErrno = UFS_NO_ERROR;
+    return ufsErrno;
+}
+
+const struct ufsBackendOps *ufsBackendFind( const char *name )
+{
+    uint64_t i;
+
+    if ( !name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    for ( i = 0; i < registrySize; i++ ) {
+        if ( !strcmp( registry[i] -> name, name ) ) {
+            ufsErrno = UFS_NO_ERROR;
+            return registry[i];
+        }
+    }
+
+    ufsErrno = UFS_DOES_NOT_EXIST;
+    return NULL;
+}
+
+uint64_t ufsBackendCount( void )
+{
+    return registrySize;
+}
+
+const struct ufsBackendOps *ufsBackendGet( uint64_t index )
+{
+    if ( index >= registrySize ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return registry[ index ];
+}
+
+bool ufsBackendOption( const char *opts, const char *key, uint64_t index,
+                       char *buff, uint64_t buffSize )
+{
+    const char *curr, *end, *value;
+    uint64_t keyLen;
+
+    if ( !key || !buff || !buffSize ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    keyLen = strlen( key );
+    for ( curr = opts; curr && *curr; curr = *end ? end + 1 : end ) {
+        end = strchr( curr, ',' );
+        if ( !end )
+            end = curr + strlen( curr );
+
+        if ( (uint64_t) ( end - curr ) <= keyLen ||
+             strncmp( curr, key, keyLen ) || curr[ keyLen ] != '=' )
+            continue;
+
+        if ( index-- )
+            continue;
+
+        value = curr + keyLen + 1;
+        if ( (uint64_t) ( end - value ) >= buffSize ) {
+            ufsErrno = UFS_BAD_CALL;
+            return false;
+        }
+
+        memcpy( buff, value, end - value );
+        buff[ end - value ] = '\0';
+
+        ufsErrno = UFS_NO_ERROR;
+        return true;
+    }
+
+    ufsErrno = UFS_DOES_NOT_EXIST;
+    return false;
+}
+
+void ufsDestroy( ufsType ufs )
+{
+    struct ufsStruct *self;
+
+    if ( !ufs )
+        return;
+
+    self = ufs;
+    self -> ops -> destroy( self -> backend );
+    free( self );
+}
+
+ufsIdentifierType ufsAddDirectory( ufsType ufs,
+                                   const char *name )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    return self -> ops -> addDirectory( self -> backend, name );
+}
+
+ufsIdentifierType ufsAddFile( ufsType ufs,
+                              ufsIdentifierType directory,
+                              const char *name )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    return self -> ops -> addFile( self -> backend, directory, name );
+}
+
+ufsIdentifierType ufsAddArea( ufsType ufs,
+                              const char *name )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    return self -> ops -> addArea( self -> backend, name );
+}
+
+ufsIdentifierType ufsGetDirectory( ufsType ufs,
+                                   const char *name )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    return self -> ops -> getDirectory( self -> backend, name );
+}
+
+ufsIdentifierType ufsGetFile( ufsType ufs,
+                              ufsIdentifierType directory,
+                              char *name )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    return self -> ops -> getFile( self -> backend, directory, name );
+}
+
+ufsIdentifierType ufsGetArea( ufsType ufs,
+                              const char *name )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    return self -> ops -> getArea( self -> backend, name );
+}
+
+ufsStatusType ufsRemoveDirectory( ufsType ufs,
+                                  ufsIdentifierType directory )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return ufsErrno;
+    }
+
+    return self -> ops -> removeDirectory( self -> backend, directory );
+}
+
+ufsStatusType ufsRemoveFile( ufsType ufs,
+                             ufsIdentifierType file )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return ufsErrno;
+    }
+
+    return self -> ops -> removeFile( self -> backend, file );
+}
+
+ufsStatusType ufsRemoveArea( ufsType ufs,
+                             ufsIdentifierType area )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return ufsErrno;
+    }
+
+    return self -> ops -> removeArea( self -> backend, area );
+}
+
+ufsStatusType ufsAddMapping( ufsType ufs,
+                             ufsIdentifierType area,
+                             ufsIdentifierType storage )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return ufsErrno;
+    }
+
+    return self -> ops -> addMapping( self -> backend, area, storage );
+}
+
+ufsStatusType ufsProbeMapping( ufsType ufs,
+                               ufsIdentifierType area,
+                               ufsIdentifierType storage )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return ufsErrno;
+    }
+
+    return self -> ops -> probeMapping( self -> backend, area, storage );
+}
+
+ufsIdentifierType ufsResolveStorageInView( ufsType ufs,
+                                           ufsViewType view,
+                                           ufsIdentifierType storage )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    return self -> ops -> resolveStorageInView( self -> backend, view,
+                                                storage );
+}
+
+ufsStatusType ufsIterateDirInView( ufsType ufs,
+                                   ufsViewType view,
+                                   ufsIdentifierType directory,
+                                   ufsDirIter iterator,
+                                   void *userData )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return ufsErrno;
+    }
+
+    return self -> ops -> iterateDirInView( self -> backend, view, directory,
+                                            iterator, userData );
+}
+
+ufsStatusType ufsCollapse( ufsType ufs,
+                           ufsViewType view )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self ) {
+        ufsErrno = UFS_BAD_CALL;
+        return ufsErrno;
+    }
+
+    return self -> ops -> collapse( self -> backend, view );
+}
+
+ufsIdentifierType ufsAddScratchArea( ufsType ufs,
+                                     const char *name )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self || !self -> ops -> addScratchArea ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    return self -> ops -> addScratchArea( self -> backend, name );
+}
+
+ufsIdentifierType ufsPersistArea( ufsType ufs,
+                                  ufsIdentifierType area )
+{
+    struct ufsStruct *self;
+
+    self = ufs;
+    if ( !self || !self -> ops -> persistArea ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    return self -> ops -> persistArea( self -> backend, area );
+}
+
+static bool isComplete( const struct ufsBackendOps *ops )
+{
+    return ops -> init && ops -> destroy && ops -> addDirectory &&
+           ops -> addFile && ops -> addArea && ops -> getDirectory &&
+           ops -> getFile && ops -> getArea && ops -> removeDirectory &&
+           ops -> removeFile && ops -> removeArea && ops -> addMapping &&
+           ops -> probeMapping && ops -> resolveStorageInView &&
+           ops -> iterateDirInView && ops -> collapse;
+}
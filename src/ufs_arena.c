@@ -0,0 +1,399 @@
+/******************************************************************************\
+*  ufs_arena.c                                                                 *
+*                                                                              *
+*  Contains the definitions for arenas and slabs.                              *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ufs_arena.h"
+#include "ufs_defs.h"
+
+#define ROUND_UP( size ) \
+    ( ( (size) + UFS_ARENA_ALIGN - 1 ) & ~(uint64_t) ( UFS_ARENA_ALIGN - 1 ) )
+#define NO_LAST (UINT64_MAX)
+
+/* A block header, its data follows it.                                       */
+struct blockStruct {
+    struct blockStruct *next;
+    uint64_t size;
+};
+
+struct ufsArenaStruct {
+    /* Blocks past current are free, the first block is never freed before    */
+    /* the arena.                                                             */
+    struct blockStruct *first,
+                       *current;
+    uint64_t used;
+    /* Offset of the last allocation in current, NO_LAST if it's unknown.     */
+    uint64_t last;
+    uint64_t blockBytes,
+             bytes;
+};
+
+/* A chunk header, chunks are aligned to their size so an item finds its      */
+/* chunk by masking its address.                                              */
+struct chunkStruct {
+    struct chunkStruct *next;
+    uint64_t live;
+};
+
+struct freeItemStruct {
+    struct freeItemStruct *next;
+};
+
+struct ufsSlabStruct {
+    struct chunkStruct *chunks;
+    struct freeItemStruct *free;
+    /* Items of the newest chunk never handed out.                            */
+    uint8_t *fresh,
+            *freshEnd;
+    uint64_t itemSize,
+             bytes;
+};
+
+static struct blockStruct *newBlock( ufsArenaPtr arena, uint64_t size );
+static void *blockData( struct blockStruct *block );
+static void freeThreadArena( void *arena );
+static void createThreadKey( void );
+static struct chunkStruct *chunkOf( void *item );
+
+static pthread_key_t threadKey;
+static pthread_once_t threadKeyOnce = PTHREAD_ONCE_INIT;
+static _Thread_local ufsArenaPtr threadArena;
+
+ufsArenaPtr ufsArenaCreate( uint64_t blockBytes )
+{
+    struct ufsArenaStruct *arena;
+
+    if ( blockBytes < UFS_ARENA_ALIGN ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    arena = calloc( 1, sizeof( *arena ) );
+    if ( !arena ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    arena -> blockBytes = ROUND_UP( blockBytes );
+    arena -> first = newBlock( arena, arena -> blockBytes );
+    if ( !arena -> first ) {
+        free( arena );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    arena -> current = arena -> first;
+    arena -> last = NO_LAST;
+
+    ufsErrno = UFS_NO_ERROR;
+    return arena;
+}
+
+void ufsArenaFree( ufsArenaPtr arena )
+{
+    struct blockStruct *block, *next;
+
+    if ( !arena )
+        return;
+
+    for ( block = arena -> first; block; block = next ) {
+        next = block -> next;
+        free( block );
+    }
+
+    free( arena );
+}
+
+ufsArenaPtr ufsArenaThread( void )
+{
+    if ( threadArena )
+        return threadArena;
+
+    pthread_once( &threadKeyOnce, createThreadKey );
+    threadArena = ufsArenaCreate( UFS_ARENA_BLOCK_BYTES );
+    if ( threadArena )
+        pthread_setspecific( threadKey, threadArena );
+
+    return threadArena;
+}
+
+/* The next free block is used when it is large enough, otherwise a new one   */
+/* goes in front of it, so a request needing an oversized block keeps it      */
+/* for the requests after it.                                                 */
+void *ufsArenaAlloc( ufsArenaPtr arena, uint64_t size )
+{
+    struct blockStruct *block;
+
+    if ( !arena ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    size = ROUND_UP( size );
+    if ( size > arena -> current -> size - arena -> used ) {
+        block = arena -> current -> next;
+        if ( !block || block -> size < size ) {
+            block = newBlock( arena, size > arena -> blockBytes ?
+                                     size : arena -> blockBytes );
+            if ( !block ) {
+                ufsErrno = UFS_OUT_OF_MEMORY;
+                return NULL;
+            }
+
+            block -> next = arena -> current -> next;
+            arena -> current -> next = block;
+        }
+
+        arena -> current = block;
+        arena -> used = 0;
+    }
+
+    arena -> last = arena -> used;
+    arena -> used += size;
+    return (uint8_t*)blockData( arena -> current ) + arena -> last;
+}
+
+void *ufsArenaGrow( ufsArenaPtr arena, void *ptr, uint64_t oldSize,
+                    uint64_t newSize )
+{
+    uint8_t *grown;
+
+    if ( !arena || newSize < oldSize ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    if ( !ptr )
+        return ufsArenaAlloc( arena, newSize );
+
+    if ( arena -> last != NO_LAST &&
+         ptr == (uint8_t*)blockData( arena -> current ) + arena -> last &&
+         ROUND_UP( newSize ) <= arena -> current -> size - arena -> last ) {
+        arena -> used = arena -> last + ROUND_UP( newSize );
+        return ptr;
+    }
+
+    grown = ufsArenaAlloc( arena, newSize );
+    if ( !grown )
+        return NULL;
+
+    memcpy( grown, ptr, oldSize );
+    return grown;
+}
+
+struct ufsArenaMarkStruct ufsArenaSave( ufsArenaPtr arena )
+{
+    return (struct ufsArenaMarkStruct) {
+        .block = arena -> current,
+        .used = arena -> used
+    };
+}
+
+void ufsArenaRestore( ufsArenaPtr arena, struct ufsArenaMarkStruct mark )
+{
+    arena -> current = mark.block;
+    arena -> used = mark.used;
+    arena -> last = NO_LAST;
+}
+
+void ufsArenaReset( ufsArenaPtr arena )
+{
+    arena -> current = arena -> first;
+    arena -> used = 0;
+    arena -> last = NO_LAST;
+}
+
+uint64_t ufsArenaTrim( ufsArenaPtr arena )
+{
+    struct blockStruct *block, *next;
+    uint64_t freed;
+
+    ufsArenaReset( arena );
+
+    freed = 0;
+    for ( block = arena -> first -> next; block; block = next ) {
+        next = block -> next;
+        freed += ROUND_UP( sizeof( *block ) ) + block -> size;
+        free( block );
+    }
+
+    arena -> first -> next = NULL;
+    arena -> bytes -= freed;
+    return freed;
+}
+
+uint64_t ufsArenaBytes( ufsArenaPtr arena )
+{
+    return arena ? arena -> bytes : 0;
+}
+
+ufsSlabPtr ufsSlabCreate( uint64_t itemSize )
+{
+    struct ufsSlabStruct *slab;
+
+    if ( !itemSize || itemSize > UFS_SLAB_CHUNK_BYTES / 2 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    slab = calloc( 1, sizeof( *slab ) );
+    if ( !slab ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    slab -> itemSize = ROUND_UP( itemSize );
+
+    ufsErrno = UFS_NO_ERROR;
+    return slab;
+}
+
+void ufsSlabDestroy( ufsSlabPtr slab )
+{
+    struct chunkStruct *chunk, *next;
+
+    if ( !slab )
+        return;
+
+    for ( chunk = slab -> chunks; chunk; chunk = next ) {
+        next = chunk -> next;
+        free( chunk );
+    }
+
+    free( slab );
+}
+
+void *ufsSlabAlloc( ufsSlabPtr slab )
+{
+    struct chunkStruct *chunk;
+    void *item;
+
+    if ( !slab ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    if ( slab -> free ) {
+        item = slab -> free;
+        slab -> free = slab -> free -> next;
+        chunkOf( item ) -> live++;
+        return item;
+    }
+
+    if ( (uint64_t) ( slab -> freshEnd - slab -> fresh ) <
+         slab -> itemSize ) {
+        chunk = aligned_alloc( UFS_SLAB_CHUNK_BYTES, UFS_SLAB_CHUNK_BYTES );
+        if ( !chunk ) {
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return NULL;
+        }
+
+        chunk -> next = slab -> chunks;
+        chunk -> live = 0;
+        slab -> chunks = chunk;
+        slab -> fresh = (uint8_t*)chunk + ROUND_UP( sizeof( *chunk ) );
+        slab -> freshEnd = (uint8_t*)chunk + UFS_SLAB_CHUNK_BYTES;
+        slab -> bytes += UFS_SLAB_CHUNK_BYTES;
+    }
+
+    item = slab -> fresh;
+    slab -> fresh += slab -> itemSize;
+    chunkOf( item ) -> live++;
+    return item;
+}
+
+void ufsSlabFree( ufsSlabPtr slab, void *item )
+{
+    struct freeItemStruct *entry;
+
+    if ( !slab || !item )
+        return;
+
+    entry = item;
+    entry -> next = slab -> free;
+    slab -> free = entry;
+    chunkOf( item ) -> live--;
+}
+
+uint64_t ufsSlabTrim( ufsSlabPtr slab )
+{
+    struct chunkStruct **chunk, *dead;
+    struct freeItemStruct **entry;
+    uint64_t freed;
+
+    /* Free items of empty chunks leave the free list first.                  */
+    for ( entry = &slab -> free; *entry; ) {
+        if ( !chunkOf( *entry ) -> live )
+            *entry = ( *entry ) -> next;
+        else
+            entry = &( *entry ) -> next;
+    }
+
+    freed = 0;
+    for ( chunk = &slab -> chunks; *chunk; ) {
+        if ( ( *chunk ) -> live ) {
+            chunk = &( *chunk ) -> next;
+            continue;
+        }
+
+        dead = *chunk;
+        *chunk = dead -> next;
+        if ( slab -> fresh && chunkOf( slab -> fresh ) == dead )
+            slab -> fresh = slab -> freshEnd = NULL;
+
+        free( dead );
+        freed += UFS_SLAB_CHUNK_BYTES;
+    }
+
+    slab -> bytes -= freed;
+    return freed;
+}
+
+uint64_t ufsSlabBytes( ufsSlabPtr slab )
+{
+    return slab ? slab -> bytes : 0;
+}
+
+static struct blockStruct *newBlock( ufsArenaPtr arena, uint64_t size )
+{
+    struct blockStruct *block;
+
+    block = malloc( ROUND_UP( sizeof( *block ) ) + size );
+    if ( !block )
+        return NULL;
+
+    block -> next = NULL;
+    block -> size = size;
+    arena -> bytes += ROUND_UP( sizeof( *block ) ) + size;
+    return block;
+}
+
+static void *blockData( struct blockStruct *block )
+{
+    return (uint8_t*)block + ROUND_UP( sizeof( *block ) );
+}
+
+static void freeThreadArena( void *arena )
+{
+    ufsArenaFree( arena );
+}
+
+static void createThreadKey( void )
+{
+    pthread_key_create( &threadKey, freeThreadArena );
+}
+
+static struct chunkStruct *chunkOf( void *item )
+{
+    return (struct chunkStruct*)( (uintptr_t) item &
+                                  ~(uintptr_t) ( UFS_SLAB_CHUNK_BYTES - 1 ) );
+}
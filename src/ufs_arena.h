@@ -0,0 +1,314 @@
+/******************************************************************************\
+*  ufs_arena.h                                                                 *
+*                                                                              *
+*  Internal header for arenas and slabs, allocators of transient memory.       *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* An arena hands out memory by bumping a pointer through a chain of blocks,  */
+/* nothing is freed on its own. A request saves a mark when it starts and     */
+/* restores it when it ends, which releases everything allocated since in     */
+/* O(1). Blocks are kept for the next request, so once an arena has grown to  */
+/* what its requests need it stops calling malloc. ufsArenaTrim hands back    */
+/* the blocks past the first.                                                 */
+/*                                                                            */
+/* Each thread has an arena of its own, ufsArenaThread, freed when the        */
+/* thread exits. Marks nest, a call may save and restore a mark while its     */
+/* caller holds an older one, as long as they are restored in reverse order.  */
+/*                                                                            */
+/* A slab hands out items of one size from chunks of many items and takes     */
+/* them back on a free list, for the nodes of in memory caches. Items are     */
+/* never returned to malloc before the slab is destroyed or trimmed, so the   */
+/* memory a slab holds is bounded by its peak number of live items.           */
+/*                                                                            */
+/* Neither is thread safe, an arena belongs to one thread and a slab is       */
+/* guarded by the lock of its cache.                                          */
+
+#ifndef UFS_ARENA_H
+#define UFS_ARENA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define UFS_ARENA_ALIGN (16)
+#define UFS_ARENA_BLOCK_BYTES (64 * 1024)
+#define UFS_SLAB_CHUNK_BYTES (64 * 1024)
+
+typedef struct ufsArenaStruct *ufsArenaPtr;
+typedef struct ufsSlabStruct *ufsSlabPtr;
+
+/* Where an arena was, restoring it frees what was allocated after.           */
+struct ufsArenaMarkStruct {
+    void *block;
+    uint64_t used;
+};
+
+/******************************************************************************\
+* ufsArenaCreate                                                               *
+*                                                                              *
+*  Creates an empty arena, its blocks are blockBytes unless an allocation      *
+*  needs more.                                                                 *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: blockBytes is below UFS_ARENA_ALIGN.                         *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -blockBytes: The size of a block.                                           *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsArenaPtr: The arena, NULL on error.                                     *
+*                                                                              *
+\******************************************************************************/
+ufsArenaPtr ufsArenaCreate( uint64_t blockBytes );
+
+/******************************************************************************\
+* ufsArenaFree                                                                 *
+*                                                                              *
+*  Frees arena and every block it holds.                                       *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -arena: The arena, may be NULL.                                             *
+*                                                                              *
+\******************************************************************************/
+void ufsArenaFree( ufsArenaPtr arena );
+
+/******************************************************************************\
+* ufsArenaThread                                                               *
+*                                                                              *
+*  Gets the arena of the calling thread, created on first use.                 *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsArenaPtr: The arena, NULL on error.                                     *
+*                                                                              *
+\******************************************************************************/
+ufsArenaPtr ufsArenaThread( void );
+
+/******************************************************************************\
+* ufsArenaAlloc                                                                *
+*                                                                              *
+*  Allocates size bytes aligned to UFS_ARENA_ALIGN, valid until a mark saved   *
+*  before is restored or the arena is reset.                                   *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: arena is NULL.                                               *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -arena: The arena.                                                          *
+*  -size: The number of bytes, 0 gives a valid pointer to no bytes.            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -void*: The memory, NULL on error.                                          *
+*                                                                              *
+\******************************************************************************/
+void *ufsArenaAlloc( ufsArenaPtr arena, uint64_t size );
+
+/******************************************************************************\
+* ufsArenaGrow                                                                 *
+*                                                                              *
+*  Grows an allocation of arena to newSize bytes, in place when it is the      *
+*  last one and its block has room, otherwise by copying it.                   *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: arena is NULL or newSize is below oldSize.                   *
+*   UFS_OUT_OF_MEMORY: The system is out of memory, ptr is left as it was.     *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -arena: The arena.                                                          *
+*  -ptr: The allocation, NULL to allocate.                                     *
+*  -oldSize: The size it was allocated or last grown with.                     *
+*  -newSize: The size it needs.                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -void*: The grown allocation, NULL on error.                                *
+*                                                                              *
+\******************************************************************************/
+void *ufsArenaGrow( ufsArenaPtr arena, void *ptr, uint64_t oldSize,
+                    uint64_t newSize );
+
+/******************************************************************************\
+* ufsArenaSave                                                                 *
+*                                                                              *
+*  Saves where arena is.                                                       *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -arena: The arena, not NULL.                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -struct ufsArenaMarkStruct: The mark.                                       *
+*                                                                              *
+\******************************************************************************/
+struct ufsArenaMarkStruct ufsArenaSave( ufsArenaPtr arena );
+
+/******************************************************************************\
+* ufsArenaRestore                                                              *
+*                                                                              *
+*  Frees everything allocated since mark was saved, in O(1).                   *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -arena: The arena, not NULL.                                                *
+*  -mark: A mark of arena not restored past yet.                               *
+*                                                                              *
+\******************************************************************************/
+void ufsArenaRestore( ufsArenaPtr arena, struct ufsArenaMarkStruct mark );
+
+/******************************************************************************\
+* ufsArenaReset                                                                *
+*                                                                              *
+*  Frees everything allocated from arena, in O(1). The blocks are kept.        *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -arena: The arena, not NULL.                                                *
+*                                                                              *
+\******************************************************************************/
+void ufsArenaReset( ufsArenaPtr arena );
+
+/******************************************************************************\
+* ufsArenaTrim                                                                 *
+*                                                                              *
+*  Resets arena and frees every block but the first.                           *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -arena: The arena, not NULL.                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The number of bytes freed.                                       *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsArenaTrim( ufsArenaPtr arena );
+
+/******************************************************************************\
+* ufsArenaBytes                                                                *
+*                                                                              *
+*  Gets the bytes of the blocks arena holds, used or not.                      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -arena: The arena.                                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The number of bytes, 0 if arena is NULL.                         *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsArenaBytes( ufsArenaPtr arena );
+
+/******************************************************************************\
+* ufsSlabCreate                                                                *
+*                                                                              *
+*  Creates a slab of items of itemSize bytes.                                  *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: itemSize is 0 or above UFS_SLAB_CHUNK_BYTES / 2.             *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -itemSize: The size of an item.                                             *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsSlabPtr: The slab, NULL on error.                                       *
+*                                                                              *
+\******************************************************************************/
+ufsSlabPtr ufsSlabCreate( uint64_t itemSize );
+
+/******************************************************************************\
+* ufsSlabDestroy                                                               *
+*                                                                              *
+*  Frees slab along with every item, live or not.                              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -slab: The slab, may be NULL.                                               *
+*                                                                              *
+\******************************************************************************/
+void ufsSlabDestroy( ufsSlabPtr slab );
+
+/******************************************************************************\
+* ufsSlabAlloc                                                                 *
+*                                                                              *
+*  Allocates an item aligned to UFS_ARENA_ALIGN, its bytes are undefined.      *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: slab is NULL.                                                *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -slab: The slab.                                                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -void*: The item, NULL on error.                                            *
+*                                                                              *
+\******************************************************************************/
+void *ufsSlabAlloc( ufsSlabPtr slab );
+
+/******************************************************************************\
+* ufsSlabFree                                                                  *
+*                                                                              *
+*  Gives an item back to slab.                                                 *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -slab: The slab the item came from.                                         *
+*  -item: The item, may be NULL.                                               *
+*                                                                              *
+\******************************************************************************/
+void ufsSlabFree( ufsSlabPtr slab, void *item );
+
+/******************************************************************************\
+* ufsSlabTrim                                                                  *
+*                                                                              *
+*  Frees the chunks that hold no live item.                                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -slab: The slab, not NULL.                                                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The number of bytes freed.                                       *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsSlabTrim( ufsSlabPtr slab );
+
+/******************************************************************************\
+* ufsSlabBytes                                                                 *
+*                                                                              *
+*  Gets the bytes of the chunks slab holds, used or not.                       *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -slab: The slab.                                                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The number of bytes, 0 if slab is NULL.                          *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsSlabBytes( ufsSlabPtr slab );
+
+#endif /* UFS_ARENA_H */
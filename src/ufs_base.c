@@ -0,0 +1,1673 @@
+/******************************************************************************\
+*  ufs_base.c                                                                  *
+*                                                                              *
+*  Contains the definitions for access to the external fs BASE refers to.      *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <linux/openat2.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "ufs_base.h"
+#include "ufs_base_index.h"
+#include "ufs_budget.h"
+#include "ufs_defs.h"
+#include "ufs_hash.h"
+#include "ufs_store.h"
+#include "ufs_uring.h"
+#include <unistd.h>
+
+#define WATCH_MASK ( IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF |     \
+                     IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | \
+                     IN_ONLYDIR )
+#define STATX_FIELDS ( STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE |     \
+                       STATX_MTIME | STATX_CTIME )
+#define EVENT_BUFFER_BYTES (16 * 1024)
+#define INITIAL_BUCKETS (64)
+#define HANDLE_FLAGS ( O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC )
+#define DIRENT_BYTES (32 * 1024)
+/* Records are 8 byte aligned and hold at least a name and its NUL.           */
+#define MAX_DIRENTS ( DIRENT_BYTES /                                          \
+                      ( ( offsetof( struct direntStruct, name ) + 2 + 7 ) &   \
+                        ~(size_t) 7 ) )
+
+struct entryStruct {
+    /* Chain of the bucket.                                                   */
+    struct entryStruct *next;
+    /* Entries of the same directory.                                         */
+    struct entryStruct *dirPrev,
+                       *dirNext;
+    struct dirStruct *dir;
+    uint64_t hash;
+    bool missing;
+    struct ufsBaseAttrStruct attr;
+    char name[];
+};
+
+struct dirStruct {
+    /* Chains of the buckets by path and by watch.                            */
+    struct dirStruct *next,
+                     *wdNext;
+    struct dirStruct *lruPrev,
+                     *lruNext;
+    struct dirStruct *parent,
+                     *children,
+                     *siblingPrev,
+                     *siblingNext;
+    struct entryStruct *entries;
+    uint64_t hash;
+    /* Seeds the hashes of the entries.                                       */
+    uint64_t serial;
+    /* Changes on every event about the directory, lookups only cache what    */
+    /* they found if it didn't change meanwhile.                              */
+    uint64_t generation;
+    int wd;
+    char path[];
+};
+
+/* What getdents64 fills the buffer with.                                     */
+struct direntStruct {
+    uint64_t ino;
+    int64_t off;
+    unsigned short reclen;
+    unsigned char type;
+    char name[];
+};
+
+/* Whether lookups in a directory can be answered from the BASE index.        */
+enum indexStateEnum {
+    INDEX_UNCHECKED = 0,
+    INDEX_CLEAN,
+    INDEX_DIRTY
+};
+
+struct handleStruct {
+    struct handleStruct *next;
+    struct handleStruct *lruPrev,
+                        *lruNext;
+    ufsIdType dir;
+    int fd;
+    /* Users of the handle, it's only closed when it has none.                */
+    uint64_t refs;
+    /* Handles that didn't fit are closed by their last user.                 */
+    bool cached;
+    enum indexStateEnum index;
+};
+
+/* The entries of a directory being refreshed, identifiers of those seen are  */
+/* sorted once it's read.                                                     */
+struct refreshStruct {
+    ufsImagePtr img;
+    ufsIdType dir;
+    ufsIdType *seen;
+    uint64_t numSeen,
+             capacity;
+};
+
+struct ufsBaseStruct {
+    int rootFd;
+    char *rootPath;
+    uint64_t maxWatches;
+
+    pthread_mutex_t lock;
+    /* By path and by watch, both have dirCapacity buckets.                   */
+    struct dirStruct **dirs,
+                     **wds;
+    uint64_t dirCapacity,
+             numDirs;
+    struct entryStruct **entries;
+    uint64_t entryCapacity,
+             numEntries;
+    /* Most recently used first.                                              */
+    struct dirStruct *lruHead,
+                     *lruTail;
+    uint64_t serial;
+    struct ufsBaseStatsStruct stats;
+
+    int inotifyFd;
+    /* Written to stop the monitor, read end first.                           */
+    int wake[2];
+    pthread_t monitor;
+    bool watching;
+
+    ufsBudgetPtr budget;
+    int64_t budgetId;
+
+    /* Directory handles by storage, with maxHandles buckets rounded up.      */
+    ufsImagePtr img;
+    struct handleStruct root;
+    struct handleStruct **handles;
+    uint64_t handleCapacity,
+             maxHandles;
+    /* Most recently used first, root isn't in it.                            */
+    struct handleStruct *handleHead,
+                        *handleTail;
+    bool openat2;
+    ufsUringPtr ring;
+};
+
+static bool validDir( const char *dir );
+static bool validName( const char *name );
+static struct dirStruct *findDir( struct ufsBaseStruct *base,
+                                  const char *path, uint64_t hash );
+static struct dirStruct *findWd( struct ufsBaseStruct *base, int wd );
+static struct entryStruct *findEntry( struct ufsBaseStruct *base,
+                                      struct dirStruct *dir,
+                                      const char *name, uint64_t hash );
+static struct dirStruct *watchDir( struct ufsBaseStruct *base,
+                                   const char *path, bool *missing );
+static void addEntry( struct ufsBaseStruct *base, struct dirStruct *dir,
+                      const char *name, bool missing,
+                      const struct ufsBaseAttrStruct *attr );
+static void dropEntry( struct ufsBaseStruct *base, struct entryStruct *entry );
+static void dropDir( struct ufsBaseStruct *base, struct dirStruct *dir );
+static void dropAll( struct ufsBaseStruct *base );
+static void dropParentEntry( struct ufsBaseStruct *base,
+                             struct dirStruct *dir );
+static bool evictDir( struct ufsBaseStruct *base, struct dirStruct *keep );
+static void touchDir( struct ufsBaseStruct *base, struct dirStruct *dir );
+static bool growDirs( struct ufsBaseStruct *base );
+static bool growEntries( struct ufsBaseStruct *base );
+static char *joinPath( const char *dir, const char *name );
+static ufsStatusType statEntry( struct ufsBaseStruct *base, const char *dir,
+                                const char *name,
+                                struct ufsBaseAttrStruct *attr );
+static ufsStatusType statAt( int fd, const char *path,
+                             struct ufsBaseAttrStruct *attr );
+static ufsStatusType errnoStatus( int error );
+static void fillAttr( struct ufsBaseAttrStruct *attr,
+                      const struct statx *stx );
+static bool runBatch( struct ufsBaseStruct *base, int dirFd,
+                      const char *const *names, uint64_t numNames,
+                      int flags, struct ufsBaseAttrStruct *attrs, int *fds,
+                      ufsStatusType *statuses );
+static struct handleStruct *getHandle( struct ufsBaseStruct *base,
+                                       ufsIdType dir, ufsStatusType *status );
+static void releaseHandle( struct ufsBaseStruct *base,
+                           struct handleStruct *handle );
+static void closeHandle( struct ufsBaseStruct *base,
+                         struct handleStruct *handle );
+static int openBeneath( struct ufsBaseStruct *base, int dirFd,
+                        const char *name, int flags );
+static bool isClean( struct ufsBaseStruct *base,
+                     struct handleStruct *handle );
+static ufsStatusType indexLookup( struct ufsBaseStruct *base, ufsIdType dir,
+                                  const char *name,
+                                  struct ufsBaseAttrStruct *attr );
+static bool refreshEntries( const char *const *names,
+                            const struct ufsBaseAttrStruct *attrs,
+                            uint64_t numEntries, void *userData );
+static bool forgetUnseen( ufsIdType id, void *userData );
+static int compareIds( const void *a, const void *b );
+static void handleEvent( struct ufsBaseStruct *base,
+                         const struct inotify_event *event );
+static void *monitor( void *arg );
+static uint64_t shrinkBase( void *cache, uint64_t bytes );
+
+ufsBasePtr ufsBaseOpen( const char *root, uint64_t maxWatches )
+{
+    struct ufsBaseStruct *base;
+
+    if ( !root ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    base = calloc( 1, sizeof( *base ) );
+    if ( !base ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    base -> inotifyFd = base -> wake[0] = base -> wake[1] = -1;
+    base -> budgetId = -1;
+    base -> maxWatches = maxWatches ? maxWatches : UFS_BASE_MAX_WATCHES;
+    base -> dirCapacity = base -> entryCapacity = INITIAL_BUCKETS;
+    base -> dirs = calloc( INITIAL_BUCKETS, sizeof( *base -> dirs ) );
+    base -> wds = calloc( INITIAL_BUCKETS, sizeof( *base -> wds ) );
+    base -> entries = calloc( INITIAL_BUCKETS, sizeof( *base -> entries ) );
+    base -> rootPath = realpath( root, NULL );
+    if ( !base -> dirs || !base -> wds || !base -> entries ||
+         !base -> rootPath ) {
+        ufsErrno = base -> rootPath || errno == ENOMEM ? UFS_OUT_OF_MEMORY :
+                                                         UFS_DOES_NOT_EXIST;
+        goto fail;
+    }
+
+    base -> rootFd = open( base -> rootPath, O_RDONLY | O_DIRECTORY |
+                                             O_CLOEXEC );
+    if ( base -> rootFd < 0 ) {
+        ufsErrno = errno == ENOMEM ? UFS_OUT_OF_MEMORY : UFS_DOES_NOT_EXIST;
+        goto fail;
+    }
+
+    pthread_mutex_init( &base -> lock, NULL );
+
+    /* Without inotify or the monitor nothing is cached.                      */
+    base -> inotifyFd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+    if ( base -> inotifyFd >= 0 &&
+         !pipe2( base -> wake, O_NONBLOCK | O_CLOEXEC ) )
+        base -> watching = !pthread_create( &base -> monitor, NULL, monitor,
+                                            base );
+
+    if ( !base -> watching ) {
+        if ( base -> inotifyFd >= 0 )
+            close( base -> inotifyFd );
+        if ( base -> wake[0] >= 0 ) {
+            close( base -> wake[0] );
+            close( base -> wake[1] );
+        }
+        base -> inotifyFd = base -> wake[0] = base -> wake[1] = -1;
+    }
+
+    base -> budget = ufsBudgetGlobal();
+    if ( base -> budget )
+        base -> budgetId = ufsBudgetRegister( base -> budget, "base cache",
+                                              shrinkBase, base );
+
+    ufsErrno = UFS_NO_ERROR;
+    return base;
+
+fail:
+    free( base -> rootPath );
+    free( base -> entries );
+    free( base -> wds );
+    free( base -> dirs );
+    free( base );
+    return NULL;
+}
+
+void ufsBaseClose( ufsBasePtr base )
+{
+    ssize_t ret;
+
+    if ( !base )
+        return;
+
+    /* Waits for a shrink, none starts after.                                 */
+    ufsBudgetUnregister( base -> budget, base -> budgetId );
+
+    if ( base -> watching ) {
+        ret = write( base -> wake[1], "", 1 );
+        (void) ret;
+        pthread_join( base -> monitor, NULL );
+        close( base -> wake[0] );
+        close( base -> wake[1] );
+    }
+
+    base -> budget = NULL;
+    dropAll( base );
+    if ( base -> img )
+        ufsBaseDropHandles( base );
+    ufsUringFree( base -> ring );
+    if ( base -> inotifyFd >= 0 )
+        close( base -> inotifyFd );
+
+    close( base -> rootFd );
+    pthread_mutex_destroy( &base -> lock );
+    free( base -> handles );
+    free( base -> rootPath );
+    free( base -> entries );
+    free( base -> wds );
+    free( base -> dirs );
+    free( base );
+}
+
+bool ufsBaseLookup( ufsBasePtr base, const char *dir, const char *name,
+                    struct ufsBaseAttrStruct *attr )
+{
+    struct ufsBaseAttrStruct found;
+    struct entryStruct *entry;
+    struct dirStruct *node;
+    ufsStatusType status;
+    uint64_t hash, generation;
+    bool missing;
+
+    if ( !dir )
+        dir = "";
+
+    if ( !base || !validDir( dir ) || !validName( name ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    node = NULL;
+    generation = 0;
+    hash = ufsHashString( dir, 0 );
+    pthread_mutex_lock( &base -> lock );
+    if ( base -> watching ) {
+        missing = false;
+        node = findDir( base, dir, hash );
+        if ( !node )
+            node = watchDir( base, dir, &missing );
+
+        if ( missing ) {
+            base -> stats.misses++;
+            pthread_mutex_unlock( &base -> lock );
+            ufsErrno = UFS_DOES_NOT_EXIST;
+            return false;
+        }
+    }
+
+    if ( node ) {
+        touchDir( base, node );
+        entry = findEntry( base, node, name,
+                           ufsHashString( name, node -> serial ) );
+        if ( entry ) {
+            base -> stats.hits++;
+            found = entry -> attr;
+            missing = entry -> missing;
+            pthread_mutex_unlock( &base -> lock );
+
+            if ( attr && !missing )
+                *attr = found;
+            ufsErrno = missing ? UFS_DOES_NOT_EXIST : UFS_NO_ERROR;
+            return !missing;
+        }
+        generation = node -> generation;
+    }
+    base -> stats.misses++;
+    pthread_mutex_unlock( &base -> lock );
+
+    status = statEntry( base, dir, name, &found );
+    if ( node && ( status == UFS_NO_ERROR ||
+                   status == UFS_DOES_NOT_EXIST ) ) {
+        pthread_mutex_lock( &base -> lock );
+        node = findDir( base, dir, hash );
+        if ( node && node -> generation == generation &&
+             !findEntry( base, node, name,
+                         ufsHashString( name, node -> serial ) ) )
+            addEntry( base, node, name, status == UFS_DOES_NOT_EXIST,
+                      &found );
+        pthread_mutex_unlock( &base -> lock );
+    }
+
+    if ( attr && status == UFS_NO_ERROR )
+        *attr = found;
+    ufsErrno = status;
+    return status == UFS_NO_ERROR;
+}
+
+bool ufsBaseAttach( ufsBasePtr base, ufsImagePtr img, ufsIdType dir,
+                    uint64_t maxHandles )
+{
+    struct open_how how = { .flags = HANDLE_FLAGS,
+                            .resolve = RESOLVE_BENEATH };
+    struct rlimit limit;
+    int fd;
+
+    if ( !base || !img || dir < 0 || base -> img ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !maxHandles )
+        maxHandles = UFS_BASE_MAX_HANDLES;
+    if ( !getrlimit( RLIMIT_NOFILE, &limit ) &&
+         limit.rlim_cur != RLIM_INFINITY && maxHandles > limit.rlim_cur / 2 )
+        maxHandles = limit.rlim_cur / 2 ? limit.rlim_cur / 2 : 1;
+
+    base -> handleCapacity = 1;
+    while ( base -> handleCapacity < maxHandles )
+        base -> handleCapacity *= 2;
+    base -> handles = calloc( base -> handleCapacity,
+                              sizeof( *base -> handles ) );
+    base -> ring = ufsUringCreate( UFS_URING_DEPTH );
+    if ( !base -> handles || !base -> ring ) {
+        free( base -> handles );
+        ufsUringFree( base -> ring );
+        base -> handles = NULL;
+        base -> ring = NULL;
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    /* Kernels before 5.6 don't have openat2.                                 */
+    fd = syscall( SYS_openat2, base -> rootFd, ".", &how, sizeof( how ) );
+    base -> openat2 = fd >= 0;
+    if ( fd >= 0 )
+        close( fd );
+
+    base -> maxHandles = maxHandles;
+    base -> root = (struct handleStruct) { .dir = dir, .fd = base -> rootFd,
+                                           .cached = true };
+    base -> img = img;
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsBaseStatAt( ufsBasePtr base, ufsIdType dir, const char *name,
+                    struct ufsBaseAttrStruct *attr )
+{
+    struct ufsBaseAttrStruct found;
+    struct handleStruct *handle;
+    ufsStatusType status;
+
+    if ( !base || !base -> img || !validName( name ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    handle = getHandle( base, dir, &status );
+    if ( !handle ) {
+        ufsErrno = status;
+        return false;
+    }
+
+    status = UFS_UNKNOWN_ERROR;
+    if ( isClean( base, handle ) )
+        status = indexLookup( base, dir, name, &found );
+    if ( status == UFS_UNKNOWN_ERROR )
+        status = statAt( handle -> fd, name, &found );
+    releaseHandle( base, handle );
+    if ( attr && status == UFS_NO_ERROR )
+        *attr = found;
+
+    ufsErrno = status;
+    return status == UFS_NO_ERROR;
+}
+
+int ufsBaseOpenAt( ufsBasePtr base, ufsIdType dir, const char *name,
+                   int flags )
+{
+    struct handleStruct *handle;
+    ufsStatusType status;
+    int fd;
+
+    if ( !base || !base -> img || !validName( name ) ||
+         ( flags & O_CREAT ) || ( flags & O_TMPFILE ) == O_TMPFILE ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    handle = getHandle( base, dir, &status );
+    if ( !handle ) {
+        ufsErrno = status;
+        return -1;
+    }
+
+    fd = openBeneath( base, handle -> fd, name,
+                      flags | O_NOFOLLOW | O_CLOEXEC );
+    ufsErrno = fd < 0 ? errnoStatus( errno ) : UFS_NO_ERROR;
+    releaseHandle( base, handle );
+    return fd;
+}
+
+bool ufsBaseStatBatch( ufsBasePtr base, ufsIdType dir,
+                       const char *const *names, uint64_t numNames,
+                       struct ufsBaseAttrStruct *attrs,
+                       ufsStatusType *statuses )
+{
+    struct handleStruct *handle;
+    ufsStatusType status;
+    bool ok;
+
+    if ( !base || !base -> img || !names || !statuses ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    handle = getHandle( base, dir, &status );
+    if ( !handle ) {
+        ufsErrno = status;
+        return false;
+    }
+
+    ok = runBatch( base, handle -> fd, names, numNames, -1, attrs, NULL,
+                   statuses );
+    releaseHandle( base, handle );
+
+    ufsErrno = ok ? UFS_NO_ERROR : UFS_OUT_OF_MEMORY;
+    return ok;
+}
+
+bool ufsBaseOpenBatch( ufsBasePtr base, ufsIdType dir,
+                       const char *const *names, uint64_t numNames,
+                       int flags, int *fds, ufsStatusType *statuses )
+{
+    struct handleStruct *handle;
+    ufsStatusType status;
+    bool ok;
+
+    if ( !base || !base -> img || !names || !fds || ( flags & O_CREAT ) ||
+         ( flags & O_TMPFILE ) == O_TMPFILE ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    handle = getHandle( base, dir, &status );
+    if ( !handle ) {
+        ufsErrno = status;
+        return false;
+    }
+
+    ok = runBatch( base, handle -> fd, names, numNames,
+                   flags | O_NOFOLLOW | O_CLOEXEC, NULL, fds, statuses );
+    releaseHandle( base, handle );
+
+    ufsErrno = ok ? UFS_NO_ERROR : UFS_OUT_OF_MEMORY;
+    return ok;
+}
+
+/* Stats a getdents64 buffer at a time, entries removed since are left out.   */
+bool ufsBaseReadDirectory( ufsBasePtr base, ufsIdType dir,
+                           ufsBaseEntrySink sink, void *userData )
+{
+    struct handleStruct *handle;
+    struct direntStruct *dirent;
+    struct ufsBaseAttrStruct *attrs;
+    const char **names;
+    ufsStatusType *statuses, status;
+    uint64_t numNames, kept, i;
+    long bytes, offset;
+    char *buffer;
+    int fd;
+
+    if ( !base || !base -> img || !sink ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    handle = getHandle( base, dir, &status );
+    if ( !handle ) {
+        ufsErrno = status;
+        return false;
+    }
+
+    fd = openat( handle -> fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    status = fd < 0 ? errnoStatus( errno ) : UFS_NO_ERROR;
+    releaseHandle( base, handle );
+    if ( fd < 0 ) {
+        ufsErrno = status;
+        return false;
+    }
+
+    buffer = malloc( DIRENT_BYTES );
+    names = malloc( MAX_DIRENTS * sizeof( *names ) );
+    attrs = malloc( MAX_DIRENTS * sizeof( *attrs ) );
+    statuses = malloc( MAX_DIRENTS * sizeof( *statuses ) );
+    if ( !buffer || !names || !attrs || !statuses ) {
+        status = UFS_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    while ( ( bytes = syscall( SYS_getdents64, fd, buffer,
+                               DIRENT_BYTES ) ) > 0 ) {
+        numNames = 0;
+        for ( offset = 0; offset < bytes; offset += dirent -> reclen ) {
+            dirent = (struct direntStruct*)( buffer + offset );
+            if ( validName( dirent -> name ) )
+                names[ numNames++ ] = dirent -> name;
+        }
+
+        if ( !runBatch( base, fd, names, numNames, -1, attrs, NULL,
+                        statuses ) ) {
+            status = UFS_OUT_OF_MEMORY;
+            goto out;
+        }
+
+        for ( i = kept = 0; i < numNames; i++ ) {
+            if ( statuses[i] == UFS_DOES_NOT_EXIST )
+                continue;
+            if ( statuses[i] != UFS_NO_ERROR ) {
+                status = statuses[i];
+                goto out;
+            }
+            names[ kept ] = names[i];
+            attrs[ kept++ ] = attrs[i];
+        }
+
+        if ( kept && !sink( names, attrs, kept, userData ) ) {
+            status = ufsErrno;
+            goto out;
+        }
+    }
+
+    if ( bytes < 0 )
+        status = errnoStatus( errno );
+
+out:
+    close( fd );
+    free( statuses );
+    free( attrs );
+    free( names );
+    free( buffer );
+    ufsErrno = status;
+    return status == UFS_NO_ERROR;
+}
+
+/* The directory is stat'ed before it's read, a change during the read makes  */
+/* it dirty on its next check.                                                */
+bool ufsBaseRefresh( ufsBasePtr base, ufsIdType dir )
+{
+    struct refreshStruct refresh;
+    struct ufsBaseAttrStruct attr;
+    struct handleStruct *handle;
+    struct statx stx;
+    ufsStatusType status;
+    bool ok;
+
+    if ( !base || !base -> img || dir <= 0 ||
+         !ufsBaseIndexHas( base -> img ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    handle = getHandle( base, dir, &status );
+    if ( !handle ) {
+        ufsErrno = status;
+        return false;
+    }
+
+    if ( statx( handle -> fd, "", AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW,
+                STATX_FIELDS, &stx ) ) {
+        ufsErrno = errnoStatus( errno );
+        releaseHandle( base, handle );
+        return false;
+    }
+    fillAttr( &attr, &stx );
+
+    memset( &refresh, 0, sizeof( refresh ) );
+    refresh.img = base -> img;
+    refresh.dir = dir;
+    ok = ufsBaseReadDirectory( base, dir, refreshEntries, &refresh );
+    status = ufsErrno;
+    if ( ok ) {
+        qsort( refresh.seen, refresh.numSeen, sizeof( *refresh.seen ),
+               compareIds );
+        ufsStoreIterateChildren( base -> img, dir, forgetUnseen, &refresh );
+    }
+
+    /* A directory that wasn't read to the end is looked up on the external   */
+    /* fs until it is.                                                        */
+    ufsBaseIndexSet( base -> img, dir, ok ? UFS_BASE_RECORD_LISTED :
+                                            UFS_BASE_RECORD_PRESENT, &attr );
+    pthread_mutex_lock( &base -> lock );
+    handle -> index = INDEX_UNCHECKED;
+    pthread_mutex_unlock( &base -> lock );
+    releaseHandle( base, handle );
+    free( refresh.seen );
+
+    ufsErrno = status;
+    return ok;
+}
+
+void ufsBaseDropHandles( ufsBasePtr base )
+{
+    pthread_mutex_lock( &base -> lock );
+    while ( base -> handleHead )
+        closeHandle( base, base -> handleHead );
+    base -> root.index = INDEX_UNCHECKED;
+    pthread_mutex_unlock( &base -> lock );
+}
+
+void ufsBaseGetStats( ufsBasePtr base, struct ufsBaseStatsStruct *stats )
+{
+    pthread_mutex_lock( &base -> lock );
+    *stats = base -> stats;
+    pthread_mutex_unlock( &base -> lock );
+}
+
+/* Components are separated by single slashes and are never "." or "..".      */
+static bool validDir( const char *dir )
+{
+    const char *end;
+    size_t length;
+
+    if ( !*dir )
+        return true;
+
+    for ( ;; ) {
+        end = strchrnul( dir, '/' );
+        length = end - dir;
+        if ( !length || ( dir[0] == '.' &&
+             ( length == 1 || ( length == 2 && dir[1] == '.' ) ) ) )
+            return false;
+        if ( !*end )
+            return true;
+        dir = end + 1;
+    }
+}
+
+static bool validName( const char *name )
+{
+    return name && *name && !strchr( name, '/' ) && strcmp( name, "." ) &&
+           strcmp( name, ".." );
+}
+
+static struct dirStruct *findDir( struct ufsBaseStruct *base,
+                                  const char *path, uint64_t hash )
+{
+    struct dirStruct *dir;
+
+    dir = base -> dirs[ hash & ( base -> dirCapacity - 1 ) ];
+    for ( ; dir; dir = dir -> next ) {
+        if ( dir -> hash == hash && !strcmp( dir -> path, path ) )
+            return dir;
+    }
+
+    return NULL;
+}
+
+static struct dirStruct *findWd( struct ufsBaseStruct *base, int wd )
+{
+    struct dirStruct *dir;
+
+    dir = base -> wds[ ufsHashMix( wd ) & ( base -> dirCapacity - 1 ) ];
+    for ( ; dir; dir = dir -> wdNext ) {
+        if ( dir -> wd == wd )
+            return dir;
+    }
+
+    return NULL;
+}
+
+static struct entryStruct *findEntry( struct ufsBaseStruct *base,
+                                      struct dirStruct *dir,
+                                      const char *name, uint64_t hash )
+{
+    struct entryStruct *entry;
+
+    entry = base -> entries[ hash & ( base -> entryCapacity - 1 ) ];
+    for ( ; entry; entry = entry -> next ) {
+        if ( entry -> hash == hash && entry -> dir == dir &&
+             !strcmp( entry -> name, name ) )
+            return entry;
+    }
+
+    return NULL;
+}
+
+/* Watches path and every directory above it that isn't watched yet. Sets     */
+/* missing when path isn't a directory, returns NULL without it when path     */
+/* can't be watched, lookups in it then go to the external fs.                */
+static struct dirStruct *watchDir( struct ufsBaseStruct *base,
+                                   const char *path, bool *missing )
+{
+    struct dirStruct *parent, *dir;
+    const char *slash;
+    char *parentPath, *fullPath;
+    size_t length;
+    uint64_t bucket;
+    int wd;
+
+    *missing = false;
+    parent = NULL;
+    length = strlen( path );
+    if ( length ) {
+        slash = strrchr( path, '/' );
+        parentPath = strndup( path, slash ? (size_t)( slash - path ) : 0 );
+        if ( !parentPath )
+            return NULL;
+
+        parent = findDir( base, parentPath, ufsHashString( parentPath, 0 ) );
+        if ( !parent )
+            parent = watchDir( base, parentPath, missing );
+        free( parentPath );
+        if ( !parent )
+            return NULL;
+    }
+
+    if ( base -> numDirs >= base -> maxWatches && !evictDir( base, parent ) )
+        return NULL;
+
+    if ( base -> numDirs >= base -> dirCapacity && !growDirs( base ) )
+        return NULL;
+
+    fullPath = length ? joinPath( base -> rootPath, path ) :
+                        strdup( base -> rootPath );
+    dir = malloc( sizeof( *dir ) + length + 1 );
+    if ( !fullPath || !dir ) {
+        free( fullPath );
+        free( dir );
+        return NULL;
+    }
+
+    wd = inotify_add_watch( base -> inotifyFd, fullPath, WATCH_MASK );
+    if ( wd < 0 && errno == ENOSPC && evictDir( base, parent ) )
+        wd = inotify_add_watch( base -> inotifyFd, fullPath, WATCH_MASK );
+    free( fullPath );
+
+    /* The directory may be watched already under another path through a      */
+    /* symbolic link, its events can only go to one of them.                  */
+    if ( wd < 0 || findWd( base, wd ) ) {
+        *missing = wd < 0 && ( errno == ENOENT || errno == ENOTDIR );
+        free( dir );
+        return NULL;
+    }
+
+    memset( dir, 0, sizeof( *dir ) );
+    memcpy( dir -> path, path, length + 1 );
+    dir -> hash = ufsHashString( path, 0 );
+    dir -> serial = dir -> generation = ++base -> serial;
+    dir -> wd = wd;
+
+    bucket = dir -> hash & ( base -> dirCapacity - 1 );
+    dir -> next = base -> dirs[ bucket ];
+    base -> dirs[ bucket ] = dir;
+    bucket = ufsHashMix( wd ) & ( base -> dirCapacity - 1 );
+    dir -> wdNext = base -> wds[ bucket ];
+    base -> wds[ bucket ] = dir;
+
+    dir -> parent = parent;
+    if ( parent ) {
+        dir -> siblingNext = parent -> children;
+        if ( parent -> children )
+            parent -> children -> siblingPrev = dir;
+        parent -> children = dir;
+        /* What a lookup found in parent before the watch may be stale.       */
+        parent -> generation = ++base -> serial;
+    }
+
+    dir -> lruNext = base -> lruHead;
+    if ( base -> lruHead )
+        base -> lruHead -> lruPrev = dir;
+    else
+        base -> lruTail = dir;
+    base -> lruHead = dir;
+
+    base -> numDirs++;
+    base -> stats.watches++;
+    ufsBudgetCharge( base -> budget, base -> budgetId,
+                     sizeof( *dir ) + length + 1 );
+    return dir;
+}
+
+/* A directory is only cached while it's watched, its times change with       */
+/* what's in it. Only once the watch is up does a lookup cache it.            */
+static void addEntry( struct ufsBaseStruct *base, struct dirStruct *dir,
+                      const char *name, bool missing,
+                      const struct ufsBaseAttrStruct *attr )
+{
+    struct entryStruct *entry;
+    char *path;
+    size_t length;
+    uint64_t bucket;
+    bool ignored;
+
+    if ( !missing && S_ISDIR( attr -> mode ) ) {
+        path = *dir -> path ? joinPath( dir -> path, name ) : strdup( name );
+        if ( !path )
+            return;
+
+        if ( !findDir( base, path, ufsHashString( path, 0 ) ) ) {
+            watchDir( base, path, &ignored );
+            free( path );
+            return;
+        }
+        free( path );
+    }
+
+    if ( base -> numEntries >= base -> entryCapacity && !growEntries( base ) )
+        return;
+
+    length = strlen( name );
+    entry = malloc( sizeof( *entry ) + length + 1 );
+    if ( !entry )
+        return;
+
+    entry -> dir = dir;
+    entry -> hash = ufsHashString( name, dir -> serial );
+    entry -> missing = missing;
+    entry -> attr = *attr;
+    memcpy( entry -> name, name, length + 1 );
+
+    bucket = entry -> hash & ( base -> entryCapacity - 1 );
+    entry -> next = base -> entries[ bucket ];
+    base -> entries[ bucket ] = entry;
+
+    entry -> dirPrev = NULL;
+    entry -> dirNext = dir -> entries;
+    if ( dir -> entries )
+        dir -> entries -> dirPrev = entry;
+    dir -> entries = entry;
+
+    base -> numEntries++;
+    ufsBudgetCharge( base -> budget, base -> budgetId,
+                     sizeof( *entry ) + length + 1 );
+}
+
+static void dropEntry( struct ufsBaseStruct *base, struct entryStruct *entry )
+{
+    struct entryStruct **link;
+
+    link = &base -> entries[ entry -> hash & ( base -> entryCapacity - 1 ) ];
+    while ( *link != entry )
+        link = &( *link ) -> next;
+    *link = entry -> next;
+
+    if ( entry -> dirPrev )
+        entry -> dirPrev -> dirNext = entry -> dirNext;
+    else
+        entry -> dir -> entries = entry -> dirNext;
+    if ( entry -> dirNext )
+        entry -> dirNext -> dirPrev = entry -> dirPrev;
+
+    base -> numEntries--;
+    ufsBudgetCharge( base -> budget, base -> budgetId,
+                     -(int64_t)( sizeof( *entry ) + strlen( entry -> name ) +
+                                 1 ) );
+    free( entry );
+}
+
+/* Drops dir, everything cached under it and its entry in its parent.         */
+static void dropDir( struct ufsBaseStruct *base, struct dirStruct *dir )
+{
+    struct dirStruct **link;
+
+    while ( dir -> children )
+        dropDir( base, dir -> children );
+    while ( dir -> entries )
+        dropEntry( base, dir -> entries );
+
+    if ( dir -> parent ) {
+        dropParentEntry( base, dir );
+        if ( dir -> siblingPrev )
+            dir -> siblingPrev -> siblingNext = dir -> siblingNext;
+        else
+            dir -> parent -> children = dir -> siblingNext;
+        if ( dir -> siblingNext )
+            dir -> siblingNext -> siblingPrev = dir -> siblingPrev;
+    }
+
+    link = &base -> dirs[ dir -> hash & ( base -> dirCapacity - 1 ) ];
+    while ( *link != dir )
+        link = &( *link ) -> next;
+    *link = dir -> next;
+    link = &base -> wds[ ufsHashMix( dir -> wd ) &
+                         ( base -> dirCapacity - 1 ) ];
+    while ( *link != dir )
+        link = &( *link ) -> wdNext;
+    *link = dir -> wdNext;
+
+    if ( dir -> lruPrev )
+        dir -> lruPrev -> lruNext = dir -> lruNext;
+    else
+        base -> lruHead = dir -> lruNext;
+    if ( dir -> lruNext )
+        dir -> lruNext -> lruPrev = dir -> lruPrev;
+    else
+        base -> lruTail = dir -> lruPrev;
+
+    /* Fails harmlessly when the kernel dropped the watch already.            */
+    inotify_rm_watch( base -> inotifyFd, dir -> wd );
+    base -> numDirs--;
+    base -> stats.watches--;
+    ufsBudgetCharge( base -> budget, base -> budgetId,
+                     -(int64_t)( sizeof( *dir ) + strlen( dir -> path ) +
+                                 1 ) );
+    free( dir );
+}
+
+static void dropAll( struct ufsBaseStruct *base )
+{
+    struct dirStruct *dir;
+
+    while ( base -> lruHead ) {
+        for ( dir = base -> lruHead; dir -> parent; dir = dir -> parent );
+        dropDir( base, dir );
+    }
+}
+
+/* The entry of dir in its parent, which lookups may not cache meanwhile.     */
+static void dropParentEntry( struct ufsBaseStruct *base,
+                             struct dirStruct *dir )
+{
+    struct entryStruct *entry;
+    const char *name;
+
+    name = strrchr( dir -> path, '/' );
+    name = name ? name + 1 : dir -> path;
+    entry = findEntry( base, dir -> parent, name,
+                       ufsHashString( name, dir -> parent -> serial ) );
+    if ( entry )
+        dropEntry( base, entry );
+    dir -> parent -> generation = ++base -> serial;
+}
+
+/* Evicts the least recently used directory without cached directories        */
+/* under it, other than keep.                                                 */
+static bool evictDir( struct ufsBaseStruct *base, struct dirStruct *keep )
+{
+    struct dirStruct *dir;
+
+    for ( dir = base -> lruTail; dir; dir = dir -> lruPrev ) {
+        if ( !dir -> children && dir != keep ) {
+            dropDir( base, dir );
+            base -> stats.evictions++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void touchDir( struct ufsBaseStruct *base, struct dirStruct *dir )
+{
+    if ( base -> lruHead == dir )
+        return;
+
+    dir -> lruPrev -> lruNext = dir -> lruNext;
+    if ( dir -> lruNext )
+        dir -> lruNext -> lruPrev = dir -> lruPrev;
+    else
+        base -> lruTail = dir -> lruPrev;
+
+    dir -> lruPrev = NULL;
+    dir -> lruNext = base -> lruHead;
+    base -> lruHead -> lruPrev = dir;
+    base -> lruHead = dir;
+}
+
+static bool growDirs( struct ufsBaseStruct *base )
+{
+    struct dirStruct **dirs, **wds, *dir;
+    uint64_t capacity, bucket;
+
+    capacity = base -> dirCapacity * 2;
+    dirs = calloc( capacity, sizeof( *dirs ) );
+    wds = calloc( capacity, sizeof( *wds ) );
+    if ( !dirs || !wds ) {
+        free( dirs );
+        free( wds );
+        return false;
+    }
+
+    for ( dir = base -> lruHead; dir; dir = dir -> lruNext ) {
+        bucket = dir -> hash & ( capacity - 1 );
+        dir -> next = dirs[ bucket ];
+        dirs[ bucket ] = dir;
+        bucket = ufsHashMix( dir -> wd ) & ( capacity - 1 );
+        dir -> wdNext = wds[ bucket ];
+        wds[ bucket ] = dir;
+    }
+
+    free( base -> dirs );
+    free( base -> wds );
+    base -> dirs = dirs;
+    base -> wds = wds;
+    base -> dirCapacity = capacity;
+    return true;
+}
+
+static bool growEntries( struct ufsBaseStruct *base )
+{
+    struct entryStruct **entries, *entry, *next;
+    uint64_t capacity, i, bucket;
+
+    capacity = base -> entryCapacity * 2;
+    entries = calloc( capacity, sizeof( *entries ) );
+    if ( !entries )
+        return false;
+
+    for ( i = 0; i < base -> entryCapacity; i++ ) {
+        for ( entry = base -> entries[i]; entry; entry = next ) {
+            next = entry -> next;
+            bucket = entry -> hash & ( capacity - 1 );
+            entry -> next = entries[ bucket ];
+            entries[ bucket ] = entry;
+        }
+    }
+
+    free( base -> entries );
+    base -> entries = entries;
+    base -> entryCapacity = capacity;
+    return true;
+}
+
+static char *joinPath( const char *dir, const char *name )
+{
+    char *path;
+
+    if ( asprintf( &path, "%s/%s", dir, name ) < 0 )
+        return NULL;
+
+    return path;
+}
+
+static ufsStatusType statEntry( struct ufsBaseStruct *base, const char *dir,
+                                const char *name,
+                                struct ufsBaseAttrStruct *attr )
+{
+    char path[ PATH_MAX ];
+    int length;
+
+    length = *dir ? snprintf( path, sizeof( path ), "%s/%s", dir, name ) :
+                    snprintf( path, sizeof( path ), "%s", name );
+    if ( length >= (int) sizeof( path ) )
+        return UFS_BAD_CALL;
+
+    return statAt( base -> rootFd, path, attr );
+}
+
+static ufsStatusType statAt( int fd, const char *path,
+                             struct ufsBaseAttrStruct *attr )
+{
+    struct statx stx;
+
+    if ( statx( fd, path, AT_SYMLINK_NOFOLLOW, STATX_FIELDS, &stx ) )
+        return errnoStatus( errno );
+
+    fillAttr( attr, &stx );
+    return UFS_NO_ERROR;
+}
+
+/* A symbolic link where a directory should be is a missing directory.        */
+static ufsStatusType errnoStatus( int error )
+{
+    if ( error == ENOENT || error == ENOTDIR || error == ELOOP ||
+         error == EXDEV )
+        return UFS_DOES_NOT_EXIST;
+
+    return error == ENOMEM ? UFS_OUT_OF_MEMORY : UFS_UNKNOWN_ERROR;
+}
+
+static void fillAttr( struct ufsBaseAttrStruct *attr,
+                      const struct statx *stx )
+{
+    attr -> inode = stx -> stx_ino;
+    attr -> size = stx -> stx_size;
+    attr -> mtime = (uint64_t) stx -> stx_mtime.tv_sec * 1000000000 +
+                    stx -> stx_mtime.tv_nsec;
+    attr -> ctime = (uint64_t) stx -> stx_ctime.tv_sec * 1000000000 +
+                    stx -> stx_ctime.tv_nsec;
+    attr -> mode = stx -> stx_mode;
+}
+
+/* Stats the names in dirFd when flags is -1, opens them with flags           */
+/* otherwise. Names that aren't a single component are never looked up.       */
+/* Returns false when the system is out of memory.                            */
+static bool runBatch( struct ufsBaseStruct *base, int dirFd,
+                      const char *const *names, uint64_t numNames,
+                      int flags, struct ufsBaseAttrStruct *attrs, int *fds,
+                      ufsStatusType *statuses )
+{
+    struct ufsUringOpStruct *ops;
+    struct statx *stxs;
+    uint64_t *indices, numOps, enters, i;
+    int result;
+
+    ops = malloc( numNames * sizeof( *ops ) + 1 );
+    indices = malloc( numNames * sizeof( *indices ) + 1 );
+    stxs = flags < 0 ? malloc( numNames * sizeof( *stxs ) + 1 ) : NULL;
+    if ( !ops || !indices || ( flags < 0 && !stxs ) ) {
+        free( ops );
+        free( indices );
+        free( stxs );
+        return false;
+    }
+
+    numOps = 0;
+    for ( i = 0; i < numNames; i++ ) {
+        if ( fds )
+            fds[i] = -1;
+        if ( !validName( names[i] ) ) {
+            if ( statuses )
+                statuses[i] = UFS_BAD_CALL;
+            continue;
+        }
+
+        ops[ numOps ] = (struct ufsUringOpStruct) {
+            .op = flags < 0 ? UFS_URING_STATX : UFS_URING_OPENAT,
+            .dirFd = dirFd,
+            .path = names[i],
+            .flags = flags < 0 ? AT_SYMLINK_NOFOLLOW : flags,
+            .mask = STATX_FIELDS,
+            .stx = stxs ? &stxs[ numOps ] : NULL
+        };
+        indices[ numOps++ ] = i;
+    }
+
+    enters = ufsUringRun( base -> ring, ops, numOps );
+    for ( i = 0; i < numOps; i++ ) {
+        result = ops[i].result;
+        if ( statuses )
+            statuses[ indices[i] ] = result < 0 ? errnoStatus( -result ) :
+                                                  UFS_NO_ERROR;
+        if ( fds )
+            fds[ indices[i] ] = result < 0 ? -1 : result;
+        else if ( attrs && result >= 0 )
+            fillAttr( &attrs[ indices[i] ], &stxs[i] );
+    }
+
+    pthread_mutex_lock( &base -> lock );
+    base -> stats.batched += numOps;
+    base -> stats.enters += enters;
+    pthread_mutex_unlock( &base -> lock );
+
+    free( stxs );
+    free( indices );
+    free( ops );
+    return true;
+}
+
+/* Opens the handle of dir through that of its parent, the store is read      */
+/* without the lock.                                                          */
+static struct handleStruct *getHandle( struct ufsBaseStruct *base,
+                                       ufsIdType dir, ufsStatusType *status )
+{
+    struct handleStruct *handle, *parentHandle;
+    const char *name;
+    ufsIdType parent;
+    uint64_t bucket;
+    int fd;
+
+    if ( dir == base -> root.dir )
+        return &base -> root;
+
+    bucket = ufsHashMix( dir ) & ( base -> handleCapacity - 1 );
+    pthread_mutex_lock( &base -> lock );
+    for ( handle = base -> handles[ bucket ]; handle;
+          handle = handle -> next ) {
+        if ( handle -> dir == dir )
+            break;
+    }
+
+    if ( handle ) {
+        handle -> refs++;
+        if ( base -> handleHead != handle ) {
+            handle -> lruPrev -> lruNext = handle -> lruNext;
+            if ( handle -> lruNext )
+                handle -> lruNext -> lruPrev = handle -> lruPrev;
+            else
+                base -> handleTail = handle -> lruPrev;
+            handle -> lruPrev = NULL;
+            handle -> lruNext = base -> handleHead;
+            base -> handleHead -> lruPrev = handle;
+            base -> handleHead = handle;
+        }
+        pthread_mutex_unlock( &base -> lock );
+        return handle;
+    }
+    pthread_mutex_unlock( &base -> lock );
+
+    /* The top level namespace is only under the root if it's the root.       */
+    parent = dir > 0 ? ufsStoreGetParent( base -> img, dir ) : -1;
+    name = parent >= 0 ? ufsStoreGetName( base -> img, UFS_TYPES_FILE, dir ) :
+                         NULL;
+    if ( !name || ( !parent && base -> root.dir ) ) {
+        *status = UFS_DOES_NOT_EXIST;
+        return NULL;
+    }
+
+    if ( !validName( name ) ) {
+        *status = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    parentHandle = getHandle( base, parent, status );
+    if ( !parentHandle )
+        return NULL;
+
+    fd = openBeneath( base, parentHandle -> fd, name, HANDLE_FLAGS );
+    *status = fd < 0 ? errnoStatus( errno ) : UFS_NO_ERROR;
+    releaseHandle( base, parentHandle );
+    if ( fd < 0 )
+        return NULL;
+
+    handle = calloc( 1, sizeof( *handle ) );
+    if ( !handle ) {
+        close( fd );
+        *status = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+    handle -> dir = dir;
+    handle -> fd = fd;
+    handle -> refs = 1;
+
+    /* Another thread may have opened it meanwhile, theirs is kept.           */
+    pthread_mutex_lock( &base -> lock );
+    for ( parentHandle = base -> handles[ bucket ]; parentHandle;
+          parentHandle = parentHandle -> next ) {
+        if ( parentHandle -> dir == dir )
+            break;
+    }
+
+    if ( parentHandle ) {
+        parentHandle -> refs++;
+        pthread_mutex_unlock( &base -> lock );
+        close( fd );
+        free( handle );
+        return parentHandle;
+    }
+
+    while ( base -> stats.handles >= base -> maxHandles ) {
+        for ( parentHandle = base -> handleTail;
+              parentHandle && parentHandle -> refs;
+              parentHandle = parentHandle -> lruPrev );
+        if ( !parentHandle )
+            break;
+
+        closeHandle( base, parentHandle );
+        base -> stats.closes++;
+    }
+
+    if ( base -> stats.handles < base -> maxHandles ) {
+        handle -> cached = true;
+        handle -> next = base -> handles[ bucket ];
+        base -> handles[ bucket ] = handle;
+        handle -> lruNext = base -> handleHead;
+        if ( base -> handleHead )
+            base -> handleHead -> lruPrev = handle;
+        else
+            base -> handleTail = handle;
+        base -> handleHead = handle;
+        base -> stats.handles++;
+    }
+    pthread_mutex_unlock( &base -> lock );
+
+    return handle;
+}
+
+static void releaseHandle( struct ufsBaseStruct *base,
+                           struct handleStruct *handle )
+{
+    if ( handle == &base -> root )
+        return;
+
+    pthread_mutex_lock( &base -> lock );
+    if ( !--handle -> refs && !handle -> cached ) {
+        close( handle -> fd );
+        free( handle );
+    }
+    pthread_mutex_unlock( &base -> lock );
+}
+
+/* Takes handle out of the cache, closing it unless it's in use.              */
+static void closeHandle( struct ufsBaseStruct *base,
+                         struct handleStruct *handle )
+{
+    struct handleStruct **link;
+
+    link = &base -> handles[ ufsHashMix( handle -> dir ) &
+                             ( base -> handleCapacity - 1 ) ];
+    while ( *link != handle )
+        link = &( *link ) -> next;
+    *link = handle -> next;
+
+    if ( handle -> lruPrev )
+        handle -> lruPrev -> lruNext = handle -> lruNext;
+    else
+        base -> handleHead = handle -> lruNext;
+    if ( handle -> lruNext )
+        handle -> lruNext -> lruPrev = handle -> lruPrev;
+    else
+        base -> handleTail = handle -> lruPrev;
+
+    base -> stats.handles--;
+    handle -> cached = false;
+    if ( !handle -> refs ) {
+        close( handle -> fd );
+        free( handle );
+    }
+}
+
+/* name is a single component, so openat with O_NOFOLLOW stays beneath        */
+/* dirFd as well, RESOLVE_BENEATH makes sure of it.                           */
+static int openBeneath( struct ufsBaseStruct *base, int dirFd,
+                        const char *name, int flags )
+{
+    struct open_how how = { .flags = flags,
+                            .resolve = RESOLVE_BENEATH |
+                                       RESOLVE_NO_MAGICLINKS };
+
+    if ( base -> openat2 )
+        return syscall( SYS_openat2, dirFd, name, &how, sizeof( how ) );
+
+    return openat( dirFd, name, flags );
+}
+
+/* A directory is clean if the index listed it and its ctime is still the     */
+/* one recorded, which is checked once per handle. The top level namespace    */
+/* has no record and is never clean.                                          */
+static bool isClean( struct ufsBaseStruct *base, struct handleStruct *handle )
+{
+    struct ufsBaseAttrStruct recorded;
+    enum indexStateEnum index;
+    struct statx stx;
+    bool clean;
+
+    pthread_mutex_lock( &base -> lock );
+    index = handle -> index;
+    pthread_mutex_unlock( &base -> lock );
+    if ( index != INDEX_UNCHECKED )
+        return index == INDEX_CLEAN;
+
+    if ( ufsBaseIndexGet( base -> img, handle -> dir, &recorded ) !=
+         UFS_BASE_RECORD_LISTED )
+        return false;
+
+    clean = !statx( handle -> fd, "", AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW,
+                    STATX_CTIME, &stx ) &&
+            ( stx.stx_mask & STATX_CTIME ) &&
+            (uint64_t) stx.stx_ctime.tv_sec * 1000000000 +
+            stx.stx_ctime.tv_nsec == recorded.ctime;
+
+    pthread_mutex_lock( &base -> lock );
+    handle -> index = clean ? INDEX_CLEAN : INDEX_DIRTY;
+    base -> stats.dirty += !clean;
+    pthread_mutex_unlock( &base -> lock );
+    return clean;
+}
+
+/* Looks name up in the index of a clean directory, UFS_UNKNOWN_ERROR when    */
+/* it has no answer and the external fs has to be asked. The store is read    */
+/* without the lock.                                                          */
+static ufsStatusType indexLookup( struct ufsBaseStruct *base, ufsIdType dir,
+                                  const char *name,
+                                  struct ufsBaseAttrStruct *attr )
+{
+    enum ufsBaseRecordStateEnum state;
+    ufsIdType id;
+
+    id = ufsStoreGetStorage( base -> img, dir, name );
+    if ( id < 0 && ufsErrno != UFS_FILE_DOES_NOT_EXIST )
+        return UFS_UNKNOWN_ERROR;
+
+    /* Storage the index has no record of isn't from BASE, unless the scan    */
+    /* couldn't stat it.                                                      */
+    state = id < 0 ? UFS_BASE_RECORD_ABSENT :
+                     ufsBaseIndexGet( base -> img, id, attr );
+    if ( state == UFS_BASE_RECORD_UNKNOWN )
+        return UFS_UNKNOWN_ERROR;
+
+    pthread_mutex_lock( &base -> lock );
+    base -> stats.indexed++;
+    pthread_mutex_unlock( &base -> lock );
+
+    return state == UFS_BASE_RECORD_ABSENT ? UFS_DOES_NOT_EXIST :
+                                             UFS_NO_ERROR;
+}
+
+/* Directories that were listed stay so while their ctime is the same.        */
+static bool refreshEntries( const char *const *names,
+                            const struct ufsBaseAttrStruct *attrs,
+                            uint64_t numEntries, void *userData )
+{
+    enum ufsBaseRecordStateEnum state;
+    struct refreshStruct *refresh;
+    struct ufsBaseAttrStruct old;
+    ufsIdType *seen, id;
+    uint64_t capacity, i;
+
+    refresh = userData;
+    for ( i = 0; i < numEntries; i++ ) {
+        id = ufsStoreGetStorage( refresh -> img, refresh -> dir, names[i] );
+        if ( id < 0 && ufsErrno == UFS_FILE_DOES_NOT_EXIST )
+            id = ufsStoreAddStorage( refresh -> img, refresh -> dir, names[i],
+                                     S_ISDIR( attrs[i].mode ) );
+        if ( id < 0 )
+            return false;
+
+        state = ufsBaseIndexGet( refresh -> img, id, &old );
+        state = state == UFS_BASE_RECORD_LISTED && S_ISDIR( attrs[i].mode ) &&
+                old.ctime == attrs[i].ctime ? UFS_BASE_RECORD_LISTED :
+                                              UFS_BASE_RECORD_PRESENT;
+        if ( !ufsBaseIndexSet( refresh -> img, id, state, &attrs[i] ) )
+            return false;
+
+        if ( refresh -> numSeen == refresh -> capacity ) {
+            capacity = refresh -> capacity ? refresh -> capacity * 2 : 64;
+            seen = realloc( refresh -> seen, capacity * sizeof( *seen ) );
+            if ( !seen ) {
+                ufsErrno = UFS_OUT_OF_MEMORY;
+                return false;
+            }
+            refresh -> seen = seen;
+            refresh -> capacity = capacity;
+        }
+        refresh -> seen[ refresh -> numSeen++ ] = id;
+    }
+
+    return true;
+}
+
+static bool forgetUnseen( ufsIdType id, void *userData )
+{
+    struct refreshStruct *refresh;
+    enum ufsBaseRecordStateEnum state;
+
+    refresh = userData;
+    state = ufsBaseIndexGet( refresh -> img, id, NULL );
+    if ( ( state == UFS_BASE_RECORD_PRESENT ||
+           state == UFS_BASE_RECORD_LISTED ) &&
+         !bsearch( &id, refresh -> seen, refresh -> numSeen,
+                   sizeof( *refresh -> seen ), compareIds ) )
+        ufsBaseIndexSet( refresh -> img, id, UFS_BASE_RECORD_ABSENT, NULL );
+
+    return true;
+}
+
+static int compareIds( const void *a, const void *b )
+{
+    ufsIdType x, y;
+
+    x = *(const ufsIdType*) a;
+    y = *(const ufsIdType*) b;
+    return ( x > y ) - ( x < y );
+}
+
+/* Events naming an entry drop it, those adding or removing one also drop     */
+/* the entry of the directory in its parent as its times changed. Events      */
+/* about the directory itself drop it.                                        */
+static void handleEvent( struct ufsBaseStruct *base,
+                         const struct inotify_event *event )
+{
+    struct entryStruct *entry;
+    struct dirStruct *dir, *child;
+    char *path;
+
+    if ( event -> mask & IN_Q_OVERFLOW ) {
+        dropAll( base );
+        return;
+    }
+
+    dir = findWd( base, event -> wd );
+    if ( !dir )
+        return;
+
+    if ( !event -> len || !event -> name[0] ) {
+        if ( event -> mask & ( IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED |
+                               IN_UNMOUNT ) )
+            dropDir( base, dir );
+        else
+            dir -> generation = ++base -> serial;
+        return;
+    }
+
+    entry = findEntry( base, dir, event -> name,
+                       ufsHashString( event -> name, dir -> serial ) );
+    if ( entry )
+        dropEntry( base, entry );
+
+    path = *dir -> path ? joinPath( dir -> path, event -> name ) :
+                          strdup( event -> name );
+    if ( !path ) {
+        /* Can't tell what's cached under it.                                 */
+        dropDir( base, dir );
+        return;
+    }
+
+    /* Whatever is at name now isn't the directory that was cached there,     */
+    /* unless the event is about its attributes.                              */
+    child = findDir( base, path, ufsHashString( path, 0 ) );
+    free( path );
+    if ( child && !( event -> mask & ( IN_ATTRIB | IN_MODIFY ) ) )
+        dropDir( base, child );
+
+    dir -> generation = ++base -> serial;
+    if ( dir -> parent && ( event -> mask & ( IN_CREATE | IN_DELETE |
+                                              IN_MOVED_FROM | IN_MOVED_TO ) ) )
+        dropParentEntry( base, dir );
+}
+
+static void *monitor( void *arg )
+{
+    struct ufsBaseStruct *base;
+    struct pollfd fds[2];
+    const struct inotify_event *event;
+    uint64_t before;
+    ssize_t bytes, offset;
+    char buffer[ EVENT_BUFFER_BYTES ]
+        __attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+
+    base = arg;
+    fds[0] = (struct pollfd) { .fd = base -> wake[0], .events = POLLIN };
+    fds[1] = (struct pollfd) { .fd = base -> inotifyFd, .events = POLLIN };
+    for ( ;; ) {
+        if ( poll( fds, 2, -1 ) < 0 && errno != EINTR )
+            break;
+        if ( fds[0].revents )
+            break;
+
+        while ( ( bytes = read( base -> inotifyFd, buffer,
+                                sizeof( buffer ) ) ) > 0 ) {
+            pthread_mutex_lock( &base -> lock );
+            before = base -> numEntries;
+            for ( offset = 0; offset < bytes;
+                  offset += sizeof( *event ) + event -> len ) {
+                event = (const struct inotify_event*)( buffer + offset );
+                handleEvent( base, event );
+            }
+            if ( base -> numEntries < before )
+                base -> stats.invalidations += before - base -> numEntries;
+            pthread_mutex_unlock( &base -> lock );
+        }
+    }
+
+    return NULL;
+}
+
+/* Evicts directories until bytes were given back.                            */
+static uint64_t shrinkBase( void *cache, uint64_t bytes )
+{
+    struct ufsBaseStruct *base;
+    uint64_t before, after;
+
+    base = cache;
+    pthread_mutex_lock( &base -> lock );
+    before = ufsBudgetUsage( base -> budget, base -> budgetId );
+    after = before;
+    while ( before - after < bytes && evictDir( base, NULL ) )
+        after = ufsBudgetUsage( base -> budget, base -> budgetId );
+    pthread_mutex_unlock( &base -> lock );
+
+    return before - after;
+}
@@ -0,0 +1,380 @@
+/******************************************************************************\
+*  ufs_base.h                                                                  *
+*                                                                              *
+*  Internal header for access to the external fs BASE refers to.               *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* A base is opened on the root of the external fs. Lookups name a directory  */
+/* relative to the root, "" being the root itself, and an entry in it.        */
+/*                                                                            */
+/* Lookups are cached, missing entries included, in the directories that      */
+/* were looked up in. A cached directory is watched with inotify, as is       */
+/* every directory above it, so a rename anywhere on its path is seen.        */
+/* An entry that is a directory is cached only while that directory is        */
+/* watched, its times change with what's in it. The monitor thread drops      */
+/* entries as events about them arrive, a change is seen by lookups once      */
+/* the monitor handled it, usually well under a millisecond after.            */
+/*                                                                            */
+/* At most maxWatches directories are cached, the least recently used one     */
+/* without cached directories under it goes first. The cache is charged to    */
+/* the global budget and gives back directories under pressure.               */
+/* When inotify isn't available lookups go to the external fs every time.     */
+/*                                                                            */
+/* inotify only reports changes through the directory they were made in, a    */
+/* change made through another hard link of a cached file isn't seen.         */
+/* fanotify with FAN_REPORT_DFID_NAME has the same limit and needs            */
+/* privileges for anything but inode marks, it isn't used.                    */
+/*                                                                            */
+/* Once an image is attached, directories can also be named by the storage    */
+/* the scan loader put them in. Such a directory is reached through an        */
+/* O_PATH handle of its parent, opening one component at a time, so a deep    */
+/* directory costs a single lookup once its parent has a handle. Components   */
+/* are opened with openat2 and RESOLVE_BENEATH where the kernel has it, and   */
+/* never follow symbolic links, nothing outside the root can be reached.      */
+/* At most maxHandles handles are kept open, the least recently used one is   */
+/* closed first, handles in use are never closed. A handle follows its        */
+/* directory if it's renamed, BASE only changes on ufsCollapse, which must    */
+/* be followed by ufsBaseDropHandles.                                         */
+/*                                                                            */
+/* The batched calls and directory reads stat and open through an io_uring    */
+/* ring, a batch of n names takes about n / UFS_URING_DEPTH system calls,     */
+/* or n calls on kernels without io_uring. They don't go through the cache.   */
+/*                                                                            */
+/* When the image keeps a BASE index, ufsBaseStatAt answers lookups in        */
+/* directories the index has as clean from the image, checking the ctime of   */
+/* a directory once per handle, see ufs_base_index.h.                         */
+
+#ifndef UFS_BASE_H
+#define UFS_BASE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs_defs.h"
+#include "ufs_image.h"
+
+#define UFS_BASE_MAX_WATCHES (8192)
+#define UFS_BASE_MAX_HANDLES (1024)
+
+typedef struct ufsBaseStruct *ufsBasePtr;
+
+struct ufsBaseAttrStruct {
+    uint64_t inode,
+             size;
+    /* Nanoseconds since the epoch.                                           */
+    uint64_t mtime,
+             ctime;
+    uint32_t mode;
+};
+
+struct ufsBaseStatsStruct {
+    /* Lookups answered from the cache, missing entries included.             */
+    uint64_t hits,
+             misses;
+    /* Entries dropped on events, directories evicted to make room.           */
+    uint64_t invalidations,
+             evictions;
+    /* Directories watched right now.                                         */
+    uint64_t watches;
+    /* Directory handles open right now, handles closed to make room.         */
+    uint64_t handles,
+             closes;
+    /* Calls made in batches, io_uring_enter calls they took.                 */
+    uint64_t batched,
+             enters;
+    /* Lookups answered from the BASE index, directories found changed since  */
+    /* they were indexed.                                                     */
+    uint64_t indexed,
+             dirty;
+};
+
+/* Gets the entries of a directory read, a chunk at a time. Returns false to  */
+/* stop the read, setting ufsErrno.                                           */
+typedef bool (*ufsBaseEntrySink)( const char *const *names,
+                                  const struct ufsBaseAttrStruct *attrs,
+                                  uint64_t numEntries, void *userData );
+
+/******************************************************************************\
+* ufsBaseOpen                                                                  *
+*                                                                              *
+*  Opens the external fs under root.                                           *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: root is NULL.                                                *
+*   UFS_DOES_NOT_EXIST: root isn't a directory.                                *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -root: The root of the external fs.                                         *
+*  -maxWatches: The most directories to cache, 0 for UFS_BASE_MAX_WATCHES.     *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsBasePtr: The base, NULL on error.                                       *
+*                                                                              *
+\******************************************************************************/
+ufsBasePtr ufsBaseOpen( const char *root, uint64_t maxWatches );
+
+/******************************************************************************\
+* ufsBaseClose                                                                 *
+*                                                                              *
+*  Stops the monitor of base and frees it.                                     *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -base: The base, may be NULL.                                               *
+*                                                                              *
+\******************************************************************************/
+void ufsBaseClose( ufsBasePtr base );
+
+/******************************************************************************\
+* ufsBaseLookup                                                                *
+*                                                                              *
+*  Gets the attributes of name in dir, symbolic links are not followed.        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: base or name are NULL, name isn't a single component or      *
+*                 dir has an empty, "." or ".." component.                     *
+*   UFS_DOES_NOT_EXIST: dir doesn't contain name.                              *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: The external fs failed the lookup otherwise.            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -base: The base.                                                            *
+*  -dir: The directory relative to the root, NULL or "" for the root.          *
+*  -name: The name of the entry.                                               *
+*  -attr: Filled with the attributes, may be NULL.                             *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the entry exists, false otherwise.                           *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseLookup( ufsBasePtr base, const char *dir, const char *name,
+                    struct ufsBaseAttrStruct *attr );
+
+/******************************************************************************\
+* ufsBaseAttach                                                                *
+*                                                                              *
+*  Attaches img to base, dir being the storage the root was loaded in.         *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: base or img are NULL, dir is negative or base already has    *
+*                 an image.                                                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -base: The base.                                                            *
+*  -img: A mutable image holding BASE, see ufsScanLoad.                        *
+*  -dir: The storage of the root, 0 for the top level namespace.               *
+*  -maxHandles: The most handles to keep open, 0 for UFS_BASE_MAX_HANDLES.     *
+*               Never more than half the file descriptors the process may      *
+*               have open.                                                     *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseAttach( ufsBasePtr base, ufsImagePtr img, ufsIdType dir,
+                    uint64_t maxHandles );
+
+/******************************************************************************\
+* ufsBaseStatAt                                                                *
+*                                                                              *
+*  Gets the attributes of name in the directory of storage dir, symbolic       *
+*  links are not followed.                                                     *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: base has no image, name isn't a single component or dir      *
+*                 has a name that isn't.                                       *
+*   UFS_DOES_NOT_EXIST: dir isn't a directory under the root or it doesn't     *
+*                       contain name.                                          *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: The external fs failed the lookup otherwise.            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -base: The base.                                                            *
+*  -dir: The storage of the directory.                                         *
+*  -name: The name of the entry.                                               *
+*  -attr: Filled with the attributes, may be NULL.                             *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the entry exists, false otherwise.                           *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseStatAt( ufsBasePtr base, ufsIdType dir, const char *name,
+                    struct ufsBaseAttrStruct *attr );
+
+/******************************************************************************\
+* ufsBaseOpenAt                                                                *
+*                                                                              *
+*  Opens name in the directory of storage dir, symbolic links are not          *
+*  followed.                                                                   *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsBaseStatAt.                                                    *
+*   UFS_BAD_CALL: flags would create a file.                                   *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -base: The base.                                                            *
+*  -dir: The storage of the directory.                                         *
+*  -name: The name of the entry.                                               *
+*  -flags: The flags of open(2), O_NOFOLLOW and O_CLOEXEC are added.           *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int: A file descriptor the caller closes, -1 on error.                     *
+*                                                                              *
+\******************************************************************************/
+int ufsBaseOpenAt( ufsBasePtr base, ufsIdType dir, const char *name,
+                   int flags );
+
+/******************************************************************************\
+* ufsBaseStatBatch                                                             *
+*                                                                              *
+*  Gets the attributes of every name in the directory of storage dir,          *
+*  symbolic links are not followed.                                            *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: base has no image, names or statuses are NULL or dir has     *
+*                 a name that isn't a single component.                        *
+*   UFS_DOES_NOT_EXIST: dir isn't a directory under the root.                  *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: The external fs failed to open dir otherwise.           *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -base: The base.                                                            *
+*  -dir: The storage of the directory.                                         *
+*  -names: The names of the entries.                                           *
+*  -numNames: The number of names.                                             *
+*  -attrs: Filled with the attributes of the entries, may be NULL.             *
+*  -statuses: Filled with the error of each name, as ufsBaseStatAt would       *
+*             set it.                                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the names were looked up, false otherwise.                   *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseStatBatch( ufsBasePtr base, ufsIdType dir,
+                       const char *const *names, uint64_t numNames,
+                       struct ufsBaseAttrStruct *attrs,
+                       ufsStatusType *statuses );
+
+/******************************************************************************\
+* ufsBaseOpenBatch                                                             *
+*                                                                              *
+*  Opens every name in the directory of storage dir, symbolic links are not    *
+*  followed.                                                                   *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsBaseStatBatch.                                                 *
+*   UFS_BAD_CALL: fds is NULL or flags would create a file.                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -base: The base.                                                            *
+*  -dir: The storage of the directory.                                         *
+*  -names: The names of the entries.                                           *
+*  -numNames: The number of names.                                             *
+*  -flags: The flags of open(2), O_NOFOLLOW and O_CLOEXEC are added.           *
+*  -fds: Filled with file descriptors the caller closes, -1 for the names      *
+*        that couldn't be opened.                                              *
+*  -statuses: Filled with the error of each name, may be NULL.                 *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the names were opened, false otherwise.                      *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseOpenBatch( ufsBasePtr base, ufsIdType dir,
+                       const char *const *names, uint64_t numNames,
+                       int flags, int *fds, ufsStatusType *statuses );
+
+/******************************************************************************\
+* ufsBaseReadDirectory                                                         *
+*                                                                              *
+*  Reads the entries of the directory of storage dir with their attributes,    *
+*  "." and ".." excluded, in no particular order.                              *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsBaseStatBatch.                                                 *
+*   UFS_BAD_CALL: sink is NULL.                                                *
+*   Those sink sets.                                                           *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -base: The base.                                                            *
+*  -dir: The storage of the directory.                                         *
+*  -sink: Gets the entries, those removed during the read may be left out.     *
+*  -userData: Passed to sink.                                                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if every entry was read, false otherwise.                       *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseReadDirectory( ufsBasePtr base, ufsIdType dir,
+                           ufsBaseEntrySink sink, void *userData );
+
+/******************************************************************************\
+* ufsBaseRefresh                                                               *
+*                                                                              *
+*  Lists the directory of storage dir again into the BASE index of the image   *
+*  of base, adding storage for new entries, so lookups in it are answered      *
+*  from the image again. Must not run alongside other calls on base or         *
+*  writers of the image.                                                       *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsBaseReadDirectory and ufsStoreAddStorage.                      *
+*   UFS_BAD_CALL: The image has no BASE index or dir is 0.                     *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -base: The base.                                                            *
+*  -dir: The storage of the directory.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the directory was listed, false otherwise.                   *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseRefresh( ufsBasePtr base, ufsIdType dir );
+
+/******************************************************************************\
+* ufsBaseDropHandles                                                           *
+*                                                                              *
+*  Closes every handle of base, those in use once they aren't. Directories     *
+*  are checked against the BASE index again.                                   *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -base: The base, not NULL.                                                  *
+*                                                                              *
+\******************************************************************************/
+void ufsBaseDropHandles( ufsBasePtr base );
+
+/******************************************************************************\
+* ufsBaseGetStats                                                              *
+*                                                                              *
+*  Gets the statistics of the cache of base.                                   *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -base: The base, not NULL.                                                  *
+*  -stats: Filled with the statistics.                                         *
+*                                                                              *
+\******************************************************************************/
+void ufsBaseGetStats( ufsBasePtr base, struct ufsBaseStatsStruct *stats );
+
+#endif /* UFS_BASE_H */
@@ -0,0 +1,247 @@
+/******************************************************************************\
+*  ufs_base_index.c                                                            *
+*                                                                              *
+*  Contains the definitions for the BASE index kept in an image.               *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ufs_base_index.h"
+#include "ufs_layout.h"
+#include "ufs_store.h"
+
+struct listStruct {
+    ufsImagePtr img;
+    ufsIdType *ids;
+    uint64_t numIds,
+             capacity;
+};
+
+static struct ufsBaseRecordStruct *getRecord( ufsImagePtr img,
+                                              ufsIdType storage );
+static bool forgetChild( ufsIdType id, void *userData );
+static bool listChild( ufsIdType id, void *userData );
+static int compareIds( const void *a, const void *b );
+
+bool ufsBaseIndexHas( ufsImagePtr img )
+{
+    struct ufsHeaderStruct *header;
+
+    header = ufsLayoutHeader( img );
+    return header -> sizes[ UFS_TYPES_BASE ] &&
+           !( header -> flags & ( UFS_HEADER_FLAG_SEALED |
+                                  UFS_HEADER_FLAG_SNAPSHOT ) );
+}
+
+enum ufsBaseRecordStateEnum ufsBaseIndexGet( ufsImagePtr img,
+                                             ufsIdType storage,
+                                             struct ufsBaseAttrStruct *attr )
+{
+    struct ufsBaseRecordStruct *record;
+
+    record = getRecord( img, storage );
+    if ( !record )
+        return UFS_BASE_RECORD_UNKNOWN;
+
+    if ( attr && ( record -> state == UFS_BASE_RECORD_PRESENT ||
+                   record -> state == UFS_BASE_RECORD_LISTED ) )
+        *attr = (struct ufsBaseAttrStruct) {
+            .inode = record -> inode, .size = record -> size,
+            .mtime = record -> mtime, .ctime = record -> ctime,
+            .mode = record -> mode
+        };
+
+    return record -> state;
+}
+
+bool ufsBaseIndexSet( ufsImagePtr img, ufsIdType storage,
+                      enum ufsBaseRecordStateEnum state,
+                      const struct ufsBaseAttrStruct *attr )
+{
+    struct ufsBaseRecordStruct *record;
+    bool hasAttr;
+
+    hasAttr = state == UFS_BASE_RECORD_PRESENT ||
+              state == UFS_BASE_RECORD_LISTED;
+    record = getRecord( img, storage );
+    if ( !record || state > UFS_BASE_RECORD_LISTED ||
+         ( hasAttr && !attr ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    memset( record, 0, sizeof( *record ) );
+    record -> state = state;
+    if ( hasAttr ) {
+        record -> mode = attr -> mode;
+        record -> inode = attr -> inode;
+        record -> size = attr -> size;
+        record -> mtime = attr -> mtime;
+        record -> ctime = attr -> ctime;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsBaseIndexForget( ufsImagePtr img, ufsIdType dir )
+{
+    if ( !ufsBaseIndexHas( img ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    /* A directory without children has nothing to forget.                    */
+    ufsStoreIterateChildren( img, dir, forgetChild, img );
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+/* The root is stat'ed before it's read, a change during the scan makes it    */
+/* dirty on its first check.                                                  */
+bool ufsBaseIndexLoad( ufsImagePtr img, ufsIdType dir, const char *root,
+                       struct ufsScanOptionsStruct options,
+                       struct ufsScanStatsStruct *stats )
+{
+    struct ufsBaseAttrStruct attr;
+    ufsScanLoaderPtr loader;
+    struct statx stx;
+    ufsStatusType status;
+    bool ok;
+
+    if ( !img || !root || dir < 0 || !ufsBaseIndexHas( img ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( statx( AT_FDCWD, root, 0, UFS_BASE_INDEX_MASK, &stx ) ||
+         !S_ISDIR( stx.stx_mode ) ) {
+        ufsErrno = errno == ENOMEM ? UFS_OUT_OF_MEMORY : UFS_DOES_NOT_EXIST;
+        return false;
+    }
+
+    attr = (struct ufsBaseAttrStruct) {
+        .inode = stx.stx_ino, .size = stx.stx_size,
+        .mtime = (uint64_t) stx.stx_mtime.tv_sec * 1000000000 +
+                 stx.stx_mtime.tv_nsec,
+        .ctime = (uint64_t) stx.stx_ctime.tv_sec * 1000000000 +
+                 stx.stx_ctime.tv_nsec,
+        .mode = stx.stx_mode
+    };
+    if ( dir && !ufsBaseIndexSet( img, dir, UFS_BASE_RECORD_PRESENT, &attr ) )
+        return false;
+    if ( !ufsBaseIndexForget( img, dir ) )
+        return false;
+
+    loader = ufsScanLoaderCreate( img, dir );
+    if ( !loader )
+        return false;
+
+    options.statxMask |= UFS_BASE_INDEX_MASK;
+    options.done = ufsScanLoadDone;
+    ok = ufsScan( root, options, ufsScanLoad, loader, stats );
+    status = ufsErrno;
+    ufsScanLoaderFree( loader );
+
+    ufsErrno = status;
+    return ok;
+}
+
+bool ufsBaseIndexList( ufsImagePtr img, ufsIdType dir, ufsIdType **ids,
+                       uint64_t *numIds )
+{
+    struct listStruct list;
+
+    if ( !ids || !numIds ||
+         ufsBaseIndexGet( img, dir, NULL ) != UFS_BASE_RECORD_LISTED ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    memset( &list, 0, sizeof( list ) );
+    list.img = img;
+    ufsStoreIterateChildren( img, dir, listChild, &list );
+    if ( list.numIds > list.capacity ) {
+        free( list.ids );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    qsort( list.ids, list.numIds, sizeof( *list.ids ), compareIds );
+    *ids = list.ids;
+    *numIds = list.numIds;
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+/* NULL when img has no index or storage isn't a file record.                 */
+static struct ufsBaseRecordStruct *getRecord( ufsImagePtr img,
+                                              ufsIdType storage )
+{
+    if ( !img || !ufsBaseIndexHas( img ) || storage <= 0 ||
+         (uint64_t) storage > ufsLayoutCapacity( img, UFS_TYPES_BASE ) )
+        return NULL;
+
+    return &ufsLayoutBaseRecords( img )[ storage - 1 ];
+}
+
+static bool forgetChild( ufsIdType id, void *userData )
+{
+    struct ufsBaseRecordStruct *record;
+
+    record = getRecord( userData, id );
+    if ( record && ( record -> state == UFS_BASE_RECORD_PRESENT ||
+                     record -> state == UFS_BASE_RECORD_LISTED ) ) {
+        memset( record, 0, sizeof( *record ) );
+        record -> state = UFS_BASE_RECORD_ABSENT;
+    }
+
+    return true;
+}
+
+/* Counts on past the capacity once out of memory, so the caller knows.       */
+static bool listChild( ufsIdType id, void *userData )
+{
+    struct listStruct *list;
+    enum ufsBaseRecordStateEnum state;
+    ufsIdType *ids;
+    uint64_t capacity;
+
+    list = userData;
+    state = ufsBaseIndexGet( list -> img, id, NULL );
+    if ( state != UFS_BASE_RECORD_PRESENT && state != UFS_BASE_RECORD_LISTED )
+        return true;
+
+    if ( list -> numIds == list -> capacity ) {
+        capacity = list -> capacity ? list -> capacity * 2 : 64;
+        ids = realloc( list -> ids, capacity * sizeof( *ids ) );
+        if ( !ids ) {
+            list -> numIds = list -> capacity + 1;
+            return false;
+        }
+        list -> ids = ids;
+        list -> capacity = capacity;
+    }
+
+    list -> ids[ list -> numIds++ ] = id;
+    return true;
+}
+
+static int compareIds( const void *a, const void *b )
+{
+    ufsIdType x, y;
+
+    x = *(const ufsIdType*) a;
+    y = *(const ufsIdType*) b;
+    return ( x > y ) - ( x < y );
+}
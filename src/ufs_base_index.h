@@ -0,0 +1,191 @@
+/******************************************************************************\
+*  ufs_base_index.h                                                            *
+*                                                                              *
+*  Internal header for the BASE index kept in an image.                        *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* An image created with baseIndex keeps, for every storage loaded from BASE, */
+/* the attributes BASE had for it, see struct ufsBaseRecordStruct. A record   */
+/* is PRESENT once an entry was seen, ABSENT once it was gone, a directory is */
+/* LISTED when every entry in it has a record as well, which ufsScanLoadDone  */
+/* marks when the scanner read it to the end. Storage without a record isn't  */
+/* from BASE.                                                                 */
+/*                                                                            */
+/* A LISTED directory is clean while its ctime on the external fs is the one  */
+/* recorded, adding, removing or renaming an entry in it changes its ctime.   */
+/* ufsBaseStatAt answers lookups in clean directories from the image and      */
+/* checks each directory once while it has a handle, see ufs_base.h, so after */
+/* a restart BASE is stat'ed a directory at a time rather than an entry at a  */
+/* time. Directories found changed are looked up on the external fs until     */
+/* ufsBaseRefresh or a new load lists them again.                             */
+/*                                                                            */
+/* Changes to an entry that leave its directory alone, e.g. writing a file,   */
+/* aren't seen. BASE only changes through ufsCollapse, which must reload or   */
+/* refresh what it changed. On filesystems with coarse timestamps a change    */
+/* in the same tick as a directory was scanned may go unseen as well.         */
+/*                                                                            */
+/* Records line up with the file records, a new storage starts without one.   */
+/* Sealed images, snapshots and replication streams don't carry the index.    */
+
+#ifndef UFS_BASE_INDEX_H
+#define UFS_BASE_INDEX_H
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "ufs_base.h"
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_scan.h"
+
+/* The fields a scan has to ask for to fill records.                          */
+#define UFS_BASE_INDEX_MASK ( STATX_TYPE | STATX_MODE | STATX_INO |           \
+                              STATX_SIZE | STATX_MTIME | STATX_CTIME )
+
+/******************************************************************************\
+* ufsBaseIndexHas                                                              *
+*                                                                              *
+*  Checks whether img keeps a BASE index that can be written.                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: A validated image, not NULL.                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if it does, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseIndexHas( ufsImagePtr img );
+
+/******************************************************************************\
+* ufsBaseIndexGet                                                              *
+*                                                                              *
+*  Gets the record of storage.                                                 *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: A validated image, not NULL.                                          *
+*  -storage: The storage.                                                      *
+*  -attr: Filled with the attributes of a PRESENT or LISTED record, may be     *
+*         NULL.                                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -enum ufsBaseRecordStateEnum: The state of the record, UNKNOWN when img     *
+*                                has no index or storage has no record.        *
+*                                                                              *
+\******************************************************************************/
+enum ufsBaseRecordStateEnum ufsBaseIndexGet( ufsImagePtr img,
+                                             ufsIdType storage,
+                                             struct ufsBaseAttrStruct *attr );
+
+/******************************************************************************\
+* ufsBaseIndexSet                                                              *
+*                                                                              *
+*  Sets the record of storage.                                                 *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img has no index, storage isn't a storage of img, state      *
+*                 isn't a state or attr is NULL for a PRESENT or LISTED one.   *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: A validated image, not NULL.                                          *
+*  -storage: The storage.                                                      *
+*  -state: The state of the record.                                            *
+*  -attr: The attributes BASE has for storage, ignored unless PRESENT or       *
+*         LISTED.                                                              *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseIndexSet( ufsImagePtr img, ufsIdType storage,
+                      enum ufsBaseRecordStateEnum state,
+                      const struct ufsBaseAttrStruct *attr );
+
+/******************************************************************************\
+* ufsBaseIndexForget                                                           *
+*                                                                              *
+*  Marks every entry of dir recorded in the index ABSENT, before it's listed   *
+*  again.                                                                      *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img has no index.                                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: A validated image, not NULL.                                          *
+*  -dir: The directory, 0 for the top level namespace.                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseIndexForget( ufsImagePtr img, ufsIdType dir );
+
+/******************************************************************************\
+* ufsBaseIndexLoad                                                             *
+*                                                                              *
+*  Scans root into dir of img, recording the attributes of everything in it    *
+*  and of root itself unless dir is the top level namespace.                   *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsScanLoaderCreate and ufsScan.                                  *
+*   UFS_BAD_CALL: img has no index.                                            *
+*   UFS_DOES_NOT_EXIST: root isn't a directory.                                *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: A validated, writable image with an index.                            *
+*  -dir: The storage of root, 0 for the top level namespace.                   *
+*  -root: The root of the external fs.                                         *
+*  -options: How to scan it, UFS_BASE_INDEX_MASK is added to statxMask.        *
+*  -stats: Filled with what the scan saw, may be NULL.                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the whole tree was loaded, false otherwise. Directories      *
+*         that weren't listed to the end are left out of the index.            *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseIndexLoad( ufsImagePtr img, ufsIdType dir, const char *root,
+                       struct ufsScanOptionsStruct options,
+                       struct ufsScanStatsStruct *stats );
+
+/******************************************************************************\
+* ufsBaseIndexList                                                             *
+*                                                                              *
+*  Lists the entries BASE has in dir as storage identifiers in increasing      *
+*  order, so they merge with the listings of the areas.                        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: ids or numIds are NULL or dir isn't LISTED.                  *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: A validated image, not NULL.                                          *
+*  -dir: The directory.                                                        *
+*  -ids: Set to the identifiers, which the caller frees.                       *
+*  -numIds: Set to the number of identifiers.                                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBaseIndexList( ufsImagePtr img, ufsIdType dir, ufsIdType **ids,
+                       uint64_t *numIds );
+
+#endif /* UFS_BASE_INDEX_H */
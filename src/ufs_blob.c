@@ -0,0 +1,1557 @@
+/******************************************************************************\
+*  ufs_blob.c                                                                  *
+*                                                                              *
+*  Contains the definitions for the content addressed store of file data.      *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include "ufs_blob.h"
+#include "ufs_defs.h"
+#include "ufs_pool.h"
+#include "ufs_store.h"
+#include <unistd.h>
+
+#define REFS_NAME ("refs")
+#define RANGES_NAME ("ranges")
+#define TMP_NAME ("tmp")
+#define BUFFER_SIZE (65536)
+/* copy_file_range copies what it can of this in one call.                    */
+#define COPY_CHUNK ( 1 << 30 )
+/* "ab/" followed by the other 62 hex digits.                                 */
+#define BLOB_NAME_SIZE ( 2 * UFS_BLOB_DIGEST_SIZE + 2 )
+#define ENTRY_NAME_SIZE (64)
+/* Gaps are filled this much at a time, writes wait for one chunk at most.    */
+#define FILL_CHUNK ( 16 << 20 )
+/* Segments mapped at a time by ufsBlobLazyRead.                              */
+#define READ_SEGMENTS (16)
+
+struct ufsBlobStoreStruct {
+    /* Taken for writing by ufsBlobCollect only.                              */
+    pthread_rwlock_t lock;
+    int dirFd,
+        refsFd,
+        rangesFd,
+        tmpFd;
+    /* Fills the gaps of lazy copy ups that were closed.                      */
+    ufsPoolPtr pool;
+    uint64_t nextTmp;
+    uint64_t puts,
+             hits;
+    uint64_t copyUps,
+             reflinks,
+             lazyCopyUps;
+};
+
+/* A range written, [ start, end ).                                           */
+struct rangeStruct {
+    uint64_t start,
+             end;
+};
+
+/* The ranges log starts with the size of the source, records follow.         */
+struct ufsBlobLazyStruct {
+    struct ufsBlobStoreStruct *store;
+    pthread_mutex_t lock;
+    ufsIdType area,
+              file;
+    /* The private data, the source and the ranges log, -1 once complete.     */
+    int fd,
+        srcFd,
+        rangesFd;
+    uint64_t size,
+             srcSize;
+    /* Sorted and merged.                                                     */
+    struct rangeStruct *ranges;
+    uint64_t numRanges,
+             capacity;
+    /* Records in the log, more than numRanges once ranges were merged.       */
+    uint64_t numRecords;
+    bool complete;
+};
+
+struct sha256Struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    uint32_t used;
+};
+
+/* Gets an entry of a directory walked, returns false to stop the walk.       */
+typedef bool (*walkFn)( int dirFd, const char *name, const struct stat *st,
+                        void *userData );
+
+struct walkBlobsStruct {
+    walkFn fn;
+    void *userData;
+};
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256Init( struct sha256Struct *sha );
+static void sha256Update( struct sha256Struct *sha, const uint8_t *data,
+                          uint64_t len );
+static void sha256Final( struct sha256Struct *sha,
+                         struct ufsBlobDigestStruct *digest );
+static void sha256Block( struct sha256Struct *sha, const uint8_t *block );
+static inline uint32_t rotr( uint32_t x, uint32_t n );
+
+static bool openDir( int parentFd, const char *name, int *fd );
+static void clearTmp( struct ufsBlobStoreStruct *store );
+static bool hashFd( int fd, int copyFd, uint8_t *buffer,
+                    struct ufsBlobDigestStruct *digest );
+static bool copyRange( int inFd, int outFd, uint64_t start, uint64_t end );
+static void nextTmpName( struct ufsBlobStoreStruct *store, char *name );
+static int makeTmp( struct ufsBlobStoreStruct *store, char *name, int flags,
+                    mode_t mode );
+static bool linkBlob( struct ufsBlobStoreStruct *store, const char *tmpName,
+                      const char *blobName );
+static bool cloneBlob( struct ufsBlobStoreStruct *store, const char *blobName,
+                       char *tmpName );
+static void blobName( const struct ufsBlobDigestStruct *digest, char *name );
+static void refName( ufsIdType area, ufsIdType file, char *name );
+static bool installAt( struct ufsBlobStoreStruct *store, const char *tmpName,
+                       int dirFd, ufsIdType area, const char *ref );
+static void srcName( ufsIdType area, ufsIdType file, char *name );
+static void dropRanges( struct ufsBlobStoreStruct *store, ufsIdType area,
+                        ufsIdType file );
+static bool startLazy( struct ufsBlobLazyStruct *lazy, ufsImagePtr img,
+                       int srcFd, bool isBlob );
+static bool resumeLazy( struct ufsBlobLazyStruct *lazy, int srcFd );
+static bool loadRanges( struct ufsBlobLazyStruct *lazy );
+static bool addRange( struct ufsBlobLazyStruct *lazy, uint64_t start,
+                      uint64_t end );
+static bool logRange( struct ufsBlobLazyStruct *lazy, uint64_t start,
+                      uint64_t end );
+static uint64_t findRange( struct ufsBlobLazyStruct *lazy, uint64_t offset );
+static bool fillLazy( struct ufsBlobLazyStruct *lazy );
+static void compactRanges( struct ufsBlobLazyStruct *lazy );
+static void completeJob( void *arg );
+static void freeLazy( struct ufsBlobLazyStruct *lazy );
+static bool walkDir( int parentFd, const char *name, walkFn fn,
+                     void *userData );
+static bool walkBlobs( struct ufsBlobStoreStruct *store, walkFn fn,
+                       void *userData );
+static bool walkFan( int dirFd, const char *name, const struct stat *st,
+                     void *userData );
+static bool collectBlob( int dirFd, const char *name, const struct stat *st,
+                         void *userData );
+static bool countBlob( int dirFd, const char *name, const struct stat *st,
+                       void *userData );
+static bool walkArea( int dirFd, const char *name, const struct stat *st,
+                      void *userData );
+static bool countRef( int dirFd, const char *name, const struct stat *st,
+                      void *userData );
+
+ufsBlobStorePtr ufsBlobOpen( const char *path )
+{
+    struct ufsBlobStoreStruct *store;
+
+    if ( !path ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    store = calloc( 1, sizeof( *store ) );
+    if ( !store ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    store -> dirFd = store -> refsFd = store -> rangesFd = -1;
+    store -> tmpFd = -1;
+    pthread_rwlock_init( &store -> lock, NULL );
+    if ( !openDir( AT_FDCWD, path, &store -> dirFd ) ||
+         !openDir( store -> dirFd, REFS_NAME, &store -> refsFd ) ||
+         !openDir( store -> dirFd, RANGES_NAME, &store -> rangesFd ) ||
+         !openDir( store -> dirFd, TMP_NAME, &store -> tmpFd ) ) {
+        ufsBlobClose( store );
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return NULL;
+    }
+
+    store -> pool = ufsPoolCreate( 1 );
+    if ( !store -> pool ) {
+        ufsBlobClose( store );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    clearTmp( store );
+    ufsErrno = UFS_NO_ERROR;
+    return store;
+}
+
+void ufsBlobClose( ufsBlobStorePtr store )
+{
+    if ( !store )
+        return;
+
+    ufsPoolDestroy( store -> pool );
+    if ( store -> tmpFd >= 0 )
+        close( store -> tmpFd );
+    if ( store -> rangesFd >= 0 )
+        close( store -> rangesFd );
+    if ( store -> refsFd >= 0 )
+        close( store -> refsFd );
+    if ( store -> dirFd >= 0 )
+        close( store -> dirFd );
+    pthread_rwlock_destroy( &store -> lock );
+    free( store );
+}
+
+bool ufsBlobPut( ufsBlobStorePtr store, int fd,
+                 struct ufsBlobDigestStruct *digest )
+{
+    char name[ BLOB_NAME_SIZE ], tmpName[ ENTRY_NAME_SIZE ];
+    struct stat st;
+    uint8_t *buffer;
+    int tmpFd;
+    bool ok;
+
+    if ( !store || !digest ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    buffer = malloc( BUFFER_SIZE );
+    if ( !buffer ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    pthread_rwlock_rdlock( &store -> lock );
+    ok = hashFd( fd, -1, buffer, digest );
+    if ( ok ) {
+        __atomic_fetch_add( &store -> puts, 1, __ATOMIC_RELAXED );
+        blobName( digest, name );
+        if ( !fstatat( store -> dirFd, name, &st, AT_SYMLINK_NOFOLLOW ) ) {
+            __atomic_fetch_add( &store -> hits, 1, __ATOMIC_RELAXED );
+        } else if ( ( tmpFd = makeTmp( store, tmpName, O_WRONLY,
+                                       0444 ) ) < 0 ) {
+            ok = false;
+        } else {
+            /* What's stored is what was hashed while copying, fd may have    */
+            /* changed since the first read.                                  */
+            ok = hashFd( fd, tmpFd, buffer, digest );
+            if ( ok && fdatasync( tmpFd ) ) {
+                ufsErrno = UFS_UNKNOWN_ERROR;
+                ok = false;
+            }
+            close( tmpFd );
+            blobName( digest, name );
+            ok = ok && linkBlob( store, tmpName, name );
+            unlinkat( store -> tmpFd, tmpName, 0 );
+        }
+    }
+
+    pthread_rwlock_unlock( &store -> lock );
+    free( buffer );
+    if ( ok )
+        ufsErrno = UFS_NO_ERROR;
+
+    return ok;
+}
+
+bool ufsBlobRef( ufsBlobStorePtr store, ufsIdType area, ufsIdType file,
+                 const struct ufsBlobDigestStruct *digest )
+{
+    char name[ BLOB_NAME_SIZE ], tmpName[ ENTRY_NAME_SIZE ],
+         ref[ ENTRY_NAME_SIZE ];
+    bool ok;
+
+    if ( !store || area <= 0 || file <= 0 || !digest ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    blobName( digest, name );
+    refName( area, file, ref );
+    pthread_rwlock_rdlock( &store -> lock );
+
+    nextTmpName( store, tmpName );
+    ok = true;
+    if ( linkat( store -> dirFd, name, store -> tmpFd, tmpName, 0 ) ) {
+        if ( errno == ENOENT ) {
+            ufsErrno = UFS_DOES_NOT_EXIST;
+            ok = false;
+        } else if ( errno == EMLINK ) {
+            ok = cloneBlob( store, name, tmpName );
+        } else {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            ok = false;
+        }
+    }
+
+    ok = ok && installAt( store, tmpName, store -> refsFd, area, ref );
+    if ( ok )
+        dropRanges( store, area, file );
+
+    pthread_rwlock_unlock( &store -> lock );
+    if ( ok )
+        ufsErrno = UFS_NO_ERROR;
+
+    return ok;
+}
+
+bool ufsBlobUnref( ufsBlobStorePtr store, ufsIdType area, ufsIdType file )
+{
+    char ref[ ENTRY_NAME_SIZE ];
+    int ret;
+
+    if ( !store || area <= 0 || file <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    refName( area, file, ref );
+    pthread_rwlock_rdlock( &store -> lock );
+    ret = unlinkat( store -> refsFd, ref, 0 );
+    dropRanges( store, area, file );
+    pthread_rwlock_unlock( &store -> lock );
+    if ( ret ) {
+        ufsErrno = errno == ENOENT ? UFS_DOES_NOT_EXIST : UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+int ufsBlobOpenFile( ufsBlobStorePtr store, ufsIdType area, ufsIdType file,
+                     bool write )
+{
+    char ref[ ENTRY_NAME_SIZE ];
+    struct stat st;
+    int fd;
+
+    if ( !store || area <= 0 || file <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    refName( area, file, ref );
+    fd = openat( store -> refsFd, ref, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 ) {
+        ufsErrno = errno == ENOENT ? UFS_DOES_NOT_EXIST : UFS_UNKNOWN_ERROR;
+        return -1;
+    }
+
+    /* The gaps of a lazy copy up read as zeros, a blob with a ranges log is  */
+    /* one that a crash stopped from starting.                                */
+    if ( fstat( fd, &st ) || ( st.st_nlink == 1 &&
+                               !faccessat( store -> rangesFd, ref, F_OK,
+                                           0 ) ) ) {
+        close( fd );
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( !write ) {
+        ufsErrno = UFS_NO_ERROR;
+        return fd;
+    }
+
+    /* Write permission isn't checked for root, the link count is.            */
+    if ( st.st_nlink != 1 ) {
+        close( fd );
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    close( fd );
+    fd = openat( store -> refsFd, ref, O_RDWR | O_CLOEXEC );
+    if ( fd < 0 ) {
+        ufsErrno = errno == ENOENT ? UFS_DOES_NOT_EXIST : UFS_UNKNOWN_ERROR;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return fd;
+}
+
+int ufsBlobCopyUp( ufsBlobStorePtr store, ufsImagePtr img, ufsIdType area,
+                   ufsIdType file, int srcFd )
+{
+    char tmpName[ ENTRY_NAME_SIZE ], ref[ ENTRY_NAME_SIZE ];
+    struct stat st;
+    bool ok;
+    int fd;
+
+    if ( !store || area <= 0 || file <= 0 || fstat( srcFd, &st ) ||
+         !S_ISREG( st.st_mode ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    refName( area, file, ref );
+    pthread_rwlock_rdlock( &store -> lock );
+    fd = makeTmp( store, tmpName, O_RDWR, 0644 );
+    ok = fd >= 0;
+    if ( ok ) {
+        /* A reflink shares the extents of srcFd, nothing is copied.          */
+        if ( !ioctl( fd, FICLONE, srcFd ) ) {
+            __atomic_fetch_add( &store -> reflinks, 1, __ATOMIC_RELAXED );
+        } else if ( !copyRange( srcFd, fd, 0, UINT64_MAX ) ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            ok = false;
+        }
+
+        if ( ok && fdatasync( fd ) ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            ok = false;
+        }
+
+        if ( ok )
+            ok = installAt( store, tmpName, store -> refsFd, area, ref );
+        else
+            unlinkat( store -> tmpFd, tmpName, 0 );
+        if ( ok )
+            dropRanges( store, area, file );
+    }
+
+    /* The data is complete before the mapping makes it seen.                 */
+    if ( ok && img && !ufsStoreAddMapping( img, area, file ) &&
+         ufsErrno != UFS_MAPPING_ALREADY_EXISTS ) {
+        unlinkat( store -> refsFd, ref, 0 );
+        ok = false;
+    }
+
+    if ( ok )
+        __atomic_fetch_add( &store -> copyUps, 1, __ATOMIC_RELAXED );
+    pthread_rwlock_unlock( &store -> lock );
+    if ( !ok ) {
+        if ( fd >= 0 )
+            close( fd );
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return fd;
+}
+
+ufsBlobLazyPtr ufsBlobLazyOpen( ufsBlobStorePtr store, ufsImagePtr img,
+                                ufsIdType area, ufsIdType file, int srcFd )
+{
+    struct ufsBlobLazyStruct *lazy;
+    char ref[ ENTRY_NAME_SIZE ];
+    struct stat st;
+    int fd;
+    bool ok;
+
+    if ( !store || area <= 0 || file <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    lazy = calloc( 1, sizeof( *lazy ) );
+    if ( !lazy ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    lazy -> store = store;
+    lazy -> area = area;
+    lazy -> file = file;
+    lazy -> fd = lazy -> srcFd = lazy -> rangesFd = -1;
+    pthread_mutex_init( &lazy -> lock, NULL );
+
+    refName( area, file, ref );
+    pthread_rwlock_rdlock( &store -> lock );
+    fd = openat( store -> refsFd, ref, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 && errno != ENOENT ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        ok = false;
+    } else if ( fd < 0 ) {
+        ok = startLazy( lazy, img, srcFd, false );
+    } else if ( fstat( fd, &st ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        ok = false;
+    } else if ( st.st_nlink != 1 ) {
+        /* A blob is its own source, it's kept by a link while it's needed.   */
+        ok = startLazy( lazy, img, fd, true );
+    } else {
+        lazy -> size = st.st_size;
+        ok = resumeLazy( lazy, srcFd );
+    }
+
+    pthread_rwlock_unlock( &store -> lock );
+    if ( fd >= 0 )
+        close( fd );
+    if ( !ok ) {
+        freeLazy( lazy );
+        return NULL;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return lazy;
+}
+
+bool ufsBlobLazyWrite( ufsBlobLazyPtr lazy, const void *buf, uint64_t len,
+                       uint64_t off )
+{
+    const uint8_t *bytes;
+    uint64_t done;
+    ssize_t got;
+    bool ok;
+
+    if ( !lazy || !buf ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    bytes = buf;
+    pthread_mutex_lock( &lazy -> lock );
+    for ( done = 0, got = 0; done < len && got >= 0; done += got ) {
+        got = pwrite( lazy -> fd, bytes + done, len - done, off + done );
+        if ( got < 0 && errno == EINTR )
+            got = 0;
+        else if ( !got )
+            got = -1;
+    }
+
+    ok = got >= 0;
+    if ( !ok )
+        ufsErrno = UFS_UNKNOWN_ERROR;
+
+    /* The range is logged once it holds the data, a crash in between reads   */
+    /* the source as if the write hadn't happened.                            */
+    if ( ok && len && !lazy -> complete )
+        ok = logRange( lazy, off, off + len ) &&
+             addRange( lazy, off, off + len );
+    if ( ok && off + len > lazy -> size )
+        lazy -> size = off + len;
+    pthread_mutex_unlock( &lazy -> lock );
+    if ( ok )
+        ufsErrno = UFS_NO_ERROR;
+
+    return ok;
+}
+
+bool ufsBlobLazyMap( ufsBlobLazyPtr lazy, uint64_t offset, uint64_t length,
+                     struct ufsBlobSegmentStruct *segments,
+                     uint64_t maxSegments, uint64_t *numSegments )
+{
+    struct ufsBlobSegmentStruct next, *last;
+    uint64_t end, i, n;
+
+    if ( !lazy || !segments || !numSegments || !maxSegments ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    pthread_mutex_lock( &lazy -> lock );
+    end = offset + length < lazy -> size && offset + length >= offset ?
+          offset + length : lazy -> size;
+    i = findRange( lazy, offset );
+    n = 0;
+    while ( offset < end ) {
+        next.offset = offset;
+        if ( lazy -> complete ) {
+            next.fd = lazy -> fd;
+            next.length = end - offset;
+        } else if ( i < lazy -> numRanges &&
+                    lazy -> ranges[i].start <= offset ) {
+            next.fd = lazy -> fd;
+            next.length = ( lazy -> ranges[i].end < end ?
+                            lazy -> ranges[i].end : end ) - offset;
+            i++;
+        } else {
+            next.length = ( i < lazy -> numRanges &&
+                            lazy -> ranges[i].start < end ?
+                            lazy -> ranges[i].start : end ) - offset;
+            /* Past the end of the source the private data reads as zeros.    */
+            if ( offset < lazy -> srcSize ) {
+                next.fd = lazy -> srcFd;
+                if ( offset + next.length > lazy -> srcSize )
+                    next.length = lazy -> srcSize - offset;
+            } else {
+                next.fd = lazy -> fd;
+            }
+        }
+
+        last = n ? &segments[ n - 1 ] : NULL;
+        if ( last && last -> fd == next.fd &&
+             last -> offset + last -> length == next.offset ) {
+            last -> length += next.length;
+        } else if ( n < maxSegments ) {
+            segments[ n++ ] = next;
+        } else {
+            break;
+        }
+
+        offset += next.length;
+    }
+
+    pthread_mutex_unlock( &lazy -> lock );
+    *numSegments = n;
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+int64_t ufsBlobLazyRead( ufsBlobLazyPtr lazy, void *buf, uint64_t len,
+                         uint64_t off )
+{
+    struct ufsBlobSegmentStruct segments[ READ_SEGMENTS ];
+    uint64_t numSegments, i, done, want;
+    uint8_t *bytes;
+    ssize_t got;
+
+    if ( !lazy || !buf ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    bytes = buf;
+    for ( done = 0; done < len; ) {
+        ufsBlobLazyMap( lazy, off + done, len - done, segments,
+                        READ_SEGMENTS, &numSegments );
+        if ( !numSegments )
+            break;
+
+        for ( i = 0; i < numSegments; i++ ) {
+            for ( want = segments[i].length; want; want -= got ) {
+                got = pread( segments[i].fd, bytes + done, want,
+                             segments[i].offset + segments[i].length - want );
+                if ( got < 0 && errno == EINTR ) {
+                    got = 0;
+                    continue;
+                }
+                if ( got < 0 ) {
+                    ufsErrno = UFS_UNKNOWN_ERROR;
+                    return -1;
+                }
+                /* The source shrank since, what's missing reads as zeros.    */
+                if ( !got ) {
+                    memset( bytes + done, 0, want );
+                    got = want;
+                }
+                done += got;
+            }
+        }
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return done;
+}
+
+bool ufsBlobLazyComplete( ufsBlobLazyPtr lazy )
+{
+    bool ok;
+
+    if ( !lazy ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    pthread_rwlock_rdlock( &lazy -> store -> lock );
+    ok = fillLazy( lazy );
+    pthread_rwlock_unlock( &lazy -> store -> lock );
+    if ( ok )
+        ufsErrno = UFS_NO_ERROR;
+
+    return ok;
+}
+
+bool ufsBlobLazyApply( ufsBlobLazyPtr lazy, int dstFd )
+{
+    uint64_t i;
+    bool ok;
+
+    if ( !lazy ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    pthread_mutex_lock( &lazy -> lock );
+    if ( lazy -> complete ) {
+        ok = copyRange( lazy -> fd, dstFd, 0, lazy -> size );
+    } else {
+        for ( i = 0, ok = true; ok && i < lazy -> numRanges; i++ )
+            ok = copyRange( lazy -> fd, dstFd, lazy -> ranges[i].start,
+                            lazy -> ranges[i].end );
+    }
+
+    ok = ok && !ftruncate( dstFd, lazy -> size );
+    pthread_mutex_unlock( &lazy -> lock );
+    if ( !ok ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+void ufsBlobLazyClose( ufsBlobLazyPtr lazy, bool complete )
+{
+    if ( !lazy )
+        return;
+
+    if ( complete && !lazy -> complete &&
+         ufsPoolSubmit( lazy -> store -> pool, completeJob, lazy ) )
+        return;
+
+    /* The gaps are filled here when no worker can take them.                 */
+    if ( complete )
+        ufsBlobLazyComplete( lazy );
+    if ( !lazy -> complete )
+        compactRanges( lazy );
+
+    freeLazy( lazy );
+}
+
+bool ufsBlobCollect( ufsBlobStorePtr store, uint64_t *numRemoved )
+{
+    uint64_t removed;
+    bool ok;
+
+    if ( !store ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    removed = 0;
+    pthread_rwlock_wrlock( &store -> lock );
+    ok = walkBlobs( store, collectBlob, &removed );
+    pthread_rwlock_unlock( &store -> lock );
+    if ( numRemoved )
+        *numRemoved = removed;
+    if ( !ok ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsBlobGetStats( ufsBlobStorePtr store, struct ufsBlobStatsStruct *stats )
+{
+    bool ok;
+
+    if ( !store || !stats ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    memset( stats, 0, sizeof( *stats ) );
+    pthread_rwlock_rdlock( &store -> lock );
+    ok = walkBlobs( store, countBlob, stats ) &&
+         walkDir( store -> dirFd, REFS_NAME, walkArea, stats );
+    stats -> puts = __atomic_load_n( &store -> puts, __ATOMIC_RELAXED );
+    stats -> hits = __atomic_load_n( &store -> hits, __ATOMIC_RELAXED );
+    stats -> copyUps = __atomic_load_n( &store -> copyUps, __ATOMIC_RELAXED );
+    stats -> reflinks = __atomic_load_n( &store -> reflinks,
+                                         __ATOMIC_RELAXED );
+    stats -> lazyCopyUps = __atomic_load_n( &store -> lazyCopyUps,
+                                            __ATOMIC_RELAXED );
+    pthread_rwlock_unlock( &store -> lock );
+    if ( !ok ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    stats -> dedupPercent = stats -> physicalBytes ?
+                            stats -> logicalBytes * 100 /
+                            stats -> physicalBytes : 100;
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+static void sha256Init( struct sha256Struct *sha )
+{
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f,
+        0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy( sha -> state, initial, sizeof( initial ) );
+    sha -> length = 0;
+    sha -> used = 0;
+}
+
+static void sha256Update( struct sha256Struct *sha, const uint8_t *data,
+                          uint64_t len )
+{
+    uint64_t take;
+
+    sha -> length += len;
+    while ( len ) {
+        if ( !sha -> used && len >= sizeof( sha -> block ) ) {
+            sha256Block( sha, data );
+            data += sizeof( sha -> block );
+            len -= sizeof( sha -> block );
+            continue;
+        }
+
+        take = sizeof( sha -> block ) - sha -> used;
+        take = take < len ? take : len;
+        memcpy( sha -> block + sha -> used, data, take );
+        sha -> used += take;
+        data += take;
+        len -= take;
+        if ( sha -> used == sizeof( sha -> block ) ) {
+            sha256Block( sha, sha -> block );
+            sha -> used = 0;
+        }
+    }
+}
+
+static void sha256Final( struct sha256Struct *sha,
+                         struct ufsBlobDigestStruct *digest )
+{
+    uint64_t bits;
+    int i;
+
+    bits = sha -> length * 8;
+    sha -> block[ sha -> used++ ] = 0x80;
+    if ( sha -> used > sizeof( sha -> block ) - 8 ) {
+        memset( sha -> block + sha -> used, 0,
+                sizeof( sha -> block ) - sha -> used );
+        sha256Block( sha, sha -> block );
+        sha -> used = 0;
+    }
+
+    memset( sha -> block + sha -> used, 0,
+            sizeof( sha -> block ) - 8 - sha -> used );
+    for ( i = 0; i < 8; i++ )
+        sha -> block[ 63 - i ] = (uint8_t)( bits >> ( 8 * i ) );
+    sha256Block( sha, sha -> block );
+
+    for ( i = 0; i < 8; i++ ) {
+        digest -> bytes[ 4 * i ] = (uint8_t)( sha -> state[i] >> 24 );
+        digest -> bytes[ 4 * i + 1 ] = (uint8_t)( sha -> state[i] >> 16 );
+        digest -> bytes[ 4 * i + 2 ] = (uint8_t)( sha -> state[i] >> 8 );
+        digest -> bytes[ 4 * i + 3 ] = (uint8_t) sha -> state[i];
+    }
+}
+
+static void sha256Block( struct sha256Struct *sha, const uint8_t *block )
+{
+    uint32_t w[64], s[8], t1, t2;
+    int i;
+
+    for ( i = 0; i < 16; i++ )
+        w[i] = (uint32_t) block[ 4 * i ] << 24 |
+               (uint32_t) block[ 4 * i + 1 ] << 16 |
+               (uint32_t) block[ 4 * i + 2 ] << 8 |
+               (uint32_t) block[ 4 * i + 3 ];
+    for ( i = 16; i < 64; i++ )
+        w[i] = ( rotr( w[ i - 2 ], 17 ) ^ rotr( w[ i - 2 ], 19 ) ^
+                 ( w[ i - 2 ] >> 10 ) ) + w[ i - 7 ] +
+               ( rotr( w[ i - 15 ], 7 ) ^ rotr( w[ i - 15 ], 18 ) ^
+                 ( w[ i - 15 ] >> 3 ) ) + w[ i - 16 ];
+
+    memcpy( s, sha -> state, sizeof( s ) );
+    for ( i = 0; i < 64; i++ ) {
+        t1 = s[7] + ( rotr( s[4], 6 ) ^ rotr( s[4], 11 ) ^ rotr( s[4], 25 ) ) +
+             ( ( s[4] & s[5] ) ^ ( ~s[4] & s[6] ) ) + sha256K[i] + w[i];
+        t2 = ( rotr( s[0], 2 ) ^ rotr( s[0], 13 ) ^ rotr( s[0], 22 ) ) +
+             ( ( s[0] & s[1] ) ^ ( s[0] & s[2] ) ^ ( s[1] & s[2] ) );
+        memmove( s + 1, s, 7 * sizeof( *s ) );
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+
+    for ( i = 0; i < 8; i++ )
+        sha -> state[i] += s[i];
+}
+
+static inline uint32_t rotr( uint32_t x, uint32_t n )
+{
+    return ( x >> n ) | ( x << ( 32 - n ) );
+}
+
+static bool openDir( int parentFd, const char *name, int *fd )
+{
+    if ( mkdirat( parentFd, name, 0755 ) && errno != EEXIST )
+        return false;
+
+    *fd = openat( parentFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    return *fd >= 0;
+}
+
+/* Left behind by writers that didn't finish.                                 */
+static void clearTmp( struct ufsBlobStoreStruct *store )
+{
+    struct dirent *entry;
+    DIR *dir;
+    int fd;
+
+    fd = dup( store -> tmpFd );
+    dir = fd >= 0 ? fdopendir( fd ) : NULL;
+    if ( !dir ) {
+        if ( fd >= 0 )
+            close( fd );
+        return;
+    }
+
+    while ( ( entry = readdir( dir ) ) ) {
+        if ( entry -> d_name[0] != '.' )
+            unlinkat( store -> tmpFd, entry -> d_name, 0 );
+    }
+
+    closedir( dir );
+}
+
+/* Hashes what fd holds, writing it to copyFd as well unless that's -1.       */
+static bool hashFd( int fd, int copyFd, uint8_t *buffer,
+                    struct ufsBlobDigestStruct *digest )
+{
+    struct sha256Struct sha;
+    uint64_t offset;
+    ssize_t got;
+
+    sha256Init( &sha );
+    for ( offset = 0;; offset += got ) {
+        got = pread( fd, buffer, BUFFER_SIZE, offset );
+        if ( got < 0 && errno == EINTR ) {
+            got = 0;
+            continue;
+        }
+        if ( got < 0 ) {
+            ufsErrno = errno == EIO ? UFS_UNKNOWN_ERROR : UFS_BAD_CALL;
+            return false;
+        }
+        if ( !got )
+            break;
+
+        sha256Update( &sha, buffer, got );
+        if ( copyFd >= 0 && write( copyFd, buffer, got ) != got ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            return false;
+        }
+    }
+
+    sha256Final( &sha, digest );
+    return true;
+}
+
+/* Copies [ start, end ) of inFd to the same offsets of outFd, or up to the   */
+/* end of inFd, leaving the offsets of both alone. Falls back to reading and  */
+/* writing where copy_file_range can't be used.                               */
+static bool copyRange( int inFd, int outFd, uint64_t start, uint64_t end )
+{
+    uint8_t buffer[ 4096 ];
+    loff_t inOffset, outOffset;
+    ssize_t got;
+    uint64_t want;
+
+    inOffset = outOffset = start;
+    for ( got = 1; got > 0 && (uint64_t) inOffset < end; ) {
+        want = end - inOffset < COPY_CHUNK ? end - inOffset : COPY_CHUNK;
+        got = copy_file_range( inFd, &inOffset, outFd, &outOffset, want, 0 );
+    }
+    if ( got >= 0 )
+        return true;
+    if ( errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP &&
+         errno != ENOSYS )
+        return false;
+
+    for ( got = 1; got > 0 && (uint64_t) inOffset < end; ) {
+        want = end - inOffset < sizeof( buffer ) ? end - inOffset :
+                                                   sizeof( buffer );
+        got = pread( inFd, buffer, want, inOffset );
+        if ( got > 0 && pwrite( outFd, buffer, got, inOffset ) != got )
+            return false;
+        inOffset += got > 0 ? got : 0;
+    }
+
+    return got >= 0;
+}
+
+/* Names aren't reused while the store is open, opening it cleared what other */
+/* processes left.                                                            */
+static void nextTmpName( struct ufsBlobStoreStruct *store, char *name )
+{
+    snprintf( name, ENTRY_NAME_SIZE, "%d.%lu", getpid(),
+              __atomic_fetch_add( &store -> nextTmp, 1, __ATOMIC_RELAXED ) );
+}
+
+/* Creates a new file in the temporary directory, name gets its name.         */
+static int makeTmp( struct ufsBlobStoreStruct *store, char *name, int flags,
+                    mode_t mode )
+{
+    int fd;
+
+    nextTmpName( store, name );
+    fd = openat( store -> tmpFd, name, flags | O_CREAT | O_EXCL | O_CLOEXEC,
+                 mode );
+    if ( fd < 0 )
+        ufsErrno = UFS_UNKNOWN_ERROR;
+
+    return fd;
+}
+
+/* A blob that's already there was written by someone else, or the data       */
+/* changed to something the store has.                                        */
+static bool linkBlob( struct ufsBlobStoreStruct *store, const char *tmpName,
+                      const char *blobName )
+{
+    char fan[3];
+    int ret;
+
+    ret = linkat( store -> tmpFd, tmpName, store -> dirFd, blobName, 0 );
+    if ( ret && errno == ENOENT ) {
+        memcpy( fan, blobName, 2 );
+        fan[2] = 0;
+        if ( mkdirat( store -> dirFd, fan, 0755 ) && errno != EEXIST ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            return false;
+        }
+        ret = linkat( store -> tmpFd, tmpName, store -> dirFd, blobName, 0 );
+    }
+
+    if ( ret && errno != EEXIST ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    if ( ret )
+        __atomic_fetch_add( &store -> hits, 1, __ATOMIC_RELAXED );
+
+    return true;
+}
+
+/* tmpName gets a reflink of the blob, or a copy of it.                       */
+static bool cloneBlob( struct ufsBlobStoreStruct *store, const char *blobName,
+                       char *tmpName )
+{
+    int inFd, outFd;
+    bool ok;
+
+    inFd = openat( store -> dirFd, blobName, O_RDONLY | O_CLOEXEC );
+    if ( inFd < 0 ) {
+        ufsErrno = errno == ENOENT ? UFS_DOES_NOT_EXIST : UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    outFd = makeTmp( store, tmpName, O_WRONLY, 0444 );
+    ok = outFd >= 0;
+    if ( ok ) {
+        ok = !ioctl( outFd, FICLONE, inFd ) ||
+             copyRange( inFd, outFd, 0, UINT64_MAX );
+        close( outFd );
+        if ( !ok ) {
+            unlinkat( store -> tmpFd, tmpName, 0 );
+            ufsErrno = UFS_UNKNOWN_ERROR;
+        }
+    }
+
+    close( inFd );
+    return ok;
+}
+
+static void blobName( const struct ufsBlobDigestStruct *digest, char *name )
+{
+    static const char hex[] = "0123456789abcdef";
+    int i, j;
+
+    for ( i = j = 0; i < UFS_BLOB_DIGEST_SIZE; i++ ) {
+        name[ j++ ] = hex[ digest -> bytes[i] >> 4 ];
+        name[ j++ ] = hex[ digest -> bytes[i] & 0xf ];
+        if ( !i )
+            name[ j++ ] = '/';
+    }
+
+    name[j] = 0;
+}
+
+static void refName( ufsIdType area, ufsIdType file, char *name )
+{
+    snprintf( name, ENTRY_NAME_SIZE, "%ld/%ld", area, file );
+}
+
+/* Replaces what ref had under dirFd in one step, ref is in the directory of  */
+/* area, which is made if it's missing.                                       */
+static bool installAt( struct ufsBlobStoreStruct *store, const char *tmpName,
+                       int dirFd, ufsIdType area, const char *ref )
+{
+    char dir[ ENTRY_NAME_SIZE ];
+    int ret;
+
+    ret = renameat( store -> tmpFd, tmpName, dirFd, ref );
+    if ( ret && errno == ENOENT ) {
+        snprintf( dir, sizeof( dir ), "%ld", area );
+        if ( mkdirat( dirFd, dir, 0755 ) && errno != EEXIST )
+            ret = -1;
+        else
+            ret = renameat( store -> tmpFd, tmpName, dirFd, ref );
+    }
+
+    if ( ret ) {
+        unlinkat( store -> tmpFd, tmpName, 0 );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    return true;
+}
+
+/* The link that keeps a blob that's the source of a lazy copy up.            */
+static void srcName( ufsIdType area, ufsIdType file, char *name )
+{
+    snprintf( name, ENTRY_NAME_SIZE, "%ld/%ld.src", area, file );
+}
+
+/* The data of file is complete or gone, it needs no ranges log or source.    */
+static void dropRanges( struct ufsBlobStoreStruct *store, ufsIdType area,
+                        ufsIdType file )
+{
+    char name[ ENTRY_NAME_SIZE ];
+
+    refName( area, file, name );
+    unlinkat( store -> rangesFd, name, 0 );
+    srcName( area, file, name );
+    unlinkat( store -> rangesFd, name, 0 );
+}
+
+/* The ranges log is installed before the sparse data, which is never seen    */
+/* without it.                                                                */
+static bool startLazy( struct ufsBlobLazyStruct *lazy, ufsImagePtr img,
+                       int srcFd, bool isBlob )
+{
+    struct ufsBlobStoreStruct *store;
+    char tmpName[ ENTRY_NAME_SIZE ], ref[ ENTRY_NAME_SIZE ],
+         src[ ENTRY_NAME_SIZE ];
+    struct stat st;
+    bool ok;
+
+    store = lazy -> store;
+    if ( srcFd < 0 || fstat( srcFd, &st ) || !S_ISREG( st.st_mode ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    lazy -> srcFd = fcntl( srcFd, F_DUPFD_CLOEXEC, 0 );
+    if ( lazy -> srcFd < 0 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    lazy -> size = lazy -> srcSize = st.st_size;
+    refName( lazy -> area, lazy -> file, ref );
+    lazy -> rangesFd = makeTmp( store, tmpName, O_WRONLY | O_APPEND, 0644 );
+    if ( lazy -> rangesFd < 0 )
+        return false;
+    if ( write( lazy -> rangesFd, &lazy -> srcSize,
+                sizeof( lazy -> srcSize ) ) != sizeof( lazy -> srcSize ) ||
+         fdatasync( lazy -> rangesFd ) ) {
+        unlinkat( store -> tmpFd, tmpName, 0 );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+    if ( !installAt( store, tmpName, store -> rangesFd, lazy -> area, ref ) )
+        return false;
+
+    srcName( lazy -> area, lazy -> file, src );
+    unlinkat( store -> rangesFd, src, 0 );
+    ok = !isBlob || !linkat( store -> refsFd, ref, store -> rangesFd, src, 0 );
+    if ( !ok )
+        ufsErrno = UFS_UNKNOWN_ERROR;
+
+    if ( ok ) {
+        lazy -> fd = makeTmp( store, tmpName, O_RDWR, 0644 );
+        ok = lazy -> fd >= 0;
+    }
+    if ( ok && ftruncate( lazy -> fd, lazy -> srcSize ) ) {
+        unlinkat( store -> tmpFd, tmpName, 0 );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        ok = false;
+    }
+    if ( ok && installAt( store, tmpName, store -> refsFd, lazy -> area,
+                          ref ) ) {
+        /* The data is there before the mapping makes it seen.                */
+        if ( !img || ufsStoreAddMapping( img, lazy -> area, lazy -> file ) ||
+             ufsErrno == UFS_MAPPING_ALREADY_EXISTS ) {
+            __atomic_fetch_add( &store -> lazyCopyUps, 1, __ATOMIC_RELAXED );
+            return true;
+        }
+        /* A blob is given back its reference.                                */
+        unlinkat( store -> refsFd, ref, 0 );
+        if ( isBlob )
+            linkat( store -> rangesFd, src, store -> refsFd, ref, 0 );
+    }
+
+    dropRanges( store, lazy -> area, lazy -> file );
+    return false;
+}
+
+/* Private data is complete unless it has a ranges log.                       */
+static bool resumeLazy( struct ufsBlobLazyStruct *lazy, int srcFd )
+{
+    struct ufsBlobStoreStruct *store;
+    char ref[ ENTRY_NAME_SIZE ], src[ ENTRY_NAME_SIZE ];
+
+    store = lazy -> store;
+    refName( lazy -> area, lazy -> file, ref );
+    lazy -> fd = openat( store -> refsFd, ref, O_RDWR | O_CLOEXEC );
+    if ( lazy -> fd < 0 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    lazy -> rangesFd = openat( store -> rangesFd, ref,
+                               O_RDWR | O_APPEND | O_CLOEXEC );
+    if ( lazy -> rangesFd < 0 && errno == ENOENT ) {
+        lazy -> complete = true;
+        return true;
+    }
+    if ( lazy -> rangesFd < 0 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    srcName( lazy -> area, lazy -> file, src );
+    lazy -> srcFd = openat( store -> rangesFd, src, O_RDONLY | O_CLOEXEC );
+    if ( lazy -> srcFd < 0 && srcFd >= 0 )
+        lazy -> srcFd = fcntl( srcFd, F_DUPFD_CLOEXEC, 0 );
+    if ( lazy -> srcFd < 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    return loadRanges( lazy );
+}
+
+/* A record cut short by a crash is ignored.                                  */
+static bool loadRanges( struct ufsBlobLazyStruct *lazy )
+{
+    struct rangeStruct records[ BUFFER_SIZE / sizeof( struct rangeStruct ) ];
+    uint64_t offset, i;
+    ssize_t got;
+
+    if ( pread( lazy -> rangesFd, &lazy -> srcSize, sizeof( lazy -> srcSize ),
+                0 ) != sizeof( lazy -> srcSize ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    offset = sizeof( lazy -> srcSize );
+    while ( ( got = pread( lazy -> rangesFd, records, sizeof( records ),
+                           offset ) ) >= (ssize_t) sizeof( *records ) ) {
+        for ( i = 0; i < got / sizeof( *records ); i++ ) {
+            if ( records[i].start < records[i].end &&
+                 !addRange( lazy, records[i].start, records[i].end ) )
+                return false;
+        }
+
+        lazy -> numRecords += i;
+        offset += i * sizeof( *records );
+    }
+
+    if ( got < 0 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    return true;
+}
+
+/* Merges [ start, end ) into the ranges, including those it touches.         */
+static bool addRange( struct ufsBlobLazyStruct *lazy, uint64_t start,
+                      uint64_t end )
+{
+    struct rangeStruct *ranges;
+    uint64_t i, j, capacity;
+
+    for ( i = findRange( lazy, start ); i && lazy -> ranges[ i - 1 ].end ==
+                                             start; i-- )
+        ;
+    for ( j = i; j < lazy -> numRanges && lazy -> ranges[j].start <= end; j++ )
+        ;
+
+    if ( i < j ) {
+        if ( lazy -> ranges[i].start < start )
+            start = lazy -> ranges[i].start;
+        if ( lazy -> ranges[ j - 1 ].end > end )
+            end = lazy -> ranges[ j - 1 ].end;
+        lazy -> ranges[i] = (struct rangeStruct) { start, end };
+        memmove( lazy -> ranges + i + 1, lazy -> ranges + j,
+                 ( lazy -> numRanges - j ) * sizeof( *lazy -> ranges ) );
+        lazy -> numRanges -= j - i - 1;
+        return true;
+    }
+
+    if ( lazy -> numRanges == lazy -> capacity ) {
+        capacity = lazy -> capacity ? lazy -> capacity * 2 : 16;
+        ranges = realloc( lazy -> ranges, capacity * sizeof( *ranges ) );
+        if ( !ranges ) {
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return false;
+        }
+        lazy -> ranges = ranges;
+        lazy -> capacity = capacity;
+    }
+
+    memmove( lazy -> ranges + i + 1, lazy -> ranges + i,
+             ( lazy -> numRanges - i ) * sizeof( *lazy -> ranges ) );
+    lazy -> ranges[i] = (struct rangeStruct) { start, end };
+    lazy -> numRanges++;
+    return true;
+}
+
+static bool logRange( struct ufsBlobLazyStruct *lazy, uint64_t start,
+                      uint64_t end )
+{
+    struct rangeStruct record = { start, end };
+
+    if ( write( lazy -> rangesFd, &record, sizeof( record ) ) !=
+         sizeof( record ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    lazy -> numRecords++;
+    return true;
+}
+
+/* The first range ending after offset, numRanges if there's none.            */
+static uint64_t findRange( struct ufsBlobLazyStruct *lazy, uint64_t offset )
+{
+    uint64_t low, high, mid;
+
+    low = 0;
+    high = lazy -> numRanges;
+    while ( low < high ) {
+        mid = low + ( high - low ) / 2;
+        if ( lazy -> ranges[ mid ].end <= offset )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/* Each chunk is logged like a write, a crash while filling loses none of it. */
+/* The lock is let go between chunks so writers get in.                       */
+static bool fillLazy( struct ufsBlobLazyStruct *lazy )
+{
+    uint64_t offset, end, i;
+    bool ok;
+
+    ok = true;
+    pthread_mutex_lock( &lazy -> lock );
+    for ( offset = 0; ok && !lazy -> complete &&
+                      offset < lazy -> srcSize; ) {
+        i = findRange( lazy, offset );
+        if ( i < lazy -> numRanges && lazy -> ranges[i].start <= offset ) {
+            offset = lazy -> ranges[i].end;
+            continue;
+        }
+
+        end = i < lazy -> numRanges ? lazy -> ranges[i].start :
+                                      lazy -> srcSize;
+        end = end < lazy -> srcSize ? end : lazy -> srcSize;
+        end = end - offset < FILL_CHUNK ? end : offset + FILL_CHUNK;
+        ok = copyRange( lazy -> srcFd, lazy -> fd, offset, end );
+        if ( !ok )
+            ufsErrno = UFS_UNKNOWN_ERROR;
+        ok = ok && logRange( lazy, offset, end ) &&
+             addRange( lazy, offset, end );
+        offset = end;
+
+        pthread_mutex_unlock( &lazy -> lock );
+        pthread_mutex_lock( &lazy -> lock );
+    }
+
+    if ( ok && !lazy -> complete ) {
+        if ( fdatasync( lazy -> fd ) ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            ok = false;
+        } else {
+            dropRanges( lazy -> store, lazy -> area, lazy -> file );
+            lazy -> complete = true;
+        }
+    }
+
+    pthread_mutex_unlock( &lazy -> lock );
+    return ok;
+}
+
+/* Rewrites the log to the merged ranges, where merging left fewer.           */
+static void compactRanges( struct ufsBlobLazyStruct *lazy )
+{
+    struct ufsBlobStoreStruct *store;
+    char tmpName[ ENTRY_NAME_SIZE ], ref[ ENTRY_NAME_SIZE ];
+    uint64_t bytes;
+    int fd;
+    bool ok;
+
+    store = lazy -> store;
+    if ( lazy -> numRecords <= lazy -> numRanges )
+        return;
+
+    pthread_rwlock_rdlock( &store -> lock );
+    fd = makeTmp( store, tmpName, O_WRONLY, 0644 );
+    if ( fd >= 0 ) {
+        bytes = lazy -> numRanges * sizeof( *lazy -> ranges );
+        ok = write( fd, &lazy -> srcSize, sizeof( lazy -> srcSize ) ) ==
+             sizeof( lazy -> srcSize ) &&
+             write( fd, lazy -> ranges, bytes ) == (ssize_t) bytes &&
+             !fdatasync( fd );
+        close( fd );
+        refName( lazy -> area, lazy -> file, ref );
+        if ( ok )
+            installAt( store, tmpName, store -> rangesFd, lazy -> area, ref );
+        else
+            unlinkat( store -> tmpFd, tmpName, 0 );
+    }
+
+    pthread_rwlock_unlock( &store -> lock );
+}
+
+/* Gaps that can't be filled are left for the next handle.                    */
+static void completeJob( void *arg )
+{
+    struct ufsBlobLazyStruct *lazy;
+
+    lazy = arg;
+    if ( !ufsBlobLazyComplete( lazy ) )
+        compactRanges( lazy );
+
+    freeLazy( lazy );
+}
+
+static void freeLazy( struct ufsBlobLazyStruct *lazy )
+{
+    if ( lazy -> fd >= 0 )
+        close( lazy -> fd );
+    if ( lazy -> srcFd >= 0 )
+        close( lazy -> srcFd );
+    if ( lazy -> rangesFd >= 0 )
+        close( lazy -> rangesFd );
+    pthread_mutex_destroy( &lazy -> lock );
+    free( lazy -> ranges );
+    free( lazy );
+}
+
+/* Entries starting with '.' are skipped, neither blobs nor refs have them.   */
+static bool walkDir( int parentFd, const char *name, walkFn fn,
+                     void *userData )
+{
+    struct dirent *entry;
+    struct stat st;
+    DIR *dir;
+    int fd;
+    bool ok;
+
+    fd = openat( parentFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    dir = fd >= 0 ? fdopendir( fd ) : NULL;
+    if ( !dir ) {
+        if ( fd >= 0 )
+            close( fd );
+        return false;
+    }
+
+    ok = true;
+    while ( ok && ( entry = readdir( dir ) ) ) {
+        if ( entry -> d_name[0] == '.' )
+            continue;
+
+        /* Removed since it was read.                                         */
+        if ( fstatat( fd, entry -> d_name, &st, AT_SYMLINK_NOFOLLOW ) )
+            continue;
+
+        ok = fn( fd, entry -> d_name, &st, userData );
+    }
+
+    closedir( dir );
+    return ok;
+}
+
+static bool walkBlobs( struct ufsBlobStoreStruct *store, walkFn fn,
+                       void *userData )
+{
+    struct walkBlobsStruct walk = { .fn = fn, .userData = userData };
+
+    return walkDir( store -> dirFd, ".", walkFan, &walk );
+}
+
+/* Blobs are in the directories named by two hex digits.                      */
+static bool walkFan( int dirFd, const char *name, const struct stat *st,
+                     void *userData )
+{
+    struct walkBlobsStruct *walk;
+
+    walk = userData;
+    if ( !S_ISDIR( st -> st_mode ) || strlen( name ) != 2 ||
+         strspn( name, "0123456789abcdef" ) != 2 )
+        return true;
+
+    return walkDir( dirFd, name, walk -> fn, walk -> userData );
+}
+
+static bool collectBlob( int dirFd, const char *name, const struct stat *st,
+                         void *userData )
+{
+    if ( S_ISREG( st -> st_mode ) && st -> st_nlink == 1 &&
+         !unlinkat( dirFd, name, 0 ) )
+        ( *(uint64_t*) userData )++;
+
+    return true;
+}
+
+static bool countBlob( int dirFd, const char *name, const struct stat *st,
+                       void *userData )
+{
+    struct ufsBlobStatsStruct *stats;
+
+    stats = userData;
+    stats -> numBlobs++;
+    stats -> physicalBytes += st -> st_size;
+    return true;
+}
+
+/* References are in a directory per area.                                    */
+static bool walkArea( int dirFd, const char *name, const struct stat *st,
+                      void *userData )
+{
+    if ( !S_ISDIR( st -> st_mode ) )
+        return true;
+
+    return walkDir( dirFd, name, countRef, userData );
+}
+
+static bool countRef( int dirFd, const char *name, const struct stat *st,
+                      void *userData )
+{
+    struct ufsBlobStatsStruct *stats;
+
+    stats = userData;
+    stats -> numRefs++;
+    stats -> logicalBytes += st -> st_size;
+    if ( st -> st_nlink == 1 )
+        stats -> numPrivate++;
+
+    return true;
+}
@@ -0,0 +1,490 @@
+/******************************************************************************\
+*  ufs_blob.h                                                                  *
+*                                                                              *
+*  Internal header for the content addressed store of file data.               *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* A blob store keeps the data of files that live only in an area, once per   */
+/* content. A blob is named by the SHA-256 of what's in it and is written     */
+/* once, to a temporary file that's linked into place, so a blob is never     */
+/* seen half written and two writers of the same data end with one blob.      */
+/* Blobs are read only, writing to the data of a file has to copy it first.   */
+/*                                                                            */
+/* Under the root of the store blob 'abcd...' is 'ab/cd...', the data area a  */
+/* has for the file record with identifier n is 'refs/a/n', a hard link to    */
+/* its blob, so reading a file needs no lookup and any number of files share  */
+/* one inode and its page cache. The link count of a blob is its reference    */
+/* count plus one. Where a blob can't take more links the reference is a      */
+/* reflink of it, or a copy on filesystems without reflinks. Such a reference */
+/* shares extents at most, it doesn't hold the blob, which ufsBlobCollect may */
+/* then remove.                                                               */
+/*                                                                            */
+/* Data that's written to is private to its file, ufsBlobCopyUp makes it from */
+/* a BASE file or a blob, reflinking where it can.                            */
+/*                                                                            */
+/* ufsBlobLazyOpen copies up nothing, the private data starts as a sparse     */
+/* file the size of its source and 'ranges/a/n' logs the ranges written to    */
+/* it since. Reads take the other ranges from the source, which is the BASE   */
+/* file given or, for a blob, a link 'ranges/a/n.src' that keeps it. The      */
+/* gaps are filled in the background when the handle is closed, or left for   */
+/* a caller that only needs the ranges written, see ufsBlobLazyApply. The     */
+/* ranges log is there before the sparse data and goes after it's filled, so  */
+/* data without one is complete.                                              */
+/*                                                                            */
+/* Identifiers are those of one image, a store must not be shared between     */
+/* images. Nothing but the links is kept, a store is consistent after any     */
+/* crash, leaving at most temporary files that the next open removes.         */
+/* ufsBlobCollect waits for the calls in progress on the same store, other    */
+/* processes must not use the store while it runs.                            */
+
+#ifndef UFS_BLOB_H
+#define UFS_BLOB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs_defs.h"
+#include "ufs_image.h"
+
+#define UFS_BLOB_DIGEST_SIZE (32)
+
+typedef struct ufsBlobStoreStruct *ufsBlobStorePtr;
+
+struct ufsBlobDigestStruct {
+    uint8_t bytes[ UFS_BLOB_DIGEST_SIZE ];
+};
+
+struct ufsBlobStatsStruct {
+    /* Files with data in the store and the blobs holding it.                 */
+    uint64_t numRefs,
+             numBlobs;
+    /* What the files hold and what the blobs take.                           */
+    uint64_t logicalBytes,
+             physicalBytes;
+    /* Files with data of their own, copy ups, reflinks and copies of blobs,  */
+    /* which physicalBytes doesn't count.                                     */
+    uint64_t numPrivate;
+    /* logicalBytes per 100 physicalBytes, 100 for an empty store.            */
+    uint64_t dedupPercent;
+    /* Calls to ufsBlobPut since the store was opened, those that found the   */
+    /* data already there.                                                    */
+    uint64_t puts,
+             hits;
+    /* Calls to ufsBlobCopyUp since the store was opened, those that made a   */
+    /* reflink.                                                               */
+    uint64_t copyUps,
+             reflinks;
+    /* Calls to ufsBlobLazyOpen since the store was opened that started a     */
+    /* copy up.                                                               */
+    uint64_t lazyCopyUps;
+};
+
+typedef struct ufsBlobLazyStruct *ufsBlobLazyPtr;
+
+/* A piece of a file read from fd at offset, which is also its offset in the  */
+/* file.                                                                      */
+struct ufsBlobSegmentStruct {
+    int fd;
+    uint64_t offset,
+             length;
+};
+
+/******************************************************************************\
+* ufsBlobOpen                                                                  *
+*                                                                              *
+*  Opens the store under path, creating it if it doesn't exist.                *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: path is NULL.                                                *
+*   UFS_DOES_NOT_EXIST: path can't be created or isn't a directory.            *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -path: The root of the store, usually UFS_BLOB_DIR.                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsBlobStorePtr: The store, NULL on error.                                 *
+*                                                                              *
+\******************************************************************************/
+ufsBlobStorePtr ufsBlobOpen( const char *path );
+
+/******************************************************************************\
+* ufsBlobClose                                                                 *
+*                                                                              *
+*  Closes a store once the lazy copy ups being completed are done, what it     *
+*  holds stays on disk. Its lazy handles must be closed first.                 *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store, may be NULL.                                             *
+*                                                                              *
+\******************************************************************************/
+void ufsBlobClose( ufsBlobStorePtr store );
+
+/******************************************************************************\
+* ufsBlobPut                                                                   *
+*                                                                              *
+*  Stores what fd holds from its start, unless the store already has it.       *
+*  The data is read twice when it's new, once to hash it and once to copy it,  *
+*  the digest is that of the copy.                                             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store or digest are NULL, or fd can't be read with pread.    *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: The blob couldn't be written.                           *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -fd: A file open for reading, its offset is left alone.                     *
+*  -digest: Set to the digest naming the blob.                                 *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBlobPut( ufsBlobStorePtr store, int fd,
+                 struct ufsBlobDigestStruct *digest );
+
+/******************************************************************************\
+* ufsBlobRef                                                                   *
+*                                                                              *
+*  Makes the blob named by digest the data of file in area, replacing what it  *
+*  had.                                                                        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store or digest are NULL or an identifier isn't positive.    *
+*   UFS_DOES_NOT_EXIST: The store has no such blob.                            *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: The reference couldn't be made.                         *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file record.                                   *
+*  -digest: The digest of the blob, as given by ufsBlobPut.                    *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBlobRef( ufsBlobStorePtr store, ufsIdType area, ufsIdType file,
+                 const struct ufsBlobDigestStruct *digest );
+
+/******************************************************************************\
+* ufsBlobUnref                                                                 *
+*                                                                              *
+*  Drops the data of file in area, e.g. when the mapping is removed.           *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store is NULL or an identifier isn't positive.               *
+*   UFS_DOES_NOT_EXIST: file has no data in area.                              *
+*   UFS_UNKNOWN_ERROR: The reference couldn't be removed.                      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file record.                                   *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBlobUnref( ufsBlobStorePtr store, ufsIdType area, ufsIdType file );
+
+/******************************************************************************\
+* ufsBlobOpenFile                                                              *
+*                                                                              *
+*  Opens the data of file in area.                                             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store is NULL, an identifier isn't positive, the data is     *
+*                 still being copied up lazily or write is true and the data   *
+*                 is a blob, see ufsBlobCopyUp and ufsBlobLazyOpen.            *
+*   UFS_DOES_NOT_EXIST: file has no data in area.                              *
+*   UFS_UNKNOWN_ERROR: The data couldn't be opened.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file record.                                   *
+*  -write: Whether to open it for writing as well.                             *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int: A file descriptor the caller closes, -1 on error.                     *
+*                                                                              *
+\******************************************************************************/
+int ufsBlobOpenFile( ufsBlobStorePtr store, ufsIdType area, ufsIdType file,
+                     bool write );
+
+/******************************************************************************\
+* ufsBlobCopyUp                                                                *
+*                                                                              *
+*  Gives file in area private data holding what srcFd holds, e.g. a BASE file  *
+*  opened for writing or a blob, then adds the mapping ( area, file ) to img.  *
+*  The data is a reflink of srcFd when both are on a filesystem that has them, *
+*  e.g. btrfs or xfs, which copies no data. Otherwise it's copied with         *
+*  copy_file_range, or read and written where that can't be used.              *
+*  The data is installed with a rename once it's complete and the mapping is   *
+*  added after, so readers of img see either the old file or all of the new    *
+*  one. A mapping that already exists is kept.                                 *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsStoreAddMapping but UFS_MAPPING_ALREADY_EXISTS.                *
+*   UFS_BAD_CALL: store is NULL, an identifier isn't positive or srcFd isn't   *
+*                 a regular file.                                              *
+*   UFS_UNKNOWN_ERROR: The data couldn't be copied.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -img: The image holding the mapping, NULL to leave the mapping to the       *
+*        caller.                                                               *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file record.                                   *
+*  -srcFd: A file open for reading, its offset is left alone.                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int: A file descriptor of the new data open for reading and writing, the   *
+*        caller closes it, -1 on error.                                        *
+*                                                                              *
+\******************************************************************************/
+int ufsBlobCopyUp( ufsBlobStorePtr store, ufsImagePtr img, ufsIdType area,
+                   ufsIdType file, int srcFd );
+
+/******************************************************************************\
+* ufsBlobLazyOpen                                                              *
+*                                                                              *
+*  Opens the data of file in area for reading and writing, copying it up       *
+*  lazily. Where file has no data in area, or its data is a blob, it gets a    *
+*  sparse file the size of the source and the mapping ( area, file ) is added  *
+*  to img, which takes no time whatever the size. Where it's being copied up   *
+*  lazily already the ranges written so far are loaded, where it's private     *
+*  the handle is complete from the start.                                      *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsStoreAddMapping but UFS_MAPPING_ALREADY_EXISTS.                *
+*   UFS_BAD_CALL: store is NULL, an identifier isn't positive or srcFd isn't   *
+*                 a regular file where it's needed.                            *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: The data couldn't be made or opened.                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -img: The image holding the mapping, NULL to leave the mapping to the       *
+*        caller.                                                               *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file record.                                   *
+*  -srcFd: The file the data comes from, e.g. a BASE file, open for reading.   *
+*          It's duplicated, not used where the source is a blob and may be -1  *
+*          then or where the data is private.                                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsBlobLazyPtr: The handle, NULL on error.                                 *
+*                                                                              *
+\******************************************************************************/
+ufsBlobLazyPtr ufsBlobLazyOpen( ufsBlobStorePtr store, ufsImagePtr img,
+                                ufsIdType area, ufsIdType file, int srcFd );
+
+/******************************************************************************\
+* ufsBlobLazyWrite                                                             *
+*                                                                              *
+*  Writes len bytes of buf at off of the data, which may grow it. Like write   *
+*  the data isn't synced.                                                      *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: lazy or buf are NULL.                                        *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: The data or its range couldn't be written.              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lazy: The handle.                                                          *
+*  -buf: What to write.                                                        *
+*  -len: The number of bytes to write.                                         *
+*  -off: Where in the data to write them.                                      *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBlobLazyWrite( ufsBlobLazyPtr lazy, const void *buf, uint64_t len,
+                       uint64_t off );
+
+/******************************************************************************\
+* ufsBlobLazyMap                                                               *
+*                                                                              *
+*  Tells where to read [ offset, offset + length ) of the data from, in order, *
+*  ranges that were written from the private data and the others from the      *
+*  source. The segments suit splice or copy_file_range as they are. Nothing    *
+*  past the end of the data is mapped, nor past maxSegments, the caller maps   *
+*  the rest with another call.                                                 *
+*  The descriptors are those of lazy and stay open until it's closed.          *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: lazy, segments or numSegments are NULL or maxSegments is 0.  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lazy: The handle.                                                          *
+*  -offset: Where to start.                                                    *
+*  -length: How many bytes to map.                                             *
+*  -segments: Filled with the segments.                                        *
+*  -maxSegments: The number of entries in segments.                            *
+*  -numSegments: Set to the number of segments filled.                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBlobLazyMap( ufsBlobLazyPtr lazy, uint64_t offset, uint64_t length,
+                     struct ufsBlobSegmentStruct *segments,
+                     uint64_t maxSegments, uint64_t *numSegments );
+
+/******************************************************************************\
+* ufsBlobLazyRead                                                              *
+*                                                                              *
+*  Reads up to len bytes at off of the data into buf, as mapped by             *
+*  ufsBlobLazyMap.                                                             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: lazy or buf are NULL.                                        *
+*   UFS_UNKNOWN_ERROR: The data couldn't be read.                              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lazy: The handle.                                                          *
+*  -buf: Filled with what's read.                                              *
+*  -len: The number of bytes to read.                                          *
+*  -off: Where in the data to read from.                                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int64_t: The number of bytes read, less than len at the end of the data,   *
+*            -1 on error.                                                      *
+*                                                                              *
+\******************************************************************************/
+int64_t ufsBlobLazyRead( ufsBlobLazyPtr lazy, void *buf, uint64_t len,
+                         uint64_t off );
+
+/******************************************************************************\
+* ufsBlobLazyComplete                                                          *
+*                                                                              *
+*  Fills the ranges of the data that weren't written from the source, a chunk  *
+*  at a time so writes aren't held up for long, and drops the ranges log.      *
+*  Does nothing to a complete handle.                                          *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: lazy is NULL.                                                *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: The data couldn't be copied.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lazy: The handle.                                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBlobLazyComplete( ufsBlobLazyPtr lazy );
+
+/******************************************************************************\
+* ufsBlobLazyApply                                                             *
+*                                                                              *
+*  Copies the ranges written to dstFd and gives it the size of the data, e.g.  *
+*  to collapse the data into its source without filling the gaps first. A      *
+*  complete handle copies all of it.                                           *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: lazy is NULL.                                                *
+*   UFS_UNKNOWN_ERROR: The ranges couldn't be copied.                          *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lazy: The handle.                                                          *
+*  -dstFd: A file open for writing, usually a copy of the source.              *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBlobLazyApply( ufsBlobLazyPtr lazy, int dstFd );
+
+/******************************************************************************\
+* ufsBlobLazyClose                                                             *
+*                                                                              *
+*  Closes a handle. With complete the gaps are filled by a worker of the       *
+*  store and ufsBlobClose waits for it, otherwise they're left and the ranges  *
+*  log is rewritten to the ranges it holds.                                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lazy: The handle, may be NULL.                                             *
+*  -complete: Whether to fill the gaps.                                        *
+*                                                                              *
+\******************************************************************************/
+void ufsBlobLazyClose( ufsBlobLazyPtr lazy, bool complete );
+
+/******************************************************************************\
+* ufsBlobCollect                                                               *
+*                                                                              *
+*  Removes the blobs no file refers to.                                        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store is NULL.                                               *
+*   UFS_UNKNOWN_ERROR: The store couldn't be read.                             *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -numRemoved: Set to the number of blobs removed, may be NULL.               *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBlobCollect( ufsBlobStorePtr store, uint64_t *numRemoved );
+
+/******************************************************************************\
+* ufsBlobGetStats                                                              *
+*                                                                              *
+*  Gets the statistics of store, reading every blob and reference.             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store or stats are NULL.                                     *
+*   UFS_UNKNOWN_ERROR: The store couldn't be read.                             *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -stats: Filled with the statistics.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBlobGetStats( ufsBlobStorePtr store, struct ufsBlobStatsStruct *stats );
+
+#endif /* UFS_BLOB_H */
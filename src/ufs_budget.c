@@ -0,0 +1,583 @@
+/******************************************************************************\
+*  ufs_budget.c                                                                *
+*                                                                              *
+*  Contains the definitions for the memory budget.                             *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "ufs_budget.h"
+#include "ufs_defs.h"
+#include <unistd.h>
+
+/* Both came with Linux 5.4, older kernels fail them with EINVAL.             */
+#ifndef MADV_COLD
+#define MADV_COLD (20)
+#endif
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT (21)
+#endif
+
+enum levelEnum {
+    LEVEL_NONE,
+    LEVEL_MODERATE,
+    LEVEL_SEVERE
+};
+
+struct cacheStruct {
+    const char *name;
+    ufsBudgetShrink shrink;
+    void *cache;
+    uint64_t usage;
+    /* Shrinks of the cache running without the lock.                         */
+    uint64_t busy;
+    bool used;
+};
+
+struct regionStruct {
+    void *addr;
+    uint64_t size;
+};
+
+struct ufsBudgetStruct {
+    pthread_mutex_t lock;
+    /* Signalled when a shrink returns.                                       */
+    pthread_cond_t idle;
+
+    struct cacheStruct caches[ UFS_BUDGET_MAX_CACHES ];
+    struct regionStruct regions[ UFS_BUDGET_MAX_REGIONS ];
+    uint64_t numRegions;
+    uint64_t total,
+             limit;
+    struct ufsBudgetStatsStruct stats;
+
+    pthread_t monitor;
+    bool watching,
+         stop;
+    /* Written to wake the monitor, read end first.                           */
+    int wake[2];
+    int psiFd,
+        eventsFd;
+    uint64_t intervalMs;
+    /* Counters of memory.events as last read.                                */
+    uint64_t lastHigh,
+             lastSevere;
+};
+
+static uint64_t shrinkCaches( struct ufsBudgetStruct *budget,
+                              uint64_t percent, bool overLimit );
+static void adviseRegions( struct ufsBudgetStruct *budget, int advice );
+static void wakeMonitor( struct ufsBudgetStruct *budget );
+static void *monitor( void *arg );
+static int openPsi( const char *path );
+static int openEvents( const char *path );
+static enum levelEnum readEvents( struct ufsBudgetStruct *budget );
+static void createGlobal( void );
+
+static ufsBudgetPtr globalBudget;
+static pthread_once_t globalOnce = PTHREAD_ONCE_INIT;
+
+ufsBudgetPtr ufsBudgetCreate( uint64_t limit )
+{
+    struct ufsBudgetStruct *budget;
+
+    budget = calloc( 1, sizeof( *budget ) );
+    if ( !budget ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    pthread_mutex_init( &budget -> lock, NULL );
+    pthread_cond_init( &budget -> idle, NULL );
+    budget -> limit = limit;
+    budget -> wake[0] = budget -> wake[1] = -1;
+    budget -> psiFd = budget -> eventsFd = -1;
+
+    ufsErrno = UFS_NO_ERROR;
+    return budget;
+}
+
+void ufsBudgetDestroy( ufsBudgetPtr budget )
+{
+    if ( !budget )
+        return;
+
+    if ( budget -> watching ) {
+        pthread_mutex_lock( &budget -> lock );
+        budget -> stop = true;
+        pthread_mutex_unlock( &budget -> lock );
+        wakeMonitor( budget );
+        pthread_join( budget -> monitor, NULL );
+
+        close( budget -> wake[0] );
+        close( budget -> wake[1] );
+        if ( budget -> psiFd >= 0 )
+            close( budget -> psiFd );
+        if ( budget -> eventsFd >= 0 )
+            close( budget -> eventsFd );
+    }
+
+    pthread_cond_destroy( &budget -> idle );
+    pthread_mutex_destroy( &budget -> lock );
+    free( budget );
+}
+
+ufsBudgetPtr ufsBudgetGlobal( void )
+{
+    pthread_once( &globalOnce, createGlobal );
+    if ( !globalBudget )
+        ufsErrno = UFS_OUT_OF_MEMORY;
+
+    return globalBudget;
+}
+
+void ufsBudgetSetLimit( ufsBudgetPtr budget, uint64_t limit )
+{
+    bool over;
+
+    pthread_mutex_lock( &budget -> lock );
+    budget -> limit = limit;
+    over = limit && budget -> total > limit;
+    pthread_mutex_unlock( &budget -> lock );
+
+    if ( over )
+        wakeMonitor( budget );
+}
+
+int64_t ufsBudgetRegister( ufsBudgetPtr budget, const char *name,
+                           ufsBudgetShrink shrink, void *cache )
+{
+    int64_t id;
+
+    if ( !budget || !name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    pthread_mutex_lock( &budget -> lock );
+    for ( id = 0; id < UFS_BUDGET_MAX_CACHES; id++ ) {
+        if ( !budget -> caches[ id ].used )
+            break;
+    }
+
+    if ( id == UFS_BUDGET_MAX_CACHES ) {
+        pthread_mutex_unlock( &budget -> lock );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    budget -> caches[ id ] = (struct cacheStruct) {
+        .name = name,
+        .shrink = shrink,
+        .cache = cache,
+        .used = true
+    };
+    pthread_mutex_unlock( &budget -> lock );
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+void ufsBudgetUnregister( ufsBudgetPtr budget, int64_t id )
+{
+    struct cacheStruct *cache;
+
+    if ( !budget || id < 0 || id >= UFS_BUDGET_MAX_CACHES )
+        return;
+
+    pthread_mutex_lock( &budget -> lock );
+    cache = &budget -> caches[ id ];
+    while ( cache -> busy )
+        pthread_cond_wait( &budget -> idle, &budget -> lock );
+
+    budget -> total -= cache -> usage;
+    memset( cache, 0, sizeof( *cache ) );
+    pthread_mutex_unlock( &budget -> lock );
+}
+
+bool ufsBudgetCharge( ufsBudgetPtr budget, int64_t id, int64_t bytes )
+{
+    struct cacheStruct *cache;
+    bool over;
+
+    if ( !budget || id < 0 || id >= UFS_BUDGET_MAX_CACHES )
+        return true;
+
+    pthread_mutex_lock( &budget -> lock );
+    cache = &budget -> caches[ id ];
+
+    /* A cache can't give back more than it was charged for.                  */
+    if ( bytes < 0 && (uint64_t) -bytes > cache -> usage )
+        bytes = -(int64_t) cache -> usage;
+
+    cache -> usage += bytes;
+    budget -> total += bytes;
+    over = budget -> limit && budget -> total > budget -> limit;
+    pthread_mutex_unlock( &budget -> lock );
+
+    if ( over && bytes > 0 )
+        wakeMonitor( budget );
+
+    return !over;
+}
+
+uint64_t ufsBudgetUsage( ufsBudgetPtr budget, int64_t id )
+{
+    uint64_t usage;
+
+    pthread_mutex_lock( &budget -> lock );
+    if ( id < 0 )
+        usage = budget -> total;
+    else
+        usage = id < UFS_BUDGET_MAX_CACHES ? budget -> caches[ id ].usage : 0;
+    pthread_mutex_unlock( &budget -> lock );
+
+    return usage;
+}
+
+bool ufsBudgetAddRegion( ufsBudgetPtr budget, void *addr, uint64_t size )
+{
+    if ( !budget || !addr ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    pthread_mutex_lock( &budget -> lock );
+    if ( budget -> numRegions == UFS_BUDGET_MAX_REGIONS ) {
+        pthread_mutex_unlock( &budget -> lock );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    budget -> regions[ budget -> numRegions++ ] = (struct regionStruct) {
+        .addr = addr,
+        .size = size
+    };
+    pthread_mutex_unlock( &budget -> lock );
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+void ufsBudgetRemoveRegion( ufsBudgetPtr budget, void *addr )
+{
+    uint64_t i;
+
+    if ( !budget )
+        return;
+
+    pthread_mutex_lock( &budget -> lock );
+    for ( i = 0; i < budget -> numRegions; i++ ) {
+        if ( budget -> regions[i].addr == addr ) {
+            budget -> regions[i] =
+                budget -> regions[ --budget -> numRegions ];
+            break;
+        }
+    }
+    pthread_mutex_unlock( &budget -> lock );
+}
+
+uint64_t ufsBudgetRelieve( ufsBudgetPtr budget, bool severe )
+{
+    uint64_t released;
+
+    released = shrinkCaches( budget, severe ? 100 :
+                                     UFS_BUDGET_PRESSURE_PERCENT, true );
+    adviseRegions( budget, severe ? MADV_PAGEOUT : MADV_COLD );
+
+    pthread_mutex_lock( &budget -> lock );
+    if ( severe )
+        budget -> stats.severe++;
+    else
+        budget -> stats.moderate++;
+    pthread_mutex_unlock( &budget -> lock );
+
+    return released;
+}
+
+bool ufsBudgetWatch( ufsBudgetPtr budget, const char *psiPath,
+                     const char *eventsPath, uint64_t intervalMs )
+{
+    if ( !budget || !intervalMs || intervalMs > INT_MAX ||
+         budget -> watching ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( pipe2( budget -> wake, O_NONBLOCK | O_CLOEXEC ) ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    budget -> psiFd = openPsi( psiPath ? psiPath : UFS_BUDGET_PSI_PATH );
+    budget -> eventsFd = openEvents( eventsPath );
+    budget -> intervalMs = intervalMs;
+    budget -> stop = false;
+
+    /* Only events from now on count.                                         */
+    readEvents( budget );
+
+    if ( pthread_create( &budget -> monitor, NULL, monitor, budget ) ) {
+        close( budget -> wake[0] );
+        close( budget -> wake[1] );
+        if ( budget -> psiFd >= 0 )
+            close( budget -> psiFd );
+        if ( budget -> eventsFd >= 0 )
+            close( budget -> eventsFd );
+        budget -> wake[0] = budget -> wake[1] = -1;
+        budget -> psiFd = budget -> eventsFd = -1;
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    budget -> watching = true;
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+void ufsBudgetGetStats( ufsBudgetPtr budget,
+                        struct ufsBudgetStatsStruct *stats )
+{
+    pthread_mutex_lock( &budget -> lock );
+    *stats = budget -> stats;
+    pthread_mutex_unlock( &budget -> lock );
+}
+
+/* Every shrinker is asked for percent of its cache, or for its share of      */
+/* the excess over the limit if that is more.                                 */
+static uint64_t shrinkCaches( struct ufsBudgetStruct *budget,
+                              uint64_t percent, bool overLimit )
+{
+    struct cacheStruct *cache;
+    uint64_t asks[ UFS_BUDGET_MAX_CACHES ], i, shrinkable, target, released;
+
+    pthread_mutex_lock( &budget -> lock );
+    shrinkable = 0;
+    for ( i = 0; i < UFS_BUDGET_MAX_CACHES; i++ ) {
+        cache = &budget -> caches[i];
+        if ( cache -> used && cache -> shrink )
+            shrinkable += cache -> usage;
+    }
+
+    target = (uint64_t) ( (double) shrinkable * percent / 100 );
+    if ( overLimit && budget -> limit && budget -> total > budget -> limit &&
+         budget -> total - budget -> limit > target )
+        target = budget -> total - budget -> limit;
+
+    for ( i = 0; i < UFS_BUDGET_MAX_CACHES; i++ ) {
+        cache = &budget -> caches[i];
+        asks[i] = 0;
+        if ( !cache -> used || !cache -> shrink || !cache -> usage ||
+             !target )
+            continue;
+
+        asks[i] = target >= shrinkable ? cache -> usage :
+                  (uint64_t) ( (double) target * cache -> usage /
+                               shrinkable ) + 1;
+        cache -> busy++;
+    }
+    pthread_mutex_unlock( &budget -> lock );
+
+    /* Busy caches can't be unregistered, their fields stay as they are.      */
+    released = 0;
+    for ( i = 0; i < UFS_BUDGET_MAX_CACHES; i++ ) {
+        if ( asks[i] )
+            released += budget -> caches[i].shrink( budget -> caches[i].cache,
+                                                    asks[i] );
+    }
+
+    pthread_mutex_lock( &budget -> lock );
+    for ( i = 0; i < UFS_BUDGET_MAX_CACHES; i++ ) {
+        if ( asks[i] )
+            budget -> caches[i].busy--;
+    }
+    budget -> stats.released += released;
+    pthread_cond_broadcast( &budget -> idle );
+    pthread_mutex_unlock( &budget -> lock );
+
+    return released;
+}
+
+/* Regions can't be removed while they are advised.                           */
+static void adviseRegions( struct ufsBudgetStruct *budget, int advice )
+{
+    struct regionStruct *region;
+    uint64_t i;
+
+    pthread_mutex_lock( &budget -> lock );
+    for ( i = 0; i < budget -> numRegions; i++ ) {
+        region = &budget -> regions[i];
+        if ( !madvise( region -> addr, region -> size, advice ) )
+            budget -> stats.advised += region -> size;
+    }
+    pthread_mutex_unlock( &budget -> lock );
+}
+
+/* The pipe is non blocking, when it's full the monitor is awake anyway.      */
+static void wakeMonitor( struct ufsBudgetStruct *budget )
+{
+    ssize_t ret;
+
+    if ( budget -> wake[1] < 0 )
+        return;
+
+    ret = write( budget -> wake[1], "", 1 );
+    (void) ret;
+}
+
+static void *monitor( void *arg )
+{
+    struct ufsBudgetStruct *budget;
+    struct pollfd fds[3];
+    enum levelEnum level, events;
+    char drain[ 64 ];
+    bool stop, over;
+
+    budget = arg;
+    for ( ;; ) {
+        fds[0] = (struct pollfd) { .fd = budget -> wake[0], .events = POLLIN };
+        fds[1] = (struct pollfd) { .fd = budget -> psiFd, .events = POLLPRI };
+        fds[2] = (struct pollfd) { .fd = budget -> eventsFd,
+                                   .events = POLLPRI };
+        if ( poll( fds, 3, budget -> intervalMs ) < 0 && errno != EINTR )
+            break;
+
+        if ( fds[0].revents & POLLIN )
+            while ( read( budget -> wake[0], drain, sizeof( drain ) ) > 0 );
+
+        pthread_mutex_lock( &budget -> lock );
+        stop = budget -> stop;
+        over = budget -> limit && budget -> total > budget -> limit;
+        pthread_mutex_unlock( &budget -> lock );
+        if ( stop )
+            break;
+
+        level = LEVEL_NONE;
+        if ( fds[1].revents & POLLPRI )
+            level = LEVEL_MODERATE;
+
+        /* The trigger is gone, the PSI file was replaced or removed.         */
+        if ( fds[1].revents & ( POLLERR | POLLNVAL ) ) {
+            close( budget -> psiFd );
+            budget -> psiFd = -1;
+        }
+
+        events = readEvents( budget );
+        if ( events > level )
+            level = events;
+
+        if ( level != LEVEL_NONE )
+            ufsBudgetRelieve( budget, level == LEVEL_SEVERE );
+        else if ( over )
+            shrinkCaches( budget, 0, true );
+    }
+
+    return NULL;
+}
+
+/* Returns -1 when there is no PSI or no trigger may be set.                  */
+static int openPsi( const char *path )
+{
+    int fd;
+
+    fd = open( path, O_RDWR | O_NONBLOCK | O_CLOEXEC );
+    if ( fd < 0 )
+        return -1;
+
+    if ( write( fd, UFS_BUDGET_PSI_TRIGGER,
+                strlen( UFS_BUDGET_PSI_TRIGGER ) + 1 ) < 0 ) {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Without a path the cgroup is the one /proc/self/cgroup names for the       */
+/* unified hierarchy, "0::<path>".                                            */
+static int openEvents( const char *path )
+{
+    char line[ PATH_MAX ], events[ PATH_MAX + 64 ];
+    FILE *cgroup;
+    int fd;
+
+    if ( path )
+        return open( path, O_RDONLY | O_CLOEXEC );
+
+    cgroup = fopen( "/proc/self/cgroup", "r" );
+    if ( !cgroup )
+        return -1;
+
+    fd = -1;
+    while ( fgets( line, sizeof( line ), cgroup ) ) {
+        if ( strncmp( line, "0::", 3 ) )
+            continue;
+
+        line[ strcspn( line, "\n" ) ] = '\0';
+        snprintf( events, sizeof( events ), "%s%s/memory.events",
+                  UFS_BUDGET_CGROUP_ROOT, line + 3 );
+        fd = open( events, O_RDONLY | O_CLOEXEC );
+        break;
+    }
+
+    fclose( cgroup );
+    return fd;
+}
+
+/* Lines are "<event> <count>", "high" is moderate, "max", "oom" and          */
+/* "oom_kill" are severe.                                                     */
+static enum levelEnum readEvents( struct ufsBudgetStruct *budget )
+{
+    char buff[ 512 ], *line, *save;
+    enum levelEnum level;
+    uint64_t count, high, severe;
+    ssize_t size;
+
+    if ( budget -> eventsFd < 0 )
+        return LEVEL_NONE;
+
+    size = pread( budget -> eventsFd, buff, sizeof( buff ) - 1, 0 );
+    if ( size <= 0 )
+        return LEVEL_NONE;
+    buff[ size ] = '\0';
+
+    high = severe = 0;
+    for ( line = strtok_r( buff, "\n", &save ); line;
+          line = strtok_r( NULL, "\n", &save ) ) {
+        if ( sscanf( line, "high %lu", &count ) == 1 )
+            high += count;
+        else if ( sscanf( line, "max %lu", &count ) == 1 ||
+                  sscanf( line, "oom %lu", &count ) == 1 ||
+                  sscanf( line, "oom_kill %lu", &count ) == 1 )
+            severe += count;
+    }
+
+    level = LEVEL_NONE;
+    if ( high > budget -> lastHigh )
+        level = LEVEL_MODERATE;
+    if ( severe > budget -> lastSevere )
+        level = LEVEL_SEVERE;
+
+    budget -> lastHigh = high;
+    budget -> lastSevere = severe;
+    return level;
+}
+
+static void createGlobal( void )
+{
+    globalBudget = ufsBudgetCreate( 0 );
+}
@@ -0,0 +1,288 @@
+/******************************************************************************\
+*  ufs_budget.h                                                                *
+*                                                                              *
+*  Internal header for the memory budget caches are accounted against.         *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* Caches register with a budget and charge it for the memory they hold, a    */
+/* cache that can give memory back registers a shrinker. When the total goes  */
+/* over the limit, or the host runs low, shrinkers are asked for a share of   */
+/* the excess in proportion to what their caches hold.                        */
+/*                                                                            */
+/* Charging never calls a shrinker, caches may charge while holding their     */
+/* locks. Going over the limit wakes the monitor instead, which shrinks from  */
+/* its own thread. Shrinkers are called without the budget lock and may       */
+/* charge the budget, they must not register or unregister.                   */
+/*                                                                            */
+/* The monitor watches a PSI trigger on /proc/pressure/memory and the         */
+/* memory.events file of the cgroup of the process. Stalls and "high" events  */
+/* are moderate pressure, every cache gives back UFS_BUDGET_PRESSURE_PERCENT  */
+/* of what it holds and regions are advised MADV_COLD. "max" and "oom"        */
+/* events are severe, caches are emptied and regions are paged out with       */
+/* MADV_PAGEOUT, so the process shrinks before the OOM killer picks it.       */
+/* Regions are mappings that can be read back from their file, such as the    */
+/* images of sealed tiers. Either file may be missing, old kernels have no    */
+/* PSI and cgroup v1 has no memory.events, the limit is still enforced.       */
+/*                                                                            */
+/* ufsBudgetGlobal is the budget of the process, unlimited until a limit is   */
+/* set, the backends account their in memory state against it.                */
+
+#ifndef UFS_BUDGET_H
+#define UFS_BUDGET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define UFS_BUDGET_MAX_CACHES (32)
+#define UFS_BUDGET_MAX_REGIONS (256)
+#define UFS_BUDGET_PRESSURE_PERCENT (25)
+#define UFS_BUDGET_PSI_PATH ("/proc/pressure/memory")
+#define UFS_BUDGET_CGROUP_ROOT ("/sys/fs/cgroup")
+/* 150ms of stalls in a 2s window, windows of unprivileged triggers are       */
+/* whole multiples of 2s.                                                     */
+#define UFS_BUDGET_PSI_TRIGGER ("some 150000 2000000")
+
+typedef struct ufsBudgetStruct *ufsBudgetPtr;
+
+/* Gives back about bytes of cache, returns how many were given back.         */
+typedef uint64_t (*ufsBudgetShrink)( void *cache, uint64_t bytes );
+
+struct ufsBudgetStatsStruct {
+    /* Moderate and severe pressure the budget was relieved of.               */
+    uint64_t moderate,
+             severe;
+    /* Bytes shrinkers gave back, bytes of regions advised.                   */
+    uint64_t released,
+             advised;
+};
+
+/******************************************************************************\
+* ufsBudgetCreate                                                              *
+*                                                                              *
+*  Creates a budget of limit bytes.                                            *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -limit: The most bytes the caches may hold, 0 for no limit.                 *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsBudgetPtr: The budget, NULL on error.                                   *
+*                                                                              *
+\******************************************************************************/
+ufsBudgetPtr ufsBudgetCreate( uint64_t limit );
+
+/******************************************************************************\
+* ufsBudgetDestroy                                                             *
+*                                                                              *
+*  Stops the monitor of budget and frees it, caches must be unregistered.      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -budget: The budget, may be NULL.                                           *
+*                                                                              *
+\******************************************************************************/
+void ufsBudgetDestroy( ufsBudgetPtr budget );
+
+/******************************************************************************\
+* ufsBudgetGlobal                                                              *
+*                                                                              *
+*  Gets the budget of the process, created on first use.                       *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsBudgetPtr: The budget, NULL on error.                                   *
+*                                                                              *
+\******************************************************************************/
+ufsBudgetPtr ufsBudgetGlobal( void );
+
+/******************************************************************************\
+* ufsBudgetSetLimit                                                            *
+*                                                                              *
+*  Changes the limit of budget, wakes the monitor if it's already exceeded.    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -budget: The budget, not NULL.                                              *
+*  -limit: The most bytes the caches may hold, 0 for no limit.                 *
+*                                                                              *
+\******************************************************************************/
+void ufsBudgetSetLimit( ufsBudgetPtr budget, uint64_t limit );
+
+/******************************************************************************\
+* ufsBudgetRegister                                                            *
+*                                                                              *
+*  Registers a cache with budget.                                              *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: budget or name are NULL.                                     *
+*   UFS_OUT_OF_MEMORY: budget has UFS_BUDGET_MAX_CACHES caches.                *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -budget: The budget.                                                        *
+*  -name: The name of the cache, kept as is.                                   *
+*  -shrink: The shrinker, NULL if the memory can't be given back.              *
+*  -cache: Passed to shrink.                                                   *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int64_t: The identifier of the cache, -1 on error.                         *
+*                                                                              *
+\******************************************************************************/
+int64_t ufsBudgetRegister( ufsBudgetPtr budget, const char *name,
+                           ufsBudgetShrink shrink, void *cache );
+
+/******************************************************************************\
+* ufsBudgetUnregister                                                          *
+*                                                                              *
+*  Unregisters a cache, waiting for its shrinker if it runs. What the cache    *
+*  was still charged for leaves the budget with it.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -budget: The budget, may be NULL.                                           *
+*  -id: The identifier of the cache, may be -1.                                *
+*                                                                              *
+\******************************************************************************/
+void ufsBudgetUnregister( ufsBudgetPtr budget, int64_t id );
+
+/******************************************************************************\
+* ufsBudgetCharge                                                              *
+*                                                                              *
+*  Charges a cache for bytes more, or less when bytes is negative.             *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -budget: The budget, may be NULL.                                           *
+*  -id: The identifier of the cache, may be -1.                                *
+*  -bytes: The change in the memory the cache holds.                           *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: false if budget is over its limit, the charge is made anyway.        *
+*                                                                              *
+\******************************************************************************/
+bool ufsBudgetCharge( ufsBudgetPtr budget, int64_t id, int64_t bytes );
+
+/******************************************************************************\
+* ufsBudgetUsage                                                               *
+*                                                                              *
+*  Gets the bytes a cache is charged for.                                      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -budget: The budget, not NULL.                                              *
+*  -id: The identifier of the cache, -1 for every cache.                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The number of bytes.                                             *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsBudgetUsage( ufsBudgetPtr budget, int64_t id );
+
+/******************************************************************************\
+* ufsBudgetAddRegion                                                           *
+*                                                                              *
+*  Adds a mapping to advise under pressure.                                    *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: budget or addr are NULL.                                     *
+*   UFS_OUT_OF_MEMORY: budget has UFS_BUDGET_MAX_REGIONS regions.              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -budget: The budget.                                                        *
+*  -addr: The start of the mapping, page aligned.                              *
+*  -size: The size of the mapping.                                             *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBudgetAddRegion( ufsBudgetPtr budget, void *addr, uint64_t size );
+
+/******************************************************************************\
+* ufsBudgetRemoveRegion                                                        *
+*                                                                              *
+*  Removes a mapping, it may be unmapped once this returns.                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -budget: The budget, may be NULL.                                           *
+*  -addr: The start of the mapping.                                            *
+*                                                                              *
+\******************************************************************************/
+void ufsBudgetRemoveRegion( ufsBudgetPtr budget, void *addr );
+
+/******************************************************************************\
+* ufsBudgetRelieve                                                             *
+*                                                                              *
+*  Relieves the host of memory as the monitor would on pressure. The caller    *
+*  must not hold the lock of any cache of budget.                              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -budget: The budget, not NULL.                                              *
+*  -severe: Empty caches and page out regions instead.                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The number of bytes the caches gave back.                        *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsBudgetRelieve( ufsBudgetPtr budget, bool severe );
+
+/******************************************************************************\
+* ufsBudgetWatch                                                               *
+*                                                                              *
+*  Starts the monitor of budget. It enforces the limit and relieves pressure   *
+*  reported by psiPath and eventsPath, checking at least every intervalMs.     *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: budget is NULL, intervalMs is 0 or the monitor runs.         *
+*   UFS_OUT_OF_MEMORY: The monitor could not be started.                       *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -budget: The budget.                                                        *
+*  -psiPath: The PSI file, NULL for UFS_BUDGET_PSI_PATH.                       *
+*  -eventsPath: The memory.events file, NULL for that of the cgroup of the     *
+*               process.                                                       *
+*  -intervalMs: The longest wait between two checks.                           *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsBudgetWatch( ufsBudgetPtr budget, const char *psiPath,
+                     const char *eventsPath, uint64_t intervalMs );
+
+/******************************************************************************\
+* ufsBudgetGetStats                                                            *
+*                                                                              *
+*  Gets what budget was relieved of so far.                                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -budget: The budget, not NULL.                                              *
+*  -stats: Filled with the statistics.                                         *
+*                                                                              *
+\******************************************************************************/
+void ufsBudgetGetStats( ufsBudgetPtr budget,
+                        struct ufsBudgetStatsStruct *stats );
+
+#endif /* UFS_BUDGET_H */
@@ -0,0 +1,1327 @@
+/******************************************************************************\
+*  ufs_cold.c                                                                  *
+*                                                                              *
+*  Contains the definitions for the store compressing data of cold areas.      *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "ufs_cold.h"
+#include "ufs_layout.h"
+#include "ufs_lz.h"
+#include "ufs_pool.h"
+#include "ufs_store.h"
+#include <unistd.h>
+
+#define ENTRY_NAME_SIZE (64)
+#define TMP_SUFFIX (".tmp")
+
+/* The start of a frame, the index follows.                                   */
+struct frameHeaderStruct {
+    uint32_t magic;
+    uint32_t blockSize;
+    uint64_t length;
+    uint64_t numBlocks;
+    /* Of the file and the area when the frame was written.                   */
+    uint32_t fileGeneration,
+             areaGeneration;
+};
+
+struct frameStruct {
+    ufsIdType area;
+    /* Names the blocks of this frame in the cache, never reused.             */
+    uint64_t serial;
+    uint64_t length,
+             numBlocks;
+    /* numBlocks + 1 offsets, the last one is the size of the frame.          */
+    uint64_t *index;
+    /* Where the last read ended, a read starting there is sequential.        */
+    uint64_t nextRead;
+    struct frameStruct *next;
+};
+
+struct cacheEntryStruct {
+    uint64_t serial,
+             block;
+    /* The tick of the last hit, the lowest goes first.                       */
+    uint64_t tick;
+    /* UFS_COLD_BLOCK bytes, NULL for a free entry.                           */
+    uint8_t *data;
+};
+
+struct areaUseStruct {
+    /* Seconds on the monotonic clock at the last read or write.              */
+    uint64_t lastUse;
+    /* Writes since the store was opened.                                     */
+    uint64_t writes;
+};
+
+struct ufsColdStoreStruct {
+    /* Taken for writing by the calls that install or drop frames.            */
+    pthread_rwlock_t lock;
+    ufsImagePtr img;
+    ufsExtentStorePtr extents;
+    int dirFd;
+    /* Decompresses the blocks reads miss.                                    */
+    ufsPoolPtr pool;
+    /* A chain of frames per file record, one frame per area at most.         */
+    struct frameStruct **frames;
+    struct areaUseStruct *areas;
+    uint64_t numAreas;
+    uint64_t nextSerial,
+             nextTmp;
+
+    pthread_mutex_t cacheLock;
+    struct cacheEntryStruct cache[ UFS_COLD_CACHE_BLOCKS ];
+    uint64_t tick;
+
+    /* The background job.                                                    */
+    pthread_mutex_t jobLock;
+    pthread_cond_t jobCond;
+    pthread_t job;
+    bool running,
+         stop;
+    uint64_t idleSeconds,
+             intervalMs;
+
+    uint64_t compressed,
+             thawed,
+             incompressible,
+             cacheHits,
+             decompressed,
+             parallelReads;
+
+    /* The next store in openStores.                                          */
+    struct ufsColdStoreStruct *nextOpen;
+};
+
+/* The stores open in this process, ufsColdDrop drops frames through the one  */
+/* of its image. Taken before the lock of a store.                            */
+static pthread_mutex_t openStoresLock = PTHREAD_MUTEX_INITIALIZER;
+static struct ufsColdStoreStruct *openStores;
+
+/* The blocks one read decompresses, the caller waits for pending to drop to  */
+/* 0.                                                                         */
+struct batchStruct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    uint64_t pending;
+    /* The error of the first block that failed, ufsErrno is per thread.      */
+    ufsStatusType error;
+};
+
+struct blockJobStruct {
+    struct batchStruct *batch;
+    struct frameStruct *frame;
+    int fd;
+    uint64_t block;
+    /* Set by the job, NULL for a block found in the cache.                   */
+    uint8_t *data;
+};
+
+/* Files of idle areas, gathered before any is compressed.                    */
+struct candidatesStruct {
+    struct ufsColdStoreStruct *store;
+    uint64_t now,
+             idleSeconds;
+    ufsIdType *pairs;
+    uint64_t numPairs,
+             capacity;
+    bool failed;
+};
+
+static uint64_t now( void );
+static void touch( struct ufsColdStoreStruct *store, ufsIdType area );
+static void frameName( ufsIdType area, ufsIdType file, char *name );
+static struct frameStruct **findFrame( struct ufsColdStoreStruct *store,
+                                       ufsIdType area, ufsIdType file );
+static bool loadFrames( struct ufsColdStoreStruct *store );
+static bool loadArea( struct ufsColdStoreStruct *store, ufsIdType area );
+static bool loadFrame( struct ufsColdStoreStruct *store, int fd,
+                       ufsIdType area, ufsIdType file, bool *isStale );
+static bool writeFrame( struct ufsColdStoreStruct *store, ufsIdType area,
+                        ufsIdType file, uint64_t length, char *tmpName,
+                        struct frameStruct **frame );
+static bool thawFrame( struct ufsColdStoreStruct *store, ufsIdType area,
+                       ufsIdType file );
+static void dropFrame( struct ufsColdStoreStruct *store,
+                       struct frameStruct **link, ufsIdType file );
+static inline uint64_t blockLength( const struct frameStruct *frame,
+                                    uint64_t block );
+static bool readBlock( const struct frameStruct *frame, int fd,
+                       uint64_t block, uint8_t *data, uint8_t *packed );
+static int64_t readFrame( struct ufsColdStoreStruct *store,
+                          struct frameStruct *frame, ufsIdType file,
+                          uint8_t *buf, uint64_t len, uint64_t off );
+static void decompressJob( void *arg );
+static bool cacheGet( struct ufsColdStoreStruct *store, uint64_t serial,
+                      uint64_t block, uint8_t *dst, uint64_t from,
+                      uint64_t length );
+static void cachePut( struct ufsColdStoreStruct *store, uint64_t serial,
+                      uint64_t block, uint8_t *data );
+static bool collectFile( ufsIdType area, ufsIdType file, void *userData );
+static void *tierThread( void *arg );
+static bool writeAll( int fd, const void *buf, uint64_t len, uint64_t off );
+static bool readAll( int fd, void *buf, uint64_t len, uint64_t off );
+
+ufsColdStorePtr ufsColdOpen( const char *path, ufsImagePtr img,
+                             ufsExtentStorePtr extents, uint64_t numThreads )
+{
+    struct ufsColdStoreStruct *store;
+    pthread_condattr_t attr;
+    uint64_t i;
+
+    if ( !path || !img || !extents || !numThreads ||
+         numThreads > UFS_POOL_MAX_THREADS ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    store = calloc( 1, sizeof( *store ) );
+    if ( !store ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    store -> img = img;
+    store -> extents = extents;
+    store -> dirFd = -1;
+    pthread_rwlock_init( &store -> lock, NULL );
+    pthread_mutex_init( &store -> cacheLock, NULL );
+    pthread_mutex_init( &store -> jobLock, NULL );
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &store -> jobCond, &attr );
+    pthread_condattr_destroy( &attr );
+
+    if ( ( mkdir( path, 0755 ) && errno != EEXIST ) ||
+         ( store -> dirFd = open( path, O_RDONLY | O_DIRECTORY |
+                                        O_CLOEXEC ) ) < 0 ) {
+        ufsColdClose( store );
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return NULL;
+    }
+
+    store -> numAreas = ufsLayoutCapacity( img, UFS_TYPES_AREA );
+    store -> frames = calloc( ufsLayoutCapacity( img, UFS_TYPES_FILE ) + 1,
+                              sizeof( *store -> frames ) );
+    store -> areas = calloc( store -> numAreas + 1,
+                             sizeof( *store -> areas ) );
+    store -> pool = ufsPoolCreate( numThreads );
+    if ( !store -> frames || !store -> areas || !store -> pool ) {
+        ufsColdClose( store );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    for ( i = 0; i < store -> numAreas; i++ )
+        store -> areas[i].lastUse = now();
+
+    if ( !loadFrames( store ) ) {
+        ufsColdClose( store );
+        return NULL;
+    }
+
+    pthread_mutex_lock( &openStoresLock );
+    store -> nextOpen = openStores;
+    openStores = store;
+    pthread_mutex_unlock( &openStoresLock );
+
+    ufsErrno = UFS_NO_ERROR;
+    return store;
+}
+
+void ufsColdClose( ufsColdStorePtr store )
+{
+    struct ufsColdStoreStruct **link;
+    struct frameStruct *frame;
+    uint64_t i;
+
+    if ( !store )
+        return;
+
+    pthread_mutex_lock( &openStoresLock );
+    for ( link = &openStores; *link; link = &(*link) -> nextOpen ) {
+        if ( *link == store ) {
+            *link = store -> nextOpen;
+            break;
+        }
+    }
+    pthread_mutex_unlock( &openStoresLock );
+
+    if ( store -> running ) {
+        pthread_mutex_lock( &store -> jobLock );
+        store -> stop = true;
+        pthread_cond_signal( &store -> jobCond );
+        pthread_mutex_unlock( &store -> jobLock );
+        pthread_join( store -> job, NULL );
+    }
+
+    if ( store -> pool )
+        ufsPoolDestroy( store -> pool );
+
+    if ( store -> frames ) {
+        for ( i = 0; i < ufsLayoutCapacity( store -> img, UFS_TYPES_FILE );
+              i++ ) {
+            while ( ( frame = store -> frames[i] ) ) {
+                store -> frames[i] = frame -> next;
+                free( frame -> index );
+                free( frame );
+            }
+        }
+    }
+
+    for ( i = 0; i < UFS_COLD_CACHE_BLOCKS; i++ )
+        free( store -> cache[i].data );
+
+    free( store -> frames );
+    free( store -> areas );
+    if ( store -> dirFd >= 0 )
+        close( store -> dirFd );
+    pthread_cond_destroy( &store -> jobCond );
+    pthread_mutex_destroy( &store -> jobLock );
+    pthread_mutex_destroy( &store -> cacheLock );
+    pthread_rwlock_destroy( &store -> lock );
+    free( store );
+}
+
+bool ufsColdIsCold( ufsColdStorePtr store, ufsIdType area, ufsIdType file )
+{
+    bool cold;
+
+    pthread_rwlock_rdlock( &store -> lock );
+    cold = findFrame( store, area, file ) != NULL;
+    pthread_rwlock_unlock( &store -> lock );
+    return cold;
+}
+
+/* The frame is written under the read lock, reads and writes go on. Writes   */
+/* to the area meanwhile may have changed what was read, the frame is thrown  */
+/* away then.                                                                 */
+int64_t ufsColdCompress( ufsColdStorePtr store, ufsIdType area,
+                         ufsIdType file )
+{
+    char name[ ENTRY_NAME_SIZE ], tmpName[ ENTRY_NAME_SIZE ];
+    struct frameStruct *frame, **link;
+    uint64_t writes, saved;
+    int64_t length;
+
+    if ( !store ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    pthread_rwlock_rdlock( &store -> lock );
+    length = 0;
+    if ( area > 0 && (uint64_t) area <= store -> numAreas &&
+         !findFrame( store, area, file ) )
+        length = ufsExtentGetSize( store -> extents, area, file );
+
+    if ( length <= 0 ) {
+        pthread_rwlock_unlock( &store -> lock );
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    writes = __atomic_load_n( &store -> areas[ area - 1 ].writes,
+                              __ATOMIC_ACQUIRE );
+    if ( !writeFrame( store, area, file, length, tmpName, &frame ) ) {
+        pthread_rwlock_unlock( &store -> lock );
+        return -1;
+    }
+    pthread_rwlock_unlock( &store -> lock );
+
+    if ( !frame ) {
+        __atomic_fetch_add( &store -> incompressible, 1, __ATOMIC_RELAXED );
+        ufsErrno = UFS_NO_ERROR;
+        return 0;
+    }
+
+    frameName( area, file, name );
+    pthread_rwlock_wrlock( &store -> lock );
+    if ( store -> areas[ area - 1 ].writes != writes ||
+         findFrame( store, area, file ) ||
+         renameat( store -> dirFd, tmpName, store -> dirFd, name ) ) {
+        pthread_rwlock_unlock( &store -> lock );
+        unlinkat( store -> dirFd, tmpName, 0 );
+        free( frame -> index );
+        free( frame );
+        ufsErrno = UFS_NO_ERROR;
+        return 0;
+    }
+
+    /* Once the lock goes a thaw or a remove may free the frame.              */
+    saved = length - frame -> index[ frame -> numBlocks ];
+    link = &store -> frames[ file - 1 ];
+    frame -> next = *link;
+    *link = frame;
+    ufsExtentRemove( store -> extents, area, file );
+    pthread_rwlock_unlock( &store -> lock );
+
+    __atomic_fetch_add( &store -> compressed, 1, __ATOMIC_RELAXED );
+    ufsErrno = UFS_NO_ERROR;
+    return saved;
+}
+
+bool ufsColdThaw( ufsColdStorePtr store, ufsIdType area, ufsIdType file )
+{
+    bool ok;
+
+    if ( !store ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    pthread_rwlock_wrlock( &store -> lock );
+    ok = thawFrame( store, area, file );
+    pthread_rwlock_unlock( &store -> lock );
+    if ( ok )
+        ufsErrno = UFS_NO_ERROR;
+
+    return ok;
+}
+
+int64_t ufsColdGetSize( ufsColdStorePtr store, ufsIdType area,
+                        ufsIdType file )
+{
+    struct frameStruct **link;
+    int64_t size;
+
+    if ( !store ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    pthread_rwlock_rdlock( &store -> lock );
+    link = findFrame( store, area, file );
+    size = link ? (int64_t)( *link ) -> length :
+                  ufsExtentGetSize( store -> extents, area, file );
+    pthread_rwlock_unlock( &store -> lock );
+    ufsErrno = UFS_NO_ERROR;
+    return size;
+}
+
+int64_t ufsColdRead( ufsColdStorePtr store, ufsIdType area, ufsIdType file,
+                     void *buf, uint64_t len, uint64_t off )
+{
+    struct frameStruct **link;
+    int64_t ret;
+
+    if ( !store || !buf ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    touch( store, area );
+    pthread_rwlock_rdlock( &store -> lock );
+    link = findFrame( store, area, file );
+    if ( link )
+        ret = readFrame( store, *link, file, buf, len, off );
+    else
+        ret = ufsExtentRead( store -> extents, area, file, buf, len, off );
+    pthread_rwlock_unlock( &store -> lock );
+
+    return ret;
+}
+
+/* Writes to hot files only take the read lock, they exclude compressions     */
+/* through the count of writes to their area instead.                         */
+bool ufsColdWrite( ufsColdStorePtr store, ufsIdType area, ufsIdType file,
+                   const void *buf, uint64_t len, uint64_t off )
+{
+    bool ok;
+
+    if ( !store ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    touch( store, area );
+    pthread_rwlock_rdlock( &store -> lock );
+    if ( findFrame( store, area, file ) ) {
+        pthread_rwlock_unlock( &store -> lock );
+        pthread_rwlock_wrlock( &store -> lock );
+        if ( findFrame( store, area, file ) &&
+             !thawFrame( store, area, file ) ) {
+            pthread_rwlock_unlock( &store -> lock );
+            return false;
+        }
+    }
+
+    ok = ufsExtentWrite( store -> extents, area, file, buf, len, off );
+    if ( ok && area > 0 && (uint64_t) area <= store -> numAreas )
+        __atomic_fetch_add( &store -> areas[ area - 1 ].writes, 1,
+                            __ATOMIC_RELEASE );
+    pthread_rwlock_unlock( &store -> lock );
+    return ok;
+}
+
+bool ufsColdRemove( ufsColdStorePtr store, ufsIdType area, ufsIdType file )
+{
+    struct frameStruct **link;
+    bool found;
+
+    if ( !store ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    pthread_rwlock_wrlock( &store -> lock );
+    link = findFrame( store, area, file );
+    found = link != NULL;
+    if ( link )
+        dropFrame( store, link, file );
+    found = ufsExtentRemove( store -> extents, area, file ) || found;
+    pthread_rwlock_unlock( &store -> lock );
+
+    ufsErrno = found ? UFS_NO_ERROR : UFS_DOES_NOT_EXIST;
+    return found;
+}
+
+bool ufsColdDrop( ufsImagePtr img, ufsIdType area, ufsIdType storage )
+{
+    struct ufsColdStoreStruct *store;
+    struct frameStruct **link;
+    bool found;
+
+    found = false;
+    pthread_mutex_lock( &openStoresLock );
+    for ( store = openStores; store && store -> img != img;
+          store = store -> nextOpen )
+        ;
+
+    if ( store ) {
+        pthread_rwlock_wrlock( &store -> lock );
+        link = findFrame( store, area, storage );
+        found = link != NULL;
+        if ( link )
+            dropFrame( store, link, storage );
+        pthread_rwlock_unlock( &store -> lock );
+    }
+    pthread_mutex_unlock( &openStoresLock );
+
+    return found;
+}
+
+int64_t ufsColdTier( ufsColdStorePtr store, uint64_t idleSeconds )
+{
+    struct candidatesStruct candidates;
+    int64_t numCompressed;
+    uint64_t i;
+
+    if ( !store ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    memset( &candidates, 0, sizeof( candidates ) );
+    candidates.store = store;
+    candidates.now = now();
+    candidates.idleSeconds = idleSeconds;
+    ufsExtentIterate( store -> extents, collectFile, &candidates );
+    if ( candidates.failed ) {
+        free( candidates.pairs );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    numCompressed = 0;
+    for ( i = 0; i < candidates.numPairs; i++ ) {
+        if ( ufsColdCompress( store, candidates.pairs[ 2 * i ],
+                              candidates.pairs[ 2 * i + 1 ] ) > 0 )
+            numCompressed++;
+    }
+
+    free( candidates.pairs );
+    ufsErrno = UFS_NO_ERROR;
+    return numCompressed;
+}
+
+bool ufsColdStart( ufsColdStorePtr store, uint64_t idleSeconds,
+                   uint64_t intervalMs )
+{
+    if ( !store || !intervalMs || store -> running ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    store -> idleSeconds = idleSeconds;
+    store -> intervalMs = intervalMs;
+    store -> stop = false;
+    if ( pthread_create( &store -> job, NULL, tierThread, store ) ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    store -> running = true;
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsColdGetStats( ufsColdStorePtr store,
+                      struct ufsColdStatsStruct *stats )
+{
+    struct frameStruct *frame;
+    uint64_t i;
+
+    if ( !store || !stats ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    memset( stats, 0, sizeof( *stats ) );
+    pthread_rwlock_rdlock( &store -> lock );
+    for ( i = 0; i < ufsLayoutCapacity( store -> img, UFS_TYPES_FILE ); i++ ) {
+        for ( frame = store -> frames[i]; frame; frame = frame -> next ) {
+            stats -> numFrames++;
+            stats -> logicalBytes += frame -> length;
+            stats -> physicalBytes += frame -> index[ frame -> numBlocks ];
+        }
+    }
+    pthread_rwlock_unlock( &store -> lock );
+
+    stats -> compressed = __atomic_load_n( &store -> compressed,
+                                           __ATOMIC_RELAXED );
+    stats -> thawed = __atomic_load_n( &store -> thawed, __ATOMIC_RELAXED );
+    stats -> incompressible = __atomic_load_n( &store -> incompressible,
+                                               __ATOMIC_RELAXED );
+    stats -> cacheHits = __atomic_load_n( &store -> cacheHits,
+                                          __ATOMIC_RELAXED );
+    stats -> decompressed = __atomic_load_n( &store -> decompressed,
+                                             __ATOMIC_RELAXED );
+    stats -> parallelReads = __atomic_load_n( &store -> parallelReads,
+                                              __ATOMIC_RELAXED );
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+static uint64_t now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec;
+}
+
+static void touch( struct ufsColdStoreStruct *store, ufsIdType area )
+{
+    if ( area > 0 && (uint64_t) area <= store -> numAreas )
+        __atomic_store_n( &store -> areas[ area - 1 ].lastUse, now(),
+                          __ATOMIC_RELAXED );
+}
+
+static void frameName( ufsIdType area, ufsIdType file, char *name )
+{
+    snprintf( name, ENTRY_NAME_SIZE, "%ld/%ld", (long) area, (long) file );
+}
+
+/* The link naming the frame, NULL when there's none.                         */
+static struct frameStruct **findFrame( struct ufsColdStoreStruct *store,
+                                       ufsIdType area, ufsIdType file )
+{
+    struct frameStruct **link;
+
+    if ( area <= 0 || file <= 0 ||
+         (uint64_t) file > ufsLayoutCapacity( store -> img, UFS_TYPES_FILE ) )
+        return NULL;
+
+    for ( link = &store -> frames[ file - 1 ]; *link;
+          link = &( *link ) -> next ) {
+        if ( ( *link ) -> area == area )
+            return link;
+    }
+
+    return NULL;
+}
+
+/* Every directory under the root is an area.                                 */
+static bool loadFrames( struct ufsColdStoreStruct *store )
+{
+    struct dirent *entry;
+    ufsIdType area;
+    char *end;
+    DIR *dir;
+    int fd;
+    bool ok;
+
+    fd = dup( store -> dirFd );
+    dir = fd >= 0 ? fdopendir( fd ) : NULL;
+    if ( !dir ) {
+        if ( fd >= 0 )
+            close( fd );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    ok = true;
+    while ( ok && ( entry = readdir( dir ) ) ) {
+        area = strtol( entry -> d_name, &end, 10 );
+        if ( *end || area <= 0 )
+            continue;
+        ok = loadArea( store, area );
+    }
+
+    closedir( dir );
+    return ok;
+}
+
+/* Temporary files are left by compressions that didn't finish. Frames of     */
+/* mappings that are gone, or whose file or area was taken again since, were  */
+/* left by removals while the store was closed.                               */
+static bool loadArea( struct ufsColdStoreStruct *store, ufsIdType area )
+{
+    char name[ ENTRY_NAME_SIZE ];
+    struct dirent *entry;
+    ufsIdType file;
+    uint64_t numFiles;
+    char *end;
+    DIR *dir;
+    int dirFd, fd;
+    bool ok, isStale;
+
+    snprintf( name, sizeof( name ), "%ld", (long) area );
+    dirFd = openat( store -> dirFd, name, O_RDONLY | O_DIRECTORY |
+                                          O_CLOEXEC );
+    dir = dirFd >= 0 ? fdopendir( dirFd ) : NULL;
+    if ( !dir ) {
+        if ( dirFd >= 0 )
+            close( dirFd );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    numFiles = ufsLayoutCapacity( store -> img, UFS_TYPES_FILE );
+    ok = true;
+    while ( ok && ( entry = readdir( dir ) ) ) {
+        if ( entry -> d_name[0] == '.' )
+            continue;
+
+        file = strtol( entry -> d_name, &end, 10 );
+        if ( *end || file <= 0 || (uint64_t) area > store -> numAreas ||
+             (uint64_t) file > numFiles ||
+             !ufsStoreProbeMapping( store -> img, area, file ) ) {
+            unlinkat( dirfd( dir ), entry -> d_name, 0 );
+            continue;
+        }
+
+        fd = openat( dirfd( dir ), entry -> d_name, O_RDONLY | O_CLOEXEC );
+        if ( fd < 0 ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            ok = false;
+            break;
+        }
+
+        ok = loadFrame( store, fd, area, file, &isStale );
+        close( fd );
+        if ( ok && isStale )
+            unlinkat( dirfd( dir ), entry -> d_name, 0 );
+        else if ( ok &&
+                  ufsExtentGetSize( store -> extents, area, file ) > 0 )
+            ufsExtentRemove( store -> extents, area, file );
+    }
+
+    closedir( dir );
+    return ok;
+}
+
+/* A frame of an earlier file or area is left out and *isStale set.          */
+static bool loadFrame( struct ufsColdStoreStruct *store, int fd,
+                       ufsIdType area, ufsIdType file, bool *isStale )
+{
+    struct frameHeaderStruct header;
+    struct frameStruct *frame;
+    struct stat st;
+    uint64_t i;
+
+    if ( fstat( fd, &st ) ||
+         !readAll( fd, &header, sizeof( header ), 0 ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    if ( header.magic != UFS_COLD_MAGIC ||
+         header.blockSize != UFS_COLD_BLOCK || !header.length ||
+         header.numBlocks != ( header.length + UFS_COLD_BLOCK - 1 ) /
+                             UFS_COLD_BLOCK ) {
+        ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+        return false;
+    }
+
+    *isStale = header.fileGeneration !=
+               ufsStoreGetGeneration( store -> img, UFS_TYPES_FILE, file ) ||
+               header.areaGeneration !=
+               ufsStoreGetGeneration( store -> img, UFS_TYPES_AREA, area );
+    if ( *isStale )
+        return true;
+
+    frame = calloc( 1, sizeof( *frame ) );
+    if ( frame )
+        frame -> index = malloc( ( header.numBlocks + 1 ) *
+                                 sizeof( *frame -> index ) );
+    if ( !frame || !frame -> index ) {
+        if ( frame )
+            free( frame );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    frame -> area = area;
+    frame -> length = header.length;
+    frame -> numBlocks = header.numBlocks;
+    if ( !readAll( fd, frame -> index, ( header.numBlocks + 1 ) *
+                                       sizeof( *frame -> index ),
+                   sizeof( header ) ) ) {
+        free( frame -> index );
+        free( frame );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    /* A block never takes more than its data, the last one ends the file.    */
+    for ( i = 0; i <= frame -> numBlocks; i++ ) {
+        if ( ( !i && frame -> index[0] != sizeof( header ) +
+                     ( frame -> numBlocks + 1 ) * sizeof( uint64_t ) ) ||
+             ( i && ( frame -> index[i] <= frame -> index[ i - 1 ] ||
+                      frame -> index[i] - frame -> index[ i - 1 ] >
+                          blockLength( frame, i - 1 ) ) ) ) {
+            free( frame -> index );
+            free( frame );
+            ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+            return false;
+        }
+    }
+
+    if ( frame -> index[ frame -> numBlocks ] != (uint64_t) st.st_size ) {
+        free( frame -> index );
+        free( frame );
+        ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+        return false;
+    }
+
+    frame -> serial = store -> nextSerial++;
+    frame -> next = store -> frames[ file - 1 ];
+    store -> frames[ file - 1 ] = frame;
+    return true;
+}
+
+/* Writes the blocks and then the header and index in front of them, *frame   */
+/* is set to NULL if they don't save enough.                                  */
+static bool writeFrame( struct ufsColdStoreStruct *store, ufsIdType area,
+                        ufsIdType file, uint64_t length, char *tmpName,
+                        struct frameStruct **frame )
+{
+    struct frameHeaderStruct header;
+    uint8_t *raw, *packed, *data;
+    uint64_t *index, numBlocks, pos, n, size, i;
+    int fd;
+
+    snprintf( tmpName, ENTRY_NAME_SIZE, "%ld", (long) area );
+    if ( mkdirat( store -> dirFd, tmpName, 0755 ) && errno != EEXIST ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    snprintf( tmpName, ENTRY_NAME_SIZE, "%ld/%ld.%lu%s", (long) area,
+              (long) file, (unsigned long) __atomic_fetch_add(
+                  &store -> nextTmp, 1, __ATOMIC_RELAXED ), TMP_SUFFIX );
+    numBlocks = ( length + UFS_COLD_BLOCK - 1 ) / UFS_COLD_BLOCK;
+    index = malloc( ( numBlocks + 1 ) * sizeof( *index ) );
+    raw = malloc( UFS_COLD_BLOCK );
+    packed = malloc( UFS_COLD_BLOCK );
+    *frame = calloc( 1, sizeof( **frame ) );
+    if ( !index || !raw || !packed || !*frame ) {
+        free( index );
+        free( raw );
+        free( packed );
+        free( *frame );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    fd = openat( store -> dirFd, tmpName,
+                 O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444 );
+    if ( fd < 0 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        goto fail;
+    }
+
+    pos = sizeof( header ) + ( numBlocks + 1 ) * sizeof( *index );
+    for ( i = 0; i < numBlocks; i++ ) {
+        n = length - i * UFS_COLD_BLOCK < UFS_COLD_BLOCK ?
+            length - i * UFS_COLD_BLOCK : UFS_COLD_BLOCK;
+        if ( ufsExtentRead( store -> extents, area, file, raw, n,
+                            i * UFS_COLD_BLOCK ) != (int64_t) n ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            goto fail;
+        }
+
+        size = ufsLzCompress( raw, n, packed, n - 1 );
+        data = size ? packed : raw;
+        size = size ? size : n;
+        if ( !writeAll( fd, data, size, pos ) )
+            goto fail;
+
+        index[i] = pos;
+        pos += size;
+    }
+    index[ numBlocks ] = pos;
+
+    if ( pos * 100 > length * ( 100 - UFS_COLD_MIN_SAVING ) ) {
+        close( fd );
+        unlinkat( store -> dirFd, tmpName, 0 );
+        free( index );
+        free( *frame );
+        *frame = NULL;
+        free( raw );
+        free( packed );
+        return true;
+    }
+
+    header = (struct frameHeaderStruct) {
+        .magic = UFS_COLD_MAGIC,
+        .blockSize = UFS_COLD_BLOCK,
+        .length = length,
+        .numBlocks = numBlocks,
+        .fileGeneration = ufsStoreGetGeneration( store -> img,
+                                                 UFS_TYPES_FILE, file ),
+        .areaGeneration = ufsStoreGetGeneration( store -> img,
+                                                 UFS_TYPES_AREA, area ),
+    };
+    if ( !writeAll( fd, &header, sizeof( header ), 0 ) ||
+         !writeAll( fd, index, ( numBlocks + 1 ) * sizeof( *index ),
+                    sizeof( header ) ) )
+        goto fail;
+
+    if ( fdatasync( fd ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        goto fail;
+    }
+
+    close( fd );
+    free( raw );
+    free( packed );
+    ( *frame ) -> area = area;
+    ( *frame ) -> serial = __atomic_fetch_add( &store -> nextSerial, 1,
+                                               __ATOMIC_RELAXED );
+    ( *frame ) -> length = length;
+    ( *frame ) -> numBlocks = numBlocks;
+    ( *frame ) -> index = index;
+    return true;
+
+fail:
+    if ( fd >= 0 ) {
+        close( fd );
+        unlinkat( store -> dirFd, tmpName, 0 );
+    }
+    free( index );
+    free( raw );
+    free( packed );
+    free( *frame );
+    *frame = NULL;
+    return false;
+}
+
+/* The extents are written before the frame goes, those of a thaw that        */
+/* failed are removed again.                                                  */
+static bool thawFrame( struct ufsColdStoreStruct *store, ufsIdType area,
+                       ufsIdType file )
+{
+    char name[ ENTRY_NAME_SIZE ];
+    struct frameStruct **link, *frame;
+    uint8_t *data, *packed;
+    uint64_t i;
+    int fd;
+    bool ok;
+
+    link = findFrame( store, area, file );
+    if ( !link ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return false;
+    }
+
+    frame = *link;
+    frameName( area, file, name );
+    fd = openat( store -> dirFd, name, O_RDONLY | O_CLOEXEC );
+    data = malloc( UFS_COLD_BLOCK );
+    packed = malloc( UFS_COLD_BLOCK );
+    ok = fd >= 0 && data && packed;
+    if ( !ok )
+        ufsErrno = fd < 0 ? UFS_UNKNOWN_ERROR : UFS_OUT_OF_MEMORY;
+
+    for ( i = 0; ok && i < frame -> numBlocks; i++ ) {
+        ok = readBlock( frame, fd, i, data, packed ) &&
+             ufsExtentWrite( store -> extents, area, file, data,
+                             blockLength( frame, i ), i * UFS_COLD_BLOCK );
+    }
+
+    if ( fd >= 0 )
+        close( fd );
+    free( data );
+    free( packed );
+    if ( !ok ) {
+        if ( ufsExtentGetSize( store -> extents, area, file ) > 0 )
+            ufsExtentRemove( store -> extents, area, file );
+        return false;
+    }
+
+    dropFrame( store, link, file );
+    __atomic_fetch_add( &store -> thawed, 1, __ATOMIC_RELAXED );
+    return true;
+}
+
+/* Unlinks the frame from disk and from its chain, under the write lock.      */
+static void dropFrame( struct ufsColdStoreStruct *store,
+                       struct frameStruct **link, ufsIdType file )
+{
+    char name[ ENTRY_NAME_SIZE ];
+    struct frameStruct *frame;
+
+    frame = *link;
+    frameName( frame -> area, file, name );
+    unlinkat( store -> dirFd, name, 0 );
+    *link = frame -> next;
+    free( frame -> index );
+    free( frame );
+}
+
+static inline uint64_t blockLength( const struct frameStruct *frame,
+                                    uint64_t block )
+{
+    return block + 1 < frame -> numBlocks ? UFS_COLD_BLOCK :
+           frame -> length - block * UFS_COLD_BLOCK;
+}
+
+/* packed holds UFS_COLD_BLOCK bytes, a block stored as it is is read         */
+/* straight into data.                                                        */
+static bool readBlock( const struct frameStruct *frame, int fd,
+                       uint64_t block, uint8_t *data, uint8_t *packed )
+{
+    uint64_t size, length;
+
+    size = frame -> index[ block + 1 ] - frame -> index[ block ];
+    length = blockLength( frame, block );
+    if ( !readAll( fd, size == length ? data : packed, size,
+                   frame -> index[ block ] ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    if ( size != length &&
+         ufsLzDecompress( packed, size, data, length ) != (int64_t) length ) {
+        ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+        return false;
+    }
+
+    return true;
+}
+
+/* Blocks found in the cache are copied out at once, the others are           */
+/* decompressed, in parallel when there are several, the caller taking one    */
+/* itself, then copied out and cached.                                        */
+static int64_t readFrame( struct ufsColdStoreStruct *store,
+                          struct frameStruct *frame, ufsIdType file,
+                          uint8_t *buf, uint64_t len, uint64_t off )
+{
+    char name[ ENTRY_NAME_SIZE ];
+    struct blockJobStruct *jobs;
+    struct batchStruct batch;
+    uint64_t first, last, end, start, from, to, numJobs, numMissing, i;
+    bool sequential;
+    int fd;
+
+    if ( off >= frame -> length || !len ) {
+        ufsErrno = UFS_NO_ERROR;
+        return 0;
+    }
+
+    if ( len > frame -> length - off )
+        len = frame -> length - off;
+    first = off / UFS_COLD_BLOCK;
+    last = ( off + len - 1 ) / UFS_COLD_BLOCK;
+    sequential = off && __atomic_exchange_n( &frame -> nextRead, off + len,
+                                             __ATOMIC_RELAXED ) == off;
+    if ( !off )
+        __atomic_store_n( &frame -> nextRead, len, __ATOMIC_RELAXED );
+
+    end = last;
+    if ( sequential )
+        end = last + UFS_COLD_READAHEAD < frame -> numBlocks ?
+              last + UFS_COLD_READAHEAD : frame -> numBlocks - 1;
+
+    jobs = calloc( end - first + 1, sizeof( *jobs ) );
+    if ( !jobs ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    frameName( frame -> area, file, name );
+    fd = openat( store -> dirFd, name, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 ) {
+        free( jobs );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return -1;
+    }
+
+    pthread_mutex_init( &batch.lock, NULL );
+    pthread_cond_init( &batch.done, NULL );
+    batch.error = UFS_NO_ERROR;
+    numJobs = numMissing = 0;
+    for ( i = first; i <= end; i++ ) {
+        start = i * UFS_COLD_BLOCK;
+        from = off > start ? off : start;
+        to = off + len < start + UFS_COLD_BLOCK ? off + len :
+                                                  start + UFS_COLD_BLOCK;
+        if ( cacheGet( store, frame -> serial, i,
+                       i <= last ? buf + ( from - off ) : NULL, from - start,
+                       i <= last ? to - from : 0 ) )
+            continue;
+
+        jobs[ numJobs++ ] = (struct blockJobStruct) {
+            .batch = &batch, .frame = frame, .fd = fd, .block = i };
+    }
+
+    batch.pending = numMissing = numJobs;
+    if ( numMissing > 1 )
+        __atomic_fetch_add( &store -> parallelReads, 1, __ATOMIC_RELAXED );
+    for ( i = 1; i < numMissing; i++ ) {
+        if ( !ufsPoolSubmit( store -> pool, decompressJob, &jobs[i] ) )
+            decompressJob( &jobs[i] );
+    }
+    if ( numMissing )
+        decompressJob( &jobs[0] );
+
+    pthread_mutex_lock( &batch.lock );
+    while ( batch.pending )
+        pthread_cond_wait( &batch.done, &batch.lock );
+    pthread_mutex_unlock( &batch.lock );
+    pthread_cond_destroy( &batch.done );
+    pthread_mutex_destroy( &batch.lock );
+    close( fd );
+
+    for ( i = 0; i < numJobs; i++ ) {
+        if ( batch.error != UFS_NO_ERROR ) {
+            free( jobs[i].data );
+            continue;
+        }
+
+        start = jobs[i].block * UFS_COLD_BLOCK;
+        if ( jobs[i].block <= last ) {
+            from = off > start ? off : start;
+            to = off + len < start + UFS_COLD_BLOCK ? off + len :
+                                                      start + UFS_COLD_BLOCK;
+            memcpy( buf + ( from - off ), jobs[i].data + ( from - start ),
+                    to - from );
+        }
+        cachePut( store, frame -> serial, jobs[i].block, jobs[i].data );
+    }
+
+    free( jobs );
+    if ( batch.error != UFS_NO_ERROR ) {
+        ufsErrno = batch.error;
+        return -1;
+    }
+
+    __atomic_fetch_add( &store -> decompressed, numMissing, __ATOMIC_RELAXED );
+    ufsErrno = UFS_NO_ERROR;
+    return len;
+}
+
+static void decompressJob( void *arg )
+{
+    struct blockJobStruct *job;
+    uint8_t *packed;
+    bool ok;
+
+    job = arg;
+    job -> data = malloc( UFS_COLD_BLOCK );
+    packed = malloc( UFS_COLD_BLOCK );
+    ok = job -> data && packed;
+    if ( !ok )
+        ufsErrno = UFS_OUT_OF_MEMORY;
+    ok = ok && readBlock( job -> frame, job -> fd, job -> block, job -> data,
+                          packed );
+    free( packed );
+
+    pthread_mutex_lock( &job -> batch -> lock );
+    if ( !ok && job -> batch -> error == UFS_NO_ERROR )
+        job -> batch -> error = ufsErrno;
+    if ( !--job -> batch -> pending )
+        pthread_cond_signal( &job -> batch -> done );
+    pthread_mutex_unlock( &job -> batch -> lock );
+}
+
+/* Copies length bytes at from of the block to dst, if it's cached.           */
+static bool cacheGet( struct ufsColdStoreStruct *store, uint64_t serial,
+                      uint64_t block, uint8_t *dst, uint64_t from,
+                      uint64_t length )
+{
+    struct cacheEntryStruct *entry;
+    uint64_t i;
+
+    pthread_mutex_lock( &store -> cacheLock );
+    for ( i = 0; i < UFS_COLD_CACHE_BLOCKS; i++ ) {
+        entry = &store -> cache[i];
+        if ( entry -> data && entry -> serial == serial &&
+             entry -> block == block ) {
+            entry -> tick = ++store -> tick;
+            if ( dst )
+                memcpy( dst, entry -> data + from, length );
+            pthread_mutex_unlock( &store -> cacheLock );
+            __atomic_fetch_add( &store -> cacheHits, 1, __ATOMIC_RELAXED );
+            return true;
+        }
+    }
+
+    pthread_mutex_unlock( &store -> cacheLock );
+    return false;
+}
+
+/* Takes data, which a concurrent read may have cached already.               */
+static void cachePut( struct ufsColdStoreStruct *store, uint64_t serial,
+                      uint64_t block, uint8_t *data )
+{
+    struct cacheEntryStruct *entry, *victim;
+    uint64_t i;
+
+    pthread_mutex_lock( &store -> cacheLock );
+    victim = &store -> cache[0];
+    for ( i = 0; i < UFS_COLD_CACHE_BLOCKS; i++ ) {
+        entry = &store -> cache[i];
+        if ( entry -> data && entry -> serial == serial &&
+             entry -> block == block ) {
+            pthread_mutex_unlock( &store -> cacheLock );
+            free( data );
+            return;
+        }
+
+        if ( victim -> data && ( !entry -> data ||
+                                 entry -> tick < victim -> tick ) )
+            victim = entry;
+    }
+
+    free( victim -> data );
+    *victim = (struct cacheEntryStruct) {
+        .serial = serial, .block = block, .tick = ++store -> tick,
+        .data = data };
+    pthread_mutex_unlock( &store -> cacheLock );
+}
+
+static bool collectFile( ufsIdType area, ufsIdType file, void *userData )
+{
+    struct candidatesStruct *candidates;
+    ufsIdType *pairs;
+    uint64_t lastUse;
+
+    candidates = userData;
+    if ( area <= 0 || (uint64_t) area > candidates -> store -> numAreas )
+        return true;
+
+    lastUse = __atomic_load_n(
+        &candidates -> store -> areas[ area - 1 ].lastUse, __ATOMIC_RELAXED );
+    if ( candidates -> now < lastUse + candidates -> idleSeconds )
+        return true;
+
+    if ( candidates -> numPairs == candidates -> capacity ) {
+        pairs = realloc( candidates -> pairs,
+                         ( candidates -> capacity * 2 + 16 ) * 2 *
+                         sizeof( *pairs ) );
+        if ( !pairs ) {
+            candidates -> failed = true;
+            return false;
+        }
+
+        candidates -> pairs = pairs;
+        candidates -> capacity = candidates -> capacity * 2 + 16;
+    }
+
+    candidates -> pairs[ 2 * candidates -> numPairs ] = area;
+    candidates -> pairs[ 2 * candidates -> numPairs + 1 ] = file;
+    candidates -> numPairs++;
+    return true;
+}
+
+static void *tierThread( void *arg )
+{
+    struct ufsColdStoreStruct *store;
+    struct timespec deadline;
+
+    store = arg;
+    pthread_mutex_lock( &store -> jobLock );
+    while ( !store -> stop ) {
+        clock_gettime( CLOCK_MONOTONIC, &deadline );
+        deadline.tv_sec += store -> intervalMs / 1000;
+        deadline.tv_nsec += store -> intervalMs % 1000 * 1000000;
+        if ( deadline.tv_nsec >= 1000000000 ) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        while ( !store -> stop &&
+                pthread_cond_timedwait( &store -> jobCond, &store -> jobLock,
+                                        &deadline ) != ETIMEDOUT )
+            ;
+        if ( store -> stop )
+            break;
+
+        pthread_mutex_unlock( &store -> jobLock );
+        ufsColdTier( store, store -> idleSeconds );
+        pthread_mutex_lock( &store -> jobLock );
+    }
+
+    pthread_mutex_unlock( &store -> jobLock );
+    return NULL;
+}
+
+static bool writeAll( int fd, const void *buf, uint64_t len, uint64_t off )
+{
+    ssize_t ret;
+
+    while ( len ) {
+        ret = pwrite( fd, buf, len, off );
+        if ( ret < 0 && errno == EINTR )
+            continue;
+        if ( ret <= 0 ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            return false;
+        }
+
+        buf = (const uint8_t*)buf + ret;
+        len -= ret;
+        off += ret;
+    }
+
+    return true;
+}
+
+static bool readAll( int fd, void *buf, uint64_t len, uint64_t off )
+{
+    ssize_t ret;
+
+    while ( len ) {
+        ret = pread( fd, buf, len, off );
+        if ( ret < 0 && errno == EINTR )
+            continue;
+        if ( ret <= 0 )
+            return false;
+
+        buf = (uint8_t*)buf + ret;
+        len -= ret;
+        off += ret;
+    }
+
+    return true;
+}
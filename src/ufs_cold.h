@@ -0,0 +1,384 @@
+/******************************************************************************\
+*  ufs_cold.h                                                                  *
+*                                                                              *
+*  Internal header for the store compressing file data of cold areas.          *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* A cold store sits in front of an extent store and moves the data of files  */
+/* in areas that aren't used into compressed frames, giving their extents     */
+/* back. Once it's open, the data of files is read and written through it,    */
+/* reads decompress what's cold and writes to a cold file thaw it back into   */
+/* extents first, callers see the same bytes either way.                      */
+/*                                                                            */
+/* Under the root of the store the frame of file n in area a is 'a/n'. A      */
+/* frame starts with a header, then an index of numBlocks + 1 offsets into    */
+/* the frame, block i taking [ index[i], index[i + 1] ). Each block holds     */
+/* UFS_COLD_BLOCK bytes of the file, the last one what's left, compressed on  */
+/* its own with ufs_lz.h, so a read decompresses the blocks it covers only.   */
+/* A block that doesn't shrink is stored as it is, its size tells. The index  */
+/* of every frame is kept in memory while the store is open.                  */
+/*                                                                            */
+/* A frame is written to a temporary file, synced and renamed into place      */
+/* before the extents go, a thaw writes the extents before the frame goes.    */
+/* Where a crash leaves both, the frame is whole and wins, opening the store  */
+/* removes the extents. Removing a mapping, its storage or its area drops the */
+/* frame from the store open on the image. With none open the frame is        */
+/* removed once one is opened. A frame carries the generations of its file    */
+/* and area, see ufsStoreGetGeneration, so one left by an earlier file or     */
+/* area under the same identifiers is never taken for the new one's data.    */
+/*                                                                            */
+/* An area is idle once no read or write went to it for idleSeconds, every    */
+/* area counts as used when the store is opened. ufsColdTier compresses the   */
+/* files of idle areas, ufsColdStart runs it in the background. Reads and     */
+/* writes go on while a file is compressed, the frame replaces the extents    */
+/* under the write lock only if no write went to the area meanwhile. Data     */
+/* that saves less than UFS_COLD_MIN_SAVING percent stays in its extents.     */
+/*                                                                            */
+/* Decompressed blocks are kept in a cache of UFS_COLD_CACHE_BLOCKS. A read   */
+/* that starts where the last read of the file ended is sequential and        */
+/* reads UFS_COLD_READAHEAD blocks past what it asked for into the cache.     */
+/* The blocks a read misses are decompressed in parallel on the workers of    */
+/* the store, each block is independent. Reads of hot files go to the extent  */
+/* store and never touch the cache.                                           */
+
+#ifndef UFS_COLD_H
+#define UFS_COLD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs_defs.h"
+#include "ufs_extent.h"
+#include "ufs_image.h"
+
+#define UFS_COLD_BLOCK ( 64 * 1024 )
+#define UFS_COLD_CACHE_BLOCKS (64)
+#define UFS_COLD_READAHEAD (8)
+#define UFS_COLD_MIN_SAVING (10)
+/* 'ufsz', the first bytes of a frame.                                        */
+#define UFS_COLD_MAGIC (0x7a736675)
+
+typedef struct ufsColdStoreStruct *ufsColdStorePtr;
+
+struct ufsColdStatsStruct {
+    /* Files kept compressed, what they hold and what their frames take.      */
+    uint64_t numFrames,
+             logicalBytes,
+             physicalBytes;
+    /* Since the store was opened: files compressed, thawed and left as they  */
+    /* were because they don't compress.                                      */
+    uint64_t compressed,
+             thawed,
+             incompressible;
+    /* Since the store was opened: blocks found in the cache, blocks          */
+    /* decompressed and reads that decompressed blocks in parallel.           */
+    uint64_t cacheHits,
+             decompressed,
+             parallelReads;
+};
+
+/******************************************************************************\
+* ufsColdOpen                                                                  *
+*                                                                              *
+*  Opens the store under path in front of extents, creating it if it doesn't   *
+*  exist, and loads the index of every frame.                                  *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: path, img or extents are NULL or numThreads is 0 or above    *
+*                 UFS_POOL_MAX_THREADS.                                        *
+*   UFS_DOES_NOT_EXIST: path can't be created or isn't a directory.            *
+*   UFS_IMAGE_IS_CORRUPTED: A frame is damaged.                                *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: A frame couldn't be read.                               *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -path: The root of the store, usually UFS_COLD_DIR.                         *
+*  -img: The image of extents, must outlive the store.                         *
+*  -extents: The extent store holding what's hot, must outlive the store.      *
+*  -numThreads: The number of workers decompressing blocks.                    *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsColdStorePtr: The store, NULL on error.                                 *
+*                                                                              *
+\******************************************************************************/
+ufsColdStorePtr ufsColdOpen( const char *path, ufsImagePtr img,
+                             ufsExtentStorePtr extents, uint64_t numThreads );
+
+/******************************************************************************\
+* ufsColdClose                                                                 *
+*                                                                              *
+*  Stops the background job and closes a store, what it holds stays on disk.   *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store, may be NULL.                                             *
+*                                                                              *
+\******************************************************************************/
+void ufsColdClose( ufsColdStorePtr store );
+
+/******************************************************************************\
+* ufsColdIsCold                                                                *
+*                                                                              *
+*  Checks whether the data of file in area is compressed.                      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store, not NULL.                                                *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if it is, false otherwise.                                      *
+*                                                                              *
+\******************************************************************************/
+bool ufsColdIsCold( ufsColdStorePtr store, ufsIdType area, ufsIdType file );
+
+/******************************************************************************\
+* ufsColdCompress                                                              *
+*                                                                              *
+*  Moves the data of file in area from its extents into a frame, unless it     *
+*  saves less than UFS_COLD_MIN_SAVING percent or is written to meanwhile.     *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store is NULL.                                               *
+*   UFS_DOES_NOT_EXIST: file has no extents in area.                           *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: The frame couldn't be written.                          *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int64_t: The bytes saved, 0 if the data stayed in its extents, -1 on       *
+*            error.                                                            *
+*                                                                              *
+\******************************************************************************/
+int64_t ufsColdCompress( ufsColdStorePtr store, ufsIdType area,
+                         ufsIdType file );
+
+/******************************************************************************\
+* ufsColdThaw                                                                  *
+*                                                                              *
+*  Moves the data of file in area from its frame back into extents.            *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsExtentWrite.                                                   *
+*   UFS_BAD_CALL: store is NULL.                                               *
+*   UFS_DOES_NOT_EXIST: file has no frame in area.                             *
+*   UFS_IMAGE_IS_CORRUPTED: The frame is damaged.                              *
+*   UFS_UNKNOWN_ERROR: The frame couldn't be read.                             *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsColdThaw( ufsColdStorePtr store, ufsIdType area, ufsIdType file );
+
+/******************************************************************************\
+* ufsColdGetSize                                                               *
+*                                                                              *
+*  Gets the size of the data of file in area, cold or not.                     *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store is NULL.                                               *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int64_t: The size, 0 for a file with no data, -1 on error.                 *
+*                                                                              *
+\******************************************************************************/
+int64_t ufsColdGetSize( ufsColdStorePtr store, ufsIdType area,
+                        ufsIdType file );
+
+/******************************************************************************\
+* ufsColdRead                                                                  *
+*                                                                              *
+*  Reads up to len bytes at off of the data of file in area into buf,          *
+*  decompressing the blocks it covers if the data is cold.                     *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsExtentRead.                                                    *
+*   UFS_BAD_CALL: store or buf are NULL.                                       *
+*   UFS_IMAGE_IS_CORRUPTED: A block of the frame is damaged.                   *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: The frame couldn't be read.                             *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*  -buf: Filled with what's read.                                              *
+*  -len: The number of bytes to read.                                          *
+*  -off: Where in the data to read from.                                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int64_t: The number of bytes read, less than len at the end of the data,   *
+*            -1 on error.                                                      *
+*                                                                              *
+\******************************************************************************/
+int64_t ufsColdRead( ufsColdStorePtr store, ufsIdType area, ufsIdType file,
+                     void *buf, uint64_t len, uint64_t off );
+
+/******************************************************************************\
+* ufsColdWrite                                                                 *
+*                                                                              *
+*  Writes len bytes of buf at off of the data of file in area, thawing it      *
+*  first if it's cold, see ufsExtentWrite.                                     *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsColdThaw and ufsExtentWrite.                                   *
+*   UFS_BAD_CALL: store is NULL.                                               *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*  -buf: What to write.                                                        *
+*  -len: The number of bytes to write.                                         *
+*  -off: Where in the data to write to.                                        *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsColdWrite( ufsColdStorePtr store, ufsIdType area, ufsIdType file,
+                   const void *buf, uint64_t len, uint64_t off );
+
+/******************************************************************************\
+* ufsColdRemove                                                                *
+*                                                                              *
+*  Removes the data of file in area, its frame and its extents, the mapping    *
+*  is kept.                                                                    *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store is NULL.                                               *
+*   UFS_DOES_NOT_EXIST: file has no data in area.                              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsColdRemove( ufsColdStorePtr store, ufsIdType area, ufsIdType file );
+
+/******************************************************************************\
+* ufsColdDrop                                                                  *
+*                                                                              *
+*  Drops the frame of storage in area from the cold store open on img, if any *
+*  is. The store calls it when a mapping, its storage or its area goes. With   *
+*  none open the frame is removed once one is opened.                          *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: The image.                                                            *
+*  -area: The identifier of the area.                                          *
+*  -storage: The identifier of the file.                                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if a frame was dropped, false otherwise.                        *
+*                                                                              *
+\******************************************************************************/
+bool ufsColdDrop( ufsImagePtr img, ufsIdType area, ufsIdType storage );
+
+/******************************************************************************\
+* ufsColdTier                                                                  *
+*                                                                              *
+*  Compresses the files of every area that's been idle for idleSeconds.        *
+*  Files that fail are left where they are.                                    *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store is NULL.                                               *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -idleSeconds: How long an area goes unused before it's cold.                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int64_t: The number of files compressed, -1 on error.                      *
+*                                                                              *
+\******************************************************************************/
+int64_t ufsColdTier( ufsColdStorePtr store, uint64_t idleSeconds );
+
+/******************************************************************************\
+* ufsColdStart                                                                 *
+*                                                                              *
+*  Starts a thread calling ufsColdTier every intervalMs until the store is     *
+*  closed.                                                                     *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store is NULL, intervalMs is 0 or the thread runs already.   *
+*   UFS_OUT_OF_MEMORY: The thread could not be created.                        *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -idleSeconds: Passed to ufsColdTier.                                        *
+*  -intervalMs: The time between two passes.                                   *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsColdStart( ufsColdStorePtr store, uint64_t idleSeconds,
+                   uint64_t intervalMs );
+
+/******************************************************************************\
+* ufsColdGetStats                                                              *
+*                                                                              *
+*  Gets the statistics of store.                                               *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store or stats are NULL.                                     *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -stats: Filled with the statistics.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsColdGetStats( ufsColdStorePtr store,
+                      struct ufsColdStatsStruct *stats );
+
+#endif /* UFS_COLD_H */
@@ -0,0 +1,1078 @@
+/******************************************************************************\
+*  ufs_extent.c                                                                *
+*                                                                              *
+*  Contains the definitions for the extent store of file data.                 *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ufs_extent.h"
+#include "ufs_header.h"
+#include "ufs_layout.h"
+#include "ufs_store.h"
+#include <unistd.h>
+
+#define NUM_BLOCKS ( 1 << ( UFS_EXTENT_ORDERS - 1 ) )
+#define MAX_ORDER ( UFS_EXTENT_ORDERS - 1 )
+#define ENTRY_NAME_SIZE (32)
+/* Segments mapped at a time by ufsExtentRead and ufsExtentSplice.            */
+#define READ_SEGMENTS (16)
+
+struct extentFileStruct {
+    int fd;
+    /* The bytes fallocated, extents past them have no space yet.             */
+    uint64_t size;
+    /* The free extents of each order, chained through next and prev by their */
+    /* first block, -1 ends a chain.                                          */
+    int32_t freeLists[ UFS_EXTENT_ORDERS ];
+    int32_t *next,
+            *prev;
+    /* The order plus one at the first block of a free extent, 0 elsewhere.   */
+    uint8_t *free;
+};
+
+struct ufsExtentStoreStruct {
+    /* Taken for writing by the calls that change extents.                    */
+    pthread_rwlock_t lock;
+    ufsImagePtr img;
+    int dirFd;
+    struct extentFileStruct *files;
+    uint64_t numFiles;
+    uint64_t grows;
+    /* The next store in openStores.                                          */
+    struct ufsExtentStoreStruct *nextOpen;
+};
+
+static const uint8_t zeros[ UFS_EXTENT_BLOCK ];
+
+/* The stores open in this process, ufsExtentDrop frees space through the one */
+/* of its image. Taken before the lock of a store.                            */
+static pthread_mutex_t openStoresLock = PTHREAD_MUTEX_INITIALIZER;
+static struct ufsExtentStoreStruct *openStores;
+
+static inline struct ufsExtentStruct *getExtent( ufsImagePtr img,
+                                                 ufsIdType id );
+static inline uint64_t extentSize( const struct ufsExtentStruct *extent );
+static inline uint64_t extentStart( const struct ufsExtentStruct *extent );
+static ufsIdType allocExtent( ufsImagePtr img );
+static void freeExtent( ufsImagePtr img, ufsIdType id );
+static bool rebuild( struct ufsExtentStoreStruct *store );
+static bool addFile( struct ufsExtentStoreStruct *store );
+static void pushFree( struct extentFileStruct *file, uint64_t block,
+                      uint32_t order );
+static void unlinkFree( struct extentFileStruct *file, uint64_t block,
+                        uint32_t order );
+static bool claimBlock( struct extentFileStruct *file, uint64_t block,
+                        uint32_t order );
+static bool allocBlock( struct ufsExtentStoreStruct *store, uint32_t order,
+                        uint32_t *extentFile, uint64_t *block );
+static void freeBlock( struct extentFileStruct *file, uint64_t block,
+                       uint32_t order );
+static bool growFile( struct ufsExtentStoreStruct *store,
+                      struct extentFileStruct *file, uint64_t end );
+static uint32_t orderFor( uint64_t length );
+static ufsIdType findCovering( ufsImagePtr img, ufsIdType area,
+                               ufsIdType file, uint64_t pos, uint64_t *next );
+static void linkExtent( ufsImagePtr img, ufsIdType file, ufsIdType id );
+static bool newExtent( struct ufsExtentStoreStruct *store, ufsIdType area,
+                       ufsIdType file, uint32_t order, const uint8_t *buf,
+                       uint64_t len, uint64_t off );
+static uint64_t dropExtents( ufsImagePtr img,
+                             struct ufsExtentStoreStruct *store,
+                             ufsIdType area, ufsIdType file );
+static uint64_t dataEnd( ufsImagePtr img, ufsIdType area, ufsIdType file );
+static uint64_t mapExtents( struct ufsExtentStoreStruct *store,
+                            ufsIdType area, ufsIdType file, uint64_t offset,
+                            uint64_t length,
+                            struct ufsExtentSegmentStruct *segments,
+                            uint64_t maxSegments );
+static bool writeAll( int fd, const void *buf, uint64_t len, uint64_t off );
+static bool readAll( int fd, void *buf, uint64_t len, uint64_t off );
+static bool checkFile( ufsImagePtr img, ufsIdType area, ufsIdType file );
+
+bool ufsExtentHas( ufsImagePtr img )
+{
+    struct ufsHeaderStruct *header;
+
+    header = ufsLayoutHeader( img );
+    return header -> sizes[ UFS_TYPES_EXTENT ] &&
+           !( header -> flags & ( UFS_HEADER_FLAG_SEALED |
+                                  UFS_HEADER_FLAG_SNAPSHOT ) );
+}
+
+ufsExtentStorePtr ufsExtentOpen( const char *path, ufsImagePtr img )
+{
+    struct ufsExtentStoreStruct *store;
+
+    if ( !path || !img || !ufsExtentHas( img ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    store = calloc( 1, sizeof( *store ) );
+    if ( !store ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    store -> img = img;
+    store -> dirFd = -1;
+    pthread_rwlock_init( &store -> lock, NULL );
+    if ( mkdir( path, 0755 ) && errno != EEXIST ) {
+        ufsExtentClose( store );
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return NULL;
+    }
+
+    store -> dirFd = open( path, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    if ( store -> dirFd < 0 ) {
+        ufsExtentClose( store );
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return NULL;
+    }
+
+    if ( !rebuild( store ) ) {
+        ufsExtentClose( store );
+        return NULL;
+    }
+
+    pthread_mutex_lock( &openStoresLock );
+    store -> nextOpen = openStores;
+    openStores = store;
+    pthread_mutex_unlock( &openStoresLock );
+
+    ufsErrno = UFS_NO_ERROR;
+    return store;
+}
+
+void ufsExtentClose( ufsExtentStorePtr store )
+{
+    struct ufsExtentStoreStruct **link;
+    uint64_t i;
+
+    if ( !store )
+        return;
+
+    pthread_mutex_lock( &openStoresLock );
+    for ( link = &openStores; *link; link = &(*link) -> nextOpen ) {
+        if ( *link == store ) {
+            *link = store -> nextOpen;
+            break;
+        }
+    }
+    pthread_mutex_unlock( &openStoresLock );
+
+    for ( i = 0; i < store -> numFiles; i++ ) {
+        close( store -> files[i].fd );
+        free( store -> files[i].next );
+        free( store -> files[i].prev );
+        free( store -> files[i].free );
+    }
+
+    free( store -> files );
+    if ( store -> dirFd >= 0 )
+        close( store -> dirFd );
+    pthread_rwlock_destroy( &store -> lock );
+    free( store );
+}
+
+/* Each pass writes what one extent takes, one that covers pos or a new one   */
+/* ending no later than the extent after it.                                  */
+bool ufsExtentWrite( ufsExtentStorePtr store, ufsIdType area, ufsIdType file,
+                     const void *buf, uint64_t len, uint64_t off )
+{
+    struct ufsExtentStruct *extent;
+    struct extentFileStruct *extentFile;
+    uint64_t pos, end, next, limit, written, n;
+    ufsStatusType status;
+    uint32_t order;
+    ufsIdType id;
+    bool mapped;
+
+    if ( !store || ( !buf && len ) || off + len < off ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !checkFile( store -> img, area, file ) )
+        return false;
+
+    pthread_rwlock_wrlock( &store -> lock );
+    mapped = ufsStoreProbeMapping( store -> img, area, file );
+    pos = off;
+    end = off + len;
+    while ( pos < end ) {
+        id = findCovering( store -> img, area, file, pos, &next );
+        extent = id ? getExtent( store -> img, id ) : NULL;
+        limit = next < end ? next : end;
+
+        if ( extent && pos < extent -> offset + extentSize( extent ) ) {
+            if ( extent -> offset + extentSize( extent ) < limit )
+                limit = extent -> offset + extentSize( extent );
+            extentFile = &store -> files[ extent -> extentFile ];
+            written = extent -> offset + extent -> length;
+
+            /* What's left of the extent since it was last freed isn't data.  */
+            for ( ; written < pos; written += n ) {
+                n = pos - written < sizeof( zeros ) ? pos - written :
+                                                      sizeof( zeros );
+                if ( !writeAll( extentFile -> fd, zeros, n,
+                                extentStart( extent ) + written -
+                                    extent -> offset ) )
+                    goto fail;
+            }
+
+            if ( !writeAll( extentFile -> fd,
+                            (const uint8_t*)buf + ( pos - off ), limit - pos,
+                            extentStart( extent ) + pos - extent -> offset ) )
+                goto fail;
+
+            if ( limit - extent -> offset > extent -> length )
+                extent -> length = limit - extent -> offset;
+            pos = limit;
+            continue;
+        }
+
+        /* Data appended to a file gets twice the extent before it, so a      */
+        /* file written in small pieces still has few extents.                */
+        order = orderFor( limit - pos );
+        if ( extent && next == UINT64_MAX && extent -> order + 1 > order )
+            order = extent -> order < MAX_ORDER ? extent -> order + 1 :
+                                                  MAX_ORDER;
+
+        if ( limit - pos > ( (uint64_t)UFS_EXTENT_BLOCK << order ) )
+            limit = pos + ( (uint64_t)UFS_EXTENT_BLOCK << order );
+        if ( !newExtent( store, area, file, order,
+                         (const uint8_t*)buf + ( pos - off ), limit - pos,
+                         pos ) )
+            goto fail;
+        pos = limit;
+    }
+
+    /* The mapping goes last, it never names data that isn't written.         */
+    if ( !mapped && !ufsStoreAddMapping( store -> img, area, file ) &&
+         ufsErrno != UFS_MAPPING_ALREADY_EXISTS )
+        goto fail;
+
+    pthread_rwlock_unlock( &store -> lock );
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+
+fail:
+    /* Nothing names what a new file got so far, its space is free again.     */
+    if ( !mapped ) {
+        status = ufsErrno;
+        dropExtents( store -> img, store, area, file );
+        ufsErrno = status;
+    }
+    pthread_rwlock_unlock( &store -> lock );
+    return false;
+}
+
+int64_t ufsExtentGetSize( ufsExtentStorePtr store, ufsIdType area,
+                          ufsIdType file )
+{
+    uint64_t size;
+
+    if ( !store ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    pthread_rwlock_rdlock( &store -> lock );
+    size = dataEnd( store -> img, area, file );
+    pthread_rwlock_unlock( &store -> lock );
+    ufsErrno = UFS_NO_ERROR;
+    return size;
+}
+
+bool ufsExtentMap( ufsExtentStorePtr store, ufsIdType area, ufsIdType file,
+                   uint64_t offset, uint64_t length,
+                   struct ufsExtentSegmentStruct *segments,
+                   uint64_t maxSegments, uint64_t *numSegments )
+{
+    if ( !store || !segments || !numSegments || !maxSegments ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    pthread_rwlock_rdlock( &store -> lock );
+    *numSegments = mapExtents( store, area, file, offset, length, segments,
+                               maxSegments );
+    pthread_rwlock_unlock( &store -> lock );
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+int64_t ufsExtentRead( ufsExtentStorePtr store, ufsIdType area, ufsIdType file,
+                       void *buf, uint64_t len, uint64_t off )
+{
+    struct ufsExtentSegmentStruct segments[ READ_SEGMENTS ];
+    uint64_t done, n, i;
+
+    if ( !store || !buf ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    pthread_rwlock_rdlock( &store -> lock );
+    for ( done = 0; done < len; ) {
+        n = mapExtents( store, area, file, off + done, len - done, segments,
+                        READ_SEGMENTS );
+        if ( !n )
+            break;
+
+        for ( i = 0; i < n; i++ ) {
+            if ( segments[i].fd < 0 )
+                memset( (uint8_t*)buf + done, 0, segments[i].length );
+            else if ( !readAll( segments[i].fd, (uint8_t*)buf + done,
+                                segments[i].length, segments[i].offset ) ) {
+                pthread_rwlock_unlock( &store -> lock );
+                ufsErrno = UFS_UNKNOWN_ERROR;
+                return -1;
+            }
+            done += segments[i].length;
+        }
+    }
+
+    pthread_rwlock_unlock( &store -> lock );
+    ufsErrno = UFS_NO_ERROR;
+    return done;
+}
+
+/* splice needs no flags, a non-blocking pipe already makes it stop instead   */
+/* of waiting.                                                                */
+int64_t ufsExtentSplice( ufsExtentStorePtr store, ufsIdType area,
+                         ufsIdType file, int pipeFd, uint64_t len,
+                         uint64_t off )
+{
+    struct ufsExtentSegmentStruct segments[ READ_SEGMENTS ];
+    uint64_t done, n, i, left;
+    loff_t from;
+    ssize_t ret;
+
+    if ( !store || pipeFd < 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    pthread_rwlock_rdlock( &store -> lock );
+    for ( done = 0; done < len; ) {
+        n = mapExtents( store, area, file, off + done, len - done, segments,
+                        READ_SEGMENTS );
+        if ( !n )
+            break;
+
+        for ( i = 0; i < n; i++ ) {
+            from = segments[i].offset;
+            for ( left = segments[i].length; left; left -= ret, done += ret ) {
+                if ( segments[i].fd < 0 )
+                    ret = write( pipeFd, zeros, left < sizeof( zeros ) ?
+                                                    left : sizeof( zeros ) );
+                else
+                    ret = splice( segments[i].fd, &from, pipeFd, NULL, left,
+                                  SPLICE_F_MOVE );
+
+                if ( ret <= 0 ) {
+                    if ( ret < 0 && errno == EINTR ) {
+                        ret = 0;
+                        continue;
+                    }
+
+                    pthread_rwlock_unlock( &store -> lock );
+                    if ( ret < 0 && errno != EAGAIN && !done ) {
+                        ufsErrno = UFS_UNKNOWN_ERROR;
+                        return -1;
+                    }
+
+                    ufsErrno = UFS_NO_ERROR;
+                    return done;
+                }
+            }
+        }
+    }
+
+    pthread_rwlock_unlock( &store -> lock );
+    ufsErrno = UFS_NO_ERROR;
+    return done;
+}
+
+bool ufsExtentRemove( ufsExtentStorePtr store, ufsIdType area,
+                      ufsIdType file )
+{
+    uint64_t numDropped;
+
+    if ( !store ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    pthread_rwlock_wrlock( &store -> lock );
+    numDropped = dropExtents( store -> img, store, area, file );
+    pthread_rwlock_unlock( &store -> lock );
+
+    ufsErrno = numDropped ? UFS_NO_ERROR : UFS_DOES_NOT_EXIST;
+    return numDropped != 0;
+}
+
+bool ufsExtentDrop( ufsImagePtr img, ufsIdType area, ufsIdType storage )
+{
+    struct ufsExtentStoreStruct *store;
+    uint64_t numDropped;
+
+    if ( !img || !ufsExtentHas( img ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    pthread_mutex_lock( &openStoresLock );
+    for ( store = openStores; store && store -> img != img;
+          store = store -> nextOpen )
+        ;
+
+    if ( store )
+        pthread_rwlock_wrlock( &store -> lock );
+    numDropped = dropExtents( img, store, area, storage );
+    if ( store )
+        pthread_rwlock_unlock( &store -> lock );
+    pthread_mutex_unlock( &openStoresLock );
+
+    if ( !numDropped ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return false;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+/* An area is named at its first extent in the chain of the file.             */
+bool ufsExtentIterate( ufsExtentStorePtr store, ufsExtentIter iter,
+                       void *userData )
+{
+    struct ufsExtentStruct *extent;
+    ufsIdType *heads, id, seen;
+    uint64_t i;
+
+    if ( !store || !iter ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    pthread_rwlock_rdlock( &store -> lock );
+    heads = ufsLayoutExtentHeads( store -> img );
+    for ( i = 0; i < ufsLayoutCapacity( store -> img, UFS_TYPES_FILE ); i++ ) {
+        for ( id = heads[i]; id; id = extent -> next ) {
+            extent = getExtent( store -> img, id );
+            for ( seen = heads[i];
+                  getExtent( store -> img, seen ) -> area != extent -> area;
+                  seen = getExtent( store -> img, seen ) -> next )
+                ;
+            if ( seen == id && !iter( extent -> area, i + 1, userData ) )
+                goto done;
+        }
+    }
+
+done:
+    pthread_rwlock_unlock( &store -> lock );
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsExtentGetStats( ufsExtentStorePtr store,
+                        struct ufsExtentStatsStruct *stats )
+{
+    struct ufsExtentStruct *extent;
+    ufsIdType *heads, id;
+    uint64_t i;
+
+    if ( !store || !stats ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    memset( stats, 0, sizeof( *stats ) );
+    pthread_rwlock_rdlock( &store -> lock );
+    stats -> numExtentFiles = store -> numFiles;
+    for ( i = 0; i < store -> numFiles; i++ )
+        stats -> fileBytes += store -> files[i].size;
+
+    heads = ufsLayoutExtentHeads( store -> img );
+    for ( i = 0; i < ufsLayoutCapacity( store -> img, UFS_TYPES_FILE ); i++ ) {
+        for ( id = heads[i]; id; id = extent -> next ) {
+            extent = getExtent( store -> img, id );
+            stats -> numExtents++;
+            stats -> allocatedBytes += extentSize( extent );
+            stats -> usedBytes += extent -> length;
+        }
+    }
+
+    stats -> grows = store -> grows;
+    pthread_rwlock_unlock( &store -> lock );
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+static inline struct ufsExtentStruct *getExtent( ufsImagePtr img,
+                                                 ufsIdType id )
+{
+    return &ufsLayoutExtents( img )[ id - 1 ];
+}
+
+static inline uint64_t extentSize( const struct ufsExtentStruct *extent )
+{
+    return (uint64_t)UFS_EXTENT_BLOCK << extent -> order;
+}
+
+/* Where the extent is in its extent file.                                    */
+static inline uint64_t extentStart( const struct ufsExtentStruct *extent )
+{
+    return extent -> block * UFS_EXTENT_BLOCK;
+}
+
+static ufsIdType allocExtent( ufsImagePtr img )
+{
+    struct ufsHeaderStruct *header;
+    ufsIdType id;
+
+    header = ufsLayoutHeader( img );
+    id = header -> freeLists[ UFS_TYPES_EXTENT ];
+    if ( id > 0 ) {
+        header -> freeLists[ UFS_TYPES_EXTENT ] = getExtent( img, id ) -> next;
+        header -> numFree[ UFS_TYPES_EXTENT ]--;
+        return id;
+    }
+
+    if ( header -> used[ UFS_TYPES_EXTENT ] >=
+         ufsLayoutCapacity( img, UFS_TYPES_EXTENT ) ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    return ++header -> used[ UFS_TYPES_EXTENT ];
+}
+
+static void freeExtent( ufsImagePtr img, ufsIdType id )
+{
+    struct ufsHeaderStruct *header;
+    struct ufsExtentStruct *extent;
+
+    header = ufsLayoutHeader( img );
+    extent = getExtent( img, id );
+    memset( extent, 0, sizeof( *extent ) );
+    extent -> next = header -> freeLists[ UFS_TYPES_EXTENT ];
+    header -> freeLists[ UFS_TYPES_EXTENT ] = id;
+    header -> numFree[ UFS_TYPES_EXTENT ]++;
+}
+
+/* Opens the extent files there are and claims the space of every extent      */
+/* reachable from a head. A crash can leave records that were allocated but   */
+/* never linked, the free list is made again from those that aren't reached.  */
+static bool rebuild( struct ufsExtentStoreStruct *store )
+{
+    char name[ ENTRY_NAME_SIZE ];
+    struct ufsHeaderStruct *header;
+    struct ufsExtentStruct *extent;
+    ufsIdType *heads, id;
+    uint8_t *reached;
+    uint64_t i;
+
+    for ( ;; ) {
+        snprintf( name, sizeof( name ), "%lu",
+                  (unsigned long) store -> numFiles );
+        if ( faccessat( store -> dirFd, name, F_OK, 0 ) )
+            break;
+        if ( !addFile( store ) )
+            return false;
+    }
+
+    header = ufsLayoutHeader( store -> img );
+    reached = calloc( header -> used[ UFS_TYPES_EXTENT ] + 1, 1 );
+    if ( !reached ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    heads = ufsLayoutExtentHeads( store -> img );
+    for ( i = 0; i < ufsLayoutCapacity( store -> img, UFS_TYPES_FILE ); i++ ) {
+        for ( id = heads[i]; id; id = extent -> next ) {
+            extent = getExtent( store -> img, id );
+            /* An extent file is made before anything is written to it.       */
+            if ( (uint64_t) id > header -> used[ UFS_TYPES_EXTENT ] ||
+                 reached[ id ] || extent -> order > MAX_ORDER ||
+                 extent -> extentFile >= store -> numFiles ||
+                 !claimBlock( &store -> files[ extent -> extentFile ],
+                              extent -> block, extent -> order ) ) {
+                free( reached );
+                ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+                return false;
+            }
+            reached[ id ] = 1;
+        }
+    }
+
+    header -> freeLists[ UFS_TYPES_EXTENT ] = 0;
+    header -> numFree[ UFS_TYPES_EXTENT ] = 0;
+    for ( id = header -> used[ UFS_TYPES_EXTENT ]; id > 0; id-- ) {
+        if ( !reached[ id ] )
+            freeExtent( store -> img, id );
+    }
+
+    free( reached );
+    return true;
+}
+
+/* Opens the next extent file, creating it empty, as one free extent.         */
+static bool addFile( struct ufsExtentStoreStruct *store )
+{
+    char name[ ENTRY_NAME_SIZE ];
+    struct extentFileStruct *files, *file;
+    struct stat st;
+    uint32_t order;
+
+    files = realloc( store -> files,
+                     sizeof( *files ) * ( store -> numFiles + 1 ) );
+    if ( !files ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    store -> files = files;
+    file = &files[ store -> numFiles ];
+    memset( file, 0, sizeof( *file ) );
+
+    snprintf( name, sizeof( name ), "%lu",
+              (unsigned long) store -> numFiles );
+    file -> fd = openat( store -> dirFd, name,
+                         O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+    if ( file -> fd < 0 || fstat( file -> fd, &st ) ) {
+        if ( file -> fd >= 0 )
+            close( file -> fd );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    file -> size = st.st_size;
+    file -> next = malloc( sizeof( int32_t ) * NUM_BLOCKS );
+    file -> prev = malloc( sizeof( int32_t ) * NUM_BLOCKS );
+    file -> free = calloc( NUM_BLOCKS, 1 );
+    if ( !file -> next || !file -> prev || !file -> free ) {
+        close( file -> fd );
+        free( file -> next );
+        free( file -> prev );
+        free( file -> free );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    for ( order = 0; order < UFS_EXTENT_ORDERS; order++ )
+        file -> freeLists[ order ] = -1;
+    pushFree( file, 0, MAX_ORDER );
+    store -> numFiles++;
+    return true;
+}
+
+static void pushFree( struct extentFileStruct *file, uint64_t block,
+                      uint32_t order )
+{
+    file -> free[ block ] = order + 1;
+    file -> prev[ block ] = -1;
+    file -> next[ block ] = file -> freeLists[ order ];
+    if ( file -> freeLists[ order ] >= 0 )
+        file -> prev[ file -> freeLists[ order ] ] = block;
+    file -> freeLists[ order ] = block;
+}
+
+static void unlinkFree( struct extentFileStruct *file, uint64_t block,
+                        uint32_t order )
+{
+    if ( file -> prev[ block ] >= 0 )
+        file -> next[ file -> prev[ block ] ] = file -> next[ block ];
+    else
+        file -> freeLists[ order ] = file -> next[ block ];
+
+    if ( file -> next[ block ] >= 0 )
+        file -> prev[ file -> next[ block ] ] = file -> prev[ block ];
+    file -> free[ block ] = 0;
+}
+
+/* Takes the extent at block out of the free extent holding it, splitting     */
+/* that down and freeing the halves it doesn't need. Fails when no free       */
+/* extent holds it, the space is taken already.                               */
+static bool claimBlock( struct extentFileStruct *file, uint64_t block,
+                        uint32_t order )
+{
+    uint64_t start, half;
+    uint32_t k;
+
+    if ( block % ( (uint64_t)1 << order ) || block >= NUM_BLOCKS )
+        return false;
+
+    for ( k = order; k <= MAX_ORDER; k++ ) {
+        start = block & ~( ( (uint64_t)1 << k ) - 1 );
+        if ( file -> free[ start ] == k + 1 )
+            break;
+    }
+
+    if ( k > MAX_ORDER )
+        return false;
+
+    unlinkFree( file, start, k );
+    while ( k > order ) {
+        k--;
+        half = (uint64_t)1 << k;
+        if ( block >= start + half ) {
+            pushFree( file, start, k );
+            start += half;
+        } else {
+            pushFree( file, start + half, k );
+        }
+    }
+
+    return true;
+}
+
+/* The first extent file with room gets it, in the smallest free extent that  */
+/* holds it, so the files fill in order and grow at their ends.               */
+static bool allocBlock( struct ufsExtentStoreStruct *store, uint32_t order,
+                        uint32_t *extentFile, uint64_t *block )
+{
+    struct extentFileStruct *file;
+    uint64_t i;
+    uint32_t k;
+    int32_t start;
+
+    for ( i = 0; ; i++ ) {
+        if ( i == store -> numFiles && !addFile( store ) )
+            return false;
+
+        file = &store -> files[i];
+        for ( k = order; k <= MAX_ORDER; k++ ) {
+            if ( file -> freeLists[k] >= 0 )
+                break;
+        }
+
+        if ( k <= MAX_ORDER )
+            break;
+    }
+
+    start = file -> freeLists[k];
+    unlinkFree( file, start, k );
+    while ( k > order ) {
+        k--;
+        pushFree( file, start + ( 1 << k ), k );
+    }
+
+    if ( !growFile( store, file,
+                    (uint64_t)( start + ( 1 << order ) ) *
+                        UFS_EXTENT_BLOCK ) ) {
+        freeBlock( file, start, order );
+        return false;
+    }
+
+    *extentFile = i;
+    *block = start;
+    return true;
+}
+
+/* Merges the extent with its buddy for as long as the buddy is free.         */
+static void freeBlock( struct extentFileStruct *file, uint64_t block,
+                       uint32_t order )
+{
+    uint64_t buddy;
+
+    for ( ; order < MAX_ORDER; order++ ) {
+        buddy = block ^ ( (uint64_t)1 << order );
+        if ( file -> free[ buddy ] != order + 1 )
+            break;
+        unlinkFree( file, buddy, order );
+        if ( buddy < block )
+            block = buddy;
+    }
+
+    pushFree( file, block, order );
+}
+
+/* Filesystems without fallocate get a sparse file instead.                   */
+static bool growFile( struct ufsExtentStoreStruct *store,
+                      struct extentFileStruct *file, uint64_t end )
+{
+    uint64_t size;
+
+    if ( end <= file -> size )
+        return true;
+
+    size = UFS_LAYOUT_ROUND( end, UFS_EXTENT_GROW );
+    if ( size > UFS_EXTENT_FILE_SIZE )
+        size = UFS_EXTENT_FILE_SIZE;
+
+    if ( fallocate( file -> fd, 0, file -> size, size - file -> size ) &&
+         ( errno != EOPNOTSUPP || ftruncate( file -> fd, size ) ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    file -> size = size;
+    store -> grows++;
+    return true;
+}
+
+static uint32_t orderFor( uint64_t length )
+{
+    uint32_t order;
+
+    for ( order = 0; order < MAX_ORDER &&
+          ( (uint64_t)UFS_EXTENT_BLOCK << order ) < length; order++ )
+        ;
+
+    return order;
+}
+
+/* The last extent of file in area starting at or before pos, 0 if there's    */
+/* none, and where the one after it starts, UINT64_MAX if there's none.       */
+static ufsIdType findCovering( ufsImagePtr img, ufsIdType area,
+                               ufsIdType file, uint64_t pos, uint64_t *next )
+{
+    struct ufsExtentStruct *extent;
+    ufsIdType id, found;
+
+    found = 0;
+    *next = UINT64_MAX;
+    for ( id = ufsLayoutExtentHeads( img )[ file - 1 ]; id;
+          id = extent -> next ) {
+        extent = getExtent( img, id );
+        if ( extent -> area != area )
+            continue;
+
+        if ( extent -> offset > pos ) {
+            *next = extent -> offset;
+            break;
+        }
+        found = id;
+    }
+
+    return found;
+}
+
+/* Keeps the chain of the file ordered by offset.                             */
+static void linkExtent( ufsImagePtr img, ufsIdType file, ufsIdType id )
+{
+    struct ufsExtentStruct *extent;
+    ufsIdType *link;
+
+    extent = getExtent( img, id );
+    for ( link = &ufsLayoutExtentHeads( img )[ file - 1 ];
+          *link && getExtent( img, *link ) -> offset < extent -> offset;
+          link = &getExtent( img, *link ) -> next )
+        ;
+
+    extent -> next = *link;
+    *link = id;
+}
+
+/* The data is in place before the record is linked.                          */
+static bool newExtent( struct ufsExtentStoreStruct *store, ufsIdType area,
+                       ufsIdType file, uint32_t order, const uint8_t *buf,
+                       uint64_t len, uint64_t off )
+{
+    struct ufsExtentStruct *extent;
+    uint32_t extentFile;
+    uint64_t block;
+    ufsIdType id;
+
+    id = allocExtent( store -> img );
+    if ( id < 0 )
+        return false;
+
+    if ( !allocBlock( store, order, &extentFile, &block ) ) {
+        freeExtent( store -> img, id );
+        return false;
+    }
+
+    extent = getExtent( store -> img, id );
+    extent -> extentFile = extentFile;
+    extent -> block = block;
+    extent -> order = order;
+    if ( !writeAll( store -> files[ extentFile ].fd, buf, len,
+                    extentStart( extent ) ) ) {
+        freeBlock( &store -> files[ extentFile ], block, order );
+        freeExtent( store -> img, id );
+        return false;
+    }
+
+    extent -> area = area;
+    extent -> offset = off;
+    extent -> length = len;
+    linkExtent( store -> img, file, id );
+    return true;
+}
+
+/* Unlinks the extents of file in area, freeing their space when there's a    */
+/* store.                                                                     */
+static uint64_t dropExtents( ufsImagePtr img,
+                             struct ufsExtentStoreStruct *store,
+                             ufsIdType area, ufsIdType file )
+{
+    struct ufsExtentStruct *extent;
+    ufsIdType *link, id;
+    uint64_t numDropped;
+
+    if ( area <= 0 || file <= 0 ||
+         (uint64_t) file > ufsLayoutCapacity( img, UFS_TYPES_FILE ) )
+        return 0;
+
+    numDropped = 0;
+    link = &ufsLayoutExtentHeads( img )[ file - 1 ];
+    while ( *link ) {
+        id = *link;
+        extent = getExtent( img, id );
+        if ( extent -> area != area ) {
+            link = &extent -> next;
+            continue;
+        }
+
+        *link = extent -> next;
+        if ( store )
+            freeBlock( &store -> files[ extent -> extentFile ],
+                       extent -> block, extent -> order );
+        freeExtent( img, id );
+        numDropped++;
+    }
+
+    return numDropped;
+}
+
+static uint64_t dataEnd( ufsImagePtr img, ufsIdType area, ufsIdType file )
+{
+    struct ufsExtentStruct *extent;
+    uint64_t end;
+    ufsIdType id;
+
+    if ( area <= 0 || file <= 0 ||
+         (uint64_t) file > ufsLayoutCapacity( img, UFS_TYPES_FILE ) )
+        return 0;
+
+    end = 0;
+    for ( id = ufsLayoutExtentHeads( img )[ file - 1 ]; id;
+          id = extent -> next ) {
+        extent = getExtent( img, id );
+        if ( extent -> area == area )
+            end = extent -> offset + extent -> length;
+    }
+
+    return end;
+}
+
+/* Bytes of an extent past those written and gaps between extents are holes.  */
+static uint64_t mapExtents( struct ufsExtentStoreStruct *store,
+                            ufsIdType area, ufsIdType file, uint64_t offset,
+                            uint64_t length,
+                            struct ufsExtentSegmentStruct *segments,
+                            uint64_t maxSegments )
+{
+    struct ufsExtentStruct *extent;
+    uint64_t pos, end, n, written;
+    ufsIdType id;
+
+    end = dataEnd( store -> img, area, file );
+    if ( offset >= end )
+        return 0;
+    if ( length < end - offset )
+        end = offset + length;
+
+    n = 0;
+    pos = offset;
+    for ( id = ufsLayoutExtentHeads( store -> img )[ file - 1 ];
+          id && pos < end && n < maxSegments; id = extent -> next ) {
+        extent = getExtent( store -> img, id );
+        written = extent -> offset + extent -> length;
+        if ( extent -> area != area || written <= pos )
+            continue;
+
+        if ( extent -> offset > pos ) {
+            segments[n].fd = -1;
+            segments[n].offset = 0;
+            segments[n].length = ( extent -> offset < end ?
+                                   extent -> offset : end ) - pos;
+            pos += segments[n++].length;
+            if ( pos >= end || n == maxSegments )
+                break;
+        }
+
+        segments[n].fd = store -> files[ extent -> extentFile ].fd;
+        segments[n].offset = extentStart( extent ) + pos - extent -> offset;
+        segments[n].length = ( written < end ? written : end ) - pos;
+        pos += segments[n++].length;
+    }
+
+    return n;
+}
+
+static bool writeAll( int fd, const void *buf, uint64_t len, uint64_t off )
+{
+    ssize_t ret;
+
+    while ( len ) {
+        ret = pwrite( fd, buf, len, off );
+        if ( ret < 0 && errno == EINTR )
+            continue;
+        if ( ret <= 0 ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            return false;
+        }
+
+        buf = (const uint8_t*)buf + ret;
+        len -= ret;
+        off += ret;
+    }
+
+    return true;
+}
+
+/* The extents never reach past the end of their file.                        */
+static bool readAll( int fd, void *buf, uint64_t len, uint64_t off )
+{
+    ssize_t ret;
+
+    while ( len ) {
+        ret = pread( fd, buf, len, off );
+        if ( ret < 0 && errno == EINTR )
+            continue;
+        if ( ret <= 0 )
+            return false;
+
+        buf = (uint8_t*)buf + ret;
+        len -= ret;
+        off += ret;
+    }
+
+    return true;
+}
+
+static bool checkFile( ufsImagePtr img, ufsIdType area, ufsIdType file )
+{
+    if ( !ufsStoreHasArea( img, area ) ) {
+        ufsErrno = UFS_AREA_DOES_NOT_EXIST;
+        return false;
+    }
+
+    if ( !ufsStoreHasStorage( img, file ) ||
+         ufsStoreIsDirectory( img, file ) ) {
+        ufsErrno = UFS_FILE_DOES_NOT_EXIST;
+        return false;
+    }
+
+    return true;
+}
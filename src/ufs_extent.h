@@ -0,0 +1,371 @@
+/******************************************************************************\
+*  ufs_extent.h                                                                *
+*                                                                              *
+*  Internal header for the store packing file data into extent files.          *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* An extent store keeps the data of files that live only in an area inside   */
+/* a few large extent files instead of a file each, so writing a new file     */
+/* touches no metadata of the external fs. Under the root of the store the    */
+/* extent files are '0', '1', ..., each UFS_EXTENT_FILE_SIZE bytes at most.   */
+/* An extent file only grows, by UFS_EXTENT_GROW at a time with fallocate,    */
+/* so the external fs sees few large appends.                                 */
+/*                                                                            */
+/* Space is handed out by a buddy allocator, an extent is 1 << order blocks   */
+/* of UFS_EXTENT_BLOCK bytes at a multiple of its size, freeing one merges it */
+/* with its buddy when that's free too. A file gets an extent of the smallest */
+/* order that holds what's written past its end, writes that follow go in     */
+/* the same extent until it's full.                                           */
+/*                                                                            */
+/* The extents of a file are records of the extent section of the image,      */
+/* chained by offset from a head that lines up with the file record, see      */
+/* ufs_layout.h. Nothing else is kept, the allocator is rebuilt from the      */
+/* records when the store is opened. An extent is written before its record   */
+/* is linked, so after a crash the records name data that was written and     */
+/* space that wasn't recorded is free again. Writing over data that's there   */
+/* is done in place. The mapping of a new file is added once all of its data  */
+/* is written.                                                                */
+/*                                                                            */
+/* Removing a mapping, its storage or its area drops the extents, the store   */
+/* open on the image gets their space back at once. With none open it's       */
+/* reused once a store is opened. Sealed images, snapshots and replication    */
+/* streams don't carry the extent section. A store belongs to one image and   */
+/* one process.                                                               */
+
+#ifndef UFS_EXTENT_H
+#define UFS_EXTENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs_defs.h"
+#include "ufs_image.h"
+
+#define UFS_EXTENT_BLOCK (4096)
+#define UFS_EXTENT_ORDERS (17)
+/* An extent file is a single extent of the largest order.                    */
+#define UFS_EXTENT_FILE_SIZE \
+    ( (uint64_t)UFS_EXTENT_BLOCK << ( UFS_EXTENT_ORDERS - 1 ) )
+#define UFS_EXTENT_GROW ( 16 << 20 )
+
+typedef struct ufsExtentStoreStruct *ufsExtentStorePtr;
+
+/* Return false to stop the iteration.                                        */
+typedef bool (*ufsExtentIter)( ufsIdType area, ufsIdType file,
+                               void *userData );
+
+/* A piece of a file read from fd at offset, fd is -1 for a hole that reads   */
+/* as zeros.                                                                  */
+struct ufsExtentSegmentStruct {
+    int fd;
+    uint64_t offset,
+             length;
+};
+
+struct ufsExtentStatsStruct {
+    /* Extent files and the bytes fallocated for them.                        */
+    uint64_t numExtentFiles,
+             fileBytes;
+    /* Extents recorded, the bytes they take and those written to them.       */
+    uint64_t numExtents,
+             allocatedBytes,
+             usedBytes;
+    /* Calls to fallocate since the store was opened.                         */
+    uint64_t grows;
+};
+
+/******************************************************************************\
+* ufsExtentHas                                                                 *
+*                                                                              *
+*  Checks whether img has an extent section that can be written.               *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: A validated image, not NULL.                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if it does, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsExtentHas( ufsImagePtr img );
+
+/******************************************************************************\
+* ufsExtentOpen                                                                *
+*                                                                              *
+*  Opens the store under path for img, creating it if it doesn't exist, and    *
+*  rebuilds its allocator from the extents img records.                        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: path or img are NULL or img has no extent section.           *
+*   UFS_DOES_NOT_EXIST: path can't be created or isn't a directory.            *
+*   UFS_IMAGE_IS_CORRUPTED: Extents of img overlap or name no extent file.     *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: An extent file couldn't be opened.                      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -path: The root of the store, usually UFS_EXTENT_DIR.                       *
+*  -img: The image holding the extents, must outlive the store.                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsExtentStorePtr: The store, NULL on error.                               *
+*                                                                              *
+\******************************************************************************/
+ufsExtentStorePtr ufsExtentOpen( const char *path, ufsImagePtr img );
+
+/******************************************************************************\
+* ufsExtentClose                                                               *
+*                                                                              *
+*  Closes a store, what it holds stays on disk.                                *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store, may be NULL.                                             *
+*                                                                              *
+\******************************************************************************/
+void ufsExtentClose( ufsExtentStorePtr store );
+
+/******************************************************************************\
+* ufsExtentWrite                                                               *
+*                                                                              *
+*  Writes len bytes of buf at off of the data of file in area, adding the      *
+*  mapping ( area, file ) once the data is written if it doesn't exist. What's *
+*  between the end of the data and off reads as zeros. A new file that fails   *
+*  is left unmapped without data.                                              *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsStoreAddMapping but UFS_MAPPING_ALREADY_EXISTS.                *
+*   UFS_BAD_CALL: store is NULL or buf is NULL and len isn't 0.                *
+*   UFS_AREA_DOES_NOT_EXIST: area doesn't exist.                               *
+*   UFS_FILE_DOES_NOT_EXIST: file doesn't exist or is a directory.             *
+*   UFS_OUT_OF_MEMORY: The image has no free extent record or the system is    *
+*                      out of memory.                                          *
+*   UFS_UNKNOWN_ERROR: The data couldn't be written, some of it may be.        *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*  -buf: What to write.                                                        *
+*  -len: The number of bytes to write.                                         *
+*  -off: Where in the data to write to.                                        *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsExtentWrite( ufsExtentStorePtr store, ufsIdType area, ufsIdType file,
+                     const void *buf, uint64_t len, uint64_t off );
+
+/******************************************************************************\
+* ufsExtentGetSize                                                             *
+*                                                                              *
+*  Gets the size of the data of file in area, the end of its last extent.      *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store is NULL.                                               *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int64_t: The size, 0 for a file with no extents, -1 on error.              *
+*                                                                              *
+\******************************************************************************/
+int64_t ufsExtentGetSize( ufsExtentStorePtr store, ufsIdType area,
+                          ufsIdType file );
+
+/******************************************************************************\
+* ufsExtentMap                                                                 *
+*                                                                              *
+*  Tells where to read [ offset, offset + length ) of the data of file in      *
+*  area from, in order. The segments suit splice or copy_file_range as they    *
+*  are. Nothing past the end of the data is mapped, nor past maxSegments, the  *
+*  caller maps the rest with another call.                                     *
+*  The segments stay valid until the data is next written or removed.          *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store, segments or numSegments are NULL or maxSegments is 0. *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*  -offset: Where to start.                                                    *
+*  -length: How many bytes to map.                                             *
+*  -segments: Filled with the segments.                                        *
+*  -maxSegments: The number of entries in segments.                            *
+*  -numSegments: Set to the number of segments filled.                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsExtentMap( ufsExtentStorePtr store, ufsIdType area, ufsIdType file,
+                   uint64_t offset, uint64_t length,
+                   struct ufsExtentSegmentStruct *segments,
+                   uint64_t maxSegments, uint64_t *numSegments );
+
+/******************************************************************************\
+* ufsExtentRead                                                                *
+*                                                                              *
+*  Reads up to len bytes at off of the data of file in area into buf.          *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store or buf are NULL.                                       *
+*   UFS_UNKNOWN_ERROR: The data couldn't be read.                              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*  -buf: Filled with what's read.                                              *
+*  -len: The number of bytes to read.                                          *
+*  -off: Where in the data to read from.                                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int64_t: The number of bytes read, less than len at the end of the data,   *
+*            -1 on error.                                                      *
+*                                                                              *
+\******************************************************************************/
+int64_t ufsExtentRead( ufsExtentStorePtr store, ufsIdType area, ufsIdType file,
+                       void *buf, uint64_t len, uint64_t off );
+
+/******************************************************************************\
+* ufsExtentSplice                                                              *
+*                                                                              *
+*  Moves up to len bytes at off of the data of file in area into the pipe      *
+*  pipeFd, splicing them from the extent files without a copy through user     *
+*  memory. Holes are written as zeros. It blocks while the pipe is full        *
+*  unless pipeFd is non-blocking, in which case it stops there.                *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store is NULL or pipeFd is negative.                         *
+*   UFS_UNKNOWN_ERROR: The data couldn't be spliced, pipeFd isn't a pipe.      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*  -pipeFd: The write end of a pipe.                                           *
+*  -len: The number of bytes to move.                                          *
+*  -off: Where in the data to move from.                                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int64_t: The number of bytes moved, less than len at the end of the data   *
+*            or of the room in a non-blocking pipe, -1 on error.               *
+*                                                                              *
+\******************************************************************************/
+int64_t ufsExtentSplice( ufsExtentStorePtr store, ufsIdType area,
+                         ufsIdType file, int pipeFd, uint64_t len,
+                         uint64_t off );
+
+/******************************************************************************\
+* ufsExtentRemove                                                              *
+*                                                                              *
+*  Removes the data of file in area and frees its extents, the mapping is      *
+*  kept.                                                                       *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store is NULL.                                               *
+*   UFS_DOES_NOT_EXIST: file has no extents in area.                           *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -area: The identifier of the area.                                          *
+*  -file: The identifier of the file.                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsExtentRemove( ufsExtentStorePtr store, ufsIdType area,
+                      ufsIdType file );
+
+/******************************************************************************\
+* ufsExtentDrop                                                                *
+*                                                                              *
+*  Drops the extent records of storage in area from img. Their space goes back *
+*  to the store open on img, with none it's free again once one is opened.     *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL or has no extent section.                        *
+*   UFS_DOES_NOT_EXIST: storage has no extents in area.                        *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: The image.                                                            *
+*  -area: The identifier of the area.                                          *
+*  -storage: The identifier of the file.                                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsExtentDrop( ufsImagePtr img, ufsIdType area, ufsIdType storage );
+
+/******************************************************************************\
+* ufsExtentIterate                                                             *
+*                                                                              *
+*  Calls iter once for every file with extents in an area, with the area.      *
+*  The extents must not change from within iter.                               *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store or iter are NULL.                                      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -iter: The iterator.                                                        *
+*  -userData: Passed to iter as is.                                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsExtentIterate( ufsExtentStorePtr store, ufsExtentIter iter,
+                       void *userData );
+
+/******************************************************************************\
+* ufsExtentGetStats                                                            *
+*                                                                              *
+*  Gets the statistics of store, walking every extent.                         *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: store or stats are NULL.                                     *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -store: The store.                                                          *
+*  -stats: Filled with the statistics.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsExtentGetStats( ufsExtentStorePtr store,
+                        struct ufsExtentStatsStruct *stats );
+
+#endif /* UFS_EXTENT_H */
@@ -0,0 +1,101 @@
+/******************************************************************************\
+*  ufs_hash.h                                                                  *
+*                                                                              *
+*  Internal hashing helpers shared by the ufs indices.                         *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_HASH_H
+#define UFS_HASH_H
+
+#include <stdint.h>
+
+#define UFS_HASH_FNV_OFFSET (0xcbf29ce484222325ULL)
+#define UFS_HASH_FNV_PRIME (0x100000001b3ULL)
+
+/******************************************************************************\
+* ufsHashMix                                                                   *
+*                                                                              *
+*  Finalizes a 64 bit value so that every input bit affects every output bit.  *
+*  This is the splitmix64 finalizer.                                           *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -x: The value to mix.                                                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The mixed value.                                                 *
+*                                                                              *
+\******************************************************************************/
+static inline uint64_t ufsHashMix( uint64_t x )
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+    x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebULL;
+    return x ^ ( x >> 31 );
+}
+
+/******************************************************************************\
+* ufsHashString                                                                *
+*                                                                              *
+*  Hashes a NUL terminated string together with a seed.                        *
+*  The seed is used to place the same name under different parents apart.      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -str: The string to hash, must not be NULL.                                 *
+*  -seed: The seed of the hash.                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The hash of str.                                                 *
+*                                                                              *
+\******************************************************************************/
+static inline uint64_t ufsHashString( const char *str, uint64_t seed )
+{
+    uint64_t
+        hash = UFS_HASH_FNV_OFFSET ^ ufsHashMix( seed );
+
+    while ( *str ) {
+        hash ^= (uint8_t)*str++;
+        hash *= UFS_HASH_FNV_PRIME;
+    }
+
+    return ufsHashMix( hash );
+}
+
+/******************************************************************************\
+* ufsHashBytes                                                                 *
+*                                                                              *
+*  Hashes len bytes together with a seed.                                      *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -data: The bytes to hash, may be NULL when len is 0.                        *
+*  -len: The number of bytes.                                                  *
+*  -seed: The seed of the hash.                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The hash of data.                                                *
+*                                                                              *
+\******************************************************************************/
+static inline uint64_t ufsHashBytes( const void *data, uint64_t len,
+                                     uint64_t seed )
+{
+    const uint8_t *bytes = data;
+    uint64_t
+        hash = UFS_HASH_FNV_OFFSET ^ ufsHashMix( seed );
+
+    while ( len-- ) {
+        hash ^= *bytes++;
+        hash *= UFS_HASH_FNV_PRIME;
+    }
+
+    return ufsHashMix( hash );
+}
+
+#endif /* UFS_HASH_H */
@@ -11,10 +11,28 @@
 #include "ufs_header.h"
 #include "ufs_defs.h"
 #include "ufs_image.h"
+#include "ufs_layout.h"
+#include "ufs_scan.h"
+#include "ufs_seal.h"
 #include <stdint.h>
+#include <string.h>
+#include <sys/random.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef UFS_FIXED_LAYOUT
+
+/* A fixed layout build can only ever create images of its own layout.       */
+struct ufsHeaderSizeRequestStruct ufsDefaultSizeRequest = {
+    .numFiles = UFS_FIXED_NUM_FILES,
+    .numAreas = UFS_FIXED_NUM_AREAS,
+    .numNodes = UFS_FIXED_NUM_NODES,
+    .numStrBytes = UFS_FIXED_NUM_STR_BYTES
+};
+
+#else
+
 struct ufsHeaderSizeRequestStruct ufsDefaultSizeRequest = {
     .numFiles = 256,
     .numAreas = 256,
@@ -22,17 +40,23 @@ struct ufsHeaderSizeRequestStruct ufsDefaultSizeRequest = {
     .numStrBytes = 1024
 };
 
+#endif /* UFS_FIXED_LAYOUT */
+
 static inline uint64_t resolveSize( struct ufsHeaderSizeRequestStruct sizes );
-static inline uint64_t roundToBoundary( uint64_t val, uint64_t align );
+static inline bool matchesFixedLayout( struct ufsHeaderSizeRequestStruct sizes );
 static inline ufsImagePtr mountHeader( ufsImagePtr img,
         struct ufsHeaderSizeRequestStruct sizes );
+static inline uint64_t grow( uint64_t count, uint64_t growthPercent,
+                             uint64_t least );
+static bool countEntries( const struct ufsScanEntryStruct *entries,
+                          uint64_t numEntries, void *userData );
 
 ufsImagePtr ufsHeaderInit( const char *path,
                            struct ufsHeaderSizeRequestStruct sizes )
 {
     ufsImagePtr ret;
     if (!path || !sizes.numFiles || !sizes.numAreas || !sizes.numNodes || 
-            !sizes.numStrBytes ) {
+            !sizes.numStrBytes || !matchesFixedLayout( sizes ) ) {
         ufsErrno = UFS_BAD_CALL;
         return NULL;
     }
@@ -52,6 +76,79 @@ ufsImagePtr ufsHeaderInit( const char *path,
     return ufsHeaderValidate( mountHeader( ret, sizes ) );
 }
 
+bool ufsHeaderSizeFor( struct ufsHeaderWorkloadStruct workload,
+                       uint64_t growthPercent,
+                       struct ufsHeaderSizeRequestStruct *sizes )
+{
+    struct ufsHeaderSizeRequestStruct
+        request = { 0 };
+    uint64_t keys, height, reach;
+
+    if ( !sizes ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    /* Every file and area has a name key, every mapping one key in each of   */
+    /* the mapping indices. Nodes other than the roots hold at least          */
+    /* UFS_NODE_MIN_DEGREE - 1 keys and one in UFS_NODE_MIN_DEGREE of them is */
+    /* an inner node, deleting while a snapshot is kept copies up to two      */
+    /* nodes per level and may add one.                                       */
+    keys = workload.numFiles + workload.numAreas + 2 * workload.numMappings;
+    for ( height = 1, reach = UFS_NODE_MAX_KEYS; reach < keys && height < 64;
+          height++ )
+        reach *= UFS_NODE_MIN_DEGREE;
+
+    request.numFiles = grow( workload.numFiles, growthPercent,
+                             ufsDefaultSizeRequest.numFiles );
+    request.numAreas = grow( workload.numAreas, growthPercent,
+                             ufsDefaultSizeRequest.numAreas );
+    /* A name and its NUL are rounded up to UFS_STRING_GRANULE bytes.         */
+    request.numStrBytes = grow( workload.numNameBytes + UFS_STRING_GRANULE *
+                                ( workload.numFiles + workload.numAreas ),
+                                growthPercent,
+                                ufsDefaultSizeRequest.numStrBytes );
+    request.numNodes = grow( keys / ( UFS_NODE_MIN_DEGREE - 1 ) *
+                             UFS_NODE_MIN_DEGREE / ( UFS_NODE_MIN_DEGREE - 1 ) +
+                             UFS_INDEX_COUNT * 2 * ( height + 2 ),
+                             growthPercent, ufsDefaultSizeRequest.numNodes );
+
+    if ( !matchesFixedLayout( request ) ) {
+        if ( request.numFiles > ufsDefaultSizeRequest.numFiles ||
+             request.numAreas > ufsDefaultSizeRequest.numAreas ||
+             request.numNodes > ufsDefaultSizeRequest.numNodes ||
+             request.numStrBytes > ufsDefaultSizeRequest.numStrBytes ) {
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return false;
+        }
+        request = ufsDefaultSizeRequest;
+    }
+
+    *sizes = request;
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsHeaderEstimateSizes( const char *root, uint64_t growthPercent,
+                             struct ufsHeaderSizeRequestStruct *sizes )
+{
+    struct ufsHeaderWorkloadStruct workload = { 0 };
+    struct ufsScanOptionsStruct options = { 0 };
+
+    if ( !sizes ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !ufsScan( root, options, countEntries, &workload, NULL ) )
+        return false;
+
+    /* The root itself is loaded as a directory too.                          */
+    workload.numFiles++;
+    return ufsHeaderSizeFor( workload, growthPercent ? growthPercent :
+                                       UFS_HEADER_GROWTH_PERCENT, sizes );
+}
+
 ufsImagePtr ufsHeaderValidate( ufsImagePtr img )
 {
     if (!img) {
@@ -63,9 +160,7 @@ ufsImagePtr ufsHeaderValidate( ufsImagePtr img )
     struct ufsHeaderStruct
         *header = ufsHeaderGet( img );
     uint64_t size, expectedSize,
-        minSize = roundToBoundary( sizeof( uint64_t ),
-                _Alignof( struct ufsHeaderStruct ) ) +
-                 sizeof( struct ufsHeaderStruct );
+        minSize = UFS_LAYOUT_HEADER_OFFSET + sizeof( struct ufsHeaderStruct );
 
     size = *(uint64_t*)img;
 
@@ -89,10 +184,32 @@ ufsImagePtr ufsHeaderValidate( ufsImagePtr img )
         return NULL;
     }
 
+    /* Sealed images are packed, they do not follow the mutable layout.      */
+    if ( header -> flags & UFS_HEADER_FLAG_SEALED )
+        return ufsSealValidate( img );
+
     sizes.numFiles = header -> sizes[ UFS_TYPES_FILE ];
     sizes.numAreas = header -> sizes[ UFS_TYPES_AREA ];
     sizes.numNodes = header -> sizes[ UFS_TYPES_NODE ];
     sizes.numStrBytes = header -> sizes[ UFS_TYPES_STRING ];
+    sizes.baseIndex = header -> sizes[ UFS_TYPES_BASE ] != 0;
+    sizes.numDataBytes = header -> sizes[ UFS_TYPES_DATA ];
+    sizes.numExtents = header -> sizes[ UFS_TYPES_EXTENT ];
+
+    /* A BASE index has a record for every file.                            */
+    if ( sizes.baseIndex &&
+         header -> sizes[ UFS_TYPES_BASE ] != sizes.numFiles ) {
+        ufsImageFree( img );
+        ufsErrno = UFS_IMAGE_BAD_SIZE;
+        return NULL;
+    }
+
+    /* The accessors of a fixed layout build never look at the header.      */
+    if ( !matchesFixedLayout( sizes ) ) {
+        ufsImageFree( img );
+        ufsErrno = UFS_IMAGE_BAD_SIZE;
+        return NULL;
+    }
 
     expectedSize = resolveSize( sizes );
 
@@ -114,44 +231,61 @@ struct ufsHeaderStruct *ufsHeaderGet( ufsImagePtr img )
         return NULL;
     }
     ufsErrno = UFS_NO_ERROR;
-    return (struct ufsHeaderStruct*)((uint8_t*)img +
-            roundToBoundary( sizeof( uint64_t ), _Alignof(struct ufsHeaderStruct)));
+    return ufsLayoutHeader( img );
 }
 
 static inline ufsImagePtr mountHeader( ufsImagePtr img,
                         struct ufsHeaderSizeRequestStruct sizes )
 {
-    uint64_t offset;
     struct ufsHeaderStruct
         *header = ufsHeaderGet( img );
 
     header -> magicNumber = UFS_MAGIC_NUMBER;
     header -> version = UFS_VERSION;
 
+    /* Only needs to tell images apart, a weak fallback will do.             */
+    if ( getrandom( &header -> uuid, sizeof( header -> uuid ), 0 ) !=
+         sizeof( header -> uuid ) )
+        header -> uuid = (uint64_t)time( NULL ) ^ ( (uint64_t)getpid() << 32 );
+
     header -> sizes[ UFS_TYPES_FILE ] = sizes.numFiles;
     header -> sizes[ UFS_TYPES_AREA ] = sizes.numAreas;
     header -> sizes[ UFS_TYPES_NODE ] = sizes.numNodes;
     header -> sizes[ UFS_TYPES_STRING ] = sizes.numStrBytes;
 
-    offset = sizeof( uint64_t );
-    offset = roundToBoundary( offset, _Alignof( struct ufsHeaderStruct ) );
-    offset += sizeof( struct ufsHeaderStruct );
-
-
-    offset = roundToBoundary( offset, _Alignof( struct ufsFileStruct ) );
-    header -> offsets[ UFS_TYPES_FILE ] = offset;
-    offset += sizeof( struct ufsFileStruct ) * sizes.numFiles;
-
-    offset = roundToBoundary( offset, _Alignof( struct ufsAreaStruct ) );
-    header -> offsets[ UFS_TYPES_AREA ] = offset;
-    offset += sizeof( struct ufsAreaStruct ) * sizes.numAreas;
+    header -> offsets[ UFS_TYPES_FILE ] = UFS_LAYOUT_FILE_OFFSET;
+    header -> offsets[ UFS_TYPES_AREA ] =
+        UFS_LAYOUT_AREA_OFFSET( sizes.numFiles );
+    header -> offsets[ UFS_TYPES_NODE ] =
+        UFS_LAYOUT_NODE_OFFSET( sizes.numFiles, sizes.numAreas );
+    header -> offsets[ UFS_TYPES_STRING ] =
+        UFS_LAYOUT_STRING_OFFSET( sizes.numFiles, sizes.numAreas,
+                                  sizes.numNodes );
+
+    if ( sizes.baseIndex ) {
+        header -> sizes[ UFS_TYPES_BASE ] = sizes.numFiles;
+        header -> offsets[ UFS_TYPES_BASE ] =
+            UFS_LAYOUT_BASE_OFFSET( sizes.numFiles, sizes.numAreas,
+                                    sizes.numNodes, sizes.numStrBytes );
+    }
 
-    offset = roundToBoundary( offset, _Alignof( struct ufsNodeStruct ) );
-    header -> offsets[ UFS_TYPES_NODE ] = offset;
-    offset += sizeof( struct ufsNodeStruct ) * sizes.numNodes;
+    /* The image is created zeroed, so are the heads and the slots.          */
+    if ( sizes.numDataBytes ) {
+        header -> sizes[ UFS_TYPES_DATA ] = sizes.numDataBytes;
+        header -> offsets[ UFS_TYPES_DATA ] =
+            UFS_LAYOUT_DATA_OFFSET( sizes.numFiles, sizes.numAreas,
+                                    sizes.numNodes, sizes.numStrBytes,
+                                    header -> sizes[ UFS_TYPES_BASE ] );
+    }
 
-    offset = roundToBoundary( offset, _Alignof( char ) );
-    header -> offsets[ UFS_TYPES_STRING ] = offset;
+    if ( sizes.numExtents ) {
+        header -> sizes[ UFS_TYPES_EXTENT ] = sizes.numExtents;
+        header -> offsets[ UFS_TYPES_EXTENT ] =
+            UFS_LAYOUT_EXTENT_OFFSET( sizes.numFiles, sizes.numAreas,
+                                      sizes.numNodes, sizes.numStrBytes,
+                                      header -> sizes[ UFS_TYPES_BASE ],
+                                      sizes.numDataBytes );
+    }
 
     ufsImageSync( img );
 
@@ -161,30 +295,77 @@ static inline ufsImagePtr mountHeader( ufsImagePtr img,
 static inline uint64_t resolveSize( struct ufsHeaderSizeRequestStruct sizes )
 {
     uint64_t
-        pageSize = sysconf( _SC_PAGESIZE  ),
-        size = sizeof( uint64_t );
-
-    size = roundToBoundary( size, _Alignof( struct ufsHeaderStruct ) );
-    size += sizeof( struct ufsHeaderStruct );
-
-    size = roundToBoundary( size, _Alignof( struct ufsFileStruct ) );
-    size += sizeof( struct ufsFileStruct ) * sizes.numFiles;
-
-    size = roundToBoundary( size, _Alignof( struct ufsAreaStruct ) );
-    size += sizeof( struct ufsAreaStruct ) * sizes.numAreas;
+        pageSize = sysconf( _SC_PAGESIZE  );
+
+    if ( sizes.numExtents )
+        return UFS_LAYOUT_ROUND( UFS_LAYOUT_EXTENT_OFFSET( sizes.numFiles,
+                                     sizes.numAreas, sizes.numNodes,
+                                     sizes.numStrBytes,
+                                     sizes.baseIndex ? sizes.numFiles : 0,
+                                     sizes.numDataBytes ) +
+                                 UFS_LAYOUT_EXTENT_SIZE( sizes.numFiles,
+                                                         sizes.numExtents ),
+                                 pageSize );
+
+    if ( sizes.numDataBytes )
+        return UFS_LAYOUT_ROUND( UFS_LAYOUT_DATA_OFFSET( sizes.numFiles,
+                                     sizes.numAreas, sizes.numNodes,
+                                     sizes.numStrBytes,
+                                     sizes.baseIndex ? sizes.numFiles : 0 ) +
+                                 UFS_LAYOUT_DATA_SIZE( sizes.numFiles,
+                                                       sizes.numDataBytes ),
+                                 pageSize );
+
+    if ( sizes.baseIndex )
+        return UFS_LAYOUT_ROUND( UFS_LAYOUT_BASE_END( sizes.numFiles,
+                                                      sizes.numAreas,
+                                                      sizes.numNodes,
+                                                      sizes.numStrBytes ),
+                                 pageSize );
+
+    return UFS_LAYOUT_ROUND( UFS_LAYOUT_END( sizes.numFiles, sizes.numAreas,
+                                             sizes.numNodes,
+                                             sizes.numStrBytes ),
+                             pageSize );
+}
 
-    size = roundToBoundary( size, _Alignof( struct ufsNodeStruct ) );
-    size += sizeof( struct ufsNodeStruct ) * sizes.numNodes;
+static inline bool matchesFixedLayout( struct ufsHeaderSizeRequestStruct sizes )
+{
+#ifdef UFS_FIXED_LAYOUT
+    return sizes.numFiles == UFS_FIXED_NUM_FILES &&
+           sizes.numAreas == UFS_FIXED_NUM_AREAS &&
+           sizes.numNodes == UFS_FIXED_NUM_NODES &&
+           sizes.numStrBytes == UFS_FIXED_NUM_STR_BYTES;
+#else
+    (void)sizes;
+    return true;
+#endif /* UFS_FIXED_LAYOUT */
+}
 
-    size = roundToBoundary( size, _Alignof( char ) );
-    size += sizeof( char ) * sizes.numStrBytes;
+/* Saturates, an image that large can't be created anyway.                    */
+static inline uint64_t grow( uint64_t count, uint64_t growthPercent,
+                             uint64_t least )
+{
+    uint64_t grown;
 
-    size = roundToBoundary( size, pageSize );
+    if ( growthPercent > UINT64_MAX - 100 ||
+         ( count && UINT64_MAX / count < 100 + growthPercent ) )
+        return UINT64_MAX;
 
-    return size;
+    grown = ( count * ( 100 + growthPercent ) + 99 ) / 100;
+    return grown > least ? grown : least;
 }
 
-static inline uint64_t roundToBoundary( uint64_t val, uint64_t align )
+static bool countEntries( const struct ufsScanEntryStruct *entries,
+                          uint64_t numEntries, void *userData )
 {
-    return (((val) + ((align) - 1)) & ~((align) - 1));
+    struct ufsHeaderWorkloadStruct *workload;
+    uint64_t i;
+
+    workload = userData;
+    workload -> numFiles += numEntries;
+    for ( i = 0; i < numEntries; i++ )
+        workload -> numNameBytes += strlen( entries[i].name );
+
+    return true;
 }
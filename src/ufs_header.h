@@ -11,33 +11,174 @@
 #ifndef UFS_HEADER_H
 #define UFS_HEADER_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "ufs_defs.h"
 #include "ufs_image.h"
 
+/* Set on images written by ufsSeal, such images can not be mutated.         */
+#define UFS_HEADER_FLAG_SEALED (1 << 0)
+/* Set on the private header of an image opened by ufsStoreOpenSnapshot.     */
+#define UFS_HEADER_FLAG_SNAPSHOT (1 << 1)
+/* Set on images written by ufsReceive, their records are placed by the     */
+/* image they were received from and can't be changed locally.              */
+#define UFS_HEADER_FLAG_REPLICA (1 << 2)
+
+#define UFS_SNAPSHOTS_MAX (16)
+
+/* isOwned of a removed file or area that a snapshot still refers to, such   */
+/* records keep their contents until the last snapshot is dropped.           */
+#define UFS_RECORD_PINNED (2)
+
+/* The indices kept in the node section, each one is a B-tree of keys.       */
+enum ufsIndexEnum {
+    UFS_INDEX_NAME = 0,     /* ( parent, hash( name ), storage ).             */
+    UFS_INDEX_AREA_NAME,    /* ( 0, hash( name ), area ).                     */
+    UFS_INDEX_MAPPING,      /* ( storage, area, 0 ).                          */
+    UFS_INDEX_AREA_MAPPING, /* ( area, storage, 0 ).                          */
+    UFS_INDEX_COUNT,
+};
+
+#define UFS_NODE_MIN_DEGREE (8)
+#define UFS_NODE_MAX_KEYS (2 * UFS_NODE_MIN_DEGREE - 1)
+#define UFS_KEY_WIDTH (3)
+
+/* Records are identified by their index in their section plus one, so 0 is  */
+/* never a valid record. Free records are chained through their first field. */
+/* Nodes are shared between the live indices and the snapshots, refCount     */
+/* counts the roots and the nodes referring to a node.                       */
 struct ufsFileStruct {
     uint8_t isOwned;
+    uint8_t isDirectory;
+    /* Counts the files the record held, tells data kept outside the image  */
+    /* for an earlier one apart, see ufsStoreGetGeneration.                  */
+    uint32_t generation;
+    ufsIdType parent;
     uint64_t strOffset;
 };
 
 struct ufsAreaStruct {
     uint8_t isOwned;
+    /* Counts the areas the record held, as for files.                       */
+    uint32_t generation;
     uint64_t strOffset;
 };
 
+struct ufsKeyStruct {
+    ufsIdType key[ UFS_KEY_WIDTH ];
+};
+
 struct ufsNodeStruct {
     uint8_t isOwned;
-    ufsIdType left, right;
-    ufsIdType key[2];
-    uint8_t numKeys;
+    uint8_t isLeaf;
+    uint16_t numKeys;
+    uint32_t refCount;
+    ufsIdType children[ UFS_NODE_MAX_KEYS + 1 ];
+    struct ufsKeyStruct keys[ UFS_NODE_MAX_KEYS ];
+};
+
+/* The state of a BASE record, see ufs_base_index.h.                         */
+enum ufsBaseRecordStateEnum {
+    UFS_BASE_RECORD_UNKNOWN = 0,
+    UFS_BASE_RECORD_PRESENT,
+    UFS_BASE_RECORD_ABSENT,
+    UFS_BASE_RECORD_LISTED,
+};
+
+/* The attributes BASE had for a storage when it was scanned, records of the */
+/* optional BASE index line up with the file records, times are nanoseconds  */
+/* since the epoch.                                                          */
+struct ufsBaseRecordStruct {
+    uint32_t state;
+    uint32_t mode;
+    uint64_t inode;
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t ctime;
+};
+
+/* Inline data comes in size classes, a slot of class c holds up to          */
+/* UFS_INLINE_MIN << c bytes.                                                */
+#define UFS_INLINE_CLASSES (4)
+#define UFS_INLINE_MIN (32)
+#define UFS_INLINE_MAX ( UFS_INLINE_MIN << ( UFS_INLINE_CLASSES - 1 ) )
+
+/* Starts the optional data section, the slots of each class are allocated   */
+/* like records, see ufs_inline.h.                                           */
+struct ufsInlineHeaderStruct {
+    uint64_t used[ UFS_INLINE_CLASSES ];
+    ufsIdType freeLists[ UFS_INLINE_CLASSES ];
+    uint64_t numFree[ UFS_INLINE_CLASSES ];
+};
+
+/* The data a file has in an area, area is 0 in a free slot. next is the     */
+/* next slot of the same file, or the next free slot of the class.           */
+struct ufsInlineSlotStruct {
+    ufsIdType area;
+    ufsIdType next;
+    uint64_t length;
+    uint8_t data[];
+};
+
+/* A block of an extent file of the store, see ufs_extent.h, holding the     */
+/* data a file has in an area from offset on. area is 0 in a free record,    */
+/* next is the next extent of the same file by offset, or the next free one. */
+struct ufsExtentStruct {
+    ufsIdType area;
+    ufsIdType next;
+    /* Where the extent starts in the file, the bytes of it written.         */
+    uint64_t offset;
+    uint64_t length;
+    /* The extent file, the first UFS_EXTENT_BLOCK sized block of the        */
+    /* extent in it and the order of the extent, it has 1 << order blocks.   */
+    uint32_t extentFile;
+    uint32_t order;
+    uint64_t block;
+};
+
+/* Names take chunks of a multiple of UFS_STRING_GRANULE bytes, freed ones   */
+/* are kept on a list per size, class c holding chunks of                    */
+/* ( c + 1 ) * UFS_STRING_GRANULE bytes and the last class every bigger one. */
+/* A free chunk starts with the offset plus one of the next chunk of its     */
+/* class, chunks of the last class follow it with their size. Both stay      */
+/* below 1 << 56, so a free chunk still reads as a NUL terminated string.    */
+#define UFS_STRING_GRANULE (8)
+#define UFS_STRING_CLASSES (16)
+
+struct ufsSnapshotStruct {
+    uint64_t isOwned;
+    /* Names the snapshot across images, see ufsSend.                        */
+    uint64_t generation;
+    ufsIdType roots[ UFS_INDEX_COUNT ];
 };
 
 struct ufsHeaderStruct {
     uint32_t magicNumber;
     uint32_t version;
+    uint64_t flags;
 
     uint64_t sizes[ UFS_TYPES_COUNT ],
-             offsets[ UFS_TYPES_COUNT ];
+             offsets[ UFS_TYPES_COUNT ],
+             used[ UFS_TYPES_COUNT ];
+
+    ufsIdType freeLists[ UFS_TYPES_COUNT ],
+              roots[ UFS_INDEX_COUNT ];
+    /* For strings, the bytes of the chunks on stringFreeLists.              */
+    uint64_t numFree[ UFS_TYPES_COUNT ];
+    /* The offset plus one of the first free chunk of each class, 0 for      */
+    /* none.                                                                 */
+    uint64_t stringFreeLists[ UFS_STRING_CLASSES ];
+
+    /* A random identity given to the image when it is created.             */
+    uint64_t uuid;
+    /* The generation of the last snapshot taken.                            */
+    uint64_t generation;
+    /* The image and the snapshot generation a replica was received from.    */
+    uint64_t sourceUuid;
+    uint64_t sourceGeneration;
+
+    uint64_t numSnapshots;
+    struct ufsSnapshotStruct snapshots[ UFS_SNAPSHOTS_MAX ];
 };
 
 struct ufsHeaderSizeRequestStruct {
@@ -45,10 +186,30 @@ struct ufsHeaderSizeRequestStruct {
     uint64_t numAreas;
     uint64_t numNodes;
     uint64_t numStrBytes;
+    /* Whether to keep a BASE index, one record per file.                    */
+    bool baseIndex;
+    /* The bytes of inline data slots, 0 for no data section.                */
+    uint64_t numDataBytes;
+    /* The records of the extent store, 0 for no extent section.             */
+    uint64_t numExtents;
 };
 
 extern struct ufsHeaderSizeRequestStruct ufsDefaultSizeRequest;
 
+/* The headroom left by ufsHeaderEstimateSizes when asked for none.          */
+#define UFS_HEADER_GROWTH_PERCENT (100)
+
+/* What an image is expected to hold, see ufsHeaderSizeFor.                  */
+struct ufsHeaderWorkloadStruct {
+    /* Directories included.                                                 */
+    uint64_t numFiles;
+    uint64_t numAreas;
+    /* The bytes of every file and area name, without their NULs.            */
+    uint64_t numNameBytes;
+    /* A storage mapped into two areas counts twice.                         */
+    uint64_t numMappings;
+};
+
 /******************************************************************************\
 * ufsHeaderInit                                                                *
 *                                                                              *
@@ -76,6 +237,61 @@ extern struct ufsHeaderSizeRequestStruct ufsDefaultSizeRequest;
 ufsImagePtr ufsHeaderInit( const char *path,
                            struct ufsHeaderSizeRequestStruct sizes );
 
+/******************************************************************************\
+* ufsHeaderSizeFor                                                             *
+*                                                                              *
+*  Sizes an image for workload with growthPercent percent of headroom on top.  *
+*  Every name and its NUL are rounded up to UFS_STRING_GRANULE bytes,          *
+*  freed names go back to the free lists and are reused by later ones, so      *
+*  only the live names are counted. Nodes are counted for B-trees as sparse    *
+*  as they get. No section is smaller than in ufsDefaultSizeRequest,           *
+*  baseIndex, numDataBytes and numExtents are left to the caller.              *
+*  A fixed layout build always gets its own layout.                            *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: sizes is NULL.                                               *
+*   UFS_OUT_OF_MEMORY: The workload doesn't fit the fixed layout.              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -workload: What the image is expected to hold.                              *
+*  -growthPercent: The headroom, e.g. 100 for twice the workload.              *
+*  -sizes: Filled with the size request.                                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsHeaderSizeFor( struct ufsHeaderWorkloadStruct workload,
+                       uint64_t growthPercent,
+                       struct ufsHeaderSizeRequestStruct *sizes );
+
+/******************************************************************************\
+* ufsHeaderEstimateSizes                                                       *
+*                                                                              *
+*  Sizes an image for the tree under root, see ufsHeaderSizeFor. The tree is   *
+*  walked with ufsScan, which only reads directories, and the image is sized   *
+*  for every entry of it and the root as storage. Callers that know what      *
+*  they'll import otherwise, e.g. from a manifest, call ufsHeaderSizeFor.      *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsScan and ufsHeaderSizeFor.                                     *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -root: The tree.                                                            *
+*  -growthPercent: The headroom, 0 for UFS_HEADER_GROWTH_PERCENT.              *
+*  -sizes: Filled with the size request.                                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsHeaderEstimateSizes( const char *root, uint64_t growthPercent,
+                             struct ufsHeaderSizeRequestStruct *sizes );
+
 /******************************************************************************\
 * ufsHeaderValidate                                                            *
 *                                                                              *
@@ -85,6 +301,7 @@ ufsImagePtr ufsHeaderInit( const char *path,
 *    2.The version of the header is compatible with this client.               *
 *    3.The image is large enough to atleast contain the header.                *
 *    4.The image conforms to the sizes specified in the header.                *
+*      For sealed images the sizes are checked by ufsSealValidate.             *
 *                                                                              *
 *  Possible Errors:                                                            *
 *    UFS_BAD_CALL: If the input image is badly formed.                         *
@@ -19,7 +19,13 @@
 #include "ufs_image.h"
 #include <unistd.h>
 
-ufsStatusType ufsErrno = UFS_NO_ERROR;
+_Thread_local ufsStatusType ufsErrno = UFS_NO_ERROR;
+
+const char *ufsStatusStrings[] = {
+#define UFS_X(name) #name,
+    UFS_STATUS_LIST
+#undef UFS_X
+};
 
 ufsImagePtr ufsImageOpen( const char *filePath )
 {
@@ -76,6 +82,122 @@ ufsImagePtr ufsImageOpen( const char *filePath )
     return ret;
 }
 
+ufsImagePtr ufsImageOpenReadOnly( const char *filePath )
+{
+    int fd;
+    struct stat sb;
+    ufsImagePtr ret;
+
+    if ( !filePath ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    if ( access( filePath, F_OK ) ) {
+        ufsErrno = UFS_IMAGE_DOES_NOT_EXIST;
+        return NULL;
+    }
+
+    fd = open( filePath, O_RDONLY );
+
+    if ( fd == -1 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        perror( "open" );
+        return NULL;
+    }
+
+    if ( fstat( fd, &sb ) == -1 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        perror( "fstat" );
+        close( fd );
+        return NULL;
+    }
+
+    if ( sb.st_size < sizeof( uint64_t ) ) {
+        ufsErrno = UFS_IMAGE_TOO_SMALL;
+        close( fd );
+        return NULL;
+    }
+
+    ret = mmap( NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    if ( ret == MAP_FAILED ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        perror( "mmap" );
+        close( fd );
+        return NULL;
+    }
+
+    close( fd );
+
+    /* Unlike ufsImageOpen we can't fix the size up, it has to be right.     */
+    if ( *(uint64_t*)ret != sb.st_size ) {
+        munmap( ret, sb.st_size );
+        ufsErrno = UFS_IMAGE_BAD_SIZE;
+        return NULL;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return ret;
+}
+
+ufsImagePtr ufsImageOpenPrivate( const char *filePath )
+{
+    int fd;
+    struct stat sb;
+    ufsImagePtr ret;
+
+    if ( !filePath ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    if ( access( filePath, F_OK ) ) {
+        ufsErrno = UFS_IMAGE_DOES_NOT_EXIST;
+        return NULL;
+    }
+
+    fd = open( filePath, O_RDONLY );
+
+    if ( fd == -1 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        perror( "open" );
+        return NULL;
+    }
+
+    if ( fstat( fd, &sb ) == -1 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        perror( "fstat" );
+        close( fd );
+        return NULL;
+    }
+
+    if ( sb.st_size < sizeof( uint64_t ) ) {
+        ufsErrno = UFS_IMAGE_TOO_SMALL;
+        close( fd );
+        return NULL;
+    }
+
+    ret = mmap( NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    if ( ret == MAP_FAILED ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        perror( "mmap" );
+        close( fd );
+        return NULL;
+    }
+
+    close( fd );
+
+    /* The size is read by ufsImageFree, a private fix up would not last.   */
+    if ( *(uint64_t*)ret != sb.st_size ) {
+        munmap( ret, sb.st_size );
+        ufsErrno = UFS_IMAGE_BAD_SIZE;
+        return NULL;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return ret;
+}
+
 ufsImagePtr ufsImageCreate( const char *filePath, uint64_t size )
 {
     int fd;
@@ -0,0 +1,1347 @@
+/******************************************************************************\
+*  ufs_image_backend.c                                                         *
+*                                                                              *
+*  Contains the mmap image backend of ufs, over tiers of images.               *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ufs.h"
+#include "ufs_arena.h"
+#include "ufs_backend.h"
+#include "ufs_budget.h"
+#include "ufs_defs.h"
+#include "ufs_hash.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_store.h"
+#include "ufs_tiers.h"
+#include <unistd.h>
+
+#define BASE_NAME ("BASE")
+#define LOCAL_MASK ( ( (ufsIdentifierType) 1 << UFS_TIERS_SHIFT ) - 1 )
+
+struct scratchStruct {
+    char *name;
+    ufsIdentifierType id;
+    /* Storage of the read-write image, by identifier.                       */
+    uint64_t *bits;
+    uint64_t numWords;
+    /* Storage of sealed images, open addressed, 0 marks a free slot.        */
+    ufsIdentifierType *set;
+    uint64_t setCapacity,
+             setCount;
+};
+
+struct tiersStruct {
+    /* images[0] is the read-write image.                                    */
+    ufsImagePtr images[ UFS_TIERS_MAX ];
+    uint64_t numImages;
+
+    struct scratchStruct *scratch;
+    uint64_t numScratch,
+             scratchCapacity;
+    ufsIdType lastScratch;
+    /* Scratch areas are charged to the global budget, sealed images are    */
+    /* regions of it.                                                        */
+    int64_t budgetId;
+};
+
+/* Lists live in the arena of the calling thread, listFree gives back what */
+/* the call allocated since listInit.                                        */
+struct idListStruct {
+    ufsIdentifierType *ids;
+    uint64_t count,
+             capacity;
+    ufsArenaPtr arena;
+    struct ufsArenaMarkStruct mark;
+};
+
+struct collectStruct {
+    struct idListStruct *list;
+    uint64_t tier;
+    bool failed;
+};
+
+static inline uint64_t tierOf( ufsIdentifierType id );
+static inline ufsIdType localOf( ufsIdentifierType id );
+static inline ufsIdentifierType globalOf( uint64_t tier, ufsIdType local );
+static ufsStatusType specStatus( ufsStatusType status );
+static ufsStatusType setStatus( ufsStatusType status );
+static bool storageExists( struct tiersStruct *ufs, ufsIdentifierType storage );
+static bool areaExists( struct tiersStruct *ufs, ufsIdentifierType area );
+static bool isDirectory( struct tiersStruct *ufs, ufsIdentifierType storage );
+static ufsIdentifierType findStorage( struct tiersStruct *ufs,
+                                      ufsIdentifierType parent,
+                                      const char *name );
+static bool areaContains( struct tiersStruct *ufs, ufsIdentifierType area,
+                          ufsIdentifierType storage );
+static bool hasMappings( struct tiersStruct *ufs, ufsIdentifierType storage );
+static bool stopIter( ufsIdType id, void *userData );
+static bool collectIter( ufsIdType id, void *userData );
+static bool listInit( struct idListStruct *list );
+static bool listPush( struct idListStruct *list, ufsIdentifierType id );
+static void listFree( struct idListStruct *list );
+static uint64_t validateView( struct tiersStruct *ufs, ufsViewType view );
+static ufsStatusType removeStorage( struct tiersStruct *ufs,
+                                    ufsIdentifierType storage,
+                                    bool directory );
+static ufsStatusType addMapping( struct tiersStruct *ufs,
+                                 ufsIdentifierType area,
+                                 ufsIdentifierType storage );
+static bool collectArea( struct tiersStruct *ufs, ufsIdentifierType area,
+                         struct idListStruct *list );
+static struct scratchStruct *findScratch( struct tiersStruct *ufs,
+                                          ufsIdentifierType area );
+static bool scratchHas( const struct scratchStruct *scratch,
+                        ufsIdentifierType storage );
+static bool scratchAdd( struct tiersStruct *ufs,
+                        struct scratchStruct *scratch,
+                        ufsIdentifierType storage );
+static void scratchDrop( struct scratchStruct *scratch,
+                         ufsIdentifierType storage );
+static bool scratchCollect( const struct scratchStruct *scratch,
+                            struct idListStruct *list );
+static void scratchClear( struct tiersStruct *ufs,
+                          struct scratchStruct *scratch );
+static void scratchRemove( struct tiersStruct *ufs,
+                           struct scratchStruct *scratch );
+
+static void *imageInit( const char *opts );
+static struct tiersStruct *imageOpen( const char *imagePath,
+                                      const char **sealedPaths,
+                                      uint64_t numSealed,
+                                      struct ufsHeaderSizeRequestStruct sizes,
+                                      uint64_t snapshot );
+static bool sizeOption( const char *opts, const char *key, uint64_t *size );
+static bool estimateSizes( const char *opts, const char *tree,
+                           struct ufsHeaderSizeRequestStruct *sizes );
+static void imageDestroy( void *backend );
+static ufsIdentifierType imageAddDirectory( void *backend, const char *name );
+static ufsIdentifierType imageAddFile( void *backend,
+                                       ufsIdentifierType directory,
+                                       const char *name );
+static ufsIdentifierType imageAddArea( void *backend, const char *name );
+static ufsIdentifierType imageGetDirectory( void *backend, const char *name );
+static ufsIdentifierType imageGetFile( void *backend,
+                                       ufsIdentifierType directory,
+                                       char *name );
+static ufsIdentifierType imageGetArea( void *backend, const char *name );
+static ufsStatusType imageRemoveDirectory( void *backend,
+                                           ufsIdentifierType directory );
+static ufsStatusType imageRemoveFile( void *backend, ufsIdentifierType file );
+static ufsStatusType imageRemoveArea( void *backend, ufsIdentifierType area );
+static ufsStatusType imageAddMapping( void *backend,
+                                      ufsIdentifierType area,
+                                      ufsIdentifierType storage );
+static ufsStatusType imageProbeMapping( void *backend,
+                                        ufsIdentifierType area,
+                                        ufsIdentifierType storage );
+static ufsIdentifierType imageResolveStorageInView( void *backend,
+                                                    ufsViewType view,
+                                                    ufsIdentifierType storage );
+static ufsStatusType imageIterateDirInView( void *backend,
+                                            ufsViewType view,
+                                            ufsIdentifierType directory,
+                                            ufsDirIter iterator,
+                                            void *userData );
+static ufsStatusType imageCollapse( void *backend, ufsViewType view );
+static ufsIdentifierType imageAddScratchArea( void *backend,
+                                              const char *name );
+static ufsIdentifierType imagePersistArea( void *backend,
+                                           ufsIdentifierType area );
+
+const struct ufsBackendOps ufsImageBackendOps = {
+    .name = "image",
+    .init = imageInit,
+    .destroy = imageDestroy,
+    .addDirectory = imageAddDirectory,
+    .addFile = imageAddFile,
+    .addArea = imageAddArea,
+    .getDirectory = imageGetDirectory,
+    .getFile = imageGetFile,
+    .getArea = imageGetArea,
+    .removeDirectory = imageRemoveDirectory,
+    .removeFile = imageRemoveFile,
+    .removeArea = imageRemoveArea,
+    .addMapping = imageAddMapping,
+    .probeMapping = imageProbeMapping,
+    .resolveStorageInView = imageResolveStorageInView,
+    .iterateDirInView = imageIterateDirInView,
+    .collapse = imageCollapse,
+    .addScratchArea = imageAddScratchArea,
+    .persistArea = imagePersistArea,
+};
+
+ufsType ufsInitTiered( const char *imagePath,
+                       const char **sealedPaths,
+                       uint64_t numSealed )
+{
+    void *backend;
+
+    backend = imageOpen( imagePath, sealedPaths, numSealed,
+                         ufsDefaultSizeRequest, 0 );
+    if ( !backend )
+        return NULL;
+
+    return ufsBackendWrap( &ufsImageBackendOps, backend );
+}
+
+/* Options: path=<read-write image>, sealed=<sealed image> repeated in lookup */
+/* order. Without a path the image goes in UFS_IMAGE_FILE.                    */
+/* files=, areas=, nodes= and strbytes= size a new read-write image,          */
+/* inlinebytes= gives it a data section for tiny files, see ufs_inline.h,     */
+/* extents= the records of an extent store, see ufs_extent.h.                 */
+/* estimate=<dir> sizes it for the tree under dir first.                      */
+/* snapshot=<id> opens a snapshot of the image instead, read only.           */
+static void *imageInit( const char *opts )
+{
+    char path[ PATH_MAX ], tree[ PATH_MAX ], *sealed;
+    const char *sealedPaths[ UFS_TIERS_MAX ];
+    struct ufsHeaderSizeRequestStruct sizes;
+    void *backend;
+    uint64_t numSealed,
+        snapshot = 0;
+
+    sizes = ufsDefaultSizeRequest;
+    if ( !ufsBackendOption( opts, "estimate", 0, tree, sizeof( tree ) ) ) {
+        if ( ufsErrno != UFS_DOES_NOT_EXIST )
+            return NULL;
+        tree[0] = 0;
+    }
+
+    if ( !sizeOption( opts, "files", &sizes.numFiles ) ||
+         !sizeOption( opts, "areas", &sizes.numAreas ) ||
+         !sizeOption( opts, "nodes", &sizes.numNodes ) ||
+         !sizeOption( opts, "strbytes", &sizes.numStrBytes ) ||
+         !sizeOption( opts, "inlinebytes", &sizes.numDataBytes ) ||
+         !sizeOption( opts, "extents", &sizes.numExtents ) ||
+         !sizeOption( opts, "snapshot", &snapshot ) )
+        return NULL;
+
+    if ( !ufsBackendOption( opts, "path", 0, path, sizeof( path ) ) ) {
+        if ( ufsErrno != UFS_DOES_NOT_EXIST )
+            return NULL;
+
+        if ( mkdir( UFS_DIRECTORY, 0755 ) && errno != EEXIST ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            return NULL;
+        }
+
+        strcpy( path, UFS_IMAGE_FILE );
+    }
+
+    /* Only a new image is sized, explicit sizes win over the estimate.       */
+    if ( *tree && !snapshot && access( path, F_OK ) &&
+         !estimateSizes( opts, tree, &sizes ) )
+        return NULL;
+
+    sealed = malloc( (uint64_t) UFS_TIERS_MAX * PATH_MAX );
+    if ( !sealed ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    for ( numSealed = 0; numSealed < UFS_TIERS_MAX; numSealed++ ) {
+        sealedPaths[ numSealed ] = sealed + numSealed * PATH_MAX;
+        if ( !ufsBackendOption( opts, "sealed", numSealed,
+                                sealed + numSealed * PATH_MAX, PATH_MAX ) )
+            break;
+    }
+
+    if ( ufsErrno != UFS_DOES_NOT_EXIST ) {
+        free( sealed );
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    backend = imageOpen( path, sealedPaths, numSealed, sizes, snapshot );
+    free( sealed );
+    return backend;
+}
+
+static struct tiersStruct *imageOpen( const char *imagePath,
+                                      const char **sealedPaths,
+                                      uint64_t numSealed,
+                                      struct ufsHeaderSizeRequestStruct sizes,
+                                      uint64_t snapshot )
+{
+    struct tiersStruct *ufs;
+    ufsImagePtr img;
+    ufsStatusType status;
+    uint64_t i;
+
+    if ( !imagePath || ( numSealed && !sealedPaths ) ||
+         numSealed >= UFS_TIERS_MAX ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    ufs = calloc( 1, sizeof( *ufs ) );
+    if ( !ufs ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+    ufs -> budgetId = -1;
+
+    if ( snapshot ) {
+        img = ufsStoreOpenSnapshot( imagePath, snapshot );
+    } else {
+        img = ufsImageOpen( imagePath );
+        if ( img )
+            img = ufsHeaderValidate( img );
+        else if ( ufsErrno == UFS_IMAGE_DOES_NOT_EXIST )
+            img = ufsHeaderInit( imagePath, sizes );
+    }
+
+    if ( !img )
+        goto error;
+
+    ufs -> images[ ufs -> numImages++ ] = img;
+
+    if ( ufsHeaderGet( img ) -> flags & UFS_HEADER_FLAG_SEALED ) {
+        ufsErrno = UFS_BAD_CALL;
+        goto error;
+    }
+
+    for ( i = 0; i < numSealed; i++ ) {
+        img = ufsHeaderValidate( ufsImageOpenReadOnly( sealedPaths[i] ) );
+        if ( !img )
+            goto error;
+
+        ufs -> images[ ufs -> numImages++ ] = img;
+
+        if ( !( ufsHeaderGet( img ) -> flags & UFS_HEADER_FLAG_SEALED ) ) {
+            ufsErrno = UFS_BAD_CALL;
+            goto error;
+        }
+    }
+
+    /* Accounting is best effort, a full budget leaves the ufs unaccounted. */
+    ufs -> budgetId = ufsBudgetRegister( ufsBudgetGlobal(), "scratch areas",
+                                         NULL, NULL );
+    for ( i = 1; i < ufs -> numImages; i++ )
+        ufsBudgetAddRegion( ufsBudgetGlobal(), ufs -> images[i],
+                            *(uint64_t*)ufs -> images[i] );
+
+    ufsErrno = UFS_NO_ERROR;
+    return ufs;
+
+error:
+    status = specStatus( ufsErrno );
+    imageDestroy( ufs );
+    ufsErrno = status == UFS_NO_ERROR ? UFS_UNKNOWN_ERROR : status;
+    return NULL;
+}
+
+static void imageDestroy( void *backend )
+{
+    struct tiersStruct *self;
+    uint64_t i;
+
+    if ( !backend )
+        return;
+
+    self = backend;
+    if ( self -> numImages )
+        ufsImageSync( self -> images[0] );
+
+    for ( i = 1; i < self -> numImages; i++ )
+        ufsBudgetRemoveRegion( ufsBudgetGlobal(), self -> images[i] );
+
+    for ( i = 0; i < self -> numImages; i++ )
+        ufsImageFree( self -> images[i] );
+
+    for ( i = 0; i < self -> numScratch; i++ ) {
+        scratchClear( self, &self -> scratch[i] );
+        free( self -> scratch[i].name );
+    }
+
+    ufsBudgetUnregister( ufsBudgetGlobal(), self -> budgetId );
+
+    free( self -> scratch );
+    free( self );
+}
+
+static ufsIdentifierType imageAddDirectory( void *backend,
+                                            const char *name )
+{
+    struct tiersStruct *self;
+    ufsIdType id;
+
+    self = backend;
+    if ( !self || !name || !*name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( findStorage( self, 0, name ) > 0 ) {
+        ufsErrno = UFS_ALREADY_EXISTS;
+        return -1;
+    }
+
+    id = ufsStoreAddStorage( self -> images[0], 0, name, true );
+    ufsErrno = specStatus( ufsErrno );
+    return id;
+}
+
+static ufsIdentifierType imageAddFile( void *backend,
+                                       ufsIdentifierType directory,
+                                       const char *name )
+{
+    struct tiersStruct *self;
+    ufsIdType id;
+
+    self = backend;
+    if ( !self || !name || !*name || directory <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( !isDirectory( self, directory ) ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    if ( findStorage( self, directory, name ) > 0 ) {
+        ufsErrno = UFS_ALREADY_EXISTS;
+        return -1;
+    }
+
+    id = ufsStoreAddStorage( self -> images[0], directory, name, false );
+    ufsErrno = specStatus( ufsErrno );
+    return id;
+}
+
+static ufsIdentifierType imageAddArea( void *backend,
+                                       const char *name )
+{
+    struct tiersStruct *self;
+    ufsIdType id;
+
+    self = backend;
+    if ( !self || !name || !*name || !strcmp( name, BASE_NAME ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( imageGetArea( backend, name ) > 0 ) {
+        ufsErrno = UFS_ALREADY_EXISTS;
+        return -1;
+    }
+
+    id = ufsStoreAddArea( self -> images[0], name );
+    ufsErrno = specStatus( ufsErrno );
+    return id;
+}
+
+static ufsIdentifierType imageGetDirectory( void *backend,
+                                            const char *name )
+{
+    ufsIdentifierType id;
+
+    if ( !backend || !name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    id = findStorage( backend, 0, name );
+    if ( id < 0 || !isDirectory( backend, id ) ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+static ufsIdentifierType imageGetFile( void *backend,
+                                       ufsIdentifierType directory,
+                                       char *name )
+{
+    ufsIdentifierType id;
+
+    if ( !backend || !name || directory <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    id = findStorage( backend, directory, name );
+    if ( id < 0 ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+static ufsIdentifierType imageGetArea( void *backend,
+                                       const char *name )
+{
+    struct tiersStruct *self;
+    ufsIdType local;
+    uint64_t i;
+
+    self = backend;
+    if ( !self || !name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    for ( i = 0; i < self -> numImages; i++ ) {
+        local = ufsStoreGetArea( self -> images[i], name );
+        if ( local > 0 ) {
+            ufsErrno = UFS_NO_ERROR;
+            return globalOf( i, local );
+        }
+    }
+
+    for ( i = 0; i < self -> numScratch; i++ ) {
+        if ( !strcmp( self -> scratch[i].name, name ) ) {
+            ufsErrno = UFS_NO_ERROR;
+            return self -> scratch[i].id;
+        }
+    }
+
+    ufsErrno = UFS_DOES_NOT_EXIST;
+    return -1;
+}
+
+static ufsStatusType imageRemoveDirectory( void *backend,
+                                           ufsIdentifierType directory )
+{
+    return removeStorage( backend, directory, true );
+}
+
+static ufsStatusType imageRemoveFile( void *backend,
+                                      ufsIdentifierType file )
+{
+    return removeStorage( backend, file, false );
+}
+
+static ufsStatusType imageRemoveArea( void *backend,
+                                      ufsIdentifierType area )
+{
+    struct tiersStruct *self;
+
+    self = backend;
+    if ( !self || area <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    if ( !areaExists( self, area ) )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    if ( tierOf( area ) == UFS_TIERS_SCRATCH ) {
+        scratchRemove( self, findScratch( self, area ) );
+        return setStatus( UFS_NO_ERROR );
+    }
+
+    /* Areas of sealed images are part of the image.                         */
+    if ( tierOf( area ) )
+        return setStatus( UFS_BAD_CALL );
+
+    ufsStoreRemoveArea( self -> images[0], area );
+    return setStatus( specStatus( ufsErrno ) );
+}
+
+static ufsStatusType imageAddMapping( void *backend,
+                                      ufsIdentifierType area,
+                                      ufsIdentifierType storage )
+{
+    struct tiersStruct *self;
+
+    self = backend;
+    if ( !self || area <= 0 || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    if ( !areaExists( self, area ) || !storageExists( self, storage ) )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    if ( areaContains( self, area, storage ) )
+        return setStatus( UFS_ALREADY_EXISTS );
+
+    return setStatus( addMapping( self, area, storage ) );
+}
+
+static ufsStatusType imageProbeMapping( void *backend,
+                                        ufsIdentifierType area,
+                                        ufsIdentifierType storage )
+{
+    struct tiersStruct *self;
+
+    self = backend;
+    if ( !self || area <= 0 || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    if ( !areaExists( self, area ) || !storageExists( self, storage ) )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    if ( !areaContains( self, area, storage ) )
+        return setStatus( UFS_MAPPING_DOES_NOT_EXIST );
+
+    return setStatus( UFS_NO_ERROR );
+}
+
+static ufsIdentifierType imageResolveStorageInView( void *backend,
+                                                    ufsViewType view,
+                                                    ufsIdentifierType storage )
+{
+    struct tiersStruct *self;
+    uint64_t i, viewSize;
+
+    self = backend;
+    if ( !self || !view || storage <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( !storageExists( self, storage ) ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    viewSize = validateView( self, view );
+    if ( ufsErrno != UFS_NO_ERROR )
+        return -1;
+
+    for ( i = 0; i < viewSize; i++ ) {
+        if ( areaContains( self, view[i], storage ) ) {
+            ufsErrno = UFS_NO_ERROR;
+            return view[i];
+        }
+    }
+
+    ufsErrno = UFS_CANNOT_RESOLVE_STORAGE;
+    return -1;
+}
+
+static ufsStatusType imageIterateDirInView( void *backend,
+                                            ufsViewType view,
+                                            ufsIdentifierType directory,
+                                            ufsDirIter iterator,
+                                            void *userData )
+{
+    struct tiersStruct *self;
+    struct idListStruct children = { 0 };
+    struct collectStruct collect = { .list = &children };
+    ufsStatusType status;
+    uint64_t i, j, viewSize, numEntries;
+
+    self = backend;
+    if ( !self || !view || !iterator || directory <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    if ( !isDirectory( self, directory ) )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    viewSize = validateView( self, view );
+    if ( ufsErrno != UFS_NO_ERROR )
+        return ufsErrno;
+
+    if ( !listInit( &children ) )
+        return setStatus( UFS_OUT_OF_MEMORY );
+
+    /* Children added on top live in the read-write image, the rest live in */
+    /* the image of the directory.                                           */
+    ufsStoreIterateChildren( self -> images[0], directory, collectIter,
+                             &collect );
+    if ( tierOf( directory ) ) {
+        collect.tier = tierOf( directory );
+        ufsStoreIterateChildren( self -> images[ collect.tier ],
+                                 localOf( directory ), collectIter, &collect );
+    }
+
+    if ( collect.failed ) {
+        listFree( &children );
+        return setStatus( UFS_OUT_OF_MEMORY );
+    }
+
+    /* Keep only the children that some area of the view contains.          */
+    numEntries = 0;
+    for ( i = 0; i < children.count; i++ ) {
+        for ( j = 0; j < viewSize; j++ ) {
+            if ( areaContains( self, view[j], children.ids[i] ) ) {
+                children.ids[ numEntries++ ] = children.ids[i];
+                break;
+            }
+        }
+    }
+
+    status = UFS_NO_ERROR;
+    for ( i = 0; i < numEntries && status == UFS_NO_ERROR; i++ )
+        status = iterator( children.ids[i], i, numEntries, userData );
+
+    listFree( &children );
+    return setStatus( status );
+}
+
+static ufsStatusType imageCollapse( void *backend,
+                                    ufsViewType view )
+{
+    struct tiersStruct *self;
+    struct idListStruct storage = { 0 }, added = { 0 };
+    uint64_t ends[ UFS_VIEW_MAX_SIZE ];
+    ufsIdentifierType last;
+    ufsStatusType status;
+    uint64_t i, j, viewSize;
+
+    self = backend;
+    if ( !self || !view )
+        return setStatus( UFS_BAD_CALL );
+
+    viewSize = validateView( self, view );
+    if ( ufsErrno != UFS_NO_ERROR )
+        return ufsErrno;
+
+    if ( viewSize < 2 )
+        return setStatus( UFS_NO_ERROR );
+
+    /* The mappings of every area but the last are removed, which can't be  */
+    /* done to sealed areas, BASE can't be enumerated either.                */
+    for ( i = 0; i + 1 < viewSize; i++ ) {
+        if ( view[i] == 0 || ( tierOf( view[i] ) &&
+                               tierOf( view[i] ) != UFS_TIERS_SCRATCH ) )
+            return setStatus( UFS_BAD_CALL );
+    }
+
+    /* Both lists share the thread's arena, added is freed first.            */
+    if ( !listInit( &storage ) )
+        return setStatus( UFS_OUT_OF_MEMORY );
+
+    if ( !listInit( &added ) ) {
+        listFree( &storage );
+        return setStatus( UFS_OUT_OF_MEMORY );
+    }
+
+    /* The storage of area i is storage.ids[ ends[ i - 1 ] .. ends[i] ).     */
+    for ( i = 0; i + 1 < viewSize; i++ ) {
+        if ( !collectArea( self, view[i], &storage ) ) {
+            listFree( &added );
+            listFree( &storage );
+            return setStatus( UFS_OUT_OF_MEMORY );
+        }
+        ends[i] = storage.count;
+    }
+
+    /* All or nothing, the last area gets every mapping before any goes and */
+    /* what it got is taken back on failure.                                 */
+    last = view[ viewSize - 1 ];
+    status = UFS_NO_ERROR;
+    for ( j = 0; last && j < storage.count && status == UFS_NO_ERROR; j++ ) {
+        if ( areaContains( self, last, storage.ids[j] ) )
+            continue;
+
+        if ( !listPush( &added, storage.ids[j] ) )
+            status = UFS_OUT_OF_MEMORY;
+        else if ( addMapping( self, last, storage.ids[j] ) != UFS_NO_ERROR ) {
+            status = ufsErrno;
+            added.count--;
+        }
+    }
+
+    if ( status != UFS_NO_ERROR ) {
+        for ( j = 0; j < added.count; j++ ) {
+            if ( tierOf( last ) == UFS_TIERS_SCRATCH )
+                scratchDrop( findScratch( self, last ), added.ids[j] );
+            else
+                ufsStoreRemoveMapping( self -> images[0], last,
+                                       added.ids[j] );
+        }
+
+        listFree( &added );
+        listFree( &storage );
+        return setStatus( status );
+    }
+
+    for ( i = 0, j = 0; i + 1 < viewSize; i++ ) {
+        if ( tierOf( view[i] ) == UFS_TIERS_SCRATCH ) {
+            scratchClear( self, findScratch( self, view[i] ) );
+            j = ends[i];
+            continue;
+        }
+
+        for ( ; j < ends[i]; j++ )
+            ufsStoreRemoveMapping( self -> images[0], view[i],
+                                   storage.ids[j] );
+    }
+
+    listFree( &added );
+    listFree( &storage );
+    return setStatus( UFS_NO_ERROR );
+}
+
+static ufsIdentifierType imageAddScratchArea( void *backend,
+                                              const char *name )
+{
+    struct tiersStruct *self;
+    struct scratchStruct *scratch;
+    uint64_t capacity;
+
+    self = backend;
+    if ( !self || !name || !*name || !strcmp( name, BASE_NAME ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( imageGetArea( backend, name ) > 0 ) {
+        ufsErrno = UFS_ALREADY_EXISTS;
+        return -1;
+    }
+
+    if ( self -> numScratch == self -> scratchCapacity ) {
+        capacity = self -> scratchCapacity ? self -> scratchCapacity * 2 : 8;
+        scratch = realloc( self -> scratch, capacity * sizeof( *scratch ) );
+        if ( !scratch ) {
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return -1;
+        }
+
+        self -> scratch = scratch;
+        self -> scratchCapacity = capacity;
+    }
+
+    scratch = &self -> scratch[ self -> numScratch ];
+    memset( scratch, 0, sizeof( *scratch ) );
+    scratch -> name = strdup( name );
+    if ( !scratch -> name ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    scratch -> id = globalOf( UFS_TIERS_SCRATCH, ++self -> lastScratch );
+    self -> numScratch++;
+
+    ufsErrno = UFS_NO_ERROR;
+    return scratch -> id;
+}
+
+/* The scratch area goes once its mappings are in the image, until then the */
+/* new area is removed on any error.                                         */
+static ufsIdentifierType imagePersistArea( void *backend,
+                                           ufsIdentifierType area )
+{
+    struct tiersStruct *self;
+    struct scratchStruct *scratch;
+    struct idListStruct storage = { 0 };
+    ufsStatusType status;
+    ufsIdType id;
+    uint64_t i;
+
+    self = backend;
+    if ( !self || area <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( !areaExists( self, area ) ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    scratch = findScratch( self, area );
+    if ( !scratch ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( !listInit( &storage ) || !scratchCollect( scratch, &storage ) ) {
+        listFree( &storage );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    id = ufsStoreAddArea( self -> images[0], scratch -> name );
+    if ( id < 0 ) {
+        listFree( &storage );
+        ufsErrno = specStatus( ufsErrno );
+        return -1;
+    }
+
+    for ( i = 0; i < storage.count; i++ ) {
+        if ( !ufsStoreAddMapping( self -> images[0], id, storage.ids[i] ) ) {
+            status = specStatus( ufsErrno );
+            ufsStoreRemoveArea( self -> images[0], id );
+            listFree( &storage );
+            ufsErrno = status;
+            return -1;
+        }
+    }
+
+    listFree( &storage );
+    scratchRemove( self, scratch );
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+static inline uint64_t tierOf( ufsIdentifierType id )
+{
+    return (uint64_t) id >> UFS_TIERS_SHIFT;
+}
+
+static inline ufsIdType localOf( ufsIdentifierType id )
+{
+    return id & LOCAL_MASK;
+}
+
+static inline ufsIdentifierType globalOf( uint64_t tier, ufsIdType local )
+{
+    return (ufsIdentifierType) ( tier << UFS_TIERS_SHIFT ) | local;
+}
+
+/* Translates the statuses of the store to the statuses of the spec.         */
+static ufsStatusType specStatus( ufsStatusType status )
+{
+    switch ( status ) {
+    case UFS_FILE_ALREADY_EXISTS:
+    case UFS_AREA_ALREADY_EXISTS:
+    case UFS_MAPPING_ALREADY_EXISTS:
+        return UFS_ALREADY_EXISTS;
+    case UFS_FILE_DOES_NOT_EXIST:
+    case UFS_AREA_DOES_NOT_EXIST:
+    case UFS_SNAPSHOT_DOES_NOT_EXIST:
+        return UFS_DOES_NOT_EXIST;
+    case UFS_IMAGE_IS_SEALED:
+    case UFS_IMAGE_IS_SNAPSHOT:
+    case UFS_IMAGE_IS_REPLICA:
+        return UFS_BAD_CALL;
+    default:
+        break;
+    }
+
+    return status <= UFS_UNKNOWN_ERROR ? status : UFS_UNKNOWN_ERROR;
+}
+
+static ufsStatusType setStatus( ufsStatusType status )
+{
+    ufsErrno = status;
+    return status;
+}
+
+static bool storageExists( struct tiersStruct *ufs, ufsIdentifierType storage )
+{
+    uint64_t tier;
+
+    tier = tierOf( storage );
+    return storage > 0 && tier < ufs -> numImages && localOf( storage ) &&
+           ufsStoreHasStorage( ufs -> images[ tier ], localOf( storage ) );
+}
+
+static bool areaExists( struct tiersStruct *ufs, ufsIdentifierType area )
+{
+    uint64_t tier;
+
+    tier = tierOf( area );
+    if ( tier == UFS_TIERS_SCRATCH )
+        return findScratch( ufs, area ) != NULL;
+
+    return area > 0 && tier < ufs -> numImages && localOf( area ) &&
+           ufsStoreHasArea( ufs -> images[ tier ], localOf( area ) );
+}
+
+static bool isDirectory( struct tiersStruct *ufs, ufsIdentifierType storage )
+{
+    return storageExists( ufs, storage ) &&
+           ufsStoreIsDirectory( ufs -> images[ tierOf( storage ) ],
+                                localOf( storage ) );
+}
+
+/* The read-write image names its parents with global identifiers, a sealed  */
+/* image only holds children of its own directories.                         */
+static ufsIdentifierType findStorage( struct tiersStruct *ufs,
+                                      ufsIdentifierType parent,
+                                      const char *name )
+{
+    ufsIdType local;
+    uint64_t i;
+
+    local = ufsStoreGetStorage( ufs -> images[0], parent, name );
+    if ( local > 0 )
+        return local;
+
+    for ( i = 1; i < ufs -> numImages; i++ ) {
+        if ( parent && tierOf( parent ) != i )
+            continue;
+
+        local = ufsStoreGetStorage( ufs -> images[i], localOf( parent ), name );
+        if ( local > 0 )
+            return globalOf( i, local );
+    }
+
+    return -1;
+}
+
+/* BASE contains exactly the storage that no area maps.                      */
+static bool areaContains( struct tiersStruct *ufs, ufsIdentifierType area,
+                          ufsIdentifierType storage )
+{
+    uint64_t tier;
+
+    if ( area == 0 )
+        return !hasMappings( ufs, storage );
+
+    tier = tierOf( area );
+    if ( tier == UFS_TIERS_SCRATCH )
+        return scratchHas( findScratch( ufs, area ), storage );
+
+    if ( ufsStoreProbeMapping( ufs -> images[0], area, storage ) )
+        return true;
+
+    return tier && tier == tierOf( storage ) &&
+           ufsStoreProbeMapping( ufs -> images[ tier ], localOf( area ),
+                                 localOf( storage ) );
+}
+
+static bool hasMappings( struct tiersStruct *ufs, ufsIdentifierType storage )
+{
+    bool found;
+    uint64_t i, tier;
+
+    found = false;
+    ufsStoreIterateMappings( ufs -> images[0], storage, stopIter, &found );
+
+    tier = tierOf( storage );
+    if ( !found && tier )
+        ufsStoreIterateMappings( ufs -> images[ tier ], localOf( storage ),
+                                 stopIter, &found );
+
+    for ( i = 0; i < ufs -> numScratch && !found; i++ )
+        found = scratchHas( &ufs -> scratch[i], storage );
+
+    return found;
+}
+
+static bool stopIter( ufsIdType id, void *userData )
+{
+    (void) id;
+    *(bool*)userData = true;
+    return false;
+}
+
+static bool collectIter( ufsIdType id, void *userData )
+{
+    struct collectStruct *collect;
+
+    collect = userData;
+    if ( !listPush( collect -> list, globalOf( collect -> tier, id ) ) ) {
+        collect -> failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+static bool listInit( struct idListStruct *list )
+{
+    list -> arena = ufsArenaThread();
+    if ( !list -> arena )
+        return false;
+
+    list -> mark = ufsArenaSave( list -> arena );
+    return true;
+}
+
+static bool listPush( struct idListStruct *list, ufsIdentifierType id )
+{
+    ufsIdentifierType *ids;
+    uint64_t capacity;
+
+    if ( list -> count == list -> capacity ) {
+        capacity = list -> capacity ? list -> capacity * 2 : 64;
+        ids = ufsArenaGrow( list -> arena, list -> ids,
+                            list -> capacity * sizeof( *ids ),
+                            capacity * sizeof( *ids ) );
+        if ( !ids )
+            return false;
+
+        list -> ids = ids;
+        list -> capacity = capacity;
+    }
+
+    list -> ids[ list -> count++ ] = id;
+    return true;
+}
+
+static void listFree( struct idListStruct *list )
+{
+    if ( list -> arena )
+        ufsArenaRestore( list -> arena, list -> mark );
+}
+
+/* Returns the number of areas in view, ufsErrno tells whether it's valid.  */
+static uint64_t validateView( struct tiersStruct *ufs, ufsViewType view )
+{
+    uint64_t i, j;
+
+    for ( i = 0; i < UFS_VIEW_MAX_SIZE && view[i] != UFS_VIEW_TERMINATOR;
+          i++ ) {
+        if ( view[i] != 0 && !areaExists( ufs, view[i] ) ) {
+            ufsErrno = UFS_INVALID_AREA_IN_VIEW;
+            return 0;
+        }
+
+        for ( j = 0; j < i; j++ ) {
+            if ( view[j] == view[i] ) {
+                ufsErrno = UFS_VIEW_CONTAINS_DUPLICATES;
+                return 0;
+            }
+        }
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return i;
+}
+
+static ufsStatusType removeStorage( struct tiersStruct *ufs,
+                                    ufsIdentifierType storage,
+                                    bool directory )
+{
+    uint64_t i;
+
+    if ( !ufs || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    if ( !storageExists( ufs, storage ) ||
+         isDirectory( ufs, storage ) != directory )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    /* Storage of sealed images is part of the image.                        */
+    if ( tierOf( storage ) )
+        return setStatus( UFS_BAD_CALL );
+
+    if ( !ufsStoreRemoveStorage( ufs -> images[0], storage ) )
+        return setStatus( specStatus( ufsErrno ) );
+
+    /* The identifier may be handed out again.                               */
+    for ( i = 0; i < ufs -> numScratch; i++ )
+        scratchDrop( &ufs -> scratch[i], storage );
+
+    return setStatus( UFS_NO_ERROR );
+}
+
+static ufsStatusType addMapping( struct tiersStruct *ufs,
+                                 ufsIdentifierType area,
+                                 ufsIdentifierType storage )
+{
+    if ( tierOf( area ) == UFS_TIERS_SCRATCH )
+        return setStatus( scratchAdd( ufs, findScratch( ufs, area ), storage ) ?
+                          UFS_NO_ERROR : UFS_OUT_OF_MEMORY );
+
+    ufsStoreAddMapping( ufs -> images[0], area, storage );
+    return setStatus( specStatus( ufsErrno ) );
+}
+
+/* Appends the storage area maps to list, area is a read-write or scratch   */
+/* area.                                                                     */
+static bool collectArea( struct tiersStruct *ufs, ufsIdentifierType area,
+                         struct idListStruct *list )
+{
+    struct collectStruct collect = { .list = list };
+
+    if ( tierOf( area ) == UFS_TIERS_SCRATCH )
+        return scratchCollect( findScratch( ufs, area ), list );
+
+    ufsStoreIterateAreaMappings( ufs -> images[0], area, collectIter,
+                                 &collect );
+    return !collect.failed;
+}
+
+static struct scratchStruct *findScratch( struct tiersStruct *ufs,
+                                          ufsIdentifierType area )
+{
+    uint64_t i;
+
+    for ( i = 0; i < ufs -> numScratch; i++ ) {
+        if ( ufs -> scratch[i].id == area )
+            return &ufs -> scratch[i];
+    }
+
+    return NULL;
+}
+
+static bool scratchHas( const struct scratchStruct *scratch,
+                        ufsIdentifierType storage )
+{
+    uint64_t slot;
+
+    if ( !tierOf( storage ) )
+        return (uint64_t) storage / 64 < scratch -> numWords &&
+               scratch -> bits[ storage / 64 ] & 1ULL << storage % 64;
+
+    if ( !scratch -> setCapacity )
+        return false;
+
+    slot = ufsHashMix( storage ) & ( scratch -> setCapacity - 1 );
+    while ( scratch -> set[ slot ] ) {
+        if ( scratch -> set[ slot ] == storage )
+            return true;
+        slot = ( slot + 1 ) & ( scratch -> setCapacity - 1 );
+    }
+
+    return false;
+}
+
+/* The set is kept at most half full, storage of sealed images is never     */
+/* removed so slots are only freed all at once.                              */
+static bool scratchAdd( struct tiersStruct *ufs,
+                        struct scratchStruct *scratch,
+                        ufsIdentifierType storage )
+{
+    ufsIdentifierType *set, *old;
+    uint64_t *bits, i, slot, word, numWords, capacity;
+
+    if ( !tierOf( storage ) ) {
+        word = storage / 64;
+        if ( word >= scratch -> numWords ) {
+            numWords = scratch -> numWords ? scratch -> numWords : 16;
+            while ( numWords <= word )
+                numWords *= 2;
+
+            bits = realloc( scratch -> bits, numWords * sizeof( *bits ) );
+            if ( !bits )
+                return false;
+
+            scratch -> bits = bits;
+            memset( scratch -> bits + scratch -> numWords, 0,
+                    ( numWords - scratch -> numWords ) * sizeof( uint64_t ) );
+            ufsBudgetCharge( ufsBudgetGlobal(), ufs -> budgetId,
+                             ( numWords - scratch -> numWords ) *
+                             sizeof( uint64_t ) );
+            scratch -> numWords = numWords;
+        }
+
+        scratch -> bits[ word ] |= 1ULL << storage % 64;
+        return true;
+    }
+
+    if ( 2 * ( scratch -> setCount + 1 ) > scratch -> setCapacity ) {
+        capacity = scratch -> setCapacity ? scratch -> setCapacity * 2 : 64;
+        set = calloc( capacity, sizeof( *set ) );
+        if ( !set )
+            return false;
+
+        old = scratch -> set;
+        for ( i = 0; i < scratch -> setCapacity; i++ ) {
+            if ( !old[i] )
+                continue;
+
+            slot = ufsHashMix( old[i] ) & ( capacity - 1 );
+            while ( set[ slot ] )
+                slot = ( slot + 1 ) & ( capacity - 1 );
+            set[ slot ] = old[i];
+        }
+
+        free( old );
+        ufsBudgetCharge( ufsBudgetGlobal(), ufs -> budgetId,
+                         ( capacity - scratch -> setCapacity ) *
+                         sizeof( *set ) );
+        scratch -> set = set;
+        scratch -> setCapacity = capacity;
+    }
+
+    slot = ufsHashMix( storage ) & ( scratch -> setCapacity - 1 );
+    while ( scratch -> set[ slot ] )
+        slot = ( slot + 1 ) & ( scratch -> setCapacity - 1 );
+
+    scratch -> set[ slot ] = storage;
+    scratch -> setCount++;
+    return true;
+}
+
+/* Only storage of the read-write image can be removed.                      */
+static void scratchDrop( struct scratchStruct *scratch,
+                         ufsIdentifierType storage )
+{
+    if ( (uint64_t) storage / 64 < scratch -> numWords )
+        scratch -> bits[ storage / 64 ] &= ~( 1ULL << storage % 64 );
+}
+
+static bool scratchCollect( const struct scratchStruct *scratch,
+                            struct idListStruct *list )
+{
+    uint64_t i, bits;
+
+    for ( i = 0; i < scratch -> numWords; i++ ) {
+        for ( bits = scratch -> bits[i]; bits; bits &= bits - 1 ) {
+            if ( !listPush( list, i * 64 + __builtin_ctzll( bits ) ) )
+                return false;
+        }
+    }
+
+    for ( i = 0; i < scratch -> setCapacity; i++ ) {
+        if ( scratch -> set[i] && !listPush( list, scratch -> set[i] ) )
+            return false;
+    }
+
+    return true;
+}
+
+static void scratchClear( struct tiersStruct *ufs,
+                          struct scratchStruct *scratch )
+{
+    ufsBudgetCharge( ufsBudgetGlobal(), ufs -> budgetId,
+                     -(int64_t) ( ( scratch -> numWords +
+                                    scratch -> setCapacity ) *
+                                  sizeof( uint64_t ) ) );
+    free( scratch -> bits );
+    free( scratch -> set );
+    scratch -> bits = NULL;
+    scratch -> set = NULL;
+    scratch -> numWords = 0;
+    scratch -> setCapacity = 0;
+    scratch -> setCount = 0;
+}
+
+static void scratchRemove( struct tiersStruct *ufs,
+                           struct scratchStruct *scratch )
+{
+    scratchClear( ufs, scratch );
+    free( scratch -> name );
+    *scratch = ufs -> scratch[ --ufs -> numScratch ];
+}
+
+/* Leaves size untouched when key is missing.                                */
+static bool sizeOption( const char *opts, const char *key, uint64_t *size )
+{
+    char buff[ 32 ], *end;
+    uint64_t value;
+
+    if ( !ufsBackendOption( opts, key, 0, buff, sizeof( buff ) ) ) {
+        if ( ufsErrno == UFS_DOES_NOT_EXIST )
+            return true;
+
+        return false;
+    }
+
+    value = strtoull( buff, &end, 10 );
+    if ( !*buff || *end || !value ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    *size = value;
+    return true;
+}
+
+static bool estimateSizes( const char *opts, const char *tree,
+                           struct ufsHeaderSizeRequestStruct *sizes )
+{
+    if ( !ufsHeaderEstimateSizes( tree, 0, sizes ) )
+        return false;
+
+    return sizeOption( opts, "files", &sizes -> numFiles ) &&
+           sizeOption( opts, "areas", &sizes -> numAreas ) &&
+           sizeOption( opts, "nodes", &sizes -> numNodes ) &&
+           sizeOption( opts, "strbytes", &sizes -> numStrBytes ) &&
+           sizeOption( opts, "inlinebytes", &sizes -> numDataBytes ) &&
+           sizeOption( opts, "extents", &sizes -> numExtents );
+}
@@ -0,0 +1,283 @@
+/******************************************************************************\
+*  ufs_inline.c                                                                *
+*                                                                              *
+*  Contains the definitions for the data of tiny files kept inline.            *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "ufs_inline.h"
+#include "ufs_layout.h"
+#include "ufs_store.h"
+
+static inline ufsIdType *getHeads( ufsImagePtr img );
+static inline uint64_t numSlots( ufsImagePtr img, int sizeClass );
+static struct ufsInlineSlotStruct *getSlot( ufsImagePtr img, ufsIdType id );
+static int classFor( uint64_t length );
+static inline int classOf( ufsIdType id );
+static ufsIdType allocSlot( ufsImagePtr img, int sizeClass );
+static void freeSlot( ufsImagePtr img, ufsIdType id );
+static ufsIdType *findSlot( ufsImagePtr img, ufsIdType area,
+                            ufsIdType storage );
+
+bool ufsInlineHas( ufsImagePtr img )
+{
+    struct ufsHeaderStruct *header;
+
+    header = ufsLayoutHeader( img );
+    return header -> sizes[ UFS_TYPES_DATA ] &&
+           !( header -> flags & ( UFS_HEADER_FLAG_SEALED |
+                                  UFS_HEADER_FLAG_SNAPSHOT ) );
+}
+
+/* The new data is in its slot before the slot is linked, the old slot is     */
+/* unlinked before it's freed.                                                */
+bool ufsInlineSet( ufsImagePtr img, ufsIdType area, ufsIdType storage,
+                   const void *data, uint64_t length )
+{
+    struct ufsInlineSlotStruct *slot;
+    ufsIdType id, old, *link, *heads;
+    int sizeClass;
+
+    if ( !img || !ufsInlineHas( img ) || ( !data && length ) ||
+         length > UFS_INLINE_MAX ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !ufsStoreHasArea( img, area ) ) {
+        ufsErrno = UFS_AREA_DOES_NOT_EXIST;
+        return false;
+    }
+
+    if ( !ufsStoreHasStorage( img, storage ) ||
+         ufsStoreIsDirectory( img, storage ) ) {
+        ufsErrno = UFS_FILE_DOES_NOT_EXIST;
+        return false;
+    }
+
+    sizeClass = classFor( length );
+    link = findSlot( img, area, storage );
+    if ( link && classOf( *link ) == sizeClass ) {
+        slot = getSlot( img, *link );
+        if ( length )
+            memcpy( slot -> data, data, length );
+        slot -> length = length;
+    } else {
+        old = link ? *link : 0;
+        id = allocSlot( img, sizeClass );
+        if ( id < 0 )
+            return false;
+
+        heads = getHeads( img );
+        slot = getSlot( img, id );
+        if ( length )
+            memcpy( slot -> data, data, length );
+        slot -> length = length;
+        slot -> area = area;
+        slot -> next = heads[ storage - 1 ];
+        heads[ storage - 1 ] = id;
+
+        /* Data that changed class leaves its old slot behind the new one.    */
+        if ( old ) {
+            for ( link = &slot -> next; *link != old;
+                  link = &getSlot( img, *link ) -> next )
+                ;
+            *link = getSlot( img, old ) -> next;
+            freeSlot( img, old );
+        }
+    }
+
+    if ( !ufsStoreAddMapping( img, area, storage ) &&
+         ufsErrno != UFS_MAPPING_ALREADY_EXISTS ) {
+        ufsInlineRemove( img, area, storage );
+        return false;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+const void *ufsInlineGet( ufsImagePtr img, ufsIdType area, ufsIdType storage,
+                          uint64_t *length )
+{
+    struct ufsInlineSlotStruct *slot;
+    ufsIdType *link;
+
+    if ( !img || !length || !ufsInlineHas( img ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    link = findSlot( img, area, storage );
+    if ( !link ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return NULL;
+    }
+
+    slot = getSlot( img, *link );
+    *length = slot -> length;
+    ufsErrno = UFS_NO_ERROR;
+    return slot -> data;
+}
+
+bool ufsInlineRemove( ufsImagePtr img, ufsIdType area, ufsIdType storage )
+{
+    ufsIdType *link, id;
+
+    if ( !img || !ufsInlineHas( img ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    link = findSlot( img, area, storage );
+    if ( !link ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return false;
+    }
+
+    id = *link;
+    *link = getSlot( img, id ) -> next;
+    freeSlot( img, id );
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsInlineGetStats( ufsImagePtr img, struct ufsInlineStatsStruct *stats )
+{
+    struct ufsInlineHeaderStruct *header;
+    struct ufsInlineSlotStruct *slot;
+    ufsIdType *heads, id;
+    uint64_t i;
+    int c;
+
+    if ( !img || !stats || !ufsInlineHas( img ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    memset( stats, 0, sizeof( *stats ) );
+    header = ufsLayoutInlineHeader( img );
+    for ( c = 0; c < UFS_INLINE_CLASSES; c++ ) {
+        stats -> numSlots[c] = numSlots( img, c );
+        stats -> numUsed[c] = header -> used[c] - header -> numFree[c];
+    }
+
+    heads = getHeads( img );
+    for ( i = 0; i < ufsLayoutCapacity( img, UFS_TYPES_FILE ); i++ ) {
+        for ( id = heads[i]; id; id = slot -> next ) {
+            slot = getSlot( img, id );
+            stats -> numBytes += slot -> length;
+        }
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+/* One per file record, the slots follow them.                                */
+static inline ufsIdType *getHeads( ufsImagePtr img )
+{
+    return (ufsIdType*)( ufsLayoutInlineHeader( img ) + 1 );
+}
+
+static inline uint64_t numSlots( ufsImagePtr img, int sizeClass )
+{
+    return ufsLayoutCapacity( img, UFS_TYPES_DATA ) / UFS_INLINE_CLASSES /
+           UFS_LAYOUT_SLOT_SIZE( sizeClass );
+}
+
+/* Identifiers interleave the classes, slot i of class c is                   */
+/* i * UFS_INLINE_CLASSES + c + 1.                                            */
+static struct ufsInlineSlotStruct *getSlot( ufsImagePtr img, ufsIdType id )
+{
+    uint8_t *slots;
+    int c, sizeClass;
+
+    sizeClass = classOf( id );
+    slots = (uint8_t*)( getHeads( img ) +
+                        ufsLayoutCapacity( img, UFS_TYPES_FILE ) );
+    for ( c = 0; c < sizeClass; c++ )
+        slots += numSlots( img, c ) * UFS_LAYOUT_SLOT_SIZE( c );
+
+    return (struct ufsInlineSlotStruct*)( slots +
+        (uint64_t)( id - 1 ) / UFS_INLINE_CLASSES *
+        UFS_LAYOUT_SLOT_SIZE( sizeClass ) );
+}
+
+static int classFor( uint64_t length )
+{
+    int c;
+
+    for ( c = 0; ( (uint64_t) UFS_INLINE_MIN << c ) < length; c++ )
+        ;
+
+    return c;
+}
+
+static inline int classOf( ufsIdType id )
+{
+    return ( id - 1 ) % UFS_INLINE_CLASSES;
+}
+
+static ufsIdType allocSlot( ufsImagePtr img, int sizeClass )
+{
+    struct ufsInlineHeaderStruct *header;
+    ufsIdType id;
+
+    header = ufsLayoutInlineHeader( img );
+    if ( header -> freeLists[ sizeClass ] ) {
+        id = header -> freeLists[ sizeClass ];
+        header -> freeLists[ sizeClass ] = getSlot( img, id ) -> next;
+        header -> numFree[ sizeClass ]--;
+        return id;
+    }
+
+    if ( header -> used[ sizeClass ] == numSlots( img, sizeClass ) ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    return (ufsIdType)( header -> used[ sizeClass ]++ ) * UFS_INLINE_CLASSES +
+           sizeClass + 1;
+}
+
+static void freeSlot( ufsImagePtr img, ufsIdType id )
+{
+    struct ufsInlineHeaderStruct *header;
+    struct ufsInlineSlotStruct *slot;
+    int sizeClass;
+
+    header = ufsLayoutInlineHeader( img );
+    sizeClass = classOf( id );
+    slot = getSlot( img, id );
+    slot -> area = 0;
+    slot -> length = 0;
+    slot -> next = header -> freeLists[ sizeClass ];
+    header -> freeLists[ sizeClass ] = id;
+    header -> numFree[ sizeClass ]++;
+}
+
+/* The link naming the slot, the head or the next of the slot before it,      */
+/* NULL when there's none.                                                    */
+static ufsIdType *findSlot( ufsImagePtr img, ufsIdType area,
+                            ufsIdType storage )
+{
+    ufsIdType *link;
+
+    if ( area <= 0 || storage <= 0 ||
+         (uint64_t) storage > ufsLayoutCapacity( img, UFS_TYPES_FILE ) )
+        return NULL;
+
+    for ( link = &getHeads( img )[ storage - 1 ]; *link;
+          link = &getSlot( img, *link ) -> next ) {
+        if ( getSlot( img, *link ) -> area == area )
+            return link;
+    }
+
+    return NULL;
+}
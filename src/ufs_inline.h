@@ -0,0 +1,156 @@
+/******************************************************************************\
+*  ufs_inline.h                                                                *
+*                                                                              *
+*  Internal header for the data of tiny files kept inline in an image.         *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* An image created with numDataBytes keeps the data of files no larger than  */
+/* UFS_INLINE_MAX inside its data section, so reading one is a copy out of    */
+/* the mapping, with no file, inode or open on the external fs. The data a    */
+/* file has in an area sits in a slot of the smallest size class that holds   */
+/* it, the slots of a file are chained from a head that lines up with its     */
+/* file record. A file has data in few areas, so the chain is short.          */
+/*                                                                            */
+/* Slots are allocated like records, from a free list or past the slots used  */
+/* so far, each class has its own. Data that outgrows its class moves to a    */
+/* slot of a bigger one and data larger than UFS_INLINE_MAX belongs in the    */
+/* blob store, see ufs_blob.h.                                                */
+/*                                                                            */
+/* Removing a mapping, its storage or its area frees the slot. Sealed images, */
+/* snapshots and replication streams don't carry the data section.            */
+
+#ifndef UFS_INLINE_H
+#define UFS_INLINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+
+struct ufsInlineStatsStruct {
+    /* The slots of each size class and those holding data.                   */
+    uint64_t numSlots[ UFS_INLINE_CLASSES ],
+             numUsed[ UFS_INLINE_CLASSES ];
+    /* The bytes of data held.                                                */
+    uint64_t numBytes;
+};
+
+/******************************************************************************\
+* ufsInlineHas                                                                 *
+*                                                                              *
+*  Checks whether img has a data section that can be written.                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: A validated image, not NULL.                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if it does, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsInlineHas( ufsImagePtr img );
+
+/******************************************************************************\
+* ufsInlineSet                                                                 *
+*                                                                              *
+*  Makes data the data of storage in area, replacing what it had, then adds    *
+*  the mapping ( area, storage ). A mapping that already exists is kept.       *
+*                                                                              *
+*  Possible errors:                                                            *
+*   Those of ufsStoreAddMapping but UFS_MAPPING_ALREADY_EXISTS.                *
+*   UFS_BAD_CALL: img has no data section, data is NULL and length isn't 0 or  *
+*                 length is above UFS_INLINE_MAX.                              *
+*   UFS_AREA_DOES_NOT_EXIST: area doesn't exist.                               *
+*   UFS_FILE_DOES_NOT_EXIST: storage doesn't exist or is a directory.          *
+*   UFS_OUT_OF_MEMORY: The size class of length has no free slot.              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: The image.                                                            *
+*  -area: The identifier of the area.                                          *
+*  -storage: The identifier of the file.                                       *
+*  -data: The data.                                                            *
+*  -length: The bytes of data.                                                 *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsInlineSet( ufsImagePtr img, ufsIdType area, ufsIdType storage,
+                   const void *data, uint64_t length );
+
+/******************************************************************************\
+* ufsInlineGet                                                                 *
+*                                                                              *
+*  Gets the data of storage in area where it's kept, in the mapping of img.    *
+*  It stays valid until the data is set or removed.                            *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or length are NULL or img has no data section.           *
+*   UFS_DOES_NOT_EXIST: storage has no inline data in area.                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: The image.                                                            *
+*  -area: The identifier of the area.                                          *
+*  -storage: The identifier of the file.                                       *
+*  -length: Set to the bytes of data.                                          *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -const void*: The data, NULL on error.                                      *
+*                                                                              *
+\******************************************************************************/
+const void *ufsInlineGet( ufsImagePtr img, ufsIdType area, ufsIdType storage,
+                          uint64_t *length );
+
+/******************************************************************************\
+* ufsInlineRemove                                                              *
+*                                                                              *
+*  Frees the slot holding the data of storage in area, the mapping is kept.    *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL or has no data section.                          *
+*   UFS_DOES_NOT_EXIST: storage has no inline data in area.                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: The image.                                                            *
+*  -area: The identifier of the area.                                          *
+*  -storage: The identifier of the file.                                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsInlineRemove( ufsImagePtr img, ufsIdType area, ufsIdType storage );
+
+/******************************************************************************\
+* ufsInlineGetStats                                                            *
+*                                                                              *
+*  Gets the statistics of the data section of img, walking every file.         *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or stats are NULL or img has no data section.            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: The image.                                                            *
+*  -stats: Filled with the statistics.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsInlineGetStats( ufsImagePtr img, struct ufsInlineStatsStruct *stats );
+
+#endif /* UFS_INLINE_H */
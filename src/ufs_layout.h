@@ -0,0 +1,283 @@
+/******************************************************************************\
+*  ufs_layout.h                                                                *
+*                                                                              *
+*  Internal header describing the layout of a ufs image.                       *
+*  The offsets of every section are expressed as constant expressions of the   *
+*  size request, so a build with a fixed layout folds them at compile time.    *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_LAYOUT_H
+#define UFS_LAYOUT_H
+
+#include <stdint.h>
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+
+/* Notes:                                                                     */
+/* A ufs image is laid out as follows:                                        */
+/*   [ size ][ header ][ files ][ areas ][ nodes ][ strings ][ base ][ data ] */
+/*   [ extents ][ page padding ]                                              */
+/* Each section starts on the alignment boundary of its record type.          */
+/* The BASE index is optional, it has a record per file or none at all, in    */
+/* which case the strings end the image.                                      */
+/* The data section is optional too, its size is the bytes of its slots. It   */
+/* starts with a struct ufsInlineHeaderStruct and the identifier of the first */
+/* slot of every file, the slots of each size class follow, a class has a     */
+/* UFS_INLINE_CLASSES-th of the bytes.                                        */
+/* So is the extent section, its size is the number of its records. The       */
+/* identifier of the first extent of every file comes before them.            */
+/* Defining UFS_FIXED_LAYOUT makes the sizes of every section compile time    */
+/* constants, taken from the generated ufs_fixed_layout.h (see `make layout`).*/
+/* In that case the accessors below do not read the header at all.            */
+
+#define UFS_LAYOUT_ROUND( val, align ) \
+    ( ( (uint64_t)(val) + ( (uint64_t)(align) - 1 ) ) & \
+      ~( (uint64_t)(align) - 1 ) )
+
+#define UFS_LAYOUT_HEADER_OFFSET \
+    UFS_LAYOUT_ROUND( sizeof( uint64_t ), _Alignof( struct ufsHeaderStruct ) )
+
+#define UFS_LAYOUT_FILE_OFFSET \
+    UFS_LAYOUT_ROUND( UFS_LAYOUT_HEADER_OFFSET + \
+                      sizeof( struct ufsHeaderStruct ), \
+                      _Alignof( struct ufsFileStruct ) )
+
+#define UFS_LAYOUT_AREA_OFFSET( numFiles ) \
+    UFS_LAYOUT_ROUND( UFS_LAYOUT_FILE_OFFSET + \
+                      sizeof( struct ufsFileStruct ) * (numFiles), \
+                      _Alignof( struct ufsAreaStruct ) )
+
+#define UFS_LAYOUT_NODE_OFFSET( numFiles, numAreas ) \
+    UFS_LAYOUT_ROUND( UFS_LAYOUT_AREA_OFFSET( numFiles ) + \
+                      sizeof( struct ufsAreaStruct ) * (numAreas), \
+                      _Alignof( struct ufsNodeStruct ) )
+
+#define UFS_LAYOUT_STRING_OFFSET( numFiles, numAreas, numNodes ) \
+    UFS_LAYOUT_ROUND( UFS_LAYOUT_NODE_OFFSET( numFiles, numAreas ) + \
+                      sizeof( struct ufsNodeStruct ) * (numNodes), \
+                      _Alignof( char ) )
+
+/* The end of the strings, before padding to a page boundary.                */
+#define UFS_LAYOUT_END( numFiles, numAreas, numNodes, numStrBytes ) \
+    ( UFS_LAYOUT_STRING_OFFSET( numFiles, numAreas, numNodes ) + \
+      sizeof( char ) * (numStrBytes) )
+
+#define UFS_LAYOUT_BASE_OFFSET( numFiles, numAreas, numNodes, numStrBytes ) \
+    UFS_LAYOUT_ROUND( UFS_LAYOUT_END( numFiles, numAreas, numNodes, \
+                                      numStrBytes ), \
+                      _Alignof( struct ufsBaseRecordStruct ) )
+
+/* The end of the BASE index, when there's one.                              */
+#define UFS_LAYOUT_BASE_END( numFiles, numAreas, numNodes, numStrBytes ) \
+    ( UFS_LAYOUT_BASE_OFFSET( numFiles, numAreas, numNodes, numStrBytes ) + \
+      sizeof( struct ufsBaseRecordStruct ) * (numFiles) )
+
+/* numBaseRecords is 0 without a BASE index.                                 */
+#define UFS_LAYOUT_DATA_OFFSET( numFiles, numAreas, numNodes, numStrBytes, \
+                                numBaseRecords ) \
+    UFS_LAYOUT_ROUND( UFS_LAYOUT_BASE_OFFSET( numFiles, numAreas, numNodes, \
+                                              numStrBytes ) + \
+                      sizeof( struct ufsBaseRecordStruct ) * \
+                      (numBaseRecords), \
+                      _Alignof( struct ufsInlineHeaderStruct ) )
+
+/* The bytes a slot of size class c takes.                                   */
+#define UFS_LAYOUT_SLOT_SIZE( c ) \
+    UFS_LAYOUT_ROUND( sizeof( struct ufsInlineSlotStruct ) + \
+                      ( (uint64_t)UFS_INLINE_MIN << (c) ), \
+                      _Alignof( struct ufsInlineSlotStruct ) )
+
+/* The bytes of the data section, the slots never take more than             */
+/* numDataBytes.                                                             */
+#define UFS_LAYOUT_DATA_SIZE( numFiles, numDataBytes ) \
+    ( sizeof( struct ufsInlineHeaderStruct ) + \
+      sizeof( ufsIdType ) * (numFiles) + (numDataBytes) )
+
+/* numDataBytes is 0 without a data section.                                 */
+#define UFS_LAYOUT_EXTENT_OFFSET( numFiles, numAreas, numNodes, numStrBytes, \
+                                  numBaseRecords, numDataBytes ) \
+    UFS_LAYOUT_ROUND( UFS_LAYOUT_DATA_OFFSET( numFiles, numAreas, numNodes, \
+                                              numStrBytes, \
+                                              numBaseRecords ) + \
+                      ( (numDataBytes) ? \
+                        UFS_LAYOUT_DATA_SIZE( numFiles, numDataBytes ) : 0 ), \
+                      _Alignof( struct ufsExtentStruct ) )
+
+#define UFS_LAYOUT_EXTENT_SIZE( numFiles, numExtents ) \
+    ( sizeof( ufsIdType ) * (numFiles) + \
+      sizeof( struct ufsExtentStruct ) * (numExtents) )
+
+#ifdef UFS_FIXED_LAYOUT
+
+#include "ufs_fixed_layout.h"
+
+#if !defined( UFS_FIXED_NUM_FILES ) || !defined( UFS_FIXED_NUM_AREAS ) || \
+    !defined( UFS_FIXED_NUM_NODES ) || !defined( UFS_FIXED_NUM_STR_BYTES )
+#error "ufs_fixed_layout.h must define every UFS_FIXED_* size."
+#endif
+
+_Static_assert( UFS_FIXED_NUM_FILES > 0 && UFS_FIXED_NUM_AREAS > 0 &&
+                UFS_FIXED_NUM_NODES > 0 && UFS_FIXED_NUM_STR_BYTES > 0,
+                "Fixed layout sizes must be strictly positive." );
+
+/* Whether there's a BASE index, data or extents is still up to the header.  */
+#define UFS_LAYOUT_CAPACITY( img, type ) \
+    ( (type) == UFS_TYPES_FILE ? (uint64_t)UFS_FIXED_NUM_FILES : \
+      (type) == UFS_TYPES_AREA ? (uint64_t)UFS_FIXED_NUM_AREAS : \
+      (type) == UFS_TYPES_NODE ? (uint64_t)UFS_FIXED_NUM_NODES : \
+      (type) == UFS_TYPES_STRING ? (uint64_t)UFS_FIXED_NUM_STR_BYTES : \
+        ufsLayoutHeader( img ) -> sizes[ (type) ] )
+
+#define UFS_LAYOUT_OFFSET( img, type ) \
+    ( (type) == UFS_TYPES_FILE ? UFS_LAYOUT_FILE_OFFSET : \
+      (type) == UFS_TYPES_AREA ? \
+        UFS_LAYOUT_AREA_OFFSET( UFS_FIXED_NUM_FILES ) : \
+      (type) == UFS_TYPES_NODE ? \
+        UFS_LAYOUT_NODE_OFFSET( UFS_FIXED_NUM_FILES, UFS_FIXED_NUM_AREAS ) : \
+      (type) == UFS_TYPES_STRING ? \
+        UFS_LAYOUT_STRING_OFFSET( UFS_FIXED_NUM_FILES, UFS_FIXED_NUM_AREAS, \
+                                  UFS_FIXED_NUM_NODES ) : \
+      (type) == UFS_TYPES_BASE ? \
+        UFS_LAYOUT_BASE_OFFSET( UFS_FIXED_NUM_FILES, UFS_FIXED_NUM_AREAS, \
+                                UFS_FIXED_NUM_NODES, \
+                                UFS_FIXED_NUM_STR_BYTES ) : \
+      (type) == UFS_TYPES_DATA ? \
+        UFS_LAYOUT_DATA_OFFSET( UFS_FIXED_NUM_FILES, UFS_FIXED_NUM_AREAS, \
+                                UFS_FIXED_NUM_NODES, \
+                                UFS_FIXED_NUM_STR_BYTES, \
+                                ufsLayoutHeader( img ) -> \
+                                    sizes[ UFS_TYPES_BASE ] ) : \
+        UFS_LAYOUT_EXTENT_OFFSET( UFS_FIXED_NUM_FILES, UFS_FIXED_NUM_AREAS, \
+                                  UFS_FIXED_NUM_NODES, \
+                                  UFS_FIXED_NUM_STR_BYTES, \
+                                  ufsLayoutHeader( img ) -> \
+                                      sizes[ UFS_TYPES_BASE ], \
+                                  ufsLayoutHeader( img ) -> \
+                                      sizes[ UFS_TYPES_DATA ] ) )
+
+#else
+
+#define UFS_LAYOUT_CAPACITY( img, type ) \
+    ( ufsLayoutHeader( img ) -> sizes[ (type) ] )
+
+#define UFS_LAYOUT_OFFSET( img, type ) \
+    ( ufsLayoutHeader( img ) -> offsets[ (type) ] )
+
+#endif /* UFS_FIXED_LAYOUT */
+
+/******************************************************************************\
+* ufsLayoutHeader                                                              *
+*                                                                              *
+*  Gets the header portion of a validated image.                               *
+*  Unlike ufsHeaderGet, this does not check its input nor touch ufsErrno,      *
+*  it is meant for hot paths that already hold a valid image.                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -struct ufsHeaderStruct*: The header portion inside img.                    *
+*                                                                              *
+\******************************************************************************/
+static inline struct ufsHeaderStruct *ufsLayoutHeader( ufsImagePtr img )
+{
+    return (struct ufsHeaderStruct*)( (uint8_t*)img +
+                                      UFS_LAYOUT_HEADER_OFFSET );
+}
+
+/******************************************************************************\
+* ufsLayoutSection                                                             *
+*                                                                              *
+*  Gets the start of a section inside a validated image.                       *
+*  With UFS_FIXED_LAYOUT and a constant type this is a constant offset.        *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -type: the section to get, one of UFS_TYPES_*.                              *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -void*: The first record of the section.                                    *
+*                                                                              *
+\******************************************************************************/
+static inline void *ufsLayoutSection( ufsImagePtr img,
+                                      enum ufsTyepesEnum type )
+{
+    return (uint8_t*)img + UFS_LAYOUT_OFFSET( img, type );
+}
+
+/******************************************************************************\
+* ufsLayoutCapacity                                                            *
+*                                                                              *
+*  Gets the number of records a section of a validated image can hold.        *
+*  With UFS_FIXED_LAYOUT and a constant type this is a constant.               *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -type: the section to query, one of UFS_TYPES_*.                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The capacity of the section, in records.                         *
+*                                                                              *
+\******************************************************************************/
+static inline uint64_t ufsLayoutCapacity( ufsImagePtr img,
+                                          enum ufsTyepesEnum type )
+{
+    return UFS_LAYOUT_CAPACITY( img, type );
+}
+
+static inline struct ufsFileStruct *ufsLayoutFiles( ufsImagePtr img )
+{
+    return ufsLayoutSection( img, UFS_TYPES_FILE );
+}
+
+static inline struct ufsAreaStruct *ufsLayoutAreas( ufsImagePtr img )
+{
+    return ufsLayoutSection( img, UFS_TYPES_AREA );
+}
+
+static inline struct ufsNodeStruct *ufsLayoutNodes( ufsImagePtr img )
+{
+    return ufsLayoutSection( img, UFS_TYPES_NODE );
+}
+
+static inline char *ufsLayoutStrings( ufsImagePtr img )
+{
+    return ufsLayoutSection( img, UFS_TYPES_STRING );
+}
+
+static inline struct ufsBaseRecordStruct *ufsLayoutBaseRecords(
+        ufsImagePtr img )
+{
+    return ufsLayoutSection( img, UFS_TYPES_BASE );
+}
+
+static inline struct ufsInlineHeaderStruct *ufsLayoutInlineHeader(
+        ufsImagePtr img )
+{
+    return ufsLayoutSection( img, UFS_TYPES_DATA );
+}
+
+/* The first extent of every file, the records follow.                       */
+static inline ufsIdType *ufsLayoutExtentHeads( ufsImagePtr img )
+{
+    return ufsLayoutSection( img, UFS_TYPES_EXTENT );
+}
+
+static inline struct ufsExtentStruct *ufsLayoutExtents( ufsImagePtr img )
+{
+    return (struct ufsExtentStruct*)( ufsLayoutExtentHeads( img ) +
+                                      ufsLayoutCapacity( img,
+                                                         UFS_TYPES_FILE ) );
+}
+
+#endif /* UFS_LAYOUT_H */
@@ -0,0 +1,2488 @@
+/******************************************************************************\
+*  ufs_lsm.c                                                                   *
+*                                                                              *
+*  Contains the definitions for the log structured key value engine.           *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ufs_defs.h"
+#include "ufs_hash.h"
+#include "ufs_lsm.h"
+#include "ufs_pool.h"
+
+#define MANIFEST_NAME "MANIFEST"
+#define MANIFEST_TMP_NAME "MANIFEST.tmp"
+#define MANIFEST_MAGIC "ufs-lsm"
+#define MANIFEST_VERSION (1)
+#define LOG_SUFFIX ".log"
+#define RUN_SUFFIX ".run"
+
+/* "ufsrun" followed by 0s.                                                  */
+#define RUN_MAGIC (0x6e7572736675ULL)
+
+/* Records are: key length, value length | TOMBSTONE, key, value. Log       */
+/* records are preceded by a checksum of the record. A batch is a log       */
+/* record with an empty key whose value holds the records of its changes.   */
+#define TOMBSTONE (0x80000000u)
+#define RECORD_HEADER ( 2 * sizeof( uint32_t ) )
+#define LOG_HEADER ( RECORD_HEADER + sizeof( uint32_t ) )
+#define LOG_BUFFER ( 64 * 1024 )
+
+#define SKIP_MAX_HEIGHT (12)
+#define ARENA_CHUNK ( 64 * 1024 )
+
+#define BLOOM_SEED (0x626c6f6f6dULL)
+#define LOG_SEED (0x6c6f67ULL)
+
+const struct ufsLsmOptionsStruct ufsLsmDefaultOptions = {
+    .memtableBytes = 4 * 1024 * 1024,
+    .blockBytes = 4096,
+    .bloomBitsPerKey = 10,
+    .level0Runs = 4,
+    .level0StopRuns = 12,
+    .levelBytes = 16 * 1024 * 1024,
+    .levelRatio = 10,
+    .runBytes = 4 * 1024 * 1024,
+    .numThreads = 2,
+    .syncLog = false,
+};
+
+struct recordStruct {
+    const uint8_t *key, *value;
+    uint32_t keyLen, valueLen;
+    bool tombstone;
+};
+
+struct skipNodeStruct {
+    struct recordStruct record;
+    /* Room for the value, values that don't fit are moved.                  */
+    uint32_t valueCapacity;
+    uint32_t height;
+    struct skipNodeStruct *next[];
+};
+
+struct chunkStruct {
+    struct chunkStruct *next;
+    uint64_t used, size;
+    uint8_t data[];
+};
+
+struct memtableStruct {
+    struct skipNodeStruct *head;
+    struct chunkStruct *chunks;
+    uint64_t bytes;
+    uint64_t count;
+    uint64_t rng;
+    /* The log holding the writes of this memtable.                          */
+    uint64_t logNumber;
+    uint64_t refs;
+};
+
+struct blockStruct {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t lastKeyLen;
+    const uint8_t *lastKey;
+};
+
+struct runFooterStruct {
+    uint64_t magic;
+    uint64_t numRecords;
+    uint64_t dataBytes;
+    uint64_t indexOffset;
+    uint64_t indexBytes;
+    uint64_t bloomOffset;
+    uint64_t bloomBits;
+    uint32_t numBlocks;
+    uint32_t numHashes;
+};
+
+struct runStruct {
+    uint64_t number;
+    char *path;
+
+    const uint8_t *map;
+    uint64_t size;
+    struct runFooterStruct footer;
+    struct blockStruct *blocks;
+    const uint8_t *bloom;
+
+    struct recordStruct smallest, largest;
+
+    uint64_t refs;
+    /* Unlinked once the last reference is gone.                             */
+    bool obsolete;
+};
+
+struct levelStruct {
+    struct runStruct **runs;
+    uint64_t count;
+    uint64_t bytes;
+};
+
+/* Level 0 holds its newest run first, the other levels are ordered by key. */
+struct versionStruct {
+    struct levelStruct levels[ UFS_LSM_LEVELS ];
+    uint64_t refs;
+};
+
+/* One input of a merge, either a memtable or a run.                         */
+struct sourceStruct {
+    struct recordStruct record;
+    bool valid;
+
+    struct skipNodeStruct *node;
+
+    struct runStruct *run;
+    uint64_t offset;
+};
+
+struct runWriterStruct {
+    struct ufsLsmStruct *lsm;
+    uint64_t number;
+    char *path;
+    int fd;
+
+    uint8_t *block;
+    uint64_t blockUsed, blockCapacity;
+    uint64_t lastKeyOffset;
+    uint32_t lastKeyLen;
+
+    uint8_t *index;
+    uint64_t indexUsed, indexCapacity;
+
+    uint64_t *hashes;
+    uint64_t numHashes, hashCapacity;
+
+    uint64_t offset;
+    uint32_t numBlocks;
+};
+
+struct ufsLsmBatchStruct {
+    /* Room for the header of the log record, then the records.             */
+    uint8_t *data;
+    uint64_t used, capacity;
+};
+
+struct compactionStruct {
+    struct ufsLsmStruct *lsm;
+    uint64_t level;
+    struct runStruct **inputs;
+    uint64_t numInputs;
+    struct runStruct **overlaps;
+    uint64_t numOverlaps;
+    /* No deeper level holds data, deletions can be dropped.                 */
+    bool bottom;
+};
+
+struct ufsLsmStruct {
+    char *path;
+    struct ufsLsmOptionsStruct options;
+
+    /* Guards everything below but the active memtable and the log.          */
+    pthread_mutex_t lock;
+    /* Signalled whenever background work finishes.                          */
+    pthread_cond_t changed;
+
+    struct memtableStruct *mem, *imm;
+    struct versionStruct *current;
+    uint64_t nextFile;
+    /* Logs before this one are written out to runs.                         */
+    uint64_t manifestLog;
+
+    int logFd;
+    uint8_t *logBuffer;
+    uint64_t logUsed;
+
+    ufsPoolPtr pool;
+    uint64_t jobs;
+    bool flushing, closing;
+    bool levelBusy[ UFS_LSM_LEVELS ];
+    uint64_t cursors[ UFS_LSM_LEVELS ];
+    ufsStatusType backgroundError;
+};
+
+static int compareKeys( const uint8_t *a, uint32_t aLen,
+                        const uint8_t *b, uint32_t bLen );
+static bool hasPrefix( const uint8_t *key, uint32_t keyLen,
+                       const uint8_t *prefix, uint32_t prefixLen );
+static uint64_t keyHash( const uint8_t *key, uint32_t keyLen );
+static const uint8_t *decodeRecord( const uint8_t *data, uint64_t size,
+                                    struct recordStruct *record );
+static void encodeRecord( uint8_t *data, const struct recordStruct *record );
+static bool writeAll( int fd, const void *data, uint64_t size );
+static char *filePath( const char *dir, uint64_t number, const char *suffix );
+
+static struct memtableStruct *memtableCreate( uint64_t logNumber );
+static void memtableUnref( struct memtableStruct *mem );
+static void *memtableAlloc( struct memtableStruct *mem, uint64_t size );
+static struct skipNodeStruct *memtableSeek( struct memtableStruct *mem,
+                                            const uint8_t *key,
+                                            uint32_t keyLen,
+                                            struct skipNodeStruct **prev );
+static bool memtableInsert( struct memtableStruct *mem,
+                            const struct recordStruct *record );
+static bool memtableGet( struct memtableStruct *mem, const uint8_t *key,
+                         uint32_t keyLen, struct recordStruct *record );
+
+static struct runStruct *runOpen( const char *dir, uint64_t number );
+static void runUnref( struct runStruct *run );
+static bool runGet( struct runStruct *run, const uint8_t *key,
+                    uint32_t keyLen, uint64_t hash,
+                    struct recordStruct *record );
+static bool runOverlaps( struct runStruct *run,
+                         const struct recordStruct *smallest,
+                         const struct recordStruct *largest );
+
+static struct runWriterStruct *writerCreate( struct ufsLsmStruct *lsm );
+static bool writerAdd( struct runWriterStruct *writer,
+                       const struct recordStruct *record );
+static bool writerFinishBlock( struct runWriterStruct *writer );
+static struct runStruct *writerFinish( struct runWriterStruct *writer );
+static void writerAbort( struct runWriterStruct *writer );
+static uint64_t writerBytes( struct runWriterStruct *writer );
+
+static void sourceSeekMemtable( struct sourceStruct *source,
+                                struct memtableStruct *mem,
+                                const uint8_t *key, uint32_t keyLen );
+static void sourceSeekRun( struct sourceStruct *source, struct runStruct *run,
+                           const uint8_t *key, uint32_t keyLen );
+static void sourceNext( struct sourceStruct *source );
+static bool mergeNext( struct sourceStruct *sources, uint64_t numSources,
+                       struct recordStruct *record );
+
+static struct versionStruct *versionCopy( struct versionStruct *version );
+static bool versionAdd( struct versionStruct *version, uint64_t level,
+                        struct runStruct *run );
+static void versionRemove( struct versionStruct *version, uint64_t level,
+                           struct runStruct *run );
+static void versionUnref( struct versionStruct *version );
+
+static bool readManifest( struct ufsLsmStruct *lsm );
+static bool writeManifest( struct ufsLsmStruct *lsm,
+                           struct versionStruct *version );
+static bool recover( struct ufsLsmStruct *lsm );
+static bool replayLog( struct ufsLsmStruct *lsm, uint64_t number );
+static bool newLog( struct ufsLsmStruct *lsm );
+static bool flushLog( struct ufsLsmStruct *lsm, bool sync );
+static bool appendRecord( struct ufsLsmStruct *lsm,
+                          const struct recordStruct *record );
+static bool appendBatch( struct ufsLsmStruct *lsm,
+                         struct ufsLsmBatchStruct *batch );
+static bool batchAdd( struct ufsLsmBatchStruct *batch,
+                      const struct recordStruct *record );
+static bool checkBatch( const uint8_t *data, const uint8_t *end );
+static bool insertBatch( struct memtableStruct *mem, const uint8_t *data,
+                         const uint8_t *end );
+static bool rotate( struct ufsLsmStruct *lsm );
+static struct runStruct *writeMemtable( struct ufsLsmStruct *lsm,
+                                        struct memtableStruct *mem );
+
+static void schedule( struct ufsLsmStruct *lsm );
+static bool needsCompaction( struct ufsLsmStruct *lsm, uint64_t level );
+static struct compactionStruct *pickCompaction( struct ufsLsmStruct *lsm,
+                                                uint64_t level );
+static void freeCompaction( struct compactionStruct *compaction );
+static void flushJob( void *arg );
+static void compactJob( void *arg );
+static void finishJob( struct ufsLsmStruct *lsm );
+
+static bool validOptions( const struct ufsLsmOptionsStruct *options );
+static bool checkSizes( uint64_t keyLen, uint64_t valueLen );
+
+ufsLsmPtr ufsLsmOpen( const char *path,
+                      const struct ufsLsmOptionsStruct *options )
+{
+    struct ufsLsmStruct *lsm;
+    ufsStatusType status;
+
+    if ( !path || !options || !validOptions( options ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    if ( mkdir( path, 0755 ) && errno != EEXIST ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return NULL;
+    }
+
+    lsm = calloc( 1, sizeof( *lsm ) );
+    if ( !lsm ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    pthread_mutex_init( &lsm -> lock, NULL );
+    pthread_cond_init( &lsm -> changed, NULL );
+    lsm -> options = *options;
+    lsm -> logFd = -1;
+    lsm -> path = strdup( path );
+    lsm -> logBuffer = malloc( LOG_BUFFER );
+    lsm -> current = calloc( 1, sizeof( *lsm -> current ) );
+    if ( !lsm -> path || !lsm -> logBuffer || !lsm -> current ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        goto error;
+    }
+
+    lsm -> current -> refs = 1;
+    if ( !recover( lsm ) )
+        goto error;
+
+    lsm -> pool = ufsPoolCreate( options -> numThreads );
+    if ( !lsm -> pool )
+        goto error;
+
+    pthread_mutex_lock( &lsm -> lock );
+    schedule( lsm );
+    pthread_mutex_unlock( &lsm -> lock );
+
+    ufsErrno = UFS_NO_ERROR;
+    return lsm;
+
+error:
+    status = ufsErrno;
+    ufsLsmClose( lsm );
+    ufsErrno = status;
+    return NULL;
+}
+
+void ufsLsmClose( ufsLsmPtr lsm )
+{
+    if ( !lsm )
+        return;
+
+    if ( lsm -> logFd >= 0 ) {
+        flushLog( lsm, true );
+        close( lsm -> logFd );
+    }
+
+    /* Running work finishes, nothing new is picked.                         */
+    pthread_mutex_lock( &lsm -> lock );
+    lsm -> closing = true;
+    pthread_mutex_unlock( &lsm -> lock );
+    ufsPoolDestroy( lsm -> pool );
+
+    if ( lsm -> mem )
+        memtableUnref( lsm -> mem );
+    if ( lsm -> imm )
+        memtableUnref( lsm -> imm );
+    if ( lsm -> current )
+        versionUnref( lsm -> current );
+
+    pthread_cond_destroy( &lsm -> changed );
+    pthread_mutex_destroy( &lsm -> lock );
+    free( lsm -> logBuffer );
+    free( lsm -> path );
+    free( lsm );
+}
+
+bool ufsLsmPut( ufsLsmPtr lsm, const void *key, uint64_t keyLen,
+                const void *value, uint64_t valueLen )
+{
+    struct recordStruct record;
+
+    if ( !lsm || !key || !keyLen || ( valueLen && !value ) ||
+         !checkSizes( keyLen, valueLen ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    record.key = key;
+    record.keyLen = keyLen;
+    record.value = value;
+    record.valueLen = valueLen;
+    record.tombstone = false;
+
+    if ( !appendRecord( lsm, &record ) ||
+         !memtableInsert( lsm -> mem, &record ) )
+        return false;
+
+    if ( lsm -> mem -> bytes >= lsm -> options.memtableBytes &&
+         !rotate( lsm ) )
+        return false;
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsLsmDelete( ufsLsmPtr lsm, const void *key, uint64_t keyLen )
+{
+    struct recordStruct record;
+
+    if ( !lsm || !key || !keyLen || !checkSizes( keyLen, 0 ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    record.key = key;
+    record.keyLen = keyLen;
+    record.value = NULL;
+    record.valueLen = 0;
+    record.tombstone = true;
+
+    if ( !appendRecord( lsm, &record ) ||
+         !memtableInsert( lsm -> mem, &record ) )
+        return false;
+
+    if ( lsm -> mem -> bytes >= lsm -> options.memtableBytes &&
+         !rotate( lsm ) )
+        return false;
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+ufsLsmBatchPtr ufsLsmBatchCreate( void )
+{
+    struct ufsLsmBatchStruct *batch;
+
+    batch = calloc( 1, sizeof( *batch ) );
+    if ( batch ) {
+        batch -> capacity = 256;
+        batch -> data = malloc( batch -> capacity );
+    }
+
+    if ( !batch || !batch -> data ) {
+        free( batch );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    batch -> used = LOG_HEADER;
+    ufsErrno = UFS_NO_ERROR;
+    return batch;
+}
+
+void ufsLsmBatchFree( ufsLsmBatchPtr batch )
+{
+    if ( !batch )
+        return;
+
+    free( batch -> data );
+    free( batch );
+}
+
+bool ufsLsmBatchPut( ufsLsmBatchPtr batch, const void *key, uint64_t keyLen,
+                     const void *value, uint64_t valueLen )
+{
+    struct recordStruct record;
+
+    if ( !batch || !key || !keyLen || ( valueLen && !value ) ||
+         !checkSizes( keyLen, valueLen ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    record.key = key;
+    record.keyLen = keyLen;
+    record.value = value;
+    record.valueLen = valueLen;
+    record.tombstone = false;
+    return batchAdd( batch, &record );
+}
+
+bool ufsLsmBatchDelete( ufsLsmBatchPtr batch, const void *key,
+                        uint64_t keyLen )
+{
+    struct recordStruct record;
+
+    if ( !batch || !key || !keyLen || !checkSizes( keyLen, 0 ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    record.key = key;
+    record.keyLen = keyLen;
+    record.value = NULL;
+    record.valueLen = 0;
+    record.tombstone = true;
+    return batchAdd( batch, &record );
+}
+
+bool ufsLsmWrite( ufsLsmPtr lsm, ufsLsmBatchPtr batch )
+{
+    if ( !lsm || !batch ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( batch -> used > LOG_HEADER &&
+         ( !appendBatch( lsm, batch ) ||
+           !insertBatch( lsm -> mem, batch -> data + LOG_HEADER,
+                         batch -> data + batch -> used ) ) )
+        return false;
+
+    if ( lsm -> mem -> bytes >= lsm -> options.memtableBytes &&
+         !rotate( lsm ) )
+        return false;
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+int64_t ufsLsmGet( ufsLsmPtr lsm, const void *key, uint64_t keyLen,
+                   void *value, uint64_t valueSize )
+{
+    struct memtableStruct *imm;
+    struct versionStruct *version;
+    struct levelStruct *level;
+    struct recordStruct record;
+    uint64_t hash, i, lo, hi, mid;
+    bool found;
+    int64_t result;
+
+    if ( !lsm || !key || ( valueSize && !value ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( keyLen > UFS_LSM_MAX_KEY ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    found = memtableGet( lsm -> mem, key, keyLen, &record );
+    imm = NULL;
+    version = NULL;
+
+    if ( !found ) {
+        pthread_mutex_lock( &lsm -> lock );
+        imm = lsm -> imm;
+        if ( imm )
+            imm -> refs++;
+        version = lsm -> current;
+        version -> refs++;
+        pthread_mutex_unlock( &lsm -> lock );
+
+        if ( imm )
+            found = memtableGet( imm, key, keyLen, &record );
+    }
+
+    hash = keyHash( key, keyLen );
+    level = version ? &version -> levels[0] : NULL;
+    for ( i = 0; !found && level && i < level -> count; i++ )
+        found = runGet( level -> runs[i], key, keyLen, hash, &record );
+
+    /* Runs of the other levels don't overlap, at most one may hold key.     */
+    for ( i = 1; !found && version && i < UFS_LSM_LEVELS; i++ ) {
+        level = &version -> levels[i];
+        lo = 0;
+        hi = level -> count;
+        while ( lo < hi ) {
+            mid = lo + ( hi - lo ) / 2;
+            if ( compareKeys( level -> runs[ mid ] -> largest.key,
+                              level -> runs[ mid ] -> largest.keyLen,
+                              key, keyLen ) < 0 )
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if ( lo < level -> count )
+            found = runGet( level -> runs[ lo ], key, keyLen, hash, &record );
+    }
+
+    result = -1;
+    if ( found && !record.tombstone ) {
+        if ( valueSize && record.valueLen )
+            memcpy( value, record.value, record.valueLen < valueSize ?
+                                         record.valueLen : valueSize );
+        result = record.valueLen;
+    }
+
+    if ( imm || version ) {
+        pthread_mutex_lock( &lsm -> lock );
+        if ( imm )
+            memtableUnref( imm );
+        versionUnref( version );
+        pthread_mutex_unlock( &lsm -> lock );
+    }
+
+    ufsErrno = result < 0 ? UFS_DOES_NOT_EXIST : UFS_NO_ERROR;
+    return result;
+}
+
+bool ufsLsmScan( ufsLsmPtr lsm, const void *prefix, uint64_t prefixLen,
+                 ufsLsmIter iter, void *userData )
+{
+    struct memtableStruct *imm;
+    struct versionStruct *version;
+    struct sourceStruct *sources;
+    struct recordStruct record;
+    struct runStruct *run;
+    uint64_t numSources, maxSources, i, j;
+
+    if ( !lsm || !iter || ( prefixLen && !prefix ) ||
+         prefixLen > UFS_LSM_MAX_KEY ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    pthread_mutex_lock( &lsm -> lock );
+    imm = lsm -> imm;
+    if ( imm )
+        imm -> refs++;
+    version = lsm -> current;
+    version -> refs++;
+    pthread_mutex_unlock( &lsm -> lock );
+
+    maxSources = 2;
+    for ( i = 0; i < UFS_LSM_LEVELS; i++ )
+        maxSources += version -> levels[i].count;
+
+    sources = calloc( maxSources, sizeof( *sources ) );
+    if ( !sources ) {
+        pthread_mutex_lock( &lsm -> lock );
+        if ( imm )
+            memtableUnref( imm );
+        versionUnref( version );
+        pthread_mutex_unlock( &lsm -> lock );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    /* Sources go from newest to oldest, the merge prefers earlier ones.    */
+    numSources = 0;
+    sourceSeekMemtable( &sources[ numSources++ ], lsm -> mem, prefix,
+                        prefixLen );
+    if ( imm )
+        sourceSeekMemtable( &sources[ numSources++ ], imm, prefix, prefixLen );
+
+    /* A run holds keys with the prefix unless it ends before the prefix or  */
+    /* starts past every key that has it.                                    */
+    for ( i = 0; i < UFS_LSM_LEVELS; i++ ) {
+        for ( j = 0; j < version -> levels[i].count; j++ ) {
+            run = version -> levels[i].runs[j];
+            if ( compareKeys( run -> largest.key, run -> largest.keyLen,
+                              prefix, prefixLen ) < 0 ||
+                 ( compareKeys( run -> smallest.key, run -> smallest.keyLen,
+                                prefix, prefixLen ) > 0 &&
+                   !hasPrefix( run -> smallest.key, run -> smallest.keyLen,
+                               prefix, prefixLen ) ) )
+                continue;
+
+            sourceSeekRun( &sources[ numSources++ ], run, prefix, prefixLen );
+        }
+    }
+
+    while ( mergeNext( sources, numSources, &record ) ) {
+        if ( !hasPrefix( record.key, record.keyLen, prefix, prefixLen ) )
+            break;
+
+        if ( !record.tombstone &&
+             !iter( record.key, record.keyLen, record.value, record.valueLen,
+                    userData ) )
+            break;
+    }
+
+    free( sources );
+    pthread_mutex_lock( &lsm -> lock );
+    if ( imm )
+        memtableUnref( imm );
+    versionUnref( version );
+    pthread_mutex_unlock( &lsm -> lock );
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsLsmSync( ufsLsmPtr lsm )
+{
+    if ( !lsm ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !flushLog( lsm, true ) )
+        return false;
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsLsmCompact( ufsLsmPtr lsm )
+{
+    ufsStatusType status;
+
+    if ( !lsm ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( lsm -> mem -> count && !rotate( lsm ) )
+        return false;
+
+    /* Finished work schedules what it made necessary, so once nothing is   */
+    /* running and nothing was scheduled every level is within its bounds.  */
+    pthread_mutex_lock( &lsm -> lock );
+    do {
+        while ( lsm -> jobs )
+            pthread_cond_wait( &lsm -> changed, &lsm -> lock );
+        schedule( lsm );
+    } while ( lsm -> jobs );
+    status = lsm -> backgroundError;
+    pthread_mutex_unlock( &lsm -> lock );
+
+    ufsErrno = status;
+    return status == UFS_NO_ERROR;
+}
+
+uint64_t ufsLsmNumRuns( ufsLsmPtr lsm, uint64_t level )
+{
+    uint64_t count;
+
+    if ( !lsm || level >= UFS_LSM_LEVELS )
+        return 0;
+
+    pthread_mutex_lock( &lsm -> lock );
+    count = lsm -> current -> levels[ level ].count;
+    pthread_mutex_unlock( &lsm -> lock );
+
+    return count;
+}
+
+static int compareKeys( const uint8_t *a, uint32_t aLen,
+                        const uint8_t *b, uint32_t bLen )
+{
+    uint32_t len;
+    int cmp;
+
+    /* Empty keys may come without bytes.                                    */
+    len = aLen < bLen ? aLen : bLen;
+    cmp = len ? memcmp( a, b, len ) : 0;
+    if ( cmp )
+        return cmp;
+
+    return aLen < bLen ? -1 : aLen > bLen;
+}
+
+static bool hasPrefix( const uint8_t *key, uint32_t keyLen,
+                       const uint8_t *prefix, uint32_t prefixLen )
+{
+    return keyLen >= prefixLen &&
+           ( !prefixLen || !memcmp( key, prefix, prefixLen ) );
+}
+
+static uint64_t keyHash( const uint8_t *key, uint32_t keyLen )
+{
+    return ufsHashBytes( key, keyLen, BLOOM_SEED );
+}
+
+/* Returns the byte after the record, NULL if it does not fit in size.      */
+static const uint8_t *decodeRecord( const uint8_t *data, uint64_t size,
+                                    struct recordStruct *record )
+{
+    uint32_t keyLen, valueLen;
+
+    if ( size < RECORD_HEADER )
+        return NULL;
+
+    memcpy( &keyLen, data, sizeof( keyLen ) );
+    memcpy( &valueLen, data + sizeof( keyLen ), sizeof( valueLen ) );
+
+    record -> tombstone = valueLen & TOMBSTONE;
+    valueLen &= ~TOMBSTONE;
+    if ( keyLen > UFS_LSM_MAX_KEY || valueLen > UFS_LSM_MAX_VALUE ||
+         size - RECORD_HEADER < (uint64_t) keyLen + valueLen )
+        return NULL;
+
+    record -> key = data + RECORD_HEADER;
+    record -> keyLen = keyLen;
+    record -> value = record -> key + keyLen;
+    record -> valueLen = valueLen;
+    return record -> value + valueLen;
+}
+
+static void encodeRecord( uint8_t *data, const struct recordStruct *record )
+{
+    uint32_t valueLen;
+
+    valueLen = record -> valueLen | ( record -> tombstone ? TOMBSTONE : 0 );
+    memcpy( data, &record -> keyLen, sizeof( uint32_t ) );
+    memcpy( data + sizeof( uint32_t ), &valueLen, sizeof( uint32_t ) );
+    memcpy( data + RECORD_HEADER, record -> key, record -> keyLen );
+    if ( record -> valueLen )
+        memcpy( data + RECORD_HEADER + record -> keyLen, record -> value,
+                record -> valueLen );
+}
+
+static bool writeAll( int fd, const void *data, uint64_t size )
+{
+    const uint8_t *curr;
+    ssize_t written;
+
+    for ( curr = data; size; curr += written, size -= written ) {
+        written = write( fd, curr, size );
+        if ( written < 0 && errno == EINTR ) {
+            written = 0;
+            continue;
+        }
+
+        if ( written <= 0 )
+            return false;
+    }
+
+    return true;
+}
+
+static char *filePath( const char *dir, uint64_t number, const char *suffix )
+{
+    char *path;
+
+    if ( asprintf( &path, "%s/%06lu%s", dir, number, suffix ) < 0 )
+        return NULL;
+
+    return path;
+}
+
+/* ----- memtable ----                                                        */
+
+static struct memtableStruct *memtableCreate( uint64_t logNumber )
+{
+    struct memtableStruct *mem;
+
+    mem = calloc( 1, sizeof( *mem ) );
+    if ( !mem ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    mem -> refs = 1;
+    mem -> logNumber = logNumber;
+    mem -> rng = ufsHashMix( logNumber ) | 1;
+    mem -> head = memtableAlloc( mem, sizeof( *mem -> head ) +
+                                 SKIP_MAX_HEIGHT * sizeof( mem -> head ) );
+    if ( !mem -> head ) {
+        memtableUnref( mem );
+        return NULL;
+    }
+
+    memset( mem -> head, 0, sizeof( *mem -> head ) +
+                            SKIP_MAX_HEIGHT * sizeof( mem -> head ) );
+    mem -> head -> height = SKIP_MAX_HEIGHT;
+    return mem;
+}
+
+static void memtableUnref( struct memtableStruct *mem )
+{
+    struct chunkStruct *chunk, *next;
+
+    if ( --mem -> refs )
+        return;
+
+    for ( chunk = mem -> chunks; chunk; chunk = next ) {
+        next = chunk -> next;
+        free( chunk );
+    }
+
+    free( mem );
+}
+
+/* Bump allocation from chunks freed together with the memtable.            */
+static void *memtableAlloc( struct memtableStruct *mem, uint64_t size )
+{
+    struct chunkStruct *chunk;
+    uint64_t chunkSize;
+    void *ptr;
+
+    size = ( size + 7 ) & ~7ULL;
+    chunk = mem -> chunks;
+    if ( !chunk || chunk -> size - chunk -> used < size ) {
+        chunkSize = size > ARENA_CHUNK / 4 ? size : ARENA_CHUNK;
+        chunk = malloc( sizeof( *chunk ) + chunkSize );
+        if ( !chunk ) {
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return NULL;
+        }
+
+        chunk -> used = 0;
+        chunk -> size = chunkSize;
+
+        /* Large allocations don't retire the chunk being filled.            */
+        if ( chunkSize != ARENA_CHUNK && mem -> chunks ) {
+            chunk -> next = mem -> chunks -> next;
+            mem -> chunks -> next = chunk;
+        } else {
+            chunk -> next = mem -> chunks;
+            mem -> chunks = chunk;
+        }
+    }
+
+    ptr = chunk -> data + chunk -> used;
+    chunk -> used += size;
+    mem -> bytes += size;
+    return ptr;
+}
+
+/* Returns the first node not before key, prev receives the last node      */
+/* before key at every height.                                               */
+static struct skipNodeStruct *memtableSeek( struct memtableStruct *mem,
+                                            const uint8_t *key,
+                                            uint32_t keyLen,
+                                            struct skipNodeStruct **prev )
+{
+    struct skipNodeStruct *node, *next;
+    int height;
+
+    node = mem -> head;
+    for ( height = SKIP_MAX_HEIGHT - 1; height >= 0; height-- ) {
+        for ( next = node -> next[ height ];
+              next && compareKeys( next -> record.key, next -> record.keyLen,
+                                   key, keyLen ) < 0;
+              next = node -> next[ height ] )
+            node = next;
+
+        if ( prev )
+            prev[ height ] = node;
+    }
+
+    return node -> next[0];
+}
+
+static bool memtableInsert( struct memtableStruct *mem,
+                            const struct recordStruct *record )
+{
+    struct skipNodeStruct *prev[ SKIP_MAX_HEIGHT ], *node;
+    uint8_t *bytes;
+    uint32_t height;
+
+    node = memtableSeek( mem, record -> key, record -> keyLen, prev );
+    if ( node && !compareKeys( node -> record.key, node -> record.keyLen,
+                               record -> key, record -> keyLen ) ) {
+        if ( record -> valueLen > node -> valueCapacity ) {
+            bytes = memtableAlloc( mem, record -> valueLen );
+            if ( !bytes )
+                return false;
+
+            node -> record.value = bytes;
+            node -> valueCapacity = record -> valueLen;
+        }
+
+        if ( record -> valueLen )
+            memcpy( (uint8_t*) node -> record.value, record -> value,
+                    record -> valueLen );
+        node -> record.valueLen = record -> valueLen;
+        node -> record.tombstone = record -> tombstone;
+        return true;
+    }
+
+    /* Each height is kept with probability 1/4.                             */
+    for ( height = 1; height < SKIP_MAX_HEIGHT; height++ ) {
+        mem -> rng ^= mem -> rng << 13;
+        mem -> rng ^= mem -> rng >> 7;
+        mem -> rng ^= mem -> rng << 17;
+        if ( mem -> rng & 3 )
+            break;
+    }
+
+    node = memtableAlloc( mem, sizeof( *node ) +
+                               height * sizeof( node ) +
+                               record -> keyLen + record -> valueLen );
+    if ( !node )
+        return false;
+
+    bytes = (uint8_t*) &node -> next[ height ];
+    memcpy( bytes, record -> key, record -> keyLen );
+    if ( record -> valueLen )
+        memcpy( bytes + record -> keyLen, record -> value, record -> valueLen );
+
+    node -> record.key = bytes;
+    node -> record.keyLen = record -> keyLen;
+    node -> record.value = bytes + record -> keyLen;
+    node -> record.valueLen = record -> valueLen;
+    node -> record.tombstone = record -> tombstone;
+    node -> valueCapacity = record -> valueLen;
+    node -> height = height;
+
+    for ( height = 0; height < node -> height; height++ ) {
+        node -> next[ height ] = prev[ height ] -> next[ height ];
+        prev[ height ] -> next[ height ] = node;
+    }
+
+    mem -> count++;
+    return true;
+}
+
+static bool memtableGet( struct memtableStruct *mem, const uint8_t *key,
+                         uint32_t keyLen, struct recordStruct *record )
+{
+    struct skipNodeStruct *node;
+
+    node = memtableSeek( mem, key, keyLen, NULL );
+    if ( !node || compareKeys( node -> record.key, node -> record.keyLen,
+                               key, keyLen ) )
+        return false;
+
+    *record = node -> record;
+    return true;
+}
+
+/* ----- runs ----                                                            */
+
+static struct runStruct *runOpen( const char *dir, uint64_t number )
+{
+    struct runStruct *run;
+    struct stat st;
+    const uint8_t *curr, *end;
+    uint32_t i;
+    int fd;
+
+    run = calloc( 1, sizeof( *run ) );
+    if ( !run ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    run -> refs = 1;
+    run -> number = number;
+    run -> path = filePath( dir, number, RUN_SUFFIX );
+    if ( !run -> path ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        goto error;
+    }
+
+    fd = open( run -> path, O_RDONLY );
+    if ( fd < 0 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        goto error;
+    }
+
+    if ( fstat( fd, &st ) || (uint64_t) st.st_size <= sizeof( run -> footer ) ) {
+        close( fd );
+        ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+        goto error;
+    }
+
+    run -> size = st.st_size;
+    run -> map = mmap( NULL, run -> size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( run -> map == MAP_FAILED ) {
+        run -> map = NULL;
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        goto error;
+    }
+
+    memcpy( &run -> footer, run -> map + run -> size - sizeof( run -> footer ),
+            sizeof( run -> footer ) );
+    if ( run -> footer.magic != RUN_MAGIC || !run -> footer.numBlocks ||
+         run -> footer.indexOffset != run -> footer.dataBytes ||
+         run -> footer.bloomOffset !=
+             run -> footer.indexOffset + run -> footer.indexBytes ||
+         run -> footer.bloomOffset + run -> footer.bloomBits / 8 !=
+             run -> size - sizeof( run -> footer ) ||
+         !run -> footer.bloomBits || run -> footer.bloomBits % 64 ) {
+        ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+        goto error;
+    }
+
+    run -> blocks = calloc( run -> footer.numBlocks, sizeof( *run -> blocks ) );
+    if ( !run -> blocks ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        goto error;
+    }
+
+    curr = run -> map + run -> footer.indexOffset;
+    end = curr + run -> footer.indexBytes;
+    for ( i = 0; i < run -> footer.numBlocks; i++ ) {
+        if ( end - curr < (ptrdiff_t) ( sizeof( uint64_t ) +
+                                        2 * sizeof( uint32_t ) ) )
+            break;
+
+        memcpy( &run -> blocks[i].offset, curr, sizeof( uint64_t ) );
+        curr += sizeof( uint64_t );
+        memcpy( &run -> blocks[i].size, curr, sizeof( uint32_t ) );
+        curr += sizeof( uint32_t );
+        memcpy( &run -> blocks[i].lastKeyLen, curr, sizeof( uint32_t ) );
+        curr += sizeof( uint32_t );
+
+        if ( end - curr < run -> blocks[i].lastKeyLen ||
+             run -> blocks[i].offset + run -> blocks[i].size >
+                 run -> footer.dataBytes )
+            break;
+
+        run -> blocks[i].lastKey = curr;
+        curr += run -> blocks[i].lastKeyLen;
+    }
+
+    if ( i != run -> footer.numBlocks ||
+         !decodeRecord( run -> map, run -> footer.dataBytes,
+                        &run -> smallest ) ) {
+        ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+        goto error;
+    }
+
+    run -> bloom = run -> map + run -> footer.bloomOffset;
+    run -> largest.key = run -> blocks[ i - 1 ].lastKey;
+    run -> largest.keyLen = run -> blocks[ i - 1 ].lastKeyLen;
+    return run;
+
+error:
+    runUnref( run );
+    return NULL;
+}
+
+static void runUnref( struct runStruct *run )
+{
+    if ( --run -> refs )
+        return;
+
+    if ( run -> map )
+        munmap( (void*) run -> map, run -> size );
+
+    if ( run -> obsolete )
+        unlink( run -> path );
+
+    free( run -> blocks );
+    free( run -> path );
+    free( run );
+}
+
+static bool runGet( struct runStruct *run, const uint8_t *key,
+                    uint32_t keyLen, uint64_t hash,
+                    struct recordStruct *record )
+{
+    const uint8_t *curr, *end;
+    uint64_t delta, bit, lo, hi, mid;
+    uint32_t i;
+    int cmp;
+
+    if ( compareKeys( key, keyLen, run -> smallest.key,
+                      run -> smallest.keyLen ) < 0 ||
+         compareKeys( key, keyLen, run -> largest.key,
+                      run -> largest.keyLen ) > 0 )
+        return false;
+
+    /* Double hashing, the second hash is odd so it visits every bit.       */
+    delta = ( hash >> 32 | hash << 32 ) | 1;
+    for ( i = 0; i < run -> footer.numHashes; i++ ) {
+        bit = ( hash + i * delta ) % run -> footer.bloomBits;
+        if ( !( run -> bloom[ bit / 8 ] & ( 1 << ( bit % 8 ) ) ) )
+            return false;
+    }
+
+    lo = 0;
+    hi = run -> footer.numBlocks;
+    while ( lo < hi ) {
+        mid = lo + ( hi - lo ) / 2;
+        if ( compareKeys( run -> blocks[ mid ].lastKey,
+                          run -> blocks[ mid ].lastKeyLen, key, keyLen ) < 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if ( lo == run -> footer.numBlocks )
+        return false;
+
+    curr = run -> map + run -> blocks[ lo ].offset;
+    end = curr + run -> blocks[ lo ].size;
+    while ( curr < end ) {
+        curr = decodeRecord( curr, end - curr, record );
+        if ( !curr )
+            return false;
+
+        cmp = compareKeys( record -> key, record -> keyLen, key, keyLen );
+        if ( cmp >= 0 )
+            return !cmp;
+    }
+
+    return false;
+}
+
+static bool runOverlaps( struct runStruct *run,
+                         const struct recordStruct *smallest,
+                         const struct recordStruct *largest )
+{
+    return compareKeys( run -> largest.key, run -> largest.keyLen,
+                        smallest -> key, smallest -> keyLen ) >= 0 &&
+           compareKeys( run -> smallest.key, run -> smallest.keyLen,
+                        largest -> key, largest -> keyLen ) <= 0;
+}
+
+/* ----- run writer ----                                                      */
+
+static struct runWriterStruct *writerCreate( struct ufsLsmStruct *lsm )
+{
+    struct runWriterStruct *writer;
+
+    writer = calloc( 1, sizeof( *writer ) );
+    if ( !writer ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    writer -> lsm = lsm;
+    writer -> fd = -1;
+
+    pthread_mutex_lock( &lsm -> lock );
+    writer -> number = lsm -> nextFile++;
+    pthread_mutex_unlock( &lsm -> lock );
+
+    writer -> path = filePath( lsm -> path, writer -> number, RUN_SUFFIX );
+    if ( !writer -> path ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        writerAbort( writer );
+        return NULL;
+    }
+
+    writer -> fd = open( writer -> path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( writer -> fd < 0 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        writerAbort( writer );
+        return NULL;
+    }
+
+    return writer;
+}
+
+static bool writerAdd( struct runWriterStruct *writer,
+                       const struct recordStruct *record )
+{
+    uint64_t size, capacity;
+    uint8_t *grown;
+
+    size = RECORD_HEADER + record -> keyLen + record -> valueLen;
+    if ( writer -> blockUsed &&
+         writer -> blockUsed + size > writer -> lsm -> options.blockBytes &&
+         !writerFinishBlock( writer ) )
+        return false;
+
+    if ( writer -> blockUsed + size > writer -> blockCapacity ) {
+        capacity = writer -> blockUsed + size;
+        if ( capacity < writer -> lsm -> options.blockBytes )
+            capacity = writer -> lsm -> options.blockBytes;
+
+        grown = realloc( writer -> block, capacity );
+        if ( !grown ) {
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return false;
+        }
+
+        writer -> block = grown;
+        writer -> blockCapacity = capacity;
+    }
+
+    if ( writer -> numHashes == writer -> hashCapacity ) {
+        capacity = writer -> hashCapacity ? writer -> hashCapacity * 2 : 1024;
+        grown = realloc( writer -> hashes, capacity * sizeof( uint64_t ) );
+        if ( !grown ) {
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return false;
+        }
+
+        writer -> hashes = (uint64_t*) grown;
+        writer -> hashCapacity = capacity;
+    }
+
+    writer -> hashes[ writer -> numHashes++ ] =
+        keyHash( record -> key, record -> keyLen );
+
+    encodeRecord( writer -> block + writer -> blockUsed, record );
+    writer -> lastKeyOffset = writer -> blockUsed + RECORD_HEADER;
+    writer -> lastKeyLen = record -> keyLen;
+    writer -> blockUsed += size;
+    return true;
+}
+
+static bool writerFinishBlock( struct runWriterStruct *writer )
+{
+    uint64_t entry, capacity;
+    uint32_t size;
+    uint8_t *grown;
+
+    entry = sizeof( uint64_t ) + 2 * sizeof( uint32_t ) + writer -> lastKeyLen;
+    if ( writer -> indexUsed + entry > writer -> indexCapacity ) {
+        capacity = writer -> indexCapacity ? writer -> indexCapacity * 2 : 4096;
+        while ( capacity < writer -> indexUsed + entry )
+            capacity *= 2;
+
+        grown = realloc( writer -> index, capacity );
+        if ( !grown ) {
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return false;
+        }
+
+        writer -> index = grown;
+        writer -> indexCapacity = capacity;
+    }
+
+    if ( !writeAll( writer -> fd, writer -> block, writer -> blockUsed ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    size = writer -> blockUsed;
+    grown = writer -> index + writer -> indexUsed;
+    memcpy( grown, &writer -> offset, sizeof( uint64_t ) );
+    memcpy( grown + sizeof( uint64_t ), &size, sizeof( uint32_t ) );
+    memcpy( grown + sizeof( uint64_t ) + sizeof( uint32_t ),
+            &writer -> lastKeyLen, sizeof( uint32_t ) );
+    memcpy( grown + sizeof( uint64_t ) + 2 * sizeof( uint32_t ),
+            writer -> block + writer -> lastKeyOffset, writer -> lastKeyLen );
+
+    writer -> indexUsed += entry;
+    writer -> offset += writer -> blockUsed;
+    writer -> blockUsed = 0;
+    writer -> numBlocks++;
+    return true;
+}
+
+static struct runStruct *writerFinish( struct runWriterStruct *writer )
+{
+    struct runFooterStruct footer = { 0 };
+    struct runStruct *run;
+    uint64_t bit, delta, i, j;
+    uint8_t *bloom;
+
+    if ( writer -> blockUsed && !writerFinishBlock( writer ) ) {
+        writerAbort( writer );
+        return NULL;
+    }
+
+    footer.magic = RUN_MAGIC;
+    footer.numRecords = writer -> numHashes;
+    footer.dataBytes = writer -> offset;
+    footer.indexOffset = writer -> offset;
+    footer.indexBytes = writer -> indexUsed;
+    footer.bloomOffset = footer.indexOffset + footer.indexBytes;
+    footer.bloomBits = ( writer -> numHashes *
+                         writer -> lsm -> options.bloomBitsPerKey + 63 ) /
+                       64 * 64;
+    if ( !footer.bloomBits )
+        footer.bloomBits = 64;
+    footer.numBlocks = writer -> numBlocks;
+    /* bits per key * ln 2 hashes minimise false positives.                  */
+    footer.numHashes = writer -> lsm -> options.bloomBitsPerKey * 69 / 100;
+    if ( !footer.numHashes )
+        footer.numHashes = 1;
+
+    bloom = calloc( footer.bloomBits / 8, 1 );
+    if ( !bloom ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        writerAbort( writer );
+        return NULL;
+    }
+
+    for ( i = 0; i < writer -> numHashes; i++ ) {
+        delta = ( writer -> hashes[i] >> 32 | writer -> hashes[i] << 32 ) | 1;
+        for ( j = 0; j < footer.numHashes; j++ ) {
+            bit = ( writer -> hashes[i] + j * delta ) % footer.bloomBits;
+            bloom[ bit / 8 ] |= 1 << ( bit % 8 );
+        }
+    }
+
+    if ( !writeAll( writer -> fd, writer -> index, writer -> indexUsed ) ||
+         !writeAll( writer -> fd, bloom, footer.bloomBits / 8 ) ||
+         !writeAll( writer -> fd, &footer, sizeof( footer ) ) ||
+         fdatasync( writer -> fd ) ) {
+        free( bloom );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        writerAbort( writer );
+        return NULL;
+    }
+
+    free( bloom );
+    close( writer -> fd );
+    writer -> fd = -1;
+
+    run = runOpen( writer -> lsm -> path, writer -> number );
+    if ( !run ) {
+        writerAbort( writer );
+        return NULL;
+    }
+
+    free( writer -> block );
+    free( writer -> index );
+    free( writer -> hashes );
+    free( writer -> path );
+    free( writer );
+    return run;
+}
+
+static void writerAbort( struct runWriterStruct *writer )
+{
+    if ( writer -> fd >= 0 )
+        close( writer -> fd );
+
+    if ( writer -> path )
+        unlink( writer -> path );
+
+    free( writer -> block );
+    free( writer -> index );
+    free( writer -> hashes );
+    free( writer -> path );
+    free( writer );
+}
+
+static uint64_t writerBytes( struct runWriterStruct *writer )
+{
+    return writer -> offset + writer -> blockUsed;
+}
+
+/* ----- merging ----                                                         */
+
+static void sourceSeekMemtable( struct sourceStruct *source,
+                                struct memtableStruct *mem,
+                                const uint8_t *key, uint32_t keyLen )
+{
+    source -> run = NULL;
+    source -> node = memtableSeek( mem, key, keyLen, NULL );
+    source -> valid = source -> node;
+    if ( source -> valid )
+        source -> record = source -> node -> record;
+}
+
+static void sourceSeekRun( struct sourceStruct *source, struct runStruct *run,
+                           const uint8_t *key, uint32_t keyLen )
+{
+    uint64_t lo, hi, mid;
+
+    source -> run = run;
+    source -> node = NULL;
+
+    lo = 0;
+    hi = run -> footer.numBlocks;
+    while ( lo < hi ) {
+        mid = lo + ( hi - lo ) / 2;
+        if ( compareKeys( run -> blocks[ mid ].lastKey,
+                          run -> blocks[ mid ].lastKeyLen, key, keyLen ) < 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    source -> valid = lo < run -> footer.numBlocks;
+    if ( !source -> valid )
+        return;
+
+    source -> offset = run -> blocks[ lo ].offset;
+    sourceNext( source );
+    while ( source -> valid &&
+            compareKeys( source -> record.key, source -> record.keyLen,
+                         key, keyLen ) < 0 )
+        sourceNext( source );
+}
+
+/* For runs, reads the record at offset, for memtables moves to the next.   */
+static void sourceNext( struct sourceStruct *source )
+{
+    const uint8_t *next;
+
+    if ( !source -> run ) {
+        source -> node = source -> node -> next[0];
+        source -> valid = source -> node;
+        if ( source -> valid )
+            source -> record = source -> node -> record;
+        return;
+    }
+
+    if ( source -> offset >= source -> run -> footer.dataBytes ) {
+        source -> valid = false;
+        return;
+    }
+
+    next = decodeRecord( source -> run -> map + source -> offset,
+                         source -> run -> footer.dataBytes - source -> offset,
+                         &source -> record );
+    source -> valid = next;
+    if ( next )
+        source -> offset = next - source -> run -> map;
+}
+
+/* Gets the smallest key of all sources, as written by the first source    */
+/* that holds it, and moves every source past it.                            */
+static bool mergeNext( struct sourceStruct *sources, uint64_t numSources,
+                       struct recordStruct *record )
+{
+    struct sourceStruct *best;
+    uint64_t i;
+
+    best = NULL;
+    for ( i = 0; i < numSources; i++ ) {
+        if ( sources[i].valid &&
+             ( !best || compareKeys( sources[i].record.key,
+                                     sources[i].record.keyLen,
+                                     best -> record.key,
+                                     best -> record.keyLen ) < 0 ) )
+            best = &sources[i];
+    }
+
+    if ( !best )
+        return false;
+
+    *record = best -> record;
+    for ( i = 0; i < numSources; i++ ) {
+        if ( sources[i].valid &&
+             !compareKeys( sources[i].record.key, sources[i].record.keyLen,
+                           record -> key, record -> keyLen ) )
+            sourceNext( &sources[i] );
+    }
+
+    return true;
+}
+
+/* ----- versions ----                                                        */
+
+static struct versionStruct *versionCopy( struct versionStruct *version )
+{
+    struct versionStruct *copy;
+    struct levelStruct *level;
+    uint64_t i, j;
+
+    copy = calloc( 1, sizeof( *copy ) );
+    if ( !copy ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    copy -> refs = 1;
+    for ( i = 0; i < UFS_LSM_LEVELS; i++ ) {
+        level = &version -> levels[i];
+        if ( !level -> count )
+            continue;
+
+        copy -> levels[i].runs = malloc( level -> count *
+                                         sizeof( *level -> runs ) );
+        if ( !copy -> levels[i].runs ) {
+            versionUnref( copy );
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return NULL;
+        }
+
+        for ( j = 0; j < level -> count; j++ ) {
+            copy -> levels[i].runs[j] = level -> runs[j];
+            level -> runs[j] -> refs++;
+        }
+
+        copy -> levels[i].count = level -> count;
+        copy -> levels[i].bytes = level -> bytes;
+    }
+
+    return copy;
+}
+
+static bool versionAdd( struct versionStruct *version, uint64_t level,
+                        struct runStruct *run )
+{
+    struct levelStruct *curr;
+    struct runStruct **runs;
+    uint64_t pos;
+
+    curr = &version -> levels[ level ];
+    runs = realloc( curr -> runs, ( curr -> count + 1 ) * sizeof( *runs ) );
+    if ( !runs ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    curr -> runs = runs;
+    pos = 0;
+    if ( level ) {
+        while ( pos < curr -> count &&
+                compareKeys( runs[ pos ] -> smallest.key,
+                             runs[ pos ] -> smallest.keyLen,
+                             run -> smallest.key,
+                             run -> smallest.keyLen ) < 0 )
+            pos++;
+    }
+
+    memmove( runs + pos + 1, runs + pos,
+             ( curr -> count - pos ) * sizeof( *runs ) );
+    runs[ pos ] = run;
+    run -> refs++;
+    curr -> count++;
+    curr -> bytes += run -> size;
+    return true;
+}
+
+static void versionRemove( struct versionStruct *version, uint64_t level,
+                           struct runStruct *run )
+{
+    struct levelStruct *curr;
+    uint64_t pos;
+
+    curr = &version -> levels[ level ];
+    for ( pos = 0; pos < curr -> count && curr -> runs[ pos ] != run; pos++ )
+        ;
+
+    if ( pos == curr -> count )
+        return;
+
+    memmove( curr -> runs + pos, curr -> runs + pos + 1,
+             ( curr -> count - pos - 1 ) * sizeof( *curr -> runs ) );
+    curr -> count--;
+    curr -> bytes -= run -> size;
+    runUnref( run );
+}
+
+static void versionUnref( struct versionStruct *version )
+{
+    uint64_t i, j;
+
+    if ( --version -> refs )
+        return;
+
+    for ( i = 0; i < UFS_LSM_LEVELS; i++ ) {
+        for ( j = 0; j < version -> levels[i].count; j++ )
+            runUnref( version -> levels[i].runs[j] );
+
+        free( version -> levels[i].runs );
+    }
+
+    free( version );
+}
+
+/* ----- manifest and logs ----                                               */
+
+static bool readManifest( struct ufsLsmStruct *lsm )
+{
+    struct runStruct *run, **runs;
+    char *path, magic[ 16 ];
+    unsigned long level, number;
+    uint64_t count;
+    int version, matched;
+    FILE *file;
+
+    if ( asprintf( &path, "%s/%s", lsm -> path, MANIFEST_NAME ) < 0 ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    file = fopen( path, "r" );
+    free( path );
+    if ( !file )
+        return errno == ENOENT;
+
+    if ( fscanf( file, "%15s %d next %lu log %lu", magic, &version,
+                 &lsm -> nextFile, &lsm -> manifestLog ) != 4 ||
+         strcmp( magic, MANIFEST_MAGIC ) || version != MANIFEST_VERSION ) {
+        fclose( file );
+        ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+        return false;
+    }
+
+    while ( ( matched = fscanf( file, " run %lu %lu", &level,
+                                &number ) ) == 2 ) {
+        if ( level >= UFS_LSM_LEVELS ) {
+            fclose( file );
+            ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+            return false;
+        }
+
+        run = runOpen( lsm -> path, number );
+        if ( !run ) {
+            fclose( file );
+            return false;
+        }
+
+        if ( !versionAdd( lsm -> current, level, run ) ) {
+            runUnref( run );
+            fclose( file );
+            return false;
+        }
+
+        /* The manifest lists level 0 newest first, versionAdd prepends.     */
+        runs = lsm -> current -> levels[0].runs;
+        count = lsm -> current -> levels[0].count;
+        if ( !level ) {
+            memmove( runs, runs + 1, ( count - 1 ) * sizeof( *runs ) );
+            runs[ count - 1 ] = run;
+        }
+
+        runUnref( run );
+    }
+
+    fclose( file );
+    if ( matched != EOF ) {
+        ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+        return false;
+    }
+
+    return true;
+}
+
+/* Replaces the manifest with one describing version, atomically.           */
+static bool writeManifest( struct ufsLsmStruct *lsm,
+                           struct versionStruct *version )
+{
+    char *path, *tmpPath;
+    uint64_t i, j;
+    FILE *file;
+    bool ok;
+    int dirFd;
+
+    path = tmpPath = NULL;
+    if ( asprintf( &path, "%s/%s", lsm -> path, MANIFEST_NAME ) < 0 ||
+         asprintf( &tmpPath, "%s/%s", lsm -> path, MANIFEST_TMP_NAME ) < 0 ) {
+        free( path );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    file = fopen( tmpPath, "w" );
+    ok = file;
+    if ( ok ) {
+        fprintf( file, "%s %d\nnext %lu\nlog %lu\n", MANIFEST_MAGIC,
+                 MANIFEST_VERSION, lsm -> nextFile, lsm -> manifestLog );
+        for ( i = 0; i < UFS_LSM_LEVELS; i++ ) {
+            for ( j = 0; j < version -> levels[i].count; j++ )
+                fprintf( file, "run %lu %lu\n", i,
+                         version -> levels[i].runs[j] -> number );
+        }
+
+        ok = !fflush( file ) && !fdatasync( fileno( file ) );
+        ok = !fclose( file ) && ok;
+    }
+
+    ok = ok && !rename( tmpPath, path );
+
+    /* Make the rename itself durable.                                       */
+    dirFd = open( lsm -> path, O_RDONLY | O_DIRECTORY );
+    if ( dirFd >= 0 ) {
+        fsync( dirFd );
+        close( dirFd );
+    }
+
+    free( tmpPath );
+    free( path );
+    if ( !ok )
+        ufsErrno = UFS_UNKNOWN_ERROR;
+
+    return ok;
+}
+
+/* Loads the manifest, replays the logs it does not cover into a level 0    */
+/* run and starts a new log.                                                 */
+static bool recover( struct ufsLsmStruct *lsm )
+{
+    struct dirent *entry;
+    struct runStruct *run;
+    uint64_t *logs, numLogs, number, i, j;
+    bool listed, ok;
+    char *end;
+    DIR *dir;
+
+    lsm -> nextFile = 1;
+    if ( !readManifest( lsm ) )
+        return false;
+
+    dir = opendir( lsm -> path );
+    if ( !dir ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    logs = NULL;
+    numLogs = 0;
+    ok = true;
+    while ( ok && ( entry = readdir( dir ) ) ) {
+        number = strtoull( entry -> d_name, &end, 10 );
+        if ( end == entry -> d_name )
+            continue;
+
+        if ( number >= lsm -> nextFile )
+            lsm -> nextFile = number + 1;
+
+        if ( !strcmp( end, LOG_SUFFIX ) && number >= lsm -> manifestLog ) {
+            logs = realloc( logs, ( numLogs + 1 ) * sizeof( *logs ) );
+            ok = logs;
+            if ( ok )
+                logs[ numLogs++ ] = number;
+            continue;
+        }
+
+        /* Runs the manifest doesn't list were never installed.             */
+        listed = strcmp( end, RUN_SUFFIX );
+        for ( i = 0; !listed && i < UFS_LSM_LEVELS; i++ ) {
+            for ( j = 0; j < lsm -> current -> levels[i].count; j++ )
+                listed |= lsm -> current -> levels[i].runs[j] -> number ==
+                          number;
+        }
+
+        if ( !listed || !strcmp( end, LOG_SUFFIX ) )
+            unlinkat( dirfd( dir ), entry -> d_name, 0 );
+    }
+
+    closedir( dir );
+    if ( !ok ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    /* Older logs hold older writes.                                         */
+    for ( i = 1; i < numLogs; i++ ) {
+        for ( j = i; j > 0 && logs[ j - 1 ] > logs[j]; j-- ) {
+            number = logs[j];
+            logs[j] = logs[ j - 1 ];
+            logs[ j - 1 ] = number;
+        }
+    }
+
+    lsm -> mem = memtableCreate( 0 );
+    ok = lsm -> mem;
+    for ( i = 0; ok && i < numLogs; i++ )
+        ok = replayLog( lsm, logs[i] );
+
+    if ( ok && lsm -> mem -> count ) {
+        run = writeMemtable( lsm, lsm -> mem );
+        ok = run && versionAdd( lsm -> current, 0, run );
+        if ( run )
+            runUnref( run );
+    }
+
+    if ( ok ) {
+        memtableUnref( lsm -> mem );
+        lsm -> mem = memtableCreate( lsm -> nextFile++ );
+        ok = lsm -> mem && newLog( lsm );
+    }
+
+    if ( ok ) {
+        lsm -> manifestLog = lsm -> mem -> logNumber;
+        ok = writeManifest( lsm, lsm -> current );
+    }
+
+    for ( i = 0; ok && i < numLogs; i++ ) {
+        end = filePath( lsm -> path, logs[i], LOG_SUFFIX );
+        if ( end )
+            unlink( end );
+        free( end );
+    }
+
+    free( logs );
+    return ok;
+}
+
+/* A torn or corrupted tail ends the replay, it was never acknowledged as   */
+/* durable.                                                                  */
+static bool replayLog( struct ufsLsmStruct *lsm, uint64_t number )
+{
+    struct recordStruct record;
+    const uint8_t *curr, *end, *next;
+    uint8_t *data;
+    uint32_t checksum, keyLen, batchLen;
+    struct stat st;
+    char *path;
+    int fd;
+    bool ok;
+
+    path = filePath( lsm -> path, number, LOG_SUFFIX );
+    if ( !path ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    fd = open( path, O_RDONLY );
+    free( path );
+    if ( fd < 0 || fstat( fd, &st ) ) {
+        if ( fd >= 0 )
+            close( fd );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    if ( !st.st_size ) {
+        close( fd );
+        return true;
+    }
+
+    data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( data == MAP_FAILED ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    ok = true;
+    end = data + st.st_size;
+    for ( curr = data; ok && end - curr >= (ptrdiff_t) LOG_HEADER;
+          curr = next ) {
+        memcpy( &checksum, curr, sizeof( checksum ) );
+        memcpy( &keyLen, curr + sizeof( checksum ), sizeof( keyLen ) );
+        if ( keyLen ) {
+            next = decodeRecord( curr + sizeof( checksum ),
+                                 end - curr - sizeof( checksum ), &record );
+        } else {
+            memcpy( &batchLen, curr + sizeof( checksum ) + sizeof( keyLen ),
+                    sizeof( batchLen ) );
+            next = batchLen <= UFS_LSM_MAX_BATCH &&
+                   batchLen <= end - curr - LOG_HEADER ?
+                   curr + LOG_HEADER + batchLen : NULL;
+        }
+
+        if ( !next ||
+             checksum != (uint32_t) ufsHashBytes( curr + sizeof( checksum ),
+                                                  next - curr -
+                                                  sizeof( checksum ),
+                                                  LOG_SEED ) ||
+             ( !keyLen && !checkBatch( curr + LOG_HEADER, next ) ) )
+            break;
+
+        ok = keyLen ? memtableInsert( lsm -> mem, &record ) :
+                      insertBatch( lsm -> mem, curr + LOG_HEADER, next );
+    }
+
+    munmap( data, st.st_size );
+    return ok;
+}
+
+static bool newLog( struct ufsLsmStruct *lsm )
+{
+    char *path;
+
+    path = filePath( lsm -> path, lsm -> mem -> logNumber, LOG_SUFFIX );
+    if ( !path ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    lsm -> logFd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644 );
+    free( path );
+    if ( lsm -> logFd < 0 ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    return true;
+}
+
+static bool flushLog( struct ufsLsmStruct *lsm, bool sync )
+{
+    if ( lsm -> logUsed &&
+         !writeAll( lsm -> logFd, lsm -> logBuffer, lsm -> logUsed ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    lsm -> logUsed = 0;
+    if ( sync && fdatasync( lsm -> logFd ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    return true;
+}
+
+static bool appendRecord( struct ufsLsmStruct *lsm,
+                          const struct recordStruct *record )
+{
+    uint64_t size;
+    uint32_t checksum;
+    uint8_t *curr;
+
+    size = LOG_HEADER + record -> keyLen + record -> valueLen;
+    if ( lsm -> logUsed + size > LOG_BUFFER &&
+         !flushLog( lsm, lsm -> options.syncLog ) )
+        return false;
+
+    /* Records are bounded well below the size of the buffer.               */
+    curr = lsm -> logBuffer + lsm -> logUsed;
+    encodeRecord( curr + sizeof( checksum ), record );
+
+    checksum = ufsHashBytes( curr + sizeof( checksum ),
+                             size - sizeof( checksum ), LOG_SEED );
+    memcpy( curr, &checksum, sizeof( checksum ) );
+    lsm -> logUsed += size;
+    return true;
+}
+
+/* Batches that don't fit the buffer are written out on their own.           */
+static bool appendBatch( struct ufsLsmStruct *lsm,
+                         struct ufsLsmBatchStruct *batch )
+{
+    uint32_t keyLen, batchLen, checksum;
+
+    keyLen = 0;
+    batchLen = batch -> used - LOG_HEADER;
+    memcpy( batch -> data + sizeof( checksum ), &keyLen, sizeof( keyLen ) );
+    memcpy( batch -> data + sizeof( checksum ) + sizeof( keyLen ), &batchLen,
+            sizeof( batchLen ) );
+    checksum = ufsHashBytes( batch -> data + sizeof( checksum ),
+                             batch -> used - sizeof( checksum ), LOG_SEED );
+    memcpy( batch -> data, &checksum, sizeof( checksum ) );
+
+    if ( lsm -> logUsed + batch -> used > LOG_BUFFER &&
+         !flushLog( lsm, lsm -> options.syncLog &&
+                         batch -> used <= LOG_BUFFER ) )
+        return false;
+
+    if ( batch -> used <= LOG_BUFFER ) {
+        memcpy( lsm -> logBuffer + lsm -> logUsed, batch -> data,
+                batch -> used );
+        lsm -> logUsed += batch -> used;
+        return true;
+    }
+
+    if ( !writeAll( lsm -> logFd, batch -> data, batch -> used ) ||
+         ( lsm -> options.syncLog && fdatasync( lsm -> logFd ) ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    return true;
+}
+
+static bool batchAdd( struct ufsLsmBatchStruct *batch,
+                      const struct recordStruct *record )
+{
+    uint64_t size, capacity;
+    uint8_t *grown;
+
+    size = RECORD_HEADER + record -> keyLen + record -> valueLen;
+    if ( batch -> used - LOG_HEADER + size > UFS_LSM_MAX_BATCH ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( batch -> used + size > batch -> capacity ) {
+        for ( capacity = batch -> capacity * 2;
+              capacity < batch -> used + size; capacity *= 2 )
+            ;
+
+        grown = realloc( batch -> data, capacity );
+        if ( !grown ) {
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return false;
+        }
+
+        batch -> data = grown;
+        batch -> capacity = capacity;
+    }
+
+    encodeRecord( batch -> data + batch -> used, record );
+    batch -> used += size;
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+/* Whether data up to end is a whole number of records.                      */
+static bool checkBatch( const uint8_t *data, const uint8_t *end )
+{
+    struct recordStruct record;
+
+    while ( data && data < end ) {
+        data = decodeRecord( data, end - data, &record );
+        if ( data && !record.keyLen )
+            return false;
+    }
+
+    return data == end;
+}
+
+static bool insertBatch( struct memtableStruct *mem, const uint8_t *data,
+                         const uint8_t *end )
+{
+    struct recordStruct record;
+
+    while ( data < end ) {
+        data = decodeRecord( data, end - data, &record );
+        if ( !memtableInsert( mem, &record ) )
+            return false;
+    }
+
+    return true;
+}
+
+/* Freezes the memtable and starts a new one along with its log.            */
+static bool rotate( struct ufsLsmStruct *lsm )
+{
+    struct memtableStruct *mem;
+    ufsStatusType status;
+
+    if ( !flushLog( lsm, lsm -> options.syncLog ) )
+        return false;
+
+    pthread_mutex_lock( &lsm -> lock );
+    schedule( lsm );
+    while ( !lsm -> backgroundError &&
+            ( lsm -> imm || lsm -> current -> levels[0].count >=
+                            lsm -> options.level0StopRuns ) )
+        pthread_cond_wait( &lsm -> changed, &lsm -> lock );
+
+    status = lsm -> backgroundError;
+    mem = status ? NULL : memtableCreate( lsm -> nextFile++ );
+    pthread_mutex_unlock( &lsm -> lock );
+
+    if ( status ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    if ( !mem )
+        return false;
+
+    close( lsm -> logFd );
+    pthread_mutex_lock( &lsm -> lock );
+    lsm -> imm = lsm -> mem;
+    lsm -> mem = mem;
+    pthread_mutex_unlock( &lsm -> lock );
+
+    if ( !newLog( lsm ) )
+        return false;
+
+    pthread_mutex_lock( &lsm -> lock );
+    schedule( lsm );
+    pthread_mutex_unlock( &lsm -> lock );
+    return true;
+}
+
+static struct runStruct *writeMemtable( struct ufsLsmStruct *lsm,
+                                        struct memtableStruct *mem )
+{
+    struct runWriterStruct *writer;
+    struct skipNodeStruct *node;
+
+    writer = writerCreate( lsm );
+    if ( !writer )
+        return NULL;
+
+    for ( node = mem -> head -> next[0]; node; node = node -> next[0] ) {
+        if ( !writerAdd( writer, &node -> record ) ) {
+            writerAbort( writer );
+            return NULL;
+        }
+    }
+
+    return writerFinish( writer );
+}
+
+/* ----- background work ----                                                 */
+
+/* Called with the lock held.                                                */
+static void schedule( struct ufsLsmStruct *lsm )
+{
+    struct compactionStruct *compaction;
+    uint64_t level;
+
+    if ( lsm -> backgroundError || !lsm -> pool )
+        return;
+
+    if ( lsm -> imm && !lsm -> flushing ) {
+        lsm -> flushing = true;
+        lsm -> jobs++;
+        if ( !ufsPoolSubmit( lsm -> pool, flushJob, lsm ) ) {
+            lsm -> flushing = false;
+            lsm -> jobs--;
+        }
+    }
+
+    if ( lsm -> closing )
+        return;
+
+    for ( level = 0; level + 1 < UFS_LSM_LEVELS; level++ ) {
+        if ( lsm -> levelBusy[ level ] || lsm -> levelBusy[ level + 1 ] ||
+             !needsCompaction( lsm, level ) )
+            continue;
+
+        compaction = pickCompaction( lsm, level );
+        if ( !compaction )
+            continue;
+
+        lsm -> jobs++;
+        if ( !ufsPoolSubmit( lsm -> pool, compactJob, compaction ) ) {
+            lsm -> jobs--;
+            freeCompaction( compaction );
+        }
+    }
+}
+
+static bool needsCompaction( struct ufsLsmStruct *lsm, uint64_t level )
+{
+    uint64_t limit, i;
+
+    if ( !level )
+        return lsm -> current -> levels[0].count >= lsm -> options.level0Runs;
+
+    limit = lsm -> options.levelBytes;
+    for ( i = 1; i < level; i++ )
+        limit *= lsm -> options.levelRatio;
+
+    return lsm -> current -> levels[ level ].bytes > limit;
+}
+
+/* Level 0 runs overlap so all of them go, other levels give one run, in    */
+/* turns. Called with the lock held.                                         */
+static struct compactionStruct *pickCompaction( struct ufsLsmStruct *lsm,
+                                                uint64_t level )
+{
+    struct compactionStruct *compaction;
+    struct levelStruct *inputs, *next;
+    struct recordStruct smallest, largest;
+    struct runStruct *run;
+    uint64_t i;
+
+    inputs = &lsm -> current -> levels[ level ];
+    next = &lsm -> current -> levels[ level + 1 ];
+
+    compaction = calloc( 1, sizeof( *compaction ) );
+    if ( !compaction )
+        return NULL;
+
+    compaction -> lsm = lsm;
+    compaction -> level = level;
+    compaction -> inputs = malloc( inputs -> count * sizeof( run ) );
+    compaction -> overlaps = malloc( ( next -> count + 1 ) * sizeof( run ) );
+    if ( !compaction -> inputs || !compaction -> overlaps ) {
+        freeCompaction( compaction );
+        return NULL;
+    }
+
+    if ( level ) {
+        run = inputs -> runs[ lsm -> cursors[ level ]++ % inputs -> count ];
+        compaction -> inputs[ compaction -> numInputs++ ] = run;
+    } else {
+        for ( i = 0; i < inputs -> count; i++ )
+            compaction -> inputs[ compaction -> numInputs++ ] =
+                inputs -> runs[i];
+    }
+
+    smallest = compaction -> inputs[0] -> smallest;
+    largest = compaction -> inputs[0] -> largest;
+    for ( i = 1; i < compaction -> numInputs; i++ ) {
+        run = compaction -> inputs[i];
+        if ( compareKeys( run -> smallest.key, run -> smallest.keyLen,
+                          smallest.key, smallest.keyLen ) < 0 )
+            smallest = run -> smallest;
+        if ( compareKeys( run -> largest.key, run -> largest.keyLen,
+                          largest.key, largest.keyLen ) > 0 )
+            largest = run -> largest;
+    }
+
+    for ( i = 0; i < next -> count; i++ ) {
+        if ( runOverlaps( next -> runs[i], &smallest, &largest ) )
+            compaction -> overlaps[ compaction -> numOverlaps++ ] =
+                next -> runs[i];
+    }
+
+    /* Nothing moves into deeper levels while level + 1 is busy.            */
+    compaction -> bottom = true;
+    for ( i = level + 2; i < UFS_LSM_LEVELS; i++ )
+        compaction -> bottom &= !lsm -> current -> levels[i].count;
+
+    for ( i = 0; i < compaction -> numInputs; i++ )
+        compaction -> inputs[i] -> refs++;
+    for ( i = 0; i < compaction -> numOverlaps; i++ )
+        compaction -> overlaps[i] -> refs++;
+
+    lsm -> levelBusy[ level ] = lsm -> levelBusy[ level + 1 ] = true;
+    return compaction;
+}
+
+/* Called with the lock held.                                                */
+static void freeCompaction( struct compactionStruct *compaction )
+{
+    uint64_t i;
+
+    if ( compaction -> inputs && compaction -> overlaps ) {
+        compaction -> lsm -> levelBusy[ compaction -> level ] = false;
+        compaction -> lsm -> levelBusy[ compaction -> level + 1 ] = false;
+    }
+
+    for ( i = 0; i < compaction -> numInputs; i++ )
+        runUnref( compaction -> inputs[i] );
+    for ( i = 0; i < compaction -> numOverlaps; i++ )
+        runUnref( compaction -> overlaps[i] );
+
+    free( compaction -> inputs );
+    free( compaction -> overlaps );
+    free( compaction );
+}
+
+static void flushJob( void *arg )
+{
+    struct ufsLsmStruct *lsm;
+    struct versionStruct *version;
+    struct runStruct *run;
+    char *logPath;
+    bool ok;
+
+    lsm = arg;
+    run = writeMemtable( lsm, lsm -> imm );
+
+    pthread_mutex_lock( &lsm -> lock );
+    version = run ? versionCopy( lsm -> current ) : NULL;
+    ok = version && versionAdd( version, 0, run );
+    if ( ok ) {
+        lsm -> manifestLog = lsm -> mem -> logNumber;
+        ok = writeManifest( lsm, version );
+    }
+
+    if ( ok ) {
+        versionUnref( lsm -> current );
+        lsm -> current = version;
+
+        logPath = filePath( lsm -> path, lsm -> imm -> logNumber, LOG_SUFFIX );
+        if ( logPath )
+            unlink( logPath );
+        free( logPath );
+
+        memtableUnref( lsm -> imm );
+        lsm -> imm = NULL;
+    } else {
+        if ( version )
+            versionUnref( version );
+        if ( run )
+            run -> obsolete = true;
+        lsm -> backgroundError = ufsErrno ? ufsErrno : UFS_UNKNOWN_ERROR;
+    }
+
+    if ( run )
+        runUnref( run );
+
+    lsm -> flushing = false;
+    finishJob( lsm );
+    pthread_mutex_unlock( &lsm -> lock );
+}
+
+static void compactJob( void *arg )
+{
+    struct compactionStruct *compaction;
+    struct ufsLsmStruct *lsm;
+    struct versionStruct *version;
+    struct sourceStruct *sources;
+    struct runWriterStruct *writer;
+    struct recordStruct record;
+    struct runStruct **outputs, **grown;
+    uint64_t numSources, numOutputs, capacity, i;
+    bool ok, more;
+
+    compaction = arg;
+    lsm = compaction -> lsm;
+    numSources = compaction -> numInputs + compaction -> numOverlaps;
+    sources = calloc( numSources, sizeof( *sources ) );
+    outputs = NULL;
+    numOutputs = capacity = 0;
+    writer = NULL;
+    ok = sources;
+    if ( !ok )
+        ufsErrno = UFS_OUT_OF_MEMORY;
+
+    /* Inputs are newer than the runs they overlap.                          */
+    for ( i = 0; ok && i < compaction -> numInputs; i++ )
+        sourceSeekRun( &sources[i], compaction -> inputs[i], NULL, 0 );
+    for ( i = 0; ok && i < compaction -> numOverlaps; i++ )
+        sourceSeekRun( &sources[ compaction -> numInputs + i ],
+                       compaction -> overlaps[i], NULL, 0 );
+
+    more = ok;
+    while ( ok && ( writer || more ) ) {
+        more = more && mergeNext( sources, numSources, &record );
+        if ( !more && !writer )
+            break;
+
+        if ( more && record.tombstone && compaction -> bottom )
+            continue;
+
+        if ( more && !writer ) {
+            writer = writerCreate( lsm );
+            ok = writer;
+        }
+
+        ok = ok && ( !more || writerAdd( writer, &record ) );
+        if ( !ok || ( more && writerBytes( writer ) < lsm -> options.runBytes ) )
+            continue;
+
+        /* The run is full or the inputs ran out.                            */
+        if ( numOutputs == capacity ) {
+            capacity = capacity ? capacity * 2 : 8;
+            grown = realloc( outputs, capacity * sizeof( *outputs ) );
+            if ( !grown ) {
+                ufsErrno = UFS_OUT_OF_MEMORY;
+                ok = false;
+                continue;
+            }
+
+            outputs = grown;
+        }
+
+        outputs[ numOutputs ] = writerFinish( writer );
+        writer = NULL;
+        ok = outputs[ numOutputs ];
+        numOutputs += ok;
+    }
+
+    if ( writer )
+        writerAbort( writer );
+
+    free( sources );
+
+    pthread_mutex_lock( &lsm -> lock );
+    version = ok ? versionCopy( lsm -> current ) : NULL;
+    ok = version;
+    for ( i = 0; ok && i < compaction -> numInputs; i++ )
+        versionRemove( version, compaction -> level, compaction -> inputs[i] );
+    for ( i = 0; ok && i < compaction -> numOverlaps; i++ )
+        versionRemove( version, compaction -> level + 1,
+                       compaction -> overlaps[i] );
+    for ( i = 0; ok && i < numOutputs; i++ )
+        ok = versionAdd( version, compaction -> level + 1, outputs[i] );
+
+    ok = ok && writeManifest( lsm, version );
+    if ( ok ) {
+        versionUnref( lsm -> current );
+        lsm -> current = version;
+
+        for ( i = 0; i < compaction -> numInputs; i++ )
+            compaction -> inputs[i] -> obsolete = true;
+        for ( i = 0; i < compaction -> numOverlaps; i++ )
+            compaction -> overlaps[i] -> obsolete = true;
+    } else {
+        if ( version )
+            versionUnref( version );
+        for ( i = 0; i < numOutputs; i++ )
+            outputs[i] -> obsolete = true;
+        lsm -> backgroundError = ufsErrno ? ufsErrno : UFS_UNKNOWN_ERROR;
+    }
+
+    for ( i = 0; i < numOutputs; i++ )
+        runUnref( outputs[i] );
+    free( outputs );
+
+    freeCompaction( compaction );
+    finishJob( lsm );
+    pthread_mutex_unlock( &lsm -> lock );
+}
+
+/* Called with the lock held.                                                */
+static void finishJob( struct ufsLsmStruct *lsm )
+{
+    lsm -> jobs--;
+    schedule( lsm );
+    pthread_cond_broadcast( &lsm -> changed );
+}
+
+static bool validOptions( const struct ufsLsmOptionsStruct *options )
+{
+    return options -> memtableBytes >= 4096 &&
+           options -> blockBytes >= 256 &&
+           options -> bloomBitsPerKey >= 1 &&
+           options -> bloomBitsPerKey <= 64 &&
+           options -> level0Runs >= 1 &&
+           options -> level0StopRuns > options -> level0Runs &&
+           options -> levelBytes >= options -> memtableBytes &&
+           options -> levelRatio >= 2 &&
+           options -> runBytes >= options -> blockBytes &&
+           options -> numThreads >= 1 &&
+           options -> numThreads <= UFS_POOL_MAX_THREADS;
+}
+
+static bool checkSizes( uint64_t keyLen, uint64_t valueLen )
+{
+    return keyLen <= UFS_LSM_MAX_KEY && valueLen <= UFS_LSM_MAX_VALUE;
+}
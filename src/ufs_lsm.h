@@ -0,0 +1,371 @@
+/******************************************************************************\
+*  ufs_lsm.h                                                                   *
+*                                                                              *
+*  Internal header for the log structured key value engine.                    *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* An lsm lives in a directory. Writes are appended to a log and applied to  */
+/* an in memory skip list ( the memtable ). A full memtable is frozen and a  */
+/* worker writes it out as an immutable sorted run at level 0. Runs are made */
+/* of data blocks, a block index holding the last key of every block and a   */
+/* Bloom filter over all keys, they are mapped read only.                     */
+/*                                                                            */
+/* Compaction is leveled: once level 0 holds level0Runs runs they are merged */
+/* into level 1, once level n > 0 holds more than                            */
+/* levelBytes * levelRatio ^ ( n - 1 ) bytes one of its runs is merged into  */
+/* level n + 1. Runs of a level above 0 never overlap. Compactions of        */
+/* disjoint levels run in parallel on a pool of numThreads workers.           */
+/* levelRatio trades write amplification ( low ratio, more levels ) for read  */
+/* and space amplification.                                                   */
+/*                                                                            */
+/* Reads merge the memtable, the frozen memtable and the runs from newest to */
+/* oldest, the first record found for a key wins and a deletion record hides */
+/* the key.                                                                   */
+/*                                                                            */
+/* The log is written through a buffer, ufsLsmSync and ufsLsmClose write it  */
+/* out, syncLog makes every write out durable with fdatasync. A crash loses  */
+/* at most the buffered tail of the log.                                      */
+/*                                                                            */
+/* A batch is appended as a single checksummed log record, a crash keeps all */
+/* of its changes or none of them.                                           */
+/*                                                                            */
+/* An lsm must be used by one thread at a time, the workers only touch state */
+/* the caller can't change.                                                   */
+
+#ifndef UFS_LSM_H
+#define UFS_LSM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs_defs.h"
+
+#define UFS_LSM_LEVELS (7)
+#define UFS_LSM_MAX_KEY (8192)
+#define UFS_LSM_MAX_VALUE (8192)
+/* The changes of a batch take at most this many bytes in the log.           */
+#define UFS_LSM_MAX_BATCH ( 1024 * 1024 * 1024 )
+
+typedef struct ufsLsmStruct *ufsLsmPtr;
+typedef struct ufsLsmBatchStruct *ufsLsmBatchPtr;
+
+/* Return false to stop the iteration.                                       */
+typedef bool (*ufsLsmIter)( const uint8_t *key, uint64_t keyLen,
+                            const uint8_t *value, uint64_t valueLen,
+                            void *userData );
+
+struct ufsLsmOptionsStruct {
+    /* A memtable is frozen once it holds this many bytes.                   */
+    uint64_t memtableBytes;
+    uint64_t blockBytes;
+    uint64_t bloomBitsPerKey;
+    /* Level 0 is compacted at level0Runs runs, writes wait at               */
+    /* level0StopRuns runs.                                                  */
+    uint64_t level0Runs;
+    uint64_t level0StopRuns;
+    /* The size of level 1, each level is levelRatio times the one above.    */
+    uint64_t levelBytes;
+    uint64_t levelRatio;
+    /* Compaction splits its output into runs of about this size.            */
+    uint64_t runBytes;
+    uint64_t numThreads;
+    bool syncLog;
+};
+
+extern const struct ufsLsmOptionsStruct ufsLsmDefaultOptions;
+
+/******************************************************************************\
+* ufsLsmOpen                                                                   *
+*                                                                              *
+*  Opens the lsm in the directory path, creating it if needed.                 *
+*  The logs left by the previous instance are replayed and written out as a    *
+*  level 0 run.                                                                *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: path or options are NULL or the options are out of range.    *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_IMAGE_IS_CORRUPTED: The manifest or one of the runs is corrupted.      *
+*   UFS_UNKNOWN_ERROR: The directory or one of its files could not be used.    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -path: The directory of the lsm.                                            *
+*  -options: The tuning of the lsm, see ufsLsmDefaultOptions.                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsLsmPtr: The opened lsm, NULL on error.                                  *
+*                                                                              *
+\******************************************************************************/
+ufsLsmPtr ufsLsmOpen( const char *path,
+                      const struct ufsLsmOptionsStruct *options );
+
+/******************************************************************************\
+* ufsLsmClose                                                                  *
+*                                                                              *
+*  Writes out the log, waits for running background work and frees lsm.       *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lsm: The lsm, may be NULL.                                                 *
+*                                                                              *
+\******************************************************************************/
+void ufsLsmClose( ufsLsmPtr lsm );
+
+/******************************************************************************\
+* ufsLsmPut                                                                    *
+*                                                                              *
+*  Sets the value of key, replacing any previous value.                        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: lsm or key are NULL, key is empty or a size is too large.    *
+*   UFS_OUT_OF_MEMORY: The memtable could not grow.                            *
+*   UFS_UNKNOWN_ERROR: The log could not be written or background work failed. *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lsm: The lsm.                                                              *
+*  -key: The key.                                                              *
+*  -keyLen: The length of key, at most UFS_LSM_MAX_KEY.                        *
+*  -value: The value, may be NULL when valueLen is 0.                          *
+*  -valueLen: The length of value, at most UFS_LSM_MAX_VALUE.                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsLsmPut( ufsLsmPtr lsm, const void *key, uint64_t keyLen,
+                const void *value, uint64_t valueLen );
+
+/******************************************************************************\
+* ufsLsmDelete                                                                 *
+*                                                                              *
+*  Removes key, removing a missing key is not an error.                        *
+*                                                                              *
+*  Possible errors: as ufsLsmPut.                                              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lsm: The lsm.                                                              *
+*  -key: The key.                                                              *
+*  -keyLen: The length of key, at most UFS_LSM_MAX_KEY.                        *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsLsmDelete( ufsLsmPtr lsm, const void *key, uint64_t keyLen );
+
+/******************************************************************************\
+* ufsLsmBatchCreate                                                            *
+*                                                                              *
+*  Creates an empty batch of changes, see ufsLsmWrite.                         *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsLsmBatchPtr: The batch, NULL on error.                                  *
+*                                                                              *
+\******************************************************************************/
+ufsLsmBatchPtr ufsLsmBatchCreate( void );
+
+/******************************************************************************\
+* ufsLsmBatchFree                                                              *
+*                                                                              *
+*  Frees a batch, whether it was written or not.                               *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -batch: The batch, may be NULL.                                             *
+*                                                                              *
+\******************************************************************************/
+void ufsLsmBatchFree( ufsLsmBatchPtr batch );
+
+/******************************************************************************\
+* ufsLsmBatchPut                                                               *
+*                                                                              *
+*  Adds the setting of key to a batch, a later change of the same key in the   *
+*  batch wins.                                                                 *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: batch or key are NULL, key is empty, a size is too large or  *
+*                 the batch would exceed UFS_LSM_MAX_BATCH.                    *
+*   UFS_OUT_OF_MEMORY: The batch could not grow.                               *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -batch: The batch.                                                          *
+*  -key: The key.                                                              *
+*  -keyLen: The length of key, at most UFS_LSM_MAX_KEY.                        *
+*  -value: The value, may be NULL when valueLen is 0.                          *
+*  -valueLen: The length of value, at most UFS_LSM_MAX_VALUE.                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsLsmBatchPut( ufsLsmBatchPtr batch, const void *key, uint64_t keyLen,
+                     const void *value, uint64_t valueLen );
+
+/******************************************************************************\
+* ufsLsmBatchDelete                                                            *
+*                                                                              *
+*  Adds the removal of key to a batch.                                         *
+*                                                                              *
+*  Possible errors: as ufsLsmBatchPut.                                         *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -batch: The batch.                                                          *
+*  -key: The key.                                                              *
+*  -keyLen: The length of key, at most UFS_LSM_MAX_KEY.                        *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsLsmBatchDelete( ufsLsmBatchPtr batch, const void *key,
+                        uint64_t keyLen );
+
+/******************************************************************************\
+* ufsLsmWrite                                                                  *
+*                                                                              *
+*  Applies the changes of a batch in the order they were added. The log holds  *
+*  all of them or none, an empty batch changes nothing. The batch is left as   *
+*  it was.                                                                     *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: lsm or batch are NULL.                                       *
+*   UFS_OUT_OF_MEMORY: The memtable could not grow.                            *
+*   UFS_UNKNOWN_ERROR: The log could not be written or background work failed. *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lsm: The lsm.                                                              *
+*  -batch: The changes.                                                        *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsLsmWrite( ufsLsmPtr lsm, ufsLsmBatchPtr batch );
+
+/******************************************************************************\
+* ufsLsmGet                                                                    *
+*                                                                              *
+*  Looks key up and copies up to valueSize bytes of its value to value.        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: lsm or key are NULL or value is NULL while valueSize isn't 0.*
+*   UFS_DOES_NOT_EXIST: There is no such key.                                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lsm: The lsm.                                                              *
+*  -key: The key.                                                              *
+*  -keyLen: The length of key.                                                 *
+*  -value: Receives the value, may be NULL to only check for the key.          *
+*  -valueSize: The size of value.                                              *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int64_t: The length of the value, which may exceed valueSize, -1 on error. *
+*                                                                              *
+\******************************************************************************/
+int64_t ufsLsmGet( ufsLsmPtr lsm, const void *key, uint64_t keyLen,
+                   void *value, uint64_t valueSize );
+
+/******************************************************************************\
+* ufsLsmScan                                                                   *
+*                                                                              *
+*  Calls iter on every key starting with prefix, in key order.                 *
+*  iter must not modify lsm.                                                   *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: lsm or iter are NULL, or prefix is NULL while prefixLen      *
+*                 isn't 0.                                                     *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lsm: The lsm.                                                              *
+*  -prefix: The prefix, every key starts with the empty prefix.                *
+*  -prefixLen: The length of prefix.                                           *
+*  -iter: Called with every key and value.                                     *
+*  -userData: Passed to iter.                                                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsLsmScan( ufsLsmPtr lsm, const void *prefix, uint64_t prefixLen,
+                 ufsLsmIter iter, void *userData );
+
+/******************************************************************************\
+* ufsLsmSync                                                                   *
+*                                                                              *
+*  Writes out the log and makes it durable.                                    *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: lsm is NULL.                                                 *
+*   UFS_UNKNOWN_ERROR: The log could not be written.                           *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lsm: The lsm.                                                              *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsLsmSync( ufsLsmPtr lsm );
+
+/******************************************************************************\
+* ufsLsmCompact                                                                *
+*                                                                              *
+*  Writes out the memtable and waits until no level needs compaction.          *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: lsm is NULL.                                                 *
+*   UFS_UNKNOWN_ERROR: Background work failed.                                 *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lsm: The lsm.                                                              *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsLsmCompact( ufsLsmPtr lsm );
+
+/******************************************************************************\
+* ufsLsmNumRuns                                                                *
+*                                                                              *
+*  Gets the number of runs in a level.                                         *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -lsm: The lsm.                                                              *
+*  -level: The level, below UFS_LSM_LEVELS.                                    *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The number of runs, 0 for bad arguments.                         *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsLsmNumRuns( ufsLsmPtr lsm, uint64_t level );
+
+#endif /* UFS_LSM_H */
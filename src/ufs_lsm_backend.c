@@ -0,0 +1,1092 @@
+/******************************************************************************\
+*  ufs_lsm_backend.c                                                           *
+*                                                                              *
+*  Contains the log structured backend of ufs.                                 *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* Every record of the index is a key of the lsm, identifiers are stored big */
+/* endian so that key order is identifier order:                              */
+/*   'S' id                -> parent, isDir, name                             */
+/*   'N' parent name       -> id                                              */
+/*   'A' id                -> name                                            */
+/*   'a' name              -> id                                              */
+/*   'M' storage area      -> ( empty )                                       */
+/*   'm' area storage      -> ( empty )                                       */
+/* Mappings are kept twice so that both the mappings of a storage and the    */
+/* mappings of an area are a prefix scan. Storage is in BASE when the 'M'    */
+/* scan of it is empty.                                                       */
+/*                                                                            */
+/* Resolving walks the view in order with point lookups, which the Bloom     */
+/* filters of the runs answer without touching their data for the areas that */
+/* don't map the storage.                                                     */
+/*                                                                            */
+/* Every change is one batch appended to the log of the lsm, so a crash      */
+/* never leaves half of it, the cost of keeping the runs sorted is paid by   */
+/* its background compactions.                                               */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ufs.h"
+#include "ufs_backend.h"
+#include "ufs_defs.h"
+#include "ufs_lsm.h"
+
+#define BASE_NAME ("BASE")
+
+#define TAG_STORAGE ('S')
+#define TAG_STORAGE_NAME ('N')
+#define TAG_AREA ('A')
+#define TAG_AREA_NAME ('a')
+#define TAG_MAPPING ('M')
+#define TAG_AREA_MAPPING ('m')
+
+/* Passed to makeKey for the identifiers a key doesn't have.                */
+#define NO_ID (-1)
+#define ID_BYTES (8)
+#define MAX_NAME ( UFS_LSM_MAX_KEY - 1 - ID_BYTES )
+
+/* storageKind answers with one of these.                                    */
+#define KIND_NONE (0)
+#define KIND_FILE (1)
+#define KIND_DIRECTORY (2)
+
+struct lsmBackendStruct {
+    ufsLsmPtr lsm;
+    ufsIdentifierType lastStorage,
+                      lastArea;
+};
+
+/* Gathers the identifiers found by a scan.                                  */
+struct collectStruct {
+    ufsIdentifierType *ids;
+    uint64_t count, capacity;
+    /* The identifier is the value rather than the end of the key.          */
+    bool fromValue;
+    bool failed;
+};
+
+static uint64_t makeKey( uint8_t *key, uint8_t tag, int64_t first,
+                         int64_t second, const char *name );
+static void encodeId( uint8_t *dst, int64_t id );
+static int64_t decodeId( const uint8_t *src );
+static int64_t storageKind( struct lsmBackendStruct *self,
+                            ufsIdentifierType storage,
+                            ufsIdentifierType *parent, char *name );
+static ufsIdentifierType findId( struct lsmBackendStruct *self,
+                                 const uint8_t *key, uint64_t keyLen );
+static int64_t areaExists( struct lsmBackendStruct *self,
+                           ufsIdentifierType area );
+static int64_t hasKeys( struct lsmBackendStruct *self, const uint8_t *prefix,
+                        uint64_t prefixLen );
+static bool collect( struct lsmBackendStruct *self, const uint8_t *prefix,
+                     uint64_t prefixLen, bool fromValue,
+                     struct collectStruct *ids );
+static bool collectIter( const uint8_t *key, uint64_t keyLen,
+                         const uint8_t *value, uint64_t valueLen,
+                         void *userData );
+static bool lastIdIter( const uint8_t *key, uint64_t keyLen,
+                        const uint8_t *value, uint64_t valueLen,
+                        void *userData );
+static bool firstKeyIter( const uint8_t *key, uint64_t keyLen,
+                          const uint8_t *value, uint64_t valueLen,
+                          void *userData );
+static int64_t contains( struct lsmBackendStruct *self,
+                         ufsIdentifierType area, ufsIdentifierType storage );
+static bool putMapping( ufsLsmBatchPtr batch, ufsIdentifierType area,
+                        ufsIdentifierType storage );
+static bool removeMapping( ufsLsmBatchPtr batch, ufsIdentifierType area,
+                           ufsIdentifierType storage );
+static bool removeMappings( struct lsmBackendStruct *self,
+                            ufsLsmBatchPtr batch, uint8_t tag,
+                            ufsIdentifierType id );
+static bool commit( struct lsmBackendStruct *self, ufsLsmBatchPtr batch,
+                    bool ok );
+static ufsIdentifierType addStorage( struct lsmBackendStruct *self,
+                                     ufsIdentifierType parent,
+                                     const char *name, bool directory );
+static ufsStatusType removeStorage( struct lsmBackendStruct *self,
+                                    ufsIdentifierType storage,
+                                    bool directory );
+static uint64_t checkView( struct lsmBackendStruct *self, ufsViewType view );
+static ufsStatusType setStatus( ufsStatusType status );
+static bool numberOption( const char *opts, const char *key,
+                          uint64_t *value );
+
+static void *lsmInit( const char *opts );
+static void lsmDestroy( void *backend );
+static ufsIdentifierType lsmAddDirectory( void *backend, const char *name );
+static ufsIdentifierType lsmAddFile( void *backend,
+                                     ufsIdentifierType directory,
+                                     const char *name );
+static ufsIdentifierType lsmAddArea( void *backend, const char *name );
+static ufsIdentifierType lsmGetDirectory( void *backend, const char *name );
+static ufsIdentifierType lsmGetFile( void *backend,
+                                     ufsIdentifierType directory,
+                                     char *name );
+static ufsIdentifierType lsmGetArea( void *backend, const char *name );
+static ufsStatusType lsmRemoveDirectory( void *backend,
+                                         ufsIdentifierType directory );
+static ufsStatusType lsmRemoveFile( void *backend, ufsIdentifierType file );
+static ufsStatusType lsmRemoveArea( void *backend, ufsIdentifierType area );
+static ufsStatusType lsmAddMapping( void *backend,
+                                    ufsIdentifierType area,
+                                    ufsIdentifierType storage );
+static ufsStatusType lsmProbeMapping( void *backend,
+                                      ufsIdentifierType area,
+                                      ufsIdentifierType storage );
+static ufsIdentifierType lsmResolveStorageInView( void *backend,
+                                                  ufsViewType view,
+                                                  ufsIdentifierType storage );
+static ufsStatusType lsmIterateDirInView( void *backend,
+                                          ufsViewType view,
+                                          ufsIdentifierType directory,
+                                          ufsDirIter iterator,
+                                          void *userData );
+static ufsStatusType lsmCollapse( void *backend, ufsViewType view );
+
+const struct ufsBackendOps ufsLsmBackendOps = {
+    .name = "lsm",
+    .init = lsmInit,
+    .destroy = lsmDestroy,
+    .addDirectory = lsmAddDirectory,
+    .addFile = lsmAddFile,
+    .addArea = lsmAddArea,
+    .getDirectory = lsmGetDirectory,
+    .getFile = lsmGetFile,
+    .getArea = lsmGetArea,
+    .removeDirectory = lsmRemoveDirectory,
+    .removeFile = lsmRemoveFile,
+    .removeArea = lsmRemoveArea,
+    .addMapping = lsmAddMapping,
+    .probeMapping = lsmProbeMapping,
+    .resolveStorageInView = lsmResolveStorageInView,
+    .iterateDirInView = lsmIterateDirInView,
+    .collapse = lsmCollapse,
+};
+
+/* Options: path=<directory>, without it the lsm goes in UFS_LSM_DIR.       */
+/* memtable=, block=, l0runs=, ratio=, threads= and sync= set the matching  */
+/* ufsLsmOptionsStruct fields.                                               */
+static void *lsmInit( const char *opts )
+{
+    struct ufsLsmOptionsStruct options;
+    struct lsmBackendStruct *self;
+    char path[ PATH_MAX ];
+    ufsStatusType status;
+    uint64_t sync;
+    uint8_t tag;
+
+    options = ufsLsmDefaultOptions;
+    sync = options.syncLog;
+    if ( !numberOption( opts, "memtable", &options.memtableBytes ) ||
+         !numberOption( opts, "block", &options.blockBytes ) ||
+         !numberOption( opts, "l0runs", &options.level0Runs ) ||
+         !numberOption( opts, "ratio", &options.levelRatio ) ||
+         !numberOption( opts, "threads", &options.numThreads ) ||
+         !numberOption( opts, "sync", &sync ) )
+        return NULL;
+
+    options.syncLog = sync;
+    if ( options.level0StopRuns < 3 * options.level0Runs )
+        options.level0StopRuns = 3 * options.level0Runs;
+    if ( options.levelBytes < options.memtableBytes )
+        options.levelBytes = options.memtableBytes;
+
+    if ( !ufsBackendOption( opts, "path", 0, path, sizeof( path ) ) ) {
+        if ( ufsErrno != UFS_DOES_NOT_EXIST )
+            return NULL;
+
+        if ( mkdir( UFS_DIRECTORY, 0755 ) && errno != EEXIST ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            return NULL;
+        }
+
+        strcpy( path, UFS_LSM_DIR );
+    }
+
+    self = calloc( 1, sizeof( *self ) );
+    if ( !self ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    self -> lsm = ufsLsmOpen( path, &options );
+    if ( !self -> lsm )
+        goto error;
+
+    /* Identifiers are never handed out twice while the lsm is open.        */
+    tag = TAG_STORAGE;
+    if ( !ufsLsmScan( self -> lsm, &tag, 1, lastIdIter,
+                      &self -> lastStorage ) )
+        goto error;
+
+    tag = TAG_AREA;
+    if ( !ufsLsmScan( self -> lsm, &tag, 1, lastIdIter, &self -> lastArea ) )
+        goto error;
+
+    ufsErrno = UFS_NO_ERROR;
+    return self;
+
+error:
+    status = ufsErrno;
+    lsmDestroy( self );
+    ufsErrno = status;
+    return NULL;
+}
+
+static void lsmDestroy( void *backend )
+{
+    struct lsmBackendStruct *self;
+
+    if ( !backend )
+        return;
+
+    self = backend;
+    ufsLsmClose( self -> lsm );
+    free( self );
+}
+
+static ufsIdentifierType lsmAddDirectory( void *backend, const char *name )
+{
+    if ( !backend || !name || !*name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    return addStorage( backend, 0, name, true );
+}
+
+static ufsIdentifierType lsmAddFile( void *backend,
+                                     ufsIdentifierType directory,
+                                     const char *name )
+{
+    int64_t kind;
+
+    if ( !backend || !name || !*name || directory <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    kind = storageKind( backend, directory, NULL, NULL );
+    if ( kind < 0 )
+        return -1;
+
+    if ( kind != KIND_DIRECTORY ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    return addStorage( backend, directory, name, false );
+}
+
+static ufsIdentifierType lsmAddArea( void *backend, const char *name )
+{
+    struct lsmBackendStruct *self;
+    uint8_t key[ UFS_LSM_MAX_KEY ], value[ ID_BYTES ];
+    ufsIdentifierType found;
+    ufsLsmBatchPtr batch;
+    uint64_t keyLen;
+    bool ok;
+
+    self = backend;
+    if ( !self || !name || !*name || !strcmp( name, BASE_NAME ) ||
+         strlen( name ) > MAX_NAME ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    keyLen = makeKey( key, TAG_AREA_NAME, NO_ID, NO_ID, name );
+    found = findId( self, key, keyLen );
+    if ( found ) {
+        ufsErrno = found < 0 ? ufsErrno : UFS_ALREADY_EXISTS;
+        return -1;
+    }
+
+    batch = ufsLsmBatchCreate();
+    encodeId( value, self -> lastArea + 1 );
+    ok = batch && ufsLsmBatchPut( batch, key, keyLen, value, sizeof( value ) );
+
+    keyLen = makeKey( key, TAG_AREA, self -> lastArea + 1, NO_ID, NULL );
+    ok = ok && ufsLsmBatchPut( batch, key, keyLen, name, strlen( name ) );
+    if ( !commit( self, batch, ok ) )
+        return -1;
+
+    ufsErrno = UFS_NO_ERROR;
+    return ++self -> lastArea;
+}
+
+static ufsIdentifierType lsmGetDirectory( void *backend, const char *name )
+{
+    uint8_t key[ UFS_LSM_MAX_KEY ];
+    ufsIdentifierType id;
+    int64_t kind;
+
+    if ( !backend || !name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( strlen( name ) > MAX_NAME ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    id = findId( backend, key,
+                 makeKey( key, TAG_STORAGE_NAME, 0, NO_ID, name ) );
+    if ( id <= 0 ) {
+        ufsErrno = id < 0 ? ufsErrno : UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    kind = storageKind( backend, id, NULL, NULL );
+    if ( kind < 0 )
+        return -1;
+
+    if ( kind != KIND_DIRECTORY ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+static ufsIdentifierType lsmGetFile( void *backend,
+                                     ufsIdentifierType directory,
+                                     char *name )
+{
+    uint8_t key[ UFS_LSM_MAX_KEY ];
+    ufsIdentifierType id;
+
+    if ( !backend || !name || directory <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( strlen( name ) > MAX_NAME ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    id = findId( backend, key,
+                 makeKey( key, TAG_STORAGE_NAME, directory, NO_ID, name ) );
+    if ( id <= 0 ) {
+        ufsErrno = id < 0 ? ufsErrno : UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+static ufsIdentifierType lsmGetArea( void *backend, const char *name )
+{
+    uint8_t key[ UFS_LSM_MAX_KEY ];
+    ufsIdentifierType id;
+
+    if ( !backend || !name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( strlen( name ) > MAX_NAME ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    id = findId( backend, key,
+                 makeKey( key, TAG_AREA_NAME, NO_ID, NO_ID, name ) );
+    if ( id <= 0 ) {
+        ufsErrno = id < 0 ? ufsErrno : UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+static ufsStatusType lsmRemoveDirectory( void *backend,
+                                         ufsIdentifierType directory )
+{
+    return removeStorage( backend, directory, true );
+}
+
+static ufsStatusType lsmRemoveFile( void *backend, ufsIdentifierType file )
+{
+    return removeStorage( backend, file, false );
+}
+
+static ufsStatusType lsmRemoveArea( void *backend, ufsIdentifierType area )
+{
+    struct lsmBackendStruct *self;
+    uint8_t key[ UFS_LSM_MAX_KEY ];
+    char name[ MAX_NAME + 1 ];
+    ufsLsmBatchPtr batch;
+    int64_t nameLen;
+
+    self = backend;
+    if ( !self || area <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    nameLen = ufsLsmGet( self -> lsm, key,
+                         makeKey( key, TAG_AREA, area, NO_ID, NULL ),
+                         name, MAX_NAME );
+    if ( nameLen < 0 )
+        return ufsErrno;
+
+    name[ nameLen ] = '\0';
+    batch = ufsLsmBatchCreate();
+    if ( !commit( self, batch,
+                  batch &&
+                  removeMappings( self, batch, TAG_AREA_MAPPING, area ) &&
+                  ufsLsmBatchDelete( batch, key,
+                                     makeKey( key, TAG_AREA_NAME, NO_ID,
+                                              NO_ID, name ) ) &&
+                  ufsLsmBatchDelete( batch, key,
+                                     makeKey( key, TAG_AREA, area, NO_ID,
+                                              NULL ) ) ) )
+        return ufsErrno;
+
+    return setStatus( UFS_NO_ERROR );
+}
+
+static ufsStatusType lsmAddMapping( void *backend,
+                                    ufsIdentifierType area,
+                                    ufsIdentifierType storage )
+{
+    struct lsmBackendStruct *self;
+    ufsLsmBatchPtr batch;
+    int64_t found;
+
+    self = backend;
+    if ( !self || area <= 0 || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    found = areaExists( self, area );
+    if ( found > 0 )
+        found = storageKind( self, storage, NULL, NULL );
+
+    if ( found < 0 )
+        return ufsErrno;
+
+    if ( !found )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    found = contains( self, area, storage );
+    if ( found < 0 )
+        return ufsErrno;
+
+    if ( found )
+        return setStatus( UFS_ALREADY_EXISTS );
+
+    batch = ufsLsmBatchCreate();
+    if ( !commit( self, batch, batch && putMapping( batch, area, storage ) ) )
+        return ufsErrno;
+
+    return setStatus( UFS_NO_ERROR );
+}
+
+static ufsStatusType lsmProbeMapping( void *backend,
+                                      ufsIdentifierType area,
+                                      ufsIdentifierType storage )
+{
+    struct lsmBackendStruct *self;
+    int64_t found;
+
+    self = backend;
+    if ( !self || area <= 0 || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    found = contains( self, area, storage );
+    if ( found < 0 )
+        return ufsErrno;
+
+    if ( found )
+        return setStatus( UFS_NO_ERROR );
+
+    /* Only a miss pays for telling a missing mapping from a missing side.  */
+    found = areaExists( self, area );
+    if ( found > 0 )
+        found = storageKind( self, storage, NULL, NULL );
+
+    if ( found < 0 )
+        return ufsErrno;
+
+    return setStatus( found ? UFS_MAPPING_DOES_NOT_EXIST : UFS_DOES_NOT_EXIST );
+}
+
+static ufsIdentifierType lsmResolveStorageInView( void *backend,
+                                                  ufsViewType view,
+                                                  ufsIdentifierType storage )
+{
+    struct lsmBackendStruct *self;
+    uint64_t i, viewSize;
+    int64_t kind, found;
+
+    self = backend;
+    if ( !self || !view || storage <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    /* Missing storage is reported before anything about the view.          */
+    kind = storageKind( self, storage, NULL, NULL );
+    if ( kind <= 0 ) {
+        ufsErrno = kind < 0 ? ufsErrno : UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    viewSize = checkView( self, view );
+    if ( ufsErrno != UFS_NO_ERROR )
+        return -1;
+
+    for ( i = 0; i < viewSize; i++ ) {
+        found = contains( self, view[i], storage );
+        if ( found < 0 )
+            return -1;
+
+        if ( found ) {
+            ufsErrno = UFS_NO_ERROR;
+            return view[i];
+        }
+    }
+
+    ufsErrno = UFS_CANNOT_RESOLVE_STORAGE;
+    return -1;
+}
+
+static ufsStatusType lsmIterateDirInView( void *backend,
+                                          ufsViewType view,
+                                          ufsIdentifierType directory,
+                                          ufsDirIter iterator,
+                                          void *userData )
+{
+    struct lsmBackendStruct *self;
+    struct collectStruct children = { 0 };
+    uint8_t key[ 1 + ID_BYTES ];
+    ufsStatusType status;
+    uint64_t i, j, viewSize, numEntries;
+    int64_t kind, found;
+
+    self = backend;
+    if ( !self || !view || !iterator || directory <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    kind = storageKind( self, directory, NULL, NULL );
+    if ( kind < 0 )
+        return ufsErrno;
+
+    if ( kind != KIND_DIRECTORY )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    viewSize = checkView( self, view );
+    if ( ufsErrno != UFS_NO_ERROR )
+        return ufsErrno;
+
+    /* The iterator needs the count up front and may call back into ufs,    */
+    /* so the listing is collected and filtered before the first call.       */
+    if ( !collect( self, key,
+                   makeKey( key, TAG_STORAGE_NAME, directory, NO_ID, NULL ),
+                   true, &children ) )
+        return ufsErrno;
+
+    numEntries = 0;
+    for ( i = 0; i < children.count; i++ ) {
+        found = 0;
+        for ( j = 0; !found && j < viewSize; j++ )
+            found = contains( self, view[j], children.ids[i] );
+
+        if ( found < 0 ) {
+            free( children.ids );
+            return ufsErrno;
+        }
+
+        if ( found )
+            children.ids[ numEntries++ ] = children.ids[i];
+    }
+
+    status = UFS_NO_ERROR;
+    for ( i = 0; i < numEntries && status == UFS_NO_ERROR; i++ )
+        status = iterator( children.ids[i], i, numEntries, userData );
+
+    free( children.ids );
+    return setStatus( status );
+}
+
+static ufsStatusType lsmCollapse( void *backend, ufsViewType view )
+{
+    struct lsmBackendStruct *self;
+    struct collectStruct storage[ UFS_VIEW_MAX_SIZE ];
+    uint8_t key[ 1 + ID_BYTES ];
+    ufsIdentifierType last;
+    ufsLsmBatchPtr batch;
+    uint64_t i, j, viewSize;
+    bool ok;
+
+    self = backend;
+    if ( !self || !view )
+        return setStatus( UFS_BAD_CALL );
+
+    viewSize = checkView( self, view );
+    if ( ufsErrno != UFS_NO_ERROR )
+        return ufsErrno;
+
+    if ( viewSize < 2 )
+        return setStatus( UFS_NO_ERROR );
+
+    /* BASE can't be enumerated, it can only be collapsed into.              */
+    for ( i = 0; i + 1 < viewSize; i++ ) {
+        if ( view[i] == 0 )
+            return setStatus( UFS_BAD_CALL );
+    }
+
+    /* One batch adds everything to the last area before removing it from   */
+    /* the others, the collapse happens entirely or not at all.             */
+    last = view[ viewSize - 1 ];
+    memset( storage, 0, sizeof( storage ) );
+    batch = ufsLsmBatchCreate();
+    ok = batch;
+    for ( i = 0; ok && i + 1 < viewSize; i++ ) {
+        ok = collect( self, key,
+                      makeKey( key, TAG_AREA_MAPPING, view[i], NO_ID, NULL ),
+                      false, &storage[i] );
+        for ( j = 0; ok && last && j < storage[i].count; j++ )
+            ok = putMapping( batch, last, storage[i].ids[j] );
+    }
+
+    for ( i = 0; ok && i + 1 < viewSize; i++ ) {
+        for ( j = 0; ok && j < storage[i].count; j++ )
+            ok = removeMapping( batch, view[i], storage[i].ids[j] );
+    }
+
+    for ( i = 0; i + 1 < viewSize; i++ )
+        free( storage[i].ids );
+
+    if ( !commit( self, batch, ok ) )
+        return ufsErrno;
+
+    return setStatus( UFS_NO_ERROR );
+}
+
+/* Builds tag, then the identifiers that aren't NO_ID, then name when it    */
+/* isn't NULL. Returns the length of the key.                                */
+static uint64_t makeKey( uint8_t *key, uint8_t tag, int64_t first,
+                         int64_t second, const char *name )
+{
+    uint64_t keyLen, nameLen;
+
+    keyLen = 0;
+    key[ keyLen++ ] = tag;
+    if ( first != NO_ID ) {
+        encodeId( key + keyLen, first );
+        keyLen += ID_BYTES;
+    }
+
+    if ( second != NO_ID ) {
+        encodeId( key + keyLen, second );
+        keyLen += ID_BYTES;
+    }
+
+    if ( name ) {
+        nameLen = strlen( name );
+        memcpy( key + keyLen, name, nameLen );
+        keyLen += nameLen;
+    }
+
+    return keyLen;
+}
+
+static void encodeId( uint8_t *dst, int64_t id )
+{
+    int i;
+
+    for ( i = ID_BYTES - 1; i >= 0; i--, id >>= 8 )
+        dst[i] = id & 0xff;
+}
+
+static int64_t decodeId( const uint8_t *src )
+{
+    uint64_t id;
+    int i;
+
+    for ( id = 0, i = 0; i < ID_BYTES; i++ )
+        id = id << 8 | src[i];
+
+    return id;
+}
+
+/* Returns one of the KIND_ values, -1 on error. parent and name receive    */
+/* the parent and the NUL terminated name of the storage when not NULL.      */
+static int64_t storageKind( struct lsmBackendStruct *self,
+                            ufsIdentifierType storage,
+                            ufsIdentifierType *parent, char *name )
+{
+    uint8_t key[ 1 + ID_BYTES ], value[ ID_BYTES + 1 + MAX_NAME ];
+    int64_t valueLen;
+
+    valueLen = ufsLsmGet( self -> lsm, key,
+                          makeKey( key, TAG_STORAGE, storage, NO_ID, NULL ),
+                          value, sizeof( value ) );
+    if ( valueLen < 0 )
+        return ufsErrno == UFS_DOES_NOT_EXIST ? KIND_NONE : -1;
+
+    if ( valueLen < ID_BYTES + 1 || valueLen > sizeof( value ) ) {
+        ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+        return -1;
+    }
+
+    if ( parent )
+        *parent = decodeId( value );
+
+    if ( name ) {
+        memcpy( name, value + ID_BYTES + 1, valueLen - ID_BYTES - 1 );
+        name[ valueLen - ID_BYTES - 1 ] = '\0';
+    }
+
+    return value[ ID_BYTES ] ? KIND_DIRECTORY : KIND_FILE;
+}
+
+/* Looks up a key holding an identifier. Returns 0 when there is no such    */
+/* key and -1 on error.                                                      */
+static ufsIdentifierType findId( struct lsmBackendStruct *self,
+                                 const uint8_t *key, uint64_t keyLen )
+{
+    uint8_t value[ ID_BYTES ];
+    int64_t valueLen;
+
+    valueLen = ufsLsmGet( self -> lsm, key, keyLen, value, sizeof( value ) );
+    if ( valueLen < 0 )
+        return ufsErrno == UFS_DOES_NOT_EXIST ? 0 : -1;
+
+    if ( valueLen != ID_BYTES ) {
+        ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+        return -1;
+    }
+
+    return decodeId( value );
+}
+
+static int64_t areaExists( struct lsmBackendStruct *self,
+                           ufsIdentifierType area )
+{
+    uint8_t key[ 1 + ID_BYTES ];
+
+    if ( ufsLsmGet( self -> lsm, key,
+                    makeKey( key, TAG_AREA, area, NO_ID, NULL ),
+                    NULL, 0 ) >= 0 )
+        return 1;
+
+    return ufsErrno == UFS_DOES_NOT_EXIST ? 0 : -1;
+}
+
+static int64_t hasKeys( struct lsmBackendStruct *self, const uint8_t *prefix,
+                        uint64_t prefixLen )
+{
+    bool found;
+
+    found = false;
+    if ( !ufsLsmScan( self -> lsm, prefix, prefixLen, firstKeyIter, &found ) )
+        return -1;
+
+    return found;
+}
+
+static bool collect( struct lsmBackendStruct *self, const uint8_t *prefix,
+                     uint64_t prefixLen, bool fromValue,
+                     struct collectStruct *ids )
+{
+    ids -> fromValue = fromValue;
+    if ( !ufsLsmScan( self -> lsm, prefix, prefixLen, collectIter, ids ) )
+        return false;
+
+    if ( ids -> failed ) {
+        free( ids -> ids );
+        ids -> ids = NULL;
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    return true;
+}
+
+static bool collectIter( const uint8_t *key, uint64_t keyLen,
+                         const uint8_t *value, uint64_t valueLen,
+                         void *userData )
+{
+    struct collectStruct *ids;
+    ufsIdentifierType *grown;
+
+    ids = userData;
+    if ( ids -> count == ids -> capacity ) {
+        ids -> capacity = ids -> capacity ? ids -> capacity * 2 : 64;
+        grown = realloc( ids -> ids, ids -> capacity * sizeof( *grown ) );
+        if ( !grown ) {
+            ids -> failed = true;
+            return false;
+        }
+
+        ids -> ids = grown;
+    }
+
+    if ( ids -> fromValue )
+        ids -> ids[ ids -> count++ ] = decodeId( value );
+    else
+        ids -> ids[ ids -> count++ ] = decodeId( key + keyLen - ID_BYTES );
+
+    return true;
+}
+
+/* Keys come in order, the last one seen has the largest identifier.        */
+static bool lastIdIter( const uint8_t *key, uint64_t keyLen,
+                        const uint8_t *value, uint64_t valueLen,
+                        void *userData )
+{
+    *(ufsIdentifierType*) userData = decodeId( key + 1 );
+    return true;
+}
+
+static bool firstKeyIter( const uint8_t *key, uint64_t keyLen,
+                          const uint8_t *value, uint64_t valueLen,
+                          void *userData )
+{
+    *(bool*) userData = true;
+    return false;
+}
+
+/* Returns 1 when area holds storage, 0 when it doesn't and -1 on error.    */
+static int64_t contains( struct lsmBackendStruct *self,
+                         ufsIdentifierType area, ufsIdentifierType storage )
+{
+    uint8_t key[ 1 + 2 * ID_BYTES ];
+    int64_t mapped;
+
+    if ( area == 0 ) {
+        mapped = hasKeys( self, key,
+                          makeKey( key, TAG_MAPPING, storage, NO_ID, NULL ) );
+        return mapped < 0 ? -1 : !mapped;
+    }
+
+    if ( ufsLsmGet( self -> lsm, key,
+                    makeKey( key, TAG_MAPPING, storage, area, NULL ),
+                    NULL, 0 ) >= 0 )
+        return 1;
+
+    return ufsErrno == UFS_DOES_NOT_EXIST ? 0 : -1;
+}
+
+/* Both keys of a mapping go into the same batch.                           */
+static bool putMapping( ufsLsmBatchPtr batch, ufsIdentifierType area,
+                        ufsIdentifierType storage )
+{
+    uint8_t key[ 1 + 2 * ID_BYTES ];
+
+    return ufsLsmBatchPut( batch, key,
+                           makeKey( key, TAG_MAPPING, storage, area, NULL ),
+                           NULL, 0 ) &&
+           ufsLsmBatchPut( batch, key,
+                           makeKey( key, TAG_AREA_MAPPING, area, storage,
+                                    NULL ),
+                           NULL, 0 );
+}
+
+static bool removeMapping( ufsLsmBatchPtr batch, ufsIdentifierType area,
+                           ufsIdentifierType storage )
+{
+    uint8_t key[ 1 + 2 * ID_BYTES ];
+
+    return ufsLsmBatchDelete( batch, key,
+                              makeKey( key, TAG_MAPPING, storage, area,
+                                       NULL ) ) &&
+           ufsLsmBatchDelete( batch, key,
+                              makeKey( key, TAG_AREA_MAPPING, area, storage,
+                                       NULL ) );
+}
+
+/* Removes every mapping of a storage ( TAG_MAPPING ) or of an area          */
+/* ( TAG_AREA_MAPPING ) through batch.                                       */
+static bool removeMappings( struct lsmBackendStruct *self,
+                            ufsLsmBatchPtr batch, uint8_t tag,
+                            ufsIdentifierType id )
+{
+    struct collectStruct others = { 0 };
+    uint8_t key[ 1 + ID_BYTES ];
+    uint64_t i;
+    bool ok;
+
+    if ( !collect( self, key, makeKey( key, tag, id, NO_ID, NULL ), false,
+                   &others ) )
+        return false;
+
+    ok = true;
+    for ( i = 0; ok && i < others.count; i++ ) {
+        if ( tag == TAG_MAPPING )
+            ok = removeMapping( batch, others.ids[i], id );
+        else
+            ok = removeMapping( batch, id, others.ids[i] );
+    }
+
+    free( others.ids );
+    return ok;
+}
+
+/* Writes batch when ok, then frees it. Returns whether it was written.     */
+static bool commit( struct lsmBackendStruct *self, ufsLsmBatchPtr batch,
+                    bool ok )
+{
+    ok = ok && ufsLsmWrite( self -> lsm, batch );
+    ufsLsmBatchFree( batch );
+    return ok;
+}
+
+static ufsIdentifierType addStorage( struct lsmBackendStruct *self,
+                                     ufsIdentifierType parent,
+                                     const char *name, bool directory )
+{
+    uint8_t key[ UFS_LSM_MAX_KEY ], value[ ID_BYTES + 1 + MAX_NAME ];
+    ufsIdentifierType found;
+    ufsLsmBatchPtr batch;
+    uint64_t keyLen, nameLen;
+    bool ok;
+
+    nameLen = strlen( name );
+    if ( nameLen > MAX_NAME ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    keyLen = makeKey( key, TAG_STORAGE_NAME, parent, NO_ID, name );
+    found = findId( self, key, keyLen );
+    if ( found ) {
+        ufsErrno = found < 0 ? ufsErrno : UFS_ALREADY_EXISTS;
+        return -1;
+    }
+
+    batch = ufsLsmBatchCreate();
+    encodeId( value, self -> lastStorage + 1 );
+    ok = batch && ufsLsmBatchPut( batch, key, keyLen, value, ID_BYTES );
+
+    encodeId( value, parent );
+    value[ ID_BYTES ] = directory;
+    memcpy( value + ID_BYTES + 1, name, nameLen );
+    keyLen = makeKey( key, TAG_STORAGE, self -> lastStorage + 1, NO_ID, NULL );
+    ok = ok && ufsLsmBatchPut( batch, key, keyLen, value,
+                               ID_BYTES + 1 + nameLen );
+    if ( !commit( self, batch, ok ) )
+        return -1;
+
+    ufsErrno = UFS_NO_ERROR;
+    return ++self -> lastStorage;
+}
+
+static ufsStatusType removeStorage( struct lsmBackendStruct *self,
+                                    ufsIdentifierType storage,
+                                    bool directory )
+{
+    uint8_t key[ UFS_LSM_MAX_KEY ];
+    char name[ MAX_NAME + 1 ];
+    ufsIdentifierType parent;
+    ufsLsmBatchPtr batch;
+    int64_t kind, children;
+
+    if ( !self || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    kind = storageKind( self, storage, &parent, name );
+    if ( kind < 0 )
+        return ufsErrno;
+
+    if ( kind != ( directory ? KIND_DIRECTORY : KIND_FILE ) )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    if ( directory ) {
+        children = hasKeys( self, key,
+                            makeKey( key, TAG_STORAGE_NAME, storage, NO_ID,
+                                     NULL ) );
+        if ( children < 0 )
+            return ufsErrno;
+
+        if ( children )
+            return setStatus( UFS_DIRECTORY_IS_NOT_EMPTY );
+    }
+
+    batch = ufsLsmBatchCreate();
+    if ( !commit( self, batch,
+                  batch &&
+                  removeMappings( self, batch, TAG_MAPPING, storage ) &&
+                  ufsLsmBatchDelete( batch, key,
+                                     makeKey( key, TAG_STORAGE_NAME, parent,
+                                              NO_ID, name ) ) &&
+                  ufsLsmBatchDelete( batch, key,
+                                     makeKey( key, TAG_STORAGE, storage,
+                                              NO_ID, NULL ) ) ) )
+        return ufsErrno;
+
+    return setStatus( UFS_NO_ERROR );
+}
+
+/* Returns the number of areas in view, ufsErrno tells whether it's valid.  */
+static uint64_t checkView( struct lsmBackendStruct *self, ufsViewType view )
+{
+    uint64_t i, j, size;
+    int64_t exists;
+
+    for ( size = 0; size < UFS_VIEW_MAX_SIZE &&
+                    view[ size ] != UFS_VIEW_TERMINATOR; size++ )
+        ;
+
+    for ( i = 0; i < size; i++ ) {
+        for ( j = 0; j < i; j++ ) {
+            if ( view[j] == view[i] ) {
+                ufsErrno = UFS_VIEW_CONTAINS_DUPLICATES;
+                return 0;
+            }
+        }
+    }
+
+    for ( i = 0; i < size; i++ ) {
+        exists = view[i] == 0 ? 1 : view[i] < 0 ? 0 :
+                                    areaExists( self, view[i] );
+        if ( exists <= 0 ) {
+            ufsErrno = exists < 0 ? ufsErrno : UFS_INVALID_AREA_IN_VIEW;
+            return 0;
+        }
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return size;
+}
+
+static ufsStatusType setStatus( ufsStatusType status )
+{
+    ufsErrno = status;
+    return status;
+}
+
+/* Leaves value untouched when key is missing.                               */
+static bool numberOption( const char *opts, const char *key,
+                          uint64_t *value )
+{
+    char buff[ 32 ], *end;
+    uint64_t parsed;
+
+    if ( !ufsBackendOption( opts, key, 0, buff, sizeof( buff ) ) )
+        return ufsErrno == UFS_DOES_NOT_EXIST;
+
+    parsed = strtoull( buff, &end, 10 );
+    if ( !*buff || *end ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    *value = parsed;
+    return true;
+}
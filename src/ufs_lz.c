@@ -0,0 +1,230 @@
+/******************************************************************************\
+*  ufs_lz.c                                                                    *
+*                                                                              *
+*  Contains the definitions for the LZ codec of compressed file data.          *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "ufs_defs.h"
+#include "ufs_lz.h"
+
+#define HASH_BITS (13)
+/* The last bytes are always literals and no match starts in the last         */
+/* MATCH_LIMIT, as in LZ4, so a decoder may copy in words near the end.       */
+#define LAST_LITERALS (5)
+#define MATCH_LIMIT (12)
+#define RUN_MASK (15)
+
+static inline uint32_t read32( const uint8_t *p );
+static inline uint32_t hash32( uint32_t seq );
+static bool putLength( uint8_t **op, const uint8_t *end, uint64_t length );
+static bool putSequence( uint8_t **op, const uint8_t *end,
+                         const uint8_t *literals, uint64_t numLiterals,
+                         uint64_t offset, uint64_t matchLength );
+static bool getLength( const uint8_t **ip, const uint8_t *end,
+                       uint64_t *length );
+
+uint64_t ufsLzCompress( const void *src, uint64_t srcLen, void *dst,
+                        uint64_t dstCap )
+{
+    uint32_t table[ 1 << HASH_BITS ], seq, h;
+    const uint8_t *in, *ip, *anchor, *ref, *end, *matchEnd;
+    uint8_t *op;
+    uint64_t length;
+
+    if ( !src || !dst ) {
+        ufsErrno = UFS_BAD_CALL;
+        return 0;
+    }
+
+    in = ip = anchor = src;
+    end = in + srcLen;
+    op = dst;
+    memset( table, 0, sizeof( table ) );
+
+    if ( srcLen > MATCH_LIMIT ) {
+        matchEnd = end - LAST_LITERALS;
+        while ( ip < end - MATCH_LIMIT ) {
+            seq = read32( ip );
+            h = hash32( seq );
+            ref = in + table[h];
+            table[h] = ip - in;
+            if ( ref >= ip || ip - ref > UFS_LZ_WINDOW ||
+                 read32( ref ) != seq ) {
+                ip++;
+                continue;
+            }
+
+            for ( length = UFS_LZ_MIN_MATCH;
+                  ip + length < matchEnd && ref[ length ] == ip[ length ];
+                  length++ )
+                ;
+
+            if ( !putSequence( &op, (uint8_t*)dst + dstCap, anchor,
+                               ip - anchor, ip - ref, length ) ) {
+                ufsErrno = UFS_NO_ERROR;
+                return 0;
+            }
+
+            ip += length;
+            anchor = ip;
+        }
+    }
+
+    if ( !putSequence( &op, (uint8_t*)dst + dstCap, anchor, end - anchor, 0,
+                       0 ) ) {
+        ufsErrno = UFS_NO_ERROR;
+        return 0;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return op - (uint8_t*)dst;
+}
+
+int64_t ufsLzDecompress( const void *src, uint64_t srcLen, void *dst,
+                         uint64_t dstCap )
+{
+    const uint8_t *ip, *iend, *match;
+    uint8_t *op, *oend;
+    uint64_t length, offset, i;
+    uint8_t token;
+
+    if ( !src || !dst ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    ip = src;
+    iend = ip + srcLen;
+    op = dst;
+    oend = op + dstCap;
+    while ( ip < iend ) {
+        token = *ip++;
+        length = token >> 4;
+        if ( !getLength( &ip, iend, &length ) ||
+             length > (uint64_t)( iend - ip ) ||
+             length > (uint64_t)( oend - op ) )
+            goto corrupted;
+
+        memcpy( op, ip, length );
+        op += length;
+        ip += length;
+        if ( ip == iend )
+            break;
+
+        if ( iend - ip < 2 )
+            goto corrupted;
+        offset = ip[0] | (uint64_t) ip[1] << 8;
+        ip += 2;
+
+        length = token & RUN_MASK;
+        if ( !getLength( &ip, iend, &length ) )
+            goto corrupted;
+        length += UFS_LZ_MIN_MATCH;
+        if ( !offset || offset > (uint64_t)( op - (uint8_t*)dst ) ||
+             length > (uint64_t)( oend - op ) )
+            goto corrupted;
+
+        /* A match may overlap what it writes, runs repeat a short pattern.   */
+        match = op - offset;
+        if ( offset >= length ) {
+            memcpy( op, match, length );
+        } else {
+            for ( i = 0; i < length; i++ )
+                op[i] = match[i];
+        }
+        op += length;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return op - (uint8_t*)dst;
+
+corrupted:
+    ufsErrno = UFS_STREAM_IS_CORRUPTED;
+    return -1;
+}
+
+static inline uint32_t read32( const uint8_t *p )
+{
+    uint32_t v;
+
+    memcpy( &v, p, sizeof( v ) );
+    return v;
+}
+
+static inline uint32_t hash32( uint32_t seq )
+{
+    return ( seq * 2654435761U ) >> ( 32 - HASH_BITS );
+}
+
+/* What's left of a length that didn't fit its nibble.                        */
+static bool putLength( uint8_t **op, const uint8_t *end, uint64_t length )
+{
+    for ( ; length >= 255; length -= 255 ) {
+        if ( *op >= end )
+            return false;
+        *( *op )++ = 255;
+    }
+
+    if ( *op >= end )
+        return false;
+    *( *op )++ = length;
+    return true;
+}
+
+/* A matchLength of 0 makes the last sequence, literals only.                 */
+static bool putSequence( uint8_t **op, const uint8_t *end,
+                         const uint8_t *literals, uint64_t numLiterals,
+                         uint64_t offset, uint64_t matchLength )
+{
+    uint64_t extra;
+    uint8_t *token;
+
+    if ( *op >= end )
+        return false;
+
+    token = ( *op )++;
+    *token = ( numLiterals < RUN_MASK ? numLiterals : RUN_MASK ) << 4;
+    if ( numLiterals >= RUN_MASK &&
+         !putLength( op, end, numLiterals - RUN_MASK ) )
+        return false;
+
+    if ( numLiterals > (uint64_t)( end - *op ) )
+        return false;
+    memcpy( *op, literals, numLiterals );
+    *op += numLiterals;
+    if ( !matchLength )
+        return true;
+
+    if ( end - *op < 2 )
+        return false;
+    *( *op )++ = offset & 0xff;
+    *( *op )++ = offset >> 8;
+
+    extra = matchLength - UFS_LZ_MIN_MATCH;
+    *token |= extra < RUN_MASK ? extra : RUN_MASK;
+    return extra < RUN_MASK || putLength( op, end, extra - RUN_MASK );
+}
+
+static bool getLength( const uint8_t **ip, const uint8_t *end,
+                       uint64_t *length )
+{
+    uint8_t byte;
+
+    if ( *length != RUN_MASK )
+        return true;
+
+    do {
+        if ( *ip >= end )
+            return false;
+        byte = *( *ip )++;
+        *length += byte;
+    } while ( byte == 255 );
+
+    return true;
+}
@@ -0,0 +1,85 @@
+/******************************************************************************\
+*  ufs_lz.h                                                                    *
+*                                                                              *
+*  Internal header for the LZ codec of compressed file data.                   *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* A byte oriented LZ77 codec in the manner of LZ4, built for decompression   */
+/* speed rather than ratio. A compressed buffer is a run of sequences, each a */
+/* token, the literals it names and a match of at least UFS_LZ_MIN_MATCH      */
+/* bytes at most UFS_LZ_WINDOW bytes back. The high nibble of the token is    */
+/* the number of literals, the low one the match length less                  */
+/* UFS_LZ_MIN_MATCH, 15 in either is followed by bytes added to it until one  */
+/* isn't 255. The offset of the match follows the literals, two bytes little  */
+/* endian. The last sequence has literals only and ends the buffer.           */
+/*                                                                            */
+/* Matches are found greedily through a table of the last position of each    */
+/* hash of 4 bytes, which lives on the stack, the codec holds no state        */
+/* between calls and is thread safe. Buffers are compressed independently,    */
+/* nothing refers to data before the start of the buffer.                     */
+
+#ifndef UFS_LZ_H
+#define UFS_LZ_H
+
+#include <stdint.h>
+
+#define UFS_LZ_MIN_MATCH (4)
+#define UFS_LZ_WINDOW (65535)
+
+/******************************************************************************\
+* ufsLzCompress                                                                *
+*                                                                              *
+*  Compresses srcLen bytes of src into dst, giving up once the result would    *
+*  take more than dstCap bytes. Passing a dstCap below srcLen asks for data    *
+*  that shrinks or nothing.                                                    *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: src or dst are NULL.                                         *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -src: What to compress.                                                     *
+*  -srcLen: The number of bytes to compress.                                   *
+*  -dst: Filled with the compressed data.                                      *
+*  -dstCap: The number of bytes dst holds.                                     *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The size of the compressed data, 0 if it doesn't fit in dstCap   *
+*             or on error.                                                     *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsLzCompress( const void *src, uint64_t srcLen, void *dst,
+                        uint64_t dstCap );
+
+/******************************************************************************\
+* ufsLzDecompress                                                              *
+*                                                                              *
+*  Decompresses srcLen bytes of src into dst. Every reference is checked, a    *
+*  damaged buffer fails instead of reading or writing out of bounds.           *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: src or dst are NULL.                                         *
+*   UFS_STREAM_IS_CORRUPTED: src isn't compressed data or it takes more than   *
+*                            dstCap bytes decompressed.                        *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -src: The compressed data.                                                  *
+*  -srcLen: The number of bytes of src.                                        *
+*  -dst: Filled with the decompressed data.                                    *
+*  -dstCap: The number of bytes dst holds.                                     *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int64_t: The size of the decompressed data, -1 on error.                   *
+*                                                                              *
+\******************************************************************************/
+int64_t ufsLzDecompress( const void *src, uint64_t srcLen, void *dst,
+                         uint64_t dstCap );
+
+#endif /* UFS_LZ_H */
@@ -0,0 +1,171 @@
+/******************************************************************************\
+*  ufs_pool.c                                                                  *
+*                                                                              *
+*  Contains the definitions for the pool of worker threads.                    *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "ufs_defs.h"
+#include "ufs_pool.h"
+
+struct jobStruct {
+    ufsPoolJob job;
+    void *arg;
+    struct jobStruct *next;
+};
+
+struct ufsPoolStruct {
+    pthread_mutex_t lock;
+    /* Signalled on new jobs and on stop.                                    */
+    pthread_cond_t work;
+    /* Signalled when the pool runs out of jobs.                             */
+    pthread_cond_t idle;
+
+    struct jobStruct *head, *tail;
+    /* Queued plus running jobs.                                             */
+    uint64_t outstanding;
+    bool stop;
+
+    pthread_t threads[ UFS_POOL_MAX_THREADS ];
+    uint64_t numThreads;
+};
+
+static void *worker( void *arg );
+
+ufsPoolPtr ufsPoolCreate( uint64_t numThreads )
+{
+    struct ufsPoolStruct *pool;
+
+    if ( !numThreads || numThreads > UFS_POOL_MAX_THREADS ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    pool = calloc( 1, sizeof( *pool ) );
+    if ( !pool ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    pthread_mutex_init( &pool -> lock, NULL );
+    pthread_cond_init( &pool -> work, NULL );
+    pthread_cond_init( &pool -> idle, NULL );
+
+    for ( ; pool -> numThreads < numThreads; pool -> numThreads++ ) {
+        if ( pthread_create( &pool -> threads[ pool -> numThreads ], NULL,
+                             worker, pool ) ) {
+            ufsPoolDestroy( pool );
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return NULL;
+        }
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return pool;
+}
+
+bool ufsPoolSubmit( ufsPoolPtr pool, ufsPoolJob job, void *arg )
+{
+    struct jobStruct *entry;
+
+    if ( !pool || !job ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    entry = malloc( sizeof( *entry ) );
+    if ( !entry ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    entry -> job = job;
+    entry -> arg = arg;
+    entry -> next = NULL;
+
+    pthread_mutex_lock( &pool -> lock );
+    if ( pool -> tail )
+        pool -> tail -> next = entry;
+    else
+        pool -> head = entry;
+
+    pool -> tail = entry;
+    pool -> outstanding++;
+    pthread_cond_signal( &pool -> work );
+    pthread_mutex_unlock( &pool -> lock );
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+void ufsPoolWait( ufsPoolPtr pool )
+{
+    if ( !pool )
+        return;
+
+    pthread_mutex_lock( &pool -> lock );
+    while ( pool -> outstanding )
+        pthread_cond_wait( &pool -> idle, &pool -> lock );
+    pthread_mutex_unlock( &pool -> lock );
+}
+
+void ufsPoolDestroy( ufsPoolPtr pool )
+{
+    uint64_t i;
+
+    if ( !pool )
+        return;
+
+    ufsPoolWait( pool );
+
+    pthread_mutex_lock( &pool -> lock );
+    pool -> stop = true;
+    pthread_cond_broadcast( &pool -> work );
+    pthread_mutex_unlock( &pool -> lock );
+
+    for ( i = 0; i < pool -> numThreads; i++ )
+        pthread_join( pool -> threads[i], NULL );
+
+    pthread_cond_destroy( &pool -> idle );
+    pthread_cond_destroy( &pool -> work );
+    pthread_mutex_destroy( &pool -> lock );
+    free( pool );
+}
+
+static void *worker( void *arg )
+{
+    struct ufsPoolStruct *pool;
+    struct jobStruct *entry;
+
+    pool = arg;
+    pthread_mutex_lock( &pool -> lock );
+    for ( ;; ) {
+        while ( !pool -> head && !pool -> stop )
+            pthread_cond_wait( &pool -> work, &pool -> lock );
+
+        if ( !pool -> head )
+            break;
+
+        entry = pool -> head;
+        pool -> head = entry -> next;
+        if ( !pool -> head )
+            pool -> tail = NULL;
+
+        pthread_mutex_unlock( &pool -> lock );
+        entry -> job( entry -> arg );
+        free( entry );
+        pthread_mutex_lock( &pool -> lock );
+
+        if ( !--pool -> outstanding )
+            pthread_cond_broadcast( &pool -> idle );
+    }
+
+    pthread_mutex_unlock( &pool -> lock );
+    return NULL;
+}
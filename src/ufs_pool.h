@@ -0,0 +1,95 @@
+/******************************************************************************\
+*  ufs_pool.h                                                                  *
+*                                                                              *
+*  Internal header for a fixed size pool of worker threads.                    *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* Jobs run in submission order on whichever worker is free, a job must not  */
+/* wait on a job submitted after it. Jobs may submit jobs.                    */
+/* Destroying a pool runs every job already submitted before returning.       */
+
+#ifndef UFS_POOL_H
+#define UFS_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define UFS_POOL_MAX_THREADS (64)
+
+typedef struct ufsPoolStruct *ufsPoolPtr;
+
+typedef void (*ufsPoolJob)( void *arg );
+
+/******************************************************************************\
+* ufsPoolCreate                                                                *
+*                                                                              *
+*  Starts a pool of numThreads workers.                                        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: numThreads is 0 or above UFS_POOL_MAX_THREADS.               *
+*   UFS_OUT_OF_MEMORY: The pool or one of its threads could not be created.    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -numThreads: The number of workers.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsPoolPtr: The new pool, NULL on error.                                   *
+*                                                                              *
+\******************************************************************************/
+ufsPoolPtr ufsPoolCreate( uint64_t numThreads );
+
+/******************************************************************************\
+* ufsPoolSubmit                                                                *
+*                                                                              *
+*  Queues job to run with arg on one of the workers.                           *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: pool or job are NULL.                                        *
+*   UFS_OUT_OF_MEMORY: The job could not be queued.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -pool: The pool.                                                            *
+*  -job: The function to run.                                                  *
+*  -arg: The argument of job.                                                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the job was queued, false otherwise.                         *
+*                                                                              *
+\******************************************************************************/
+bool ufsPoolSubmit( ufsPoolPtr pool, ufsPoolJob job, void *arg );
+
+/******************************************************************************\
+* ufsPoolWait                                                                  *
+*                                                                              *
+*  Blocks until every submitted job has run, including jobs that jobs submit.  *
+*  Must not be called from a job.                                              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -pool: The pool.                                                            *
+*                                                                              *
+\******************************************************************************/
+void ufsPoolWait( ufsPoolPtr pool );
+
+/******************************************************************************\
+* ufsPoolDestroy                                                               *
+*                                                                              *
+*  Runs the queued jobs, stops the workers and frees the pool.                 *
+*  Must not be called from a job.                                              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -pool: The pool, may be NULL.                                               *
+*                                                                              *
+\******************************************************************************/
+void ufsPoolDestroy( ufsPoolPtr pool );
+
+#endif /* UFS_POOL_H */
@@ -0,0 +1,655 @@
+/******************************************************************************\
+*  ufs_replica.c                                                               *
+*                                                                              *
+*  Contains the definitions for leaders and followers.                         *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_layout.h"
+#include "ufs_replica.h"
+#include "ufs_send.h"
+#include "ufs_store.h"
+
+/* "ufshelo" and "ufsack" followed by 0s.                                    */
+#define HELLO_MAGIC (0x6f6c6568736675ULL)
+#define ACK_MAGIC (0x6b6361736675ULL)
+
+/* A follower this many shipments behind is disconnected.                    */
+#define PENDING_MAX (256)
+
+/* How long the leader waits for a new follower to introduce itself.        */
+#define HELLO_TIMEOUT_MS (1000)
+
+/* A follower that takes no part of a stream for this long is disconnected.  */
+#define SEND_TIMEOUT_MS (1000)
+
+/* The first thing a follower sends, the state of its image.                */
+struct helloStruct {
+    uint64_t magic;
+    uint64_t uuid;
+    uint64_t generation;
+};
+
+/* Sent by a follower after every stream it applied.                        */
+struct ackStruct {
+    uint64_t magic;
+    uint64_t generation;
+};
+
+/* A connection that hasn't introduced itself yet.                           */
+struct greetingStruct {
+    int fd;
+    uint64_t since;
+    uint8_t hello[ sizeof( struct helloStruct ) ];
+    uint64_t helloLen;
+};
+
+struct shipmentStruct {
+    uint64_t generation;
+    uint64_t time;
+};
+
+struct followerStruct {
+    int fd;
+    /* The generation the follower is at once it applied what it was sent,   */
+    /* 0 before the first stream.                                             */
+    uint64_t sent;
+    /* The shipments not acknowledged yet, a ring.                           */
+    struct shipmentStruct pending[ PENDING_MAX ];
+    uint64_t first;
+    uint64_t numPending;
+    uint8_t ack[ sizeof( struct ackStruct ) ];
+    uint64_t ackLen;
+};
+
+struct ufsLeaderStruct {
+    ufsImagePtr img;
+    int listenFd;
+    struct followerStruct **followers;
+    uint64_t numFollowers;
+    uint64_t capacity;
+    struct greetingStruct *greetings;
+    uint64_t numGreetings;
+    uint64_t greetingsCapacity;
+    /* The snapshots the leader took or took over, by slot. Only these are   */
+    /* dropped, those of the image's other users stay.                       */
+    bool isShipped[ UFS_SNAPSHOTS_MAX ];
+};
+
+struct ufsFollowerStruct {
+    ufsImagePtr img;
+    int fd;
+    /* The snapshot of the last stream applied, 0 before the first one.      */
+    ufsIdType snapshot;
+    uint64_t appliedAt;
+    bool isPromoted;
+};
+
+static uint64_t now( void );
+static ufsIdType findSnapshot( ufsImagePtr img, uint64_t generation );
+static bool sendAll( int fd, const void *data, uint64_t size );
+static bool acceptFollowers( ufsLeaderPtr leader );
+static bool addGreeting( ufsLeaderPtr leader, int fd );
+static void removeGreeting( ufsLeaderPtr leader, uint64_t i );
+static int readHello( struct greetingStruct *greeting );
+static bool addFollower( ufsLeaderPtr leader, int fd,
+                         const struct helloStruct *hello );
+static void removeFollower( ufsLeaderPtr leader, uint64_t i );
+static bool readAcks( struct followerStruct *follower );
+static void dropSnapshots( ufsLeaderPtr leader, ufsIdType keep );
+
+ufsLeaderPtr ufsLeaderCreate( ufsImagePtr img, int listenFd )
+{
+    ufsLeaderPtr leader;
+    int flags;
+
+    if ( !img || listenFd < 0 || ( ufsLayoutHeader( img ) -> flags &
+                                   ( UFS_HEADER_FLAG_SEALED |
+                                     UFS_HEADER_FLAG_SNAPSHOT |
+                                     UFS_HEADER_FLAG_REPLICA ) ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    /* Followers are only accepted when the leader ships, without waiting.   */
+    flags = fcntl( listenFd, F_GETFL );
+    if ( flags < 0 || fcntl( listenFd, F_SETFL, flags | O_NONBLOCK ) < 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    leader = calloc( 1, sizeof( *leader ) );
+    if ( !leader ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    leader -> img = img;
+    leader -> listenFd = listenFd;
+
+    ufsErrno = UFS_NO_ERROR;
+    return leader;
+}
+
+void ufsLeaderFree( ufsLeaderPtr leader )
+{
+    if ( !leader )
+        return;
+
+    while ( leader -> numFollowers )
+        removeFollower( leader, leader -> numFollowers - 1 );
+
+    while ( leader -> numGreetings ) {
+        close( leader -> greetings[ leader -> numGreetings - 1 ].fd );
+        removeGreeting( leader, leader -> numGreetings - 1 );
+    }
+
+    close( leader -> listenFd );
+    free( leader -> followers );
+    free( leader -> greetings );
+    free( leader );
+}
+
+bool ufsLeaderShip( ufsLeaderPtr leader )
+{
+    struct followerStruct *follower;
+    ufsIdType snapshot, from;
+    uint64_t generation, i, slot;
+
+    if ( !leader ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !acceptFollowers( leader ) )
+        return false;
+
+    for ( i = leader -> numFollowers; i-- > 0; ) {
+        if ( !readAcks( leader -> followers[i] ) )
+            removeFollower( leader, i );
+    }
+
+    snapshot = ufsStoreSnapshot( leader -> img );
+    if ( snapshot < 0 )
+        return false;
+
+    leader -> isShipped[ snapshot - 1 ] = true;
+
+    generation = ufsLayoutHeader( leader -> img ) ->
+                 snapshots[ snapshot - 1 ].generation;
+
+    for ( i = leader -> numFollowers; i-- > 0; ) {
+        follower = leader -> followers[i];
+        from = follower -> sent ? findSnapshot( leader -> img,
+                                                follower -> sent ) : 0;
+
+        if ( follower -> numPending == PENDING_MAX ||
+             ( follower -> sent && from <= 0 ) ||
+             !ufsSend( leader -> img, from, snapshot, follower -> fd ) ) {
+            removeFollower( leader, i );
+            continue;
+        }
+
+        slot = ( follower -> first + follower -> numPending++ ) % PENDING_MAX;
+        follower -> pending[ slot ].generation = generation;
+        follower -> pending[ slot ].time = now();
+        follower -> sent = generation;
+    }
+
+    /* Every follower is at the new snapshot now.                            */
+    dropSnapshots( leader, snapshot );
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+uint64_t ufsLeaderNumFollowers( ufsLeaderPtr leader )
+{
+    return leader ? leader -> numFollowers : 0;
+}
+
+bool ufsLeaderGetLag( ufsLeaderPtr leader, uint64_t follower,
+                      struct ufsReplicaLagStruct *lag )
+{
+    struct followerStruct *curr;
+
+    if ( !leader || !lag || follower >= leader -> numFollowers ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    /* A follower that went away is only removed by the next shipment.      */
+    curr = leader -> followers[ follower ];
+    readAcks( curr );
+
+    lag -> generations = curr -> numPending;
+    lag -> nanoseconds = curr -> numPending ?
+        now() - curr -> pending[ curr -> first ].time : 0;
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+ufsFollowerPtr ufsFollowerCreate( ufsImagePtr img, int fd )
+{
+    struct ufsHeaderStruct *header;
+    struct helloStruct hello;
+    ufsFollowerPtr follower;
+
+    if ( !img || fd < 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    header = ufsLayoutHeader( img );
+    if ( header -> flags & ( UFS_HEADER_FLAG_SEALED |
+                             UFS_HEADER_FLAG_SNAPSHOT ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    follower = calloc( 1, sizeof( *follower ) );
+    if ( !follower ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    follower -> img = img;
+    follower -> fd = fd;
+    follower -> appliedAt = now();
+
+    memset( &hello, 0, sizeof( hello ) );
+    hello.magic = HELLO_MAGIC;
+
+    /* A replica picks up where it stopped, from the snapshot it kept.       */
+    if ( header -> flags & UFS_HEADER_FLAG_REPLICA ) {
+        hello.uuid = header -> sourceUuid;
+        hello.generation = header -> sourceGeneration;
+
+        follower -> snapshot = findSnapshot( img, hello.generation );
+        if ( follower -> snapshot <= 0 )
+            follower -> snapshot = ufsStoreSnapshot( img );
+
+        if ( follower -> snapshot < 0 ) {
+            free( follower );
+            return NULL;
+        }
+    }
+
+    if ( !sendAll( fd, &hello, sizeof( hello ) ) ) {
+        free( follower );
+        ufsErrno = UFS_REPLICA_DISCONNECTED;
+        return NULL;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return follower;
+}
+
+void ufsFollowerFree( ufsFollowerPtr follower )
+{
+    if ( !follower )
+        return;
+
+    if ( follower -> fd >= 0 )
+        close( follower -> fd );
+
+    free( follower );
+}
+
+int ufsFollowerPoll( ufsFollowerPtr follower, int timeout )
+{
+    struct pollfd pfd;
+    struct ackStruct ack;
+    ufsIdType snapshot;
+    ssize_t got;
+    uint8_t byte;
+    int ready;
+
+    if ( !follower || follower -> isPromoted ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    pfd.fd = follower -> fd;
+    pfd.events = POLLIN;
+    ready = poll( &pfd, 1, timeout );
+    if ( ready <= 0 ) {
+        ufsErrno = UFS_NO_ERROR;
+        return 0;
+    }
+
+    /* Nothing to read at the start of a stream, the leader is gone.         */
+    do {
+        got = recv( follower -> fd, &byte, 1, MSG_PEEK );
+    } while ( got < 0 && errno == EINTR );
+
+    if ( got <= 0 ) {
+        ufsErrno = UFS_REPLICA_DISCONNECTED;
+        return -1;
+    }
+
+    if ( !ufsReceive( follower -> img, follower -> fd ) )
+        return -1;
+
+    /* The new snapshot is taken first, so the records the old one kept     */
+    /* alive are freed as soon as it is dropped.                             */
+    snapshot = ufsStoreSnapshot( follower -> img );
+    if ( snapshot < 0 )
+        return -1;
+
+    if ( follower -> snapshot > 0 )
+        ufsStoreDropSnapshot( follower -> img, follower -> snapshot );
+    follower -> snapshot = snapshot;
+    follower -> appliedAt = now();
+
+    ack.magic = ACK_MAGIC;
+    ack.generation = ufsLayoutHeader( follower -> img ) -> sourceGeneration;
+    if ( !sendAll( follower -> fd, &ack, sizeof( ack ) ) ) {
+        ufsErrno = UFS_REPLICA_DISCONNECTED;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return 1;
+}
+
+uint64_t ufsFollowerStaleness( ufsFollowerPtr follower )
+{
+    return follower ? now() - follower -> appliedAt : 0;
+}
+
+bool ufsFollowerPromote( ufsFollowerPtr follower )
+{
+    if ( !follower || follower -> isPromoted || follower -> snapshot <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !ufsStorePromote( follower -> img ) )
+        return false;
+
+    close( follower -> fd );
+    follower -> fd = -1;
+    follower -> isPromoted = true;
+
+    return ufsImageSync( follower -> img );
+}
+
+static uint64_t now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static ufsIdType findSnapshot( ufsImagePtr img, uint64_t generation )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    int i;
+
+    for ( i = 0; i < UFS_SNAPSHOTS_MAX; i++ ) {
+        if ( header -> snapshots[i].isOwned &&
+             header -> snapshots[i].generation == generation )
+            return i + 1;
+    }
+
+    return 0;
+}
+
+static bool sendAll( int fd, const void *data, uint64_t size )
+{
+    const uint8_t *curr;
+    ssize_t written;
+
+    for ( curr = data; size; curr += written, size -= written ) {
+        written = send( fd, curr, size, MSG_NOSIGNAL );
+        if ( written < 0 && errno == EINTR ) {
+            written = 0;
+            continue;
+        }
+
+        if ( written <= 0 )
+            return false;
+    }
+
+    return true;
+}
+
+/* Nothing here waits, a connection that is slow to introduce itself is      */
+/* picked up again by the next shipment.                                     */
+static bool acceptFollowers( ufsLeaderPtr leader )
+{
+    struct greetingStruct *greeting;
+    struct helloStruct hello;
+    uint64_t i;
+    int fd, ready;
+
+    while ( true ) {
+        fd = accept4( leader -> listenFd, NULL, NULL,
+                      SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( fd < 0 && errno == EINTR )
+            continue;
+
+        if ( fd < 0 )
+            break;
+
+        if ( !addGreeting( leader, fd ) )
+            return false;
+    }
+
+    for ( i = leader -> numGreetings; i-- > 0; ) {
+        greeting = &leader -> greetings[i];
+        fd = greeting -> fd;
+        ready = readHello( greeting );
+
+        if ( ready == 0 &&
+             now() - greeting -> since < HELLO_TIMEOUT_MS * 1000000ULL )
+            continue;
+
+        memcpy( &hello, greeting -> hello, sizeof( hello ) );
+        removeGreeting( leader, i );
+
+        if ( ready <= 0 )
+            close( fd );
+        else if ( !addFollower( leader, fd, &hello ) )
+            return false;
+    }
+
+    return true;
+}
+
+static bool addGreeting( ufsLeaderPtr leader, int fd )
+{
+    struct greetingStruct *greetings;
+
+    if ( leader -> numGreetings == leader -> greetingsCapacity ) {
+        greetings = realloc( leader -> greetings, sizeof( *greetings ) *
+                             ( leader -> greetingsCapacity * 2 + 4 ) );
+        if ( !greetings ) {
+            close( fd );
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return false;
+        }
+
+        leader -> greetings = greetings;
+        leader -> greetingsCapacity = leader -> greetingsCapacity * 2 + 4;
+    }
+
+    leader -> greetings[ leader -> numGreetings ].fd = fd;
+    leader -> greetings[ leader -> numGreetings ].since = now();
+    leader -> greetings[ leader -> numGreetings ].helloLen = 0;
+    leader -> numGreetings++;
+    return true;
+}
+
+/* Leaves the connection open, the caller closes it or hands it on.          */
+static void removeGreeting( ufsLeaderPtr leader, uint64_t i )
+{
+    leader -> greetings[i] = leader -> greetings[ --leader -> numGreetings ];
+}
+
+/* Reads what arrived of the hello, 1 once it is complete, 0 while it isn't  */
+/* and -1 once the connection is gone.                                       */
+static int readHello( struct greetingStruct *greeting )
+{
+    ssize_t got;
+
+    while ( greeting -> helloLen < sizeof( greeting -> hello ) ) {
+        got = recv( greeting -> fd, greeting -> hello + greeting -> helloLen,
+                    sizeof( greeting -> hello ) - greeting -> helloLen,
+                    MSG_DONTWAIT );
+        if ( got < 0 && errno == EINTR )
+            continue;
+
+        if ( got < 0 )
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+        if ( got == 0 )
+            return -1;
+
+        greeting -> helloLen += got;
+    }
+
+    return 1;
+}
+
+/* Turns away followers whose image is neither fresh nor at the newest       */
+/* snapshot, no stream would apply to them. Streams are written blocking     */
+/* with a timeout, a follower that stops reading only holds the others up    */
+/* for SEND_TIMEOUT_MS before it is disconnected.                            */
+static bool addFollower( ufsLeaderPtr leader, int fd,
+                         const struct helloStruct *hello )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( leader -> img );
+    struct followerStruct *follower, **followers;
+    ufsIdType from;
+    struct timeval timeout = {
+        .tv_sec = SEND_TIMEOUT_MS / 1000,
+        .tv_usec = SEND_TIMEOUT_MS % 1000 * 1000
+    };
+    int flags;
+
+    from = hello -> generation ? findSnapshot( leader -> img,
+                                               hello -> generation ) : 0;
+    if ( hello -> magic != HELLO_MAGIC ||
+         ( hello -> generation &&
+           ( hello -> uuid != header -> uuid || from <= 0 ) ) ) {
+        close( fd );
+        return true;
+    }
+
+    flags = fcntl( fd, F_GETFL );
+    if ( flags < 0 || fcntl( fd, F_SETFL, flags & ~O_NONBLOCK ) < 0 ||
+         setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                     sizeof( timeout ) ) < 0 ) {
+        close( fd );
+        return true;
+    }
+
+    if ( leader -> numFollowers == leader -> capacity ) {
+        followers = realloc( leader -> followers, sizeof( *followers ) *
+                             ( leader -> capacity * 2 + 4 ) );
+        if ( !followers ) {
+            close( fd );
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return false;
+        }
+
+        leader -> followers = followers;
+        leader -> capacity = leader -> capacity * 2 + 4;
+    }
+
+    follower = calloc( 1, sizeof( *follower ) );
+    if ( !follower ) {
+        close( fd );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    /* Only shipped snapshots have followers at them, one left behind by an  */
+    /* earlier leader or a promoted follower is this leader's to drop now.   */
+    if ( from > 0 )
+        leader -> isShipped[ from - 1 ] = true;
+
+    follower -> fd = fd;
+    follower -> sent = hello -> generation;
+    leader -> followers[ leader -> numFollowers++ ] = follower;
+    return true;
+}
+
+static void removeFollower( ufsLeaderPtr leader, uint64_t i )
+{
+    close( leader -> followers[i] -> fd );
+    free( leader -> followers[i] );
+    leader -> followers[i] = leader -> followers[ --leader -> numFollowers ];
+}
+
+/* Reads the acknowledgements that arrived, false once the follower is gone. */
+static bool readAcks( struct followerStruct *follower )
+{
+    struct ackStruct ack;
+    ssize_t got;
+
+    while ( true ) {
+        got = recv( follower -> fd, follower -> ack + follower -> ackLen,
+                    sizeof( ack ) - follower -> ackLen, MSG_DONTWAIT );
+        if ( got < 0 && errno == EINTR )
+            continue;
+
+        if ( got < 0 )
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+
+        if ( got == 0 )
+            return false;
+
+        follower -> ackLen += got;
+        if ( follower -> ackLen < sizeof( ack ) )
+            continue;
+
+        memcpy( &ack, follower -> ack, sizeof( ack ) );
+        follower -> ackLen = 0;
+        if ( ack.magic != ACK_MAGIC )
+            return false;
+
+        while ( follower -> numPending &&
+                follower -> pending[ follower -> first ].generation <=
+                ack.generation ) {
+            follower -> first = ( follower -> first + 1 ) % PENDING_MAX;
+            follower -> numPending--;
+        }
+    }
+}
+
+static void dropSnapshots( ufsLeaderPtr leader, ufsIdType keep )
+{
+    int i;
+
+    for ( i = 0; i < UFS_SNAPSHOTS_MAX; i++ ) {
+        if ( i + 1 != keep && leader -> isShipped[i] ) {
+            ufsStoreDropSnapshot( leader -> img, i + 1 );
+            leader -> isShipped[i] = false;
+        }
+    }
+}
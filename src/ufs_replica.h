@@ -0,0 +1,256 @@
+/******************************************************************************\
+*  ufs_replica.h                                                               *
+*                                                                              *
+*  Internal header for leaders and followers, replicas kept up to date over    *
+*  a socket.                                                                   *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* A leader ships the changes of its image to every follower connected to    */
+/* its listening socket, a follower applies them to an image of its own and  */
+/* answers reads from it, its records can't be changed otherwise. Any stream */
+/* socket will do, a unix socket on one host or TCP across hosts.             */
+/*                                                                            */
+/* ufsLeaderShip takes a snapshot and sends each follower a stream, see       */
+/* ufs_send.h, from the snapshot it is at to the new one. The caller decides */
+/* how often, e.g. after every batch of changes or on a timer. The leader    */
+/* keeps the newest snapshot it shipped and drops the others it took, along  */
+/* with one an earlier leader left behind once a follower resumes from it.   */
+/* Snapshots taken with ufsStoreSnapshot are left alone. A follower          */
+/* connecting says which source and generation its image is at, a fresh      */
+/* follower gets a full stream, one that is at the newest snapshot picks up  */
+/* from there and any other is turned away, its image has to be rebuilt.     */
+/* Followers acknowledge every stream once it is applied, which is what the  */
+/* lag is measured with.                                                     */
+/* The leader never waits for a follower to introduce itself, one whose       */
+/* hello is still on its way is picked up by a later shipment. A follower     */
+/* that stops reading is disconnected once a stream to it stalls for a        */
+/* second, so it holds up the others for that long at most.                   */
+/*                                                                            */
+/* A follower keeps a snapshot of the last stream it applied. When the       */
+/* leader is lost, ufsFollowerPromote turns the follower's image into a      */
+/* source and a leader on it serves the followers that were at the same      */
+/* generation, without rebuilding them.                                       */
+/*                                                                            */
+/* Neither side is thread safe, each must be used by one thread at a time    */
+/* along with its image.                                                      */
+
+#ifndef UFS_REPLICA_H
+#define UFS_REPLICA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs_defs.h"
+#include "ufs_image.h"
+
+typedef struct ufsLeaderStruct *ufsLeaderPtr;
+typedef struct ufsFollowerStruct *ufsFollowerPtr;
+
+struct ufsReplicaLagStruct {
+    /* The snapshots shipped but not acknowledged yet.                       */
+    uint64_t generations;
+    /* Since the oldest of those was shipped, 0 when there are none.         */
+    uint64_t nanoseconds;
+};
+
+/******************************************************************************\
+* ufsLeaderCreate                                                              *
+*                                                                              *
+*  Creates a leader shipping the changes of img to the followers that connect  *
+*  to listenFd. The leader takes over listenFd.                                *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL, sealed, a snapshot or a replica, or listenFd is *
+*                 negative.                                                    *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -listenFd: A listening stream socket.                                       *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsLeaderPtr: The leader, NULL on error.                                   *
+*                                                                              *
+\******************************************************************************/
+ufsLeaderPtr ufsLeaderCreate( ufsImagePtr img, int listenFd );
+
+/******************************************************************************\
+* ufsLeaderFree                                                                *
+*                                                                              *
+*  Disconnects every follower, closes the listening socket and frees leader.   *
+*  The snapshot of the last shipment stays, so followers at it can pick up     *
+*  from there with the next leader.                                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -leader: The leader, may be NULL.                                           *
+*                                                                              *
+\******************************************************************************/
+void ufsLeaderFree( ufsLeaderPtr leader );
+
+/******************************************************************************\
+* ufsLeaderShip                                                                *
+*                                                                              *
+*  Accepts waiting followers, collects acknowledgements, takes a snapshot and  *
+*  sends every follower the changes up to it. Followers that can't be written  *
+*  to or stall a stream for a second are disconnected, which isn't an error.   *
+*  Connections that haven't introduced themselves yet are left for the next    *
+*  call, or closed after a second.                                             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: leader is NULL.                                              *
+*   Any error of ufsStoreSnapshot.                                             *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -leader: The leader.                                                        *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsLeaderShip( ufsLeaderPtr leader );
+
+/******************************************************************************\
+* ufsLeaderNumFollowers                                                        *
+*                                                                              *
+*  Gets the number of connected followers, as of the last ufsLeaderShip.       *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -leader: The leader.                                                        *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The number of followers, 0 if leader is NULL.                    *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsLeaderNumFollowers( ufsLeaderPtr leader );
+
+/******************************************************************************\
+* ufsLeaderGetLag                                                              *
+*                                                                              *
+*  Gets how far a follower is behind, as of the acknowledgements that arrived. *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: leader or lag are NULL or there is no such follower.         *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -leader: The leader.                                                        *
+*  -follower: The follower, below ufsLeaderNumFollowers.                       *
+*  -lag: Receives the lag.                                                     *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsLeaderGetLag( ufsLeaderPtr leader, uint64_t follower,
+                      struct ufsReplicaLagStruct *lag );
+
+/******************************************************************************\
+* ufsFollowerCreate                                                            *
+*                                                                              *
+*  Creates a follower applying what the leader at the other end of fd ships    *
+*  to img. The follower takes over fd.                                         *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL, sealed or a snapshot, or fd is negative.        *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_REPLICA_DISCONNECTED: fd could not be written.                         *
+*   Any error of ufsStoreSnapshot.                                             *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image, a replica or one without storage or areas.     *
+*  -fd: A stream socket connected to a leader.                                 *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsFollowerPtr: The follower, NULL on error.                               *
+*                                                                              *
+\******************************************************************************/
+ufsFollowerPtr ufsFollowerCreate( ufsImagePtr img, int fd );
+
+/******************************************************************************\
+* ufsFollowerFree                                                              *
+*                                                                              *
+*  Disconnects from the leader and frees follower, the image stays a replica.  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -follower: The follower, may be NULL.                                       *
+*                                                                              *
+\******************************************************************************/
+void ufsFollowerFree( ufsFollowerPtr follower );
+
+/******************************************************************************\
+* ufsFollowerPoll                                                              *
+*                                                                              *
+*  Waits up to timeout milliseconds for a stream and applies it.               *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: follower is NULL or was promoted.                            *
+*   UFS_REPLICA_DISCONNECTED: The leader went away or turned the follower      *
+*                             away.                                            *
+*   Any error of ufsReceive and ufsStoreSnapshot.                              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -follower: The follower.                                                    *
+*  -timeout: The time to wait in milliseconds, -1 to wait for ever.            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -int: 1 when a stream was applied, 0 when none came, -1 on error.           *
+*                                                                              *
+\******************************************************************************/
+int ufsFollowerPoll( ufsFollowerPtr follower, int timeout );
+
+/******************************************************************************\
+* ufsFollowerStaleness                                                         *
+*                                                                              *
+*  Gets the time since the follower applied a stream, or since it was          *
+*  created if it never did.                                                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -follower: The follower.                                                    *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The time in nanoseconds, 0 if follower is NULL.                  *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsFollowerStaleness( ufsFollowerPtr follower );
+
+/******************************************************************************\
+* ufsFollowerPromote                                                           *
+*                                                                              *
+*  Disconnects from the leader and turns the image into a source with          *
+*  ufsStorePromote. A leader created on the image serves the followers of the  *
+*  old leader that are at the same generation.                                 *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: follower is NULL, was promoted or never applied a stream.    *
+*   Any error of ufsStorePromote and ufsImageSync.                             *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -follower: The follower.                                                    *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsFollowerPromote( ufsFollowerPtr follower );
+
+#endif /* UFS_REPLICA_H */
@@ -0,0 +1,643 @@
+/******************************************************************************\
+*  ufs_scan.c                                                                  *
+*                                                                              *
+*  Contains the definitions for the parallel scanner of the external fs.       *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "ufs_base_index.h"
+#include "ufs_scan.h"
+#include "ufs_store.h"
+#include <unistd.h>
+
+/* What getdents64 fills the buffer with, glibc only has a wrapper since 2.30.*/
+struct direntStruct {
+    uint64_t ino;
+    int64_t off;
+    unsigned short reclen;
+    unsigned char type;
+    char name[];
+};
+
+/* Records are 8 byte aligned and hold at least a name and its NUL.           */
+#define MAX_ENTRIES ( UFS_SCAN_BUFFER_BYTES /                                 \
+                      ( offsetof( struct direntStruct, name ) + 2 ) + 1 )
+
+struct taskStruct {
+    /* Relative to the root, "." for the root itself.                         */
+    char *path;
+    uint64_t dir;
+};
+
+struct dequeStruct {
+    pthread_mutex_t lock;
+    struct taskStruct *tasks;
+    uint64_t head,
+             count,
+             capacity;
+};
+
+struct scanStruct {
+    int rootFd;
+    struct ufsScanOptionsStruct options;
+    ufsScanSink sink;
+    void *userData;
+
+    pthread_mutex_t lock;
+    /* Signalled on new tasks, on the last directory and on failure.          */
+    pthread_cond_t work;
+    /* Directories found and not done with, queued ones among them.           */
+    uint64_t pending,
+             queued;
+    uint64_t nextDir;
+    uint64_t idle;
+    bool failed;
+    ufsStatusType error;
+    struct ufsScanStatsStruct stats;
+
+    /* Serialises the sink.                                                   */
+    pthread_mutex_t sinkLock;
+
+    struct dequeStruct deques[ UFS_SCAN_MAX_THREADS ];
+    uint64_t numThreads;
+};
+
+struct workerStruct {
+    struct scanStruct *scan;
+    uint64_t index;
+    pthread_t thread;
+    char *buffer;
+    struct ufsScanEntryStruct *entries;
+    struct ufsScanStatsStruct stats;
+};
+
+struct ufsScanLoaderStruct {
+    ufsImagePtr img;
+    /* Storage of every loaded directory by scan identifier, -1 if unknown.   */
+    ufsIdType *dirs;
+    uint64_t numDirs;
+};
+
+static void *worker( void *arg );
+static bool takeTask( struct workerStruct *self, struct taskStruct *task );
+static bool pushTask( struct dequeStruct *deque, struct taskStruct task );
+static void scanDirectory( struct workerStruct *self, struct taskStruct task );
+static bool fillEntry( struct workerStruct *self, int fd,
+                       const struct direntStruct *dirent,
+                       struct ufsScanEntryStruct *entry );
+static char *joinPath( const char *path, const char *name );
+static void fail( struct scanStruct *scan, ufsStatusType error );
+
+bool ufsScan( const char *root, struct ufsScanOptionsStruct options,
+              ufsScanSink sink, void *userData,
+              struct ufsScanStatsStruct *stats )
+{
+    struct scanStruct *scan;
+    struct workerStruct *workers;
+    struct taskStruct task;
+    uint64_t i, j;
+    long cpus;
+    bool ok;
+
+    if ( !root || !sink || options.numThreads > UFS_SCAN_MAX_THREADS ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !options.numThreads ) {
+        cpus = sysconf( _SC_NPROCESSORS_ONLN );
+        options.numThreads = cpus < 1 ? 1 : (uint64_t) cpus;
+        if ( options.numThreads > UFS_SCAN_MAX_THREADS )
+            options.numThreads = UFS_SCAN_MAX_THREADS;
+    }
+
+    scan = calloc( 1, sizeof( *scan ) );
+    workers = calloc( options.numThreads, sizeof( *workers ) );
+    task.path = strdup( "." );
+    task.dir = 0;
+    if ( !scan || !workers || !task.path ) {
+        free( task.path );
+        free( workers );
+        free( scan );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    scan -> rootFd = open( root, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    if ( scan -> rootFd < 0 ) {
+        free( task.path );
+        free( workers );
+        free( scan );
+        ufsErrno = errno == ENOMEM ? UFS_OUT_OF_MEMORY : UFS_DOES_NOT_EXIST;
+        return false;
+    }
+
+    scan -> options = options;
+    scan -> sink = sink;
+    scan -> userData = userData;
+    scan -> numThreads = options.numThreads;
+    scan -> nextDir = 1;
+    scan -> error = UFS_NO_ERROR;
+    pthread_mutex_init( &scan -> lock, NULL );
+    pthread_cond_init( &scan -> work, NULL );
+    pthread_mutex_init( &scan -> sinkLock, NULL );
+    for ( i = 0; i < scan -> numThreads; i++ )
+        pthread_mutex_init( &scan -> deques[i].lock, NULL );
+
+    if ( !pushTask( &scan -> deques[0], task ) ) {
+        free( task.path );
+        scan -> failed = true;
+        scan -> error = UFS_OUT_OF_MEMORY;
+    } else {
+        scan -> pending = scan -> queued = 1;
+    }
+
+    /* The calling thread is the first worker, a scan goes on with as many    */
+    /* threads as could be started.                                           */
+    for ( i = 0; i < scan -> numThreads; i++ ) {
+        workers[i].scan = scan;
+        workers[i].index = i;
+    }
+    for ( i = 1; i < scan -> numThreads; i++ ) {
+        if ( pthread_create( &workers[i].thread, NULL, worker,
+                             &workers[i] ) )
+            break;
+    }
+    worker( &workers[0] );
+    for ( j = 1; j < i; j++ )
+        pthread_join( workers[j].thread, NULL );
+
+    for ( i = 0; i < scan -> numThreads; i++ ) {
+        for ( j = 0; j < scan -> deques[i].count; j++ ) {
+            free( scan -> deques[i].tasks[ ( scan -> deques[i].head + j ) %
+                                           scan -> deques[i].capacity ].path );
+        }
+        free( scan -> deques[i].tasks );
+        pthread_mutex_destroy( &scan -> deques[i].lock );
+    }
+
+    ok = !scan -> failed;
+    if ( stats )
+        *stats = scan -> stats;
+    ufsErrno = scan -> error;
+
+    close( scan -> rootFd );
+    pthread_mutex_destroy( &scan -> sinkLock );
+    pthread_cond_destroy( &scan -> work );
+    pthread_mutex_destroy( &scan -> lock );
+    free( workers );
+    free( scan );
+    return ok;
+}
+
+ufsScanLoaderPtr ufsScanLoaderCreate( ufsImagePtr img, ufsIdType dir )
+{
+    struct ufsScanLoaderStruct *loader;
+
+    if ( !img || dir < 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    loader = calloc( 1, sizeof( *loader ) );
+    if ( loader )
+        loader -> dirs = malloc( sizeof( *loader -> dirs ) );
+
+    if ( !loader || !loader -> dirs ) {
+        free( loader );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    loader -> img = img;
+    loader -> dirs[0] = dir;
+    loader -> numDirs = 1;
+    ufsErrno = UFS_NO_ERROR;
+    return loader;
+}
+
+void ufsScanLoaderFree( ufsScanLoaderPtr loader )
+{
+    if ( !loader )
+        return;
+
+    free( loader -> dirs );
+    free( loader );
+}
+
+bool ufsScanLoad( const struct ufsScanEntryStruct *entries,
+                  uint64_t numEntries, void *userData )
+{
+    struct ufsScanLoaderStruct *loader;
+    struct ufsBaseAttrStruct attr;
+    ufsIdType *dirs, parent, id;
+    uint64_t i, size;
+    bool indexed, found;
+
+    loader = userData;
+    indexed = ufsBaseIndexHas( loader -> img );
+    for ( i = 0; i < numEntries; i++ ) {
+        parent = ufsScanLoaderGetDirectory( loader, entries[i].parent );
+        if ( parent < 0 ) {
+            ufsErrno = UFS_BAD_CALL;
+            return false;
+        }
+
+        id = ufsStoreGetStorage( loader -> img, parent, entries[i].name );
+        found = id >= 0;
+        if ( id < 0 && ufsErrno == UFS_FILE_DOES_NOT_EXIST )
+            id = ufsStoreAddStorage( loader -> img, parent, entries[i].name,
+                                     S_ISDIR( entries[i].mode ) );
+        if ( id < 0 )
+            return false;
+
+        /* What's in a directory is seen again after it, entries without a    */
+        /* ctime weren't stat'ed for the index and are left unknown.          */
+        if ( indexed ) {
+            if ( found && entries[i].dir &&
+                 !ufsBaseIndexForget( loader -> img, id ) )
+                return false;
+
+            attr = (struct ufsBaseAttrStruct) {
+                .mode = entries[i].mode, .inode = entries[i].inode,
+                .size = entries[i].size, .mtime = entries[i].mtime,
+                .ctime = entries[i].ctime
+            };
+            if ( !ufsBaseIndexSet( loader -> img, id, entries[i].ctime ?
+                                   UFS_BASE_RECORD_PRESENT :
+                                   UFS_BASE_RECORD_UNKNOWN, &attr ) )
+                return false;
+        }
+
+        if ( !entries[i].dir )
+            continue;
+
+        /* Directories are numbered in the order they are found, the array    */
+        /* grows about as fast as the scan goes.                              */
+        if ( entries[i].dir >= loader -> numDirs ) {
+            size = loader -> numDirs * 2;
+            if ( size <= entries[i].dir )
+                size = entries[i].dir + 1;
+
+            dirs = realloc( loader -> dirs, size * sizeof( *dirs ) );
+            if ( !dirs ) {
+                ufsErrno = UFS_OUT_OF_MEMORY;
+                return false;
+            }
+
+            for ( ; loader -> numDirs < size; loader -> numDirs++ )
+                dirs[ loader -> numDirs ] = -1;
+            loader -> dirs = dirs;
+        }
+
+        loader -> dirs[ entries[i].dir ] = id;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+void ufsScanLoadDone( uint64_t dir, void *userData )
+{
+    struct ufsScanLoaderStruct *loader;
+    struct ufsBaseAttrStruct attr;
+    ufsIdType id;
+
+    loader = userData;
+    id = ufsScanLoaderGetDirectory( loader, dir );
+    if ( id > 0 && ufsBaseIndexGet( loader -> img, id, &attr ) ==
+                   UFS_BASE_RECORD_PRESENT )
+        ufsBaseIndexSet( loader -> img, id, UFS_BASE_RECORD_LISTED, &attr );
+}
+
+ufsIdType ufsScanLoaderGetDirectory( ufsScanLoaderPtr loader, uint64_t dir )
+{
+    if ( dir >= loader -> numDirs )
+        return -1;
+
+    return loader -> dirs[ dir ];
+}
+
+static void *worker( void *arg )
+{
+    struct workerStruct *self;
+    struct scanStruct *scan;
+    struct taskStruct task;
+
+    self = arg;
+    scan = self -> scan;
+    self -> buffer = malloc( UFS_SCAN_BUFFER_BYTES );
+    self -> entries = malloc( MAX_ENTRIES * sizeof( *self -> entries ) );
+    if ( !self -> buffer || !self -> entries )
+        fail( scan, UFS_OUT_OF_MEMORY );
+
+    while ( takeTask( self, &task ) ) {
+        scanDirectory( self, task );
+        free( task.path );
+
+        pthread_mutex_lock( &scan -> lock );
+        if ( !--scan -> pending )
+            pthread_cond_broadcast( &scan -> work );
+        pthread_mutex_unlock( &scan -> lock );
+    }
+
+    pthread_mutex_lock( &scan -> lock );
+    scan -> stats.directories += self -> stats.directories;
+    scan -> stats.files += self -> stats.files;
+    scan -> stats.errors += self -> stats.errors;
+    scan -> stats.steals += self -> stats.steals;
+    pthread_mutex_unlock( &scan -> lock );
+
+    free( self -> entries );
+    free( self -> buffer );
+    return NULL;
+}
+
+/* Takes the newest task of the worker, or else the oldest of another one.    */
+/* Returns false once the scan is over.                                       */
+static bool takeTask( struct workerStruct *self, struct taskStruct *task )
+{
+    struct scanStruct *scan;
+    struct dequeStruct *deque;
+    uint64_t i;
+    bool found, done;
+
+    scan = self -> scan;
+    for ( ;; ) {
+        found = false;
+        for ( i = 0; i < scan -> numThreads && !found; i++ ) {
+            deque = &scan -> deques[ ( self -> index + i ) %
+                                     scan -> numThreads ];
+            pthread_mutex_lock( &deque -> lock );
+            if ( deque -> count && !i ) {
+                *task = deque -> tasks[ ( deque -> head + deque -> count - 1 ) %
+                                        deque -> capacity ];
+                deque -> count--;
+                found = true;
+            } else if ( deque -> count ) {
+                *task = deque -> tasks[ deque -> head ];
+                deque -> head = ( deque -> head + 1 ) % deque -> capacity;
+                deque -> count--;
+                self -> stats.steals++;
+                found = true;
+            }
+            pthread_mutex_unlock( &deque -> lock );
+        }
+
+        pthread_mutex_lock( &scan -> lock );
+        if ( found ) {
+            scan -> queued--;
+            found = !scan -> failed;
+            pthread_mutex_unlock( &scan -> lock );
+            /* ufsScan frees what's left of a failed scan.                    */
+            if ( !found )
+                free( task -> path );
+            return found;
+        }
+
+        while ( !scan -> queued && scan -> pending && !scan -> failed ) {
+            scan -> idle++;
+            pthread_cond_wait( &scan -> work, &scan -> lock );
+            scan -> idle--;
+        }
+
+        done = !scan -> pending || scan -> failed;
+        pthread_mutex_unlock( &scan -> lock );
+        if ( done )
+            return false;
+    }
+}
+
+static bool pushTask( struct dequeStruct *deque, struct taskStruct task )
+{
+    struct taskStruct *tasks;
+    uint64_t i, capacity;
+
+    pthread_mutex_lock( &deque -> lock );
+    if ( deque -> count == deque -> capacity ) {
+        capacity = deque -> capacity ? deque -> capacity * 2 : 64;
+        tasks = malloc( capacity * sizeof( *tasks ) );
+        if ( !tasks ) {
+            pthread_mutex_unlock( &deque -> lock );
+            return false;
+        }
+
+        for ( i = 0; i < deque -> count; i++ )
+            tasks[i] = deque -> tasks[ ( deque -> head + i ) %
+                                       deque -> capacity ];
+        free( deque -> tasks );
+        deque -> tasks = tasks;
+        deque -> head = 0;
+        deque -> capacity = capacity;
+    }
+
+    deque -> tasks[ ( deque -> head + deque -> count ) %
+                    deque -> capacity ] = task;
+    deque -> count++;
+    pthread_mutex_unlock( &deque -> lock );
+    return true;
+}
+
+/* Hands the directory to the sink a getdents64 buffer at a time. The         */
+/* subdirectories of a buffer get their identifiers before the sink sees      */
+/* them and are queued after, so no directory is read before it's reported.   */
+static void scanDirectory( struct workerStruct *self, struct taskStruct task )
+{
+    struct scanStruct *scan;
+    struct direntStruct *dirent;
+    struct taskStruct child;
+    uint64_t numEntries, numDirs, nextDir, pushed, i;
+    ufsStatusType error;
+    long bytes, offset;
+    int fd;
+    bool ok, complete, missed;
+
+    scan = self -> scan;
+    fd = openat( scan -> rootFd, task.path,
+                 O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC );
+    if ( fd < 0 ) {
+        self -> stats.errors++;
+        return;
+    }
+    self -> stats.directories++;
+
+    complete = missed = false;
+    for ( ;; ) {
+        bytes = syscall( SYS_getdents64, fd, self -> buffer,
+                         UFS_SCAN_BUFFER_BYTES );
+        if ( bytes <= 0 ) {
+            if ( bytes < 0 )
+                self -> stats.errors++;
+            complete = !bytes;
+            break;
+        }
+
+        numEntries = numDirs = 0;
+        for ( offset = 0; offset < bytes; offset += dirent -> reclen ) {
+            dirent = (struct direntStruct*)( self -> buffer + offset );
+            if ( dirent -> name[0] == '.' && ( !dirent -> name[1] ||
+                 ( dirent -> name[1] == '.' && !dirent -> name[2] ) ) )
+                continue;
+
+            if ( !fillEntry( self, fd, dirent,
+                             &self -> entries[ numEntries ] ) ) {
+                missed = true;
+                continue;
+            }
+
+            self -> entries[ numEntries ].parent = task.dir;
+            numDirs += S_ISDIR( self -> entries[ numEntries ].mode );
+            numEntries++;
+        }
+
+        if ( !numEntries )
+            continue;
+
+        pthread_mutex_lock( &scan -> lock );
+        nextDir = scan -> nextDir;
+        scan -> nextDir += numDirs;
+        ok = !scan -> failed;
+        pthread_mutex_unlock( &scan -> lock );
+        if ( !ok )
+            break;
+
+        for ( i = 0; i < numEntries; i++ ) {
+            self -> entries[i].dir = S_ISDIR( self -> entries[i].mode ) ?
+                                     nextDir++ : 0;
+            self -> stats.files += !self -> entries[i].dir;
+        }
+
+        pthread_mutex_lock( &scan -> sinkLock );
+        ok = scan -> sink( self -> entries, numEntries, scan -> userData );
+        error = ufsErrno;
+        pthread_mutex_unlock( &scan -> sinkLock );
+        if ( !ok ) {
+            fail( scan, error == UFS_NO_ERROR ? UFS_UNKNOWN_ERROR : error );
+            break;
+        }
+
+        for ( i = pushed = 0; i < numEntries; i++ ) {
+            if ( !self -> entries[i].dir )
+                continue;
+
+            child.path = joinPath( task.path, self -> entries[i].name );
+            child.dir = self -> entries[i].dir;
+            if ( !child.path || !pushTask( &scan -> deques[ self -> index ],
+                                           child ) ) {
+                free( child.path );
+                fail( scan, UFS_OUT_OF_MEMORY );
+                break;
+            }
+            pushed++;
+        }
+
+        pthread_mutex_lock( &scan -> lock );
+        scan -> pending += pushed;
+        scan -> queued += pushed;
+        if ( pushed && scan -> idle )
+            pthread_cond_broadcast( &scan -> work );
+        pthread_mutex_unlock( &scan -> lock );
+        if ( pushed < numDirs )
+            break;
+    }
+
+    if ( complete && !missed && scan -> options.done ) {
+        pthread_mutex_lock( &scan -> sinkLock );
+        scan -> options.done( task.dir, scan -> userData );
+        pthread_mutex_unlock( &scan -> sinkLock );
+    }
+
+    close( fd );
+}
+
+/* Only goes to statx when getdents64 doesn't have all that was asked for.    */
+static bool fillEntry( struct workerStruct *self, int fd,
+                       const struct direntStruct *dirent,
+                       struct ufsScanEntryStruct *entry )
+{
+    struct statx stx;
+    unsigned int mask;
+
+    entry -> name = dirent -> name;
+    entry -> inode = dirent -> ino;
+    entry -> mode = DTTOIF( dirent -> type );
+    entry -> size = 0;
+    entry -> mtime = 0;
+    entry -> ctime = 0;
+
+    mask = self -> scan -> options.statxMask;
+    if ( dirent -> type == DT_UNKNOWN )
+        mask |= STATX_TYPE;
+    if ( !mask )
+        return true;
+
+    if ( statx( fd, dirent -> name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                mask, &stx ) ) {
+        /* Gone since it was listed.                                          */
+        self -> stats.errors++;
+        return false;
+    }
+
+    if ( stx.stx_mask & STATX_MODE )
+        entry -> mode = stx.stx_mode;
+    else if ( stx.stx_mask & STATX_TYPE )
+        entry -> mode = stx.stx_mode & S_IFMT;
+    if ( stx.stx_mask & STATX_INO )
+        entry -> inode = stx.stx_ino;
+    if ( stx.stx_mask & STATX_SIZE )
+        entry -> size = stx.stx_size;
+    if ( stx.stx_mask & STATX_MTIME )
+        entry -> mtime = (uint64_t) stx.stx_mtime.tv_sec * 1000000000 +
+                         stx.stx_mtime.tv_nsec;
+    if ( stx.stx_mask & STATX_CTIME )
+        entry -> ctime = (uint64_t) stx.stx_ctime.tv_sec * 1000000000 +
+                         stx.stx_ctime.tv_nsec;
+    return true;
+}
+
+static char *joinPath( const char *path, const char *name )
+{
+    size_t pathLength, nameLength;
+    char *joined;
+
+    if ( path[0] == '.' && !path[1] )
+        return strdup( name );
+
+    pathLength = strlen( path );
+    nameLength = strlen( name );
+    joined = malloc( pathLength + nameLength + 2 );
+    if ( !joined )
+        return NULL;
+
+    memcpy( joined, path, pathLength );
+    joined[ pathLength ] = '/';
+    memcpy( joined + pathLength + 1, name, nameLength + 1 );
+    return joined;
+}
+
+/* The first failure is the one reported.                                     */
+static void fail( struct scanStruct *scan, ufsStatusType error )
+{
+    pthread_mutex_lock( &scan -> lock );
+    if ( !scan -> failed ) {
+        scan -> failed = true;
+        scan -> error = error;
+    }
+    pthread_cond_broadcast( &scan -> work );
+    pthread_mutex_unlock( &scan -> lock );
+}
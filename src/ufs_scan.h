@@ -0,0 +1,209 @@
+/******************************************************************************\
+*  ufs_scan.h                                                                  *
+*                                                                              *
+*  Internal header for the parallel scanner of the external fs.                *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* The scanner walks the external fs under a root with a pool of workers.     */
+/* Each worker has a deque of directories, it takes the newest of its own     */
+/* and steals the oldest of another's when it runs out, so workers stay deep  */
+/* in their own subtrees and thieves take large ones. Directories are read    */
+/* with getdents64 into a large buffer, relative to an fd of the directory,   */
+/* entries are only stat'ed when the caller asks for more than the name,      */
+/* inode and type getdents64 gives, or the filesystem doesn't give a type.    */
+/*                                                                            */
+/* Entries go to a sink a buffer at a time, the sink is never called by two   */
+/* workers at once. Every directory gets a scan identifier, 0 is the root.    */
+/* A directory is handed to the sink before anything in it is, so a sink      */
+/* always knows the parent of an entry. Directories whose every entry went to */
+/* the sink are handed to the done callback after, when there's one.          */
+/*                                                                            */
+/* Symbolic links are reported, not followed. Directories that can't be read  */
+/* are counted as errors and skipped, the scan goes on.                       */
+/*                                                                            */
+/* ufsScanLoad is a sink that loads the scan into an image as storage, which  */
+/* BASE holds since it has no mappings, ufsScanLoaderPtr is its userData.     */
+/* Images with a BASE index get the attributes of every entry recorded when   */
+/* the scan asks for them, ufsScanLoadDone marks listed directories, see      */
+/* ufs_base_index.h.                                                          */
+
+#ifndef UFS_SCAN_H
+#define UFS_SCAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs_defs.h"
+#include "ufs_image.h"
+
+#define UFS_SCAN_MAX_THREADS (64)
+#define UFS_SCAN_BUFFER_BYTES (256 * 1024)
+
+typedef struct ufsScanLoaderStruct *ufsScanLoaderPtr;
+
+struct ufsScanEntryStruct {
+    /* The scan identifier of the directory holding the entry.                */
+    uint64_t parent;
+    /* The scan identifier of the entry, 0 unless it's a directory.           */
+    uint64_t dir;
+    /* Valid until the sink returns.                                          */
+    const char *name;
+    uint64_t inode;
+    /* The file type bits, the whole mode when STATX_MODE was asked for.      */
+    uint32_t mode;
+    /* 0 unless STATX_SIZE was asked for.                                     */
+    uint64_t size;
+    /* Nanoseconds since the epoch, 0 unless STATX_MTIME was asked for.       */
+    uint64_t mtime;
+    /* Nanoseconds since the epoch, 0 unless STATX_CTIME was asked for.       */
+    uint64_t ctime;
+};
+
+/* Returns false to stop the scan, with ufsErrno set.                         */
+typedef bool (*ufsScanSink)( const struct ufsScanEntryStruct *entries,
+                             uint64_t numEntries, void *userData );
+
+/* Called like the sink with the scan identifier of a directory read to the   */
+/* end, none of its entries was missed.                                       */
+typedef void (*ufsScanDone)( uint64_t dir, void *userData );
+
+struct ufsScanOptionsStruct {
+    /* 0 for one per online CPU.                                              */
+    uint64_t numThreads;
+    /* statx fields to fill beyond getdents64, 0 for none.                    */
+    unsigned int statxMask;
+    /* May be NULL.                                                           */
+    ufsScanDone done;
+};
+
+struct ufsScanStatsStruct {
+    uint64_t directories,
+             files,
+             errors,
+             steals;
+};
+
+/******************************************************************************\
+* ufsScan                                                                      *
+*                                                                              *
+*  Walks the tree under root, handing every entry in it to sink.               *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: root or sink are NULL, or numThreads is above                *
+*                 UFS_SCAN_MAX_THREADS.                                        *
+*   UFS_DOES_NOT_EXIST: root can't be opened as a directory.                   *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   Whatever sink sets when it stops the scan.                                 *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -root: The directory to walk.                                               *
+*  -options: How to walk it.                                                   *
+*  -sink: Called with the entries of every directory.                          *
+*  -userData: Passed to sink and done.                                         *
+*  -stats: Filled with what the scan saw, may be NULL.                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the whole tree was walked, false otherwise.                  *
+*                                                                              *
+\******************************************************************************/
+bool ufsScan( const char *root, struct ufsScanOptionsStruct options,
+              ufsScanSink sink, void *userData,
+              struct ufsScanStatsStruct *stats );
+
+/******************************************************************************\
+* ufsScanLoaderCreate                                                          *
+*                                                                              *
+*  Creates a loader of scans into img, the root of the scan goes in dir.       *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL or dir is negative.                              *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: A validated, writable image.                                          *
+*  -dir: A directory of img, 0 for the top level namespace.                    *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsScanLoaderPtr: The loader, NULL on error.                               *
+*                                                                              *
+\******************************************************************************/
+ufsScanLoaderPtr ufsScanLoaderCreate( ufsImagePtr img, ufsIdType dir );
+
+/******************************************************************************\
+* ufsScanLoaderFree                                                            *
+*                                                                              *
+*  Frees loader, what it loaded stays in the image.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -loader: The loader, may be NULL.                                           *
+*                                                                              *
+\******************************************************************************/
+void ufsScanLoaderFree( ufsScanLoaderPtr loader );
+
+/******************************************************************************\
+* ufsScanLoad                                                                  *
+*                                                                              *
+*  A sink adding entries to the image of a loader. Storage the image already   *
+*  has is kept as is, so a scan may be loaded again. Entries with a ctime are  *
+*  recorded in the BASE index of the image when it has one, a directory that   *
+*  was there before has its entries marked ABSENT until they're seen again.    *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_OUT_OF_MEMORY: The image or the system is out of memory.               *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*   UFS_BAD_CALL: An entry's directory wasn't loaded.                          *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -entries: The entries.                                                      *
+*  -numEntries: The number of entries.                                         *
+*  -userData: The loader.                                                      *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsScanLoad( const struct ufsScanEntryStruct *entries,
+                  uint64_t numEntries, void *userData );
+
+/******************************************************************************\
+* ufsScanLoadDone                                                              *
+*                                                                              *
+*  A done callback marking a directory LISTED in the BASE index of the image   *
+*  of a loader, does nothing for images without one.                           *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -dir: The scan identifier of the directory.                                 *
+*  -userData: The loader.                                                      *
+*                                                                              *
+\******************************************************************************/
+void ufsScanLoadDone( uint64_t dir, void *userData );
+
+/******************************************************************************\
+* ufsScanLoaderGetDirectory                                                    *
+*                                                                              *
+*  Gets the storage a directory of the scan was loaded as.                     *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -loader: The loader, not NULL.                                              *
+*  -dir: The scan identifier of the directory.                                 *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsIdType: The storage, -1 if the directory wasn't loaded.                 *
+*                                                                              *
+\******************************************************************************/
+ufsIdType ufsScanLoaderGetDirectory( ufsScanLoaderPtr loader, uint64_t dir );
+
+#endif /* UFS_SCAN_H */
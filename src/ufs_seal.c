@@ -0,0 +1,1204 @@
+/******************************************************************************\
+*  ufs_seal.c                                                                  *
+*                                                                              *
+*  Contains the definitions for sealed ufs images.                             *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ufs_defs.h"
+#include "ufs_hash.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_layout.h"
+#include "ufs_seal.h"
+#include "ufs_store.h"
+
+/* Give up on a bucket after this many pilots and retry with another seed.   */
+#define MAX_PILOT (1u << 24)
+#define MAX_SEEDS (16)
+
+#define ALIGN (8)
+
+static const uint64_t sectionElementSizes[ UFS_SEAL_SECTION_COUNT ] = {
+    [ UFS_SEAL_STORAGE_PILOTS ] = sizeof( uint32_t ),
+    [ UFS_SEAL_STORAGE_SLOTS ] = sizeof( uint32_t ),
+    [ UFS_SEAL_AREA_PILOTS ] = sizeof( uint32_t ),
+    [ UFS_SEAL_AREA_SLOTS ] = sizeof( uint32_t ),
+    [ UFS_SEAL_MAPPING_OFFSETS ] = sizeof( uint64_t ),
+    [ UFS_SEAL_MAPPING_AREAS ] = sizeof( uint32_t ),
+    [ UFS_SEAL_NAME_BLOCKS ] = sizeof( uint64_t ),
+};
+
+/* Everything ufsSeal computes before writing the sealed image.              */
+struct sealBuildStruct {
+    ufsImagePtr img;
+
+    uint64_t numStorage, numAreas, numMappings, numNames, numRoots;
+
+    /* Old id -> new id, and new id - 1 -> old id.                           */
+    ufsIdType *newStorage, *oldStorage,
+              *newArea, *oldArea;
+
+    struct ufsSealedFileStruct *files;
+    uint32_t *areaNames;
+
+    const char **names;
+
+    uint64_t *mappingOffsets;
+    uint32_t *mappingAreas;
+
+    struct ufsSealHashStruct storageHash, areaHash;
+    uint32_t *storagePilots, *storageSlots,
+             *areaPilots, *areaSlots;
+
+    uint64_t *nameBlocks;
+    uint8_t *nameData;
+    uint64_t nameDataSize;
+};
+
+struct collectStruct {
+    ufsIdType *ids;
+    uint64_t count, capacity;
+};
+
+static inline struct ufsSealHeaderStruct *getSealHeader( ufsImagePtr img );
+static inline void *getSection( ufsImagePtr img,
+                                enum ufsSealSectionEnum section );
+static inline void *getHeaderSection( ufsImagePtr img,
+                                      enum ufsTyepesEnum type );
+static inline struct ufsSealedFileStruct *getFile( ufsImagePtr img,
+                                                   ufsIdType id );
+static inline uint64_t hashBucket( uint64_t hash,
+                                   const struct ufsSealHashStruct *mph );
+static inline uint64_t hashSlot( uint64_t hash, uint32_t pilot,
+                                 const struct ufsSealHashStruct *mph,
+                                 uint64_t numKeys );
+static uint32_t hashLookup( ufsImagePtr img, uint64_t hash,
+                            enum ufsSealSectionEnum pilots,
+                            enum ufsSealSectionEnum slots,
+                            const struct ufsSealHashStruct *mph,
+                            uint64_t numKeys );
+static bool decodeName( ufsImagePtr img, uint32_t rank, char *buff,
+                        uint64_t buffSize );
+static bool validateSlots( ufsImagePtr img, enum ufsSealSectionEnum slots,
+                           uint64_t numKeys );
+static bool validateMappings( ufsImagePtr img );
+static bool collectId( ufsIdType id, void *userData );
+static int compareNames( const void *a, const void *b );
+static int compareIdsByName( const void *a, const void *b );
+static int compareAreaIds( const void *a, const void *b );
+static int compareIds( const void *a, const void *b );
+static uint64_t eytzinger( const ufsIdType *sorted, ufsIdType *out,
+                           uint64_t count, uint64_t i, uint64_t k );
+static bool buildOrder( struct sealBuildStruct *build );
+static bool buildAreas( struct sealBuildStruct *build );
+static bool buildNames( struct sealBuildStruct *build );
+static bool buildMappings( struct sealBuildStruct *build );
+static bool buildHash( const uint64_t *hashes, uint64_t numKeys,
+                       struct ufsSealHashStruct *mph,
+                       uint32_t **pilots, uint32_t **slots );
+static bool writeImage( struct sealBuildStruct *build, const char *outPath );
+static uint32_t nameRank( struct sealBuildStruct *build, const char *name );
+static uint64_t encodeVarint( uint8_t *out, uint64_t val );
+static uint64_t decodeVarint( const uint8_t **in );
+static void freeBuild( struct sealBuildStruct *build );
+
+/* qsort has no user data, the comparators need the image being sealed.     */
+static __thread ufsImagePtr sortImage;
+
+bool ufsSeal( ufsImagePtr img, const char *outPath )
+{
+    struct sealBuildStruct build;
+    bool ret;
+
+    if ( !img || !outPath || access( outPath, F_OK ) == 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( ufsLayoutHeader( img ) -> flags & UFS_HEADER_FLAG_SEALED ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    memset( &build, 0, sizeof( build ) );
+    build.img = img;
+
+    ret = buildOrder( &build ) &&
+          buildAreas( &build ) &&
+          buildNames( &build ) &&
+          buildMappings( &build ) &&
+          writeImage( &build, outPath );
+
+    freeBuild( &build );
+
+    if ( ret )
+        ufsErrno = UFS_NO_ERROR;
+    return ret;
+}
+
+ufsImagePtr ufsSealValidate( ufsImagePtr img )
+{
+    struct ufsHeaderStruct *header;
+    struct ufsSealHeaderStruct *seal;
+    uint64_t size, i;
+
+    if ( !img ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    size = *(uint64_t*)img;
+    header = ufsLayoutHeader( img );
+
+    if ( header -> offsets[ UFS_TYPES_NODE ] +
+            sizeof( struct ufsSealHeaderStruct ) > size ||
+         header -> offsets[ UFS_TYPES_FILE ] + header -> sizes[ UFS_TYPES_FILE ] *
+            sizeof( struct ufsSealedFileStruct ) > size ||
+         header -> offsets[ UFS_TYPES_AREA ] + header -> sizes[ UFS_TYPES_AREA ] *
+            sizeof( uint32_t ) > size ||
+         header -> offsets[ UFS_TYPES_STRING ] +
+            header -> sizes[ UFS_TYPES_STRING ] > size )
+        goto badSize;
+
+    seal = getSealHeader( img );
+
+    for ( i = 0; i < UFS_SEAL_SECTION_COUNT; i++ ) {
+        if ( seal -> offsets[i] + seal -> sizes[i] * sectionElementSizes[i] >
+             size )
+            goto badSize;
+    }
+
+    if ( seal -> sizes[ UFS_SEAL_STORAGE_SLOTS ] !=
+            header -> sizes[ UFS_TYPES_FILE ] ||
+         seal -> sizes[ UFS_SEAL_AREA_SLOTS ] !=
+            header -> sizes[ UFS_TYPES_AREA ] ||
+         seal -> sizes[ UFS_SEAL_MAPPING_OFFSETS ] !=
+            header -> sizes[ UFS_TYPES_FILE ] + 1 ||
+         seal -> storageHash.numBuckets == 0 ||
+         seal -> sizes[ UFS_SEAL_STORAGE_PILOTS ] !=
+            seal -> storageHash.numBuckets ||
+         seal -> areaHash.numBuckets == 0 ||
+         seal -> sizes[ UFS_SEAL_AREA_PILOTS ] != seal -> areaHash.numBuckets ||
+         seal -> numRoots > header -> sizes[ UFS_TYPES_FILE ] ||
+         ( seal -> numNames + UFS_SEAL_BLOCK_NAMES - 1 ) /
+            UFS_SEAL_BLOCK_NAMES > seal -> sizes[ UFS_SEAL_NAME_BLOCKS ] )
+        goto badSize;
+
+    /* Lookups index the files, areas and mappings with what these tables     */
+    /* hold, none of it is checked again once the image is validated.         */
+    if ( !validateSlots( img, UFS_SEAL_STORAGE_SLOTS,
+                         header -> sizes[ UFS_TYPES_FILE ] ) ||
+         !validateSlots( img, UFS_SEAL_AREA_SLOTS,
+                         header -> sizes[ UFS_TYPES_AREA ] ) ||
+         !validateMappings( img ) )
+        goto badSize;
+
+    ufsErrno = UFS_NO_ERROR;
+    return img;
+
+badSize:
+    ufsImageFree( img );
+    ufsErrno = UFS_IMAGE_BAD_SIZE;
+    return NULL;
+}
+
+bool ufsSealGetName( ufsImagePtr img, enum ufsTyepesEnum type, ufsIdType id,
+                     char *buff, uint64_t buffSize )
+{
+    uint32_t rank;
+
+    if ( !img || !buff ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( type == UFS_TYPES_FILE ) {
+        if ( !ufsSealHasStorage( img, id ) ) {
+            ufsErrno = UFS_FILE_DOES_NOT_EXIST;
+            return false;
+        }
+        rank = getFile( img, id ) -> name;
+    } else if ( type == UFS_TYPES_AREA ) {
+        if ( !ufsSealHasArea( img, id ) ) {
+            ufsErrno = UFS_AREA_DOES_NOT_EXIST;
+            return false;
+        }
+        rank = ( (uint32_t*)getHeaderSection( img, UFS_TYPES_AREA ) )[ id - 1 ];
+    } else {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !decodeName( img, rank, buff, buffSize ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+ufsIdType ufsSealGetStorage( ufsImagePtr img,
+                             ufsIdType parent,
+                             const char *name )
+{
+    char buff[ UFS_SEAL_NAME_MAX ];
+    uint32_t id;
+
+    id = hashLookup( img, ufsHashString( name, parent ),
+                     UFS_SEAL_STORAGE_PILOTS, UFS_SEAL_STORAGE_SLOTS,
+                     &getSealHeader( img ) -> storageHash,
+                     ufsLayoutHeader( img ) -> sizes[ UFS_TYPES_FILE ] );
+
+    /* A perfect hash maps names it was not built with to arbitrary slots.   */
+    if ( !id || getFile( img, id ) -> parent != parent ||
+         !decodeName( img, getFile( img, id ) -> name, buff, sizeof( buff ) ) ||
+         strcmp( buff, name ) != 0 ) {
+        ufsErrno = UFS_FILE_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+bool ufsSealHasStorage( ufsImagePtr img, ufsIdType storage )
+{
+    return storage > 0 &&
+           storage <= ufsLayoutHeader( img ) -> sizes[ UFS_TYPES_FILE ];
+}
+
+bool ufsSealIsDirectory( ufsImagePtr img, ufsIdType storage )
+{
+    if ( !ufsSealHasStorage( img, storage ) ) {
+        ufsErrno = UFS_FILE_DOES_NOT_EXIST;
+        return false;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return getFile( img, storage ) -> isDirectory;
+}
+
+ufsIdType ufsSealGetParent( ufsImagePtr img, ufsIdType storage )
+{
+    if ( !ufsSealHasStorage( img, storage ) ) {
+        ufsErrno = UFS_FILE_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return getFile( img, storage ) -> parent;
+}
+
+ufsIdType ufsSealGetArea( ufsImagePtr img, const char *name )
+{
+    char buff[ UFS_SEAL_NAME_MAX ];
+    uint32_t id;
+
+    id = hashLookup( img, ufsHashString( name, 0 ),
+                     UFS_SEAL_AREA_PILOTS, UFS_SEAL_AREA_SLOTS,
+                     &getSealHeader( img ) -> areaHash,
+                     ufsLayoutHeader( img ) -> sizes[ UFS_TYPES_AREA ] );
+
+    if ( !id ||
+         !decodeName( img,
+                      ( (uint32_t*)getHeaderSection( img, UFS_TYPES_AREA ) )
+                          [ id - 1 ],
+                      buff, sizeof( buff ) ) ||
+         strcmp( buff, name ) != 0 ) {
+        ufsErrno = UFS_AREA_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+bool ufsSealHasArea( ufsImagePtr img, ufsIdType area )
+{
+    return area > 0 &&
+           area <= ufsLayoutHeader( img ) -> sizes[ UFS_TYPES_AREA ];
+}
+
+bool ufsSealProbeMapping( ufsImagePtr img, ufsIdType area, ufsIdType storage )
+{
+    uint64_t *offsets;
+    uint32_t *areas;
+    uint64_t low, high, mid;
+
+    if ( !ufsSealHasStorage( img, storage ) || !ufsSealHasArea( img, area ) ) {
+        ufsErrno = UFS_MAPPING_DOES_NOT_EXIST;
+        return false;
+    }
+
+    offsets = getSection( img, UFS_SEAL_MAPPING_OFFSETS );
+    areas = getSection( img, UFS_SEAL_MAPPING_AREAS );
+
+    low = offsets[ storage - 1 ];
+    high = offsets[ storage ];
+
+    while ( low < high ) {
+        mid = low + ( high - low ) / 2;
+
+        if ( areas[ mid ] == area ) {
+            ufsErrno = UFS_NO_ERROR;
+            return true;
+        }
+
+        if ( areas[ mid ] < area )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    ufsErrno = UFS_MAPPING_DOES_NOT_EXIST;
+    return false;
+}
+
+bool ufsSealIterateChildren( ufsImagePtr img,
+                             ufsIdType directory,
+                             ufsStoreIter iter,
+                             void *userData )
+{
+    struct ufsSealedFileStruct *dir;
+    ufsIdType first, count, i;
+
+    if ( directory == 0 ) {
+        first = 1;
+        count = getSealHeader( img ) -> numRoots;
+    } else if ( ufsSealHasStorage( img, directory ) ) {
+        dir = getFile( img, directory );
+        first = dir -> firstChild;
+        count = dir -> numChildren;
+    } else {
+        first = count = 0;
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        if ( !iter( first + i, userData ) )
+            break;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsSealIterateMappings( ufsImagePtr img,
+                             ufsIdType storage,
+                             ufsStoreIter iter,
+                             void *userData )
+{
+    uint64_t *offsets, i;
+    uint32_t *areas;
+
+    if ( ufsSealHasStorage( img, storage ) ) {
+        offsets = getSection( img, UFS_SEAL_MAPPING_OFFSETS );
+        areas = getSection( img, UFS_SEAL_MAPPING_AREAS );
+
+        for ( i = offsets[ storage - 1 ]; i < offsets[ storage ]; i++ ) {
+            if ( !iter( areas[i], userData ) )
+                break;
+        }
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsSealIterateAreaMappings( ufsImagePtr img,
+                                 ufsIdType area,
+                                 ufsStoreIter iter,
+                                 void *userData )
+{
+    ufsIdType storage,
+        numStorage = ufsLayoutHeader( img ) -> sizes[ UFS_TYPES_FILE ];
+
+    for ( storage = 1; storage <= numStorage; storage++ ) {
+        if ( ufsSealProbeMapping( img, area, storage ) &&
+             !iter( storage, userData ) )
+            break;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+static inline struct ufsSealHeaderStruct *getSealHeader( ufsImagePtr img )
+{
+    return (struct ufsSealHeaderStruct*)( (uint8_t*)img +
+        ufsLayoutHeader( img ) -> offsets[ UFS_TYPES_NODE ] );
+}
+
+static inline void *getSection( ufsImagePtr img,
+                                enum ufsSealSectionEnum section )
+{
+    return (uint8_t*)img + getSealHeader( img ) -> offsets[ section ];
+}
+
+/* Sealed images are packed, a fixed layout build can't compute these.      */
+static inline void *getHeaderSection( ufsImagePtr img,
+                                      enum ufsTyepesEnum type )
+{
+    return (uint8_t*)img + ufsLayoutHeader( img ) -> offsets[ type ];
+}
+
+static inline struct ufsSealedFileStruct *getFile( ufsImagePtr img,
+                                                   ufsIdType id )
+{
+    return (struct ufsSealedFileStruct*)( (uint8_t*)img +
+        ufsLayoutHeader( img ) -> offsets[ UFS_TYPES_FILE ] ) + ( id - 1 );
+}
+
+static inline uint64_t hashBucket( uint64_t hash,
+                                   const struct ufsSealHashStruct *mph )
+{
+    return ufsHashMix( hash ^ mph -> seed ) % mph -> numBuckets;
+}
+
+static inline uint64_t hashSlot( uint64_t hash, uint32_t pilot,
+                                 const struct ufsSealHashStruct *mph,
+                                 uint64_t numKeys )
+{
+    return ufsHashMix( hash ^ ufsHashMix( mph -> seed + pilot + 1 ) ) %
+           numKeys;
+}
+
+/* Returns the identifier in the slot hash falls to, 0 if there are no keys. */
+static uint32_t hashLookup( ufsImagePtr img, uint64_t hash,
+                            enum ufsSealSectionEnum pilots,
+                            enum ufsSealSectionEnum slots,
+                            const struct ufsSealHashStruct *mph,
+                            uint64_t numKeys )
+{
+    uint32_t pilot;
+
+    if ( !numKeys )
+        return 0;
+
+    pilot = ( (uint32_t*)getSection( img, pilots ) )[ hashBucket( hash, mph ) ];
+
+    return ( (uint32_t*)getSection( img, slots ) )
+        [ hashSlot( hash, pilot, mph, numKeys ) ];
+}
+
+/* A slot holds the id of one of the numKeys keys.                            */
+static bool validateSlots( ufsImagePtr img, enum ufsSealSectionEnum slots,
+                           uint64_t numKeys )
+{
+    uint32_t *ids;
+    uint64_t i;
+
+    ids = getSection( img, slots );
+    for ( i = 0; i < getSealHeader( img ) -> sizes[ slots ]; i++ ) {
+        if ( ids[i] > numKeys )
+            return false;
+    }
+
+    return true;
+}
+
+/* The offsets of the mapping table never decrease and end inside it, every  */
+/* area they point at exists.                                                 */
+static bool validateMappings( ufsImagePtr img )
+{
+    struct ufsSealHeaderStruct
+        *seal = getSealHeader( img );
+    uint64_t *offsets, numOffsets, i;
+    uint32_t *areas;
+
+    offsets = getSection( img, UFS_SEAL_MAPPING_OFFSETS );
+    areas = getSection( img, UFS_SEAL_MAPPING_AREAS );
+    numOffsets = seal -> sizes[ UFS_SEAL_MAPPING_OFFSETS ];
+
+    if ( offsets[0] != 0 ||
+         offsets[ numOffsets - 1 ] > seal -> sizes[ UFS_SEAL_MAPPING_AREAS ] )
+        return false;
+
+    for ( i = 1; i < numOffsets; i++ ) {
+        if ( offsets[i] < offsets[ i - 1 ] )
+            return false;
+    }
+
+    for ( i = 0; i < offsets[ numOffsets - 1 ]; i++ ) {
+        if ( !ufsSealHasArea( img, areas[i] ) )
+            return false;
+    }
+
+    return true;
+}
+
+/* Each entry of a block is ( shared prefix length, suffix length, suffix ).  */
+static bool decodeName( ufsImagePtr img, uint32_t rank, char *buff,
+                        uint64_t buffSize )
+{
+    struct ufsSealHeaderStruct
+        *seal = getSealHeader( img );
+    const uint8_t *data;
+    uint64_t shared, suffix, i;
+
+    if ( rank >= seal -> numNames )
+        return false;
+
+    data = (uint8_t*)getHeaderSection( img, UFS_TYPES_STRING ) +
+        ( (uint64_t*)getSection( img, UFS_SEAL_NAME_BLOCKS ) )
+            [ rank / UFS_SEAL_BLOCK_NAMES ];
+
+    for ( i = 0; i <= rank % UFS_SEAL_BLOCK_NAMES; i++ ) {
+        shared = decodeVarint( &data );
+        suffix = decodeVarint( &data );
+
+        if ( shared + suffix + 1 > buffSize )
+            return false;
+
+        memcpy( buff + shared, data, suffix );
+        buff[ shared + suffix ] = '\0';
+        data += suffix;
+    }
+
+    return true;
+}
+
+static bool collectId( ufsIdType id, void *userData )
+{
+    struct collectStruct
+        *collect = userData;
+    ufsIdType *ids;
+
+    if ( collect -> count == collect -> capacity ) {
+        collect -> capacity = collect -> capacity ? collect -> capacity * 2 : 16;
+        ids = realloc( collect -> ids,
+                       sizeof( ufsIdType ) * collect -> capacity );
+        if ( !ids ) {
+            collect -> capacity = 0;
+            return false;
+        }
+        collect -> ids = ids;
+    }
+
+    collect -> ids[ collect -> count++ ] = id;
+    return true;
+}
+
+static int compareNames( const void *a, const void *b )
+{
+    return strcmp( *(const char**)a, *(const char**)b );
+}
+
+static int compareIdsByName( const void *a, const void *b )
+{
+    return strcmp( ufsStoreGetName( sortImage, UFS_TYPES_FILE,
+                                    *(const ufsIdType*)a ),
+                   ufsStoreGetName( sortImage, UFS_TYPES_FILE,
+                                    *(const ufsIdType*)b ) );
+}
+
+static int compareAreaIds( const void *a, const void *b )
+{
+    return strcmp( ufsStoreGetName( sortImage, UFS_TYPES_AREA,
+                                    *(const ufsIdType*)a ),
+                   ufsStoreGetName( sortImage, UFS_TYPES_AREA,
+                                    *(const ufsIdType*)b ) );
+}
+
+static int compareIds( const void *a, const void *b )
+{
+    ufsIdType
+        x = *(const ufsIdType*)a,
+        y = *(const ufsIdType*)b;
+
+    return ( x > y ) - ( x < y );
+}
+
+/* Lays sorted out in Eytzinger ( BFS ) order, k is the 1 based heap index.  */
+static uint64_t eytzinger( const ufsIdType *sorted, ufsIdType *out,
+                           uint64_t count, uint64_t i, uint64_t k )
+{
+    if ( k <= count ) {
+        i = eytzinger( sorted, out, count, i, 2 * k );
+        out[ k - 1 ] = sorted[ i++ ];
+        i = eytzinger( sorted, out, count, i, 2 * k + 1 );
+    }
+
+    return i;
+}
+
+/* Gives the storage dense ids, breadth first, one directory at a time.      */
+static bool buildOrder( struct sealBuildStruct *build )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( build -> img );
+    struct collectStruct children;
+    ufsIdType *sorted, dir, old, i;
+    uint64_t used, owned, head, next;
+
+    used = header -> used[ UFS_TYPES_FILE ];
+
+    for ( owned = 0, old = 1; old <= used; old++ )
+        owned += ufsStoreHasStorage( build -> img, old );
+
+    build -> newStorage = calloc( used + 1, sizeof( ufsIdType ) );
+    build -> oldStorage = calloc( owned + 1, sizeof( ufsIdType ) );
+    build -> files = calloc( owned + 1, sizeof( struct ufsSealedFileStruct ) );
+    sorted = calloc( owned + 1, sizeof( ufsIdType ) );
+
+    if ( !build -> newStorage || !build -> oldStorage || !build -> files ||
+         !sorted ) {
+        free( sorted );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    memset( &children, 0, sizeof( children ) );
+    sortImage = build -> img;
+    next = head = 0;
+    dir = 0;
+
+    /* The queue is oldStorage itself, new ids are handed out as we go.      */
+    while ( true ) {
+        if ( dir == 0 || ufsStoreIsDirectory( build -> img, dir ) ) {
+            children.count = 0;
+            ufsStoreIterateChildren( build -> img, dir, collectId, &children );
+
+            if ( children.count && !children.capacity ) {
+                free( sorted );
+                ufsErrno = UFS_OUT_OF_MEMORY;
+                return false;
+            }
+
+            if ( children.count ) {
+                memcpy( sorted, children.ids,
+                        sizeof( ufsIdType ) * children.count );
+                qsort( sorted, children.count, sizeof( ufsIdType ),
+                       compareIdsByName );
+            }
+            eytzinger( sorted, build -> oldStorage + next, children.count,
+                       0, 1 );
+
+            if ( dir ) {
+                build -> files[ build -> newStorage[ dir ] - 1 ].firstChild =
+                    children.count ? next + 1 : 0;
+                build -> files[ build -> newStorage[ dir ] - 1 ].numChildren =
+                    children.count;
+            } else {
+                build -> numRoots = children.count;
+            }
+
+            for ( i = 0; i < children.count; i++ ) {
+                old = build -> oldStorage[ next ];
+                build -> newStorage[ old ] = ++next;
+                build -> files[ next - 1 ].isDirectory =
+                    ufsStoreIsDirectory( build -> img, old );
+                build -> files[ next - 1 ].parent =
+                    dir ? build -> newStorage[ dir ] : 0;
+            }
+        }
+
+        if ( head >= next )
+            break;
+
+        dir = build -> oldStorage[ head++ ];
+    }
+
+    free( children.ids );
+    free( sorted );
+
+    /* Whatever was not reached hangs off storage of another image.          */
+    if ( next != owned ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    build -> numStorage = owned;
+    return true;
+}
+
+static bool buildAreas( struct sealBuildStruct *build )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( build -> img );
+    uint64_t used, i;
+    ufsIdType old;
+
+    used = header -> used[ UFS_TYPES_AREA ];
+
+    build -> newArea = calloc( used + 1, sizeof( ufsIdType ) );
+    build -> oldArea = calloc( used + 1, sizeof( ufsIdType ) );
+
+    if ( !build -> newArea || !build -> oldArea ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    for ( old = 1; old <= used; old++ ) {
+        if ( ufsStoreHasArea( build -> img, old ) )
+            build -> oldArea[ build -> numAreas++ ] = old;
+    }
+
+    sortImage = build -> img;
+    qsort( build -> oldArea, build -> numAreas, sizeof( ufsIdType ),
+           compareAreaIds );
+
+    for ( i = 0; i < build -> numAreas; i++ )
+        build -> newArea[ build -> oldArea[i] ] = i + 1;
+
+    return true;
+}
+
+/* Sorts and front codes every name, then hashes storage and areas by name.  */
+static bool buildNames( struct sealBuildStruct *build )
+{
+    uint64_t i, j, total, numBlocks, shared, len, offset, *hashes;
+    const char *name, *prev;
+
+    total = build -> numStorage + build -> numAreas;
+    build -> names = calloc( total + 1, sizeof( char* ) );
+    if ( !build -> names ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    for ( i = 0; i < build -> numStorage; i++ )
+        build -> names[i] = ufsStoreGetName( build -> img, UFS_TYPES_FILE,
+                                             build -> oldStorage[i] );
+    for ( i = 0; i < build -> numAreas; i++ )
+        build -> names[ build -> numStorage + i ] =
+            ufsStoreGetName( build -> img, UFS_TYPES_AREA, build -> oldArea[i] );
+
+    qsort( build -> names, total, sizeof( char* ), compareNames );
+
+    for ( i = j = 0; i < total; i++ ) {
+        if ( strlen( build -> names[i] ) >= UFS_SEAL_NAME_MAX ) {
+            ufsErrno = UFS_BAD_CALL;
+            return false;
+        }
+        if ( j == 0 || strcmp( build -> names[ j - 1 ], build -> names[i] ) )
+            build -> names[ j++ ] = build -> names[i];
+    }
+    build -> numNames = j;
+
+    numBlocks = ( build -> numNames + UFS_SEAL_BLOCK_NAMES - 1 ) /
+                UFS_SEAL_BLOCK_NAMES;
+    build -> nameBlocks = calloc( numBlocks + 1, sizeof( uint64_t ) );
+
+    /* Two varints of at most 10 bytes each, plus the suffix.                */
+    for ( i = 0, total = 0; i < build -> numNames; i++ )
+        total += strlen( build -> names[i] ) + 20;
+    build -> nameData = malloc( total + 1 );
+
+    if ( !build -> nameBlocks || !build -> nameData ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    for ( i = 0, offset = 0, prev = ""; i < build -> numNames; i++ ) {
+        name = build -> names[i];
+
+        if ( i % UFS_SEAL_BLOCK_NAMES == 0 ) {
+            build -> nameBlocks[ i / UFS_SEAL_BLOCK_NAMES ] = offset;
+            prev = "";
+        }
+
+        for ( shared = 0; prev[ shared ] && prev[ shared ] == name[ shared ];
+              shared++ )
+            ;
+        len = strlen( name + shared );
+
+        offset += encodeVarint( build -> nameData + offset, shared );
+        offset += encodeVarint( build -> nameData + offset, len );
+        memcpy( build -> nameData + offset, name + shared, len );
+        offset += len;
+        prev = name;
+    }
+    build -> nameDataSize = offset;
+
+    for ( i = 0; i < build -> numStorage; i++ )
+        build -> files[i].name = nameRank( build,
+            ufsStoreGetName( build -> img, UFS_TYPES_FILE,
+                             build -> oldStorage[i] ) );
+
+    build -> areaNames = calloc( build -> numAreas + 1, sizeof( uint32_t ) );
+    hashes = calloc( build -> numStorage + build -> numAreas + 1,
+                     sizeof( uint64_t ) );
+    if ( !build -> areaNames || !hashes ) {
+        free( hashes );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    for ( i = 0; i < build -> numAreas; i++ )
+        build -> areaNames[i] = nameRank( build,
+            ufsStoreGetName( build -> img, UFS_TYPES_AREA, build -> oldArea[i] ) );
+
+    for ( i = 0; i < build -> numStorage; i++ )
+        hashes[i] = ufsHashString( ufsStoreGetName( build -> img,
+                                        UFS_TYPES_FILE, build -> oldStorage[i] ),
+                                   build -> files[i].parent );
+
+    if ( !buildHash( hashes, build -> numStorage, &build -> storageHash,
+                     &build -> storagePilots, &build -> storageSlots ) ) {
+        free( hashes );
+        return false;
+    }
+
+    for ( i = 0; i < build -> numAreas; i++ )
+        hashes[i] = ufsHashString( ufsStoreGetName( build -> img,
+                                        UFS_TYPES_AREA, build -> oldArea[i] ),
+                                   0 );
+
+    if ( !buildHash( hashes, build -> numAreas, &build -> areaHash,
+                     &build -> areaPilots, &build -> areaSlots ) ) {
+        free( hashes );
+        return false;
+    }
+
+    free( hashes );
+    return true;
+}
+
+static bool buildMappings( struct sealBuildStruct *build )
+{
+    struct collectStruct areas;
+    uint64_t i, j, capacity;
+    uint32_t *grown;
+
+    memset( &areas, 0, sizeof( areas ) );
+    capacity = 16;
+
+    build -> mappingOffsets = calloc( build -> numStorage + 1,
+                                      sizeof( uint64_t ) );
+    build -> mappingAreas = malloc( sizeof( uint32_t ) * capacity );
+    if ( !build -> mappingOffsets || !build -> mappingAreas ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    for ( i = 0; i < build -> numStorage; i++ ) {
+        areas.count = 0;
+        ufsStoreIterateMappings( build -> img, build -> oldStorage[i],
+                                 collectId, &areas );
+
+        if ( areas.count && !areas.capacity ) {
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return false;
+        }
+
+        for ( j = 0; j < areas.count; j++ ) {
+            /* Mappings to areas of other images can't be sealed.            */
+            if ( !ufsStoreHasArea( build -> img, areas.ids[j] ) ) {
+                free( areas.ids );
+                ufsErrno = UFS_BAD_CALL;
+                return false;
+            }
+            areas.ids[j] = build -> newArea[ areas.ids[j] ];
+        }
+        if ( areas.count )
+            qsort( areas.ids, areas.count, sizeof( ufsIdType ), compareIds );
+
+        if ( build -> numMappings + areas.count > capacity ) {
+            while ( build -> numMappings + areas.count > capacity )
+                capacity *= 2;
+            grown = realloc( build -> mappingAreas, sizeof( uint32_t ) * capacity );
+            if ( !grown ) {
+                free( areas.ids );
+                ufsErrno = UFS_OUT_OF_MEMORY;
+                return false;
+            }
+            build -> mappingAreas = grown;
+        }
+
+        for ( j = 0; j < areas.count; j++ )
+            build -> mappingAreas[ build -> numMappings++ ] = areas.ids[j];
+
+        build -> mappingOffsets[ i + 1 ] = build -> numMappings;
+    }
+
+    free( areas.ids );
+    return true;
+}
+
+/* Hash and displace: buckets are placed largest first, each one gets the    */
+/* first pilot that sends all of its keys to free slots.                      */
+static bool buildHash( const uint64_t *hashes, uint64_t numKeys,
+                       struct ufsSealHashStruct *mph,
+                       uint32_t **pilots, uint32_t **slots )
+{
+    uint64_t *bucketOf, *bucketStart, *bucketKeys, *order, *sizeStart,
+             *keySlots, numBuckets, b, i, j, k, size, maxSize, attempt;
+    uint8_t *taken;
+    uint32_t pilot;
+    bool placed, ok;
+
+    numBuckets = numKeys / UFS_SEAL_BUCKET_LOAD + 1;
+    mph -> numBuckets = numBuckets;
+
+    *pilots = calloc( numBuckets, sizeof( uint32_t ) );
+    *slots = calloc( numKeys + 1, sizeof( uint32_t ) );
+    bucketOf = calloc( numKeys + 1, sizeof( uint64_t ) );
+    bucketStart = calloc( numBuckets + 1, sizeof( uint64_t ) );
+    bucketKeys = calloc( numKeys + 1, sizeof( uint64_t ) );
+    order = calloc( numBuckets, sizeof( uint64_t ) );
+    keySlots = calloc( numKeys + 1, sizeof( uint64_t ) );
+    taken = calloc( numKeys + 1, sizeof( uint8_t ) );
+    sizeStart = NULL;
+
+    ok = *pilots && *slots && bucketOf && bucketStart && bucketKeys &&
+         order && keySlots && taken;
+
+    for ( attempt = 0; ok && attempt < MAX_SEEDS; attempt++ ) {
+        mph -> seed = ufsHashMix( attempt + numKeys );
+        memset( bucketStart, 0, sizeof( uint64_t ) * ( numBuckets + 1 ) );
+        memset( taken, 0, numKeys + 1 );
+
+        /* Counting sort of the keys by bucket.                              */
+        for ( i = 0; i < numKeys; i++ ) {
+            bucketOf[i] = hashBucket( hashes[i], mph );
+            bucketStart[ bucketOf[i] + 1 ]++;
+        }
+        for ( b = 0, maxSize = 0; b < numBuckets; b++ ) {
+            if ( bucketStart[ b + 1 ] > maxSize )
+                maxSize = bucketStart[ b + 1 ];
+            bucketStart[ b + 1 ] += bucketStart[b];
+        }
+        for ( i = 0; i < numKeys; i++ )
+            bucketKeys[ bucketStart[ bucketOf[i] ]++ ] = i;
+        for ( b = numBuckets; b > 0; b-- )
+            bucketStart[b] = bucketStart[ b - 1 ];
+        bucketStart[0] = 0;
+
+        /* Counting sort of the buckets by size, largest first.              */
+        free( sizeStart );
+        sizeStart = calloc( maxSize + 2, sizeof( uint64_t ) );
+        if ( !sizeStart ) {
+            ok = false;
+            break;
+        }
+        for ( b = 0; b < numBuckets; b++ )
+            sizeStart[ maxSize - ( bucketStart[ b + 1 ] - bucketStart[b] ) + 1 ]++;
+        for ( size = 0; size <= maxSize; size++ )
+            sizeStart[ size + 1 ] += sizeStart[ size ];
+        for ( b = 0; b < numBuckets; b++ )
+            order[ sizeStart[ maxSize -
+                              ( bucketStart[ b + 1 ] - bucketStart[b] ) ]++ ] = b;
+
+        placed = true;
+        for ( i = 0; placed && i < numBuckets; i++ ) {
+            b = order[i];
+            size = bucketStart[ b + 1 ] - bucketStart[b];
+            if ( !size )
+                break;
+
+            placed = false;
+            for ( pilot = 0; !placed && pilot < MAX_PILOT; pilot++ ) {
+                for ( j = 0; j < size; j++ ) {
+                    keySlots[j] = hashSlot( hashes[ bucketKeys[ bucketStart[b] + j ] ],
+                                            pilot, mph, numKeys );
+                    if ( taken[ keySlots[j] ] )
+                        break;
+                    for ( k = 0; k < j && keySlots[k] != keySlots[j]; k++ )
+                        ;
+                    if ( k < j )
+                        break;
+                }
+
+                if ( j < size )
+                    continue;
+
+                for ( j = 0; j < size; j++ ) {
+                    taken[ keySlots[j] ] = 1;
+                    ( *slots )[ keySlots[j] ] =
+                        bucketKeys[ bucketStart[b] + j ] + 1;
+                }
+                ( *pilots )[b] = pilot;
+                placed = true;
+            }
+        }
+
+        if ( placed )
+            break;
+    }
+
+    if ( ok && attempt == MAX_SEEDS ) {
+        ok = false;
+        ufsErrno = UFS_UNKNOWN_ERROR;
+    } else if ( !ok ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+    }
+
+    free( bucketOf );
+    free( bucketStart );
+    free( bucketKeys );
+    free( order );
+    free( sizeStart );
+    free( keySlots );
+    free( taken );
+    return ok;
+}
+
+static bool writeImage( struct sealBuildStruct *build, const char *outPath )
+{
+    struct ufsHeaderStruct *header;
+    struct ufsSealHeaderStruct *seal;
+    const void *sources[ UFS_SEAL_SECTION_COUNT ];
+    ufsImagePtr out;
+    uint64_t offset, i;
+
+    /* Compute the layout first, the header goes where it always goes.       */
+    struct ufsHeaderStruct layout;
+    struct ufsSealHeaderStruct sealLayout;
+
+    memset( &layout, 0, sizeof( layout ) );
+    memset( &sealLayout, 0, sizeof( sealLayout ) );
+
+    layout.magicNumber = UFS_MAGIC_NUMBER;
+    layout.version = UFS_VERSION;
+    layout.flags = UFS_HEADER_FLAG_SEALED;
+
+    offset = UFS_LAYOUT_HEADER_OFFSET + sizeof( struct ufsHeaderStruct );
+
+    offset = UFS_LAYOUT_ROUND( offset, ALIGN );
+    layout.offsets[ UFS_TYPES_NODE ] = offset;
+    layout.sizes[ UFS_TYPES_NODE ] = 1;
+    offset += sizeof( struct ufsSealHeaderStruct );
+
+    offset = UFS_LAYOUT_ROUND( offset, ALIGN );
+    layout.offsets[ UFS_TYPES_FILE ] = offset;
+    layout.sizes[ UFS_TYPES_FILE ] = build -> numStorage;
+    offset += sizeof( struct ufsSealedFileStruct ) * build -> numStorage;
+
+    offset = UFS_LAYOUT_ROUND( offset, ALIGN );
+    layout.offsets[ UFS_TYPES_AREA ] = offset;
+    layout.sizes[ UFS_TYPES_AREA ] = build -> numAreas;
+    offset += sizeof( uint32_t ) * build -> numAreas;
+
+    sealLayout.storageHash = build -> storageHash;
+    sealLayout.areaHash = build -> areaHash;
+    sealLayout.numRoots = build -> numRoots;
+    sealLayout.numNames = build -> numNames;
+
+    sealLayout.sizes[ UFS_SEAL_STORAGE_PILOTS ] = build -> storageHash.numBuckets;
+    sealLayout.sizes[ UFS_SEAL_STORAGE_SLOTS ] = build -> numStorage;
+    sealLayout.sizes[ UFS_SEAL_AREA_PILOTS ] = build -> areaHash.numBuckets;
+    sealLayout.sizes[ UFS_SEAL_AREA_SLOTS ] = build -> numAreas;
+    sealLayout.sizes[ UFS_SEAL_MAPPING_OFFSETS ] = build -> numStorage + 1;
+    sealLayout.sizes[ UFS_SEAL_MAPPING_AREAS ] = build -> numMappings;
+    sealLayout.sizes[ UFS_SEAL_NAME_BLOCKS ] =
+        ( build -> numNames + UFS_SEAL_BLOCK_NAMES - 1 ) / UFS_SEAL_BLOCK_NAMES;
+
+    sources[ UFS_SEAL_STORAGE_PILOTS ] = build -> storagePilots;
+    sources[ UFS_SEAL_STORAGE_SLOTS ] = build -> storageSlots;
+    sources[ UFS_SEAL_AREA_PILOTS ] = build -> areaPilots;
+    sources[ UFS_SEAL_AREA_SLOTS ] = build -> areaSlots;
+    sources[ UFS_SEAL_MAPPING_OFFSETS ] = build -> mappingOffsets;
+    sources[ UFS_SEAL_MAPPING_AREAS ] = build -> mappingAreas;
+    sources[ UFS_SEAL_NAME_BLOCKS ] = build -> nameBlocks;
+
+    for ( i = 0; i < UFS_SEAL_SECTION_COUNT; i++ ) {
+        offset = UFS_LAYOUT_ROUND( offset, ALIGN );
+        sealLayout.offsets[i] = offset;
+        offset += sealLayout.sizes[i] * sectionElementSizes[i];
+    }
+
+    layout.offsets[ UFS_TYPES_STRING ] = offset;
+    layout.sizes[ UFS_TYPES_STRING ] = build -> nameDataSize;
+    offset += build -> nameDataSize;
+
+    for ( i = 0; i < UFS_TYPES_COUNT; i++ )
+        layout.used[i] = layout.sizes[i];
+
+    out = ufsImageCreate( outPath, offset );
+    if ( !out )
+        return false;
+
+    header = ufsLayoutHeader( out );
+    *header = layout;
+
+    seal = (struct ufsSealHeaderStruct*)( (uint8_t*)out +
+                                          layout.offsets[ UFS_TYPES_NODE ] );
+    *seal = sealLayout;
+
+    memcpy( (uint8_t*)out + layout.offsets[ UFS_TYPES_FILE ], build -> files,
+            sizeof( struct ufsSealedFileStruct ) * build -> numStorage );
+    memcpy( (uint8_t*)out + layout.offsets[ UFS_TYPES_AREA ],
+            build -> areaNames, sizeof( uint32_t ) * build -> numAreas );
+    memcpy( (uint8_t*)out + layout.offsets[ UFS_TYPES_STRING ],
+            build -> nameData, build -> nameDataSize );
+
+    for ( i = 0; i < UFS_SEAL_SECTION_COUNT; i++ )
+        memcpy( (uint8_t*)out + sealLayout.offsets[i], sources[i],
+                sealLayout.sizes[i] * sectionElementSizes[i] );
+
+    if ( !ufsImageSync( out ) ) {
+        ufsImageFree( out );
+        unlink( outPath );
+        return false;
+    }
+
+    ufsImageFree( out );
+
+    /* Sealed means sealed, nobody gets to open it for writing by accident.  */
+    chmod( outPath, S_IRUSR | S_IRGRP | S_IROTH );
+    return true;
+}
+
+static uint32_t nameRank( struct sealBuildStruct *build, const char *name )
+{
+    const char **found;
+
+    found = bsearch( &name, build -> names, build -> numNames, sizeof( char* ),
+                     compareNames );
+
+    return found - build -> names;
+}
+
+static uint64_t encodeVarint( uint8_t *out, uint64_t val )
+{
+    uint64_t len = 0;
+
+    do {
+        out[ len++ ] = ( val & 0x7f ) | ( val >= 0x80 ? 0x80 : 0 );
+        val >>= 7;
+    } while ( val );
+
+    return len;
+}
+
+static uint64_t decodeVarint( const uint8_t **in )
+{
+    uint64_t val = 0;
+    int shift = 0;
+
+    do {
+        val |= (uint64_t)( **in & 0x7f ) << shift;
+        shift += 7;
+    } while ( *( *in )++ & 0x80 );
+
+    return val;
+}
+
+static void freeBuild( struct sealBuildStruct *build )
+{
+    free( build -> newStorage );
+    free( build -> oldStorage );
+    free( build -> newArea );
+    free( build -> oldArea );
+    free( build -> files );
+    free( build -> areaNames );
+    free( build -> names );
+    free( build -> mappingOffsets );
+    free( build -> mappingAreas );
+    free( build -> storagePilots );
+    free( build -> storageSlots );
+    free( build -> areaPilots );
+    free( build -> areaSlots );
+    free( build -> nameBlocks );
+    free( build -> nameData );
+}
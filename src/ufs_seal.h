@@ -0,0 +1,186 @@
+/******************************************************************************\
+*  ufs_seal.h                                                                  *
+*                                                                              *
+*  Internal header for sealed ufs images.                                      *
+*  A sealed image is an immutable, packed copy of a ufs image.                 *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* A sealed image keeps the size word and the header of a mutable image, the  */
+/* header is flagged with UFS_HEADER_FLAG_SEALED and its sections are packed: */
+/*   FILE: dense ufsSealedFileStruct records, no free slots.                  */
+/*   AREA: dense uint32_t name ranks.                                         */
+/*   NODE: a single ufsSealHeaderStruct describing the sealed indices.        */
+/*   STRING: all names, sorted and front coded in blocks.                     */
+/* Identifiers are dense. The children of a directory get consecutive ids, in */
+/* Eytzinger order of their names, so listing a directory is a range and an   */
+/* in order walk of that range yields the names sorted.                       */
+/* Names are found through a minimal perfect hash ( hash and displace ), a    */
+/* lookup is a single probe into the slot table followed by one comparison.   */
+/* Mappings are kept as a compressed sparse row table keyed by storage.       */
+/* Sealed images can only be opened for reading, see ufsImageOpenReadOnly.    */
+
+#ifndef UFS_SEAL_H
+#define UFS_SEAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs_defs.h"
+#include "ufs_image.h"
+#include "ufs_store.h"
+
+/* Names per front coded block, the first name of a block is stored whole.   */
+#define UFS_SEAL_BLOCK_NAMES (16)
+#define UFS_SEAL_NAME_MAX (4096)
+/* Average number of keys per bucket of the perfect hash.                    */
+#define UFS_SEAL_BUCKET_LOAD (4)
+
+enum ufsSealSectionEnum {
+    UFS_SEAL_STORAGE_PILOTS = 0, /* uint32_t per bucket.                      */
+    UFS_SEAL_STORAGE_SLOTS,      /* uint32_t storage id per slot.             */
+    UFS_SEAL_AREA_PILOTS,        /* uint32_t per bucket.                      */
+    UFS_SEAL_AREA_SLOTS,         /* uint32_t area id per slot.                */
+    UFS_SEAL_MAPPING_OFFSETS,    /* uint64_t per storage, plus one.           */
+    UFS_SEAL_MAPPING_AREAS,      /* uint32_t area id per mapping.             */
+    UFS_SEAL_NAME_BLOCKS,        /* uint64_t string offset per block.         */
+    UFS_SEAL_SECTION_COUNT,
+};
+
+struct ufsSealedFileStruct {
+    ufsIdType parent;
+    ufsIdType firstChild;
+    uint32_t name;
+    uint32_t numChildren;
+    uint8_t isDirectory;
+};
+
+struct ufsSealHashStruct {
+    uint64_t seed;
+    uint64_t numBuckets;
+};
+
+struct ufsSealHeaderStruct {
+    struct ufsSealHashStruct storageHash,
+                             areaHash;
+    uint64_t numRoots,
+             numNames;
+
+    /* Sizes are in elements, not bytes.                                     */
+    uint64_t sizes[ UFS_SEAL_SECTION_COUNT ],
+             offsets[ UFS_SEAL_SECTION_COUNT ];
+};
+
+/******************************************************************************\
+* ufsSeal                                                                      *
+*                                                                              *
+*  Writes a sealed copy of img to outPath.                                     *
+*  The source image is left untouched.                                         *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or outPath are NULL, outPath exists, img is already      *
+*                 sealed, a name is longer than UFS_SEAL_NAME_MAX or img       *
+*                 references storage or areas of other images.                 *
+*   UFS_OUT_OF_MEMORY: Could not allocate the temporary tables.                *
+*   All errors of ufsImageCreate.                                              *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated mutable ufs image.                                        *
+*  -outPath: The path of the sealed image, must not exist.                     *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsSeal( ufsImagePtr img, const char *outPath );
+
+/******************************************************************************\
+* ufsSealValidate                                                              *
+*                                                                              *
+*  Validates the sections of a sealed image against the size of the image.    *
+*  Called by ufsHeaderValidate once it found the sealed flag.                  *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL.                                                 *
+*   UFS_IMAGE_BAD_SIZE: A section does not fit in the image.                   *
+*                                                                              *
+*  NOTE: If the image happens to be invalid, this function will free it.       *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a sealed ufs image.                                                   *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsImagePtr: The same ufs image if valid, NULL otherwise.                  *
+*                                                                              *
+\******************************************************************************/
+ufsImagePtr ufsSealValidate( ufsImagePtr img );
+
+/******************************************************************************\
+* ufsSealGetName                                                               *
+*                                                                              *
+*  Decodes the name of a storage or an area of a sealed image into buff.       *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or buff are NULL, or buff is too small.                  *
+*   UFS_FILE_DOES_NOT_EXIST: The storage does not exist.                       *
+*   UFS_AREA_DOES_NOT_EXIST: The area does not exist.                          *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a sealed ufs image.                                                   *
+*  -type: UFS_TYPES_FILE or UFS_TYPES_AREA.                                    *
+*  -id: The identifier of the storage or area.                                 *
+*  -buff: Where to decode the name to.                                         *
+*  -buffSize: The size of buff, UFS_SEAL_NAME_MAX always suffices.             *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsSealGetName( ufsImagePtr img, enum ufsTyepesEnum type, ufsIdType id,
+                     char *buff, uint64_t buffSize );
+
+/* The following implement the read functions of ufs_store.h for sealed      */
+/* images, they have the same semantics and errors and are only meant to be   */
+/* called through them.                                                       */
+
+ufsIdType ufsSealGetStorage( ufsImagePtr img,
+                             ufsIdType parent,
+                             const char *name );
+
+bool ufsSealHasStorage( ufsImagePtr img, ufsIdType storage );
+
+bool ufsSealIsDirectory( ufsImagePtr img, ufsIdType storage );
+
+ufsIdType ufsSealGetParent( ufsImagePtr img, ufsIdType storage );
+
+ufsIdType ufsSealGetArea( ufsImagePtr img, const char *name );
+
+bool ufsSealHasArea( ufsImagePtr img, ufsIdType area );
+
+bool ufsSealProbeMapping( ufsImagePtr img, ufsIdType area, ufsIdType storage );
+
+bool ufsSealIterateChildren( ufsImagePtr img,
+                             ufsIdType directory,
+                             ufsStoreIter iter,
+                             void *userData );
+
+bool ufsSealIterateMappings( ufsImagePtr img,
+                             ufsIdType storage,
+                             ufsStoreIter iter,
+                             void *userData );
+
+/* Sealed images are not indexed by area, this walks every mapping.          */
+bool ufsSealIterateAreaMappings( ufsImagePtr img,
+                                 ufsIdType area,
+                                 ufsStoreIter iter,
+                                 void *userData );
+
+#endif /* UFS_SEAL_H */
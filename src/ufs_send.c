@@ -0,0 +1,491 @@
+/******************************************************************************\
+*  ufs_send.c                                                                  *
+*                                                                              *
+*  Contains the definitions for the ufs replication streams.                   *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "ufs_defs.h"
+#include "ufs_hash.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_layout.h"
+#include "ufs_send.h"
+#include "ufs_store.h"
+
+/* "ufssend" followed by 0.                                                  */
+#define STREAM_MAGIC (0x646e6573736675ULL)
+
+/* The largest chunk, a chunk may go past UFS_SEND_CHUNK_BYTES by a record. */
+#define CHUNK_MAX ( UFS_SEND_CHUNK_BYTES + sizeof( struct recordStruct ) + \
+                    UFS_SEND_NAME_MAX + 1 )
+
+struct streamHeaderStruct {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t uuid;
+    uint64_t fromGeneration;
+    uint64_t toGeneration;
+    /* Of the fields above.                                                  */
+    uint64_t checksum;
+};
+
+struct chunkHeaderStruct {
+    uint64_t length;
+    uint64_t numChanges;
+    /* Of the fields above, the sequence number and the records.             */
+    uint64_t checksum;
+};
+
+/* Followed by nameLen bytes of name and a 0.                                */
+struct recordStruct {
+    uint8_t type;
+    uint8_t isDirectory;
+    uint16_t reserved;
+    uint32_t nameLen;
+    int64_t id;
+    int64_t other;
+};
+
+struct senderStruct {
+    int fd;
+    uint64_t sequence;
+    uint64_t length;
+    uint64_t numChanges;
+    uint8_t *buffer;
+    /* The type of change this pass of the diff sends.                       */
+    int type;
+};
+
+struct changesStruct {
+    struct ufsStoreChangeStruct *changes;
+    uint64_t numChanges;
+    uint64_t capacity;
+    /* The chunks the names point into.                                      */
+    uint8_t **chunks;
+    uint64_t numChunks;
+    /* Of the last change read, a stream never goes back to an earlier one.  */
+    uint8_t lastType;
+};
+
+static const struct ufsSnapshotStruct *getSnapshot( ufsImagePtr img,
+                                                    ufsIdType snapshot );
+static uint64_t chunkChecksum( const struct chunkHeaderStruct *chunk,
+                               uint64_t sequence, const uint8_t *records );
+static bool writeAll( int fd, const void *data, uint64_t size );
+static bool readAll( int fd, void *data, uint64_t size );
+static bool flushChunk( struct senderStruct *sender );
+static bool sendChange( const struct ufsStoreChangeStruct *change,
+                        void *userData );
+static bool readChunk( int fd, uint64_t sequence, struct changesStruct *out,
+                       bool *isLast );
+static bool parseChunk( uint8_t *records, uint64_t length,
+                        uint64_t numChanges, struct changesStruct *out );
+static void dropChunks( struct changesStruct *changes );
+static void freeChanges( struct changesStruct *changes );
+
+bool ufsSend( ufsImagePtr img, ufsIdType fromSnapshot, ufsIdType toSnapshot,
+              int fd )
+{
+    struct ufsHeaderStruct *header;
+    struct streamHeaderStruct streamHeader;
+    struct senderStruct sender = {
+        .fd = fd
+    };
+
+    if ( !img || fd < 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    header = ufsLayoutHeader( img );
+    if ( header -> flags & ( UFS_HEADER_FLAG_SEALED |
+                             UFS_HEADER_FLAG_SNAPSHOT ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( ( fromSnapshot && !getSnapshot( img, fromSnapshot ) ) ||
+         !getSnapshot( img, toSnapshot ) ) {
+        ufsErrno = UFS_SNAPSHOT_DOES_NOT_EXIST;
+        return false;
+    }
+
+    sender.buffer = malloc( CHUNK_MAX );
+    if ( !sender.buffer ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    memset( &streamHeader, 0, sizeof( streamHeader ) );
+    streamHeader.magic = STREAM_MAGIC;
+    streamHeader.version = UFS_SEND_VERSION;
+    streamHeader.uuid = header -> uuid;
+    streamHeader.fromGeneration = fromSnapshot ?
+        getSnapshot( img, fromSnapshot ) -> generation : 0;
+    streamHeader.toGeneration = getSnapshot( img, toSnapshot ) -> generation;
+    streamHeader.checksum = ufsHashBytes( &streamHeader,
+                                          offsetof( struct streamHeaderStruct,
+                                                    checksum ), 0 );
+
+    if ( !writeAll( fd, &streamHeader, sizeof( streamHeader ) ) ) {
+        free( sender.buffer );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    /* One pass per type, so the receiver can apply each chunk as it comes.  */
+    /* sendChange sets the error when it stops the diff.                     */
+    for ( sender.type = 0; sender.type < UFS_STORE_CHANGE_COUNT;
+          sender.type++ ) {
+        if ( !ufsStoreDiff( img, fromSnapshot, toSnapshot, sendChange,
+                            &sender ) ) {
+            free( sender.buffer );
+            return false;
+        }
+    }
+
+    /* The empty chunk ends the stream.                                      */
+    if ( ( sender.length && !flushChunk( &sender ) ) ||
+         !flushChunk( &sender ) ) {
+        free( sender.buffer );
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    free( sender.buffer );
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsReceive( ufsImagePtr img, int fd )
+{
+    struct ufsHeaderStruct *header;
+    struct streamHeaderStruct streamHeader;
+    struct changesStruct changes;
+    struct ufsStoreApplyStruct apply;
+    ufsStatusType status;
+    uint64_t sequence;
+    bool isLast, applies;
+
+    if ( !img || fd < 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !readAll( fd, &streamHeader, sizeof( streamHeader ) ) )
+        return false;
+
+    if ( streamHeader.magic != STREAM_MAGIC ||
+         streamHeader.checksum !=
+         ufsHashBytes( &streamHeader,
+                       offsetof( struct streamHeaderStruct, checksum ), 0 ) ) {
+        ufsErrno = UFS_STREAM_IS_CORRUPTED;
+        return false;
+    }
+
+    if ( streamHeader.version != UFS_SEND_VERSION ) {
+        ufsErrno = UFS_VERSION_MISMATCH;
+        return false;
+    }
+
+    /* A full stream needs an empty image, the rest continue the last one.   */
+    header = ufsLayoutHeader( img );
+    if ( streamHeader.fromGeneration == 0 )
+        applies = !( header -> flags & UFS_HEADER_FLAG_REPLICA ) &&
+                  header -> used[ UFS_TYPES_FILE ] == 0 &&
+                  header -> used[ UFS_TYPES_AREA ] == 0;
+    else
+        applies = ( header -> flags & UFS_HEADER_FLAG_REPLICA ) &&
+                  header -> sourceUuid == streamHeader.uuid &&
+                  header -> sourceGeneration == streamHeader.fromGeneration;
+
+    if ( !applies ) {
+        ufsErrno = UFS_STREAM_DOES_NOT_APPLY;
+        return false;
+    }
+
+    if ( !ufsStoreApplyBegin( img, &apply ) )
+        return false;
+
+    /* Each chunk is applied once it checks out, a bad one later on rolls    */
+    /* back the ones before.                                                 */
+    memset( &changes, 0, sizeof( changes ) );
+    for ( sequence = 0, isLast = false; !isLast; sequence++ ) {
+        if ( !readChunk( fd, sequence, &changes, &isLast ) ||
+             !ufsStoreApplyChanges( img, &apply, changes.changes,
+                                    changes.numChanges ) ) {
+            status = ufsErrno;
+            freeChanges( &changes );
+            ufsStoreApplyEnd( img, &apply, false );
+            ufsErrno = status;
+            return false;
+        }
+
+        dropChunks( &changes );
+    }
+
+    freeChanges( &changes );
+    ufsStoreApplyEnd( img, &apply, true );
+
+    header -> sourceUuid = streamHeader.uuid;
+    header -> sourceGeneration = streamHeader.toGeneration;
+
+    return ufsImageSync( img );
+}
+
+static const struct ufsSnapshotStruct *getSnapshot( ufsImagePtr img,
+                                                    ufsIdType snapshot )
+{
+    const struct ufsSnapshotStruct *ret;
+
+    if ( snapshot <= 0 || snapshot > UFS_SNAPSHOTS_MAX )
+        return NULL;
+
+    ret = &ufsLayoutHeader( img ) -> snapshots[ snapshot - 1 ];
+    return ret -> isOwned ? ret : NULL;
+}
+
+static uint64_t chunkChecksum( const struct chunkHeaderStruct *chunk,
+                               uint64_t sequence, const uint8_t *records )
+{
+    uint64_t
+        seed = ufsHashBytes( chunk,
+                             offsetof( struct chunkHeaderStruct, checksum ),
+                             sequence );
+
+    return ufsHashBytes( records, chunk -> length, seed );
+}
+
+static bool writeAll( int fd, const void *data, uint64_t size )
+{
+    const uint8_t *curr;
+    ssize_t written;
+
+    for ( curr = data; size; curr += written, size -= written ) {
+        /* A reader that went away must not raise SIGPIPE.                   */
+        written = send( fd, curr, size, MSG_NOSIGNAL );
+        if ( written < 0 && errno == ENOTSOCK )
+            written = write( fd, curr, size );
+
+        if ( written < 0 && errno == EINTR ) {
+            written = 0;
+            continue;
+        }
+
+        if ( written <= 0 )
+            return false;
+    }
+
+    return true;
+}
+
+/* The stream ending early is a damaged stream, a failing read is not.       */
+static bool readAll( int fd, void *data, uint64_t size )
+{
+    uint8_t *curr;
+    ssize_t got;
+
+    for ( curr = data; size; curr += got, size -= got ) {
+        got = read( fd, curr, size );
+        if ( got < 0 && errno == EINTR ) {
+            got = 0;
+            continue;
+        }
+
+        if ( got < 0 ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            return false;
+        }
+
+        if ( got == 0 ) {
+            ufsErrno = UFS_STREAM_IS_CORRUPTED;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool flushChunk( struct senderStruct *sender )
+{
+    struct chunkHeaderStruct chunk = {
+        .length = sender -> length,
+        .numChanges = sender -> numChanges
+    };
+
+    chunk.checksum = chunkChecksum( &chunk, sender -> sequence++,
+                                    sender -> buffer );
+
+    if ( !writeAll( sender -> fd, &chunk, sizeof( chunk ) ) ||
+         !writeAll( sender -> fd, sender -> buffer, sender -> length ) )
+        return false;
+
+    sender -> length = 0;
+    sender -> numChanges = 0;
+    return true;
+}
+
+static bool sendChange( const struct ufsStoreChangeStruct *change,
+                        void *userData )
+{
+    struct senderStruct
+        *sender = userData;
+    struct recordStruct record;
+    uint64_t nameLen, size;
+
+    if ( change -> type != sender -> type )
+        return true;
+
+    nameLen = change -> name ? strlen( change -> name ) : 0;
+    if ( nameLen > UFS_SEND_NAME_MAX ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    size = sizeof( record ) + nameLen + 1;
+    if ( sender -> length + size > UFS_SEND_CHUNK_BYTES && sender -> length &&
+         !flushChunk( sender ) ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return false;
+    }
+
+    memset( &record, 0, sizeof( record ) );
+    record.type = change -> type;
+    record.isDirectory = change -> isDirectory;
+    record.nameLen = nameLen;
+    record.id = change -> id;
+    record.other = change -> other;
+
+    memcpy( sender -> buffer + sender -> length, &record, sizeof( record ) );
+    memcpy( sender -> buffer + sender -> length + sizeof( record ),
+            change -> name ? change -> name : "", nameLen + 1 );
+    sender -> length += size;
+    sender -> numChanges++;
+
+    return true;
+}
+
+static bool readChunk( int fd, uint64_t sequence, struct changesStruct *out,
+                       bool *isLast )
+{
+    struct chunkHeaderStruct chunk;
+    uint8_t *records, **chunks;
+
+    if ( !readAll( fd, &chunk, sizeof( chunk ) ) )
+        return false;
+
+    /* Every record takes at least sizeof( struct recordStruct ) + 1 bytes.  */
+    if ( chunk.length > CHUNK_MAX || chunk.numChanges >
+         chunk.length / ( sizeof( struct recordStruct ) + 1 ) ) {
+        ufsErrno = UFS_STREAM_IS_CORRUPTED;
+        return false;
+    }
+
+    records = malloc( chunk.length + 1 );
+    chunks = realloc( out -> chunks,
+                      sizeof( *chunks ) * ( out -> numChunks + 1 ) );
+    if ( chunks )
+        out -> chunks = chunks;
+
+    if ( !records || !chunks ) {
+        free( records );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    out -> chunks[ out -> numChunks++ ] = records;
+
+    if ( !readAll( fd, records, chunk.length ) )
+        return false;
+
+    if ( chunk.checksum != chunkChecksum( &chunk, sequence, records ) ) {
+        ufsErrno = UFS_STREAM_IS_CORRUPTED;
+        return false;
+    }
+
+    *isLast = chunk.length == 0;
+    return parseChunk( records, chunk.length, chunk.numChanges, out );
+}
+
+/* The names are used in place, the stream already ends each with a 0.      */
+static bool parseChunk( uint8_t *records, uint64_t length,
+                        uint64_t numChanges, struct changesStruct *out )
+{
+    struct ufsStoreChangeStruct *changes, *change;
+    struct recordStruct record;
+    uint64_t pos, i;
+
+    if ( out -> numChanges + numChanges > out -> capacity ) {
+        out -> capacity = ( out -> numChanges + numChanges ) * 2;
+        changes = realloc( out -> changes,
+                           sizeof( *changes ) * out -> capacity );
+        if ( !changes ) {
+            ufsErrno = UFS_OUT_OF_MEMORY;
+            return false;
+        }
+
+        out -> changes = changes;
+    }
+
+    for ( pos = 0, i = 0; i < numChanges; i++ ) {
+        if ( length - pos < sizeof( record ) )
+            break;
+
+        memcpy( &record, records + pos, sizeof( record ) );
+        pos += sizeof( record );
+
+        if ( record.type >= UFS_STORE_CHANGE_COUNT ||
+             record.type < out -> lastType ||
+             record.nameLen > UFS_SEND_NAME_MAX ||
+             length - pos < (uint64_t)record.nameLen + 1 ||
+             records[ pos + record.nameLen ] != 0 )
+            break;
+
+        out -> lastType = record.type;
+        change = &out -> changes[ out -> numChanges + i ];
+        change -> type = record.type;
+        change -> isDirectory = record.isDirectory;
+        change -> id = record.id;
+        change -> other = record.other;
+        change -> name = record.nameLen ? (const char *)records + pos : NULL;
+        pos += record.nameLen + 1;
+    }
+
+    if ( i < numChanges || pos != length ) {
+        ufsErrno = UFS_STREAM_IS_CORRUPTED;
+        return false;
+    }
+
+    out -> numChanges += numChanges;
+    return true;
+}
+
+/* The changes of the chunks go with them, the arrays stay for the next.     */
+static void dropChunks( struct changesStruct *changes )
+{
+    uint64_t i;
+
+    for ( i = 0; i < changes -> numChunks; i++ )
+        free( changes -> chunks[i] );
+
+    changes -> numChunks = 0;
+    changes -> numChanges = 0;
+}
+
+static void freeChanges( struct changesStruct *changes )
+{
+    dropChunks( changes );
+    free( changes -> chunks );
+    free( changes -> changes );
+}
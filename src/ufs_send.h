@@ -0,0 +1,101 @@
+/******************************************************************************\
+*  ufs_send.h                                                                  *
+*                                                                              *
+*  Internal header for the ufs replication streams.                            *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* ufsSend writes the changes between two snapshots of an image, as found by */
+/* ufsStoreDiff, and ufsReceive applies them to a replica with               */
+/* ufsStoreApplyChanges. A stream holds records, not pages, a stream from     */
+/* snapshot 0 holds the whole store.                                          */
+/*                                                                            */
+/* A stream is a header naming the source image and the generations of both  */
+/* snapshots, followed by chunks of at most UFS_SEND_CHUNK_BYTES of records   */
+/* and an empty chunk that ends it. Every part carries a checksum, chunks are */
+/* chained by their sequence number so a stream cut short or put together    */
+/* from two streams is caught. The stream is strictly sequential and says     */
+/* where it ends, so the sender never seeks, the receiver never reads past   */
+/* the end and either side may be a pipe, a socket or a file, which can be   */
+/* moved along with splice or sendfile.                                       */
+/* The changes come in the order of ufsStoreChangeEnum, so the receiver       */
+/* applies each chunk once its checksum passes and only holds one chunk in    */
+/* memory. A damaged chunk rolls back the ones applied before it.             */
+/*                                                                            */
+/* A replica only takes the stream that starts at the generation it is at.   */
+/* Integers are written in host order, replicas share the source's format.   */
+
+#ifndef UFS_SEND_H
+#define UFS_SEND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs_defs.h"
+#include "ufs_image.h"
+
+#define UFS_SEND_VERSION (2)
+#define UFS_SEND_CHUNK_BYTES (64 * 1024)
+#define UFS_SEND_NAME_MAX (4096)
+
+/******************************************************************************\
+* ufsSend                                                                      *
+*                                                                              *
+*  Writes the changes from snapshot fromSnapshot to snapshot toSnapshot to fd. *
+*  Both snapshots must stay until the stream is written.                       *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL, sealed or a snapshot, fd is negative or a name  *
+*                 is longer than UFS_SEND_NAME_MAX.                            *
+*   UFS_SNAPSHOT_DOES_NOT_EXIST: One of the snapshots does not exist.          *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*   UFS_UNKNOWN_ERROR: fd could not be written.                                *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -fromSnapshot: The snapshot the replica is at, 0 for a full stream.         *
+*  -toSnapshot: The snapshot to bring the replica to.                          *
+*  -fd: The descriptor to write the stream to.                                 *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsSend( ufsImagePtr img, ufsIdType fromSnapshot, ufsIdType toSnapshot,
+              int fd );
+
+/******************************************************************************\
+* ufsReceive                                                                   *
+*                                                                              *
+*  Reads one stream from fd and applies it to img, all of it or nothing.       *
+*  Each chunk is applied once its checksum passes, a damaged chunk rolls back  *
+*  the ones before it. On success img is a replica at the stream's newer       *
+*  snapshot and has been synced.                                               *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL or fd is negative.                               *
+*   UFS_STREAM_IS_CORRUPTED: The stream is damaged or cut short.               *
+*   UFS_VERSION_MISMATCH: The stream was written by another version.           *
+*   UFS_STREAM_DOES_NOT_APPLY: The stream starts at another source or          *
+*                              generation than img is at.                      *
+*   UFS_OUT_OF_MEMORY: The system or the image is out of memory.               *
+*   UFS_UNKNOWN_ERROR: fd could not be read.                                   *
+*   Any error of ufsStoreApplyChanges and ufsImageSync.                        *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image, a replica or one without storage or areas.     *
+*  -fd: The descriptor to read the stream from.                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsReceive( ufsImagePtr img, int fd );
+
+#endif /* UFS_SEND_H */
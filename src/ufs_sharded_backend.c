@@ -0,0 +1,1301 @@
+/******************************************************************************\
+*  ufs_sharded_backend.c                                                       *
+*                                                                              *
+*  Contains the sharded backend of ufs, areas spread over images.              *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ufs.h"
+#include "ufs_arena.h"
+#include "ufs_backend.h"
+#include "ufs_defs.h"
+#include "ufs_hash.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_pool.h"
+#include "ufs_shards.h"
+#include "ufs_store.h"
+
+#define BASE_NAME ("BASE")
+#define SHARED_NAME ("shared")
+#define SHARD_NAME ("shard-%lu")
+#define LOCAL_MASK ( ( (ufsIdentifierType) 1 << UFS_SHARDS_SHIFT ) - 1 )
+#define SHARD_BIT( shard ) ( (uint64_t) 1 << ( ( shard ) - 1 ) )
+
+/* Marks left by a probe job on each child, per shard.                       */
+#define MARK_IN_VIEW (1 << 0)
+#define MARK_MAPPED (1 << 1)
+
+struct shardStruct {
+    ufsImagePtr img;
+    pthread_rwlock_t lock;
+};
+
+struct shardsStruct {
+    /* shards[0] is the shared image.                                        */
+    struct shardStruct shards[ UFS_SHARDS_MAX + 1 ];
+    uint64_t numShards;
+    ufsPoolPtr pool;
+};
+
+/* In the arena of the calling thread, as in the image backend.           */
+struct idListStruct {
+    ufsIdentifierType *ids;
+    uint64_t count,
+             capacity;
+    ufsArenaPtr arena;
+    struct ufsArenaMarkStruct mark;
+};
+
+struct collectStruct {
+    struct idListStruct *list;
+    uint64_t shard;
+    bool failed;
+};
+
+/* Jobs handed to the pool by one call, the caller waits on done.           */
+struct fanStruct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    uint64_t pending;
+};
+
+struct probeJobStruct {
+    struct shardsStruct *self;
+    struct fanStruct *fan;
+    const ufsIdentifierType *view;
+    uint64_t viewSize;
+    bool base;
+    uint64_t shard;
+    const struct idListStruct *children;
+    uint8_t *marks;
+};
+
+struct syncJobStruct {
+    struct fanStruct *fan;
+    ufsImagePtr img;
+};
+
+static inline uint64_t shardOf( ufsIdentifierType id );
+static inline ufsIdType localOf( ufsIdentifierType id );
+static inline ufsIdentifierType globalOf( uint64_t shard, ufsIdType local );
+static inline uint64_t nameShard( struct shardsStruct *self, const char *name );
+static inline uint64_t allShards( struct shardsStruct *self );
+static ufsStatusType specStatus( ufsStatusType status );
+static ufsStatusType setStatus( ufsStatusType status );
+static void lockShards( struct shardsStruct *self, uint64_t mask, bool write );
+static void unlockShards( struct shardsStruct *self, uint64_t mask );
+static uint64_t viewShards( struct shardsStruct *self, ufsViewType view );
+static uint64_t validateView( struct shardsStruct *self, ufsViewType view );
+static bool areaExists( struct shardsStruct *self, ufsIdentifierType area );
+static bool storageExists( struct shardsStruct *self,
+                           ufsIdentifierType storage );
+static bool isDirectory( struct shardsStruct *self,
+                         ufsIdentifierType storage );
+static bool areaContains( struct shardsStruct *self, ufsIdentifierType area,
+                          ufsIdentifierType storage );
+static bool hasMappings( struct shardsStruct *self, ufsIdentifierType storage );
+static bool stopIter( ufsIdType id, void *userData );
+static bool collectIter( ufsIdType id, void *userData );
+static bool listInit( struct idListStruct *list );
+static bool listPush( struct idListStruct *list, ufsIdentifierType id );
+static void listFree( struct idListStruct *list );
+static ufsStatusType removeStorage( struct shardsStruct *self,
+                                    ufsIdentifierType storage,
+                                    bool directory );
+static void fanInit( struct fanStruct *fan );
+static void fanRun( struct shardsStruct *self, struct fanStruct *fan,
+                    ufsPoolJob job, void *arg );
+static void fanDone( struct fanStruct *fan );
+static void fanWait( struct fanStruct *fan );
+static void probeJob( void *arg );
+static void syncJob( void *arg );
+
+static void *shardedInit( const char *opts );
+static struct shardsStruct *shardedOpen( const char *directory,
+                                         uint64_t numShards,
+                                         uint64_t numThreads,
+                                         struct ufsHeaderSizeRequestStruct
+                                         sizes );
+static ufsImagePtr openShard( const char *path,
+                              struct ufsHeaderSizeRequestStruct sizes );
+static bool shardPath( char *path, const char *directory, uint64_t shard );
+static bool numberOption( const char *opts, const char *key,
+                          uint64_t *value );
+static void shardedDestroy( void *backend );
+static ufsIdentifierType shardedAddDirectory( void *backend,
+                                              const char *name );
+static ufsIdentifierType shardedAddFile( void *backend,
+                                         ufsIdentifierType directory,
+                                         const char *name );
+static ufsIdentifierType shardedAddArea( void *backend, const char *name );
+static ufsIdentifierType shardedGetDirectory( void *backend,
+                                              const char *name );
+static ufsIdentifierType shardedGetFile( void *backend,
+                                         ufsIdentifierType directory,
+                                         char *name );
+static ufsIdentifierType shardedGetArea( void *backend, const char *name );
+static ufsStatusType shardedRemoveDirectory( void *backend,
+                                             ufsIdentifierType directory );
+static ufsStatusType shardedRemoveFile( void *backend,
+                                        ufsIdentifierType file );
+static ufsStatusType shardedRemoveArea( void *backend,
+                                        ufsIdentifierType area );
+static ufsStatusType shardedAddMapping( void *backend,
+                                        ufsIdentifierType area,
+                                        ufsIdentifierType storage );
+static ufsStatusType shardedProbeMapping( void *backend,
+                                          ufsIdentifierType area,
+                                          ufsIdentifierType storage );
+static ufsIdentifierType shardedResolveStorageInView( void *backend,
+                                                      ufsViewType view,
+                                                      ufsIdentifierType
+                                                      storage );
+static ufsStatusType shardedIterateDirInView( void *backend,
+                                              ufsViewType view,
+                                              ufsIdentifierType directory,
+                                              ufsDirIter iterator,
+                                              void *userData );
+static ufsStatusType shardedCollapse( void *backend, ufsViewType view );
+
+const struct ufsBackendOps ufsShardedBackendOps = {
+    .name = "sharded",
+    .init = shardedInit,
+    .destroy = shardedDestroy,
+    .addDirectory = shardedAddDirectory,
+    .addFile = shardedAddFile,
+    .addArea = shardedAddArea,
+    .getDirectory = shardedGetDirectory,
+    .getFile = shardedGetFile,
+    .getArea = shardedGetArea,
+    .removeDirectory = shardedRemoveDirectory,
+    .removeFile = shardedRemoveFile,
+    .removeArea = shardedRemoveArea,
+    .addMapping = shardedAddMapping,
+    .probeMapping = shardedProbeMapping,
+    .resolveStorageInView = shardedResolveStorageInView,
+    .iterateDirInView = shardedIterateDirInView,
+    .collapse = shardedCollapse,
+};
+
+ufsType ufsInitSharded( const char *directory, uint64_t numShards )
+{
+    void *backend;
+
+    if ( !numShards ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    backend = shardedOpen( directory, numShards, numShards,
+                           ufsDefaultSizeRequest );
+    if ( !backend )
+        return NULL;
+
+    return ufsBackendWrap( &ufsShardedBackendOps, backend );
+}
+
+/* Options: path=<directory>, without it the shards go in UFS_SHARDS_DIR.   */
+/* shards= is the number of area shards, taken from the directory when it   */
+/* already holds shards. threads= is the number of probe workers, one per   */
+/* shard by default. files=, areas=, nodes= and strbytes= size new shards.  */
+static void *shardedInit( const char *opts )
+{
+    struct ufsHeaderSizeRequestStruct sizes;
+    char path[ PATH_MAX ];
+    uint64_t numShards = 0,
+             numThreads = 0;
+
+    sizes = ufsDefaultSizeRequest;
+    if ( !numberOption( opts, "shards", &numShards ) ||
+         !numberOption( opts, "threads", &numThreads ) ||
+         !numberOption( opts, "files", &sizes.numFiles ) ||
+         !numberOption( opts, "areas", &sizes.numAreas ) ||
+         !numberOption( opts, "nodes", &sizes.numNodes ) ||
+         !numberOption( opts, "strbytes", &sizes.numStrBytes ) )
+        return NULL;
+
+    if ( !ufsBackendOption( opts, "path", 0, path, sizeof( path ) ) ) {
+        if ( ufsErrno != UFS_DOES_NOT_EXIST )
+            return NULL;
+
+        if ( mkdir( UFS_DIRECTORY, 0755 ) && errno != EEXIST ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            return NULL;
+        }
+
+        strcpy( path, UFS_SHARDS_DIR );
+    }
+
+    return shardedOpen( path, numShards, numThreads, sizes );
+}
+
+/* A numShards of 0 takes the shards of directory, or the default.          */
+static struct shardsStruct *shardedOpen( const char *directory,
+                                         uint64_t numShards,
+                                         uint64_t numThreads,
+                                         struct ufsHeaderSizeRequestStruct
+                                         sizes )
+{
+    struct shardsStruct *self;
+    char path[ PATH_MAX ];
+    ufsStatusType status;
+    uint64_t i, existing;
+    bool shared;
+
+    if ( !directory || numShards > UFS_SHARDS_MAX ||
+         numThreads > UFS_POOL_MAX_THREADS ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    if ( mkdir( directory, 0755 ) && errno != EEXIST ) {
+        ufsErrno = UFS_UNKNOWN_ERROR;
+        return NULL;
+    }
+
+    /* The hash of an area's name picks its shard, the number of shards is  */
+    /* part of the data once there is any.                                   */
+    if ( !shardPath( path, directory, 0 ) )
+        return NULL;
+
+    shared = access( path, F_OK ) == 0;
+    for ( existing = 0; existing <= UFS_SHARDS_MAX; existing++ ) {
+        if ( !shardPath( path, directory, existing + 1 ) )
+            return NULL;
+        if ( access( path, F_OK ) )
+            break;
+    }
+
+    if ( shared != ( existing > 0 ) || existing > UFS_SHARDS_MAX ||
+         ( existing && numShards && numShards != existing ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    if ( existing )
+        numShards = existing;
+    else if ( !numShards )
+        numShards = UFS_SHARDS_DEFAULT;
+
+    if ( !numThreads )
+        numThreads = numShards < UFS_POOL_MAX_THREADS ? numShards :
+                                                        UFS_POOL_MAX_THREADS;
+
+    self = calloc( 1, sizeof( *self ) );
+    if ( !self ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    for ( i = 0; i <= UFS_SHARDS_MAX; i++ )
+        pthread_rwlock_init( &self -> shards[i].lock, NULL );
+
+    self -> pool = ufsPoolCreate( numThreads );
+    if ( !self -> pool )
+        goto error;
+
+    for ( i = 0; i <= numShards; i++ ) {
+        if ( !shardPath( path, directory, i ) )
+            goto error;
+
+        self -> shards[i].img = openShard( path, sizes );
+        if ( !self -> shards[i].img )
+            goto error;
+
+        self -> numShards = i;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return self;
+
+error:
+    status = specStatus( ufsErrno );
+    shardedDestroy( self );
+    ufsErrno = status == UFS_NO_ERROR ? UFS_UNKNOWN_ERROR : status;
+    return NULL;
+}
+
+static ufsImagePtr openShard( const char *path,
+                              struct ufsHeaderSizeRequestStruct sizes )
+{
+    ufsImagePtr img;
+
+    img = ufsImageOpen( path );
+    if ( img )
+        img = ufsHeaderValidate( img );
+    else if ( ufsErrno == UFS_IMAGE_DOES_NOT_EXIST )
+        img = ufsHeaderInit( path, sizes );
+
+    if ( !img )
+        return NULL;
+
+    if ( ufsHeaderGet( img ) -> flags & ( UFS_HEADER_FLAG_SEALED |
+                                          UFS_HEADER_FLAG_SNAPSHOT |
+                                          UFS_HEADER_FLAG_REPLICA ) ) {
+        ufsImageFree( img );
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    return img;
+}
+
+static bool shardPath( char *path, const char *directory, uint64_t shard )
+{
+    char name[ 32 ];
+    int len;
+
+    if ( shard )
+        snprintf( name, sizeof( name ), SHARD_NAME, shard );
+    else
+        strcpy( name, SHARED_NAME );
+
+    len = snprintf( path, PATH_MAX, "%s/%s", directory, name );
+    if ( len < 0 || len >= PATH_MAX ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    return true;
+}
+
+static void shardedDestroy( void *backend )
+{
+    struct shardsStruct *self;
+    struct syncJobStruct jobs[ UFS_SHARDS_MAX + 1 ];
+    struct fanStruct fan;
+    uint64_t i, numImages;
+
+    if ( !backend )
+        return;
+
+    self = backend;
+    numImages = self -> shards[0].img ? self -> numShards + 1 : 0;
+
+    /* Every shard flushes on its own, so they do at the same time.          */
+    fanInit( &fan );
+    for ( i = 0; i < numImages; i++ ) {
+        jobs[i].fan = &fan;
+        jobs[i].img = self -> shards[i].img;
+        fanRun( self, &fan, syncJob, &jobs[i] );
+    }
+    fanWait( &fan );
+
+    ufsPoolDestroy( self -> pool );
+    for ( i = 0; i <= UFS_SHARDS_MAX; i++ ) {
+        ufsImageFree( self -> shards[i].img );
+        pthread_rwlock_destroy( &self -> shards[i].lock );
+    }
+
+    free( self );
+}
+
+static ufsIdentifierType shardedAddDirectory( void *backend,
+                                              const char *name )
+{
+    struct shardsStruct *self;
+    ufsImagePtr shared;
+    ufsIdType id;
+
+    self = backend;
+    if ( !self || !name || !*name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    shared = self -> shards[0].img;
+    pthread_rwlock_wrlock( &self -> shards[0].lock );
+    if ( ufsStoreGetStorage( shared, 0, name ) > 0 ) {
+        ufsErrno = UFS_ALREADY_EXISTS;
+        id = -1;
+    } else {
+        id = ufsStoreAddStorage( shared, 0, name, true );
+        ufsErrno = specStatus( ufsErrno );
+    }
+    pthread_rwlock_unlock( &self -> shards[0].lock );
+
+    return id;
+}
+
+static ufsIdentifierType shardedAddFile( void *backend,
+                                         ufsIdentifierType directory,
+                                         const char *name )
+{
+    struct shardsStruct *self;
+    ufsImagePtr shared;
+    ufsIdType id;
+
+    self = backend;
+    if ( !self || !name || !*name || directory <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    shared = self -> shards[0].img;
+    pthread_rwlock_wrlock( &self -> shards[0].lock );
+    if ( !isDirectory( self, directory ) ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        id = -1;
+    } else if ( ufsStoreGetStorage( shared, directory, name ) > 0 ) {
+        ufsErrno = UFS_ALREADY_EXISTS;
+        id = -1;
+    } else {
+        id = ufsStoreAddStorage( shared, directory, name, false );
+        ufsErrno = specStatus( ufsErrno );
+    }
+    pthread_rwlock_unlock( &self -> shards[0].lock );
+
+    return id;
+}
+
+static ufsIdentifierType shardedAddArea( void *backend,
+                                         const char *name )
+{
+    struct shardsStruct *self;
+    ufsImagePtr img;
+    ufsIdType local;
+    uint64_t shard;
+
+    self = backend;
+    if ( !self || !name || !*name || !strcmp( name, BASE_NAME ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    /* A name only ever lives in its own shard.                              */
+    shard = nameShard( self, name );
+    img = self -> shards[ shard ].img;
+
+    lockShards( self, SHARD_BIT( shard ), true );
+    if ( ufsStoreGetArea( img, name ) > 0 ) {
+        ufsErrno = UFS_ALREADY_EXISTS;
+        local = -1;
+    } else {
+        local = ufsStoreAddArea( img, name );
+        ufsErrno = specStatus( ufsErrno );
+    }
+    unlockShards( self, SHARD_BIT( shard ) );
+
+    return local > 0 ? globalOf( shard, local ) : -1;
+}
+
+static ufsIdentifierType shardedGetDirectory( void *backend,
+                                              const char *name )
+{
+    struct shardsStruct *self;
+    ufsIdentifierType id;
+
+    self = backend;
+    if ( !self || !name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    pthread_rwlock_rdlock( &self -> shards[0].lock );
+    id = ufsStoreGetStorage( self -> shards[0].img, 0, name );
+    if ( id < 0 || !isDirectory( self, id ) )
+        id = -1;
+    pthread_rwlock_unlock( &self -> shards[0].lock );
+
+    ufsErrno = id < 0 ? UFS_DOES_NOT_EXIST : UFS_NO_ERROR;
+    return id;
+}
+
+static ufsIdentifierType shardedGetFile( void *backend,
+                                         ufsIdentifierType directory,
+                                         char *name )
+{
+    struct shardsStruct *self;
+    ufsIdentifierType id;
+
+    self = backend;
+    if ( !self || !name || directory <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    pthread_rwlock_rdlock( &self -> shards[0].lock );
+    id = ufsStoreGetStorage( self -> shards[0].img, directory, name );
+    pthread_rwlock_unlock( &self -> shards[0].lock );
+
+    ufsErrno = id < 0 ? UFS_DOES_NOT_EXIST : UFS_NO_ERROR;
+    return id < 0 ? -1 : id;
+}
+
+static ufsIdentifierType shardedGetArea( void *backend,
+                                         const char *name )
+{
+    struct shardsStruct *self;
+    ufsIdType local;
+    uint64_t shard;
+
+    self = backend;
+    if ( !self || !name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    shard = nameShard( self, name );
+    lockShards( self, SHARD_BIT( shard ), false );
+    local = ufsStoreGetArea( self -> shards[ shard ].img, name );
+    unlockShards( self, SHARD_BIT( shard ) );
+
+    if ( local <= 0 ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return globalOf( shard, local );
+}
+
+static ufsStatusType shardedRemoveDirectory( void *backend,
+                                             ufsIdentifierType directory )
+{
+    return removeStorage( backend, directory, true );
+}
+
+static ufsStatusType shardedRemoveFile( void *backend,
+                                        ufsIdentifierType file )
+{
+    return removeStorage( backend, file, false );
+}
+
+static ufsStatusType shardedRemoveArea( void *backend,
+                                        ufsIdentifierType area )
+{
+    struct shardsStruct *self;
+    ufsStatusType status;
+    uint64_t shard;
+
+    self = backend;
+    if ( !self || area <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    shard = shardOf( area );
+    if ( !shard || shard > self -> numShards )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    lockShards( self, SHARD_BIT( shard ), true );
+    if ( !areaExists( self, area ) )
+        status = UFS_DOES_NOT_EXIST;
+    else if ( !ufsStoreRemoveArea( self -> shards[ shard ].img,
+                                   localOf( area ) ) )
+        status = specStatus( ufsErrno );
+    else
+        status = UFS_NO_ERROR;
+    unlockShards( self, SHARD_BIT( shard ) );
+
+    return setStatus( status );
+}
+
+/* Adding a mapping only excludes writers of the area's shard, the storage  */
+/* can't go away while the shared image is read locked.                      */
+static ufsStatusType shardedAddMapping( void *backend,
+                                        ufsIdentifierType area,
+                                        ufsIdentifierType storage )
+{
+    struct shardsStruct *self;
+    ufsStatusType status;
+    uint64_t shard;
+
+    self = backend;
+    if ( !self || area <= 0 || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    shard = shardOf( area );
+    if ( !shard || shard > self -> numShards )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    pthread_rwlock_rdlock( &self -> shards[0].lock );
+    lockShards( self, SHARD_BIT( shard ), true );
+
+    if ( !areaExists( self, area ) || !storageExists( self, storage ) )
+        status = UFS_DOES_NOT_EXIST;
+    else if ( areaContains( self, area, storage ) )
+        status = UFS_ALREADY_EXISTS;
+    else if ( !ufsStoreAddMapping( self -> shards[ shard ].img,
+                                   localOf( area ), storage ) )
+        status = specStatus( ufsErrno );
+    else
+        status = UFS_NO_ERROR;
+
+    unlockShards( self, SHARD_BIT( shard ) );
+    pthread_rwlock_unlock( &self -> shards[0].lock );
+    return setStatus( status );
+}
+
+static ufsStatusType shardedProbeMapping( void *backend,
+                                          ufsIdentifierType area,
+                                          ufsIdentifierType storage )
+{
+    struct shardsStruct *self;
+    ufsStatusType status;
+    uint64_t shard;
+
+    self = backend;
+    if ( !self || area <= 0 || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    shard = shardOf( area );
+    if ( !shard || shard > self -> numShards )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    pthread_rwlock_rdlock( &self -> shards[0].lock );
+    lockShards( self, SHARD_BIT( shard ), false );
+
+    if ( !areaExists( self, area ) || !storageExists( self, storage ) )
+        status = UFS_DOES_NOT_EXIST;
+    else if ( !areaContains( self, area, storage ) )
+        status = UFS_MAPPING_DOES_NOT_EXIST;
+    else
+        status = UFS_NO_ERROR;
+
+    unlockShards( self, SHARD_BIT( shard ) );
+    pthread_rwlock_unlock( &self -> shards[0].lock );
+    return setStatus( status );
+}
+
+static ufsIdentifierType shardedResolveStorageInView( void *backend,
+                                                      ufsViewType view,
+                                                      ufsIdentifierType
+                                                      storage )
+{
+    struct shardsStruct *self;
+    ufsIdentifierType area;
+    uint64_t i, mask, viewSize;
+
+    self = backend;
+    if ( !self || !view || storage <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    mask = viewShards( self, view );
+    pthread_rwlock_rdlock( &self -> shards[0].lock );
+    lockShards( self, mask, false );
+
+    area = -1;
+    if ( !storageExists( self, storage ) ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        goto out;
+    }
+
+    viewSize = validateView( self, view );
+    if ( ufsErrno != UFS_NO_ERROR )
+        goto out;
+
+    for ( i = 0; i < viewSize && area < 0; i++ ) {
+        if ( areaContains( self, view[i], storage ) )
+            area = view[i];
+    }
+
+    ufsErrno = area < 0 ? UFS_CANNOT_RESOLVE_STORAGE : UFS_NO_ERROR;
+
+out:
+    unlockShards( self, mask );
+    pthread_rwlock_unlock( &self -> shards[0].lock );
+    return area;
+}
+
+/* Every shard of the view marks the children its areas hold, in parallel, */
+/* the marks are then merged in the order the children were listed.         */
+static ufsStatusType shardedIterateDirInView( void *backend,
+                                              ufsViewType view,
+                                              ufsIdentifierType directory,
+                                              ufsDirIter iterator,
+                                              void *userData )
+{
+    struct shardsStruct *self;
+    struct idListStruct children = { 0 };
+    struct collectStruct collect = { .list = &children };
+    struct probeJobStruct jobs[ UFS_SHARDS_MAX ];
+    struct fanStruct fan;
+    ufsStatusType status;
+    uint64_t i, j, mask, viewSize, numEntries, numJobs;
+    uint8_t *marks, merged;
+    bool base;
+
+    self = backend;
+    if ( !self || !view || !iterator || directory <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    if ( !listInit( &children ) )
+        return setStatus( UFS_OUT_OF_MEMORY );
+
+    marks = NULL;
+    mask = viewShards( self, view );
+    pthread_rwlock_rdlock( &self -> shards[0].lock );
+    lockShards( self, mask, false );
+
+    if ( !isDirectory( self, directory ) ) {
+        status = UFS_DOES_NOT_EXIST;
+        goto out;
+    }
+
+    viewSize = validateView( self, view );
+    status = ufsErrno;
+    if ( status != UFS_NO_ERROR )
+        goto out;
+
+    base = false;
+    for ( i = 0; i < viewSize; i++ )
+        base = base || view[i] == 0;
+
+    ufsStoreIterateChildren( self -> shards[0].img, directory, collectIter,
+                             &collect );
+    if ( collect.failed ) {
+        status = UFS_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    marks = ufsArenaAlloc( children.arena,
+                           children.count * self -> numShards );
+    if ( !marks ) {
+        status = UFS_OUT_OF_MEMORY;
+        goto out;
+    }
+    memset( marks, 0, children.count * self -> numShards );
+
+    /* The locks taken above cover the workers as well.                     */
+    fanInit( &fan );
+    numJobs = 0;
+    for ( i = 1; i <= self -> numShards && children.count; i++ ) {
+        if ( !( mask & SHARD_BIT( i ) ) )
+            continue;
+
+        jobs[ numJobs ] = (struct probeJobStruct) {
+            .self = self,
+            .fan = &fan,
+            .view = view,
+            .viewSize = viewSize,
+            .base = base,
+            .shard = i,
+            .children = &children,
+            .marks = marks + ( i - 1 ) * children.count
+        };
+        fanRun( self, &fan, probeJob, &jobs[ numJobs++ ] );
+    }
+    fanWait( &fan );
+
+    numEntries = 0;
+    for ( i = 0; i < children.count; i++ ) {
+        merged = 0;
+        for ( j = 0; j < self -> numShards; j++ )
+            merged |= marks[ j * children.count + i ];
+
+        if ( merged & MARK_IN_VIEW || ( base && !( merged & MARK_MAPPED ) ) )
+            children.ids[ numEntries++ ] = children.ids[i];
+    }
+
+    unlockShards( self, mask );
+    pthread_rwlock_unlock( &self -> shards[0].lock );
+
+    status = UFS_NO_ERROR;
+    for ( i = 0; i < numEntries && status == UFS_NO_ERROR; i++ )
+        status = iterator( children.ids[i], i, numEntries, userData );
+
+    listFree( &children );
+    return setStatus( status );
+
+out:
+    unlockShards( self, mask );
+    pthread_rwlock_unlock( &self -> shards[0].lock );
+    listFree( &children );
+    return setStatus( status );
+}
+
+static ufsStatusType shardedCollapse( void *backend,
+                                      ufsViewType view )
+{
+    struct shardsStruct *self;
+    struct idListStruct storage = { 0 }, added = { 0 };
+    struct collectStruct collect = { .list = &storage };
+    uint64_t ends[ UFS_VIEW_MAX_SIZE ];
+    ufsIdentifierType last;
+    ufsStatusType status;
+    ufsImagePtr lastImg;
+    uint64_t i, j, mask, viewSize;
+
+    self = backend;
+    if ( !self || !view )
+        return setStatus( UFS_BAD_CALL );
+
+    if ( !listInit( &storage ) )
+        return setStatus( UFS_OUT_OF_MEMORY );
+
+    if ( !listInit( &added ) ) {
+        listFree( &storage );
+        return setStatus( UFS_OUT_OF_MEMORY );
+    }
+
+    mask = viewShards( self, view );
+    lockShards( self, mask, true );
+
+    viewSize = validateView( self, view );
+    status = ufsErrno;
+    if ( status != UFS_NO_ERROR || viewSize < 2 )
+        goto out;
+
+    /* BASE can't be enumerated.                                             */
+    for ( i = 0; i + 1 < viewSize; i++ ) {
+        if ( view[i] == 0 ) {
+            status = UFS_BAD_CALL;
+            goto out;
+        }
+    }
+
+    /* The storage of area i is storage.ids[ ends[ i - 1 ] .. ends[i] ).     */
+    for ( i = 0; i + 1 < viewSize; i++ ) {
+        ufsStoreIterateAreaMappings( self -> shards[ shardOf( view[i] ) ].img,
+                                     localOf( view[i] ), collectIter,
+                                     &collect );
+        if ( collect.failed ) {
+            status = UFS_OUT_OF_MEMORY;
+            goto out;
+        }
+        ends[i] = storage.count;
+    }
+
+    /* All or nothing, the last area gets every mapping before any goes and */
+    /* what it got is taken back on failure. A crash in between loses none. */
+    last = view[ viewSize - 1 ];
+    lastImg = self -> shards[ shardOf( last ) ].img;
+    for ( j = 0; last && j < storage.count && status == UFS_NO_ERROR; j++ ) {
+        if ( areaContains( self, last, storage.ids[j] ) )
+            continue;
+
+        if ( !listPush( &added, storage.ids[j] ) )
+            status = UFS_OUT_OF_MEMORY;
+        else if ( !ufsStoreAddMapping( lastImg, localOf( last ),
+                                       storage.ids[j] ) ) {
+            status = specStatus( ufsErrno );
+            added.count--;
+        }
+    }
+
+    if ( status != UFS_NO_ERROR ) {
+        for ( j = 0; j < added.count; j++ )
+            ufsStoreRemoveMapping( lastImg, localOf( last ), added.ids[j] );
+        goto out;
+    }
+
+    for ( i = 0, j = 0; i + 1 < viewSize; i++ ) {
+        for ( ; j < ends[i]; j++ )
+            ufsStoreRemoveMapping( self -> shards[ shardOf( view[i] ) ].img,
+                                   localOf( view[i] ), storage.ids[j] );
+    }
+
+out:
+    unlockShards( self, mask );
+    listFree( &added );
+    listFree( &storage );
+    return setStatus( status );
+}
+
+static inline uint64_t shardOf( ufsIdentifierType id )
+{
+    return (uint64_t) id >> UFS_SHARDS_SHIFT;
+}
+
+static inline ufsIdType localOf( ufsIdentifierType id )
+{
+    return id & LOCAL_MASK;
+}
+
+static inline ufsIdentifierType globalOf( uint64_t shard, ufsIdType local )
+{
+    return (ufsIdentifierType) ( shard << UFS_SHARDS_SHIFT ) | local;
+}
+
+static inline uint64_t nameShard( struct shardsStruct *self, const char *name )
+{
+    return 1 + ufsHashString( name, 0 ) % self -> numShards;
+}
+
+static inline uint64_t allShards( struct shardsStruct *self )
+{
+    return self -> numShards == 64 ? UINT64_MAX :
+                                     SHARD_BIT( self -> numShards + 1 ) - 1;
+}
+
+/* Translates the statuses of the store to the statuses of the spec.         */
+static ufsStatusType specStatus( ufsStatusType status )
+{
+    switch ( status ) {
+    case UFS_FILE_ALREADY_EXISTS:
+    case UFS_AREA_ALREADY_EXISTS:
+    case UFS_MAPPING_ALREADY_EXISTS:
+        return UFS_ALREADY_EXISTS;
+    case UFS_FILE_DOES_NOT_EXIST:
+    case UFS_AREA_DOES_NOT_EXIST:
+        return UFS_DOES_NOT_EXIST;
+    case UFS_IMAGE_IS_SEALED:
+    case UFS_IMAGE_IS_SNAPSHOT:
+    case UFS_IMAGE_IS_REPLICA:
+        return UFS_BAD_CALL;
+    default:
+        break;
+    }
+
+    return status <= UFS_UNKNOWN_ERROR ? status : UFS_UNKNOWN_ERROR;
+}
+
+static ufsStatusType setStatus( ufsStatusType status )
+{
+    ufsErrno = status;
+    return status;
+}
+
+/* Area shards are always locked in increasing order.                        */
+static void lockShards( struct shardsStruct *self, uint64_t mask, bool write )
+{
+    uint64_t i;
+
+    for ( i = 1; i <= self -> numShards; i++ ) {
+        if ( !( mask & SHARD_BIT( i ) ) )
+            continue;
+
+        if ( write )
+            pthread_rwlock_wrlock( &self -> shards[i].lock );
+        else
+            pthread_rwlock_rdlock( &self -> shards[i].lock );
+    }
+}
+
+static void unlockShards( struct shardsStruct *self, uint64_t mask )
+{
+    uint64_t i;
+
+    for ( i = self -> numShards; i >= 1; i-- ) {
+        if ( mask & SHARD_BIT( i ) )
+            pthread_rwlock_unlock( &self -> shards[i].lock );
+    }
+}
+
+/* The shards a view reads, BASE reads all of them.                          */
+static uint64_t viewShards( struct shardsStruct *self, ufsViewType view )
+{
+    uint64_t i, shard,
+             mask = 0;
+
+    for ( i = 0; i < UFS_VIEW_MAX_SIZE && view[i] != UFS_VIEW_TERMINATOR;
+          i++ ) {
+        if ( view[i] == 0 )
+            return allShards( self );
+
+        shard = shardOf( view[i] );
+        if ( view[i] > 0 && shard && shard <= self -> numShards )
+            mask |= SHARD_BIT( shard );
+    }
+
+    return mask;
+}
+
+/* Returns the number of areas in view, ufsErrno tells whether it's valid.  */
+/* The shards of the view must be locked.                                    */
+static uint64_t validateView( struct shardsStruct *self, ufsViewType view )
+{
+    uint64_t i, j;
+
+    for ( i = 0; i < UFS_VIEW_MAX_SIZE && view[i] != UFS_VIEW_TERMINATOR;
+          i++ ) {
+        if ( view[i] != 0 && !areaExists( self, view[i] ) ) {
+            ufsErrno = UFS_INVALID_AREA_IN_VIEW;
+            return 0;
+        }
+
+        for ( j = 0; j < i; j++ ) {
+            if ( view[j] == view[i] ) {
+                ufsErrno = UFS_VIEW_CONTAINS_DUPLICATES;
+                return 0;
+            }
+        }
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return i;
+}
+
+static bool areaExists( struct shardsStruct *self, ufsIdentifierType area )
+{
+    uint64_t shard;
+
+    shard = shardOf( area );
+    return area > 0 && shard && shard <= self -> numShards &&
+           localOf( area ) &&
+           ufsStoreHasArea( self -> shards[ shard ].img, localOf( area ) );
+}
+
+static bool storageExists( struct shardsStruct *self,
+                           ufsIdentifierType storage )
+{
+    return storage > 0 && !shardOf( storage ) &&
+           ufsStoreHasStorage( self -> shards[0].img, storage );
+}
+
+static bool isDirectory( struct shardsStruct *self,
+                         ufsIdentifierType storage )
+{
+    return storageExists( self, storage ) &&
+           ufsStoreIsDirectory( self -> shards[0].img, storage );
+}
+
+/* BASE contains exactly the storage that no area maps.                      */
+static bool areaContains( struct shardsStruct *self, ufsIdentifierType area,
+                          ufsIdentifierType storage )
+{
+    if ( area == 0 )
+        return !hasMappings( self, storage );
+
+    return ufsStoreProbeMapping( self -> shards[ shardOf( area ) ].img,
+                                 localOf( area ), storage );
+}
+
+static bool hasMappings( struct shardsStruct *self, ufsIdentifierType storage )
+{
+    bool found;
+    uint64_t i;
+
+    found = false;
+    for ( i = 1; i <= self -> numShards && !found; i++ )
+        ufsStoreIterateMappings( self -> shards[i].img, storage, stopIter,
+                                 &found );
+
+    return found;
+}
+
+static bool stopIter( ufsIdType id, void *userData )
+{
+    (void) id;
+    *(bool*)userData = true;
+    return false;
+}
+
+static bool collectIter( ufsIdType id, void *userData )
+{
+    struct collectStruct *collect;
+
+    collect = userData;
+    if ( !listPush( collect -> list, globalOf( collect -> shard, id ) ) ) {
+        collect -> failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+static bool listInit( struct idListStruct *list )
+{
+    list -> arena = ufsArenaThread();
+    if ( !list -> arena )
+        return false;
+
+    list -> mark = ufsArenaSave( list -> arena );
+    return true;
+}
+
+static bool listPush( struct idListStruct *list, ufsIdentifierType id )
+{
+    ufsIdentifierType *ids;
+    uint64_t capacity;
+
+    if ( list -> count == list -> capacity ) {
+        capacity = list -> capacity ? list -> capacity * 2 : 64;
+        ids = ufsArenaGrow( list -> arena, list -> ids,
+                            list -> capacity * sizeof( *ids ),
+                            capacity * sizeof( *ids ) );
+        if ( !ids )
+            return false;
+
+        list -> ids = ids;
+        list -> capacity = capacity;
+    }
+
+    list -> ids[ list -> count++ ] = id;
+    return true;
+}
+
+static void listFree( struct idListStruct *list )
+{
+    if ( list -> arena )
+        ufsArenaRestore( list -> arena, list -> mark );
+}
+
+/* Mappings go first, see ufs_shards.h.                                      */
+static ufsStatusType removeStorage( struct shardsStruct *self,
+                                    ufsIdentifierType storage,
+                                    bool directory )
+{
+    struct idListStruct areas = { 0 };
+    struct collectStruct collect = { .list = &areas };
+    ufsStatusType status;
+    uint64_t i, j;
+    bool found;
+
+    if ( !self || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    if ( !listInit( &areas ) )
+        return setStatus( UFS_OUT_OF_MEMORY );
+
+    pthread_rwlock_wrlock( &self -> shards[0].lock );
+    lockShards( self, allShards( self ), true );
+
+    if ( !storageExists( self, storage ) ||
+         isDirectory( self, storage ) != directory ) {
+        status = UFS_DOES_NOT_EXIST;
+        goto out;
+    }
+
+    found = false;
+    if ( directory )
+        ufsStoreIterateChildren( self -> shards[0].img, storage, stopIter,
+                                 &found );
+    if ( found ) {
+        status = UFS_DIRECTORY_IS_NOT_EMPTY;
+        goto out;
+    }
+
+    for ( i = 1; i <= self -> numShards; i++ ) {
+        areas.count = 0;
+        ufsStoreIterateMappings( self -> shards[i].img, storage, collectIter,
+                                 &collect );
+        if ( collect.failed ) {
+            status = UFS_OUT_OF_MEMORY;
+            goto out;
+        }
+
+        for ( j = 0; j < areas.count; j++ )
+            ufsStoreRemoveMapping( self -> shards[i].img, areas.ids[j],
+                                   storage );
+    }
+
+    status = ufsStoreRemoveStorage( self -> shards[0].img, storage ) ?
+             UFS_NO_ERROR : specStatus( ufsErrno );
+
+out:
+    unlockShards( self, allShards( self ) );
+    pthread_rwlock_unlock( &self -> shards[0].lock );
+    listFree( &areas );
+    return setStatus( status );
+}
+
+static void fanInit( struct fanStruct *fan )
+{
+    pthread_mutex_init( &fan -> lock, NULL );
+    pthread_cond_init( &fan -> done, NULL );
+    fan -> pending = 0;
+}
+
+/* Runs job on the pool, or right here when it can't take it.               */
+static void fanRun( struct shardsStruct *self, struct fanStruct *fan,
+                    ufsPoolJob job, void *arg )
+{
+    pthread_mutex_lock( &fan -> lock );
+    fan -> pending++;
+    pthread_mutex_unlock( &fan -> lock );
+
+    if ( !self -> pool || !ufsPoolSubmit( self -> pool, job, arg ) )
+        job( arg );
+}
+
+static void fanDone( struct fanStruct *fan )
+{
+    pthread_mutex_lock( &fan -> lock );
+    if ( --fan -> pending == 0 )
+        pthread_cond_signal( &fan -> done );
+    pthread_mutex_unlock( &fan -> lock );
+}
+
+static void fanWait( struct fanStruct *fan )
+{
+    pthread_mutex_lock( &fan -> lock );
+    while ( fan -> pending )
+        pthread_cond_wait( &fan -> done, &fan -> lock );
+    pthread_mutex_unlock( &fan -> lock );
+
+    pthread_cond_destroy( &fan -> done );
+    pthread_mutex_destroy( &fan -> lock );
+}
+
+static void probeJob( void *arg )
+{
+    struct probeJobStruct *job;
+    ufsImagePtr img;
+    ufsIdentifierType child;
+    uint64_t i, j;
+    bool found;
+
+    job = arg;
+    img = job -> self -> shards[ job -> shard ].img;
+    for ( i = 0; i < job -> children -> count; i++ ) {
+        child = job -> children -> ids[i];
+        for ( j = 0; j < job -> viewSize; j++ ) {
+            if ( job -> view[j] == 0 ||
+                 shardOf( job -> view[j] ) != job -> shard )
+                continue;
+
+            if ( ufsStoreProbeMapping( img, localOf( job -> view[j] ),
+                                       child ) ) {
+                job -> marks[i] = MARK_IN_VIEW | MARK_MAPPED;
+                break;
+            }
+        }
+
+        if ( job -> base && !job -> marks[i] ) {
+            found = false;
+            ufsStoreIterateMappings( img, child, stopIter, &found );
+            if ( found )
+                job -> marks[i] = MARK_MAPPED;
+        }
+    }
+
+    fanDone( job -> fan );
+}
+
+static void syncJob( void *arg )
+{
+    struct syncJobStruct *job;
+
+    job = arg;
+    ufsImageSync( job -> img );
+    fanDone( job -> fan );
+}
+
+/* Leaves value untouched when key is missing.                               */
+static bool numberOption( const char *opts, const char *key,
+                          uint64_t *value )
+{
+    char buff[ 32 ], *end;
+    uint64_t number;
+
+    if ( !ufsBackendOption( opts, key, 0, buff, sizeof( buff ) ) ) {
+        if ( ufsErrno == UFS_DOES_NOT_EXIST )
+            return true;
+
+        return false;
+    }
+
+    number = strtoull( buff, &end, 10 );
+    if ( !*buff || *end || !number ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    *value = number;
+    return true;
+}
@@ -0,0 +1,1027 @@
+/******************************************************************************\
+*  ufs_sqlite_backend.c                                                        *
+*                                                                              *
+*  Contains the SQLite backend of ufs.                                         *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* Storage, areas and mappings are WITHOUT ROWID tables clustered on their    */
+/* identifiers, name lookups and listings are served by covering indexes.     */
+/* Mappings reference storage and areas with ON DELETE CASCADE, so removing   */
+/* either removes its mappings, and constraint violations are how "already    */
+/* exists" and "does not exist" are found on insert.                          */
+/*                                                                            */
+/* Writes are batched: a transaction is opened on the first write and        */
+/* committed every batch= writes and on destroy. The database runs in WAL    */
+/* mode, a crash loses at most the open batch, batch=1 commits every write.  */
+/*                                                                            */
+/* Views are loaded into a temporary table, resolving and listing are single */
+/* queries over it. The last loaded view is kept, so repeated calls with the */
+/* same view don't reload it.                                                 */
+/*                                                                            */
+/* A ufs instance is not shared between threads, each instance owns its     */
+/* connection and the statements prepared on it.                              */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "sqlite3.h"
+#include "ufs.h"
+#include "ufs_backend.h"
+#include "ufs_defs.h"
+
+#define BASE_NAME ("BASE")
+#define DEFAULT_BATCH (256)
+#define BUSY_TIMEOUT_MS (5000)
+
+/* STORAGE_KIND answers with one of these.                                   */
+#define KIND_NONE (0)
+#define KIND_FILE (1)
+#define KIND_DIRECTORY (2)
+
+enum statementType {
+    STMT_BEGIN,
+    STMT_COMMIT,
+    STMT_SAVEPOINT,
+    STMT_RELEASE,
+    STMT_ROLLBACK_TO,
+    STMT_MAX_STORAGE,
+    STMT_MAX_AREA,
+    STMT_FIND_STORAGE,
+    STMT_STORAGE_KIND,
+    STMT_HAS_CHILDREN,
+    STMT_ADD_STORAGE,
+    STMT_REMOVE_STORAGE,
+    STMT_FIND_AREA,
+    STMT_AREA_EXISTS,
+    STMT_ADD_AREA,
+    STMT_REMOVE_AREA,
+    STMT_ADD_MAPPING,
+    STMT_PROBE_MAPPING,
+    STMT_MOVE_MAPPINGS,
+    STMT_REMOVE_AREA_MAPPINGS,
+    STMT_CLEAR_VIEW,
+    STMT_LOAD_VIEW,
+    STMT_INVALID_VIEW,
+    STMT_RESOLVE,
+    STMT_LIST,
+    STMT_COUNT
+};
+
+static const char *schema =
+    "PRAGMA journal_mode = WAL;"
+    "PRAGMA synchronous = NORMAL;"
+    "PRAGMA foreign_keys = ON;"
+    "PRAGMA temp_store = MEMORY;"
+    "CREATE TABLE IF NOT EXISTS storage ("
+    "    id INTEGER PRIMARY KEY,"
+    "    parent INTEGER NOT NULL,"
+    "    name TEXT NOT NULL,"
+    "    isDir INTEGER NOT NULL"
+    ") WITHOUT ROWID;"
+    /* Carries id as the primary key, covers lookups and listings.           */
+    "CREATE UNIQUE INDEX IF NOT EXISTS storageByName"
+    "    ON storage ( parent, name );"
+    "CREATE TABLE IF NOT EXISTS areas ("
+    "    id INTEGER PRIMARY KEY,"
+    "    name TEXT NOT NULL"
+    ") WITHOUT ROWID;"
+    "CREATE UNIQUE INDEX IF NOT EXISTS areasByName ON areas ( name );"
+    "CREATE TABLE IF NOT EXISTS mappings ("
+    "    storage INTEGER NOT NULL"
+    "        REFERENCES storage ( id ) ON DELETE CASCADE,"
+    "    area INTEGER NOT NULL"
+    "        REFERENCES areas ( id ) ON DELETE CASCADE,"
+    "    PRIMARY KEY ( storage, area )"
+    ") WITHOUT ROWID;"
+    "CREATE INDEX IF NOT EXISTS mappingsByArea ON mappings ( area, storage );"
+    "CREATE TEMP TABLE IF NOT EXISTS viewAreas ("
+    "    pos INTEGER PRIMARY KEY,"
+    "    area INTEGER NOT NULL"
+    ") WITHOUT ROWID;";
+
+/* BASE holds the storage that no area maps, both queries below spell out    */
+/* the same containment rule.                                                 */
+static const char *statementSql[ STMT_COUNT ] = {
+    [ STMT_BEGIN ] = "BEGIN IMMEDIATE",
+    [ STMT_COMMIT ] = "COMMIT",
+    [ STMT_SAVEPOINT ] = "SAVEPOINT collapse",
+    [ STMT_RELEASE ] = "RELEASE collapse",
+    [ STMT_ROLLBACK_TO ] = "ROLLBACK TO collapse",
+    [ STMT_MAX_STORAGE ] = "SELECT coalesce( max( id ), 0 ) FROM storage",
+    [ STMT_MAX_AREA ] = "SELECT coalesce( max( id ), 0 ) FROM areas",
+    [ STMT_FIND_STORAGE ] =
+        "SELECT id FROM storage WHERE parent = ?1 AND name = ?2",
+    [ STMT_STORAGE_KIND ] = "SELECT 1 + isDir FROM storage WHERE id = ?1",
+    [ STMT_HAS_CHILDREN ] = "SELECT 1 FROM storage WHERE parent = ?1 LIMIT 1",
+    [ STMT_ADD_STORAGE ] =
+        "INSERT INTO storage ( id, parent, name, isDir )"
+        " VALUES ( ?1, ?2, ?3, ?4 )",
+    [ STMT_REMOVE_STORAGE ] = "DELETE FROM storage WHERE id = ?1",
+    [ STMT_FIND_AREA ] = "SELECT id FROM areas WHERE name = ?1",
+    [ STMT_AREA_EXISTS ] = "SELECT 1 FROM areas WHERE id = ?1",
+    [ STMT_ADD_AREA ] = "INSERT INTO areas ( id, name ) VALUES ( ?1, ?2 )",
+    [ STMT_REMOVE_AREA ] = "DELETE FROM areas WHERE id = ?1",
+    [ STMT_ADD_MAPPING ] =
+        "INSERT INTO mappings ( area, storage ) VALUES ( ?1, ?2 )",
+    [ STMT_PROBE_MAPPING ] =
+        "SELECT 1 FROM mappings WHERE area = ?1 AND storage = ?2",
+    [ STMT_MOVE_MAPPINGS ] =
+        "INSERT OR IGNORE INTO mappings ( area, storage )"
+        " SELECT ?2, storage FROM mappings WHERE area = ?1",
+    [ STMT_REMOVE_AREA_MAPPINGS ] = "DELETE FROM mappings WHERE area = ?1",
+    [ STMT_CLEAR_VIEW ] = "DELETE FROM temp.viewAreas",
+    [ STMT_LOAD_VIEW ] =
+        "INSERT INTO temp.viewAreas ( pos, area ) VALUES ( ?1, ?2 )",
+    [ STMT_INVALID_VIEW ] =
+        "SELECT 1 FROM temp.viewAreas AS v"
+        " WHERE v.area != 0 AND"
+        "       NOT EXISTS ( SELECT 1 FROM areas WHERE id = v.area )"
+        " LIMIT 1",
+    [ STMT_RESOLVE ] =
+        "SELECT v.area FROM temp.viewAreas AS v"
+        " WHERE EXISTS ( SELECT 1 FROM storage WHERE id = ?1 ) AND"
+        "       ( EXISTS ( SELECT 1 FROM mappings"
+        "                  WHERE storage = ?1 AND area = v.area ) OR"
+        "         ( v.area = 0 AND"
+        "           NOT EXISTS ( SELECT 1 FROM mappings"
+        "                        WHERE storage = ?1 ) ) )"
+        " ORDER BY v.pos LIMIT 1",
+    [ STMT_LIST ] =
+        "SELECT s.id FROM storage AS s"
+        " WHERE s.parent = ?1 AND"
+        "       EXISTS ( SELECT 1 FROM temp.viewAreas AS v"
+        "                WHERE EXISTS ( SELECT 1 FROM mappings"
+        "                               WHERE storage = s.id AND"
+        "                                     area = v.area ) OR"
+        "                      ( v.area = 0 AND"
+        "                        NOT EXISTS ( SELECT 1 FROM mappings"
+        "                                     WHERE storage = s.id ) ) )",
+};
+
+struct sqliteStruct {
+    sqlite3 *db;
+    sqlite3_stmt *statements[ STMT_COUNT ];
+
+    ufsIdentifierType lastStorage,
+                      lastArea;
+
+    /* Writes in the open transaction, committed at batchSize.               */
+    uint64_t batchSize,
+             pending;
+
+    /* The view held by temp.viewAreas, only valid when loaded is set.      */
+    ufsIdentifierType view[ UFS_VIEW_MAX_SIZE ];
+    uint64_t viewSize;
+    bool loaded;
+};
+
+static sqlite3_stmt *statement( struct sqliteStruct *self,
+                                enum statementType type );
+static int64_t queryId( struct sqliteStruct *self, enum statementType type,
+                        int64_t first, int64_t second );
+static ufsIdentifierType findStorage( struct sqliteStruct *self,
+                                      ufsIdentifierType parent,
+                                      const char *name );
+static ufsIdentifierType addStorage( struct sqliteStruct *self,
+                                     ufsIdentifierType parent,
+                                     const char *name,
+                                     bool directory );
+static ufsStatusType removeStorage( struct sqliteStruct *self,
+                                    ufsIdentifierType storage,
+                                    bool directory );
+static uint64_t loadView( struct sqliteStruct *self, ufsViewType view );
+static bool beginWrite( struct sqliteStruct *self );
+static bool endWrite( struct sqliteStruct *self );
+static bool commit( struct sqliteStruct *self );
+static ufsStatusType undoCollapse( struct sqliteStruct *self );
+static ufsStatusType sqliteStatus( int rc );
+static ufsStatusType setStatus( ufsStatusType status );
+static bool batchOption( const char *opts, uint64_t *batchSize );
+
+static void *sqliteInit( const char *opts );
+static void sqliteDestroy( void *backend );
+static ufsIdentifierType sqliteAddDirectory( void *backend, const char *name );
+static ufsIdentifierType sqliteAddFile( void *backend,
+                                        ufsIdentifierType directory,
+                                        const char *name );
+static ufsIdentifierType sqliteAddArea( void *backend, const char *name );
+static ufsIdentifierType sqliteGetDirectory( void *backend, const char *name );
+static ufsIdentifierType sqliteGetFile( void *backend,
+                                        ufsIdentifierType directory,
+                                        char *name );
+static ufsIdentifierType sqliteGetArea( void *backend, const char *name );
+static ufsStatusType sqliteRemoveDirectory( void *backend,
+                                            ufsIdentifierType directory );
+static ufsStatusType sqliteRemoveFile( void *backend, ufsIdentifierType file );
+static ufsStatusType sqliteRemoveArea( void *backend, ufsIdentifierType area );
+static ufsStatusType sqliteAddMapping( void *backend,
+                                       ufsIdentifierType area,
+                                       ufsIdentifierType storage );
+static ufsStatusType sqliteProbeMapping( void *backend,
+                                         ufsIdentifierType area,
+                                         ufsIdentifierType storage );
+static ufsIdentifierType sqliteResolveStorageInView( void *backend,
+                                                     ufsViewType view,
+                                                     ufsIdentifierType storage );
+static ufsStatusType sqliteIterateDirInView( void *backend,
+                                             ufsViewType view,
+                                             ufsIdentifierType directory,
+                                             ufsDirIter iterator,
+                                             void *userData );
+static ufsStatusType sqliteCollapse( void *backend, ufsViewType view );
+
+const struct ufsBackendOps ufsSqliteBackendOps = {
+    .name = "sqlite",
+    .init = sqliteInit,
+    .destroy = sqliteDestroy,
+    .addDirectory = sqliteAddDirectory,
+    .addFile = sqliteAddFile,
+    .addArea = sqliteAddArea,
+    .getDirectory = sqliteGetDirectory,
+    .getFile = sqliteGetFile,
+    .getArea = sqliteGetArea,
+    .removeDirectory = sqliteRemoveDirectory,
+    .removeFile = sqliteRemoveFile,
+    .removeArea = sqliteRemoveArea,
+    .addMapping = sqliteAddMapping,
+    .probeMapping = sqliteProbeMapping,
+    .resolveStorageInView = sqliteResolveStorageInView,
+    .iterateDirInView = sqliteIterateDirInView,
+    .collapse = sqliteCollapse,
+};
+
+/* Options: path=<database>, without it the database goes in               */
+/* UFS_SQLITE_FILE. batch= is the number of writes per transaction.          */
+static void *sqliteInit( const char *opts )
+{
+    struct sqliteStruct *self;
+    char path[ PATH_MAX ];
+    ufsStatusType status;
+    uint64_t batchSize;
+    int rc;
+
+    batchSize = DEFAULT_BATCH;
+    if ( !batchOption( opts, &batchSize ) )
+        return NULL;
+
+    if ( !ufsBackendOption( opts, "path", 0, path, sizeof( path ) ) ) {
+        if ( ufsErrno != UFS_DOES_NOT_EXIST )
+            return NULL;
+
+        if ( mkdir( UFS_DIRECTORY, 0755 ) && errno != EEXIST ) {
+            ufsErrno = UFS_UNKNOWN_ERROR;
+            return NULL;
+        }
+
+        strcpy( path, UFS_SQLITE_FILE );
+    }
+
+    self = calloc( 1, sizeof( *self ) );
+    if ( !self ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    self -> batchSize = batchSize;
+
+    rc = sqlite3_open_v2( path, &self -> db,
+                          SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                          SQLITE_OPEN_NOMUTEX, NULL );
+    if ( rc != SQLITE_OK )
+        goto error;
+
+    sqlite3_extended_result_codes( self -> db, 1 );
+    sqlite3_busy_timeout( self -> db, BUSY_TIMEOUT_MS );
+
+    rc = sqlite3_exec( self -> db, schema, NULL, NULL, NULL );
+    if ( rc != SQLITE_OK )
+        goto error;
+
+    /* Identifiers are never handed out twice while the database is open.   */
+    self -> lastStorage = queryId( self, STMT_MAX_STORAGE, 0, 0 );
+    self -> lastArea = queryId( self, STMT_MAX_AREA, 0, 0 );
+    if ( self -> lastStorage < 0 || self -> lastArea < 0 ) {
+        rc = sqlite3_errcode( self -> db );
+        goto error;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return self;
+
+error:
+    status = sqliteStatus( rc );
+    sqliteDestroy( self );
+    ufsErrno = status;
+    return NULL;
+}
+
+static void sqliteDestroy( void *backend )
+{
+    struct sqliteStruct *self;
+    uint64_t i;
+
+    if ( !backend )
+        return;
+
+    self = backend;
+    commit( self );
+
+    for ( i = 0; i < STMT_COUNT; i++ )
+        sqlite3_finalize( self -> statements[i] );
+
+    sqlite3_close( self -> db );
+    free( self );
+}
+
+static ufsIdentifierType sqliteAddDirectory( void *backend,
+                                             const char *name )
+{
+    if ( !backend || !name || !*name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    return addStorage( backend, 0, name, true );
+}
+
+static ufsIdentifierType sqliteAddFile( void *backend,
+                                        ufsIdentifierType directory,
+                                        const char *name )
+{
+    int64_t kind;
+
+    if ( !backend || !name || !*name || directory <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    kind = queryId( backend, STMT_STORAGE_KIND, directory, 0 );
+    if ( kind < 0 )
+        return -1;
+
+    if ( kind != KIND_DIRECTORY ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    return addStorage( backend, directory, name, false );
+}
+
+static ufsIdentifierType sqliteAddArea( void *backend,
+                                        const char *name )
+{
+    struct sqliteStruct *self;
+    sqlite3_stmt *stmt;
+    int rc;
+
+    self = backend;
+    if ( !self || !name || !*name || !strcmp( name, BASE_NAME ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( !beginWrite( self ) )
+        return -1;
+
+    stmt = statement( self, STMT_ADD_AREA );
+    if ( !stmt )
+        return -1;
+
+    sqlite3_bind_int64( stmt, 1, self -> lastArea + 1 );
+    sqlite3_bind_text( stmt, 2, name, -1, SQLITE_STATIC );
+    rc = sqlite3_step( stmt );
+    sqlite3_reset( stmt );
+
+    if ( rc != SQLITE_DONE ) {
+        sqliteStatus( rc );
+        return -1;
+    }
+
+    if ( !endWrite( self ) )
+        return -1;
+
+    ufsErrno = UFS_NO_ERROR;
+    return ++self -> lastArea;
+}
+
+static ufsIdentifierType sqliteGetDirectory( void *backend,
+                                             const char *name )
+{
+    ufsIdentifierType id;
+    int64_t kind;
+
+    if ( !backend || !name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    id = findStorage( backend, 0, name );
+    if ( id <= 0 ) {
+        ufsErrno = id < 0 ? ufsErrno : UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    kind = queryId( backend, STMT_STORAGE_KIND, id, 0 );
+    if ( kind < 0 )
+        return -1;
+
+    if ( kind != KIND_DIRECTORY ) {
+        ufsErrno = UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+static ufsIdentifierType sqliteGetFile( void *backend,
+                                        ufsIdentifierType directory,
+                                        char *name )
+{
+    ufsIdentifierType id;
+
+    if ( !backend || !name || directory <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    id = findStorage( backend, directory, name );
+    if ( id <= 0 ) {
+        ufsErrno = id < 0 ? ufsErrno : UFS_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+static ufsIdentifierType sqliteGetArea( void *backend,
+                                        const char *name )
+{
+    struct sqliteStruct *self;
+    sqlite3_stmt *stmt;
+    ufsIdentifierType id;
+    int rc;
+
+    self = backend;
+    if ( !self || !name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    stmt = statement( self, STMT_FIND_AREA );
+    if ( !stmt )
+        return -1;
+
+    sqlite3_bind_text( stmt, 1, name, -1, SQLITE_STATIC );
+    rc = sqlite3_step( stmt );
+    id = rc == SQLITE_ROW ? sqlite3_column_int64( stmt, 0 ) : -1;
+    sqlite3_reset( stmt );
+
+    if ( rc == SQLITE_ROW ) {
+        ufsErrno = UFS_NO_ERROR;
+        return id;
+    }
+
+    if ( rc == SQLITE_DONE )
+        ufsErrno = UFS_DOES_NOT_EXIST;
+    else
+        sqliteStatus( rc );
+
+    return -1;
+}
+
+static ufsStatusType sqliteRemoveDirectory( void *backend,
+                                            ufsIdentifierType directory )
+{
+    return removeStorage( backend, directory, true );
+}
+
+static ufsStatusType sqliteRemoveFile( void *backend,
+                                       ufsIdentifierType file )
+{
+    return removeStorage( backend, file, false );
+}
+
+static ufsStatusType sqliteRemoveArea( void *backend,
+                                       ufsIdentifierType area )
+{
+    struct sqliteStruct *self;
+    int64_t exists;
+
+    self = backend;
+    if ( !self || area <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    exists = queryId( self, STMT_AREA_EXISTS, area, 0 );
+    if ( exists < 0 )
+        return ufsErrno;
+
+    if ( !exists )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    if ( !beginWrite( self ) ||
+         queryId( self, STMT_REMOVE_AREA, area, 0 ) < 0 ||
+         !endWrite( self ) )
+        return ufsErrno;
+
+    /* The loaded view may name the area.                                    */
+    self -> loaded = false;
+    return setStatus( UFS_NO_ERROR );
+}
+
+static ufsStatusType sqliteAddMapping( void *backend,
+                                       ufsIdentifierType area,
+                                       ufsIdentifierType storage )
+{
+    struct sqliteStruct *self;
+
+    self = backend;
+    if ( !self || area <= 0 || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    if ( !beginWrite( self ) ||
+         queryId( self, STMT_ADD_MAPPING, area, storage ) < 0 ||
+         !endWrite( self ) )
+        return ufsErrno;
+
+    return setStatus( UFS_NO_ERROR );
+}
+
+static ufsStatusType sqliteProbeMapping( void *backend,
+                                         ufsIdentifierType area,
+                                         ufsIdentifierType storage )
+{
+    struct sqliteStruct *self;
+    int64_t found;
+
+    self = backend;
+    if ( !self || area <= 0 || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    found = queryId( self, STMT_PROBE_MAPPING, area, storage );
+    if ( found < 0 )
+        return ufsErrno;
+
+    if ( found )
+        return setStatus( UFS_NO_ERROR );
+
+    /* Only a miss pays for telling a missing mapping from a missing side.  */
+    found = queryId( self, STMT_AREA_EXISTS, area, 0 );
+    if ( found > 0 )
+        found = queryId( self, STMT_STORAGE_KIND, storage, 0 );
+
+    if ( found < 0 )
+        return ufsErrno;
+
+    return setStatus( found ? UFS_MAPPING_DOES_NOT_EXIST : UFS_DOES_NOT_EXIST );
+}
+
+static ufsIdentifierType sqliteResolveStorageInView( void *backend,
+                                                     ufsViewType view,
+                                                     ufsIdentifierType storage )
+{
+    struct sqliteStruct *self;
+    sqlite3_stmt *stmt;
+    ufsStatusType status;
+    int64_t area, kind;
+    int rc;
+
+    self = backend;
+    if ( !self || !view || storage <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    loadView( self, view );
+    status = ufsErrno;
+    if ( status == UFS_NO_ERROR ) {
+        stmt = statement( self, STMT_RESOLVE );
+        if ( !stmt )
+            return -1;
+
+        sqlite3_bind_int64( stmt, 1, storage );
+        rc = sqlite3_step( stmt );
+        area = rc == SQLITE_ROW ? sqlite3_column_int64( stmt, 0 ) : -1;
+        sqlite3_reset( stmt );
+
+        if ( rc == SQLITE_ROW ) {
+            ufsErrno = UFS_NO_ERROR;
+            return area;
+        }
+
+        if ( rc != SQLITE_DONE ) {
+            sqliteStatus( rc );
+            return -1;
+        }
+    }
+
+    /* Missing storage is reported before anything about the view.          */
+    kind = queryId( self, STMT_STORAGE_KIND, storage, 0 );
+    if ( kind < 0 )
+        return -1;
+
+    if ( kind == KIND_NONE )
+        ufsErrno = UFS_DOES_NOT_EXIST;
+    else
+        ufsErrno = status == UFS_NO_ERROR ? UFS_CANNOT_RESOLVE_STORAGE :
+                                            status;
+
+    return -1;
+}
+
+static ufsStatusType sqliteIterateDirInView( void *backend,
+                                             ufsViewType view,
+                                             ufsIdentifierType directory,
+                                             ufsDirIter iterator,
+                                             void *userData )
+{
+    struct sqliteStruct *self;
+    sqlite3_stmt *stmt;
+    ufsIdentifierType *ids, *grown;
+    ufsStatusType status;
+    uint64_t i, numEntries, capacity;
+    int64_t kind;
+    int rc;
+
+    self = backend;
+    if ( !self || !view || !iterator || directory <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    kind = queryId( self, STMT_STORAGE_KIND, directory, 0 );
+    if ( kind < 0 )
+        return ufsErrno;
+
+    if ( kind != KIND_DIRECTORY )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    loadView( self, view );
+    if ( ufsErrno != UFS_NO_ERROR )
+        return ufsErrno;
+
+    stmt = statement( self, STMT_LIST );
+    if ( !stmt )
+        return ufsErrno;
+
+    /* The iterator needs the count up front and may call back into ufs,    */
+    /* so the listing is collected before the first call.                    */
+    ids = NULL;
+    numEntries = capacity = 0;
+    sqlite3_bind_int64( stmt, 1, directory );
+    while ( ( rc = sqlite3_step( stmt ) ) == SQLITE_ROW ) {
+        if ( numEntries == capacity ) {
+            capacity = capacity ? capacity * 2 : 64;
+            grown = realloc( ids, capacity * sizeof( *ids ) );
+            if ( !grown ) {
+                rc = SQLITE_NOMEM;
+                break;
+            }
+
+            ids = grown;
+        }
+
+        ids[ numEntries++ ] = sqlite3_column_int64( stmt, 0 );
+    }
+
+    sqlite3_reset( stmt );
+    if ( rc != SQLITE_DONE ) {
+        free( ids );
+        return sqliteStatus( rc );
+    }
+
+    status = UFS_NO_ERROR;
+    for ( i = 0; i < numEntries && status == UFS_NO_ERROR; i++ )
+        status = iterator( ids[i], i, numEntries, userData );
+
+    free( ids );
+    return setStatus( status );
+}
+
+static ufsStatusType sqliteCollapse( void *backend,
+                                     ufsViewType view )
+{
+    struct sqliteStruct *self;
+    ufsIdentifierType last;
+    uint64_t i, viewSize;
+
+    self = backend;
+    if ( !self || !view )
+        return setStatus( UFS_BAD_CALL );
+
+    viewSize = loadView( self, view );
+    if ( ufsErrno != UFS_NO_ERROR )
+        return ufsErrno;
+
+    if ( viewSize < 2 )
+        return setStatus( UFS_NO_ERROR );
+
+    /* BASE can't be enumerated, it can only be collapsed into.              */
+    for ( i = 0; i + 1 < viewSize; i++ ) {
+        if ( view[i] == 0 )
+            return setStatus( UFS_BAD_CALL );
+    }
+
+    if ( !beginWrite( self ) )
+        return ufsErrno;
+
+    /* The collapse is all or nothing, the batch around it stays open.       */
+    if ( queryId( self, STMT_SAVEPOINT, 0, 0 ) < 0 )
+        return ufsErrno;
+
+    last = view[ viewSize - 1 ];
+    for ( i = 0; i + 1 < viewSize; i++ ) {
+        if ( last && queryId( self, STMT_MOVE_MAPPINGS, view[i], last ) < 0 )
+            return undoCollapse( self );
+
+        if ( queryId( self, STMT_REMOVE_AREA_MAPPINGS, view[i], 0 ) < 0 )
+            return undoCollapse( self );
+    }
+
+    if ( queryId( self, STMT_RELEASE, 0, 0 ) < 0 )
+        return undoCollapse( self );
+
+    if ( !endWrite( self ) )
+        return ufsErrno;
+
+    return setStatus( UFS_NO_ERROR );
+}
+
+/* Statements are prepared on first use and kept for the connection.        */
+static sqlite3_stmt *statement( struct sqliteStruct *self,
+                                enum statementType type )
+{
+    int rc;
+
+    if ( !self -> statements[ type ] ) {
+        rc = sqlite3_prepare_v3( self -> db, statementSql[ type ], -1,
+                                 SQLITE_PREPARE_PERSISTENT,
+                                 &self -> statements[ type ], NULL );
+        if ( rc != SQLITE_OK ) {
+            sqliteStatus( rc );
+            return NULL;
+        }
+    }
+
+    return self -> statements[ type ];
+}
+
+/* Runs a statement of up to two integer parameters. Returns the first      */
+/* column of the first row, 0 when there are no rows and -1 on error.        */
+static int64_t queryId( struct sqliteStruct *self, enum statementType type,
+                        int64_t first, int64_t second )
+{
+    sqlite3_stmt *stmt;
+    int64_t value;
+    int rc, params;
+
+    stmt = statement( self, type );
+    if ( !stmt )
+        return -1;
+
+    params = sqlite3_bind_parameter_count( stmt );
+    if ( params > 0 )
+        sqlite3_bind_int64( stmt, 1, first );
+    if ( params > 1 )
+        sqlite3_bind_int64( stmt, 2, second );
+
+    rc = sqlite3_step( stmt );
+    value = rc == SQLITE_ROW ? sqlite3_column_int64( stmt, 0 ) : 0;
+    sqlite3_reset( stmt );
+
+    if ( rc != SQLITE_ROW && rc != SQLITE_DONE ) {
+        sqliteStatus( rc );
+        return -1;
+    }
+
+    return value;
+}
+
+/* Returns 0 when there is no such storage and -1 on error.                  */
+static ufsIdentifierType findStorage( struct sqliteStruct *self,
+                                      ufsIdentifierType parent,
+                                      const char *name )
+{
+    sqlite3_stmt *stmt;
+    ufsIdentifierType id;
+    int rc;
+
+    stmt = statement( self, STMT_FIND_STORAGE );
+    if ( !stmt )
+        return -1;
+
+    sqlite3_bind_int64( stmt, 1, parent );
+    sqlite3_bind_text( stmt, 2, name, -1, SQLITE_STATIC );
+    rc = sqlite3_step( stmt );
+    id = rc == SQLITE_ROW ? sqlite3_column_int64( stmt, 0 ) : 0;
+    sqlite3_reset( stmt );
+
+    if ( rc != SQLITE_ROW && rc != SQLITE_DONE ) {
+        sqliteStatus( rc );
+        return -1;
+    }
+
+    return id;
+}
+
+static ufsIdentifierType addStorage( struct sqliteStruct *self,
+                                     ufsIdentifierType parent,
+                                     const char *name,
+                                     bool directory )
+{
+    sqlite3_stmt *stmt;
+    int rc;
+
+    if ( !beginWrite( self ) )
+        return -1;
+
+    stmt = statement( self, STMT_ADD_STORAGE );
+    if ( !stmt )
+        return -1;
+
+    sqlite3_bind_int64( stmt, 1, self -> lastStorage + 1 );
+    sqlite3_bind_int64( stmt, 2, parent );
+    sqlite3_bind_text( stmt, 3, name, -1, SQLITE_STATIC );
+    sqlite3_bind_int( stmt, 4, directory );
+    rc = sqlite3_step( stmt );
+    sqlite3_reset( stmt );
+
+    if ( rc != SQLITE_DONE ) {
+        sqliteStatus( rc );
+        return -1;
+    }
+
+    if ( !endWrite( self ) )
+        return -1;
+
+    ufsErrno = UFS_NO_ERROR;
+    return ++self -> lastStorage;
+}
+
+static ufsStatusType removeStorage( struct sqliteStruct *self,
+                                    ufsIdentifierType storage,
+                                    bool directory )
+{
+    int64_t kind, children;
+
+    if ( !self || storage <= 0 )
+        return setStatus( UFS_BAD_CALL );
+
+    kind = queryId( self, STMT_STORAGE_KIND, storage, 0 );
+    if ( kind < 0 )
+        return ufsErrno;
+
+    if ( kind != ( directory ? KIND_DIRECTORY : KIND_FILE ) )
+        return setStatus( UFS_DOES_NOT_EXIST );
+
+    if ( directory ) {
+        children = queryId( self, STMT_HAS_CHILDREN, storage, 0 );
+        if ( children < 0 )
+            return ufsErrno;
+
+        if ( children )
+            return setStatus( UFS_DIRECTORY_IS_NOT_EMPTY );
+    }
+
+    if ( !beginWrite( self ) ||
+         queryId( self, STMT_REMOVE_STORAGE, storage, 0 ) < 0 ||
+         !endWrite( self ) )
+        return ufsErrno;
+
+    return setStatus( UFS_NO_ERROR );
+}
+
+/* Returns the number of areas in view, ufsErrno tells whether it's valid.  */
+static uint64_t loadView( struct sqliteStruct *self, ufsViewType view )
+{
+    uint64_t i, j, size;
+    int64_t invalid;
+
+    for ( size = 0; size < UFS_VIEW_MAX_SIZE &&
+                    view[ size ] != UFS_VIEW_TERMINATOR; size++ )
+        ;
+
+    if ( self -> loaded && self -> viewSize == size &&
+         !memcmp( self -> view, view, size * sizeof( *view ) ) ) {
+        ufsErrno = UFS_NO_ERROR;
+        return size;
+    }
+
+    for ( i = 0; i < size; i++ ) {
+        for ( j = 0; j < i; j++ ) {
+            if ( view[j] == view[i] ) {
+                ufsErrno = UFS_VIEW_CONTAINS_DUPLICATES;
+                return 0;
+            }
+        }
+    }
+
+    self -> loaded = false;
+    if ( queryId( self, STMT_CLEAR_VIEW, 0, 0 ) < 0 )
+        return 0;
+
+    for ( i = 0; i < size; i++ ) {
+        if ( queryId( self, STMT_LOAD_VIEW, i, view[i] ) < 0 )
+            return 0;
+    }
+
+    invalid = queryId( self, STMT_INVALID_VIEW, 0, 0 );
+    if ( invalid ) {
+        ufsErrno = invalid < 0 ? ufsErrno : UFS_INVALID_AREA_IN_VIEW;
+        return 0;
+    }
+
+    memcpy( self -> view, view, size * sizeof( *view ) );
+    self -> viewSize = size;
+    self -> loaded = true;
+
+    ufsErrno = UFS_NO_ERROR;
+    return size;
+}
+
+static bool beginWrite( struct sqliteStruct *self )
+{
+    if ( !sqlite3_get_autocommit( self -> db ) )
+        return true;
+
+    return queryId( self, STMT_BEGIN, 0, 0 ) == 0;
+}
+
+/* Counts a write, committing the batch once it is full.                     */
+static bool endWrite( struct sqliteStruct *self )
+{
+    if ( ++self -> pending < self -> batchSize )
+        return true;
+
+    return commit( self );
+}
+
+static bool commit( struct sqliteStruct *self )
+{
+    self -> pending = 0;
+    if ( !self -> db || sqlite3_get_autocommit( self -> db ) )
+        return true;
+
+    return queryId( self, STMT_COMMIT, 0, 0 ) == 0;
+}
+
+/* Rolls back to the savepoint of sqliteCollapse and drops it, keeping the   */
+/* error that got there.                                                     */
+static ufsStatusType undoCollapse( struct sqliteStruct *self )
+{
+    ufsStatusType status;
+
+    status = ufsErrno;
+    queryId( self, STMT_ROLLBACK_TO, 0, 0 );
+    queryId( self, STMT_RELEASE, 0, 0 );
+    return setStatus( status );
+}
+
+static ufsStatusType sqliteStatus( int rc )
+{
+    switch ( rc ) {
+    case SQLITE_NOMEM:
+        return setStatus( UFS_OUT_OF_MEMORY );
+    case SQLITE_CONSTRAINT_UNIQUE:
+    case SQLITE_CONSTRAINT_PRIMARYKEY:
+        return setStatus( UFS_ALREADY_EXISTS );
+    case SQLITE_CONSTRAINT_FOREIGNKEY:
+        return setStatus( UFS_DOES_NOT_EXIST );
+    default:
+        break;
+    }
+
+    return setStatus( UFS_UNKNOWN_ERROR );
+}
+
+static ufsStatusType setStatus( ufsStatusType status )
+{
+    ufsErrno = status;
+    return status;
+}
+
+/* Leaves batchSize untouched when batch= is missing.                        */
+static bool batchOption( const char *opts, uint64_t *batchSize )
+{
+    char buff[ 32 ], *end;
+    uint64_t value;
+
+    if ( !ufsBackendOption( opts, "batch", 0, buff, sizeof( buff ) ) )
+        return ufsErrno == UFS_DOES_NOT_EXIST;
+
+    value = strtoull( buff, &end, 10 );
+    if ( !*buff || *end || !value ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    *batchSize = value;
+    return true;
+}
@@ -0,0 +1,2335 @@
+/******************************************************************************\
+*  ufs_store.c                                                                 *
+*                                                                              *
+*  Contains the definitions for the ufs record store.                          *
+*  The indices are B-trees ( CLRS style, top down ) kept in the node section.  *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ufs_defs.h"
+#include "ufs_hash.h"
+#include "ufs_cold.h"
+#include "ufs_extent.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_inline.h"
+#include "ufs_layout.h"
+#include "ufs_seal.h"
+#include "ufs_store.h"
+
+#define T UFS_NODE_MIN_DEGREE
+
+typedef bool (*keyIter)( const struct ufsKeyStruct *key, void *userData );
+
+struct idIterAdapterStruct {
+    ufsStoreIter iter;
+    void *userData;
+    int column;
+};
+
+/* The deepest tree a diff can walk, far beyond what an image can hold.     */
+#define DIFF_MAX_DEPTH (64)
+
+enum cursorItemEnum {
+    CURSOR_END = 0,
+    CURSOR_KEY,
+    CURSOR_TREE,
+};
+
+struct cursorFrameStruct {
+    ufsIdType node;
+    int pos;
+};
+
+/* An in order walk of a tree that can step over whole subtrees.            */
+struct cursorStruct {
+    ufsImagePtr img;
+    /* The root, until it is entered or skipped.                             */
+    ufsIdType pending;
+    uint64_t height;
+    int depth;
+    struct cursorFrameStruct stack[ DIFF_MAX_DEPTH ];
+};
+
+struct diffStruct {
+    ufsImagePtr img;
+    enum ufsIndexEnum index;
+    ufsStoreChangeIter iter;
+    void *userData;
+};
+
+struct nameSearchStruct {
+    ufsImagePtr img;
+    enum ufsTyepesEnum type;
+    const char *name;
+    ufsIdType found;
+};
+
+static inline bool isSealed( ufsImagePtr img );
+static inline bool isSnapshot( ufsImagePtr img );
+static bool checkWritable( ufsImagePtr img );
+static bool checkMutable( ufsImagePtr img );
+static inline struct ufsNodeStruct *getNode( ufsImagePtr img, ufsIdType id );
+static inline struct ufsFileStruct *getFile( ufsImagePtr img, ufsIdType id );
+static inline struct ufsAreaStruct *getArea( ufsImagePtr img, ufsIdType id );
+static inline int compareKeys( const struct ufsKeyStruct *a,
+                               const struct ufsKeyStruct *b );
+static inline struct ufsKeyStruct makeKey( ufsIdType a, ufsIdType b,
+                                           ufsIdType c );
+static ufsIdType allocRecord( ufsImagePtr img, enum ufsTyepesEnum type );
+static void freeRecord( ufsImagePtr img, enum ufsTyepesEnum type,
+                        ufsIdType id );
+static void dropRecord( ufsImagePtr img, enum ufsTyepesEnum type,
+                        ufsIdType id );
+static inline struct ufsSnapshotStruct *getSnapshot( ufsImagePtr img,
+                                                     ufsIdType snapshot );
+static int takeSnapshot( ufsImagePtr img );
+static void releaseSnapshot( ufsImagePtr img, int slot );
+static void releaseRecord( ufsImagePtr img, enum ufsTyepesEnum type,
+                           ufsIdType id );
+static void unpinRecords( ufsImagePtr img, enum ufsTyepesEnum type );
+static bool inSnapshot( ufsImagePtr img, enum ufsTyepesEnum type,
+                        ufsIdType id );
+static bool isReferenced( ufsImagePtr img, enum ufsTyepesEnum type,
+                          ufsIdType id );
+static bool inRoots( ufsImagePtr img, const ufsIdType *roots,
+                     enum ufsTyepesEnum type, ufsIdType id );
+static uint64_t allocString( ufsImagePtr img, const char *str );
+static void freeString( ufsImagePtr img, uint64_t offset );
+static inline uint64_t stringChunk( uint64_t len );
+static inline int stringClass( uint64_t chunk );
+static uint64_t popString( ufsImagePtr img, int stringClass, uint64_t size,
+                           uint64_t *taken );
+static void pushString( ufsImagePtr img, uint64_t offset, uint64_t chunk );
+static bool mergeStrings( ufsImagePtr img );
+static inline uint64_t getStringWord( ufsImagePtr img, uint64_t offset );
+static inline void setStringWord( ufsImagePtr img, uint64_t offset,
+                                  uint64_t word );
+static void clearBaseRecord( ufsImagePtr img, ufsIdType id );
+static void dropData( ufsImagePtr img, ufsIdType area, ufsIdType storage );
+static ufsIdType ownNode( ufsImagePtr img, ufsIdType *slot );
+static void dropNode( ufsImagePtr img, ufsIdType nodeId );
+static bool reserveNodes( ufsImagePtr img, uint64_t ops );
+static bool treeFind( ufsImagePtr img, enum ufsIndexEnum index,
+                      struct ufsKeyStruct key );
+static bool treeFindFrom( ufsImagePtr img, ufsIdType nodeId,
+                          struct ufsKeyStruct key );
+static bool treeFirst( ufsImagePtr img, enum ufsIndexEnum index,
+                       struct ufsKeyStruct from, int prefixLen,
+                       struct ufsKeyStruct *out );
+static bool treeScan( ufsImagePtr img, ufsIdType nodeId,
+                      const struct ufsKeyStruct *from, int prefixLen,
+                      keyIter iter, void *userData );
+static bool treeInsert( ufsImagePtr img, enum ufsIndexEnum index,
+                        struct ufsKeyStruct key );
+static bool treeSplitChild( ufsImagePtr img, ufsIdType parent, int i );
+static void treeDelete( ufsImagePtr img, enum ufsIndexEnum index,
+                        struct ufsKeyStruct key );
+static bool treeDeleteFrom( ufsImagePtr img, ufsIdType *slot,
+                            struct ufsKeyStruct key );
+static bool treeMerge( ufsImagePtr img, ufsIdType parent, int i );
+static uint64_t treeHeight( ufsImagePtr img, ufsIdType nodeId );
+static void cursorInit( struct cursorStruct *cursor, ufsImagePtr img,
+                        ufsIdType root );
+static enum cursorItemEnum cursorPeek( struct cursorStruct *cursor,
+                                       ufsIdType *tree, uint64_t *height,
+                                       struct ufsKeyStruct *key );
+static void cursorSkip( struct cursorStruct *cursor );
+static bool cursorEnter( struct cursorStruct *cursor, ufsIdType tree );
+static bool diffIndex( struct diffStruct *diff, ufsIdType fromRoot,
+                       ufsIdType toRoot );
+static bool emitChange( struct diffStruct *diff,
+                        const struct ufsKeyStruct *key, bool added );
+static bool checkChange( ufsImagePtr img,
+                         const struct ufsStoreChangeStruct *change );
+static bool applyChange( ufsImagePtr img,
+                         const struct ufsStoreChangeStruct *change );
+static bool placeRecord( ufsImagePtr img, enum ufsTyepesEnum type,
+                         const struct ufsStoreChangeStruct *change );
+static ufsIdType findByName( ufsImagePtr img, enum ufsTyepesEnum type,
+                             ufsIdType parent, const char *name );
+static bool nameMatches( const struct ufsKeyStruct *key, void *userData );
+static bool adaptIdIter( const struct ufsKeyStruct *key, void *userData );
+static bool iterateIndex( ufsImagePtr img, enum ufsIndexEnum index,
+                          ufsIdType prefix, int column,
+                          ufsStoreIter iter, void *userData );
+
+ufsIdType ufsStoreAddStorage( ufsImagePtr img,
+                              ufsIdType parent,
+                              const char *name,
+                              bool isDirectory )
+{
+    ufsIdType id;
+    uint64_t strOffset;
+    struct ufsFileStruct *file;
+
+    if ( !img || !name || !*name || parent < 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( !checkMutable( img ) )
+        return -1;
+
+    if ( findByName( img, UFS_TYPES_FILE, parent, name ) > 0 ) {
+        ufsErrno = UFS_FILE_ALREADY_EXISTS;
+        return -1;
+    }
+
+    id = allocRecord( img, UFS_TYPES_FILE );
+    if ( id < 0 )
+        return -1;
+
+    strOffset = allocString( img, name );
+    if ( strOffset == UINT64_MAX ) {
+        freeRecord( img, UFS_TYPES_FILE, id );
+        return -1;
+    }
+
+    file = getFile( img, id );
+    file -> isOwned = 1;
+    file -> generation++;
+    file -> isDirectory = isDirectory;
+    file -> parent = parent;
+    file -> strOffset = strOffset;
+    clearBaseRecord( img, id );
+
+    if ( !treeInsert( img, UFS_INDEX_NAME,
+                      makeKey( parent, ufsHashString( name, parent ), id ) ) ) {
+        dropRecord( img, UFS_TYPES_FILE, id );
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+ufsIdType ufsStoreGetStorage( ufsImagePtr img,
+                              ufsIdType parent,
+                              const char *name )
+{
+    ufsIdType id;
+
+    if ( !img || !name || parent < 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( isSealed( img ) )
+        return ufsSealGetStorage( img, parent, name );
+
+    id = findByName( img, UFS_TYPES_FILE, parent, name );
+    if ( id <= 0 ) {
+        ufsErrno = UFS_FILE_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+bool ufsStoreHasStorage( ufsImagePtr img, ufsIdType storage )
+{
+    if ( !img || storage <= 0 )
+        return false;
+
+    if ( isSealed( img ) )
+        return ufsSealHasStorage( img, storage );
+
+    if ( storage > ufsLayoutHeader( img ) -> used[ UFS_TYPES_FILE ] )
+        return false;
+
+    if ( isSnapshot( img ) )
+        return getFile( img, storage ) -> isOwned &&
+               inSnapshot( img, UFS_TYPES_FILE, storage );
+
+    return getFile( img, storage ) -> isOwned == 1;
+}
+
+bool ufsStoreIsDirectory( ufsImagePtr img, ufsIdType storage )
+{
+    if ( !img ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( isSealed( img ) )
+        return ufsSealIsDirectory( img, storage );
+
+    if ( !ufsStoreHasStorage( img, storage ) ) {
+        ufsErrno = UFS_FILE_DOES_NOT_EXIST;
+        return false;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return getFile( img, storage ) -> isDirectory;
+}
+
+ufsIdType ufsStoreGetParent( ufsImagePtr img, ufsIdType storage )
+{
+    if ( !img ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( isSealed( img ) )
+        return ufsSealGetParent( img, storage );
+
+    if ( !ufsStoreHasStorage( img, storage ) ) {
+        ufsErrno = UFS_FILE_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return getFile( img, storage ) -> parent;
+}
+
+bool ufsStoreRemoveStorage( ufsImagePtr img, ufsIdType storage )
+{
+    struct ufsFileStruct *file;
+    struct ufsKeyStruct key;
+
+    if ( !img ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !checkMutable( img ) )
+        return false;
+
+    if ( !ufsStoreHasStorage( img, storage ) ) {
+        ufsErrno = UFS_FILE_DOES_NOT_EXIST;
+        return false;
+    }
+
+    file = getFile( img, storage );
+
+    if ( file -> isDirectory &&
+         treeFirst( img, UFS_INDEX_NAME, makeKey( storage, INT64_MIN, 0 ), 1,
+                    &key ) ) {
+        ufsErrno = UFS_DIRECTORY_IS_NOT_EMPTY;
+        return false;
+    }
+
+    while ( treeFirst( img, UFS_INDEX_MAPPING,
+                       makeKey( storage, INT64_MIN, 0 ), 1, &key ) ) {
+        if ( !reserveNodes( img, 2 ) )
+            return false;
+        treeDelete( img, UFS_INDEX_MAPPING, key );
+        treeDelete( img, UFS_INDEX_AREA_MAPPING,
+                    makeKey( key.key[1], storage, 0 ) );
+        dropData( img, key.key[1], storage );
+    }
+
+    if ( !reserveNodes( img, 1 ) )
+        return false;
+
+    treeDelete( img, UFS_INDEX_NAME,
+                makeKey( file -> parent,
+                         ufsHashString( ufsLayoutStrings( img ) +
+                                        file -> strOffset, file -> parent ),
+                         storage ) );
+
+    releaseRecord( img, UFS_TYPES_FILE, storage );
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+ufsIdType ufsStoreAddArea( ufsImagePtr img, const char *name )
+{
+    ufsIdType id;
+    uint64_t strOffset;
+    struct ufsAreaStruct *area;
+
+    if ( !img || !name || !*name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( !checkMutable( img ) )
+        return -1;
+
+    if ( findByName( img, UFS_TYPES_AREA, 0, name ) > 0 ) {
+        ufsErrno = UFS_AREA_ALREADY_EXISTS;
+        return -1;
+    }
+
+    id = allocRecord( img, UFS_TYPES_AREA );
+    if ( id < 0 )
+        return -1;
+
+    strOffset = allocString( img, name );
+    if ( strOffset == UINT64_MAX ) {
+        freeRecord( img, UFS_TYPES_AREA, id );
+        return -1;
+    }
+
+    area = getArea( img, id );
+    area -> isOwned = 1;
+    area -> generation++;
+    area -> strOffset = strOffset;
+
+    if ( !treeInsert( img, UFS_INDEX_AREA_NAME,
+                      makeKey( 0, ufsHashString( name, 0 ), id ) ) ) {
+        dropRecord( img, UFS_TYPES_AREA, id );
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+ufsIdType ufsStoreGetArea( ufsImagePtr img, const char *name )
+{
+    ufsIdType id;
+
+    if ( !img || !name ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( isSealed( img ) )
+        return ufsSealGetArea( img, name );
+
+    id = findByName( img, UFS_TYPES_AREA, 0, name );
+    if ( id <= 0 ) {
+        ufsErrno = UFS_AREA_DOES_NOT_EXIST;
+        return -1;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return id;
+}
+
+bool ufsStoreHasArea( ufsImagePtr img, ufsIdType area )
+{
+    if ( !img || area <= 0 )
+        return false;
+
+    if ( isSealed( img ) )
+        return ufsSealHasArea( img, area );
+
+    if ( area > ufsLayoutHeader( img ) -> used[ UFS_TYPES_AREA ] )
+        return false;
+
+    if ( isSnapshot( img ) )
+        return getArea( img, area ) -> isOwned &&
+               inSnapshot( img, UFS_TYPES_AREA, area );
+
+    return getArea( img, area ) -> isOwned == 1;
+}
+
+bool ufsStoreRemoveArea( ufsImagePtr img, ufsIdType area )
+{
+    struct ufsAreaStruct *record;
+    struct ufsKeyStruct key;
+
+    if ( !img ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !checkMutable( img ) )
+        return false;
+
+    if ( !ufsStoreHasArea( img, area ) ) {
+        ufsErrno = UFS_AREA_DOES_NOT_EXIST;
+        return false;
+    }
+
+    while ( treeFirst( img, UFS_INDEX_AREA_MAPPING,
+                       makeKey( area, INT64_MIN, 0 ), 1, &key ) ) {
+        if ( !reserveNodes( img, 2 ) )
+            return false;
+        treeDelete( img, UFS_INDEX_AREA_MAPPING, key );
+        treeDelete( img, UFS_INDEX_MAPPING, makeKey( key.key[1], area, 0 ) );
+        dropData( img, area, key.key[1] );
+    }
+
+    if ( !reserveNodes( img, 1 ) )
+        return false;
+
+    record = getArea( img, area );
+    treeDelete( img, UFS_INDEX_AREA_NAME,
+                makeKey( 0, ufsHashString( ufsLayoutStrings( img ) +
+                                           record -> strOffset, 0 ),
+                         area ) );
+
+    releaseRecord( img, UFS_TYPES_AREA, area );
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsStoreAddMapping( ufsImagePtr img, ufsIdType area, ufsIdType storage )
+{
+    if ( !img || area <= 0 || storage <= 0 ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !checkMutable( img ) )
+        return false;
+
+    if ( treeFind( img, UFS_INDEX_MAPPING, makeKey( storage, area, 0 ) ) ) {
+        ufsErrno = UFS_MAPPING_ALREADY_EXISTS;
+        return false;
+    }
+
+    /* Enough for both inserts and for taking the first one back.            */
+    if ( !reserveNodes( img, 3 ) )
+        return false;
+
+    if ( !treeInsert( img, UFS_INDEX_MAPPING, makeKey( storage, area, 0 ) ) )
+        return false;
+
+    if ( !treeInsert( img, UFS_INDEX_AREA_MAPPING,
+                      makeKey( area, storage, 0 ) ) ) {
+        treeDelete( img, UFS_INDEX_MAPPING, makeKey( storage, area, 0 ) );
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsStoreProbeMapping( ufsImagePtr img, ufsIdType area, ufsIdType storage )
+{
+    if ( !img ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( isSealed( img ) )
+        return ufsSealProbeMapping( img, area, storage );
+
+    if ( !treeFind( img, UFS_INDEX_MAPPING, makeKey( storage, area, 0 ) ) ) {
+        ufsErrno = UFS_MAPPING_DOES_NOT_EXIST;
+        return false;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsStoreRemoveMapping( ufsImagePtr img, ufsIdType area, ufsIdType storage )
+{
+    if ( !img ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !checkMutable( img ) )
+        return false;
+
+    if ( !treeFind( img, UFS_INDEX_MAPPING, makeKey( storage, area, 0 ) ) ) {
+        ufsErrno = UFS_MAPPING_DOES_NOT_EXIST;
+        return false;
+    }
+
+    if ( !reserveNodes( img, 2 ) )
+        return false;
+
+    treeDelete( img, UFS_INDEX_MAPPING, makeKey( storage, area, 0 ) );
+    treeDelete( img, UFS_INDEX_AREA_MAPPING, makeKey( area, storage, 0 ) );
+    dropData( img, area, storage );
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsStoreIterateChildren( ufsImagePtr img,
+                              ufsIdType directory,
+                              ufsStoreIter iter,
+                              void *userData )
+{
+    if ( !img || !iter ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( isSealed( img ) )
+        return ufsSealIterateChildren( img, directory, iter, userData );
+
+    return iterateIndex( img, UFS_INDEX_NAME, directory, 2, iter, userData );
+}
+
+bool ufsStoreIterateMappings( ufsImagePtr img,
+                              ufsIdType storage,
+                              ufsStoreIter iter,
+                              void *userData )
+{
+    if ( !img || !iter ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( isSealed( img ) )
+        return ufsSealIterateMappings( img, storage, iter, userData );
+
+    return iterateIndex( img, UFS_INDEX_MAPPING, storage, 1, iter, userData );
+}
+
+bool ufsStoreIterateAreaMappings( ufsImagePtr img,
+                                  ufsIdType area,
+                                  ufsStoreIter iter,
+                                  void *userData )
+{
+    if ( !img || !iter ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( isSealed( img ) )
+        return ufsSealIterateAreaMappings( img, area, iter, userData );
+
+    return iterateIndex( img, UFS_INDEX_AREA_MAPPING, area, 1, iter,
+                         userData );
+}
+
+const char *ufsStoreGetName( ufsImagePtr img,
+                             enum ufsTyepesEnum type,
+                             ufsIdType id )
+{
+    uint64_t strOffset;
+
+    if ( !img || isSealed( img ) ||
+         ( type != UFS_TYPES_FILE && type != UFS_TYPES_AREA ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    if ( type == UFS_TYPES_FILE ) {
+        if ( !ufsStoreHasStorage( img, id ) ) {
+            ufsErrno = UFS_FILE_DOES_NOT_EXIST;
+            return NULL;
+        }
+        strOffset = getFile( img, id ) -> strOffset;
+    } else {
+        if ( !ufsStoreHasArea( img, id ) ) {
+            ufsErrno = UFS_AREA_DOES_NOT_EXIST;
+            return NULL;
+        }
+        strOffset = getArea( img, id ) -> strOffset;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return ufsLayoutStrings( img ) + strOffset;
+}
+
+uint32_t ufsStoreGetGeneration( ufsImagePtr img,
+                                enum ufsTyepesEnum type,
+                                ufsIdType id )
+{
+    if ( !img || isSealed( img ) )
+        return 0;
+
+    if ( type == UFS_TYPES_FILE )
+        return ufsStoreHasStorage( img, id ) ?
+               getFile( img, id ) -> generation : 0;
+
+    if ( type == UFS_TYPES_AREA )
+        return ufsStoreHasArea( img, id ) ?
+               getArea( img, id ) -> generation : 0;
+
+    return 0;
+}
+
+ufsIdType ufsStoreSnapshot( ufsImagePtr img )
+{
+    struct ufsHeaderStruct *header;
+    int slot;
+
+    if ( !img ) {
+        ufsErrno = UFS_BAD_CALL;
+        return -1;
+    }
+
+    if ( !checkWritable( img ) )
+        return -1;
+
+    header = ufsLayoutHeader( img );
+
+    slot = takeSnapshot( img );
+    if ( slot < 0 )
+        return -1;
+
+    /* A replica's snapshots are named after the state of its source.       */
+    if ( header -> flags & UFS_HEADER_FLAG_REPLICA )
+        header -> snapshots[ slot ].generation = header -> sourceGeneration;
+    else
+        header -> snapshots[ slot ].generation = ++header -> generation;
+
+    ufsErrno = UFS_NO_ERROR;
+    return slot + 1;
+}
+
+bool ufsStoreDropSnapshot( ufsImagePtr img, ufsIdType snapshot )
+{
+    if ( !img ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !checkWritable( img ) )
+        return false;
+
+    if ( !getSnapshot( img, snapshot ) ) {
+        ufsErrno = UFS_SNAPSHOT_DOES_NOT_EXIST;
+        return false;
+    }
+
+    releaseSnapshot( img, snapshot - 1 );
+    unpinRecords( img, UFS_TYPES_FILE );
+    unpinRecords( img, UFS_TYPES_AREA );
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+ufsImagePtr ufsStoreOpenSnapshot( const char *path, ufsIdType snapshot )
+{
+    struct ufsHeaderStruct *header;
+    ufsImagePtr img;
+
+    if ( !path ) {
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    img = ufsImageOpenPrivate( path );
+    if ( img )
+        img = ufsHeaderValidate( img );
+
+    if ( !img )
+        return NULL;
+
+    header = ufsLayoutHeader( img );
+
+    if ( header -> flags & ( UFS_HEADER_FLAG_SEALED |
+                             UFS_HEADER_FLAG_SNAPSHOT ) ) {
+        ufsImageFree( img );
+        ufsErrno = UFS_BAD_CALL;
+        return NULL;
+    }
+
+    if ( !getSnapshot( img, snapshot ) ) {
+        ufsImageFree( img );
+        ufsErrno = UFS_SNAPSHOT_DOES_NOT_EXIST;
+        return NULL;
+    }
+
+    /* Only the header page becomes private, the nodes stay shared with the */
+    /* file and the writers never change the nodes of a snapshot.            */
+    memcpy( header -> roots, getSnapshot( img, snapshot ) -> roots,
+            sizeof( header -> roots ) );
+    header -> flags |= UFS_HEADER_FLAG_SNAPSHOT;
+
+    ufsErrno = UFS_NO_ERROR;
+    return img;
+}
+
+bool ufsStoreDiff( ufsImagePtr img, ufsIdType from, ufsIdType to,
+                   ufsStoreChangeIter iter, void *userData )
+{
+    static const ufsIdType noRoots[ UFS_INDEX_COUNT ];
+    struct diffStruct diff = {
+        .img = img,
+        .iter = iter,
+        .userData = userData
+    };
+    const ufsIdType *fromRoots;
+    int i;
+
+    if ( !img || !iter || isSealed( img ) || isSnapshot( img ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( ( from && !getSnapshot( img, from ) ) || !getSnapshot( img, to ) ) {
+        ufsErrno = UFS_SNAPSHOT_DOES_NOT_EXIST;
+        return false;
+    }
+
+    fromRoots = from ? getSnapshot( img, from ) -> roots : noRoots;
+
+    /* The area mapping index mirrors the mapping index.                     */
+    for ( i = 0; i < UFS_INDEX_COUNT; i++ ) {
+        if ( i == UFS_INDEX_AREA_MAPPING )
+            continue;
+
+        diff.index = i;
+        if ( !diffIndex( &diff, fromRoots[i],
+                         getSnapshot( img, to ) -> roots[i] ) )
+            return false;
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsStoreApply( ufsImagePtr img,
+                    const struct ufsStoreChangeStruct *changes,
+                    uint64_t numChanges )
+{
+    struct ufsStoreApplyStruct apply;
+
+    if ( !img || ( !changes && numChanges ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !ufsStoreApplyBegin( img, &apply ) )
+        return false;
+
+    if ( !ufsStoreApplyChanges( img, &apply, changes, numChanges ) ) {
+        ufsStoreApplyEnd( img, &apply, false );
+        return false;
+    }
+
+    ufsStoreApplyEnd( img, &apply, true );
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsStoreApplyBegin( ufsImagePtr img, struct ufsStoreApplyStruct *apply )
+{
+    struct ufsHeaderStruct *header;
+
+    if ( !img || !apply ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !checkWritable( img ) )
+        return false;
+
+    header = ufsLayoutHeader( img );
+
+    /* Local records would sit on identifiers the source hands out.          */
+    if ( !( header -> flags & UFS_HEADER_FLAG_REPLICA ) &&
+         ( header -> used[ UFS_TYPES_FILE ] ||
+           header -> used[ UFS_TYPES_AREA ] ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    /* A snapshot of the state before keeps the trees to roll back to.       */
+    apply -> slot = takeSnapshot( img );
+    if ( apply -> slot < 0 )
+        return false;
+
+    apply -> flags = header -> flags;
+    memcpy( apply -> used, header -> used, sizeof( apply -> used ) );
+    header -> flags |= UFS_HEADER_FLAG_REPLICA;
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+bool ufsStoreApplyChanges( ufsImagePtr img,
+                           struct ufsStoreApplyStruct *apply,
+                           const struct ufsStoreChangeStruct *changes,
+                           uint64_t numChanges )
+{
+    uint64_t i;
+    int type;
+
+    if ( !img || !apply || ( !changes && numChanges ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    for ( i = 0; i < numChanges; i++ ) {
+        if ( !checkChange( img, &changes[i] ) ) {
+            ufsErrno = UFS_STREAM_DOES_NOT_APPLY;
+            return false;
+        }
+    }
+
+    for ( type = 0; type < UFS_STORE_CHANGE_COUNT; type++ ) {
+        for ( i = 0; i < numChanges; i++ ) {
+            if ( changes[i].type == type &&
+                 !applyChange( img, &changes[i] ) )
+                return false;
+        }
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+void ufsStoreApplyEnd( ufsImagePtr img, struct ufsStoreApplyStruct *apply,
+                       bool keep )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    const ufsIdType *roots = header -> snapshots[ apply -> slot ].roots;
+    struct ufsFileStruct *file;
+    struct ufsAreaStruct *area;
+    ufsIdType id;
+    int i;
+
+    if ( keep ) {
+        /* The removed records only stay pinned for the other snapshots.     */
+        releaseSnapshot( img, apply -> slot );
+        unpinRecords( img, UFS_TYPES_FILE );
+        unpinRecords( img, UFS_TYPES_AREA );
+        return;
+    }
+
+    /* The snapshot tells the records owned before from the placed ones,     */
+    /* removed records stay pinned while it names them. The names of the     */
+    /* placed ones go back to the string free lists.                         */
+    for ( id = 1; id <= header -> used[ UFS_TYPES_FILE ]; id++ ) {
+        file = getFile( img, id );
+        if ( file -> isOwned == UFS_RECORD_PINNED &&
+             inRoots( img, roots, UFS_TYPES_FILE, id ) ) {
+            file -> isOwned = 1;
+        } else if ( file -> isOwned == 1 &&
+                    !inRoots( img, roots, UFS_TYPES_FILE, id ) ) {
+            freeString( img, file -> strOffset );
+            file -> isOwned = 0;
+        }
+    }
+    for ( id = 1; id <= header -> used[ UFS_TYPES_AREA ]; id++ ) {
+        area = getArea( img, id );
+        if ( area -> isOwned == UFS_RECORD_PINNED &&
+             inRoots( img, roots, UFS_TYPES_AREA, id ) ) {
+            area -> isOwned = 1;
+        } else if ( area -> isOwned == 1 &&
+                    !inRoots( img, roots, UFS_TYPES_AREA, id ) ) {
+            freeString( img, area -> strOffset );
+            area -> isOwned = 0;
+        }
+    }
+
+    /* The snapshot hands its references back to the live roots.             */
+    for ( i = 0; i < UFS_INDEX_COUNT; i++ ) {
+        dropNode( img, header -> roots[i] );
+        header -> roots[i] = roots[i];
+    }
+    memset( &header -> snapshots[ apply -> slot ], 0,
+            sizeof( header -> snapshots[0] ) );
+    header -> numSnapshots--;
+
+    /* Nodes and strings taken since sit on the free lists now, their end    */
+    /* stays.                                                                */
+    apply -> used[ UFS_TYPES_NODE ] = header -> used[ UFS_TYPES_NODE ];
+    apply -> used[ UFS_TYPES_STRING ] = header -> used[ UFS_TYPES_STRING ];
+    memcpy( header -> used, apply -> used, sizeof( apply -> used ) );
+    header -> flags = apply -> flags;
+}
+
+bool ufsStorePromote( ufsImagePtr img )
+{
+    struct ufsHeaderStruct *header;
+    enum ufsTyepesEnum type;
+    ufsIdType id;
+    uint8_t isOwned;
+
+    if ( !img ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    if ( !checkWritable( img ) )
+        return false;
+
+    header = ufsLayoutHeader( img );
+    if ( !( header -> flags & UFS_HEADER_FLAG_REPLICA ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return false;
+    }
+
+    header -> flags &= ~UFS_HEADER_FLAG_REPLICA;
+    header -> uuid = header -> sourceUuid;
+
+    /* Generations start over in a new epoch, a replica that got further     */
+    /* than this one can't mistake a new snapshot for the one it is at.      */
+    header -> generation = ( ( header -> sourceGeneration >> 32 ) + 1 ) << 32;
+    header -> sourceUuid = 0;
+    header -> sourceGeneration = 0;
+
+    /* Records a replica dropped were never chained, chain them now.         */
+    for ( type = UFS_TYPES_FILE; type <= UFS_TYPES_AREA; type++ ) {
+        header -> freeLists[ type ] = 0;
+        header -> numFree[ type ] = 0;
+
+        for ( id = header -> used[ type ]; id > 0; id-- ) {
+            isOwned = type == UFS_TYPES_FILE ? getFile( img, id ) -> isOwned :
+                                               getArea( img, id ) -> isOwned;
+            if ( !isOwned )
+                freeRecord( img, type, id );
+        }
+    }
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
+
+static inline bool isSealed( ufsImagePtr img )
+{
+    return ufsLayoutHeader( img ) -> flags & UFS_HEADER_FLAG_SEALED;
+}
+
+static inline bool isSnapshot( ufsImagePtr img )
+{
+    return ufsLayoutHeader( img ) -> flags & UFS_HEADER_FLAG_SNAPSHOT;
+}
+
+static bool checkWritable( ufsImagePtr img )
+{
+    if ( isSealed( img ) ) {
+        ufsErrno = UFS_IMAGE_IS_SEALED;
+        return false;
+    }
+
+    if ( isSnapshot( img ) ) {
+        ufsErrno = UFS_IMAGE_IS_SNAPSHOT;
+        return false;
+    }
+
+    return true;
+}
+
+/* Replicas can be snapshotted but their records only change by ufsReceive.  */
+static bool checkMutable( ufsImagePtr img )
+{
+    if ( !checkWritable( img ) )
+        return false;
+
+    if ( ufsLayoutHeader( img ) -> flags & UFS_HEADER_FLAG_REPLICA ) {
+        ufsErrno = UFS_IMAGE_IS_REPLICA;
+        return false;
+    }
+
+    return true;
+}
+
+static inline struct ufsNodeStruct *getNode( ufsImagePtr img, ufsIdType id )
+{
+    return ufsLayoutNodes( img ) + ( id - 1 );
+}
+
+static inline struct ufsFileStruct *getFile( ufsImagePtr img, ufsIdType id )
+{
+    return ufsLayoutFiles( img ) + ( id - 1 );
+}
+
+static inline struct ufsAreaStruct *getArea( ufsImagePtr img, ufsIdType id )
+{
+    return ufsLayoutAreas( img ) + ( id - 1 );
+}
+
+static inline int compareKeys( const struct ufsKeyStruct *a,
+                               const struct ufsKeyStruct *b )
+{
+    int i;
+
+    for ( i = 0; i < UFS_KEY_WIDTH; i++ ) {
+        if ( a -> key[i] != b -> key[i] )
+            return a -> key[i] < b -> key[i] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static inline struct ufsKeyStruct makeKey( ufsIdType a, ufsIdType b,
+                                           ufsIdType c )
+{
+    struct ufsKeyStruct ret = { .key = { a, b, c } };
+    return ret;
+}
+
+static ufsIdType allocRecord( ufsImagePtr img, enum ufsTyepesEnum type )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    ufsIdType id;
+
+    id = header -> freeLists[ type ];
+
+    if ( id > 0 ) {
+        switch ( type ) {
+            case UFS_TYPES_FILE:
+                header -> freeLists[ type ] = getFile( img, id ) -> parent;
+                break;
+            case UFS_TYPES_AREA:
+                header -> freeLists[ type ] = getArea( img, id ) -> strOffset;
+                break;
+            default:
+                header -> freeLists[ type ] = getNode( img, id ) -> children[0];
+                break;
+        }
+        header -> numFree[ type ]--;
+        return id;
+    }
+
+    if ( header -> used[ type ] >= ufsLayoutCapacity( img, type ) ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    return ++header -> used[ type ];
+}
+
+static void freeRecord( ufsImagePtr img, enum ufsTyepesEnum type,
+                        ufsIdType id )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+
+    /* Replicas never allocate records, ufsStoreApply places them by id.     */
+    if ( type != UFS_TYPES_NODE &&
+         ( header -> flags & UFS_HEADER_FLAG_REPLICA ) ) {
+        if ( type == UFS_TYPES_FILE )
+            getFile( img, id ) -> isOwned = 0;
+        else
+            getArea( img, id ) -> isOwned = 0;
+        return;
+    }
+
+    switch ( type ) {
+        case UFS_TYPES_FILE:
+            getFile( img, id ) -> isOwned = 0;
+            getFile( img, id ) -> parent = header -> freeLists[ type ];
+            break;
+        case UFS_TYPES_AREA:
+            getArea( img, id ) -> isOwned = 0;
+            getArea( img, id ) -> strOffset = header -> freeLists[ type ];
+            break;
+        default:
+            getNode( img, id ) -> isOwned = 0;
+            getNode( img, id ) -> refCount = 0;
+            getNode( img, id ) -> children[0] = header -> freeLists[ type ];
+            break;
+    }
+
+    header -> freeLists[ type ] = id;
+    header -> numFree[ type ]++;
+}
+
+/* Frees a file or area record along with its name.                          */
+static void dropRecord( ufsImagePtr img, enum ufsTyepesEnum type,
+                        ufsIdType id )
+{
+    freeString( img, type == UFS_TYPES_FILE ? getFile( img, id ) -> strOffset :
+                                              getArea( img, id ) -> strOffset );
+    freeRecord( img, type, id );
+}
+
+static inline struct ufsSnapshotStruct *getSnapshot( ufsImagePtr img,
+                                                     ufsIdType snapshot )
+{
+    struct ufsSnapshotStruct *ret;
+
+    if ( snapshot <= 0 || snapshot > UFS_SNAPSHOTS_MAX )
+        return NULL;
+
+    ret = &ufsLayoutHeader( img ) -> snapshots[ snapshot - 1 ];
+    return ret -> isOwned ? ret : NULL;
+}
+
+/* The snapshot shares the roots, the writers copy whatever they touch.      */
+static int takeSnapshot( ufsImagePtr img )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    struct ufsSnapshotStruct *snapshot;
+    int slot, i;
+
+    for ( slot = 0; slot < UFS_SNAPSHOTS_MAX &&
+                    header -> snapshots[ slot ].isOwned; slot++ )
+        ;
+
+    if ( slot == UFS_SNAPSHOTS_MAX ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    snapshot = &header -> snapshots[ slot ];
+    snapshot -> isOwned = 1;
+    snapshot -> generation = 0;
+    for ( i = 0; i < UFS_INDEX_COUNT; i++ ) {
+        snapshot -> roots[i] = header -> roots[i];
+        if ( snapshot -> roots[i] > 0 )
+            getNode( img, snapshot -> roots[i] ) -> refCount++;
+    }
+    header -> numSnapshots++;
+
+    return slot;
+}
+
+static void releaseSnapshot( ufsImagePtr img, int slot )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    int i;
+
+    for ( i = 0; i < UFS_INDEX_COUNT; i++ )
+        dropNode( img, header -> snapshots[ slot ].roots[i] );
+
+    memset( &header -> snapshots[ slot ], 0, sizeof( header -> snapshots[0] ) );
+    header -> numSnapshots--;
+}
+
+/* A snapshot may still name the record, so it is only pinned until the last */
+/* snapshot goes away.                                                       */
+static void releaseRecord( ufsImagePtr img, enum ufsTyepesEnum type,
+                           ufsIdType id )
+{
+    if ( !isReferenced( img, type, id ) ) {
+        dropRecord( img, type, id );
+        return;
+    }
+
+    if ( type == UFS_TYPES_FILE )
+        getFile( img, id ) -> isOwned = UFS_RECORD_PINNED;
+    else
+        getArea( img, id ) -> isOwned = UFS_RECORD_PINNED;
+}
+
+/* Frees the pinned records no snapshot refers to anymore.                  */
+static void unpinRecords( ufsImagePtr img, enum ufsTyepesEnum type )
+{
+    ufsIdType id,
+        used = ufsLayoutHeader( img ) -> used[ type ];
+    uint8_t isOwned;
+
+    for ( id = 1; id <= used; id++ ) {
+        isOwned = type == UFS_TYPES_FILE ? getFile( img, id ) -> isOwned :
+                                           getArea( img, id ) -> isOwned;
+        if ( isOwned == UFS_RECORD_PINNED && !isReferenced( img, type, id ) )
+            dropRecord( img, type, id );
+    }
+}
+
+/* Whether a record belongs to the snapshot an image was opened on.          */
+/* Records never change while a snapshot names them, a record that was free  */
+/* or got reused since then has no key with its identifier in the snapshot.  */
+static bool inSnapshot( ufsImagePtr img, enum ufsTyepesEnum type,
+                        ufsIdType id )
+{
+    return inRoots( img, ufsLayoutHeader( img ) -> roots, type, id );
+}
+
+/* Whether any snapshot of the image still names a record.                  */
+static bool isReferenced( ufsImagePtr img, enum ufsTyepesEnum type,
+                          ufsIdType id )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    int i;
+
+    for ( i = 0; header -> numSnapshots && i < UFS_SNAPSHOTS_MAX; i++ ) {
+        if ( header -> snapshots[i].isOwned &&
+             inRoots( img, header -> snapshots[i].roots, type, id ) )
+            return true;
+    }
+
+    return false;
+}
+
+static bool inRoots( ufsImagePtr img, const ufsIdType *roots,
+                     enum ufsTyepesEnum type, ufsIdType id )
+{
+    ufsIdType parent;
+    uint64_t strOffset;
+
+    if ( type == UFS_TYPES_FILE ) {
+        parent = getFile( img, id ) -> parent;
+        strOffset = getFile( img, id ) -> strOffset;
+    } else {
+        parent = 0;
+        strOffset = getArea( img, id ) -> strOffset;
+    }
+
+    /* The writer may be reusing the record right now, don't trust it.       */
+    if ( parent < 0 ||
+         strOffset >= ufsLayoutCapacity( img, UFS_TYPES_STRING ) )
+        return false;
+
+    return treeFindFrom( img, roots[ type == UFS_TYPES_FILE ?
+                                     UFS_INDEX_NAME : UFS_INDEX_AREA_NAME ],
+                         makeKey( parent,
+                                  ufsHashString( ufsLayoutStrings( img ) +
+                                                 strOffset, parent ),
+                                  id ) );
+}
+
+/* A freed chunk of the same size first, then the untouched end of the       */
+/* section, then a bigger freed chunk split in two. Once none fits the free  */
+/* chunks next to each other are merged and it's tried once more.            */
+static uint64_t allocString( ufsImagePtr img, const char *str )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    uint64_t offset, chunk, taken,
+        len = strlen( str ) + 1;
+    bool merged = false;
+    int c;
+
+    chunk = stringChunk( len );
+
+    do {
+        c = stringClass( chunk );
+        offset = popString( img, c, chunk, &taken );
+
+        if ( offset == UINT64_MAX &&
+             ufsLayoutCapacity( img, UFS_TYPES_STRING ) -
+             header -> used[ UFS_TYPES_STRING ] >= chunk ) {
+            offset = header -> used[ UFS_TYPES_STRING ];
+            taken = chunk;
+            header -> used[ UFS_TYPES_STRING ] += chunk;
+        }
+
+        for ( c++; offset == UINT64_MAX && c < UFS_STRING_CLASSES; c++ )
+            offset = popString( img, c, chunk, &taken );
+    } while ( offset == UINT64_MAX && !merged &&
+              header -> numFree[ UFS_TYPES_STRING ] >= chunk &&
+              ( merged = mergeStrings( img ) ) );
+
+    if ( offset == UINT64_MAX ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return UINT64_MAX;
+    }
+
+    if ( taken > chunk )
+        pushString( img, offset + chunk, taken - chunk );
+
+    memcpy( ufsLayoutStrings( img ) + offset, str, len );
+    return offset;
+}
+
+static void freeString( ufsImagePtr img, uint64_t offset )
+{
+    pushString( img, offset,
+                stringChunk( strlen( ufsLayoutStrings( img ) + offset ) + 1 ) );
+}
+
+/* The bytes of the chunk holding len bytes.                                 */
+static inline uint64_t stringChunk( uint64_t len )
+{
+    return ( len + UFS_STRING_GRANULE - 1 ) / UFS_STRING_GRANULE *
+           UFS_STRING_GRANULE;
+}
+
+static inline int stringClass( uint64_t chunk )
+{
+    return chunk / UFS_STRING_GRANULE < UFS_STRING_CLASSES ?
+           chunk / UFS_STRING_GRANULE - 1 : UFS_STRING_CLASSES - 1;
+}
+
+/* Takes the first chunk of at least size bytes off the list of a class,     */
+/* UINT64_MAX if there is none. *taken is set to the size of the chunk.      */
+static uint64_t popString( ufsImagePtr img, int stringClass, uint64_t size,
+                           uint64_t *taken )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    uint64_t offset, chunk,
+        prev = UINT64_MAX,
+        next = header -> stringFreeLists[ stringClass ];
+
+    while ( next ) {
+        offset = next - 1;
+        next = getStringWord( img, offset );
+        chunk = stringClass < UFS_STRING_CLASSES - 1 ?
+                (uint64_t)( stringClass + 1 ) * UFS_STRING_GRANULE :
+                getStringWord( img, offset + UFS_STRING_GRANULE );
+
+        if ( chunk >= size ) {
+            if ( prev == UINT64_MAX )
+                header -> stringFreeLists[ stringClass ] = next;
+            else
+                setStringWord( img, prev, next );
+
+            header -> numFree[ UFS_TYPES_STRING ] -= chunk;
+            *taken = chunk;
+            return offset;
+        }
+
+        prev = offset;
+    }
+
+    return UINT64_MAX;
+}
+
+static void pushString( ufsImagePtr img, uint64_t offset, uint64_t chunk )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    int c;
+
+    c = stringClass( chunk );
+    setStringWord( img, offset, header -> stringFreeLists[c] );
+    if ( c == UFS_STRING_CLASSES - 1 )
+        setStringWord( img, offset + UFS_STRING_GRANULE, chunk );
+
+    header -> stringFreeLists[c] = offset + 1;
+    header -> numFree[ UFS_TYPES_STRING ] += chunk;
+}
+
+/* Rebuilds the free lists with runs of free chunks merged into one, a run   */
+/* reaching the end of what was handed out goes back to the untouched end.   */
+static bool mergeStrings( ufsImagePtr img )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    uint64_t numGranules, offset, chunk, next, start, i;
+    uint8_t *isFree;
+    int c;
+
+    numGranules = header -> used[ UFS_TYPES_STRING ] / UFS_STRING_GRANULE;
+    isFree = calloc( numGranules + 1, 1 );
+    if ( !isFree )
+        return false;
+
+    for ( c = 0; c < UFS_STRING_CLASSES; c++ ) {
+        for ( next = header -> stringFreeLists[c]; next; ) {
+            offset = next - 1;
+            next = getStringWord( img, offset );
+            chunk = c < UFS_STRING_CLASSES - 1 ?
+                    (uint64_t)( c + 1 ) * UFS_STRING_GRANULE :
+                    getStringWord( img, offset + UFS_STRING_GRANULE );
+            memset( isFree + offset / UFS_STRING_GRANULE, 1,
+                    chunk / UFS_STRING_GRANULE );
+        }
+        header -> stringFreeLists[c] = 0;
+    }
+    header -> numFree[ UFS_TYPES_STRING ] = 0;
+
+    for ( i = 0; i < numGranules; ) {
+        if ( !isFree[i] ) {
+            i++;
+            continue;
+        }
+
+        for ( start = i; i < numGranules && isFree[i]; i++ )
+            ;
+
+        if ( i == numGranules )
+            header -> used[ UFS_TYPES_STRING ] = start * UFS_STRING_GRANULE;
+        else
+            pushString( img, start * UFS_STRING_GRANULE,
+                        ( i - start ) * UFS_STRING_GRANULE );
+    }
+
+    free( isFree );
+    return true;
+}
+
+static inline uint64_t getStringWord( ufsImagePtr img, uint64_t offset )
+{
+    uint64_t word;
+
+    memcpy( &word, ufsLayoutStrings( img ) + offset, sizeof( word ) );
+    return word;
+}
+
+static inline void setStringWord( ufsImagePtr img, uint64_t offset,
+                                  uint64_t word )
+{
+    memcpy( ufsLayoutStrings( img ) + offset, &word, sizeof( word ) );
+}
+
+/* Identifiers are reused, what BASE had for the last owner is stale.        */
+static void clearBaseRecord( ufsImagePtr img, ufsIdType id )
+{
+    if ( (uint64_t) id <= ufsLayoutCapacity( img, UFS_TYPES_BASE ) )
+        memset( &ufsLayoutBaseRecords( img )[ id - 1 ], 0,
+                sizeof( struct ufsBaseRecordStruct ) );
+}
+
+/* The inline data and the extents of a mapping go with it.                  */
+static void dropData( ufsImagePtr img, ufsIdType area, ufsIdType storage )
+{
+    if ( ufsInlineHas( img ) )
+        ufsInlineRemove( img, area, storage );
+    /* Cold frames stand in for extents, a cold store needs an extent one.   */
+    if ( ufsExtentHas( img ) ) {
+        ufsExtentDrop( img, area, storage );
+        ufsColdDrop( img, area, storage );
+    }
+}
+
+static bool treeFind( ufsImagePtr img, enum ufsIndexEnum index,
+                      struct ufsKeyStruct key )
+{
+    return treeFindFrom( img, ufsLayoutHeader( img ) -> roots[ index ], key );
+}
+
+static bool treeFindFrom( ufsImagePtr img, ufsIdType nodeId,
+                          struct ufsKeyStruct key )
+{
+    struct ufsNodeStruct *node;
+    int i, cmp;
+
+    while ( nodeId > 0 ) {
+        node = getNode( img, nodeId );
+
+        for ( i = 0; i < node -> numKeys; i++ ) {
+            cmp = compareKeys( &key, &node -> keys[i] );
+            if ( cmp == 0 )
+                return true;
+            if ( cmp < 0 )
+                break;
+        }
+
+        if ( node -> isLeaf )
+            return false;
+
+        nodeId = node -> children[i];
+    }
+
+    return false;
+}
+
+struct firstKeyStruct {
+    struct ufsKeyStruct *out;
+    bool found;
+};
+
+static bool takeFirst( const struct ufsKeyStruct *key, void *userData )
+{
+    struct firstKeyStruct
+        *first = userData;
+
+    *first -> out = *key;
+    first -> found = true;
+    return false;
+}
+
+static bool treeFirst( ufsImagePtr img, enum ufsIndexEnum index,
+                       struct ufsKeyStruct from, int prefixLen,
+                       struct ufsKeyStruct *out )
+{
+    struct firstKeyStruct first = { .out = out, .found = false };
+
+    treeScan( img, ufsLayoutHeader( img ) -> roots[ index ], &from, prefixLen,
+              takeFirst, &first );
+
+    return first.found;
+}
+
+/* In order traversal of the keys >= from sharing the first prefixLen words  */
+/* of from. Returns false once the traversal should stop.                     */
+static bool treeScan( ufsImagePtr img, ufsIdType nodeId,
+                      const struct ufsKeyStruct *from, int prefixLen,
+                      keyIter iter, void *userData )
+{
+    struct ufsNodeStruct *node;
+    int i, j;
+
+    if ( nodeId <= 0 )
+        return true;
+
+    node = getNode( img, nodeId );
+
+    for ( i = 0; i < node -> numKeys &&
+                 compareKeys( &node -> keys[i], from ) < 0; i++ )
+        ;
+
+    for ( ; i <= node -> numKeys; i++ ) {
+        if ( !node -> isLeaf &&
+             !treeScan( img, node -> children[i], from, prefixLen,
+                        iter, userData ) )
+            return false;
+
+        if ( i == node -> numKeys )
+            break;
+
+        for ( j = 0; j < prefixLen; j++ ) {
+            if ( node -> keys[i].key[j] != from -> key[j] )
+                return false;
+        }
+
+        if ( !iter( &node -> keys[i], userData ) )
+            return false;
+    }
+
+    return true;
+}
+
+static bool treeInsert( ufsImagePtr img, enum ufsIndexEnum index,
+                        struct ufsKeyStruct key )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    struct ufsNodeStruct *node;
+    ufsIdType nodeId, newRoot;
+    int i;
+
+    if ( header -> roots[ index ] <= 0 ) {
+        nodeId = allocRecord( img, UFS_TYPES_NODE );
+        if ( nodeId < 0 )
+            return false;
+
+        node = getNode( img, nodeId );
+        node -> isOwned = 1;
+        node -> isLeaf = 1;
+        node -> numKeys = 1;
+        node -> refCount = 1;
+        node -> keys[0] = key;
+        header -> roots[ index ] = nodeId;
+        return true;
+    }
+
+    nodeId = ownNode( img, &header -> roots[ index ] );
+    if ( nodeId < 0 )
+        return false;
+
+    if ( getNode( img, nodeId ) -> numKeys == UFS_NODE_MAX_KEYS ) {
+        newRoot = allocRecord( img, UFS_TYPES_NODE );
+        if ( newRoot < 0 )
+            return false;
+
+        node = getNode( img, newRoot );
+        node -> isOwned = 1;
+        node -> isLeaf = 0;
+        node -> numKeys = 0;
+        node -> refCount = 1;
+        node -> children[0] = nodeId;
+
+        if ( !treeSplitChild( img, newRoot, 0 ) ) {
+            freeRecord( img, UFS_TYPES_NODE, newRoot );
+            return false;
+        }
+
+        header -> roots[ index ] = nodeId = newRoot;
+    }
+
+    /* Every node we descend into has room, full children are split first.  */
+    while ( true ) {
+        node = getNode( img, nodeId );
+
+        for ( i = 0; i < node -> numKeys &&
+                     compareKeys( &node -> keys[i], &key ) < 0; i++ )
+            ;
+
+        if ( node -> isLeaf ) {
+            memmove( &node -> keys[ i + 1 ], &node -> keys[i],
+                     sizeof( struct ufsKeyStruct ) * ( node -> numKeys - i ) );
+            node -> keys[i] = key;
+            node -> numKeys++;
+            return true;
+        }
+
+        if ( getNode( img, node -> children[i] ) -> numKeys ==
+             UFS_NODE_MAX_KEYS ) {
+            if ( !treeSplitChild( img, nodeId, i ) )
+                return false;
+            if ( compareKeys( &key, &node -> keys[i] ) > 0 )
+                i++;
+        }
+
+        nodeId = ownNode( img, &node -> children[i] );
+        if ( nodeId < 0 )
+            return false;
+    }
+}
+
+/* parent must be owned, the full child i is split around its middle key.   */
+static bool treeSplitChild( ufsImagePtr img, ufsIdType parent, int i )
+{
+    struct ufsNodeStruct *x, *y, *z;
+    ufsIdType yId, zId;
+
+    x = getNode( img, parent );
+
+    yId = ownNode( img, &x -> children[i] );
+    if ( yId < 0 )
+        return false;
+
+    zId = allocRecord( img, UFS_TYPES_NODE );
+    if ( zId < 0 )
+        return false;
+
+    y = getNode( img, yId );
+    z = getNode( img, zId );
+
+    z -> isOwned = 1;
+    z -> isLeaf = y -> isLeaf;
+    z -> numKeys = T - 1;
+    z -> refCount = 1;
+    memcpy( z -> keys, &y -> keys[T], sizeof( struct ufsKeyStruct ) * ( T - 1 ) );
+    if ( !y -> isLeaf )
+        memcpy( z -> children, &y -> children[T], sizeof( ufsIdType ) * T );
+
+    y -> numKeys = T - 1;
+
+    memmove( &x -> children[ i + 2 ], &x -> children[ i + 1 ],
+             sizeof( ufsIdType ) * ( x -> numKeys - i ) );
+    memmove( &x -> keys[ i + 1 ], &x -> keys[i],
+             sizeof( struct ufsKeyStruct ) * ( x -> numKeys - i ) );
+
+    x -> children[ i + 1 ] = zId;
+    x -> keys[i] = y -> keys[ T - 1 ];
+    x -> numKeys++;
+
+    return true;
+}
+
+/* Callers reserve nodes first, see reserveNodes. Should a copy fail anyway  */
+/* the tree is left valid, without the key removed.                          */
+static void treeDelete( ufsImagePtr img, enum ufsIndexEnum index,
+                        struct ufsKeyStruct key )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    struct ufsNodeStruct *root;
+    ufsIdType rootId;
+
+    if ( header -> roots[ index ] <= 0 )
+        return;
+
+    if ( !treeDeleteFrom( img, &header -> roots[ index ], key ) )
+        return;
+
+    /* treeDeleteFrom owned the root, so it is ours to free.                 */
+    rootId = header -> roots[ index ];
+    root = getNode( img, rootId );
+    if ( root -> numKeys == 0 ) {
+        header -> roots[ index ] = root -> isLeaf ? 0 : root -> children[0];
+        freeRecord( img, UFS_TYPES_NODE, rootId );
+    }
+}
+
+/* Every node we descend into has at least T keys, except for the root.      */
+/* slot is the reference to the node, the node is owned before it changes.   */
+static bool treeDeleteFrom( ufsImagePtr img, ufsIdType *slot,
+                            struct ufsKeyStruct key )
+{
+    struct ufsNodeStruct *x, *y, *z, *c, *sibling;
+    ufsIdType nodeId, walk;
+    int i;
+
+    nodeId = ownNode( img, slot );
+    if ( nodeId < 0 )
+        return false;
+
+    x = getNode( img, nodeId );
+
+    for ( i = 0; i < x -> numKeys &&
+                 compareKeys( &x -> keys[i], &key ) < 0; i++ )
+        ;
+
+    if ( i < x -> numKeys && compareKeys( &x -> keys[i], &key ) == 0 ) {
+        if ( x -> isLeaf ) {
+            memmove( &x -> keys[i], &x -> keys[ i + 1 ],
+                     sizeof( struct ufsKeyStruct ) * ( x -> numKeys - i - 1 ) );
+            x -> numKeys--;
+            return true;
+        }
+
+        y = getNode( img, x -> children[i] );
+        z = getNode( img, x -> children[ i + 1 ] );
+
+        if ( y -> numKeys >= T ) {
+            for ( walk = x -> children[i]; !getNode( img, walk ) -> isLeaf; )
+                walk = getNode( img, walk ) ->
+                    children[ getNode( img, walk ) -> numKeys ];
+            x -> keys[i] = getNode( img, walk ) ->
+                keys[ getNode( img, walk ) -> numKeys - 1 ];
+            return treeDeleteFrom( img, &x -> children[i], x -> keys[i] );
+        } else if ( z -> numKeys >= T ) {
+            for ( walk = x -> children[ i + 1 ];
+                  !getNode( img, walk ) -> isLeaf; )
+                walk = getNode( img, walk ) -> children[0];
+            x -> keys[i] = getNode( img, walk ) -> keys[0];
+            return treeDeleteFrom( img, &x -> children[ i + 1 ],
+                                   x -> keys[i] );
+        }
+
+        if ( !treeMerge( img, nodeId, i ) )
+            return false;
+        return treeDeleteFrom( img, &x -> children[i], key );
+    }
+
+    if ( x -> isLeaf )
+        return true;
+
+    if ( getNode( img, x -> children[i] ) -> numKeys == T - 1 ) {
+        if ( i > 0 &&
+             getNode( img, x -> children[ i - 1 ] ) -> numKeys >= T ) {
+            if ( ownNode( img, &x -> children[i] ) < 0 ||
+                 ownNode( img, &x -> children[ i - 1 ] ) < 0 )
+                return false;
+            c = getNode( img, x -> children[i] );
+            sibling = getNode( img, x -> children[ i - 1 ] );
+
+            /* Rotate a key from the left sibling through the parent.        */
+            memmove( &c -> keys[1], &c -> keys[0],
+                     sizeof( struct ufsKeyStruct ) * c -> numKeys );
+            if ( !c -> isLeaf )
+                memmove( &c -> children[1], &c -> children[0],
+                         sizeof( ufsIdType ) * ( c -> numKeys + 1 ) );
+            c -> keys[0] = x -> keys[ i - 1 ];
+            if ( !c -> isLeaf )
+                c -> children[0] = sibling -> children[ sibling -> numKeys ];
+            x -> keys[ i - 1 ] = sibling -> keys[ sibling -> numKeys - 1 ];
+            sibling -> numKeys--;
+            c -> numKeys++;
+        } else if ( i < x -> numKeys &&
+                    getNode( img, x -> children[ i + 1 ] ) -> numKeys >= T ) {
+            if ( ownNode( img, &x -> children[i] ) < 0 ||
+                 ownNode( img, &x -> children[ i + 1 ] ) < 0 )
+                return false;
+            c = getNode( img, x -> children[i] );
+            sibling = getNode( img, x -> children[ i + 1 ] );
+
+            /* Rotate a key from the right sibling through the parent.       */
+            c -> keys[ c -> numKeys ] = x -> keys[i];
+            if ( !c -> isLeaf )
+                c -> children[ c -> numKeys + 1 ] = sibling -> children[0];
+            c -> numKeys++;
+            x -> keys[i] = sibling -> keys[0];
+            memmove( &sibling -> keys[0], &sibling -> keys[1],
+                     sizeof( struct ufsKeyStruct ) * ( sibling -> numKeys - 1 ) );
+            if ( !sibling -> isLeaf )
+                memmove( &sibling -> children[0], &sibling -> children[1],
+                         sizeof( ufsIdType ) * sibling -> numKeys );
+            sibling -> numKeys--;
+        } else if ( i < x -> numKeys ) {
+            if ( !treeMerge( img, nodeId, i ) )
+                return false;
+        } else {
+            if ( !treeMerge( img, nodeId, --i ) )
+                return false;
+        }
+    }
+
+    return treeDeleteFrom( img, &x -> children[i], key );
+}
+
+/* Merges children i + 1 and the key i of parent into child i.               */
+/* parent must be owned, child i + 1 may still be shared with a snapshot.    */
+static bool treeMerge( ufsImagePtr img, ufsIdType parent, int i )
+{
+    struct ufsNodeStruct *x, *y, *z;
+    ufsIdType yId, zId;
+    int j;
+
+    x = getNode( img, parent );
+
+    yId = ownNode( img, &x -> children[i] );
+    if ( yId < 0 )
+        return false;
+
+    y = getNode( img, yId );
+    zId = x -> children[ i + 1 ];
+    z = getNode( img, zId );
+
+    y -> keys[ y -> numKeys ] = x -> keys[i];
+    memcpy( &y -> keys[ y -> numKeys + 1 ], z -> keys,
+            sizeof( struct ufsKeyStruct ) * z -> numKeys );
+    if ( !y -> isLeaf )
+        memcpy( &y -> children[ y -> numKeys + 1 ], z -> children,
+                sizeof( ufsIdType ) * ( z -> numKeys + 1 ) );
+    y -> numKeys += z -> numKeys + 1;
+
+    memmove( &x -> keys[i], &x -> keys[ i + 1 ],
+             sizeof( struct ufsKeyStruct ) * ( x -> numKeys - i - 1 ) );
+    memmove( &x -> children[ i + 1 ], &x -> children[ i + 2 ],
+             sizeof( ufsIdType ) * ( x -> numKeys - i - 1 ) );
+    x -> numKeys--;
+
+    /* A shared z lives on in the snapshots, y now refers to its children    */
+    /* too. Otherwise the references of z simply move over to y.             */
+    if ( z -> refCount > 1 ) {
+        z -> refCount--;
+        for ( j = 0; !z -> isLeaf && j <= z -> numKeys; j++ )
+            getNode( img, z -> children[j] ) -> refCount++;
+    } else {
+        freeRecord( img, UFS_TYPES_NODE, zId );
+    }
+
+    return true;
+}
+
+/* Makes the node in slot private to its single referrer, copying it if a    */
+/* snapshot shares it. The referrer of slot must be owned already.           */
+static ufsIdType ownNode( ufsImagePtr img, ufsIdType *slot )
+{
+    struct ufsNodeStruct *node, *copy;
+    ufsIdType copyId;
+    int j;
+
+    node = getNode( img, *slot );
+    if ( node -> refCount <= 1 )
+        return *slot;
+
+    copyId = allocRecord( img, UFS_TYPES_NODE );
+    if ( copyId < 0 )
+        return -1;
+
+    copy = getNode( img, copyId );
+    memcpy( copy, node, sizeof( *copy ) );
+    copy -> refCount = 1;
+    for ( j = 0; !copy -> isLeaf && j <= copy -> numKeys; j++ )
+        getNode( img, copy -> children[j] ) -> refCount++;
+
+    node -> refCount--;
+    *slot = copyId;
+    return copyId;
+}
+
+static void dropNode( ufsImagePtr img, ufsIdType nodeId )
+{
+    struct ufsNodeStruct *node;
+    int j;
+
+    if ( nodeId <= 0 )
+        return;
+
+    node = getNode( img, nodeId );
+    if ( --node -> refCount > 0 )
+        return;
+
+    for ( j = 0; !node -> isLeaf && j <= node -> numKeys; j++ )
+        dropNode( img, node -> children[j] );
+
+    freeRecord( img, UFS_TYPES_NODE, nodeId );
+}
+
+/* While snapshots exist deleting copies nodes. Making sure ops tree          */
+/* operations can't run out of nodes half way keeps the indices in step.      */
+/* An operation copies at most two nodes per level and may add a level.      */
+static bool reserveNodes( ufsImagePtr img, uint64_t ops )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    struct ufsNodeStruct *node;
+    uint64_t height, levels;
+    ufsIdType nodeId;
+    int i;
+
+    if ( !header -> numSnapshots )
+        return true;
+
+    for ( height = 0, i = 0; i < UFS_INDEX_COUNT; i++ ) {
+        for ( levels = 0, nodeId = header -> roots[i]; nodeId > 0; levels++ ) {
+            node = getNode( img, nodeId );
+            nodeId = node -> isLeaf ? 0 : node -> children[0];
+        }
+        if ( levels > height )
+            height = levels;
+    }
+
+    if ( ufsLayoutCapacity( img, UFS_TYPES_NODE ) -
+         header -> used[ UFS_TYPES_NODE ] + header -> numFree[ UFS_TYPES_NODE ]
+         < ops * 2 * ( height + 2 ) ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return false;
+    }
+
+    return true;
+}
+
+static uint64_t treeHeight( ufsImagePtr img, ufsIdType nodeId )
+{
+    uint64_t ret;
+
+    for ( ret = 0; nodeId > 0; ret++ )
+        nodeId = getNode( img, nodeId ) -> isLeaf ? 0 :
+                 getNode( img, nodeId ) -> children[0];
+
+    return ret;
+}
+
+static void cursorInit( struct cursorStruct *cursor, ufsImagePtr img,
+                        ufsIdType root )
+{
+    cursor -> img = img;
+    cursor -> pending = root;
+    cursor -> height = treeHeight( img, root );
+    cursor -> depth = 0;
+}
+
+/* The items of a leaf are its keys, those of an inner node alternate        */
+/* between subtrees and keys: child 0, key 0, child 1 and so on.             */
+static enum cursorItemEnum cursorPeek( struct cursorStruct *cursor,
+                                       ufsIdType *tree, uint64_t *height,
+                                       struct ufsKeyStruct *key )
+{
+    struct cursorFrameStruct *frame;
+    struct ufsNodeStruct *node;
+    int numItems;
+
+    if ( cursor -> pending > 0 ) {
+        *tree = cursor -> pending;
+        *height = cursor -> height;
+        return CURSOR_TREE;
+    }
+
+    while ( cursor -> depth > 0 ) {
+        frame = &cursor -> stack[ cursor -> depth - 1 ];
+        node = getNode( cursor -> img, frame -> node );
+        numItems = node -> isLeaf ? node -> numKeys : 2 * node -> numKeys + 1;
+
+        if ( frame -> pos >= numItems ) {
+            if ( --cursor -> depth > 0 )
+                cursor -> stack[ cursor -> depth - 1 ].pos++;
+            continue;
+        }
+
+        if ( node -> isLeaf ) {
+            *key = node -> keys[ frame -> pos ];
+            return CURSOR_KEY;
+        }
+
+        if ( frame -> pos % 2 ) {
+            *key = node -> keys[ frame -> pos / 2 ];
+            return CURSOR_KEY;
+        }
+
+        *tree = node -> children[ frame -> pos / 2 ];
+        *height = cursor -> height - cursor -> depth;
+        return CURSOR_TREE;
+    }
+
+    return CURSOR_END;
+}
+
+static void cursorSkip( struct cursorStruct *cursor )
+{
+    if ( cursor -> pending > 0 )
+        cursor -> pending = 0;
+    else
+        cursor -> stack[ cursor -> depth - 1 ].pos++;
+}
+
+/* Steps into the subtree cursorPeek returned. Trees of a sound image are    */
+/* never deeper than the stack.                                              */
+static bool cursorEnter( struct cursorStruct *cursor, ufsIdType tree )
+{
+    if ( cursor -> depth >= DIFF_MAX_DEPTH ) {
+        ufsErrno = UFS_IMAGE_IS_CORRUPTED;
+        return false;
+    }
+
+    cursor -> pending = 0;
+    cursor -> stack[ cursor -> depth ].node = tree;
+    cursor -> stack[ cursor -> depth ].pos = 0;
+    cursor -> depth++;
+    return true;
+}
+
+/* A merge of the keys of both trees. Nodes of a snapshot never change, so  */
+/* when both cursors reach the same subtree it holds the same keys and is    */
+/* skipped as a whole.                                                        */
+static bool diffIndex( struct diffStruct *diff, ufsIdType fromRoot,
+                       ufsIdType toRoot )
+{
+    struct cursorStruct a, b;
+    struct ufsKeyStruct keyA, keyB;
+    enum cursorItemEnum itemA, itemB;
+    ufsIdType treeA, treeB;
+    uint64_t heightA, heightB;
+    int cmp;
+
+    cursorInit( &a, diff -> img, fromRoot );
+    cursorInit( &b, diff -> img, toRoot );
+
+    while ( true ) {
+        itemA = cursorPeek( &a, &treeA, &heightA, &keyA );
+        itemB = cursorPeek( &b, &treeB, &heightB, &keyB );
+
+        if ( itemA == CURSOR_END && itemB == CURSOR_END )
+            return true;
+
+        if ( itemA == CURSOR_TREE && itemB == CURSOR_TREE ) {
+            if ( treeA == treeB ) {
+                cursorSkip( &a );
+                cursorSkip( &b );
+                continue;
+            }
+
+            /* Descend the taller one first so the two can line up again.    */
+            if ( heightA >= heightB && !cursorEnter( &a, treeA ) )
+                return false;
+            if ( heightB >= heightA && !cursorEnter( &b, treeB ) )
+                return false;
+            continue;
+        }
+
+        if ( itemA == CURSOR_TREE ) {
+            if ( !cursorEnter( &a, treeA ) )
+                return false;
+            continue;
+        }
+
+        if ( itemB == CURSOR_TREE ) {
+            if ( !cursorEnter( &b, treeB ) )
+                return false;
+            continue;
+        }
+
+        cmp = itemA == CURSOR_END ? 1 :
+              itemB == CURSOR_END ? -1 : compareKeys( &keyA, &keyB );
+
+        if ( cmp < 0 ) {
+            if ( !emitChange( diff, &keyA, false ) )
+                return false;
+            cursorSkip( &a );
+        } else if ( cmp > 0 ) {
+            if ( !emitChange( diff, &keyB, true ) )
+                return false;
+            cursorSkip( &b );
+        } else {
+            cursorSkip( &a );
+            cursorSkip( &b );
+        }
+    }
+}
+
+static bool emitChange( struct diffStruct *diff,
+                        const struct ufsKeyStruct *key, bool added )
+{
+    struct ufsStoreChangeStruct change;
+    struct ufsFileStruct *file;
+
+    memset( &change, 0, sizeof( change ) );
+
+    switch ( diff -> index ) {
+        case UFS_INDEX_NAME:
+            change.type = added ? UFS_STORE_ADD_STORAGE :
+                                  UFS_STORE_REMOVE_STORAGE;
+            change.id = key -> key[2];
+            if ( added ) {
+                file = getFile( diff -> img, change.id );
+                change.isDirectory = file -> isDirectory;
+                change.other = file -> parent;
+                change.name = ufsLayoutStrings( diff -> img ) +
+                              file -> strOffset;
+            }
+            break;
+        case UFS_INDEX_AREA_NAME:
+            change.type = added ? UFS_STORE_ADD_AREA : UFS_STORE_REMOVE_AREA;
+            change.id = key -> key[2];
+            if ( added )
+                change.name = ufsLayoutStrings( diff -> img ) +
+                              getArea( diff -> img, change.id ) -> strOffset;
+            break;
+        default:
+            change.type = added ? UFS_STORE_ADD_MAPPING :
+                                  UFS_STORE_REMOVE_MAPPING;
+            change.id = key -> key[0];
+            change.other = key -> key[1];
+            break;
+    }
+
+    return diff -> iter( &change, diff -> userData );
+}
+
+/* Checks a change against the state before any of them is applied.         */
+static bool checkChange( ufsImagePtr img,
+                         const struct ufsStoreChangeStruct *change )
+{
+    enum ufsTyepesEnum type;
+
+    switch ( change -> type ) {
+        case UFS_STORE_REMOVE_MAPPING:
+            return treeFind( img, UFS_INDEX_MAPPING,
+                             makeKey( change -> id, change -> other, 0 ) );
+        case UFS_STORE_REMOVE_STORAGE:
+            return ufsStoreHasStorage( img, change -> id );
+        case UFS_STORE_REMOVE_AREA:
+            return ufsStoreHasArea( img, change -> id );
+        case UFS_STORE_ADD_MAPPING:
+            return change -> id > 0 && change -> other > 0 &&
+                   !treeFind( img, UFS_INDEX_MAPPING,
+                              makeKey( change -> id, change -> other, 0 ) );
+        case UFS_STORE_ADD_STORAGE:
+        case UFS_STORE_ADD_AREA:
+            type = change -> type == UFS_STORE_ADD_STORAGE ? UFS_TYPES_FILE :
+                                                             UFS_TYPES_AREA;
+            if ( change -> id <= 0 || change -> other < 0 ||
+                 change -> id > ufsLayoutCapacity( img, type ) ||
+                 !change -> name || !*change -> name )
+                return false;
+
+            return type == UFS_TYPES_FILE ?
+                   !getFile( img, change -> id ) -> isOwned :
+                   !getArea( img, change -> id ) -> isOwned;
+        default:
+            return false;
+    }
+}
+
+static bool applyChange( ufsImagePtr img,
+                         const struct ufsStoreChangeStruct *change )
+{
+    struct ufsFileStruct *file;
+    struct ufsAreaStruct *area;
+
+    switch ( change -> type ) {
+        case UFS_STORE_REMOVE_MAPPING:
+            if ( !reserveNodes( img, 2 ) )
+                return false;
+            treeDelete( img, UFS_INDEX_MAPPING,
+                        makeKey( change -> id, change -> other, 0 ) );
+            treeDelete( img, UFS_INDEX_AREA_MAPPING,
+                        makeKey( change -> other, change -> id, 0 ) );
+            dropData( img, change -> other, change -> id );
+            return true;
+        case UFS_STORE_REMOVE_STORAGE:
+            if ( !reserveNodes( img, 1 ) )
+                return false;
+            file = getFile( img, change -> id );
+            treeDelete( img, UFS_INDEX_NAME,
+                        makeKey( file -> parent,
+                                 ufsHashString( ufsLayoutStrings( img ) +
+                                                file -> strOffset,
+                                                file -> parent ),
+                                 change -> id ) );
+            releaseRecord( img, UFS_TYPES_FILE, change -> id );
+            return true;
+        case UFS_STORE_REMOVE_AREA:
+            if ( !reserveNodes( img, 1 ) )
+                return false;
+            area = getArea( img, change -> id );
+            treeDelete( img, UFS_INDEX_AREA_NAME,
+                        makeKey( 0, ufsHashString( ufsLayoutStrings( img ) +
+                                                   area -> strOffset, 0 ),
+                                 change -> id ) );
+            releaseRecord( img, UFS_TYPES_AREA, change -> id );
+            return true;
+        case UFS_STORE_ADD_AREA:
+            return placeRecord( img, UFS_TYPES_AREA, change );
+        case UFS_STORE_ADD_STORAGE:
+            return placeRecord( img, UFS_TYPES_FILE, change );
+        default:
+            return treeInsert( img, UFS_INDEX_MAPPING,
+                               makeKey( change -> id, change -> other, 0 ) ) &&
+                   treeInsert( img, UFS_INDEX_AREA_MAPPING,
+                               makeKey( change -> other, change -> id, 0 ) );
+    }
+}
+
+/* Writes a record at the identifier the change names.                       */
+static bool placeRecord( ufsImagePtr img, enum ufsTyepesEnum type,
+                         const struct ufsStoreChangeStruct *change )
+{
+    struct ufsHeaderStruct
+        *header = ufsLayoutHeader( img );
+    struct ufsFileStruct *file;
+    struct ufsAreaStruct *area;
+    uint64_t strOffset;
+    ufsIdType parent;
+
+    parent = type == UFS_TYPES_FILE ? change -> other : 0;
+
+    /* The same identifier twice in one batch.                               */
+    if ( type == UFS_TYPES_FILE ? getFile( img, change -> id ) -> isOwned :
+                                  getArea( img, change -> id ) -> isOwned ) {
+        ufsErrno = UFS_STREAM_DOES_NOT_APPLY;
+        return false;
+    }
+
+    strOffset = allocString( img, change -> name );
+    if ( strOffset == UINT64_MAX )
+        return false;
+
+    if ( type == UFS_TYPES_FILE ) {
+        file = getFile( img, change -> id );
+        file -> isOwned = 1;
+        file -> generation++;
+        file -> isDirectory = change -> isDirectory;
+        file -> parent = parent;
+        file -> strOffset = strOffset;
+        clearBaseRecord( img, change -> id );
+    } else {
+        area = getArea( img, change -> id );
+        area -> isOwned = 1;
+        area -> generation++;
+        area -> strOffset = strOffset;
+    }
+
+    if ( header -> used[ type ] < change -> id )
+        header -> used[ type ] = change -> id;
+
+    return treeInsert( img, type == UFS_TYPES_FILE ? UFS_INDEX_NAME :
+                                                     UFS_INDEX_AREA_NAME,
+                       makeKey( parent,
+                                ufsHashString( change -> name, parent ),
+                                change -> id ) );
+}
+
+static ufsIdType findByName( ufsImagePtr img, enum ufsTyepesEnum type,
+                             ufsIdType parent, const char *name )
+{
+    struct nameSearchStruct search = {
+        .img = img,
+        .type = type,
+        .name = name,
+        .found = 0
+    };
+    struct ufsKeyStruct from;
+    enum ufsIndexEnum index;
+
+    index = type == UFS_TYPES_FILE ? UFS_INDEX_NAME : UFS_INDEX_AREA_NAME;
+    from = makeKey( parent, ufsHashString( name, parent ), INT64_MIN );
+
+    /* Names sharing a hash are told apart by comparing the strings.         */
+    treeScan( img, ufsLayoutHeader( img ) -> roots[ index ], &from, 2,
+              nameMatches, &search );
+
+    return search.found;
+}
+
+static bool nameMatches( const struct ufsKeyStruct *key, void *userData )
+{
+    struct nameSearchStruct
+        *search = userData;
+    uint64_t strOffset;
+
+    strOffset = search -> type == UFS_TYPES_FILE ?
+                getFile( search -> img, key -> key[2] ) -> strOffset :
+                getArea( search -> img, key -> key[2] ) -> strOffset;
+
+    if ( strcmp( ufsLayoutStrings( search -> img ) + strOffset,
+                 search -> name ) == 0 ) {
+        search -> found = key -> key[2];
+        return false;
+    }
+
+    return true;
+}
+
+static bool adaptIdIter( const struct ufsKeyStruct *key, void *userData )
+{
+    struct idIterAdapterStruct
+        *adapter = userData;
+
+    return adapter -> iter( key -> key[ adapter -> column ],
+                            adapter -> userData );
+}
+
+static bool iterateIndex( ufsImagePtr img, enum ufsIndexEnum index,
+                          ufsIdType prefix, int column,
+                          ufsStoreIter iter, void *userData )
+{
+    struct idIterAdapterStruct adapter = {
+        .iter = iter,
+        .userData = userData,
+        .column = column
+    };
+    struct ufsKeyStruct
+        from = makeKey( prefix, INT64_MIN, INT64_MIN );
+
+    treeScan( img, ufsLayoutHeader( img ) -> roots[ index ], &from, 1,
+              adaptIdIter, &adapter );
+
+    ufsErrno = UFS_NO_ERROR;
+    return true;
+}
@@ -0,0 +1,735 @@
+/******************************************************************************\
+*  ufs_store.h                                                                 *
+*                                                                              *
+*  Internal header for the ufs record store.                                   *
+*  The store keeps storage, areas and mappings inside a single ufs image.      *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* The store works on a single validated image, it knows nothing about views */
+/* or BASE, those are the business of ufs.c.                                  */
+/* Storage ( files and directories ) share one identifier space, areas have  */
+/* their own. Identifiers are strictly greater than 0.                        */
+/* A storage is named relative to its parent, a parent of 0 is the top level  */
+/* namespace, which is where ufs.c puts directories.                          */
+/* The store does not check references across records, e.g. a mapping's      */
+/* storage or a file's parent may live in another image. ufs.c checks them.  */
+/* All read functions work on sealed images as well, see ufs_seal.h.          */
+/* All functions that mutate fail with UFS_IMAGE_IS_SEALED on sealed images,  */
+/* with UFS_IMAGE_IS_SNAPSHOT on images opened by ufsStoreOpenSnapshot and    */
+/* those that change records with UFS_IMAGE_IS_REPLICA on replicas.           */
+/* The name of a record goes back to the string section when the record is    */
+/* freed, see UFS_STRING_GRANULE. Names are reused by size and free chunks    */
+/* next to each other are merged once nothing else fits.                      */
+/*                                                                            */
+/* The indices are copy on write B-trees. ufsStoreSnapshot records the roots */
+/* of every index and takes a reference on them, which is O(1). A writer     */
+/* copies a node the first time it changes it while a snapshot shares it, so */
+/* the live roots move on and a snapshot keeps seeing the state it recorded. */
+/* Removed files and areas are pinned rather than freed while a snapshot     */
+/* still names them, the other records never change once written.             */
+/* ufsStoreOpenSnapshot maps the image privately with the snapshot's roots   */
+/* in place of the live ones. Such an image is read only, it takes no locks  */
+/* and writers of the live image never wait for it.                           */
+/*                                                                            */
+/* ufsStoreDiff walks two snapshots side by side and skips every subtree     */
+/* they share, so its cost follows the change rather than the image.         */
+/* ufsStoreApply places the changes by identifier into a replica, records    */
+/* of a replica only ever change that way.                                    */
+/* A replica's snapshots carry the generation of its source, so once         */
+/* ufsStorePromote turns it into a source of its own under the old source's  */
+/* identity, replicas that followed the old source can follow it instead.     */
+
+#ifndef UFS_STORE_H
+#define UFS_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+
+/* Return false to stop the iteration.                                       */
+typedef bool (*ufsStoreIter)( ufsIdType id, void *userData );
+
+enum ufsStoreChangeEnum {
+    UFS_STORE_REMOVE_MAPPING = 0,
+    UFS_STORE_REMOVE_STORAGE,
+    UFS_STORE_REMOVE_AREA,
+    UFS_STORE_ADD_AREA,
+    UFS_STORE_ADD_STORAGE,
+    UFS_STORE_ADD_MAPPING,
+    UFS_STORE_CHANGE_COUNT,
+};
+
+/* A change between two states of a store, ufsStoreApply applies them in    */
+/* the order of ufsStoreChangeEnum.                                           */
+struct ufsStoreChangeStruct {
+    uint8_t type;
+    uint8_t isDirectory;    /* Added storage.                                 */
+    ufsIdType id;           /* The storage or the area, mappings: storage.    */
+    ufsIdType other;        /* Added storage: parent, mappings: area.         */
+    const char *name;       /* Added storage and areas, NULL otherwise.       */
+};
+
+/* Return false to stop the iteration.                                       */
+typedef bool (*ufsStoreChangeIter)( const struct ufsStoreChangeStruct *change,
+                                    void *userData );
+
+/* An apply that spans several calls, see ufsStoreApplyBegin. The caller     */
+/* holds it, the store only reads and writes it.                              */
+struct ufsStoreApplyStruct {
+    int slot;               /* The snapshot of the state to roll back to.     */
+    uint64_t flags;         /* The header flags before.                       */
+    uint64_t used[ UFS_TYPES_COUNT ];
+};
+
+/******************************************************************************\
+* ufsStoreAddStorage                                                           *
+*                                                                              *
+*  Adds a file or a directory named name under parent.                         *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or name are NULL, name is empty or parent is negative.   *
+*   UFS_FILE_ALREADY_EXISTS: parent already contains name.                     *
+*   UFS_OUT_OF_MEMORY: The image has no room for the storage.                  *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -parent: The containing directory, 0 for the top level namespace.           *
+*  -name: The name of the storage.                                             *
+*  -isDirectory: Whether the storage is a directory.                           *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsIdType: The identifier of the new storage, -1 on error.                 *
+*                                                                              *
+\******************************************************************************/
+ufsIdType ufsStoreAddStorage( ufsImagePtr img,
+                              ufsIdType parent,
+                              const char *name,
+                              bool isDirectory );
+
+/******************************************************************************\
+* ufsStoreGetStorage                                                           *
+*                                                                              *
+*  Finds the storage named name under parent.                                  *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or name are NULL or parent is negative.                  *
+*   UFS_FILE_DOES_NOT_EXIST: parent does not contain name.                     *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -parent: The containing directory, 0 for the top level namespace.           *
+*  -name: The name of the storage.                                             *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsIdType: The identifier of the storage, -1 on error.                     *
+*                                                                              *
+\******************************************************************************/
+ufsIdType ufsStoreGetStorage( ufsImagePtr img,
+                              ufsIdType parent,
+                              const char *name );
+
+/******************************************************************************\
+* ufsStoreHasStorage                                                           *
+*                                                                              *
+*  Checks whether storage exists in img.                                       *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -storage: The storage's identifier.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the storage exists, false otherwise.                         *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreHasStorage( ufsImagePtr img, ufsIdType storage );
+
+/******************************************************************************\
+* ufsStoreIsDirectory                                                          *
+*                                                                              *
+*  Checks whether storage is a directory.                                      *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL.                                                 *
+*   UFS_FILE_DOES_NOT_EXIST: storage does not exist.                           *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -storage: The storage's identifier.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if storage is an existing directory, false otherwise.          *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreIsDirectory( ufsImagePtr img, ufsIdType storage );
+
+/******************************************************************************\
+* ufsStoreGetParent                                                            *
+*                                                                              *
+*  Gets the directory containing storage.                                      *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL.                                                 *
+*   UFS_FILE_DOES_NOT_EXIST: storage does not exist.                           *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -storage: The storage's identifier.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsIdType: The parent of storage, 0 for top level storage, -1 on error.    *
+*                                                                              *
+\******************************************************************************/
+ufsIdType ufsStoreGetParent( ufsImagePtr img, ufsIdType storage );
+
+/******************************************************************************\
+* ufsStoreRemoveStorage                                                        *
+*                                                                              *
+*  Removes storage along with all of its mappings.                             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL.                                                 *
+*   UFS_FILE_DOES_NOT_EXIST: storage does not exist.                           *
+*   UFS_DIRECTORY_IS_NOT_EMPTY: storage is a directory with children.          *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -storage: The storage's identifier.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreRemoveStorage( ufsImagePtr img, ufsIdType storage );
+
+/******************************************************************************\
+* ufsStoreAddArea                                                              *
+*                                                                              *
+*  Adds an area named name.                                                    *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or name are NULL or name is empty.                       *
+*   UFS_AREA_ALREADY_EXISTS: The area already exists.                          *
+*   UFS_OUT_OF_MEMORY: The image has no room for the area.                     *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -name: The name of the area.                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsIdType: The identifier of the new area, -1 on error.                    *
+*                                                                              *
+\******************************************************************************/
+ufsIdType ufsStoreAddArea( ufsImagePtr img, const char *name );
+
+/******************************************************************************\
+* ufsStoreGetArea                                                              *
+*                                                                              *
+*  Finds the area named name.                                                  *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or name are NULL.                                        *
+*   UFS_AREA_DOES_NOT_EXIST: There is no such area.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -name: The name of the area.                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsIdType: The identifier of the area, -1 on error.                        *
+*                                                                              *
+\******************************************************************************/
+ufsIdType ufsStoreGetArea( ufsImagePtr img, const char *name );
+
+/******************************************************************************\
+* ufsStoreHasArea                                                              *
+*                                                                              *
+*  Checks whether area exists in img.                                          *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -area: The area's identifier.                                               *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the area exists, false otherwise.                            *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreHasArea( ufsImagePtr img, ufsIdType area );
+
+/******************************************************************************\
+* ufsStoreRemoveArea                                                           *
+*                                                                              *
+*  Removes area along with all of its mappings.                                *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL.                                                 *
+*   UFS_AREA_DOES_NOT_EXIST: area does not exist.                              *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -area: The area's identifier.                                               *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreRemoveArea( ufsImagePtr img, ufsIdType area );
+
+/******************************************************************************\
+* ufsStoreAddMapping                                                           *
+*                                                                              *
+*  Adds the mapping ( area, storage ).                                         *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL or an identifier is not strictly positive.       *
+*   UFS_MAPPING_ALREADY_EXISTS: The mapping already exists.                    *
+*   UFS_OUT_OF_MEMORY: The image has no room for the mapping.                  *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -area: The area's identifier.                                               *
+*  -storage: The storage's identifier.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreAddMapping( ufsImagePtr img, ufsIdType area, ufsIdType storage );
+
+/******************************************************************************\
+* ufsStoreProbeMapping                                                         *
+*                                                                              *
+*  Checks whether the mapping ( area, storage ) exists.                        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL.                                                 *
+*   UFS_MAPPING_DOES_NOT_EXIST: The mapping does not exist.                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -area: The area's identifier.                                               *
+*  -storage: The storage's identifier.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if the mapping exists, false otherwise.                         *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreProbeMapping( ufsImagePtr img, ufsIdType area, ufsIdType storage );
+
+/******************************************************************************\
+* ufsStoreRemoveMapping                                                        *
+*                                                                              *
+*  Removes the mapping ( area, storage ).                                      *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL.                                                 *
+*   UFS_MAPPING_DOES_NOT_EXIST: The mapping does not exist.                    *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -area: The area's identifier.                                               *
+*  -storage: The storage's identifier.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreRemoveMapping( ufsImagePtr img, ufsIdType area, ufsIdType storage );
+
+/******************************************************************************\
+* ufsStoreIterateChildren                                                      *
+*                                                                              *
+*  Calls iter on every storage whose parent is directory.                      *
+*  The store must not be mutated from within iter.                             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or iter are NULL.                                        *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -directory: The directory, 0 for the top level namespace.                   *
+*  -iter: The iterator.                                                        *
+*  -userData: Passed to iter as is.                                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreIterateChildren( ufsImagePtr img,
+                              ufsIdType directory,
+                              ufsStoreIter iter,
+                              void *userData );
+
+/******************************************************************************\
+* ufsStoreIterateMappings                                                      *
+*                                                                              *
+*  Calls iter on every area that maps storage.                                 *
+*  The store must not be mutated from within iter.                             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or iter are NULL.                                        *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -storage: The storage's identifier.                                         *
+*  -iter: The iterator.                                                        *
+*  -userData: Passed to iter as is.                                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreIterateMappings( ufsImagePtr img,
+                              ufsIdType storage,
+                              ufsStoreIter iter,
+                              void *userData );
+
+/******************************************************************************\
+* ufsStoreIterateAreaMappings                                                  *
+*                                                                              *
+*  Calls iter on every storage that area maps.                                 *
+*  The store must not be mutated from within iter.                             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or iter are NULL.                                        *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -area: The area's identifier.                                               *
+*  -iter: The iterator.                                                        *
+*  -userData: Passed to iter as is.                                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreIterateAreaMappings( ufsImagePtr img,
+                                  ufsIdType area,
+                                  ufsStoreIter iter,
+                                  void *userData );
+
+/******************************************************************************\
+* ufsStoreGetName                                                              *
+*                                                                              *
+*  Gets the name of a storage or an area of a mutable image.                   *
+*  Sealed images keep their names front coded, see ufsSealGetName.             *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL, sealed or type is not FILE or AREA.             *
+*   UFS_FILE_DOES_NOT_EXIST: The storage does not exist.                       *
+*   UFS_AREA_DOES_NOT_EXIST: The area does not exist.                          *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated mutable ufs image.                                        *
+*  -type: UFS_TYPES_FILE or UFS_TYPES_AREA.                                    *
+*  -id: The identifier of the storage or area.                                 *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -const char*: The name inside the image, NULL on error.                     *
+*                                                                              *
+\******************************************************************************/
+const char *ufsStoreGetName( ufsImagePtr img,
+                             enum ufsTyepesEnum type,
+                             ufsIdType id );
+
+/******************************************************************************\
+* ufsStoreGetGeneration                                                        *
+*                                                                              *
+*  Gets the generation of a storage or an area of a mutable image. It changes  *
+*  every time the identifier is taken again, so data kept outside the image    *
+*  can tell whether it still belongs to the record.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated mutable ufs image.                                        *
+*  -type: UFS_TYPES_FILE or UFS_TYPES_AREA.                                    *
+*  -id: The identifier of the storage or area.                                 *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint32_t: The generation, 0 if img is NULL or sealed or there is no such   *
+*             record.                                                          *
+*                                                                              *
+\******************************************************************************/
+uint32_t ufsStoreGetGeneration( ufsImagePtr img,
+                                enum ufsTyepesEnum type,
+                                ufsIdType id );
+
+/******************************************************************************\
+* ufsStoreSnapshot                                                             *
+*                                                                              *
+*  Records the current state of every index as a snapshot, in O(1).            *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL.                                                 *
+*   UFS_OUT_OF_MEMORY: UFS_SNAPSHOTS_MAX snapshots already exist.              *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*   UFS_IMAGE_IS_SNAPSHOT: The image is a snapshot.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsIdType: The identifier of the snapshot, -1 on error.                    *
+*                                                                              *
+\******************************************************************************/
+ufsIdType ufsStoreSnapshot( ufsImagePtr img );
+
+/******************************************************************************\
+* ufsStoreDropSnapshot                                                         *
+*                                                                              *
+*  Drops a snapshot and frees the nodes only it referred to. Once the last     *
+*  snapshot is dropped the pinned records are freed as well.                   *
+*  Images opened on the snapshot must be freed first.                          *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL.                                                 *
+*   UFS_SNAPSHOT_DOES_NOT_EXIST: The snapshot does not exist.                  *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*   UFS_IMAGE_IS_SNAPSHOT: The image is a snapshot.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -snapshot: The snapshot to drop.                                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreDropSnapshot( ufsImagePtr img, ufsIdType snapshot );
+
+/******************************************************************************\
+* ufsStoreOpenSnapshot                                                         *
+*                                                                              *
+*  Opens a snapshot of the image at path for reading.                          *
+*  Every read function works on the returned image, it sees the indices as     *
+*  they were when the snapshot was taken. Free it with ufsImageFree.           *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: path is NULL or the image is sealed.                         *
+*   UFS_SNAPSHOT_DOES_NOT_EXIST: The snapshot does not exist.                  *
+*   Any error of ufsImageOpenPrivate and ufsHeaderValidate.                    *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -path: The path of the image file.                                          *
+*  -snapshot: The snapshot to open.                                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsImagePtr: The read only image of the snapshot, NULL on error.           *
+*                                                                              *
+\******************************************************************************/
+ufsImagePtr ufsStoreOpenSnapshot( const char *path, ufsIdType snapshot );
+
+/******************************************************************************\
+* ufsStoreDiff                                                                 *
+*                                                                              *
+*  Calls iter with every change that turns snapshot from into snapshot to.     *
+*  Subtrees both snapshots share are skipped without being read. iter          *
+*  returning false stops the walk, ufsStoreDiff then returns false and leaves  *
+*  ufsErrno as iter set it.                                                    *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or iter are NULL or img is sealed or a snapshot.         *
+*   UFS_SNAPSHOT_DOES_NOT_EXIST: One of the snapshots does not exist.          *
+*   UFS_IMAGE_IS_CORRUPTED: An index is deeper than any sound one.             *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*  -from: The older snapshot, 0 for an empty store.                            *
+*  -to: The newer snapshot.                                                    *
+*  -iter: Called with every change, in no particular order.                    *
+*  -userData: Passed to iter.                                                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreDiff( ufsImagePtr img, ufsIdType from, ufsIdType to,
+                   ufsStoreChangeIter iter, void *userData );
+
+/******************************************************************************\
+* ufsStoreApply                                                                *
+*                                                                              *
+*  Applies changes to a replica, all of them or none.                          *
+*  The image becomes a replica if it isn't one already.                        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL, changes is NULL while numChanges isn't 0, or    *
+*                 the image has records of its own.                            *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*   UFS_IMAGE_IS_SNAPSHOT: The image is a snapshot.                            *
+*   UFS_STREAM_DOES_NOT_APPLY: A change does not fit the current state, e.g.   *
+*                              it removes a missing storage or places a record *
+*                              over one a snapshot still refers to.            *
+*   UFS_OUT_OF_MEMORY: The image has no room for the changes.                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image, either a replica or one that never held        *
+*        storage or areas.                                                     *
+*  -changes: The changes, as produced by ufsStoreDiff.                         *
+*  -numChanges: The number of changes.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreApply( ufsImagePtr img,
+                    const struct ufsStoreChangeStruct *changes,
+                    uint64_t numChanges );
+
+/******************************************************************************\
+* ufsStoreApplyBegin                                                           *
+*                                                                              *
+*  Starts applying changes to a replica over several calls, e.g. as they come  *
+*  in from a stream. Until ufsStoreApplyEnd the changes can still be rolled    *
+*  back as a whole, the image holds a snapshot of its state before meanwhile.  *
+*  The image becomes a replica if it isn't one already.                        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or apply are NULL, or the image has records of its own.  *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*   UFS_IMAGE_IS_SNAPSHOT: The image is a snapshot.                            *
+*   UFS_OUT_OF_MEMORY: Every snapshot slot is taken.                           *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image, either a replica or one that never held        *
+*        storage or areas.                                                     *
+*  -apply: Filled with what ufsStoreApplyEnd needs.                            *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreApplyBegin( ufsImagePtr img, struct ufsStoreApplyStruct *apply );
+
+/******************************************************************************\
+* ufsStoreApplyChanges                                                         *
+*                                                                              *
+*  Applies the next changes of an apply started by ufsStoreApplyBegin, in the  *
+*  order of ufsStoreChangeEnum. Changes of a type must not come after changes  *
+*  of a later type in an earlier call.                                         *
+*  On error the image is left part way, ufsStoreApplyEnd rolls it back.        *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img or apply are NULL, or changes is NULL while numChanges   *
+*                 isn't 0.                                                     *
+*   UFS_STREAM_DOES_NOT_APPLY: A change does not fit the current state.        *
+*   UFS_OUT_OF_MEMORY: The image has no room for the changes.                  *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: The image passed to ufsStoreApplyBegin.                               *
+*  -apply: The apply ufsStoreApplyBegin filled.                                *
+*  -changes: The changes, as produced by ufsStoreDiff.                         *
+*  -numChanges: The number of changes.                                         *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStoreApplyChanges( ufsImagePtr img,
+                           struct ufsStoreApplyStruct *apply,
+                           const struct ufsStoreChangeStruct *changes,
+                           uint64_t numChanges );
+
+/******************************************************************************\
+* ufsStoreApplyEnd                                                             *
+*                                                                              *
+*  Ends an apply started by ufsStoreApplyBegin, keeping every change applied   *
+*  since or rolling all of them back. Must be called once for every            *
+*  successful ufsStoreApplyBegin. Leaves ufsErrno alone.                       *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: The image passed to ufsStoreApplyBegin.                               *
+*  -apply: The apply ufsStoreApplyBegin filled.                                *
+*  -keep: Whether to keep the changes.                                         *
+*                                                                              *
+\******************************************************************************/
+void ufsStoreApplyEnd( ufsImagePtr img, struct ufsStoreApplyStruct *apply,
+                       bool keep );
+
+
+/******************************************************************************\
+* ufsStorePromote                                                              *
+*                                                                              *
+*  Turns a replica into an image of its own, e.g. when its source is lost.     *
+*  The image takes over the identity of its source, so the snapshots it kept   *
+*  can serve the source's other replicas that are at the same generation.      *
+*  The old source must not be used as a source again.                          *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: img is NULL or not a replica.                                *
+*   UFS_IMAGE_IS_SEALED: The image is sealed.                                  *
+*   UFS_IMAGE_IS_SNAPSHOT: The image is a snapshot.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -img: a validated ufs image.                                                *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true on success, false otherwise.                                    *
+*                                                                              *
+\******************************************************************************/
+bool ufsStorePromote( ufsImagePtr img );
+
+#endif /* UFS_STORE_H */
@@ -0,0 +1,295 @@
+/******************************************************************************\
+*  ufs_uring.c                                                                 *
+*                                                                              *
+*  Contains the definitions for batches of metadata calls on io_uring.         *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "ufs_defs.h"
+#include "ufs_uring.h"
+#include <unistd.h>
+
+#define MAX_DEPTH (4096)
+/* Results are 0, a file descriptor or -errno, never this.                    */
+#define NOT_DONE (INT_MIN)
+
+struct ufsUringStruct {
+    pthread_mutex_t lock;
+    /* -1 for a synchronous ring.                                             */
+    int fd;
+    void *rings;
+    size_t ringBytes;
+    struct io_uring_sqe *sqes;
+    size_t sqeBytes;
+    uint32_t sqEntries;
+    /* Shared with the kernel, heads and tails are accessed atomically.       */
+    uint32_t *sqTail,
+             *sqMask,
+             *sqArray;
+    uint32_t *cqHead,
+             *cqTail,
+             *cqMask;
+    struct io_uring_cqe *cqes;
+};
+
+static bool setUp( struct ufsUringStruct *ring, uint32_t depth );
+static bool probeOps( int fd );
+static void tearDown( struct ufsUringStruct *ring );
+static void runSync( struct ufsUringOpStruct *op );
+static void prepare( struct io_uring_sqe *sqe,
+                     const struct ufsUringOpStruct *op, uint64_t index );
+static uint64_t reap( struct ufsUringStruct *ring,
+                      struct ufsUringOpStruct *ops );
+
+ufsUringPtr ufsUringCreate( uint32_t depth )
+{
+    struct ufsUringStruct *ring;
+
+    ring = calloc( 1, sizeof( *ring ) );
+    if ( !ring ) {
+        ufsErrno = UFS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    pthread_mutex_init( &ring -> lock, NULL );
+    ring -> fd = -1;
+    if ( depth && !setUp( ring, depth < MAX_DEPTH ? depth : MAX_DEPTH ) )
+        tearDown( ring );
+
+    ufsErrno = UFS_NO_ERROR;
+    return ring;
+}
+
+void ufsUringFree( ufsUringPtr ring )
+{
+    if ( !ring )
+        return;
+
+    tearDown( ring );
+    pthread_mutex_destroy( &ring -> lock );
+    free( ring );
+}
+
+bool ufsUringIsAsync( ufsUringPtr ring )
+{
+    bool async;
+
+    pthread_mutex_lock( &ring -> lock );
+    async = ring -> fd >= 0;
+    pthread_mutex_unlock( &ring -> lock );
+
+    return async;
+}
+
+uint64_t ufsUringRun( ufsUringPtr ring, struct ufsUringOpStruct *ops,
+                      uint64_t numOps )
+{
+    uint64_t next, queued, unsubmitted, completed, enters, i;
+    uint32_t tail, index;
+    long ret;
+
+    if ( !ring || ( !ops && numOps ) ) {
+        ufsErrno = UFS_BAD_CALL;
+        return 0;
+    }
+
+    pthread_mutex_lock( &ring -> lock );
+    for ( i = 0; i < numOps; i++ )
+        ops[i].result = NOT_DONE;
+
+    next = queued = unsubmitted = completed = enters = 0;
+    while ( ring -> fd >= 0 && completed < numOps ) {
+        /* No more than fit the submission queue are in flight, the           */
+        /* completion queue is twice as large and can't overflow.             */
+        tail = *ring -> sqTail;
+        while ( next < numOps && queued - completed < ring -> sqEntries ) {
+            index = tail & *ring -> sqMask;
+            prepare( &ring -> sqes[ index ], &ops[ next ], next );
+            ring -> sqArray[ index ] = index;
+            tail++;
+            next++;
+            queued++;
+            unsubmitted++;
+        }
+        __atomic_store_n( ring -> sqTail, tail, __ATOMIC_RELEASE );
+
+        ret = syscall( __NR_io_uring_enter, ring -> fd, unsubmitted,
+                       queued - completed, IORING_ENTER_GETEVENTS, NULL, 0 );
+        enters++;
+        if ( ret >= 0 )
+            unsubmitted -= ret;
+        completed += reap( ring, ops );
+
+        /* Whatever didn't complete runs synchronously below.                 */
+        if ( ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY )
+            tearDown( ring );
+    }
+
+    for ( i = 0; i < numOps; i++ ) {
+        if ( ops[i].result == NOT_DONE )
+            runSync( &ops[i] );
+    }
+    pthread_mutex_unlock( &ring -> lock );
+
+    ufsErrno = UFS_NO_ERROR;
+    return enters;
+}
+
+/* Needs IORING_FEAT_SINGLE_MMAP, which came with 5.4, before the ops the     */
+/* ring is for anyway.                                                        */
+static bool setUp( struct ufsUringStruct *ring, uint32_t depth )
+{
+    struct io_uring_params params;
+    size_t sqBytes, cqBytes;
+
+    memset( &params, 0, sizeof( params ) );
+    ring -> fd = syscall( __NR_io_uring_setup, depth, &params );
+    if ( ring -> fd < 0 || !( params.features & IORING_FEAT_SINGLE_MMAP ) ||
+         !probeOps( ring -> fd ) )
+        return false;
+
+    sqBytes = params.sq_off.array + params.sq_entries * sizeof( uint32_t );
+    cqBytes = params.cq_off.cqes +
+              params.cq_entries * sizeof( struct io_uring_cqe );
+    ring -> ringBytes = sqBytes > cqBytes ? sqBytes : cqBytes;
+    ring -> rings = mmap( NULL, ring -> ringBytes, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring -> fd,
+                          IORING_OFF_SQ_RING );
+    if ( ring -> rings == MAP_FAILED ) {
+        ring -> rings = NULL;
+        return false;
+    }
+
+    ring -> sqeBytes = params.sq_entries * sizeof( struct io_uring_sqe );
+    ring -> sqes = mmap( NULL, ring -> sqeBytes, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring -> fd,
+                         IORING_OFF_SQES );
+    if ( ring -> sqes == MAP_FAILED ) {
+        ring -> sqes = NULL;
+        return false;
+    }
+
+    ring -> sqEntries = params.sq_entries;
+    ring -> sqTail = (uint32_t*)( (char*) ring -> rings +
+                                  params.sq_off.tail );
+    ring -> sqMask = (uint32_t*)( (char*) ring -> rings +
+                                  params.sq_off.ring_mask );
+    ring -> sqArray = (uint32_t*)( (char*) ring -> rings +
+                                   params.sq_off.array );
+    ring -> cqHead = (uint32_t*)( (char*) ring -> rings +
+                                  params.cq_off.head );
+    ring -> cqTail = (uint32_t*)( (char*) ring -> rings +
+                                  params.cq_off.tail );
+    ring -> cqMask = (uint32_t*)( (char*) ring -> rings +
+                                  params.cq_off.ring_mask );
+    ring -> cqes = (struct io_uring_cqe*)( (char*) ring -> rings +
+                                           params.cq_off.cqes );
+    return true;
+}
+
+/* Kernels that can't probe can't do the ops either.                          */
+static bool probeOps( int fd )
+{
+    struct io_uring_probe *probe;
+    size_t bytes;
+    bool supported;
+
+    bytes = sizeof( *probe ) + IORING_OP_LAST * sizeof( probe -> ops[0] );
+    probe = calloc( 1, bytes );
+    if ( !probe )
+        return false;
+
+    supported = !syscall( __NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+                          probe, IORING_OP_LAST ) &&
+                probe -> ops_len > IORING_OP_STATX &&
+                probe -> ops_len > IORING_OP_OPENAT &&
+                ( probe -> ops[ IORING_OP_STATX ].flags &
+                  IO_URING_OP_SUPPORTED ) &&
+                ( probe -> ops[ IORING_OP_OPENAT ].flags &
+                  IO_URING_OP_SUPPORTED );
+    free( probe );
+
+    return supported;
+}
+
+/* Leaves a synchronous ring.                                                 */
+static void tearDown( struct ufsUringStruct *ring )
+{
+    if ( ring -> sqes )
+        munmap( ring -> sqes, ring -> sqeBytes );
+    if ( ring -> rings )
+        munmap( ring -> rings, ring -> ringBytes );
+    if ( ring -> fd >= 0 )
+        close( ring -> fd );
+
+    ring -> sqes = NULL;
+    ring -> rings = NULL;
+    ring -> fd = -1;
+}
+
+static void runSync( struct ufsUringOpStruct *op )
+{
+    int ret;
+
+    if ( op -> op == UFS_URING_STATX )
+        ret = statx( op -> dirFd, op -> path, op -> flags, op -> mask,
+                     op -> stx );
+    else
+        ret = openat( op -> dirFd, op -> path, op -> flags );
+
+    op -> result = ret < 0 ? -errno : ret;
+}
+
+static void prepare( struct io_uring_sqe *sqe,
+                     const struct ufsUringOpStruct *op, uint64_t index )
+{
+    memset( sqe, 0, sizeof( *sqe ) );
+    sqe -> fd = op -> dirFd;
+    sqe -> addr = (uintptr_t) op -> path;
+    sqe -> user_data = index;
+    if ( op -> op == UFS_URING_STATX ) {
+        sqe -> opcode = IORING_OP_STATX;
+        sqe -> len = op -> mask;
+        sqe -> off = (uintptr_t) op -> stx;
+        sqe -> statx_flags = op -> flags;
+    } else {
+        sqe -> opcode = IORING_OP_OPENAT;
+        sqe -> open_flags = op -> flags;
+    }
+}
+
+static uint64_t reap( struct ufsUringStruct *ring,
+                      struct ufsUringOpStruct *ops )
+{
+    struct io_uring_cqe *cqe;
+    uint32_t head, tail;
+    uint64_t reaped;
+
+    reaped = 0;
+    head = *ring -> cqHead;
+    tail = __atomic_load_n( ring -> cqTail, __ATOMIC_ACQUIRE );
+    for ( ; head != tail; head++ ) {
+        cqe = &ring -> cqes[ head & *ring -> cqMask ];
+        ops[ cqe -> user_data ].result = cqe -> res;
+        reaped++;
+    }
+    __atomic_store_n( ring -> cqHead, head, __ATOMIC_RELEASE );
+
+    return reaped;
+}
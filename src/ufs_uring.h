@@ -0,0 +1,123 @@
+/******************************************************************************\
+*  ufs_uring.h                                                                 *
+*                                                                              *
+*  Internal header for batches of metadata calls on io_uring.                  *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+/* Notes:                                                                     */
+/* A ring runs batches of statx and openat calls, submitting as many as fit   */
+/* the submission queue with a single io_uring_enter and reaping them         */
+/* together, so a batch of n calls costs about n / depth system calls.        */
+/* The ring is set up with the raw system calls, there is no liburing.        */
+/*                                                                            */
+/* Kernels without io_uring, or whose io_uring can't do IORING_OP_STATX and   */
+/* IORING_OP_OPENAT, which came with 5.6, get a synchronous ring making the   */
+/* calls one at a time, as does a depth of 0. Both give the same results.     */
+/* A ring runs one batch at a time, batches of other threads wait.            */
+
+#ifndef UFS_URING_H
+#define UFS_URING_H
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define UFS_URING_DEPTH (64)
+
+typedef struct ufsUringStruct *ufsUringPtr;
+
+enum ufsUringOpEnum {
+    UFS_URING_STATX,
+    UFS_URING_OPENAT
+};
+
+struct ufsUringOpStruct {
+    enum ufsUringOpEnum op;
+    int dirFd;
+    const char *path;
+    /* AT_* flags of statx, or the flags of openat.                           */
+    int flags;
+    /* The fields of statx.                                                   */
+    unsigned int mask;
+    /* Filled by statx.                                                       */
+    struct statx *stx;
+    /* 0 or the file descriptor openat gave, -errno on error.                 */
+    int result;
+};
+
+/******************************************************************************\
+* ufsUringCreate                                                               *
+*                                                                              *
+*  Creates a ring of depth entries, synchronous if io_uring can't be used.     *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_OUT_OF_MEMORY: The system is out of memory.                            *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -depth: The entries of the submission queue, 0 for a synchronous ring.      *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -ufsUringPtr: The ring, NULL on error.                                      *
+*                                                                              *
+\******************************************************************************/
+ufsUringPtr ufsUringCreate( uint32_t depth );
+
+/******************************************************************************\
+* ufsUringFree                                                                 *
+*                                                                              *
+*  Frees ring.                                                                 *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -ring: The ring, may be NULL.                                               *
+*                                                                              *
+\******************************************************************************/
+void ufsUringFree( ufsUringPtr ring );
+
+/******************************************************************************\
+* ufsUringIsAsync                                                              *
+*                                                                              *
+*  Checks whether ring runs on io_uring.                                       *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -ring: The ring, not NULL.                                                  *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -bool: true if it does, false if it's synchronous.                          *
+*                                                                              *
+\******************************************************************************/
+bool ufsUringIsAsync( ufsUringPtr ring );
+
+/******************************************************************************\
+* ufsUringRun                                                                  *
+*                                                                              *
+*  Runs every call of ops and waits for all of them.                           *
+*                                                                              *
+*  Possible errors:                                                            *
+*   UFS_BAD_CALL: ring or ops are NULL.                                        *
+*                                                                              *
+* Parameters                                                                   *
+*                                                                              *
+*  -ring: The ring.                                                            *
+*  -ops: The calls, their result is filled in.                                 *
+*  -numOps: The number of calls.                                               *
+*                                                                              *
+* Return                                                                       *
+*                                                                              *
+*  -uint64_t: The number of io_uring_enter calls made.                         *
+*                                                                              *
+\******************************************************************************/
+uint64_t ufsUringRun( ufsUringPtr ring, struct ufsUringOpStruct *ops,
+                      uint64_t numOps );
+
+#endif /* UFS_URING_H */
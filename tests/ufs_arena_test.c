@@ -0,0 +1,183 @@
+/******************************************************************************\
+*  ufs_arena_test.c                                                            *
+*                                                                              *
+*  Tests for arenas and slabs.                                                 *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ufs_arena.h"
+#include "ufs_defs.h"
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define BLOCK_BYTES (4096)
+#define NUM_ITEMS (10000)
+
+static void *threadArena( void *arg )
+{
+    (void) arg;
+    return ufsArenaThread();
+}
+
+/* ----- ufs_arena tests ----                                                 */
+
+static void test_ufs_arena_alloc( void **state ) {
+    ufsArenaPtr arena;
+    struct ufsArenaMarkStruct mark;
+    uint8_t *a, *b, *c, *big;
+    uint64_t bytes;
+    int i;
+
+    (void) state;
+
+    assert_null( ufsArenaCreate( 0 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_null( ufsArenaAlloc( NULL, 8 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    arena = ufsArenaCreate( BLOCK_BYTES );
+    assert_non_null( arena );
+    bytes = ufsArenaBytes( arena );
+    assert_true( bytes >= BLOCK_BYTES );
+
+    a = ufsArenaAlloc( arena, 3 );
+    b = ufsArenaAlloc( arena, 17 );
+    assert_non_null( a );
+    assert_non_null( b );
+    assert_int_equal( (uintptr_t) a % UFS_ARENA_ALIGN, 0 );
+    assert_int_equal( (uintptr_t) b % UFS_ARENA_ALIGN, 0 );
+    assert_ptr_equal( b, a + UFS_ARENA_ALIGN );
+    assert_non_null( ufsArenaAlloc( arena, 0 ) );
+
+    /* The last allocation grows in place, any other one is copied.         */
+    c = ufsArenaAlloc( arena, 16 );
+    memset( c, 7, 16 );
+    assert_ptr_equal( ufsArenaGrow( arena, c, 16, 256 ), c );
+    b = ufsArenaGrow( arena, b, 17, 64 );
+    assert_ptr_not_equal( b, c );
+    assert_null( ufsArenaGrow( arena, b, 64, 8 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* Restoring a mark gives the same memory to the next allocations.      */
+    mark = ufsArenaSave( arena );
+    a = ufsArenaAlloc( arena, 100 );
+    big = ufsArenaAlloc( arena, BLOCK_BYTES * 4 );
+    assert_non_null( big );
+    memset( big, 1, BLOCK_BYTES * 4 );
+    ufsArenaRestore( arena, mark );
+    assert_ptr_equal( ufsArenaAlloc( arena, 100 ), a );
+    assert_ptr_equal( ufsArenaAlloc( arena, BLOCK_BYTES * 4 ), big );
+
+    /* Once it has grown a reset arena doesn't allocate.                    */
+    for ( i = 0; i < 100; i++ ) {
+        if ( i == 1 )
+            bytes = ufsArenaBytes( arena );
+        ufsArenaReset( arena );
+        assert_non_null( ufsArenaAlloc( arena, BLOCK_BYTES / 2 ) );
+        assert_non_null( ufsArenaAlloc( arena, BLOCK_BYTES * 4 ) );
+        assert_non_null( ufsArenaAlloc( arena, BLOCK_BYTES ) );
+    }
+    assert_int_equal( ufsArenaBytes( arena ), bytes );
+
+    assert_true( ufsArenaTrim( arena ) > 0 );
+    assert_true( ufsArenaBytes( arena ) < bytes );
+    assert_non_null( ufsArenaAlloc( arena, 8 ) );
+    ufsArenaFree( arena );
+}
+
+static void test_ufs_arena_thread( void **state ) {
+    pthread_t thread;
+    ufsArenaPtr mine, theirs;
+
+    (void) state;
+
+    mine = ufsArenaThread();
+    assert_non_null( mine );
+    assert_ptr_equal( ufsArenaThread(), mine );
+
+    assert_int_equal( pthread_create( &thread, NULL, threadArena, NULL ), 0 );
+    assert_int_equal( pthread_join( thread, (void**)&theirs ), 0 );
+    assert_non_null( theirs );
+    assert_ptr_not_equal( theirs, mine );
+}
+
+static void test_ufs_arena_slab( void **state ) {
+    ufsSlabPtr slab;
+    void **items;
+    uint64_t bytes;
+    int i;
+
+    (void) state;
+
+    assert_null( ufsSlabCreate( 0 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_null( ufsSlabCreate( UFS_SLAB_CHUNK_BYTES ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    slab = ufsSlabCreate( 24 );
+    assert_non_null( slab );
+    items = malloc( NUM_ITEMS * sizeof( *items ) );
+    assert_non_null( items );
+
+    for ( i = 0; i < NUM_ITEMS; i++ ) {
+        items[i] = ufsSlabAlloc( slab );
+        assert_non_null( items[i] );
+        assert_int_equal( (uintptr_t) items[i] % UFS_ARENA_ALIGN, 0 );
+        memset( items[i], i, 24 );
+    }
+    bytes = ufsSlabBytes( slab );
+    assert_true( bytes >= NUM_ITEMS * 32 );
+
+    /* Freed items come back before the slab grows.                          */
+    ufsSlabFree( slab, items[5] );
+    assert_ptr_equal( ufsSlabAlloc( slab ), items[5] );
+    for ( i = 0; i < NUM_ITEMS; i++ )
+        ufsSlabFree( slab, items[i] );
+    for ( i = 0; i < NUM_ITEMS; i++ )
+        items[i] = ufsSlabAlloc( slab );
+    assert_int_equal( ufsSlabBytes( slab ), bytes );
+
+    /* Only chunks without live items are trimmed.                           */
+    assert_int_equal( ufsSlabTrim( slab ), 0 );
+    for ( i = 1; i < NUM_ITEMS; i++ )
+        ufsSlabFree( slab, items[i] );
+    assert_true( ufsSlabTrim( slab ) > 0 );
+    assert_int_equal( ufsSlabBytes( slab ), UFS_SLAB_CHUNK_BYTES );
+    for ( i = 1; i < NUM_ITEMS; i++ )
+        assert_non_null( ufsSlabAlloc( slab ) );
+
+    free( items );
+    ufsSlabDestroy( slab );
+}
+
+static const struct CMUnitTest arena_tests[] = {
+    cmocka_unit_test(test_ufs_arena_alloc),
+    cmocka_unit_test(test_ufs_arena_thread),
+    cmocka_unit_test(test_ufs_arena_slab),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(arena_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
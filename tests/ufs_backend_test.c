@@ -0,0 +1,422 @@
+/******************************************************************************\
+*  ufs_backend_test.c                                                          *
+*                                                                              *
+*  Conformance tests of ufs.h, run against every registered backend.           *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+#define _GNU_SOURCE
+
+#include <ftw.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ufs.h"
+#include "ufs_backend.h"
+#include "ufs_defs.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define MANY_FILES (64)
+
+struct backendStateStruct {
+    struct ufsTestUtilsFileNameStruct path;
+    char opts[ UFS_TEST_UTILS_BUFF_SIZE + 64 ];
+    ufsType ufs;
+};
+
+struct countStruct {
+    uint64_t count;
+    uint64_t numEntries;
+};
+
+/* The backend under test, set by main before each group.                    */
+static const struct ufsBackendOps *currentBackend;
+
+static int removeEntry( const char *path, const struct stat *sb, int flag,
+                        struct FTW *ftw ) {
+    (void) sb; (void) flag; (void) ftw;
+    return remove( path );
+}
+
+static int backendSetup( void **state ) {
+    struct backendStateStruct *s;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s || !ufsTestUtilsGetTmpFileName( &s -> path ) )
+        return -1;
+
+    snprintf( s -> opts, sizeof( s -> opts ), "path=%s", s -> path.name );
+    s -> ufs = ufsInitWithBackend( currentBackend -> name, s -> opts );
+    if ( !s -> ufs )
+        return -1;
+
+    *state = s;
+    return 0;
+}
+
+static int backendTeardown( void **state ) {
+    struct backendStateStruct *s;
+
+    s = *state;
+    ufsDestroy( s -> ufs );
+    nftw( s -> path.name, removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+static ufsStatusType countDirIter( ufsIdentifierType storage,
+                                   uint64_t currEntry,
+                                   uint64_t numEntries,
+                                   void *userData ) {
+    struct countStruct *c = userData;
+
+    assert_true( storage > 0 );
+    assert_int_equal( currEntry, c -> count );
+    c -> count++;
+    c -> numEntries = numEntries;
+    return UFS_NO_ERROR;
+}
+
+static ufsStatusType failDirIter( ufsIdentifierType storage,
+                                  uint64_t currEntry,
+                                  uint64_t numEntries,
+                                  void *userData ) {
+    (void) storage; (void) currEntry; (void) numEntries;
+    (*(uint64_t*)userData)++;
+    return UFS_UNKNOWN_ERROR;
+}
+
+/* ----- registry tests ----                                                  */
+
+static void test_ufs_backend_registry( void **state ) {
+    struct ufsBackendOps incomplete = { .name = "incomplete" };
+    struct ufsBackendOps duplicate;
+    char buff[ 16 ];
+
+    (void) state;
+
+    assert_true( ufsBackendCount() >= 1 );
+    assert_ptr_equal( ufsBackendGet( 0 ), &ufsImageBackendOps );
+    assert_ptr_equal( ufsBackendFind( "image" ), &ufsImageBackendOps );
+    assert_ptr_equal( ufsBackendFind( "sqlite" ), &ufsSqliteBackendOps );
+    assert_null( ufsInitWithBackend( "sqlite", "batch=0" ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_ptr_equal( ufsBackendFind( "lsm" ), &ufsLsmBackendOps );
+    assert_null( ufsInitWithBackend( "lsm", "path=/nonexistent,memtable=1" ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_ptr_equal( ufsBackendFind( "sharded" ), &ufsShardedBackendOps );
+    assert_null( ufsInitWithBackend( "sharded", "path=/x,shards=0" ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_null( ufsBackendGet( ufsBackendCount() ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    assert_null( ufsBackendFind( "nope" ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_null( ufsInitWithBackend( "nope", NULL ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    assert_int_equal( ufsBackendRegister( NULL ), UFS_BAD_CALL );
+    assert_int_equal( ufsBackendRegister( &incomplete ), UFS_BAD_CALL );
+    duplicate = ufsImageBackendOps;
+    assert_int_equal( ufsBackendRegister( &duplicate ), UFS_ALREADY_EXISTS );
+
+    assert_true( ufsBackendOption( "path=/a,sealed=/b,sealed=/c", "sealed", 1,
+                                   buff, sizeof( buff ) ) );
+    assert_string_equal( buff, "/c" );
+    assert_true( ufsBackendOption( "path=,x=1", "path", 0, buff,
+                                   sizeof( buff ) ) );
+    assert_string_equal( buff, "" );
+    assert_false( ufsBackendOption( "paths=/a", "path", 0, buff,
+                                    sizeof( buff ) ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_false( ufsBackendOption( NULL, "path", 0, buff, sizeof( buff ) ) );
+    assert_false( ufsBackendOption( "path=/a/very/long/path", "path", 0, buff,
+                                    sizeof( buff ) ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* A NULL ufs is a bad call for every function.                          */
+    assert_int_equal( ufsAddDirectory( NULL, "x" ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsCollapse( NULL, NULL ), UFS_BAD_CALL );
+    assert_int_equal( ufsAddScratchArea( NULL, "x" ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsPersistArea( NULL, 1 ), -1 );
+    ufsDestroy( NULL );
+}
+
+/* ----- conformance tests ----                                               */
+
+static void test_ufs_conformance_storage( void **state ) {
+    struct backendStateStruct *s;
+    ufsIdentifierType dir, f1, f2;
+
+    s = *state;
+
+    assert_int_equal( ufsAddDirectory( s -> ufs, NULL ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    dir = ufsAddDirectory( s -> ufs, "/src" );
+    assert_true( dir > 0 );
+    assert_int_equal( ufsAddDirectory( s -> ufs, "/src" ), -1 );
+    assert_int_equal( ufsErrno, UFS_ALREADY_EXISTS );
+    assert_int_equal( ufsGetDirectory( s -> ufs, "/src" ), dir );
+    assert_int_equal( ufsGetDirectory( s -> ufs, "/nope" ), -1 );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    f1 = ufsAddFile( s -> ufs, dir, "main.c" );
+    f2 = ufsAddFile( s -> ufs, dir, "util.c" );
+    assert_true( f1 > 0 && f2 > 0 && f1 != f2 );
+    assert_int_equal( ufsAddFile( s -> ufs, dir, "main.c" ), -1 );
+    assert_int_equal( ufsErrno, UFS_ALREADY_EXISTS );
+    assert_int_equal( ufsAddFile( s -> ufs, 0, "main.c" ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsAddFile( s -> ufs, f1, "x" ), -1 );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_int_equal( ufsGetFile( s -> ufs, dir, "main.c" ), f1 );
+    assert_int_equal( ufsGetFile( s -> ufs, dir, "nope.c" ), -1 );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    assert_int_equal( ufsRemoveDirectory( s -> ufs, dir ),
+                      UFS_DIRECTORY_IS_NOT_EMPTY );
+    assert_int_equal( ufsRemoveDirectory( s -> ufs, f1 ), UFS_DOES_NOT_EXIST );
+    assert_int_equal( ufsRemoveFile( s -> ufs, dir ), UFS_DOES_NOT_EXIST );
+    assert_int_equal( ufsRemoveFile( s -> ufs, f1 ), UFS_NO_ERROR );
+    assert_int_equal( ufsRemoveFile( s -> ufs, f1 ), UFS_DOES_NOT_EXIST );
+    assert_int_equal( ufsGetFile( s -> ufs, dir, "main.c" ), -1 );
+    assert_int_equal( ufsRemoveFile( s -> ufs, f2 ), UFS_NO_ERROR );
+    assert_int_equal( ufsRemoveDirectory( s -> ufs, dir ), UFS_NO_ERROR );
+    assert_int_equal( ufsGetDirectory( s -> ufs, "/src" ), -1 );
+}
+
+static void test_ufs_conformance_mappings( void **state ) {
+    struct backendStateStruct *s;
+    ufsIdentifierType dir, f1, a1, a2;
+
+    s = *state;
+
+    assert_int_equal( ufsAddArea( s -> ufs, "BASE" ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    a1 = ufsAddArea( s -> ufs, "a1" );
+    a2 = ufsAddArea( s -> ufs, "a2" );
+    assert_true( a1 > 0 && a2 > 0 && a1 != a2 );
+    assert_int_equal( ufsAddArea( s -> ufs, "a1" ), -1 );
+    assert_int_equal( ufsErrno, UFS_ALREADY_EXISTS );
+    assert_int_equal( ufsGetArea( s -> ufs, "a2" ), a2 );
+
+    dir = ufsAddDirectory( s -> ufs, "/d" );
+    f1 = ufsAddFile( s -> ufs, dir, "f" );
+
+    assert_int_equal( ufsAddMapping( s -> ufs, a1, f1 ), UFS_NO_ERROR );
+    assert_int_equal( ufsAddMapping( s -> ufs, a1, f1 ), UFS_ALREADY_EXISTS );
+    assert_int_equal( ufsAddMapping( s -> ufs, a1, 12345 ), UFS_DOES_NOT_EXIST );
+    assert_int_equal( ufsAddMapping( s -> ufs, 0, f1 ), UFS_BAD_CALL );
+    assert_int_equal( ufsProbeMapping( s -> ufs, a1, f1 ), UFS_NO_ERROR );
+    assert_int_equal( ufsProbeMapping( s -> ufs, a2, f1 ),
+                      UFS_MAPPING_DOES_NOT_EXIST );
+    assert_int_equal( ufsProbeMapping( s -> ufs, 12345, f1 ),
+                      UFS_DOES_NOT_EXIST );
+
+    /* Removing an area removes its mappings.                                */
+    assert_int_equal( ufsRemoveArea( s -> ufs, a1 ), UFS_NO_ERROR );
+    assert_int_equal( ufsRemoveArea( s -> ufs, a1 ), UFS_DOES_NOT_EXIST );
+    assert_int_equal( ufsGetArea( s -> ufs, "a1" ), -1 );
+    assert_int_equal( ufsAddMapping( s -> ufs, a2, f1 ), UFS_NO_ERROR );
+
+    /* And so does removing a file.                                          */
+    assert_int_equal( ufsRemoveFile( s -> ufs, f1 ), UFS_NO_ERROR );
+    f1 = ufsAddFile( s -> ufs, dir, "f" );
+    assert_int_equal( ufsProbeMapping( s -> ufs, a2, f1 ),
+                      UFS_MAPPING_DOES_NOT_EXIST );
+}
+
+static void test_ufs_conformance_views( void **state ) {
+    struct backendStateStruct *s;
+    ufsIdentifierType dir, f1, f2, a1, a2;
+    ufsViewType view = { UFS_VIEW_TERMINATOR };
+
+    s = *state;
+
+    dir = ufsAddDirectory( s -> ufs, "/d" );
+    f1 = ufsAddFile( s -> ufs, dir, "f1" );
+    f2 = ufsAddFile( s -> ufs, dir, "f2" );
+    a1 = ufsAddArea( s -> ufs, "a1" );
+    a2 = ufsAddArea( s -> ufs, "a2" );
+    assert_int_equal( ufsAddMapping( s -> ufs, a1, f1 ), UFS_NO_ERROR );
+    assert_int_equal( ufsAddMapping( s -> ufs, a2, f1 ), UFS_NO_ERROR );
+
+    /* f2 has no explicit mapping, BASE holds it.                            */
+    view[0] = a2; view[1] = a1; view[2] = 0; view[3] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsResolveStorageInView( s -> ufs, view, f1 ), a2 );
+    assert_int_equal( ufsResolveStorageInView( s -> ufs, view, f2 ), 0 );
+
+    view[0] = a1; view[1] = a2;
+    assert_int_equal( ufsResolveStorageInView( s -> ufs, view, f1 ), a1 );
+
+    view[0] = a1; view[1] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsResolveStorageInView( s -> ufs, view, f2 ), -1 );
+    assert_int_equal( ufsErrno, UFS_CANNOT_RESOLVE_STORAGE );
+
+    view[0] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsResolveStorageInView( s -> ufs, view, f1 ), -1 );
+    assert_int_equal( ufsErrno, UFS_CANNOT_RESOLVE_STORAGE );
+
+    view[0] = a1; view[1] = a1; view[2] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsResolveStorageInView( s -> ufs, view, f1 ), -1 );
+    assert_int_equal( ufsErrno, UFS_VIEW_CONTAINS_DUPLICATES );
+
+    view[1] = 12345;
+    assert_int_equal( ufsResolveStorageInView( s -> ufs, view, f1 ), -1 );
+    assert_int_equal( ufsErrno, UFS_INVALID_AREA_IN_VIEW );
+
+    view[1] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsResolveStorageInView( s -> ufs, view, 12345 ), -1 );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+}
+
+static void test_ufs_conformance_iterate( void **state ) {
+    struct backendStateStruct *s;
+    struct countStruct c = { 0 };
+    ufsIdentifierType dir, area, file;
+    ufsViewType view = { UFS_VIEW_TERMINATOR };
+    char name[ 32 ];
+    uint64_t calls, i;
+
+    s = *state;
+
+    dir = ufsAddDirectory( s -> ufs, "/many" );
+    area = ufsAddArea( s -> ufs, "even" );
+    for ( i = 0; i < MANY_FILES; i++ ) {
+        snprintf( name, sizeof( name ), "file%lu", i );
+        file = ufsAddFile( s -> ufs, dir, name );
+        assert_true( file > 0 );
+        if ( i % 2 == 0 )
+            assert_int_equal( ufsAddMapping( s -> ufs, area, file ),
+                              UFS_NO_ERROR );
+    }
+
+    view[0] = area; view[1] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsIterateDirInView( s -> ufs, view, dir, countDirIter,
+                                           &c ), UFS_NO_ERROR );
+    assert_int_equal( c.count, MANY_FILES / 2 );
+    assert_int_equal( c.numEntries, MANY_FILES / 2 );
+
+    view[1] = 0; view[2] = UFS_VIEW_TERMINATOR;
+    c.count = 0;
+    assert_int_equal( ufsIterateDirInView( s -> ufs, view, dir, countDirIter,
+                                           &c ), UFS_NO_ERROR );
+    assert_int_equal( c.count, MANY_FILES );
+
+    /* An iterator error halts the iteration.                                */
+    calls = 0;
+    assert_int_equal( ufsIterateDirInView( s -> ufs, view, dir, failDirIter,
+                                           &calls ), UFS_UNKNOWN_ERROR );
+    assert_int_equal( ufsErrno, UFS_UNKNOWN_ERROR );
+    assert_int_equal( calls, 1 );
+
+    assert_int_equal( ufsIterateDirInView( s -> ufs, view, dir, NULL, NULL ),
+                      UFS_BAD_CALL );
+    assert_int_equal( ufsIterateDirInView( s -> ufs, view, 12345,
+                                           countDirIter, &c ),
+                      UFS_DOES_NOT_EXIST );
+}
+
+static void test_ufs_conformance_collapse( void **state ) {
+    struct backendStateStruct *s;
+    ufsIdentifierType dir, f1, f2, a1, a2;
+    ufsViewType view = { UFS_VIEW_TERMINATOR };
+
+    s = *state;
+
+    dir = ufsAddDirectory( s -> ufs, "/d" );
+    f1 = ufsAddFile( s -> ufs, dir, "f1" );
+    f2 = ufsAddFile( s -> ufs, dir, "f2" );
+    a1 = ufsAddArea( s -> ufs, "a1" );
+    a2 = ufsAddArea( s -> ufs, "a2" );
+    assert_int_equal( ufsAddMapping( s -> ufs, a1, f1 ), UFS_NO_ERROR );
+    assert_int_equal( ufsAddMapping( s -> ufs, a1, f2 ), UFS_NO_ERROR );
+    assert_int_equal( ufsAddMapping( s -> ufs, a2, f2 ), UFS_NO_ERROR );
+
+    view[0] = a1; view[1] = a2; view[2] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsCollapse( s -> ufs, view ), UFS_NO_ERROR );
+    assert_int_equal( ufsProbeMapping( s -> ufs, a2, f1 ), UFS_NO_ERROR );
+    assert_int_equal( ufsProbeMapping( s -> ufs, a2, f2 ), UFS_NO_ERROR );
+    assert_int_equal( ufsProbeMapping( s -> ufs, a1, f1 ),
+                      UFS_MAPPING_DOES_NOT_EXIST );
+
+    view[1] = a1;
+    assert_int_equal( ufsCollapse( s -> ufs, view ),
+                      UFS_VIEW_CONTAINS_DUPLICATES );
+}
+
+static void test_ufs_conformance_persists( void **state ) {
+    struct backendStateStruct *s;
+    ufsIdentifierType dir, file, area;
+
+    s = *state;
+
+    dir = ufsAddDirectory( s -> ufs, "/keep" );
+    file = ufsAddFile( s -> ufs, dir, "me" );
+    area = ufsAddArea( s -> ufs, "area" );
+    assert_int_equal( ufsAddMapping( s -> ufs, area, file ), UFS_NO_ERROR );
+
+    ufsDestroy( s -> ufs );
+    s -> ufs = ufsInitWithBackend( currentBackend -> name, s -> opts );
+    assert_non_null( s -> ufs );
+
+    assert_int_equal( ufsGetDirectory( s -> ufs, "/keep" ), dir );
+    assert_int_equal( ufsGetFile( s -> ufs, dir, "me" ), file );
+    assert_int_equal( ufsGetArea( s -> ufs, "area" ), area );
+    assert_int_equal( ufsProbeMapping( s -> ufs, area, file ), UFS_NO_ERROR );
+}
+
+static const struct CMUnitTest registry_tests[] = {
+    cmocka_unit_test(test_ufs_backend_registry),
+};
+
+static const struct CMUnitTest conformance_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_conformance_storage, backendSetup, backendTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_conformance_mappings, backendSetup, backendTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_conformance_views, backendSetup, backendTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_conformance_iterate, backendSetup, backendTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_conformance_collapse, backendSetup, backendTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_conformance_persists, backendSetup, backendTeardown),
+};
+
+int main(void) {
+    uint64_t i;
+    int failed;
+
+    failed = cmocka_run_group_tests(registry_tests, NULL, NULL);
+
+    for ( i = 0; i < ufsBackendCount(); i++ ) {
+        currentBackend = ufsBackendGet( i );
+        failed += _cmocka_run_group_tests( currentBackend -> name,
+                                           conformance_tests,
+                                           sizeof( conformance_tests ) /
+                                           sizeof( conformance_tests[0] ),
+                                           NULL, NULL );
+    }
+
+    return failed;
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
@@ -0,0 +1,591 @@
+/******************************************************************************\
+*  ufs_base_test.c                                                             *
+*                                                                              *
+*  Tests for access to the external fs.                                        *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "ufs_base.h"
+#include "ufs_base_index.h"
+#include "ufs_budget.h"
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_scan.h"
+#include "ufs_store.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define NUM_DIRS (6)
+#define NUM_BATCH (200)
+
+/* A fixed layout build swaps these for its own, see ufsTestUtilsLayoutSizes. */
+static const struct ufsHeaderSizeRequestStruct bigSizeRequest = {
+    .numFiles = 1024,
+    .numAreas = 64,
+    .numNodes = 1024,
+    .numStrBytes = 32768
+};
+
+static const struct ufsHeaderSizeRequestStruct indexSizeRequest = {
+    .numFiles = 1024,
+    .numAreas = 64,
+    .numNodes = 1024,
+    .numStrBytes = 32768,
+    .baseIndex = true
+};
+
+struct baseStateStruct {
+    struct ufsTestUtilsFileNameStruct img;
+    char root[ UFS_TEST_UTILS_BUFF_SIZE ];
+};
+
+static void makeFile( const char *root, const char *path, int size ) {
+    char full[ UFS_TEST_UTILS_BUFF_SIZE * 2 ];
+    int fd;
+
+    snprintf( full, sizeof( full ), "%s/%s", root, path );
+    fd = open( full, O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+    assert_true( fd >= 0 );
+    assert_int_equal( ftruncate( fd, size ), 0 );
+    close( fd );
+}
+
+static void makeDir( const char *root, const char *path ) {
+    char full[ UFS_TEST_UTILS_BUFF_SIZE * 2 ];
+
+    snprintf( full, sizeof( full ), "%s/%s", root, path );
+    assert_int_equal( mkdir( full, 0700 ), 0 );
+}
+
+static int removeEntry( const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw ) {
+    (void) st;
+    (void) flag;
+    (void) ftw;
+    return remove( path );
+}
+
+/* Waits up to 5s for a lookup to give found, and size if it's found.         */
+static bool waitForLookup( ufsBasePtr base, const char *dir, const char *name,
+                           bool found, uint64_t size ) {
+    struct timespec delay = { 0, 1000000 };
+    struct ufsBaseAttrStruct attr;
+    int i;
+
+    for ( i = 0; i < 5000; i++ ) {
+        if ( ufsBaseLookup( base, dir, name, &attr ) == found &&
+             ( !found || attr.size == size ) )
+            return true;
+        nanosleep( &delay, NULL );
+    }
+
+    return false;
+}
+
+/* Counts the entries read and adds up the sizes of the files.                */
+static bool countSink( const char *const *names,
+                       const struct ufsBaseAttrStruct *attrs,
+                       uint64_t numEntries, void *userData ) {
+    uint64_t *counts = userData, i;
+
+    for ( i = 0; i < numEntries; i++ ) {
+        counts[0]++;
+        if ( S_ISREG( attrs[i].mode ) )
+            counts[1] += attrs[i].size;
+        if ( !strcmp( names[i], "sub" ) && S_ISDIR( attrs[i].mode ) )
+            counts[2]++;
+    }
+
+    return true;
+}
+
+static bool stopSink( const char *const *names,
+                      const struct ufsBaseAttrStruct *attrs,
+                      uint64_t numEntries, void *userData ) {
+    (void) names;
+    (void) attrs;
+    (void) numEntries;
+    (void) userData;
+
+    ufsErrno = UFS_OUT_OF_MEMORY;
+    return false;
+}
+
+static int baseSetup( void **state ) {
+    struct baseStateStruct *s;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s || !ufsTestUtilsGetTmpFileName( &s -> img ) )
+        return -1;
+
+    snprintf( s -> root, sizeof( s -> root ), "/tmp/ufs_base_XXXXXX" );
+    if ( !mkdtemp( s -> root ) )
+        return -1;
+
+    *state = s;
+    return 0;
+}
+
+static int baseTeardown( void **state ) {
+    struct baseStateStruct *s;
+
+    s = *state;
+    nftw( s -> root, removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+    unlink( s -> img.name );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+/* ----- ufs_base tests ----                                                  */
+
+static void test_ufs_base_lookup( void **state ) {
+    struct baseStateStruct *s;
+    struct ufsBaseAttrStruct attr;
+    struct ufsBaseStatsStruct stats;
+    char full[ UFS_TEST_UTILS_BUFF_SIZE * 2 ],
+         moved[ UFS_TEST_UTILS_BUFF_SIZE * 2 ];
+    ufsBasePtr base;
+
+    s = *state;
+    makeDir( s -> root, "a" );
+    makeDir( s -> root, "a/b" );
+    makeFile( s -> root, "a/b/f", 10 );
+
+    assert_null( ufsBaseOpen( "/does/not/exist", 0 ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    base = ufsBaseOpen( s -> root, 0 );
+    assert_non_null( base );
+
+    assert_false( ufsBaseLookup( base, "a/../a", "b", NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsBaseLookup( base, "a//b", "f", NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsBaseLookup( base, "a", "b/f", NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* The second lookup of an entry or of a missing one is a hit.            */
+    assert_true( ufsBaseLookup( base, "a/b", "f", &attr ) );
+    assert_true( S_ISREG( attr.mode ) );
+    assert_int_equal( attr.size, 10 );
+    assert_true( ufsBaseLookup( base, "a/b", "f", &attr ) );
+    assert_false( ufsBaseLookup( base, "a/b", "g", NULL ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_false( ufsBaseLookup( base, "a/b", "g", NULL ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_false( ufsBaseLookup( base, "a/nope", "g", NULL ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_false( ufsBaseLookup( base, "a/b/f", "g", NULL ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    ufsBaseGetStats( base, &stats );
+    assert_int_equal( stats.hits, 2 );
+    assert_int_equal( stats.watches, 3 );
+
+    /* Directories are cached once they're watched.                           */
+    assert_true( ufsBaseLookup( base, "", "a", &attr ) );
+    assert_true( S_ISDIR( attr.mode ) );
+    assert_true( ufsBaseLookup( base, NULL, "a", &attr ) );
+
+    /* Changes are seen, wherever they're made on the path.                   */
+    makeFile( s -> root, "a/b/g", 3 );
+    assert_true( waitForLookup( base, "a/b", "g", true, 3 ) );
+    makeFile( s -> root, "a/b/f", 20 );
+    assert_true( waitForLookup( base, "a/b", "f", true, 20 ) );
+
+    snprintf( full, sizeof( full ), "%s/a", s -> root );
+    snprintf( moved, sizeof( moved ), "%s/z", s -> root );
+    assert_int_equal( rename( full, moved ), 0 );
+    assert_true( waitForLookup( base, "a/b", "f", false, 0 ) );
+    assert_true( waitForLookup( base, "", "a", false, 0 ) );
+    assert_true( ufsBaseLookup( base, "z/b", "f", &attr ) );
+    assert_int_equal( attr.size, 20 );
+
+    ufsBaseGetStats( base, &stats );
+    assert_true( stats.invalidations > 0 );
+    ufsBaseClose( base );
+}
+
+static void test_ufs_base_evict( void **state ) {
+    struct baseStateStruct *s;
+    struct ufsBaseStatsStruct stats;
+    ufsBudgetPtr budget;
+    ufsBasePtr base;
+    uint64_t before;
+    char path[ 16 ];
+    int i;
+
+    s = *state;
+    for ( i = 0; i < NUM_DIRS; i++ ) {
+        snprintf( path, sizeof( path ), "d%d", i );
+        makeDir( s -> root, path );
+        snprintf( path, sizeof( path ), "d%d/f", i );
+        makeFile( s -> root, path, i );
+    }
+
+    budget = ufsBudgetGlobal();
+    assert_non_null( budget );
+    before = ufsBudgetUsage( budget, -1 );
+
+    /* The root and two of the directories fit.                               */
+    base = ufsBaseOpen( s -> root, 3 );
+    assert_non_null( base );
+    for ( i = 0; i < NUM_DIRS; i++ ) {
+        snprintf( path, sizeof( path ), "d%d", i );
+        assert_true( ufsBaseLookup( base, path, "f", NULL ) );
+        assert_true( ufsBaseLookup( base, path, "f", NULL ) );
+    }
+
+    ufsBaseGetStats( base, &stats );
+    assert_int_equal( stats.watches, 3 );
+    assert_int_equal( stats.evictions, NUM_DIRS - 2 );
+    assert_int_equal( stats.hits, NUM_DIRS );
+    assert_true( ufsBudgetUsage( budget, -1 ) > before );
+
+    /* Pressure evicts all of it.                                             */
+    ufsBudgetRelieve( budget, true );
+    ufsBaseGetStats( base, &stats );
+    assert_int_equal( stats.watches, 0 );
+    assert_int_equal( ufsBudgetUsage( budget, -1 ), before );
+    assert_true( ufsBaseLookup( base, "d1", "f", NULL ) );
+    ufsBaseClose( base );
+    assert_int_equal( ufsBudgetUsage( budget, -1 ), before );
+}
+
+static void test_ufs_base_handles( void **state ) {
+    struct baseStateStruct *s;
+    struct ufsHeaderSizeRequestStruct sizes = bigSizeRequest;
+    struct ufsScanOptionsStruct options = { .numThreads = 2 };
+    struct ufsBaseAttrStruct attr;
+    struct ufsBaseStatsStruct stats;
+    char link[ UFS_TEST_UTILS_BUFF_SIZE * 2 ], buff[ 16 ];
+    ufsScanLoaderPtr loader;
+    ufsIdType top, a, b, c, escape, other;
+    ufsImagePtr img;
+    ufsBasePtr base;
+    int fd;
+
+    s = *state;
+    if ( !ufsTestUtilsLayoutSizes( &sizes ) )
+        skip();
+
+    makeDir( s -> root, "a" );
+    makeDir( s -> root, "a/b" );
+    makeDir( s -> root, "a/b/c" );
+    makeFile( s -> root, "a/b/c/f", 7 );
+    snprintf( link, sizeof( link ), "%s/escape", s -> root );
+    assert_int_equal( symlink( "/", link ), 0 );
+
+    img = ufsHeaderInit( s -> img.name, sizes );
+    assert_non_null( img );
+    top = ufsStoreAddStorage( img, 0, "base", true );
+    other = ufsStoreAddStorage( img, 0, "other", true );
+    loader = ufsScanLoaderCreate( img, top );
+    assert_non_null( loader );
+    assert_true( ufsScan( s -> root, options, ufsScanLoad, loader, NULL ) );
+    ufsScanLoaderFree( loader );
+
+    a = ufsStoreGetStorage( img, top, "a" );
+    b = ufsStoreGetStorage( img, a, "b" );
+    c = ufsStoreGetStorage( img, b, "c" );
+    escape = ufsStoreGetStorage( img, top, "escape" );
+    assert_true( a > 0 && b > 0 && c > 0 && escape > 0 );
+
+    base = ufsBaseOpen( s -> root, 0 );
+    assert_non_null( base );
+    assert_false( ufsBaseStatAt( base, c, "f", NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_true( ufsBaseAttach( base, img, top, 2 ) );
+    assert_false( ufsBaseAttach( base, img, top, 2 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* The directories above c are opened once, the oldest gets closed.       */
+    assert_true( ufsBaseStatAt( base, c, "f", &attr ) );
+    assert_int_equal( attr.size, 7 );
+    assert_true( ufsBaseStatAt( base, top, "a", &attr ) );
+    assert_true( S_ISDIR( attr.mode ) );
+    ufsBaseGetStats( base, &stats );
+    assert_int_equal( stats.handles, 2 );
+    assert_int_equal( stats.closes, 1 );
+
+    fd = ufsBaseOpenAt( base, c, "f", O_RDONLY );
+    assert_true( fd >= 0 );
+    assert_int_equal( read( fd, buff, sizeof( buff ) ), 7 );
+    close( fd );
+    assert_int_equal( ufsBaseOpenAt( base, c, "g", O_RDWR | O_CREAT ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsBaseOpenAt( base, c, "g", O_RDONLY ), -1 );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_false( ufsBaseStatAt( base, b, "nope", NULL ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    /* Nothing outside the root is reached.                                   */
+    assert_false( ufsBaseStatAt( base, escape, "etc", NULL ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_false( ufsBaseStatAt( base, other, "a", NULL ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_false( ufsBaseStatAt( base, c, "..", NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    ufsBaseDropHandles( base );
+    ufsBaseGetStats( base, &stats );
+    assert_int_equal( stats.handles, 0 );
+    assert_true( ufsBaseStatAt( base, c, "f", NULL ) );
+
+    ufsBaseClose( base );
+    ufsImageFree( img );
+}
+
+static void test_ufs_base_batch( void **state ) {
+    struct baseStateStruct *s;
+    struct ufsHeaderSizeRequestStruct sizes = bigSizeRequest;
+    struct ufsScanOptionsStruct options = { .numThreads = 2 };
+    struct ufsBaseAttrStruct attrs[ NUM_BATCH + 2 ];
+    struct ufsBaseStatsStruct stats;
+    ufsStatusType statuses[ NUM_BATCH + 2 ];
+    const char *names[ NUM_BATCH + 2 ];
+    char paths[ NUM_BATCH ][ 16 ], buff[ 16 ];
+    uint64_t counts[3] = { 0 };
+    int fds[ NUM_BATCH + 2 ], i;
+    ufsScanLoaderPtr loader;
+    ufsIdType top, dir;
+    ufsImagePtr img;
+    ufsBasePtr base;
+
+    s = *state;
+    if ( !ufsTestUtilsLayoutSizes( &sizes ) )
+        skip();
+
+    makeDir( s -> root, "d" );
+    makeDir( s -> root, "d/sub" );
+    for ( i = 0; i < NUM_BATCH; i++ ) {
+        snprintf( paths[i], sizeof( paths[i] ), "f%d", i );
+        snprintf( buff, sizeof( buff ), "d/f%d", i );
+        makeFile( s -> root, buff, i );
+        names[i] = paths[i];
+    }
+    names[ NUM_BATCH ] = "missing";
+    names[ NUM_BATCH + 1 ] = "..";
+
+    img = ufsHeaderInit( s -> img.name, sizes );
+    assert_non_null( img );
+    top = ufsStoreAddStorage( img, 0, "base", true );
+    loader = ufsScanLoaderCreate( img, top );
+    assert_non_null( loader );
+    assert_true( ufsScan( s -> root, options, ufsScanLoad, loader, NULL ) );
+    ufsScanLoaderFree( loader );
+    dir = ufsStoreGetStorage( img, top, "d" );
+    assert_true( dir > 0 );
+
+    base = ufsBaseOpen( s -> root, 0 );
+    assert_non_null( base );
+    assert_false( ufsBaseStatBatch( base, dir, names, 1, attrs, statuses ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_true( ufsBaseAttach( base, img, top, 0 ) );
+
+    assert_true( ufsBaseStatBatch( base, dir, names, NUM_BATCH + 2, attrs,
+                                   statuses ) );
+    for ( i = 0; i < NUM_BATCH; i++ ) {
+        assert_int_equal( statuses[i], UFS_NO_ERROR );
+        assert_int_equal( attrs[i].size, i );
+    }
+    assert_int_equal( statuses[ NUM_BATCH ], UFS_DOES_NOT_EXIST );
+    assert_int_equal( statuses[ NUM_BATCH + 1 ], UFS_BAD_CALL );
+
+    /* A batch takes a handful of calls on io_uring.                          */
+    ufsBaseGetStats( base, &stats );
+    assert_int_equal( stats.batched, NUM_BATCH + 1 );
+    assert_true( stats.enters <= NUM_BATCH / 8 );
+
+    assert_false( ufsBaseOpenBatch( base, dir, names, 1, O_CREAT, fds,
+                                    NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_true( ufsBaseOpenBatch( base, dir, names, NUM_BATCH + 2,
+                                   O_RDONLY, fds, statuses ) );
+    for ( i = 0; i < NUM_BATCH; i++ ) {
+        assert_true( fds[i] >= 0 );
+        assert_int_equal( lseek( fds[i], 0, SEEK_END ), i );
+        close( fds[i] );
+    }
+    assert_int_equal( fds[ NUM_BATCH ], -1 );
+    assert_int_equal( statuses[ NUM_BATCH ], UFS_DOES_NOT_EXIST );
+    assert_int_equal( fds[ NUM_BATCH + 1 ], -1 );
+
+    assert_true( ufsBaseReadDirectory( base, dir, countSink, counts ) );
+    assert_int_equal( counts[0], NUM_BATCH + 1 );
+    assert_int_equal( counts[1], NUM_BATCH * ( NUM_BATCH - 1 ) / 2 );
+    assert_int_equal( counts[2], 1 );
+    assert_false( ufsBaseReadDirectory( base, dir, stopSink, NULL ) );
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+    assert_false( ufsBaseReadDirectory( base, dir, NULL, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    ufsBaseClose( base );
+    ufsImageFree( img );
+}
+
+/* Directory times may only move on with the clock tick.                      */
+static void waitForTick( void ) {
+    struct timespec delay = { 0, 50000000 };
+
+    nanosleep( &delay, NULL );
+}
+
+static void test_ufs_base_index( void **state ) {
+    struct baseStateStruct *s;
+    struct ufsHeaderSizeRequestStruct sizes = bigSizeRequest;
+    struct ufsHeaderSizeRequestStruct indexSizes = indexSizeRequest;
+    struct ufsScanOptionsStruct options = { .numThreads = 2 };
+    struct ufsBaseAttrStruct attr;
+    struct ufsBaseStatsStruct stats;
+    char path[ UFS_TEST_UTILS_BUFF_SIZE * 2 ];
+    ufsIdType top, d, f, sub, h, *ids;
+    uint64_t numIds;
+    ufsImagePtr img;
+    ufsBasePtr base;
+
+    s = *state;
+    if ( !ufsTestUtilsLayoutSizes( &sizes ) ||
+         !ufsTestUtilsLayoutSizes( &indexSizes ) )
+        skip();
+
+    makeDir( s -> root, "d" );
+    makeDir( s -> root, "d/sub" );
+    makeFile( s -> root, "d/f", 3 );
+    makeFile( s -> root, "d/sub/g", 5 );
+
+    /* Images keep no index unless asked to.                                  */
+    img = ufsHeaderInit( s -> img.name, sizes );
+    assert_non_null( img );
+    assert_false( ufsBaseIndexHas( img ) );
+    assert_false( ufsBaseIndexLoad( img, 0, s -> root, options, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    ufsImageFree( img );
+    unlink( s -> img.name );
+
+    img = ufsHeaderInit( s -> img.name, indexSizes );
+    assert_non_null( img );
+    assert_true( ufsBaseIndexHas( img ) );
+    top = ufsStoreAddStorage( img, 0, "base", true );
+    assert_int_equal( ufsBaseIndexGet( img, top, NULL ),
+                      UFS_BASE_RECORD_UNKNOWN );
+    assert_true( ufsBaseIndexLoad( img, top, s -> root, options, NULL ) );
+
+    d = ufsStoreGetStorage( img, top, "d" );
+    f = ufsStoreGetStorage( img, d, "f" );
+    sub = ufsStoreGetStorage( img, d, "sub" );
+    assert_true( d > 0 && f > 0 && sub > 0 );
+    assert_int_equal( ufsBaseIndexGet( img, top, NULL ),
+                      UFS_BASE_RECORD_LISTED );
+    assert_int_equal( ufsBaseIndexGet( img, sub, NULL ),
+                      UFS_BASE_RECORD_LISTED );
+    assert_int_equal( ufsBaseIndexGet( img, f, &attr ),
+                      UFS_BASE_RECORD_PRESENT );
+    assert_int_equal( attr.size, 3 );
+    assert_true( S_ISREG( attr.mode ) );
+
+    assert_true( ufsBaseIndexList( img, d, &ids, &numIds ) );
+    assert_int_equal( numIds, 2 );
+    assert_true( ids[0] < ids[1] );
+    assert_true( ( ids[0] == f && ids[1] == sub ) ||
+                 ( ids[0] == sub && ids[1] == f ) );
+    free( ids );
+    assert_false( ufsBaseIndexList( img, f, &ids, &numIds ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* Lookups in clean directories never reach the external fs.              */
+    base = ufsBaseOpen( s -> root, 0 );
+    assert_non_null( base );
+    assert_true( ufsBaseAttach( base, img, top, 0 ) );
+    assert_true( ufsBaseStatAt( base, d, "f", &attr ) );
+    assert_int_equal( attr.size, 3 );
+    assert_false( ufsBaseStatAt( base, d, "nope", NULL ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_true( ufsBaseStatAt( base, sub, "g", &attr ) );
+    assert_int_equal( attr.size, 5 );
+    ufsBaseGetStats( base, &stats );
+    assert_int_equal( stats.indexed, 3 );
+    assert_int_equal( stats.dirty, 0 );
+
+    /* A changed directory is seen on its next check and refreshed.           */
+    waitForTick();
+    makeFile( s -> root, "d/h", 1 );
+    ufsBaseDropHandles( base );
+    assert_true( ufsBaseStatAt( base, d, "h", NULL ) );
+    assert_true( ufsBaseStatAt( base, sub, "g", NULL ) );
+    ufsBaseGetStats( base, &stats );
+    assert_int_equal( stats.indexed, 4 );
+    assert_int_equal( stats.dirty, 1 );
+
+    assert_true( ufsBaseRefresh( base, d ) );
+    h = ufsStoreGetStorage( img, d, "h" );
+    assert_true( h > 0 );
+    assert_int_equal( ufsBaseIndexGet( img, h, NULL ),
+                      UFS_BASE_RECORD_PRESENT );
+    assert_int_equal( ufsBaseIndexGet( img, sub, NULL ),
+                      UFS_BASE_RECORD_LISTED );
+    assert_true( ufsBaseStatAt( base, d, "h", NULL ) );
+    ufsBaseGetStats( base, &stats );
+    assert_int_equal( stats.indexed, 5 );
+
+    waitForTick();
+    snprintf( path, sizeof( path ), "%s/d/f", s -> root );
+    assert_int_equal( unlink( path ), 0 );
+    assert_true( ufsBaseRefresh( base, d ) );
+    assert_int_equal( ufsBaseIndexGet( img, f, NULL ),
+                      UFS_BASE_RECORD_ABSENT );
+    assert_false( ufsBaseStatAt( base, d, "f", NULL ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    ufsBaseGetStats( base, &stats );
+    assert_int_equal( stats.indexed, 6 );
+
+    assert_false( ufsBaseRefresh( base, 0 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsBaseIndexSet( img, top, UFS_BASE_RECORD_PRESENT,
+                                   NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    ufsBaseClose( base );
+    ufsImageFree( img );
+}
+
+static const struct CMUnitTest base_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_base_lookup, baseSetup, baseTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_base_evict, baseSetup, baseTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_base_handles, baseSetup, baseTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_base_batch, baseSetup, baseTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_base_index, baseSetup, baseTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(base_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
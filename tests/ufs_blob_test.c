@@ -0,0 +1,594 @@
+/******************************************************************************\
+*  ufs_blob_test.c                                                             *
+*                                                                              *
+*  Tests for the content addressed store of file data.                         *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ufs_blob.h"
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_store.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define BIG_SIZE (200000)
+#define NUM_REFS (10)
+#define AREA (3)
+
+struct blobStateStruct {
+    char root[ UFS_TEST_UTILS_BUFF_SIZE ],
+         store[ UFS_TEST_UTILS_BUFF_SIZE * 2 ];
+    int rootFd;
+};
+
+/* SHA-256 of "abc" and of nothing.                                           */
+static const uint8_t abcDigest[ UFS_BLOB_DIGEST_SIZE ] = {
+    0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde,
+    0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+    0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad
+};
+
+static const uint8_t emptyDigest[ UFS_BLOB_DIGEST_SIZE ] = {
+    0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14, 0x9a, 0xfb, 0xf4, 0xc8,
+    0x99, 0x6f, 0xb9, 0x24, 0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c,
+    0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55
+};
+
+static int removeEntry( const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw ) {
+    (void) st;
+    (void) flag;
+    (void) ftw;
+    return remove( path );
+}
+
+/* Writes len bytes of a pattern seeded by seed to name under the root.       */
+static int makeFile( struct blobStateStruct *s, const char *name,
+                     uint64_t len, uint8_t seed ) {
+    uint8_t *data;
+    uint64_t i;
+    int fd;
+
+    data = malloc( len + 1 );
+    if ( !data )
+        return -1;
+
+    for ( i = 0; i < len; i++ )
+        data[i] = (uint8_t)( i * 31 + seed );
+
+    fd = openat( s -> rootFd, name, O_RDWR | O_CREAT | O_TRUNC, 0600 );
+    if ( fd >= 0 && write( fd, data, len ) != (ssize_t) len ) {
+        close( fd );
+        fd = -1;
+    }
+
+    free( data );
+    return fd;
+}
+
+static int blobSetup( void **state ) {
+    struct blobStateStruct *s;
+    int fd;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s )
+        return -1;
+
+    snprintf( s -> root, sizeof( s -> root ), "/tmp/ufs_blob_XXXXXX" );
+    if ( !mkdtemp( s -> root ) )
+        return -1;
+
+    snprintf( s -> store, sizeof( s -> store ), "%s/store", s -> root );
+    s -> rootFd = open( s -> root, O_RDONLY | O_DIRECTORY );
+    if ( s -> rootFd < 0 )
+        return -1;
+
+    fd = openat( s -> rootFd, "abc", O_WRONLY | O_CREAT, 0600 );
+    if ( fd < 0 || write( fd, "abc", 3 ) != 3 )
+        return -1;
+    close( fd );
+
+    *state = s;
+    return 0;
+}
+
+static int blobTeardown( void **state ) {
+    struct blobStateStruct *s;
+
+    s = *state;
+    close( s -> rootFd );
+    nftw( s -> root, removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+/* ----- ufs_blob tests ----                                                  */
+
+static void test_ufs_blob_put( void **state ) {
+    struct blobStateStruct *s;
+    struct ufsBlobDigestStruct digest, other;
+    struct ufsBlobStatsStruct stats;
+    ufsBlobStorePtr store;
+    struct stat st;
+    int fd;
+
+    s = *state;
+    assert_null( ufsBlobOpen( NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    store = ufsBlobOpen( s -> store );
+    assert_non_null( store );
+
+    assert_false( ufsBlobPut( NULL, 0, &digest ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsBlobPut( store, -1, &digest ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    fd = openat( s -> rootFd, "abc", O_RDONLY );
+    assert_true( fd >= 0 );
+    assert_true( ufsBlobPut( store, fd, &digest ) );
+    assert_memory_equal( digest.bytes, abcDigest, UFS_BLOB_DIGEST_SIZE );
+    close( fd );
+
+    /* The blob is named by its digest and is read only.                      */
+    assert_int_equal( fstatat( s -> rootFd, "store/ba/7816bf8f01cfea414140de"
+                               "5dae2223b00361a396177a9cb410ff61f20015ad",
+                               &st, 0 ), 0 );
+    assert_int_equal( st.st_size, 3 );
+    assert_int_equal( st.st_mode & 0777, 0444 );
+
+    fd = makeFile( s, "empty", 0, 0 );
+    assert_true( fd >= 0 );
+    assert_true( ufsBlobPut( store, fd, &digest ) );
+    assert_memory_equal( digest.bytes, emptyDigest, UFS_BLOB_DIGEST_SIZE );
+    close( fd );
+
+    /* The same data under another name is found, not written again.          */
+    fd = makeFile( s, "big", BIG_SIZE, 1 );
+    assert_true( fd >= 0 );
+    assert_true( ufsBlobPut( store, fd, &digest ) );
+    close( fd );
+    fd = makeFile( s, "big2", BIG_SIZE, 1 );
+    assert_true( fd >= 0 );
+    assert_true( ufsBlobPut( store, fd, &other ) );
+    assert_memory_equal( digest.bytes, other.bytes, UFS_BLOB_DIGEST_SIZE );
+    close( fd );
+    fd = makeFile( s, "big3", BIG_SIZE, 2 );
+    assert_true( fd >= 0 );
+    assert_true( ufsBlobPut( store, fd, &other ) );
+    assert_memory_not_equal( digest.bytes, other.bytes, UFS_BLOB_DIGEST_SIZE );
+    close( fd );
+
+    assert_false( ufsBlobGetStats( store, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_true( ufsBlobGetStats( store, &stats ) );
+    assert_int_equal( stats.numBlobs, 4 );
+    assert_int_equal( stats.physicalBytes, 3 + 2 * BIG_SIZE );
+    assert_int_equal( stats.numRefs, 0 );
+    assert_int_equal( stats.puts, 5 );
+    assert_int_equal( stats.hits, 1 );
+
+    /* Nothing refers to them yet.                                            */
+    assert_false( ufsBlobCollect( NULL, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    ufsBlobClose( store );
+}
+
+static void test_ufs_blob_ref( void **state ) {
+    struct blobStateStruct *s;
+    struct ufsBlobDigestStruct digest, small, missing;
+    struct ufsBlobStatsStruct stats;
+    ufsBlobStorePtr store;
+    uint64_t removed;
+    struct stat st;
+    char buffer[8];
+    int fd, i;
+
+    s = *state;
+    store = ufsBlobOpen( s -> store );
+    assert_non_null( store );
+
+    fd = makeFile( s, "big", BIG_SIZE, 1 );
+    assert_true( fd >= 0 );
+    assert_true( ufsBlobPut( store, fd, &digest ) );
+    close( fd );
+    fd = openat( s -> rootFd, "abc", O_RDONLY );
+    assert_true( fd >= 0 );
+    assert_true( ufsBlobPut( store, fd, &small ) );
+    close( fd );
+
+    assert_false( ufsBlobRef( store, AREA, 0, &digest ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    memset( &missing, 0, sizeof( missing ) );
+    assert_false( ufsBlobRef( store, AREA, 1, &missing ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_int_equal( ufsBlobOpenFile( store, AREA, 1, false ), -1 );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    /* Every file shares the one inode.                                       */
+    for ( i = 1; i <= NUM_REFS; i++ )
+        assert_true( ufsBlobRef( store, AREA, i, &digest ) );
+    fd = ufsBlobOpenFile( store, AREA, NUM_REFS, false );
+    assert_true( fd >= 0 );
+    assert_int_equal( fstat( fd, &st ), 0 );
+    assert_int_equal( st.st_size, BIG_SIZE );
+    assert_int_equal( st.st_nlink, NUM_REFS + 1 );
+    assert_int_equal( pread( fd, buffer, 2, 1 ), 2 );
+    assert_int_equal( (uint8_t) buffer[0], 32 );
+    assert_int_equal( (uint8_t) buffer[1], 63 );
+    close( fd );
+
+    assert_true( ufsBlobGetStats( store, &stats ) );
+    assert_int_equal( stats.numRefs, NUM_REFS );
+    assert_int_equal( stats.numBlobs, 2 );
+    assert_int_equal( stats.numPrivate, 0 );
+    assert_int_equal( stats.logicalBytes, NUM_REFS * BIG_SIZE );
+    assert_int_equal( stats.physicalBytes, BIG_SIZE + 3 );
+    assert_int_equal( stats.dedupPercent,
+                      NUM_REFS * BIG_SIZE * 100 / ( BIG_SIZE + 3 ) );
+
+    /* A file given other data lets go of the old blob.                       */
+    assert_true( ufsBlobRef( store, AREA, 1, &small ) );
+    fd = ufsBlobOpenFile( store, AREA, 1, false );
+    assert_true( fd >= 0 );
+    assert_int_equal( read( fd, buffer, sizeof( buffer ) ), 3 );
+    assert_memory_equal( buffer, "abc", 3 );
+    close( fd );
+
+    for ( i = 2; i <= NUM_REFS; i++ )
+        assert_true( ufsBlobUnref( store, AREA, i ) );
+    assert_false( ufsBlobUnref( store, AREA, 2 ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    assert_true( ufsBlobCollect( store, &removed ) );
+    assert_int_equal( removed, 1 );
+    assert_false( ufsBlobRef( store, AREA, 2, &digest ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    assert_true( ufsBlobGetStats( store, &stats ) );
+    assert_int_equal( stats.numRefs, 1 );
+    assert_int_equal( stats.numBlobs, 1 );
+    assert_int_equal( stats.dedupPercent, 100 );
+
+    assert_true( ufsBlobUnref( store, AREA, 1 ) );
+    assert_true( ufsBlobCollect( store, &removed ) );
+    assert_int_equal( removed, 1 );
+    assert_true( ufsBlobGetStats( store, &stats ) );
+    assert_int_equal( stats.numBlobs, 0 );
+    assert_int_equal( stats.dedupPercent, 100 );
+    ufsBlobClose( store );
+}
+
+static void test_ufs_blob_reopen( void **state ) {
+    struct blobStateStruct *s;
+    struct ufsBlobDigestStruct digest;
+    struct ufsBlobStatsStruct stats;
+    ufsBlobStorePtr store;
+    int fd;
+
+    s = *state;
+    store = ufsBlobOpen( s -> store );
+    assert_non_null( store );
+    fd = openat( s -> rootFd, "abc", O_RDONLY );
+    assert_true( fd >= 0 );
+    assert_true( ufsBlobPut( store, fd, &digest ) );
+    close( fd );
+    assert_true( ufsBlobRef( store, AREA, 7, &digest ) );
+    ufsBlobClose( store );
+
+    /* A writer that didn't finish left a temporary file.                     */
+    fd = openat( s -> rootFd, "store/tmp/1.0", O_WRONLY | O_CREAT, 0444 );
+    assert_true( fd >= 0 );
+    close( fd );
+
+    store = ufsBlobOpen( s -> store );
+    assert_non_null( store );
+    assert_int_equal( faccessat( s -> rootFd, "store/tmp/1.0", F_OK, 0 ), -1 );
+    assert_true( ufsBlobGetStats( store, &stats ) );
+    assert_int_equal( stats.numRefs, 1 );
+    assert_int_equal( stats.numBlobs, 1 );
+    assert_int_equal( stats.puts, 0 );
+
+    fd = ufsBlobOpenFile( store, AREA, 7, false );
+    assert_true( fd >= 0 );
+    close( fd );
+    ufsBlobClose( store );
+    ufsBlobClose( NULL );
+
+    /* The store can't be put under a file.                                   */
+    snprintf( s -> store, sizeof( s -> store ), "%s/abc/store", s -> root );
+    assert_null( ufsBlobOpen( s -> store ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+}
+
+static void test_ufs_blob_copy_up( void **state ) {
+    struct blobStateStruct *s;
+    struct ufsBlobDigestStruct digest;
+    struct ufsBlobStatsStruct stats;
+    char path[ UFS_TEST_UTILS_BUFF_SIZE * 2 ], buffer[8];
+    ufsBlobStorePtr store;
+    ufsIdType area, file, other;
+    ufsImagePtr img;
+    struct stat st;
+    int src, fd, ro;
+
+    s = *state;
+    store = ufsBlobOpen( s -> store );
+    assert_non_null( store );
+    snprintf( path, sizeof( path ), "%s/img", s -> root );
+    img = ufsHeaderInit( path, ufsDefaultSizeRequest );
+    assert_non_null( img );
+    area = ufsStoreAddArea( img, "sandbox" );
+    assert_true( area > 0 );
+    file = ufsStoreAddStorage( img, 0, "big", false );
+    assert_true( file > 0 );
+    other = ufsStoreAddStorage( img, 0, "abc", false );
+    assert_true( other > 0 );
+
+    src = makeFile( s, "big", BIG_SIZE, 1 );
+    assert_true( src >= 0 );
+    assert_int_equal( ufsBlobCopyUp( NULL, img, area, file, src ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsBlobCopyUp( store, img, area, file, -1 ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsBlobCopyUp( store, img, area, file, s -> rootFd ),
+                      -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsStoreProbeMapping( img, area, file ) );
+
+    /* The copy is private and mapped, the source is left alone.              */
+    assert_int_equal( lseek( src, 5, SEEK_SET ), 5 );
+    fd = ufsBlobCopyUp( store, img, area, file, src );
+    assert_true( fd >= 0 );
+    assert_int_equal( lseek( src, 0, SEEK_CUR ), 5 );
+    assert_true( ufsStoreProbeMapping( img, area, file ) );
+    assert_int_equal( fstat( fd, &st ), 0 );
+    assert_int_equal( st.st_size, BIG_SIZE );
+    assert_int_equal( st.st_nlink, 1 );
+    assert_int_equal( pread( fd, buffer, 2, 1 ), 2 );
+    assert_int_equal( (uint8_t) buffer[0], 32 );
+    assert_int_equal( (uint8_t) buffer[1], 63 );
+    assert_int_equal( pwrite( fd, "xy", 2, 0 ), 2 );
+    assert_int_equal( pread( src, buffer, 1, 0 ), 1 );
+    assert_int_equal( buffer[0], 1 );
+    close( fd );
+    close( src );
+
+    fd = ufsBlobOpenFile( store, area, file, true );
+    assert_true( fd >= 0 );
+    assert_int_equal( pread( fd, buffer, 2, 0 ), 2 );
+    assert_memory_equal( buffer, "xy", 2 );
+    close( fd );
+
+    /* Data that's a blob is copied up before it's written.                   */
+    src = openat( s -> rootFd, "abc", O_RDONLY );
+    assert_true( src >= 0 );
+    assert_true( ufsBlobPut( store, src, &digest ) );
+    close( src );
+    assert_true( ufsBlobRef( store, area, other, &digest ) );
+    assert_int_equal( ufsBlobOpenFile( store, area, other, true ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    ro = ufsBlobOpenFile( store, area, other, false );
+    assert_true( ro >= 0 );
+    fd = ufsBlobCopyUp( store, img, area, other, ro );
+    assert_true( fd >= 0 );
+    assert_int_equal( fstat( ro, &st ), 0 );
+    assert_int_equal( st.st_nlink, 1 );
+    assert_int_equal( pwrite( fd, "xyz", 3, 0 ), 3 );
+    assert_int_equal( pread( ro, buffer, 3, 0 ), 3 );
+    assert_memory_equal( buffer, "abc", 3 );
+    close( ro );
+    close( fd );
+
+    /* A mapping that's there is kept.                                        */
+    src = ufsBlobOpenFile( store, area, file, false );
+    assert_true( src >= 0 );
+    fd = ufsBlobCopyUp( store, img, area, file, src );
+    assert_true( fd >= 0 );
+    close( fd );
+    close( src );
+
+    assert_true( ufsBlobGetStats( store, &stats ) );
+    assert_int_equal( stats.copyUps, 3 );
+    assert_true( stats.reflinks <= stats.copyUps );
+    assert_int_equal( stats.numRefs, 2 );
+    assert_int_equal( stats.numPrivate, 2 );
+    assert_int_equal( stats.logicalBytes, BIG_SIZE + 3 );
+
+    ufsImageFree( img );
+    ufsBlobClose( store );
+}
+
+static void test_ufs_blob_lazy( void **state ) {
+    struct blobStateStruct *s;
+    struct ufsBlobDigestStruct digest;
+    struct ufsBlobSegmentStruct segments[8];
+    struct ufsBlobStatsStruct stats;
+    char path[ UFS_TEST_UTILS_BUFF_SIZE * 2 ], buffer[16];
+    uint64_t numSegments;
+    ufsBlobStorePtr store;
+    ufsIdType area, file, other;
+    ufsBlobLazyPtr lazy;
+    ufsImagePtr img;
+    struct stat st;
+    int src, fd, dst;
+
+    s = *state;
+    store = ufsBlobOpen( s -> store );
+    assert_non_null( store );
+    snprintf( path, sizeof( path ), "%s/img", s -> root );
+    img = ufsHeaderInit( path, ufsDefaultSizeRequest );
+    assert_non_null( img );
+    area = ufsStoreAddArea( img, "sandbox" );
+    assert_true( area > 0 );
+    file = ufsStoreAddStorage( img, 0, "big", false );
+    assert_true( file > 0 );
+    other = ufsStoreAddStorage( img, 0, "abc", false );
+    assert_true( other > 0 );
+
+    src = makeFile( s, "big", BIG_SIZE, 1 );
+    assert_true( src >= 0 );
+    assert_null( ufsBlobLazyOpen( NULL, img, area, file, src ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_null( ufsBlobLazyOpen( store, img, area, file, -1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsStoreProbeMapping( img, area, file ) );
+
+    /* Nothing is copied, the data is sparse until it's written.              */
+    lazy = ufsBlobLazyOpen( store, img, area, file, src );
+    assert_non_null( lazy );
+    assert_true( ufsStoreProbeMapping( img, area, file ) );
+    assert_int_equal( ufsBlobOpenFile( store, area, file, false ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_true( ufsBlobLazyWrite( lazy, "xyz", 3, 1000 ) );
+    assert_true( ufsBlobLazyWrite( lazy, "tail", 4, BIG_SIZE + 6 ) );
+
+    /* Reads stitch the ranges written into the source.                       */
+    assert_int_equal( ufsBlobLazyRead( lazy, buffer, 5, 999 ), 5 );
+    assert_int_equal( (uint8_t) buffer[0], (uint8_t)( 999 * 31 + 1 ) );
+    assert_memory_equal( buffer + 1, "xyz", 3 );
+    assert_int_equal( (uint8_t) buffer[4], (uint8_t)( 1003 * 31 + 1 ) );
+    assert_int_equal( ufsBlobLazyRead( lazy, buffer, 16, BIG_SIZE + 2 ), 8 );
+    assert_memory_equal( buffer, "\0\0\0\0tail", 8 );
+
+    assert_true( ufsBlobLazyMap( lazy, 0, UINT64_MAX, segments, 8,
+                                 &numSegments ) );
+    assert_int_equal( numSegments, 4 );
+    assert_int_equal( segments[0].length, 1000 );
+    assert_int_equal( segments[1].offset, 1000 );
+    assert_int_equal( segments[1].length, 3 );
+    assert_int_equal( segments[2].fd, segments[0].fd );
+    assert_int_equal( segments[2].length, BIG_SIZE - 1003 );
+    assert_int_equal( segments[3].fd, segments[1].fd );
+    assert_int_equal( segments[3].offset, BIG_SIZE );
+    assert_int_equal( segments[3].length, 10 );
+    assert_true( ufsBlobLazyMap( lazy, 500, 1000, segments, 2,
+                                 &numSegments ) );
+    assert_int_equal( numSegments, 2 );
+    assert_int_equal( segments[0].offset, 500 );
+    assert_int_equal( segments[1].length, 3 );
+
+    /* Ranges that touch are merged, the log is compacted when it's closed.   */
+    assert_true( ufsBlobLazyWrite( lazy, "ab", 2, 1003 ) );
+    assert_true( ufsBlobLazyMap( lazy, 1000, 5, segments, 8,
+                                 &numSegments ) );
+    assert_int_equal( numSegments, 1 );
+    ufsBlobLazyClose( lazy, false );
+
+    /* The ranges are there when it's opened again, and can be applied to a   */
+    /* copy of the source.                                                    */
+    lazy = ufsBlobLazyOpen( store, img, area, file, src );
+    assert_non_null( lazy );
+    assert_int_equal( ufsBlobLazyRead( lazy, buffer, 5, 1000 ), 5 );
+    assert_memory_equal( buffer, "xyzab", 5 );
+    dst = makeFile( s, "dst", BIG_SIZE, 1 );
+    assert_true( dst >= 0 );
+    assert_true( ufsBlobLazyApply( lazy, dst ) );
+    assert_int_equal( fstat( dst, &st ), 0 );
+    assert_int_equal( st.st_size, BIG_SIZE + 10 );
+    assert_int_equal( pread( dst, buffer, 6, 999 ), 6 );
+    assert_int_equal( (uint8_t) buffer[0], (uint8_t)( 999 * 31 + 1 ) );
+    assert_memory_equal( buffer + 1, "xyzab", 5 );
+    close( dst );
+
+    /* Closing fills the gaps in the background, closing the store waits.     */
+    ufsBlobLazyClose( lazy, true );
+    close( src );
+    ufsBlobClose( store );
+    store = ufsBlobOpen( s -> store );
+    assert_non_null( store );
+    fd = ufsBlobOpenFile( store, area, file, false );
+    assert_true( fd >= 0 );
+    assert_int_equal( pread( fd, buffer, 6, 999 ), 6 );
+    assert_int_equal( (uint8_t) buffer[0], (uint8_t)( 999 * 31 + 1 ) );
+    assert_memory_equal( buffer + 1, "xyzab", 5 );
+    assert_int_equal( pread( fd, buffer, 1, BIG_SIZE - 1 ), 1 );
+    assert_int_equal( (uint8_t) buffer[0],
+                      (uint8_t)( ( BIG_SIZE - 1 ) * 31 + 1 ) );
+    close( fd );
+
+    /* Complete data gives a complete handle that needs no source.            */
+    lazy = ufsBlobLazyOpen( store, img, area, file, -1 );
+    assert_non_null( lazy );
+    assert_true( ufsBlobLazyComplete( lazy ) );
+    assert_true( ufsBlobLazyMap( lazy, 0, UINT64_MAX, segments, 8,
+                                 &numSegments ) );
+    assert_int_equal( numSegments, 1 );
+    assert_int_equal( segments[0].length, BIG_SIZE + 10 );
+    ufsBlobLazyClose( lazy, false );
+
+    /* A blob is its own source and is kept until the gaps are filled.        */
+    src = openat( s -> rootFd, "abc", O_RDONLY );
+    assert_true( src >= 0 );
+    assert_true( ufsBlobPut( store, src, &digest ) );
+    close( src );
+    assert_true( ufsBlobRef( store, area, other, &digest ) );
+    lazy = ufsBlobLazyOpen( store, img, area, other, -1 );
+    assert_non_null( lazy );
+    assert_true( ufsBlobLazyWrite( lazy, "X", 1, 1 ) );
+    assert_true( ufsBlobCollect( store, NULL ) );
+    ufsBlobLazyClose( lazy, false );
+    lazy = ufsBlobLazyOpen( store, img, area, other, -1 );
+    assert_non_null( lazy );
+    assert_int_equal( ufsBlobLazyRead( lazy, buffer, 8, 0 ), 3 );
+    assert_memory_equal( buffer, "aXc", 3 );
+    assert_true( ufsBlobLazyComplete( lazy ) );
+    ufsBlobLazyClose( lazy, false );
+
+    fd = ufsBlobOpenFile( store, area, other, true );
+    assert_true( fd >= 0 );
+    assert_int_equal( pread( fd, buffer, 8, 0 ), 3 );
+    assert_memory_equal( buffer, "aXc", 3 );
+    close( fd );
+
+    assert_true( ufsBlobGetStats( store, &stats ) );
+    assert_int_equal( stats.lazyCopyUps, 1 );
+    assert_int_equal( stats.numRefs, 2 );
+    assert_int_equal( stats.numPrivate, 2 );
+    assert_true( ufsBlobUnref( store, area, file ) );
+
+    ufsImageFree( img );
+    ufsBlobClose( store );
+}
+
+static const struct CMUnitTest blob_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_blob_put, blobSetup, blobTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_blob_ref, blobSetup, blobTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_blob_reopen, blobSetup, blobTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_blob_copy_up, blobSetup, blobTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_blob_lazy, blobSetup, blobTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(blob_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
@@ -0,0 +1,276 @@
+/******************************************************************************\
+*  ufs_budget_test.c                                                           *
+*                                                                              *
+*  Tests for the memory budget.                                                *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "ufs.h"
+#include "ufs_backend.h"
+#include "ufs_budget.h"
+#include "ufs_defs.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define REGION_BYTES (1 << 20)
+
+struct budgetStateStruct {
+    struct ufsTestUtilsFileNameStruct file;
+    char opts[ UFS_TEST_UTILS_BUFF_SIZE + 16 ];
+};
+
+struct fakeCacheStruct {
+    ufsBudgetPtr budget;
+    int64_t id;
+    uint64_t asked;
+};
+
+static int budgetSetup( void **state ) {
+    struct budgetStateStruct *s;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s || !ufsTestUtilsGetTmpFileName( &s -> file ) )
+        return -1;
+
+    snprintf( s -> opts, sizeof( s -> opts ), "path=%s", s -> file.name );
+    *state = s;
+    return 0;
+}
+
+static int budgetTeardown( void **state ) {
+    struct budgetStateStruct *s;
+
+    s = *state;
+    unlink( s -> file.name );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+/* Gives back what it's asked for, as far as it holds it.                     */
+static uint64_t fakeShrink( void *cache, uint64_t bytes ) {
+    struct fakeCacheStruct *fake = cache;
+    uint64_t held;
+
+    held = ufsBudgetUsage( fake -> budget, fake -> id );
+    if ( bytes > held )
+        bytes = held;
+
+    fake -> asked += bytes;
+    ufsBudgetCharge( fake -> budget, fake -> id, -(int64_t) bytes );
+    return bytes;
+}
+
+/* Counters are single digits, a single write of the same length replaces     */
+/* them so the monitor never reads half a file.                               */
+static void writeEvents( const char *path, int high, int max ) {
+    char buff[ 64 ];
+    int fd, size;
+
+    size = snprintf( buff, sizeof( buff ),
+                     "low 0\nhigh %d\nmax %d\noom 0\noom_kill 0\n", high, max );
+    fd = open( path, O_WRONLY | O_CREAT, 0600 );
+    assert_true( fd >= 0 );
+    assert_int_equal( pwrite( fd, buff, size, 0 ), size );
+    close( fd );
+}
+
+/* Waits up to 5s for the monitor to bring the total to at most usage.        */
+static bool waitForUsage( ufsBudgetPtr budget, uint64_t usage ) {
+    struct timespec delay = { 0, 1000000 };
+    int i;
+
+    for ( i = 0; i < 5000; i++ ) {
+        if ( ufsBudgetUsage( budget, -1 ) <= usage )
+            return true;
+        nanosleep( &delay, NULL );
+    }
+
+    return false;
+}
+
+/* ----- ufs_budget tests ----                                                */
+
+static void test_ufs_budget_shrink( void **state ) {
+    struct budgetStateStruct *s;
+    struct fakeCacheStruct a = { 0 }, b = { 0 };
+    struct ufsBudgetStatsStruct stats;
+    ufsBudgetPtr budget;
+    int64_t pinned;
+    uint64_t released;
+    uint8_t *region;
+    int fd, i;
+
+    s = *state;
+
+    budget = ufsBudgetCreate( 1000 );
+    assert_non_null( budget );
+    assert_int_equal( ufsBudgetRegister( NULL, "a", NULL, NULL ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    a.budget = b.budget = budget;
+    a.id = ufsBudgetRegister( budget, "a", fakeShrink, &a );
+    b.id = ufsBudgetRegister( budget, "b", fakeShrink, &b );
+    pinned = ufsBudgetRegister( budget, "pinned", NULL, NULL );
+    assert_true( a.id >= 0 && b.id >= 0 && pinned >= 0 );
+
+    assert_true( ufsBudgetCharge( budget, a.id, 600 ) );
+    assert_true( ufsBudgetCharge( budget, b.id, 200 ) );
+    assert_true( ufsBudgetCharge( budget, pinned, 100 ) );
+    assert_false( ufsBudgetCharge( budget, a.id, 300 ) );
+    assert_int_equal( ufsBudgetUsage( budget, -1 ), 1200 );
+
+    /* A quarter of what shrinkable caches hold, in proportion.               */
+    released = ufsBudgetRelieve( budget, false );
+    assert_int_equal( released, a.asked + b.asked );
+    assert_true( released >= 275 && released < 300 );
+    assert_true( a.asked > 4 * b.asked - 8 && a.asked < 5 * b.asked );
+    assert_int_equal( ufsBudgetUsage( budget, pinned ), 100 );
+    assert_int_equal( ufsBudgetUsage( budget, -1 ), 1200 - released );
+
+    /* Severe pressure empties them, regions are paged out and read back.     */
+    fd = open( s -> file.name, O_RDWR | O_CREAT | O_TRUNC, 0600 );
+    assert_true( fd >= 0 );
+    assert_int_equal( ftruncate( fd, REGION_BYTES ), 0 );
+    region = mmap( NULL, REGION_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0 );
+    assert_true( region != MAP_FAILED );
+    close( fd );
+    for ( i = 0; i < REGION_BYTES; i++ )
+        region[i] = i % 251;
+    assert_true( ufsBudgetAddRegion( budget, region, REGION_BYTES ) );
+
+    ufsBudgetRelieve( budget, true );
+    assert_int_equal( ufsBudgetUsage( budget, a.id ), 0 );
+    assert_int_equal( ufsBudgetUsage( budget, b.id ), 0 );
+    assert_int_equal( ufsBudgetUsage( budget, -1 ), 100 );
+    for ( i = 0; i < REGION_BYTES; i++ )
+        assert_int_equal( region[i], i % 251 );
+
+    ufsBudgetGetStats( budget, &stats );
+    assert_int_equal( stats.moderate, 1 );
+    assert_int_equal( stats.severe, 1 );
+    assert_int_equal( stats.released, 1100 );
+
+    ufsBudgetRemoveRegion( budget, region );
+    munmap( region, REGION_BYTES );
+    ufsBudgetUnregister( budget, pinned );
+    assert_int_equal( ufsBudgetUsage( budget, -1 ), 0 );
+    ufsBudgetUnregister( budget, a.id );
+    ufsBudgetUnregister( budget, b.id );
+    ufsBudgetDestroy( budget );
+}
+
+static void test_ufs_budget_watch( void **state ) {
+    struct budgetStateStruct *s;
+    struct fakeCacheStruct a = { 0 };
+    struct ufsBudgetStatsStruct stats;
+    struct timespec delay = { 0, 1000000 };
+    ufsBudgetPtr budget;
+    int i;
+
+    s = *state;
+    writeEvents( s -> file.name, 3, 0 );
+
+    budget = ufsBudgetCreate( 1000 );
+    assert_non_null( budget );
+    a.budget = budget;
+    a.id = ufsBudgetRegister( budget, "a", fakeShrink, &a );
+
+    assert_false( ufsBudgetWatch( budget, NULL, NULL, 0 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_true( ufsBudgetWatch( budget, "/does/not/exist", s -> file.name,
+                                 10 ) );
+    assert_false( ufsBudgetWatch( budget, NULL, NULL, 10 ) );
+
+    /* Going over the limit wakes the monitor, the "high" events from         */
+    /* before it started don't count.                                         */
+    assert_false( ufsBudgetCharge( budget, a.id, 2000 ) );
+    assert_true( waitForUsage( budget, 1000 ) );
+    ufsBudgetGetStats( budget, &stats );
+    assert_int_equal( stats.moderate + stats.severe, 0 );
+
+    ufsBudgetCharge( budget, a.id,
+                     800 - (int64_t) ufsBudgetUsage( budget, a.id ) );
+    writeEvents( s -> file.name, 4, 0 );
+    assert_true( waitForUsage( budget, 600 ) );
+
+    writeEvents( s -> file.name, 4, 1 );
+    assert_true( waitForUsage( budget, 0 ) );
+    for ( i = 0; i < 5000 && !stats.severe; i++ ) {
+        nanosleep( &delay, NULL );
+        ufsBudgetGetStats( budget, &stats );
+    }
+    assert_int_equal( stats.moderate, 1 );
+    assert_int_equal( stats.severe, 1 );
+
+    ufsBudgetDestroy( budget );
+}
+
+static void test_ufs_budget_scratch( void **state ) {
+    struct budgetStateStruct *s;
+    ufsIdentifierType dir, file, scratch;
+    ufsBudgetPtr budget;
+    ufsType ufs;
+    uint64_t before;
+
+    s = *state;
+    budget = ufsBudgetGlobal();
+    assert_non_null( budget );
+    assert_ptr_equal( ufsBudgetGlobal(), budget );
+    before = ufsBudgetUsage( budget, -1 );
+
+    ufs = ufsInitWithBackend( "image", s -> opts );
+    assert_non_null( ufs );
+    dir = ufsAddDirectory( ufs, "/d" );
+    file = ufsAddFile( ufs, dir, "f" );
+    scratch = ufsAddScratchArea( ufs, "scratch" );
+    assert_true( file > 0 && scratch > 0 );
+
+    /* Scratch areas are charged to the global budget.                        */
+    assert_int_equal( ufsAddMapping( ufs, scratch, file ), UFS_NO_ERROR );
+    assert_true( ufsBudgetUsage( budget, -1 ) > before );
+    assert_true( ufsPersistArea( ufs, scratch ) > 0 );
+    assert_int_equal( ufsBudgetUsage( budget, -1 ), before );
+
+    scratch = ufsAddScratchArea( ufs, "again" );
+    assert_int_equal( ufsAddMapping( ufs, scratch, file ), UFS_NO_ERROR );
+    ufsDestroy( ufs );
+    assert_int_equal( ufsBudgetUsage( budget, -1 ), before );
+}
+
+static const struct CMUnitTest budget_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_budget_shrink, budgetSetup, budgetTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_budget_watch, budgetSetup, budgetTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_budget_scratch, budgetSetup, budgetTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(budget_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
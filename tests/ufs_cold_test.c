@@ -0,0 +1,516 @@
+/******************************************************************************\
+*  ufs_cold_test.c                                                             *
+*                                                                              *
+*  Tests for the LZ codec and the store compressing data of cold areas.        *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ufs_cold.h"
+#include "ufs_defs.h"
+#include "ufs_extent.h"
+#include "ufs_header.h"
+#include "ufs_lz.h"
+#include "ufs_store.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define NUM_EXTENTS (64)
+#define NUM_THREADS (4)
+/* Five blocks and a bit.                                                     */
+#define BIG_SIZE ( 5 * UFS_COLD_BLOCK + 1000 )
+
+struct coldStateStruct {
+    char root[ UFS_TEST_UTILS_BUFF_SIZE ],
+         extents[ UFS_TEST_UTILS_BUFF_SIZE * 2 ],
+         cold[ UFS_TEST_UTILS_BUFF_SIZE * 2 ],
+         image[ UFS_TEST_UTILS_BUFF_SIZE * 2 ];
+};
+
+static int removeEntry( const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw ) {
+    (void) st;
+    (void) flag;
+    (void) ftw;
+    return remove( path );
+}
+
+/* Text like data, a few words repeated in an order that doesn't repeat.      */
+static void fillText( uint8_t *data, uint64_t len, uint32_t seed ) {
+    static const char *words[] = { "union ", "area ", "file ", "mapping ",
+                                   "extent ", "frame ", "block ", "cold " };
+    const char *word;
+    uint64_t i;
+
+    for ( i = 0; i < len; ) {
+        seed = seed * 1103515245 + 12345;
+        for ( word = words[ ( seed >> 16 ) % 8 ]; *word && i < len; )
+            data[ i++ ] = *word++;
+    }
+}
+
+static void fillRandom( uint8_t *data, uint64_t len, uint64_t seed ) {
+    uint64_t i;
+
+    for ( i = 0; i < len; i++ ) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        data[i] = seed;
+    }
+}
+
+static int coldSetup( void **state ) {
+    struct ufsHeaderSizeRequestStruct sizes;
+    struct coldStateStruct *s;
+    ufsImagePtr img;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s )
+        return -1;
+
+    snprintf( s -> root, sizeof( s -> root ), "/tmp/ufs_cold_XXXXXX" );
+    if ( !mkdtemp( s -> root ) )
+        return -1;
+
+    snprintf( s -> extents, sizeof( s -> extents ), "%s/extents", s -> root );
+    snprintf( s -> cold, sizeof( s -> cold ), "%s/cold", s -> root );
+    snprintf( s -> image, sizeof( s -> image ), "%s/image", s -> root );
+
+    sizes = ufsDefaultSizeRequest;
+    sizes.numExtents = NUM_EXTENTS;
+    img = ufsHeaderInit( s -> image, sizes );
+    if ( !img )
+        return -1;
+
+    ufsImageFree( img );
+    *state = s;
+    return 0;
+}
+
+static int coldTeardown( void **state ) {
+    struct coldStateStruct *s;
+
+    s = *state;
+    nftw( s -> root, removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+/* ----- ufs_lz tests ----                                                    */
+
+static void test_ufs_lz_round_trip( void **state ) {
+    uint8_t src[ UFS_COLD_BLOCK ], packed[ UFS_COLD_BLOCK ],
+            out[ UFS_COLD_BLOCK ];
+    uint64_t size;
+
+    (void) state;
+
+    fillText( src, sizeof( src ), 1 );
+    size = ufsLzCompress( src, sizeof( src ), packed, sizeof( src ) - 1 );
+    assert_true( size > 0 && size < sizeof( src ) / 2 );
+    assert_int_equal( ufsLzDecompress( packed, size, out, sizeof( out ) ),
+                      sizeof( src ) );
+    assert_memory_equal( src, out, sizeof( src ) );
+
+    /* Runs are matches overlapping what they write.                          */
+    memset( src, 'a', sizeof( src ) );
+    size = ufsLzCompress( src, sizeof( src ), packed, sizeof( src ) - 1 );
+    assert_true( size > 0 && size < 512 );
+    assert_int_equal( ufsLzDecompress( packed, size, out, sizeof( out ) ),
+                      sizeof( src ) );
+    assert_memory_equal( src, out, sizeof( src ) );
+
+    /* Short and empty buffers are literals only.                             */
+    size = ufsLzCompress( "abc", 3, packed, sizeof( packed ) );
+    assert_int_equal( size, 4 );
+    assert_int_equal( ufsLzDecompress( packed, size, out, 3 ), 3 );
+    assert_memory_equal( out, "abc", 3 );
+    size = ufsLzCompress( src, 0, packed, sizeof( packed ) );
+    assert_int_equal( size, 1 );
+    assert_int_equal( ufsLzDecompress( packed, size, out, 0 ), 0 );
+
+    /* Random data doesn't shrink, asking it to fails.                        */
+    fillRandom( src, sizeof( src ), 42 );
+    assert_int_equal( ufsLzCompress( src, sizeof( src ), packed,
+                                     sizeof( src ) - 1 ), 0 );
+    assert_int_equal( ufsErrno, UFS_NO_ERROR );
+}
+
+static void test_ufs_lz_corrupted( void **state ) {
+    uint8_t src[ 4096 ], packed[ 4096 ], out[ 4096 ];
+    uint64_t size;
+
+    (void) state;
+
+    fillText( src, sizeof( src ), 2 );
+    size = ufsLzCompress( src, sizeof( src ), packed, sizeof( packed ) );
+    assert_true( size > 0 );
+
+    /* Too little room, a truncated buffer and an offset before the start.    */
+    assert_int_equal( ufsLzDecompress( packed, size, out, 100 ), -1 );
+    assert_int_equal( ufsErrno, UFS_STREAM_IS_CORRUPTED );
+    assert_int_equal( ufsLzDecompress( packed, size - 1, out, sizeof( out ) ),
+                      -1 );
+
+    packed[0] = 0x10;
+    packed[1] = 'x';
+    packed[2] = 0x05;
+    packed[3] = 0x00;
+    assert_int_equal( ufsLzDecompress( packed, 4, out, sizeof( out ) ), -1 );
+    assert_int_equal( ufsErrno, UFS_STREAM_IS_CORRUPTED );
+
+    assert_int_equal( ufsLzDecompress( NULL, 1, out, 1 ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+}
+
+/* ----- ufs_cold tests ----                                                  */
+
+static void test_ufs_cold_compress_read( void **state ) {
+    struct coldStateStruct *s;
+    struct ufsColdStatsStruct stats;
+    uint8_t *data, *buf;
+    uint64_t off;
+
+    s = *state;
+    ufsImagePtr img = ufsHeaderValidate( ufsImageOpen( s -> image ) );
+    assert_non_null( img );
+    ufsExtentStorePtr extents = ufsExtentOpen( s -> extents, img );
+    assert_non_null( extents );
+    ufsColdStorePtr store = ufsColdOpen( s -> cold, img, extents,
+                                         NUM_THREADS );
+    assert_non_null( store );
+
+    ufsIdType area = ufsStoreAddArea( img, "old" );
+    ufsIdType file = ufsStoreAddStorage( img, 0, "log", false );
+    assert_true( area > 0 && file > 0 );
+
+    data = malloc( BIG_SIZE );
+    buf = malloc( BIG_SIZE );
+    assert_non_null( data );
+    assert_non_null( buf );
+    fillText( data, BIG_SIZE, 3 );
+    assert_true( ufsColdWrite( store, area, file, data, BIG_SIZE, 0 ) );
+    assert_false( ufsColdIsCold( store, area, file ) );
+
+    assert_true( ufsColdCompress( store, area, file ) > BIG_SIZE / 2 );
+    assert_true( ufsColdIsCold( store, area, file ) );
+    assert_int_equal( ufsExtentGetSize( extents, area, file ), 0 );
+    assert_int_equal( ufsColdGetSize( store, area, file ), BIG_SIZE );
+    assert_int_equal( ufsColdCompress( store, area, file ), -1 );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    /* Reads within a block, across blocks and past the end.                  */
+    assert_int_equal( ufsColdRead( store, area, file, buf, 10, 100 ), 10 );
+    assert_memory_equal( buf, data + 100, 10 );
+    assert_int_equal( ufsColdRead( store, area, file, buf, 3 * UFS_COLD_BLOCK,
+                                   UFS_COLD_BLOCK - 7 ), 3 * UFS_COLD_BLOCK );
+    assert_memory_equal( buf, data + UFS_COLD_BLOCK - 7, 3 * UFS_COLD_BLOCK );
+    assert_int_equal( ufsColdRead( store, area, file, buf, BIG_SIZE,
+                                   BIG_SIZE - 5 ), 5 );
+    assert_memory_equal( buf, data + BIG_SIZE - 5, 5 );
+    assert_int_equal( ufsColdRead( store, area, file, buf, 1, BIG_SIZE ), 0 );
+
+    assert_true( ufsColdGetStats( store, &stats ) );
+    assert_int_equal( stats.numFrames, 1 );
+    assert_int_equal( stats.logicalBytes, BIG_SIZE );
+    assert_true( stats.physicalBytes < BIG_SIZE / 2 );
+    assert_int_equal( stats.compressed, 1 );
+    assert_true( stats.parallelReads >= 1 );
+    assert_true( stats.cacheHits >= 1 );
+
+    /* A sequential read brings the blocks after it into the cache.           */
+    ufsColdClose( store );
+    store = ufsColdOpen( s -> cold, img, extents, NUM_THREADS );
+    assert_non_null( store );
+    assert_int_equal( ufsColdRead( store, area, file, buf, 4096, 0 ), 4096 );
+    for ( off = 4096; off < BIG_SIZE; off += 4096 )
+        assert_int_equal( ufsColdRead( store, area, file, buf + off, 4096,
+                                       off ),
+                          off + 4096 < BIG_SIZE ? 4096 : BIG_SIZE - off );
+    assert_memory_equal( buf, data, BIG_SIZE );
+    assert_true( ufsColdGetStats( store, &stats ) );
+    assert_int_equal( stats.decompressed, 6 );
+    assert_int_equal( stats.parallelReads, 1 );
+
+    free( data );
+    free( buf );
+    ufsColdClose( store );
+    ufsExtentClose( extents );
+    ufsImageFree( img );
+}
+
+static void test_ufs_cold_thaw( void **state ) {
+    struct coldStateStruct *s;
+    struct ufsColdStatsStruct stats;
+    uint8_t *data, *buf;
+
+    s = *state;
+    ufsImagePtr img = ufsHeaderValidate( ufsImageOpen( s -> image ) );
+    assert_non_null( img );
+    ufsExtentStorePtr extents = ufsExtentOpen( s -> extents, img );
+    assert_non_null( extents );
+    ufsColdStorePtr store = ufsColdOpen( s -> cold, img, extents, 1 );
+    assert_non_null( store );
+
+    ufsIdType area = ufsStoreAddArea( img, "old" );
+    ufsIdType file = ufsStoreAddStorage( img, 0, "log", false );
+    ufsIdType noise = ufsStoreAddStorage( img, 0, "noise", false );
+    assert_true( area > 0 && file > 0 && noise > 0 );
+
+    data = malloc( BIG_SIZE );
+    buf = malloc( BIG_SIZE );
+    assert_non_null( data );
+    assert_non_null( buf );
+
+    /* Data that doesn't compress stays in its extents.                       */
+    fillRandom( data, BIG_SIZE, 7 );
+    assert_true( ufsColdWrite( store, area, noise, data, BIG_SIZE, 0 ) );
+    assert_int_equal( ufsColdCompress( store, area, noise ), 0 );
+    assert_false( ufsColdIsCold( store, area, noise ) );
+    assert_int_equal( ufsColdRead( store, area, noise, buf, BIG_SIZE, 0 ),
+                      BIG_SIZE );
+    assert_memory_equal( buf, data, BIG_SIZE );
+
+    /* Writing to a cold file thaws it first.                                 */
+    fillText( data, BIG_SIZE, 5 );
+    assert_true( ufsColdWrite( store, area, file, data, BIG_SIZE, 0 ) );
+    assert_true( ufsColdCompress( store, area, file ) > 0 );
+    memcpy( data + UFS_COLD_BLOCK, "thawed", 6 );
+    assert_true( ufsColdWrite( store, area, file, "thawed", 6,
+                               UFS_COLD_BLOCK ) );
+    assert_false( ufsColdIsCold( store, area, file ) );
+    assert_int_equal( ufsExtentGetSize( extents, area, file ), BIG_SIZE );
+    assert_int_equal( ufsColdRead( store, area, file, buf, BIG_SIZE, 0 ),
+                      BIG_SIZE );
+    assert_memory_equal( buf, data, BIG_SIZE );
+
+    assert_true( ufsColdCompress( store, area, file ) > 0 );
+    assert_true( ufsColdThaw( store, area, file ) );
+    assert_false( ufsColdThaw( store, area, file ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_int_equal( ufsColdRead( store, area, file, buf, BIG_SIZE, 0 ),
+                      BIG_SIZE );
+    assert_memory_equal( buf, data, BIG_SIZE );
+
+    /* Removing drops both the frame and the extents.                         */
+    assert_true( ufsColdCompress( store, area, file ) > 0 );
+    assert_true( ufsColdRemove( store, area, file ) );
+    assert_int_equal( ufsColdGetSize( store, area, file ), 0 );
+    assert_false( ufsColdRemove( store, area, file ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    assert_true( ufsColdGetStats( store, &stats ) );
+    assert_int_equal( stats.numFrames, 0 );
+    assert_int_equal( stats.compressed, 3 );
+    assert_int_equal( stats.thawed, 2 );
+    assert_int_equal( stats.incompressible, 1 );
+
+    free( data );
+    free( buf );
+    ufsColdClose( store );
+    ufsExtentClose( extents );
+    ufsImageFree( img );
+}
+
+static void test_ufs_cold_tier( void **state ) {
+    struct coldStateStruct *s;
+    uint8_t data[ 3 * UFS_COLD_BLOCK ];
+    int i;
+
+    s = *state;
+    ufsImagePtr img = ufsHeaderValidate( ufsImageOpen( s -> image ) );
+    assert_non_null( img );
+    ufsExtentStorePtr extents = ufsExtentOpen( s -> extents, img );
+    assert_non_null( extents );
+    ufsColdStorePtr store = ufsColdOpen( s -> cold, img, extents, 2 );
+    assert_non_null( store );
+
+    ufsIdType old = ufsStoreAddArea( img, "old" );
+    ufsIdType hot = ufsStoreAddArea( img, "hot" );
+    ufsIdType a = ufsStoreAddStorage( img, 0, "a", false );
+    ufsIdType b = ufsStoreAddStorage( img, 0, "b", false );
+    assert_true( old > 0 && hot > 0 && a > 0 && b > 0 );
+
+    fillText( data, sizeof( data ), 9 );
+    assert_true( ufsColdWrite( store, old, a, data, sizeof( data ), 0 ) );
+    assert_true( ufsColdWrite( store, old, b, data, sizeof( data ), 0 ) );
+    assert_true( ufsColdWrite( store, hot, a, data, sizeof( data ), 0 ) );
+
+    /* Everything was just used.                                              */
+    assert_int_equal( ufsColdTier( store, 3600 ), 0 );
+    assert_int_equal( ufsColdTier( store, 0 ), 3 );
+    assert_true( ufsColdIsCold( store, old, a ) );
+    assert_true( ufsColdIsCold( store, old, b ) );
+    assert_true( ufsColdIsCold( store, hot, a ) );
+    assert_int_equal( ufsColdTier( store, 0 ), 0 );
+
+    /* The background job finds what a write thawed.                          */
+    assert_true( ufsColdWrite( store, hot, a, "x", 1, 0 ) );
+    assert_false( ufsColdIsCold( store, hot, a ) );
+    assert_true( ufsColdStart( store, 0, 10 ) );
+    assert_false( ufsColdStart( store, 0, 10 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    for ( i = 0; i < 500 && !ufsColdIsCold( store, hot, a ); i++ )
+        usleep( 10000 );
+    assert_true( ufsColdIsCold( store, hot, a ) );
+
+    ufsColdClose( store );
+    ufsExtentClose( extents );
+    ufsImageFree( img );
+}
+
+static void test_ufs_cold_reopen( void **state ) {
+    char path[ UFS_TEST_UTILS_BUFF_SIZE * 4 ];
+    struct coldStateStruct *s;
+    struct ufsColdStatsStruct stats;
+    uint8_t data[ 2 * UFS_COLD_BLOCK ], buf[ 2 * UFS_COLD_BLOCK ];
+    int fd;
+
+    s = *state;
+    ufsImagePtr img = ufsHeaderValidate( ufsImageOpen( s -> image ) );
+    assert_non_null( img );
+    ufsExtentStorePtr extents = ufsExtentOpen( s -> extents, img );
+    assert_non_null( extents );
+    ufsColdStorePtr store = ufsColdOpen( s -> cold, img, extents, 2 );
+    assert_non_null( store );
+
+    ufsIdType area = ufsStoreAddArea( img, "old" );
+    ufsIdType a = ufsStoreAddStorage( img, 0, "a", false );
+    ufsIdType b = ufsStoreAddStorage( img, 0, "b", false );
+    assert_true( area > 0 && a > 0 && b > 0 );
+
+    fillText( data, sizeof( data ), 11 );
+    assert_true( ufsColdWrite( store, area, a, data, sizeof( data ), 0 ) );
+    assert_true( ufsColdWrite( store, area, b, data, sizeof( data ), 0 ) );
+    assert_int_equal( ufsColdTier( store, 0 ), 2 );
+    ufsColdClose( store );
+
+    /* A crash after the rename leaves the extents, a crash before it a       */
+    /* temporary file. b's mapping went while the store was closed.           */
+    assert_true( ufsExtentWrite( extents, area, a, data, sizeof( data ), 0 ) );
+    snprintf( path, sizeof( path ), "%s/%ld/%ld.7.tmp", s -> cold,
+              (long) area, (long) a );
+    fd = open( path, O_WRONLY | O_CREAT, 0644 );
+    assert_true( fd >= 0 );
+    close( fd );
+    assert_true( ufsStoreRemoveMapping( img, area, b ) );
+
+    store = ufsColdOpen( s -> cold, img, extents, 2 );
+    assert_non_null( store );
+    assert_true( ufsColdIsCold( store, area, a ) );
+    assert_false( ufsColdIsCold( store, area, b ) );
+    assert_int_equal( ufsExtentGetSize( extents, area, a ), 0 );
+    assert_int_equal( access( path, F_OK ), -1 );
+    assert_int_equal( ufsColdRead( store, area, a, buf, sizeof( buf ), 0 ),
+                      sizeof( buf ) );
+    assert_memory_equal( buf, data, sizeof( buf ) );
+    assert_true( ufsColdGetStats( store, &stats ) );
+    assert_int_equal( stats.numFrames, 1 );
+    ufsColdClose( store );
+
+    /* A damaged frame fails the open.                                        */
+    snprintf( path, sizeof( path ), "%s/%ld/%ld", s -> cold, (long) area,
+              (long) a );
+    assert_int_equal( chmod( path, 0644 ), 0 );
+    assert_int_equal( truncate( path, 100 ), 0 );
+    assert_null( ufsColdOpen( s -> cold, img, extents, 2 ) );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_CORRUPTED );
+
+    assert_null( ufsColdOpen( s -> cold, img, extents, 0 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    ufsExtentClose( extents );
+    ufsImageFree( img );
+}
+
+static void test_ufs_cold_reuse( void **state ) {
+    struct coldStateStruct *s;
+    uint8_t data[ 2 * UFS_COLD_BLOCK ], buf[ 2 * UFS_COLD_BLOCK ];
+
+    s = *state;
+    ufsImagePtr img = ufsHeaderValidate( ufsImageOpen( s -> image ) );
+    assert_non_null( img );
+    ufsExtentStorePtr extents = ufsExtentOpen( s -> extents, img );
+    assert_non_null( extents );
+    ufsColdStorePtr store = ufsColdOpen( s -> cold, img, extents, 2 );
+    assert_non_null( store );
+
+    ufsIdType area = ufsStoreAddArea( img, "old" );
+    ufsIdType file = ufsStoreAddStorage( img, 0, "a", false );
+    assert_true( area > 0 && file > 0 );
+
+    /* Removing the file drops its frame, the next one under its identifier   */
+    /* starts hot and empty.                                                  */
+    fillText( data, sizeof( data ), 5 );
+    assert_true( ufsColdWrite( store, area, file, data, sizeof( data ), 0 ) );
+    assert_true( ufsColdCompress( store, area, file ) > 0 );
+    assert_true( ufsStoreRemoveStorage( img, file ) );
+    assert_int_equal( ufsStoreAddStorage( img, 0, "b", false ), file );
+    assert_false( ufsColdIsCold( store, area, file ) );
+    assert_int_equal( ufsColdGetSize( store, area, file ), 0 );
+
+    /* A frame left by a removal while the store was closed is dropped on     */
+    /* open, the new file keeps its extents.                                  */
+    assert_true( ufsColdWrite( store, area, file, data, sizeof( data ), 0 ) );
+    assert_true( ufsColdCompress( store, area, file ) > 0 );
+    ufsColdClose( store );
+    assert_true( ufsStoreRemoveStorage( img, file ) );
+    assert_int_equal( ufsStoreAddStorage( img, 0, "c", false ), file );
+    fillText( data, sizeof( data ), 6 );
+    assert_true( ufsExtentWrite( extents, area, file, data, sizeof( data ),
+                                 0 ) );
+
+    store = ufsColdOpen( s -> cold, img, extents, 2 );
+    assert_non_null( store );
+    assert_false( ufsColdIsCold( store, area, file ) );
+    assert_int_equal( ufsExtentGetSize( extents, area, file ), sizeof( data ) );
+    assert_int_equal( ufsColdRead( store, area, file, buf, sizeof( buf ), 0 ),
+                      sizeof( buf ) );
+    assert_memory_equal( buf, data, sizeof( buf ) );
+
+    ufsColdClose( store );
+    ufsExtentClose( extents );
+    ufsImageFree( img );
+}
+
+static const struct CMUnitTest cold_tests[] = {
+    cmocka_unit_test(test_ufs_lz_round_trip),
+    cmocka_unit_test(test_ufs_lz_corrupted),
+    cmocka_unit_test_setup_teardown(test_ufs_cold_compress_read, coldSetup, coldTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_cold_thaw, coldSetup, coldTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_cold_tier, coldSetup, coldTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_cold_reopen, coldSetup, coldTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_cold_reuse, coldSetup, coldTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(cold_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
@@ -0,0 +1,456 @@
+/******************************************************************************\
+*  ufs_extent_test.c                                                           *
+*                                                                              *
+*  Tests for the store packing file data into extent files.                    *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ufs_defs.h"
+#include "ufs_extent.h"
+#include "ufs_header.h"
+#include "ufs_layout.h"
+#include "ufs_store.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define NUM_EXTENTS (64)
+#define BIG_SIZE (100000)
+
+struct extentStateStruct {
+    char root[ UFS_TEST_UTILS_BUFF_SIZE ],
+         store[ UFS_TEST_UTILS_BUFF_SIZE * 2 ],
+         image[ UFS_TEST_UTILS_BUFF_SIZE * 2 ];
+};
+
+static int removeEntry( const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw ) {
+    (void) st;
+    (void) flag;
+    (void) ftw;
+    return remove( path );
+}
+
+static void fillPattern( uint8_t *data, uint64_t len, uint8_t seed ) {
+    uint64_t i;
+
+    for ( i = 0; i < len; i++ )
+        data[i] = (uint8_t)( i * 31 + seed );
+}
+
+static ufsImagePtr initImage( struct extentStateStruct *s,
+                              uint64_t numExtents ) {
+    struct ufsHeaderSizeRequestStruct sizes;
+
+    sizes = ufsDefaultSizeRequest;
+    sizes.numExtents = numExtents;
+    return ufsHeaderInit( s -> image, sizes );
+}
+
+static int extentSetup( void **state ) {
+    struct extentStateStruct *s;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s )
+        return -1;
+
+    snprintf( s -> root, sizeof( s -> root ), "/tmp/ufs_extent_XXXXXX" );
+    if ( !mkdtemp( s -> root ) )
+        return -1;
+
+    snprintf( s -> store, sizeof( s -> store ), "%s/store", s -> root );
+    snprintf( s -> image, sizeof( s -> image ), "%s/image", s -> root );
+    *state = s;
+    return 0;
+}
+
+static int extentTeardown( void **state ) {
+    struct extentStateStruct *s;
+
+    s = *state;
+    nftw( s -> root, removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+/* ----- ufs_extent tests ----                                                */
+
+static void test_ufs_extent_write_read( void **state ) {
+    struct extentStateStruct *s;
+    struct ufsExtentStatsStruct stats;
+    uint8_t buf[ 8192 ], expected[ 8192 ];
+
+    s = *state;
+    ufsImagePtr img = initImage( s, NUM_EXTENTS );
+    assert_non_null( img );
+    assert_true( ufsExtentHas( img ) );
+
+    ufsExtentStorePtr store = ufsExtentOpen( s -> store, img );
+    assert_non_null( store );
+
+    ufsIdType area = ufsStoreAddArea( img, "upper" );
+    ufsIdType other = ufsStoreAddArea( img, "lower" );
+    ufsIdType file = ufsStoreAddStorage( img, 0, "motd", false );
+    ufsIdType dir = ufsStoreAddStorage( img, 0, "etc", true );
+    assert_true( area > 0 && other > 0 && file > 0 && dir > 0 );
+
+    assert_true( ufsExtentWrite( store, area, file, "hello", 5, 0 ) );
+    assert_true( ufsStoreProbeMapping( img, area, file ) );
+    assert_int_equal( ufsExtentGetSize( store, area, file ), 5 );
+    assert_int_equal( ufsExtentRead( store, area, file, buf, sizeof( buf ),
+                                     0 ), 5 );
+    assert_memory_equal( buf, "hello", 5 );
+    assert_int_equal( ufsExtentRead( store, area, file, buf, 1, 5 ), 0 );
+
+    /* Each area has its own data.                                            */
+    assert_int_equal( ufsExtentGetSize( store, other, file ), 0 );
+    assert_true( ufsExtentWrite( store, other, file, "other", 5, 0 ) );
+    assert_int_equal( ufsExtentRead( store, area, file, buf, 5, 0 ), 5 );
+    assert_memory_equal( buf, "hello", 5 );
+
+    /* Over the data in place, past it in the same extent and past that.      */
+    assert_true( ufsExtentWrite( store, area, file, "J", 1, 0 ) );
+    assert_true( ufsExtentWrite( store, area, file, "!", 1, 100 ) );
+    assert_true( ufsExtentWrite( store, area, file, "?", 1, 6000 ) );
+    memset( expected, 0, sizeof( expected ) );
+    memcpy( expected, "Jello", 5 );
+    expected[ 100 ] = '!';
+    expected[ 6000 ] = '?';
+    assert_int_equal( ufsExtentGetSize( store, area, file ), 6001 );
+    assert_int_equal( ufsExtentRead( store, area, file, buf, sizeof( buf ),
+                                     0 ), 6001 );
+    assert_memory_equal( buf, expected, 6001 );
+
+    /* A write can span the end of one extent and the hole after it.          */
+    fillPattern( expected, sizeof( expected ), 7 );
+    assert_true( ufsExtentWrite( store, area, file, expected, 5000, 1000 ) );
+    assert_int_equal( ufsExtentRead( store, area, file, buf, 5000, 1000 ),
+                      5000 );
+    assert_memory_equal( buf, expected, 5000 );
+    assert_int_equal( ufsExtentRead( store, area, file, buf, 1, 6000 ), 1 );
+    assert_int_equal( buf[0], '?' );
+
+    assert_true( ufsExtentGetStats( store, &stats ) );
+    assert_int_equal( stats.numExtentFiles, 1 );
+    assert_int_equal( stats.numExtents, 4 );
+    assert_int_equal( stats.usedBytes, 5 + 6001 );
+    assert_int_equal( stats.grows, 1 );
+    assert_int_equal( stats.fileBytes, UFS_EXTENT_GROW );
+
+    assert_false( ufsExtentWrite( store, area, dir, "x", 1, 0 ) );
+    assert_int_equal( ufsErrno, UFS_FILE_DOES_NOT_EXIST );
+    assert_false( ufsExtentWrite( store, area + 100, file, "x", 1, 0 ) );
+    assert_int_equal( ufsErrno, UFS_AREA_DOES_NOT_EXIST );
+    assert_false( ufsExtentWrite( store, area, file, NULL, 1, 0 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    ufsExtentClose( store );
+    ufsImageFree( img );
+}
+
+static void test_ufs_extent_append( void **state ) {
+    struct extentStateStruct *s;
+    struct ufsExtentStatsStruct stats;
+    uint8_t *data, *buf;
+    uint64_t off;
+
+    s = *state;
+    ufsImagePtr img = initImage( s, NUM_EXTENTS );
+    assert_non_null( img );
+    ufsExtentStorePtr store = ufsExtentOpen( s -> store, img );
+    assert_non_null( store );
+
+    ufsIdType area = ufsStoreAddArea( img, "upper" );
+    ufsIdType file = ufsStoreAddStorage( img, 0, "log", false );
+    assert_true( area > 0 && file > 0 );
+
+    data = malloc( BIG_SIZE );
+    buf = malloc( BIG_SIZE );
+    assert_non_null( data );
+    assert_non_null( buf );
+    fillPattern( data, BIG_SIZE, 3 );
+
+    /* Each extent is twice the one before, 4K, 8K ... 64K hold 100000.       */
+    for ( off = 0; off < BIG_SIZE; off += 1000 )
+        assert_true( ufsExtentWrite( store, area, file, data + off, 1000,
+                                     off ) );
+
+    assert_true( ufsExtentGetStats( store, &stats ) );
+    assert_int_equal( stats.numExtents, 5 );
+    assert_int_equal( stats.allocatedBytes, 124 * 1024 );
+    assert_int_equal( stats.usedBytes, BIG_SIZE );
+
+    assert_int_equal( ufsExtentRead( store, area, file, buf, BIG_SIZE, 0 ),
+                      BIG_SIZE );
+    assert_memory_equal( buf, data, BIG_SIZE );
+
+    free( data );
+    free( buf );
+    ufsExtentClose( store );
+    ufsImageFree( img );
+}
+
+static void test_ufs_extent_map_splice( void **state ) {
+    struct extentStateStruct *s;
+    struct ufsExtentSegmentStruct segments[4];
+    uint8_t *data, *buf;
+    uint64_t n;
+    int fds[2];
+
+    s = *state;
+    ufsImagePtr img = initImage( s, NUM_EXTENTS );
+    assert_non_null( img );
+    ufsExtentStorePtr store = ufsExtentOpen( s -> store, img );
+    assert_non_null( store );
+
+    ufsIdType area = ufsStoreAddArea( img, "upper" );
+    ufsIdType file = ufsStoreAddStorage( img, 0, "data", false );
+    assert_true( area > 0 && file > 0 );
+
+    data = calloc( 1, BIG_SIZE );
+    buf = malloc( BIG_SIZE );
+    assert_non_null( data );
+    assert_non_null( buf );
+    fillPattern( data, 10000, 5 );
+    fillPattern( data + 50000, 10000, 9 );
+    assert_true( ufsExtentWrite( store, area, file, data, 10000, 0 ) );
+    assert_true( ufsExtentWrite( store, area, file, data + 50000, 10000,
+                                 50000 ) );
+
+    /* Data, a hole, data, and nothing past the end.                          */
+    assert_true( ufsExtentMap( store, area, file, 5000, BIG_SIZE, segments,
+                               4, &n ) );
+    assert_int_equal( n, 3 );
+    assert_true( segments[0].fd >= 0 );
+    assert_int_equal( segments[0].length, 5000 );
+    assert_int_equal( segments[1].fd, -1 );
+    assert_int_equal( segments[1].length, 40000 );
+    assert_true( segments[2].fd >= 0 );
+    assert_int_equal( segments[2].length, 10000 );
+
+    assert_true( ufsExtentMap( store, area, file, 0, BIG_SIZE, segments,
+                               1, &n ) );
+    assert_int_equal( n, 1 );
+    assert_true( ufsExtentMap( store, area, file, 60000, 1, segments, 4,
+                               &n ) );
+    assert_int_equal( n, 0 );
+    assert_false( ufsExtentMap( store, area, file, 0, 1, segments, 0, &n ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* A pipe big enough takes it all, a full non-blocking one stops it.      */
+    assert_int_equal( pipe( fds ), 0 );
+    assert_true( fcntl( fds[1], F_SETPIPE_SZ, 65536 ) >= 65536 );
+    assert_int_equal( ufsExtentSplice( store, area, file, fds[1], 60000, 0 ),
+                      60000 );
+    assert_int_equal( read( fds[0], buf, 60000 ), 60000 );
+    assert_memory_equal( buf, data, 60000 );
+    close( fds[0] );
+    close( fds[1] );
+
+    assert_int_equal( pipe2( fds, O_NONBLOCK ), 0 );
+    assert_int_equal( fcntl( fds[1], F_SETPIPE_SZ, 4096 ), 4096 );
+    n = ufsExtentSplice( store, area, file, fds[1], 60000, 0 );
+    assert_true( n > 0 && n < 60000 );
+    assert_int_equal( read( fds[0], buf, n ), n );
+    assert_memory_equal( buf, data, n );
+    close( fds[0] );
+    close( fds[1] );
+
+    assert_int_equal( ufsExtentSplice( store, area, file, -1, 1, 0 ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    free( data );
+    free( buf );
+    ufsExtentClose( store );
+    ufsImageFree( img );
+}
+
+static void test_ufs_extent_remove( void **state ) {
+    struct extentStateStruct *s;
+    struct ufsExtentStatsStruct stats;
+    uint8_t data[ 20000 ], buf[ 20000 ];
+    uint64_t block;
+
+    s = *state;
+    ufsImagePtr img = initImage( s, NUM_EXTENTS );
+    assert_non_null( img );
+    ufsExtentStorePtr store = ufsExtentOpen( s -> store, img );
+    assert_non_null( store );
+
+    ufsIdType area = ufsStoreAddArea( img, "upper" );
+    ufsIdType a = ufsStoreAddStorage( img, 0, "a", false );
+    ufsIdType b = ufsStoreAddStorage( img, 0, "b", false );
+    assert_true( area > 0 && a > 0 && b > 0 );
+
+    fillPattern( data, sizeof( data ), 1 );
+    assert_true( ufsExtentWrite( store, area, a, data, 100, 0 ) );
+    assert_true( ufsExtentWrite( store, area, b, data, sizeof( data ), 0 ) );
+
+    /* Removing the data keeps the mapping, freed space merges back whole.    */
+    assert_true( ufsExtentRemove( store, area, b ) );
+    assert_true( ufsStoreProbeMapping( img, area, b ) );
+    assert_int_equal( ufsExtentGetSize( store, area, b ), 0 );
+    assert_false( ufsExtentRemove( store, area, b ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    assert_true( ufsExtentRemove( store, area, a ) );
+    assert_true( ufsExtentGetStats( store, &stats ) );
+    assert_int_equal( stats.numExtents, 0 );
+    assert_int_equal( stats.allocatedBytes, 0 );
+    assert_int_equal( ufsLayoutHeader( img ) -> numFree[ UFS_TYPES_EXTENT ],
+                      2 );
+
+    /* Removing the mapping drops the extents, the open store reuses them.    */
+    assert_true( ufsExtentWrite( store, area, a, data, sizeof( data ), 0 ) );
+    block = ufsLayoutExtents( img )[ ufsLayoutExtentHeads( img )[ a - 1 ] - 1 ]
+                .block;
+    assert_true( ufsStoreRemoveMapping( img, area, a ) );
+    assert_int_equal( ufsExtentGetSize( store, area, a ), 0 );
+    assert_true( ufsExtentWrite( store, area, b, data, sizeof( data ), 0 ) );
+    assert_int_equal(
+        ufsLayoutExtents( img )[ ufsLayoutExtentHeads( img )[ b - 1 ] - 1 ]
+            .block, block );
+    assert_true( ufsExtentRemove( store, area, b ) );
+
+    /* Without a store open the space comes back on open.                     */
+    assert_true( ufsExtentWrite( store, area, a, data, sizeof( data ), 0 ) );
+    ufsExtentClose( store );
+    assert_true( ufsStoreRemoveMapping( img, area, a ) );
+
+    store = ufsExtentOpen( s -> store, img );
+    assert_non_null( store );
+    assert_true( ufsExtentWrite( store, area, b, data, sizeof( data ), 0 ) );
+    assert_true( ufsExtentGetStats( store, &stats ) );
+    assert_int_equal( stats.numExtents, 1 );
+    assert_int_equal( stats.grows, 0 );
+    assert_int_equal( ufsExtentRead( store, area, b, buf, sizeof( buf ), 0 ),
+                      sizeof( buf ) );
+    assert_memory_equal( buf, data, sizeof( buf ) );
+
+    ufsExtentClose( store );
+    ufsImageFree( img );
+}
+
+static void test_ufs_extent_reopen( void **state ) {
+    struct extentStateStruct *s;
+    struct ufsExtentStatsStruct stats;
+    uint8_t data[ 5000 ], buf[ 5000 ];
+    struct ufsExtentStruct *extents;
+
+    s = *state;
+    ufsImagePtr img = initImage( s, 2 );
+    assert_non_null( img );
+    ufsExtentStorePtr store = ufsExtentOpen( s -> store, img );
+    assert_non_null( store );
+
+    ufsIdType area = ufsStoreAddArea( img, "upper" );
+    ufsIdType a = ufsStoreAddStorage( img, 0, "a", false );
+    ufsIdType b = ufsStoreAddStorage( img, 0, "b", false );
+    assert_true( area > 0 && a > 0 && b > 0 );
+
+    fillPattern( data, sizeof( data ), 2 );
+    assert_true( ufsExtentWrite( store, area, a, data, 100, 0 ) );
+    assert_true( ufsExtentWrite( store, area, b, "b", 1, 0 ) );
+
+    /* Both records are taken.                                                */
+    assert_false( ufsExtentWrite( store, area, a, data, 1, 100000 ) );
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+
+    /* A new file that couldn't be written isn't mapped.                      */
+    ufsIdType c = ufsStoreAddStorage( img, 0, "c", false );
+    assert_true( c > 0 );
+    assert_false( ufsExtentWrite( store, area, c, data, 1, 0 ) );
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+    assert_false( ufsStoreProbeMapping( img, area, c ) );
+    ufsExtentClose( store );
+    ufsImageFree( img );
+
+    /* The extents are where they were, new space doesn't overlap them.       */
+    img = ufsHeaderValidate( ufsImageOpen( s -> image ) );
+    assert_non_null( img );
+    store = ufsExtentOpen( s -> store, img );
+    assert_non_null( store );
+    assert_true( ufsExtentRemove( store, area, b ) );
+    assert_true( ufsExtentWrite( store, area, b, data, sizeof( data ), 0 ) );
+    assert_int_equal( ufsExtentRead( store, area, a, buf, sizeof( buf ), 0 ),
+                      100 );
+    assert_memory_equal( buf, data, 100 );
+    assert_int_equal( ufsExtentRead( store, area, b, buf, sizeof( buf ), 0 ),
+                      sizeof( data ) );
+    assert_memory_equal( buf, data, sizeof( data ) );
+    assert_true( ufsExtentGetStats( store, &stats ) );
+    assert_int_equal( stats.allocatedBytes, 3 * UFS_EXTENT_BLOCK );
+    ufsExtentClose( store );
+
+    /* Extents sharing space are refused.                                     */
+    extents = ufsLayoutExtents( img );
+    extents[1].block = extents[0].block;
+    extents[1].order = extents[0].order;
+    assert_null( ufsExtentOpen( s -> store, img ) );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_CORRUPTED );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_extent_no_section( void **state ) {
+    struct extentStateStruct *s;
+
+    s = *state;
+    ufsImagePtr img = initImage( s, 0 );
+    assert_non_null( img );
+    assert_false( ufsExtentHas( img ) );
+
+    assert_null( ufsExtentOpen( s -> store, img ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsExtentDrop( img, 1, 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* The store doesn't mind the missing section.                            */
+    ufsIdType area = ufsStoreAddArea( img, "upper" );
+    ufsIdType file = ufsStoreAddStorage( img, 0, "a", false );
+    assert_true( ufsStoreAddMapping( img, area, file ) );
+    assert_true( ufsStoreRemoveMapping( img, area, file ) );
+
+    ufsImageFree( img );
+}
+
+static const struct CMUnitTest extent_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_extent_write_read, extentSetup, extentTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_extent_append, extentSetup, extentTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_extent_map_splice, extentSetup, extentTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_extent_remove, extentSetup, extentTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_extent_reopen, extentSetup, extentTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_extent_no_section, extentSetup, extentTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(extent_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
@@ -0,0 +1,257 @@
+/******************************************************************************\
+*  ufs_inline_test.c                                                           *
+*                                                                              *
+*  Tests for the data of tiny files kept inline in an image.                   *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_inline.h"
+#include "ufs_layout.h"
+#include "ufs_store.h"
+#include "utils.h"
+
+#include <cmocka.h>
+
+/* Room for every class, the last one holds a single slot.                    */
+#define TEST_DATA_BYTES ( UFS_INLINE_CLASSES * UFS_LAYOUT_SLOT_SIZE( 3 ) )
+
+static ufsImagePtr initImage( const char *name, uint64_t numDataBytes )
+{
+    struct ufsHeaderSizeRequestStruct sizes;
+
+    sizes = ufsDefaultSizeRequest;
+    sizes.numDataBytes = numDataBytes;
+    return ufsHeaderInit( name, sizes );
+}
+
+/* ----- ufs_inline tests ----                                                */
+
+static void test_ufs_inline_set_get( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    uint8_t big[ UFS_INLINE_MAX ];
+    const char *data;
+    uint64_t length;
+
+    fn = *state;
+    ufsImagePtr img = initImage( fn -> name, TEST_DATA_BYTES );
+    assert_non_null( img );
+    assert_true( ufsInlineHas( img ) );
+
+    ufsIdType area = ufsStoreAddArea( img, "upper" );
+    ufsIdType other = ufsStoreAddArea( img, "lower" );
+    ufsIdType file = ufsStoreAddStorage( img, 0, "motd", false );
+    ufsIdType dir = ufsStoreAddStorage( img, 0, "etc", true );
+    assert_true( area > 0 && other > 0 && file > 0 && dir > 0 );
+
+    assert_true( ufsInlineSet( img, area, file, "hello", 5 ) );
+    assert_true( ufsStoreProbeMapping( img, area, file ) );
+    data = ufsInlineGet( img, area, file, &length );
+    assert_non_null( data );
+    assert_int_equal( length, 5 );
+    assert_memory_equal( data, "hello", 5 );
+
+    /* Each area has its own data, the mapping may already exist.             */
+    assert_true( ufsStoreAddMapping( img, other, file ) );
+    assert_null( ufsInlineGet( img, other, file, &length ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_true( ufsInlineSet( img, other, file, "", 0 ) );
+    assert_non_null( ufsInlineGet( img, other, file, &length ) );
+    assert_int_equal( length, 0 );
+
+    /* Same class is overwritten in place, another class moves the data.      */
+    assert_true( ufsInlineSet( img, area, file, "world!", 6 ) );
+    data = ufsInlineGet( img, area, file, &length );
+    assert_int_equal( length, 6 );
+    assert_memory_equal( data, "world!", 6 );
+
+    memset( big, 'x', sizeof( big ) );
+    assert_true( ufsInlineSet( img, area, file, big, sizeof( big ) ) );
+    data = ufsInlineGet( img, area, file, &length );
+    assert_int_equal( length, sizeof( big ) );
+    assert_memory_equal( data, big, sizeof( big ) );
+    assert_non_null( ufsInlineGet( img, other, file, &length ) );
+    assert_int_equal( length, 0 );
+
+    assert_false( ufsInlineSet( img, area, file, big, sizeof( big ) + 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsInlineSet( img, area, file, NULL, 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsInlineSet( img, area, dir, "x", 1 ) );
+    assert_int_equal( ufsErrno, UFS_FILE_DOES_NOT_EXIST );
+    assert_false( ufsInlineSet( img, area + 100, file, "x", 1 ) );
+    assert_int_equal( ufsErrno, UFS_AREA_DOES_NOT_EXIST );
+
+    ufsImageFree( img );
+
+    /* The data outlives the mapping of the image.                            */
+    img = ufsHeaderValidate( ufsImageOpen( fn -> name ) );
+    assert_non_null( img );
+    data = ufsInlineGet( img, area, file, &length );
+    assert_non_null( data );
+    assert_int_equal( length, sizeof( big ) );
+    assert_memory_equal( data, big, sizeof( big ) );
+    ufsImageFree( img );
+}
+
+static void test_ufs_inline_remove( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsInlineStatsStruct stats;
+    uint64_t length;
+
+    fn = *state;
+    ufsImagePtr img = initImage( fn -> name, TEST_DATA_BYTES );
+    assert_non_null( img );
+
+    ufsIdType area = ufsStoreAddArea( img, "upper" );
+    ufsIdType other = ufsStoreAddArea( img, "lower" );
+    ufsIdType a = ufsStoreAddStorage( img, 0, "a", false );
+    ufsIdType b = ufsStoreAddStorage( img, 0, "b", false );
+    ufsIdType c = ufsStoreAddStorage( img, 0, "c", false );
+    assert_true( area > 0 && other > 0 && a > 0 && b > 0 && c > 0 );
+
+    assert_true( ufsInlineSet( img, area, a, "aa", 2 ) );
+    assert_true( ufsInlineSet( img, other, a, "aaa", 3 ) );
+    assert_true( ufsInlineSet( img, area, b, "bbbb", 4 ) );
+    assert_true( ufsInlineSet( img, other, c, "ccccc", 5 ) );
+
+    assert_true( ufsInlineGetStats( img, &stats ) );
+    assert_int_equal( stats.numUsed[0], 4 );
+    assert_int_equal( stats.numBytes, 14 );
+    assert_int_equal( stats.numSlots[3], 1 );
+
+    /* Removing the data keeps the mapping.                                   */
+    assert_true( ufsInlineRemove( img, area, a ) );
+    assert_true( ufsStoreProbeMapping( img, area, a ) );
+    assert_false( ufsInlineRemove( img, area, a ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_non_null( ufsInlineGet( img, other, a, &length ) );
+    assert_int_equal( length, 3 );
+
+    /* Removing the mapping, the storage or the area frees the slot.          */
+    assert_true( ufsStoreRemoveMapping( img, other, a ) );
+    assert_null( ufsInlineGet( img, other, a, &length ) );
+    assert_true( ufsStoreRemoveStorage( img, b ) );
+    assert_true( ufsStoreRemoveArea( img, other ) );
+    assert_null( ufsInlineGet( img, other, c, &length ) );
+
+    assert_true( ufsInlineGetStats( img, &stats ) );
+    assert_int_equal( stats.numUsed[0], 0 );
+    assert_int_equal( stats.numBytes, 0 );
+
+    /* Freed slots are reused before new ones.                                */
+    assert_true( ufsInlineSet( img, area, c, "c", 1 ) );
+    assert_true( ufsInlineGetStats( img, &stats ) );
+    assert_int_equal( stats.numUsed[0], 1 );
+    assert_int_equal( ufsLayoutInlineHeader( img ) -> used[0], 4 );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_inline_full( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsInlineStatsStruct stats;
+    uint8_t data[ UFS_INLINE_MIN + 1 ];
+    char name[ 32 ];
+    ufsIdType file, first;
+    uint64_t i;
+
+    fn = *state;
+    ufsImagePtr img = initImage( fn -> name, UFS_INLINE_CLASSES *
+                                             UFS_LAYOUT_SLOT_SIZE( 1 ) );
+    assert_non_null( img );
+    assert_true( ufsInlineGetStats( img, &stats ) );
+    assert_int_equal( stats.numSlots[1], 1 );
+    assert_int_equal( stats.numSlots[3], 0 );
+
+    ufsIdType area = ufsStoreAddArea( img, "upper" );
+    assert_true( area > 0 );
+
+    memset( data, 'x', sizeof( data ) );
+    first = 0;
+    for ( i = 0; i < stats.numSlots[0]; i++ ) {
+        snprintf( name, sizeof( name ), "f%lu", (unsigned long) i );
+        file = ufsStoreAddStorage( img, 0, name, false );
+        assert_true( file > 0 );
+        assert_true( ufsInlineSet( img, area, file, data, 1 ) );
+        if ( !first )
+            first = file;
+    }
+
+    /* A full class fails the set, data that can't move keeps its slot.       */
+    file = ufsStoreAddStorage( img, 0, "last", false );
+    assert_true( file > 0 );
+    assert_false( ufsInlineSet( img, area, file, data, 1 ) );
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+    assert_true( ufsInlineSet( img, area, file, data, sizeof( data ) ) );
+    assert_false( ufsInlineSet( img, area, first, data, sizeof( data ) ) );
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+    assert_false( ufsInlineSet( img, area, file, data, UFS_INLINE_MAX ) );
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+
+    assert_true( ufsInlineGetStats( img, &stats ) );
+    assert_int_equal( stats.numBytes, stats.numSlots[0] + sizeof( data ) );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_inline_no_section( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsInlineStatsStruct stats;
+    uint64_t length;
+
+    fn = *state;
+    ufsImagePtr img = initImage( fn -> name, 0 );
+    assert_non_null( img );
+    assert_false( ufsInlineHas( img ) );
+
+    ufsIdType area = ufsStoreAddArea( img, "upper" );
+    ufsIdType file = ufsStoreAddStorage( img, 0, "a", false );
+    assert_true( area > 0 && file > 0 );
+
+    assert_false( ufsInlineSet( img, area, file, "a", 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_null( ufsInlineGet( img, area, file, &length ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsInlineGetStats( img, &stats ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* The store doesn't mind the missing section.                            */
+    assert_true( ufsStoreAddMapping( img, area, file ) );
+    assert_true( ufsStoreRemoveMapping( img, area, file ) );
+
+    ufsImageFree( img );
+}
+
+static const struct CMUnitTest inline_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_inline_set_get, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_inline_remove, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_inline_full, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_inline_no_section, getFileNameSetup, cleanUpTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(inline_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
@@ -0,0 +1,282 @@
+/******************************************************************************\
+*  ufs_layout_test.c                                                           *
+*                                                                              *
+*  Tests for the ufs image layout accessors.                                   *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_layout.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+/* The layout macros must be usable wherever a constant is required.          */
+_Static_assert( UFS_LAYOUT_FILE_OFFSET > UFS_LAYOUT_HEADER_OFFSET,
+                "Files must come after the header." );
+_Static_assert( UFS_LAYOUT_STRING_OFFSET( 1, 1, 1 ) >
+                UFS_LAYOUT_NODE_OFFSET( 1, 1 ),
+                "Strings must come after the nodes." );
+
+/* ----- ufs_layout tests ----                                                */
+
+static void test_ufs_layout_round( void **state ) {
+    (void) state;
+    assert_int_equal( UFS_LAYOUT_ROUND( 0, 8 ), 0 );
+    assert_int_equal( UFS_LAYOUT_ROUND( 1, 8 ), 8 );
+    assert_int_equal( UFS_LAYOUT_ROUND( 8, 8 ), 8 );
+    assert_int_equal( UFS_LAYOUT_ROUND( 9, 4096 ), 4096 );
+}
+
+static void test_ufs_layout_matches_header( void **state ) {
+    struct ufsHeaderStruct *header;
+    struct ufsTestUtilsFileNameStruct *fn;
+    enum ufsTyepesEnum type;
+
+    fn = *state;
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, ufsDefaultSizeRequest );
+    assert_non_null( img );
+
+    header = ufsHeaderGet( img );
+    assert_ptr_equal( header, ufsLayoutHeader( img ) );
+
+    /* The BASE index, data and extents are optional, an image can lack them. */
+    for ( type = UFS_TYPES_FILE; type < UFS_TYPES_COUNT; type++ ) {
+        if ( type >= UFS_TYPES_BASE && !header -> sizes[ type ] )
+            continue;
+        assert_ptr_equal( ufsLayoutSection( img, type ),
+                          (uint8_t*)img + header -> offsets[ type ] );
+        assert_int_equal( ufsLayoutCapacity( img, type ),
+                          header -> sizes[ type ] );
+    }
+
+    assert_ptr_equal( ufsLayoutFiles( img ),
+                      ufsLayoutSection( img, UFS_TYPES_FILE ) );
+    assert_ptr_equal( ufsLayoutAreas( img ),
+                      ufsLayoutSection( img, UFS_TYPES_AREA ) );
+    assert_ptr_equal( ufsLayoutNodes( img ),
+                      ufsLayoutSection( img, UFS_TYPES_NODE ) );
+    assert_ptr_equal( ufsLayoutStrings( img ),
+                      ufsLayoutSection( img, UFS_TYPES_STRING ) );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_layout_fits_image( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsHeaderSizeRequestStruct sizes;
+    uint64_t end;
+
+    fn = *state;
+    sizes = ufsDefaultSizeRequest;
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, sizes );
+    assert_non_null( img );
+
+    end = UFS_LAYOUT_END( sizes.numFiles, sizes.numAreas, sizes.numNodes,
+                          sizes.numStrBytes );
+
+    assert_true( end <= *(uint64_t*)img );
+    assert_int_equal( *(uint64_t*)img,
+                      UFS_LAYOUT_ROUND( end, sysconf( _SC_PAGESIZE ) ) );
+
+    /* The last string byte must be addressable.                              */
+    ufsLayoutStrings( img )[ sizes.numStrBytes - 1 ] = 'u';
+    assert_true( ufsImageSync( img ) );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_layout_base_index( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsHeaderSizeRequestStruct sizes;
+    struct ufsHeaderStruct *header;
+    uint64_t end;
+
+    fn = *state;
+    sizes = ufsDefaultSizeRequest;
+    sizes.baseIndex = true;
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, sizes );
+    assert_non_null( img );
+
+    header = ufsLayoutHeader( img );
+    assert_int_equal( header -> sizes[ UFS_TYPES_BASE ], sizes.numFiles );
+    assert_int_equal( header -> offsets[ UFS_TYPES_BASE ],
+                      UFS_LAYOUT_BASE_OFFSET( sizes.numFiles, sizes.numAreas,
+                                              sizes.numNodes,
+                                              sizes.numStrBytes ) );
+    assert_true( header -> offsets[ UFS_TYPES_BASE ] >=
+                 UFS_LAYOUT_END( sizes.numFiles, sizes.numAreas,
+                                 sizes.numNodes, sizes.numStrBytes ) );
+    assert_int_equal( ufsLayoutCapacity( img, UFS_TYPES_BASE ),
+                      sizes.numFiles );
+
+    end = UFS_LAYOUT_BASE_END( sizes.numFiles, sizes.numAreas,
+                               sizes.numNodes, sizes.numStrBytes );
+    assert_int_equal( *(uint64_t*)img,
+                      UFS_LAYOUT_ROUND( end, sysconf( _SC_PAGESIZE ) ) );
+
+    /* The last record must be addressable and the image reopen.              */
+    ufsLayoutBaseRecords( img )[ sizes.numFiles - 1 ].state =
+        UFS_BASE_RECORD_ABSENT;
+    assert_true( ufsImageSync( img ) );
+    ufsImageFree( img );
+
+    img = ufsHeaderValidate( ufsImageOpen( fn -> name ) );
+    assert_non_null( img );
+    assert_int_equal( ufsLayoutBaseRecords( img )[ sizes.numFiles - 1 ].state,
+                      UFS_BASE_RECORD_ABSENT );
+    ufsImageFree( img );
+}
+
+static void test_ufs_layout_data_section( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsHeaderSizeRequestStruct sizes;
+    struct ufsHeaderStruct *header;
+    uint64_t end;
+
+    fn = *state;
+    sizes = ufsDefaultSizeRequest;
+    sizes.baseIndex = true;
+    sizes.numDataBytes = 4096;
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, sizes );
+    assert_non_null( img );
+
+    /* The data comes after the BASE index, when there's one.                 */
+    header = ufsLayoutHeader( img );
+    assert_int_equal( header -> sizes[ UFS_TYPES_DATA ], sizes.numDataBytes );
+    assert_int_equal( header -> offsets[ UFS_TYPES_DATA ],
+                      UFS_LAYOUT_DATA_OFFSET( sizes.numFiles, sizes.numAreas,
+                                              sizes.numNodes,
+                                              sizes.numStrBytes,
+                                              sizes.numFiles ) );
+    assert_true( header -> offsets[ UFS_TYPES_DATA ] >=
+                 UFS_LAYOUT_BASE_END( sizes.numFiles, sizes.numAreas,
+                                      sizes.numNodes, sizes.numStrBytes ) );
+    assert_int_equal( ufsLayoutCapacity( img, UFS_TYPES_DATA ),
+                      sizes.numDataBytes );
+    assert_ptr_equal( ufsLayoutInlineHeader( img ),
+                      ufsLayoutSection( img, UFS_TYPES_DATA ) );
+
+    end = header -> offsets[ UFS_TYPES_DATA ] +
+          UFS_LAYOUT_DATA_SIZE( sizes.numFiles, sizes.numDataBytes );
+    assert_int_equal( *(uint64_t*)img,
+                      UFS_LAYOUT_ROUND( end, sysconf( _SC_PAGESIZE ) ) );
+
+    /* The last byte must be addressable and the image reopen.                */
+    ((uint8_t*)img)[ end - 1 ] = 'u';
+    assert_true( ufsImageSync( img ) );
+    ufsImageFree( img );
+
+    img = ufsHeaderValidate( ufsImageOpen( fn -> name ) );
+    assert_non_null( img );
+    assert_int_equal( ufsLayoutCapacity( img, UFS_TYPES_DATA ),
+                      sizes.numDataBytes );
+    assert_int_equal( ((uint8_t*)img)[ end - 1 ], 'u' );
+    ufsImageFree( img );
+}
+
+static void test_ufs_layout_extent_section( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsHeaderSizeRequestStruct sizes;
+    struct ufsHeaderStruct *header;
+    uint64_t end;
+
+    fn = *state;
+    sizes = ufsDefaultSizeRequest;
+    sizes.numDataBytes = 4096;
+    sizes.numExtents = 100;
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, sizes );
+    assert_non_null( img );
+
+    /* The extents come after the data, the heads before the records.         */
+    header = ufsLayoutHeader( img );
+    assert_int_equal( header -> sizes[ UFS_TYPES_EXTENT ], sizes.numExtents );
+    assert_int_equal( header -> offsets[ UFS_TYPES_EXTENT ],
+                      UFS_LAYOUT_EXTENT_OFFSET( sizes.numFiles,
+                                                sizes.numAreas,
+                                                sizes.numNodes,
+                                                sizes.numStrBytes, 0,
+                                                sizes.numDataBytes ) );
+    assert_true( header -> offsets[ UFS_TYPES_EXTENT ] >=
+                 header -> offsets[ UFS_TYPES_DATA ] +
+                 UFS_LAYOUT_DATA_SIZE( sizes.numFiles,
+                                       sizes.numDataBytes ) );
+    assert_ptr_equal( ufsLayoutExtents( img ),
+                      ufsLayoutExtentHeads( img ) + sizes.numFiles );
+
+    end = header -> offsets[ UFS_TYPES_EXTENT ] +
+          UFS_LAYOUT_EXTENT_SIZE( sizes.numFiles, sizes.numExtents );
+    assert_int_equal( *(uint64_t*)img,
+                      UFS_LAYOUT_ROUND( end, sysconf( _SC_PAGESIZE ) ) );
+
+    /* The last record must be addressable and the image reopen.              */
+    ufsLayoutExtents( img )[ sizes.numExtents - 1 ].length = 42;
+    assert_true( ufsImageSync( img ) );
+    ufsImageFree( img );
+
+    img = ufsHeaderValidate( ufsImageOpen( fn -> name ) );
+    assert_non_null( img );
+    assert_int_equal( ufsLayoutExtents( img )[ sizes.numExtents - 1 ].length,
+                      42 );
+    ufsImageFree( img );
+}
+
+#ifdef UFS_FIXED_LAYOUT
+
+static void test_ufs_layout_fixed_rejects_other_sizes( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsHeaderSizeRequestStruct sizes;
+
+    fn = *state;
+    sizes = ufsDefaultSizeRequest;
+    sizes.numFiles++;
+
+    assert_null( ufsHeaderInit( fn -> name, sizes ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+}
+
+#endif /* UFS_FIXED_LAYOUT */
+
+static const struct CMUnitTest layout_tests[] = {
+    cmocka_unit_test(test_ufs_layout_round),
+    cmocka_unit_test_setup_teardown(test_ufs_layout_matches_header, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_layout_fits_image, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_layout_base_index, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_layout_data_section, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_layout_extent_section, getFileNameSetup, cleanUpTeardown),
+#ifdef UFS_FIXED_LAYOUT
+    cmocka_unit_test_setup_teardown(test_ufs_layout_fixed_rejects_other_sizes, getFileNameSetup, cleanUpTeardown),
+#endif /* UFS_FIXED_LAYOUT */
+};
+
+int main(void) {
+    return cmocka_run_group_tests(layout_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
@@ -0,0 +1,418 @@
+/******************************************************************************\
+*  ufs_lsm_test.c                                                              *
+*                                                                              *
+*  Tests for the log structured key value engine.                              *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <ftw.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ufs_defs.h"
+#include "ufs_lsm.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define NUM_KEYS (20000)
+
+struct lsmStateStruct {
+    struct ufsTestUtilsFileNameStruct path;
+};
+
+struct scanStruct {
+    char last[ 64 ];
+    uint64_t count;
+};
+
+/* Small enough for a few thousand keys to go through every level.           */
+static const struct ufsLsmOptionsStruct smallOptions = {
+    .memtableBytes = 16 * 1024,
+    .blockBytes = 512,
+    .bloomBitsPerKey = 10,
+    .level0Runs = 2,
+    .level0StopRuns = 6,
+    .levelBytes = 32 * 1024,
+    .levelRatio = 2,
+    .runBytes = 8 * 1024,
+    .numThreads = 3,
+    .syncLog = false,
+};
+
+static int removeEntry( const char *path, const struct stat *sb, int flag,
+                        struct FTW *ftw ) {
+    (void) sb; (void) flag; (void) ftw;
+    return remove( path );
+}
+
+static int lsmSetup( void **state ) {
+    struct lsmStateStruct *s;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s || !ufsTestUtilsGetTmpFileName( &s -> path ) )
+        return -1;
+
+    *state = s;
+    return 0;
+}
+
+static int lsmTeardown( void **state ) {
+    struct lsmStateStruct *s;
+
+    s = *state;
+    nftw( s -> path.name, removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+static int keyOf( char *buff, int i ) {
+    return sprintf( buff, "key-%08d", i );
+}
+
+static int valueOf( char *buff, int i, int round ) {
+    return sprintf( buff, "value-%d-%d", i, round );
+}
+
+static void expectValue( ufsLsmPtr lsm, int i, int round ) {
+    char key[ 32 ], expected[ 32 ], value[ 32 ];
+    int keyLen, expectedLen;
+
+    keyLen = keyOf( key, i );
+    expectedLen = valueOf( expected, i, round );
+    assert_int_equal( ufsLsmGet( lsm, key, keyLen, value, sizeof( value ) ),
+                      expectedLen );
+    assert_memory_equal( value, expected, expectedLen );
+}
+
+static void expectMissing( ufsLsmPtr lsm, int i ) {
+    char key[ 32 ];
+
+    assert_int_equal( ufsLsmGet( lsm, key, keyOf( key, i ), NULL, 0 ), -1 );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+}
+
+static bool scanIter( const uint8_t *key, uint64_t keyLen,
+                      const uint8_t *value, uint64_t valueLen,
+                      void *userData ) {
+    struct scanStruct *scan;
+    char curr[ 64 ];
+
+    scan = userData;
+    assert_true( keyLen < sizeof( curr ) );
+    memcpy( curr, key, keyLen );
+    curr[ keyLen ] = '\0';
+
+    assert_true( strcmp( scan -> last, curr ) < 0 );
+    strcpy( scan -> last, curr );
+    scan -> count++;
+    return true;
+}
+
+/* ----- ufs_lsm tests ----                                                   */
+
+static void test_ufs_lsm_bad_args( void **state ) {
+    struct lsmStateStruct *s;
+    struct ufsLsmOptionsStruct options;
+    uint8_t big[ UFS_LSM_MAX_KEY + 1 ] = { 0 };
+    ufsLsmPtr lsm;
+
+    s = *state;
+    assert_null( ufsLsmOpen( NULL, &ufsLsmDefaultOptions ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_null( ufsLsmOpen( s -> path.name, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    options = ufsLsmDefaultOptions;
+    options.level0StopRuns = options.level0Runs;
+    assert_null( ufsLsmOpen( s -> path.name, &options ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    lsm = ufsLsmOpen( s -> path.name, &ufsLsmDefaultOptions );
+    assert_non_null( lsm );
+
+    assert_false( ufsLsmPut( lsm, "", 0, "v", 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsLsmPut( lsm, big, sizeof( big ), "v", 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsLsmPut( lsm, "k", 1, big, UFS_LSM_MAX_VALUE + 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsLsmPut( lsm, "k", 1, NULL, 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsLsmScan( lsm, "", 0, NULL, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsLsmGet( NULL, "k", 1, NULL, 0 ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsLsmNumRuns( lsm, UFS_LSM_LEVELS ), 0 );
+
+    ufsLsmClose( lsm );
+}
+
+static void test_ufs_lsm_put_get_delete( void **state ) {
+    struct lsmStateStruct *s;
+    char value[ 4 ];
+    ufsLsmPtr lsm;
+
+    s = *state;
+    lsm = ufsLsmOpen( s -> path.name, &ufsLsmDefaultOptions );
+    assert_non_null( lsm );
+
+    assert_true( ufsLsmPut( lsm, "a", 1, "first", 5 ) );
+    assert_true( ufsLsmPut( lsm, "empty", 5, NULL, 0 ) );
+    assert_int_equal( ufsLsmGet( lsm, "a", 1, value, sizeof( value ) ), 5 );
+    assert_memory_equal( value, "firs", sizeof( value ) );
+    assert_int_equal( ufsLsmGet( lsm, "empty", 5, NULL, 0 ), 0 );
+
+    assert_true( ufsLsmPut( lsm, "a", 1, "second, longer", 14 ) );
+    assert_int_equal( ufsLsmGet( lsm, "a", 1, NULL, 0 ), 14 );
+
+    assert_true( ufsLsmDelete( lsm, "a", 1 ) );
+    assert_int_equal( ufsLsmGet( lsm, "a", 1, NULL, 0 ), -1 );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    assert_true( ufsLsmDelete( lsm, "never", 5 ) );
+
+    ufsLsmClose( lsm );
+}
+
+static void test_ufs_lsm_replays_log( void **state ) {
+    struct lsmStateStruct *s;
+    ufsLsmPtr lsm;
+    int i;
+
+    s = *state;
+    lsm = ufsLsmOpen( s -> path.name, &ufsLsmDefaultOptions );
+    assert_non_null( lsm );
+
+    for ( i = 0; i < 100; i++ ) {
+        char key[ 32 ], value[ 32 ];
+
+        assert_true( ufsLsmPut( lsm, key, keyOf( key, i ), value,
+                                valueOf( value, i, 0 ) ) );
+    }
+
+    assert_true( ufsLsmDelete( lsm, "key-00000007", 12 ) );
+    assert_int_equal( ufsLsmNumRuns( lsm, 0 ), 0 );
+    ufsLsmClose( lsm );
+
+    /* The log becomes a level 0 run on open.                                */
+    lsm = ufsLsmOpen( s -> path.name, &ufsLsmDefaultOptions );
+    assert_non_null( lsm );
+    assert_int_equal( ufsLsmNumRuns( lsm, 0 ), 1 );
+
+    for ( i = 0; i < 100; i++ ) {
+        if ( i == 7 )
+            expectMissing( lsm, i );
+        else
+            expectValue( lsm, i, 0 );
+    }
+
+    ufsLsmClose( lsm );
+}
+
+static void test_ufs_lsm_compacts( void **state ) {
+    struct lsmStateStruct *s;
+    char key[ 32 ], value[ 32 ];
+    uint64_t deeper, level;
+    ufsLsmPtr lsm;
+    int i, round;
+
+    s = *state;
+    lsm = ufsLsmOpen( s -> path.name, &smallOptions );
+    assert_non_null( lsm );
+
+    /* Overwrite every key so that runs at different levels disagree.        */
+    for ( round = 0; round < 2; round++ ) {
+        for ( i = 0; i < NUM_KEYS; i++ ) {
+            assert_true( ufsLsmPut( lsm, key, keyOf( key, i ), value,
+                                    valueOf( value, i, round ) ) );
+        }
+    }
+
+    for ( i = 0; i < NUM_KEYS; i += 3 )
+        assert_true( ufsLsmDelete( lsm, key, keyOf( key, i ) ) );
+
+    assert_true( ufsLsmCompact( lsm ) );
+    assert_true( ufsLsmNumRuns( lsm, 0 ) < smallOptions.level0Runs );
+
+    deeper = 0;
+    for ( level = 2; level < UFS_LSM_LEVELS; level++ )
+        deeper += ufsLsmNumRuns( lsm, level );
+    assert_true( deeper > 0 );
+
+    for ( i = 0; i < NUM_KEYS; i++ ) {
+        if ( i % 3 == 0 )
+            expectMissing( lsm, i );
+        else
+            expectValue( lsm, i, 1 );
+    }
+
+    ufsLsmClose( lsm );
+
+    /* Runs are found again through the manifest.                            */
+    lsm = ufsLsmOpen( s -> path.name, &smallOptions );
+    assert_non_null( lsm );
+    for ( i = 0; i < NUM_KEYS; i += 97 ) {
+        if ( i % 3 == 0 )
+            expectMissing( lsm, i );
+        else
+            expectValue( lsm, i, 1 );
+    }
+
+    ufsLsmClose( lsm );
+}
+
+static void test_ufs_lsm_scan( void **state ) {
+    struct lsmStateStruct *s;
+    struct scanStruct scan;
+    char key[ 32 ], value[ 32 ];
+    ufsLsmPtr lsm;
+    int i;
+
+    s = *state;
+    lsm = ufsLsmOpen( s -> path.name, &smallOptions );
+    assert_non_null( lsm );
+
+    /* Spread the keys over the memtable and the runs, in reverse order.    */
+    for ( i = NUM_KEYS - 1; i >= 0; i-- ) {
+        assert_true( ufsLsmPut( lsm, key, keyOf( key, i ), value,
+                                valueOf( value, i, 0 ) ) );
+    }
+
+    assert_true( ufsLsmPut( lsm, "other", 5, "x", 1 ) );
+    for ( i = 0; i < 1000; i += 2 )
+        assert_true( ufsLsmDelete( lsm, key, keyOf( key, i ) ) );
+
+    memset( &scan, 0, sizeof( scan ) );
+    assert_true( ufsLsmScan( lsm, "key-", 4, scanIter, &scan ) );
+    assert_int_equal( scan.count, NUM_KEYS - 500 );
+
+    memset( &scan, 0, sizeof( scan ) );
+    assert_true( ufsLsmScan( lsm, "key-00001", 9, scanIter, &scan ) );
+    assert_int_equal( scan.count, 1000 );
+
+    memset( &scan, 0, sizeof( scan ) );
+    assert_true( ufsLsmScan( lsm, "key-000009", 10, scanIter, &scan ) );
+    assert_int_equal( scan.count, 50 );
+
+    memset( &scan, 0, sizeof( scan ) );
+    assert_true( ufsLsmScan( lsm, NULL, 0, scanIter, &scan ) );
+    assert_int_equal( scan.count, NUM_KEYS - 500 + 1 );
+    assert_string_equal( scan.last, "other" );
+
+    memset( &scan, 0, sizeof( scan ) );
+    assert_true( ufsLsmScan( lsm, "missing", 7, scanIter, &scan ) );
+    assert_int_equal( scan.count, 0 );
+
+    ufsLsmClose( lsm );
+}
+
+static void test_ufs_lsm_batch( void **state ) {
+    struct lsmStateStruct *s;
+    char path[ UFS_TEST_UTILS_BUFF_SIZE * 2 ];
+    struct dirent *entry;
+    ufsLsmBatchPtr batch;
+    struct stat st;
+    ufsLsmPtr lsm;
+    DIR *dir;
+    int i;
+
+    s = *state;
+    lsm = ufsLsmOpen( s -> path.name, &ufsLsmDefaultOptions );
+    assert_non_null( lsm );
+    batch = ufsLsmBatchCreate();
+    assert_non_null( batch );
+
+    assert_false( ufsLsmBatchPut( batch, "", 0, "v", 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsLsmWrite( lsm, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_true( ufsLsmWrite( lsm, batch ) );
+
+    /* More than the log buffer holds, in one record.                        */
+    for ( i = 0; i < 5000; i++ ) {
+        char key[ 32 ], value[ 32 ];
+
+        assert_true( ufsLsmBatchPut( batch, key, keyOf( key, i ), value,
+                                     valueOf( value, i, 0 ) ) );
+    }
+
+    assert_true( ufsLsmBatchDelete( batch, "key-00000007", 12 ) );
+    assert_true( ufsLsmWrite( lsm, batch ) );
+    ufsLsmBatchFree( batch );
+    expectMissing( lsm, 7 );
+    expectValue( lsm, 8, 0 );
+    ufsLsmClose( lsm );
+
+    lsm = ufsLsmOpen( s -> path.name, &ufsLsmDefaultOptions );
+    assert_non_null( lsm );
+    for ( i = 0; i < 5000; i++ ) {
+        if ( i == 7 )
+            expectMissing( lsm, i );
+        else
+            expectValue( lsm, i, 0 );
+    }
+
+    /* A torn batch is dropped as a whole.                                   */
+    batch = ufsLsmBatchCreate();
+    assert_non_null( batch );
+    assert_true( ufsLsmPut( lsm, "kept", 4, NULL, 0 ) );
+    assert_true( ufsLsmBatchPut( batch, "first", 5, NULL, 0 ) );
+    assert_true( ufsLsmBatchPut( batch, "second", 6, NULL, 0 ) );
+    assert_true( ufsLsmWrite( lsm, batch ) );
+    ufsLsmBatchFree( batch );
+    assert_true( ufsLsmSync( lsm ) );
+
+    dir = opendir( s -> path.name );
+    assert_non_null( dir );
+    while ( ( entry = readdir( dir ) ) && !strstr( entry -> d_name, ".log" ) )
+        ;
+    assert_non_null( entry );
+    snprintf( path, sizeof( path ), "%s/%s", s -> path.name, entry -> d_name );
+    closedir( dir );
+    assert_int_equal( stat( path, &st ), 0 );
+    assert_int_equal( truncate( path, st.st_size - 1 ), 0 );
+    ufsLsmClose( lsm );
+
+    lsm = ufsLsmOpen( s -> path.name, &ufsLsmDefaultOptions );
+    assert_non_null( lsm );
+    assert_int_equal( ufsLsmGet( lsm, "kept", 4, NULL, 0 ), 0 );
+    assert_int_equal( ufsLsmGet( lsm, "first", 5, NULL, 0 ), -1 );
+    assert_int_equal( ufsLsmGet( lsm, "second", 6, NULL, 0 ), -1 );
+    ufsLsmClose( lsm );
+}
+
+static const struct CMUnitTest lsm_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_lsm_bad_args, lsmSetup, lsmTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_lsm_put_get_delete, lsmSetup, lsmTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_lsm_replays_log, lsmSetup, lsmTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_lsm_compacts, lsmSetup, lsmTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_lsm_scan, lsmSetup, lsmTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_lsm_batch, lsmSetup, lsmTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(lsm_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
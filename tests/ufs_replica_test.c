@@ -0,0 +1,367 @@
+/******************************************************************************\
+*  ufs_replica_test.c                                                          *
+*                                                                              *
+*  Tests for leaders and followers.                                            *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_replica.h"
+#include "ufs_store.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define NUM_FOLLOWERS (3)
+#define NUM_FILES (200)
+
+struct replicaStateStruct {
+    struct ufsTestUtilsFileNameStruct leader;
+    struct ufsTestUtilsFileNameStruct followers[ NUM_FOLLOWERS ];
+    struct sockaddr_un addr;
+};
+
+static const struct ufsHeaderSizeRequestStruct replicaSizeRequest = {
+    .numFiles = 1024,
+    .numAreas = 16,
+    .numNodes = 1024,
+    .numStrBytes = 32768
+};
+
+/* The sizes every image here is made with, a fixed layout build swaps in    */
+/* its own and skips the test when they hold less.                           */
+static struct ufsHeaderSizeRequestStruct replicaSizes( void ) {
+    struct ufsHeaderSizeRequestStruct sizes = replicaSizeRequest;
+
+    if ( !ufsTestUtilsLayoutSizes( &sizes ) )
+        skip();
+
+    return sizes;
+}
+
+static int replicaSetup( void **state ) {
+    struct replicaStateStruct *s;
+    int i;
+
+    s = calloc( 1, sizeof( *s ) );
+    if ( !s || !ufsTestUtilsGetTmpFileName( &s -> leader ) )
+        return -1;
+
+    for ( i = 0; i < NUM_FOLLOWERS; i++ ) {
+        if ( !ufsTestUtilsGetTmpFileName( &s -> followers[i] ) )
+            return -1;
+    }
+
+    /* An abstract socket, nothing to clean up.                              */
+    s -> addr.sun_family = AF_UNIX;
+    snprintf( s -> addr.sun_path + 1, sizeof( s -> addr.sun_path ) - 1,
+              "ufs-replica-%d", getpid() );
+
+    *state = s;
+    return 0;
+}
+
+static int replicaTeardown( void **state ) {
+    struct replicaStateStruct *s;
+    int i;
+
+    s = *state;
+    unlink( s -> leader.name );
+    for ( i = 0; i < NUM_FOLLOWERS; i++ )
+        unlink( s -> followers[i].name );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+static int listenOn( struct replicaStateStruct *s ) {
+    int fd;
+
+    fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    assert_true( fd >= 0 );
+    assert_int_equal( bind( fd, (struct sockaddr*)&s -> addr,
+                            sizeof( s -> addr ) ), 0 );
+    assert_int_equal( listen( fd, 8 ), 0 );
+    return fd;
+}
+
+static ufsFollowerPtr follow( struct replicaStateStruct *s,
+                              ufsImagePtr img ) {
+    ufsFollowerPtr follower;
+    int fd;
+
+    fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    assert_true( fd >= 0 );
+    assert_int_equal( connect( fd, (struct sockaddr*)&s -> addr,
+                               sizeof( s -> addr ) ), 0 );
+
+    follower = ufsFollowerCreate( img, fd );
+    assert_non_null( follower );
+    return follower;
+}
+
+static void assertSameFiles( ufsImagePtr a, ufsImagePtr b ) {
+    ufsIdType id;
+
+    for ( id = 1; id <= ufsHeaderGet( a ) -> sizes[ UFS_TYPES_FILE ]; id++ ) {
+        assert_int_equal( ufsStoreHasStorage( a, id ),
+                          ufsStoreHasStorage( b, id ) );
+        if ( ufsStoreHasStorage( a, id ) )
+            assert_string_equal( ufsStoreGetName( a, UFS_TYPES_FILE, id ),
+                                 ufsStoreGetName( b, UFS_TYPES_FILE, id ) );
+    }
+}
+
+static void addFiles( ufsImagePtr img, const char *prefix, int count ) {
+    char name[ 64 ];
+    int i;
+
+    for ( i = 0; i < count; i++ ) {
+        snprintf( name, sizeof( name ), "%s-%d", prefix, i );
+        assert_true( ufsStoreAddStorage( img, 0, name, false ) > 0 );
+    }
+}
+
+/* ----- ufs_replica tests ----                                               */
+
+static void test_ufs_replica_ship( void **state ) {
+    struct replicaStateStruct *s;
+    struct ufsReplicaLagStruct lag;
+    ufsImagePtr source, replica;
+    ufsLeaderPtr leader;
+    ufsFollowerPtr follower;
+    ufsIdType id, own;
+
+    s = *state;
+
+    source = ufsHeaderInit( s -> leader.name, replicaSizes() );
+    replica = ufsHeaderInit( s -> followers[0].name, replicaSizes() );
+    assert_non_null( source );
+    assert_non_null( replica );
+
+    leader = ufsLeaderCreate( source, listenOn( s ) );
+    assert_non_null( leader );
+    assert_null( ufsLeaderCreate( NULL, 0 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    addFiles( source, "early", NUM_FILES );
+    own = ufsStoreSnapshot( source );
+    assert_true( own > 0 );
+    follower = follow( s, replica );
+    assert_int_equal( ufsFollowerPoll( follower, 0 ), 0 );
+
+    /* The first shipment brings the fresh follower up to date.             */
+    assert_true( ufsLeaderShip( leader ) );
+    assert_int_equal( ufsLeaderNumFollowers( leader ), 1 );
+    assert_true( ufsLeaderGetLag( leader, 0, &lag ) );
+    assert_int_equal( lag.generations, 1 );
+    assert_true( lag.nanoseconds > 0 );
+
+    assert_int_equal( ufsFollowerPoll( follower, 1000 ), 1 );
+    assertSameFiles( source, replica );
+    assert_true( ufsLeaderGetLag( leader, 0, &lag ) );
+    assert_int_equal( lag.generations, 0 );
+    assert_int_equal( lag.nanoseconds, 0 );
+
+    /* Two shipments in a row are applied in order.                          */
+    addFiles( source, "late", 10 );
+    assert_true( ufsLeaderShip( leader ) );
+    id = ufsStoreGetStorage( source, 0, "early-3" );
+    assert_true( ufsStoreRemoveStorage( source, id ) );
+    assert_true( ufsLeaderShip( leader ) );
+    assert_true( ufsLeaderGetLag( leader, 0, &lag ) );
+    assert_int_equal( lag.generations, 2 );
+
+    assert_int_equal( ufsFollowerPoll( follower, 1000 ), 1 );
+    assert_int_equal( ufsFollowerPoll( follower, 1000 ), 1 );
+    assertSameFiles( source, replica );
+    assert_false( ufsStoreHasStorage( replica, id ) );
+    assert_true( ufsFollowerStaleness( follower ) > 0 );
+
+    /* The follower answers reads only.                                      */
+    assert_true( ufsStoreGetStorage( replica, 0, "late-9" ) > 0 );
+    assert_int_equal( ufsStoreAddStorage( replica, 0, "local", false ), -1 );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_REPLICA );
+
+    /* The leader keeps only the snapshot the followers are at, a snapshot   */
+    /* it didn't take stays.                                                 */
+    assert_int_equal( ufsHeaderGet( source ) -> numSnapshots, 2 );
+    assert_true( ufsHeaderGet( source ) -> snapshots[ own - 1 ].isOwned );
+
+    ufsLeaderFree( leader );
+    assert_int_equal( ufsFollowerPoll( follower, 1000 ), -1 );
+    assert_int_equal( ufsErrno, UFS_REPLICA_DISCONNECTED );
+
+    ufsFollowerFree( follower );
+    ufsImageFree( source );
+    ufsImageFree( replica );
+}
+
+static void test_ufs_replica_failover( void **state ) {
+    struct replicaStateStruct *s;
+    ufsImagePtr source, replicas[ NUM_FOLLOWERS ];
+    ufsFollowerPtr followers[ NUM_FOLLOWERS ];
+    ufsLeaderPtr leader;
+    int i;
+
+    s = *state;
+
+    source = ufsHeaderInit( s -> leader.name, replicaSizes() );
+    assert_non_null( source );
+    leader = ufsLeaderCreate( source, listenOn( s ) );
+    assert_non_null( leader );
+
+    addFiles( source, "a", NUM_FILES );
+    for ( i = 0; i < 2; i++ ) {
+        replicas[i] = ufsHeaderInit( s -> followers[i].name,
+                                     replicaSizes() );
+        assert_non_null( replicas[i] );
+        followers[i] = follow( s, replicas[i] );
+    }
+
+    assert_true( ufsLeaderShip( leader ) );
+    addFiles( source, "b", 5 );
+    assert_true( ufsLeaderShip( leader ) );
+    for ( i = 0; i < 2; i++ ) {
+        assert_int_equal( ufsFollowerPoll( followers[i], 1000 ), 1 );
+        assert_int_equal( ufsFollowerPoll( followers[i], 1000 ), 1 );
+    }
+
+    /* The leader is lost, the first follower takes over.                    */
+    ufsLeaderFree( leader );
+    ufsImageFree( source );
+    for ( i = 0; i < 2; i++ )
+        assert_int_equal( ufsFollowerPoll( followers[i], 1000 ), -1 );
+
+    assert_true( ufsFollowerPromote( followers[0] ) );
+    assert_false( ufsFollowerPromote( followers[0] ) );
+    assert_int_equal( ufsFollowerPoll( followers[0], 0 ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    ufsFollowerFree( followers[0] );
+
+    leader = ufsLeaderCreate( replicas[0], listenOn( s ) );
+    assert_non_null( leader );
+    assert_true( ufsStoreAddStorage( replicas[0], 0, "c-0", false ) > 0 );
+
+    /* The other follower picks up where it was, a new one starts fresh.    */
+    ufsFollowerFree( followers[1] );
+    followers[1] = follow( s, replicas[1] );
+    replicas[2] = ufsHeaderInit( s -> followers[2].name, replicaSizes() );
+    assert_non_null( replicas[2] );
+    followers[2] = follow( s, replicas[2] );
+
+    assert_true( ufsLeaderShip( leader ) );
+    assert_int_equal( ufsLeaderNumFollowers( leader ), 2 );
+
+    /* The snapshot the follower resumed from was taken over and dropped.    */
+    assert_int_equal( ufsHeaderGet( replicas[0] ) -> numSnapshots, 1 );
+    for ( i = 1; i < NUM_FOLLOWERS; i++ ) {
+        assert_int_equal( ufsFollowerPoll( followers[i], 1000 ), 1 );
+        assertSameFiles( replicas[0], replicas[i] );
+    }
+    assert_true( ufsStoreGetStorage( replicas[1], 0, "c-0" ) > 0 );
+
+    ufsLeaderFree( leader );
+    for ( i = 1; i < NUM_FOLLOWERS; i++ )
+        ufsFollowerFree( followers[i] );
+    for ( i = 0; i < NUM_FOLLOWERS; i++ )
+        ufsImageFree( replicas[i] );
+}
+
+static void test_ufs_replica_slow_followers( void **state ) {
+    struct replicaStateStruct *s;
+    ufsImagePtr source, replicas[2];
+    ufsFollowerPtr good, stuck;
+    ufsLeaderPtr leader;
+    char name[ 64 ];
+    int fd, round, i;
+
+    s = *state;
+
+    source = ufsHeaderInit( s -> leader.name, replicaSizes() );
+    assert_non_null( source );
+    leader = ufsLeaderCreate( source, listenOn( s ) );
+    assert_non_null( leader );
+
+    /* A connection that never finishes its hello holds nothing up.         */
+    fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    assert_true( fd >= 0 );
+    assert_int_equal( connect( fd, (struct sockaddr*)&s -> addr,
+                               sizeof( s -> addr ) ), 0 );
+    assert_int_equal( send( fd, "ufs", 3, 0 ), 3 );
+
+    for ( i = 0; i < 2; i++ ) {
+        replicas[i] = ufsHeaderInit( s -> followers[i].name,
+                                     replicaSizes() );
+        assert_non_null( replicas[i] );
+    }
+    good = follow( s, replicas[0] );
+    stuck = follow( s, replicas[1] );
+
+    addFiles( source, "r0", NUM_FILES * 2 );
+    assert_true( ufsLeaderShip( leader ) );
+    assert_int_equal( ufsLeaderNumFollowers( leader ), 2 );
+
+    /* Once the follower that stopped reading fills its socket it is        */
+    /* dropped, the other one keeps up.                                      */
+    for ( round = 1; round < 32 && ufsLeaderNumFollowers( leader ) == 2;
+          round++ ) {
+        assert_int_equal( ufsFollowerPoll( good, 1000 ), 1 );
+        for ( i = 0; i < NUM_FILES * 2; i++ ) {
+            snprintf( name, sizeof( name ), "r%d-%d", round - 1, i );
+            assert_true( ufsStoreRemoveStorage( source,
+                             ufsStoreGetStorage( source, 0, name ) ) );
+        }
+        snprintf( name, sizeof( name ), "r%d", round );
+        addFiles( source, name, NUM_FILES * 2 );
+        assert_true( ufsLeaderShip( leader ) );
+    }
+
+    assert_int_equal( ufsLeaderNumFollowers( leader ), 1 );
+    assert_int_equal( ufsFollowerPoll( good, 1000 ), 1 );
+    assertSameFiles( source, replicas[0] );
+
+    close( fd );
+    ufsLeaderFree( leader );
+    ufsFollowerFree( good );
+    ufsFollowerFree( stuck );
+    ufsImageFree( source );
+    for ( i = 0; i < 2; i++ )
+        ufsImageFree( replicas[i] );
+}
+
+static const struct CMUnitTest replica_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_replica_ship, replicaSetup, replicaTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_replica_failover, replicaSetup, replicaTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_replica_slow_followers, replicaSetup, replicaTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(replica_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
@@ -0,0 +1,353 @@
+/******************************************************************************\
+*  ufs_scan_test.c                                                             *
+*                                                                              *
+*  Tests for the parallel scanner of the external fs.                          *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_scan.h"
+#include "ufs_store.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define NUM_DIRS (8)
+#define NUM_FILES (20)
+#define NUM_SUB_FILES (5)
+#define MAX_SEEN (64)
+
+/* A fixed layout build swaps these for its own, see ufsTestUtilsLayoutSizes. */
+static const struct ufsHeaderSizeRequestStruct bigSizeRequest = {
+    .numFiles = 1024,
+    .numAreas = 64,
+    .numNodes = 1024,
+    .numStrBytes = 32768
+};
+
+struct scanStateStruct {
+    struct ufsTestUtilsFileNameStruct img;
+    char root[ UFS_TEST_UTILS_BUFF_SIZE ];
+};
+
+struct checkStruct {
+    bool seen[ MAX_SEEN ];
+    uint64_t entries,
+             calls;
+    bool ordered,
+         ctimes;
+};
+
+static void makeFile( const char *path ) {
+    int fd;
+
+    fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+    assert_true( fd >= 0 );
+    close( fd );
+}
+
+static int removeEntry( const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw ) {
+    (void) st;
+    (void) flag;
+    (void) ftw;
+    return remove( path );
+}
+
+static int scanSetup( void **state ) {
+    struct scanStateStruct *s;
+    char path[ UFS_TEST_UTILS_BUFF_SIZE * 2 ];
+    int i, j;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s || !ufsTestUtilsGetTmpFileName( &s -> img ) )
+        return -1;
+
+    snprintf( s -> root, sizeof( s -> root ), "/tmp/ufs_scan_XXXXXX" );
+    if ( !mkdtemp( s -> root ) )
+        return -1;
+
+    /* NUM_DIRS directories, each with files and a subdirectory of files,     */
+    /* and a link to the first one at the top.                                */
+    for ( i = 0; i < NUM_DIRS; i++ ) {
+        snprintf( path, sizeof( path ), "%s/d%d", s -> root, i );
+        mkdir( path, 0700 );
+        for ( j = 0; j < NUM_FILES; j++ ) {
+            snprintf( path, sizeof( path ), "%s/d%d/f%d", s -> root, i, j );
+            makeFile( path );
+        }
+
+        snprintf( path, sizeof( path ), "%s/d%d/sub", s -> root, i );
+        mkdir( path, 0700 );
+        for ( j = 0; j < NUM_SUB_FILES; j++ ) {
+            snprintf( path, sizeof( path ), "%s/d%d/sub/g%d", s -> root, i,
+                      j );
+            makeFile( path );
+        }
+    }
+
+    snprintf( path, sizeof( path ), "%s/link", s -> root );
+    if ( symlink( "d0", path ) )
+        return -1;
+
+    *state = s;
+    return 0;
+}
+
+static int scanTeardown( void **state ) {
+    struct scanStateStruct *s;
+
+    s = *state;
+    nftw( s -> root, removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+    unlink( s -> img.name );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+/* Checks every parent was reported before its entries.                       */
+static bool checkSink( const struct ufsScanEntryStruct *entries,
+                       uint64_t numEntries, void *userData ) {
+    struct checkStruct *check = userData;
+    uint64_t i;
+
+    check -> calls++;
+    for ( i = 0; i < numEntries; i++ ) {
+        check -> entries++;
+        if ( entries[i].parent >= MAX_SEEN || entries[i].dir >= MAX_SEEN ||
+             ( entries[i].parent && !check -> seen[ entries[i].parent ] ) )
+            check -> ordered = false;
+        if ( !entries[i].ctime || !( entries[i].mode & 0777 ) )
+            check -> ctimes = false;
+        if ( entries[i].dir < MAX_SEEN )
+            check -> seen[ entries[i].dir ] = true;
+    }
+
+    return true;
+}
+
+static bool abortSink( const struct ufsScanEntryStruct *entries,
+                       uint64_t numEntries, void *userData ) {
+    (void) entries;
+    (void) numEntries;
+
+    (*(uint64_t*)userData)++;
+    ufsErrno = UFS_OUT_OF_MEMORY;
+    return false;
+}
+
+/* ----- ufs_scan tests ----                                                  */
+
+static void test_ufs_scan_walk( void **state ) {
+    struct scanStateStruct *s;
+    struct ufsScanOptionsStruct options = { 0 };
+    struct ufsScanStatsStruct stats;
+    struct checkStruct check = { .ordered = true, .ctimes = true };
+    uint64_t calls = 0;
+
+    s = *state;
+
+    assert_false( ufsScan( NULL, options, checkSink, &check, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsScan( s -> root, options, NULL, &check, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    options.numThreads = UFS_SCAN_MAX_THREADS + 1;
+    assert_false( ufsScan( s -> root, options, checkSink, &check, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    options.numThreads = 4;
+    assert_false( ufsScan( "/does/not/exist", options, checkSink, &check,
+                           NULL ) );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+
+    options.statxMask = STATX_MODE | STATX_CTIME;
+    assert_true( ufsScan( s -> root, options, checkSink, &check, &stats ) );
+    assert_int_equal( ufsErrno, UFS_NO_ERROR );
+    assert_int_equal( stats.directories, 1 + NUM_DIRS * 2 );
+    assert_int_equal( stats.files,
+                      1 + NUM_DIRS * ( NUM_FILES + NUM_SUB_FILES ) );
+    assert_int_equal( stats.errors, 0 );
+    assert_int_equal( check.entries, stats.directories - 1 + stats.files );
+    assert_true( check.ordered );
+    assert_true( check.ctimes );
+
+    /* A sink stops the scan with its own error.                              */
+    assert_false( ufsScan( s -> root, options, abortSink, &calls, NULL ) );
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+    assert_int_equal( calls, 1 );
+}
+
+static void test_ufs_scan_load( void **state ) {
+    struct scanStateStruct *s;
+    struct ufsHeaderSizeRequestStruct sizes = bigSizeRequest;
+    struct ufsScanOptionsStruct options = { .numThreads = 3 };
+    struct ufsScanStatsStruct stats;
+    ufsScanLoaderPtr loader;
+    ufsImagePtr img;
+    ufsIdType top, dir, sub, file, link;
+    char name[ 16 ];
+    int i;
+
+    s = *state;
+    if ( !ufsTestUtilsLayoutSizes( &sizes ) )
+        skip();
+
+    img = ufsHeaderInit( s -> img.name, sizes );
+    assert_non_null( img );
+
+    assert_null( ufsScanLoaderCreate( NULL, 0 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    top = ufsStoreAddStorage( img, 0, "base", true );
+    assert_true( top > 0 );
+    loader = ufsScanLoaderCreate( img, top );
+    assert_non_null( loader );
+
+    assert_true( ufsScan( s -> root, options, ufsScanLoad, loader, &stats ) );
+    assert_int_equal( ufsScanLoaderGetDirectory( loader, 0 ), top );
+    assert_int_equal( ufsScanLoaderGetDirectory( loader, 1 + NUM_DIRS * 2 ),
+                      -1 );
+
+    for ( i = 0; i < NUM_DIRS; i++ ) {
+        snprintf( name, sizeof( name ), "d%d", i );
+        dir = ufsStoreGetStorage( img, top, name );
+        assert_true( dir > 0 );
+        assert_true( ufsStoreIsDirectory( img, dir ) );
+        assert_int_equal( ufsStoreGetParent( img, dir ), top );
+
+        file = ufsStoreGetStorage( img, dir, "f7" );
+        assert_true( file > 0 );
+        assert_false( ufsStoreIsDirectory( img, file ) );
+
+        sub = ufsStoreGetStorage( img, dir, "sub" );
+        assert_true( sub > 0 );
+        assert_true( ufsStoreGetStorage( img, sub, "g4" ) > 0 );
+    }
+
+    /* Links are loaded as files, not followed.                               */
+    link = ufsStoreGetStorage( img, top, "link" );
+    assert_true( link > 0 );
+    assert_false( ufsStoreIsDirectory( img, link ) );
+    ufsScanLoaderFree( loader );
+
+    /* Loading again keeps what's there.                                      */
+    loader = ufsScanLoaderCreate( img, top );
+    assert_non_null( loader );
+    assert_true( ufsScan( s -> root, options, ufsScanLoad, loader, NULL ) );
+    assert_int_equal( ufsStoreGetStorage( img, top, "link" ), link );
+    ufsScanLoaderFree( loader );
+    ufsImageFree( img );
+}
+
+static void test_ufs_scan_estimate( void **state ) {
+    struct scanStateStruct *s;
+    struct ufsHeaderSizeRequestStruct sizes;
+    struct ufsHeaderWorkloadStruct workload = { 0 };
+    struct ufsScanOptionsStruct options = { .numThreads = 3 };
+    ufsScanLoaderPtr loader;
+    ufsImagePtr img;
+    ufsIdType top;
+    uint64_t entries, nameBytes;
+
+    s = *state;
+    assert_false( ufsHeaderEstimateSizes( s -> root, 0, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsHeaderSizeFor( workload, 0, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* Nothing to hold gets the defaults.                                     */
+    assert_true( ufsHeaderSizeFor( workload, 0, &sizes ) );
+    assert_int_equal( sizes.numFiles, ufsDefaultSizeRequest.numFiles );
+    assert_int_equal( sizes.numAreas, ufsDefaultSizeRequest.numAreas );
+    assert_int_equal( sizes.numNodes, ufsDefaultSizeRequest.numNodes );
+    assert_int_equal( sizes.numStrBytes, ufsDefaultSizeRequest.numStrBytes );
+
+    workload = (struct ufsHeaderWorkloadStruct) {
+        .numFiles = 100000, .numAreas = 1000, .numNameBytes = 1000000,
+        .numMappings = 10000
+    };
+#ifdef UFS_FIXED_LAYOUT
+    /* A fixed layout build can't hand out more than its own.                 */
+    assert_false( ufsHeaderSizeFor( workload, 50, &sizes ) );
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+#else
+    assert_true( ufsHeaderSizeFor( workload, 50, &sizes ) );
+    assert_int_equal( sizes.numFiles, 150000 );
+    assert_int_equal( sizes.numAreas, 1500 );
+    assert_int_equal( sizes.numStrBytes,
+                      ( 1000000 + UFS_STRING_GRANULE * 101000 ) * 3 / 2 );
+    assert_true( sizes.numNodes >= 121000 / UFS_NODE_MAX_KEYS * 3 / 2 );
+    assert_true( sizes.numNodes <= 121000 / ( UFS_NODE_MIN_DEGREE - 1 ) * 2 );
+#endif /* UFS_FIXED_LAYOUT */
+
+    /* The root, every directory, file, sub directory and the link.           */
+    entries = 1 + NUM_DIRS * ( 1 + NUM_FILES + 1 + NUM_SUB_FILES ) + 1;
+    nameBytes = NUM_DIRS * ( 2 + 10 * 2 + ( NUM_FILES - 10 ) * 3 + 3 +
+                             NUM_SUB_FILES * 2 ) + 4;
+#ifdef UFS_FIXED_LAYOUT
+    /* Either the layout holds the tree and is handed out, or nothing is.     */
+    if ( !ufsHeaderEstimateSizes( s -> root, 100, &sizes ) ) {
+        assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+        skip();
+    }
+    assert_true( sizes.numFiles >= 2 * entries );
+    assert_true( sizes.numStrBytes >=
+                 2 * ( UFS_STRING_GRANULE * entries + nameBytes ) );
+#else
+    assert_true( ufsHeaderEstimateSizes( s -> root, 100, &sizes ) );
+    assert_int_equal( sizes.numFiles, 2 * entries );
+    assert_int_equal( sizes.numStrBytes,
+                      2 * ( UFS_STRING_GRANULE * entries + nameBytes ) );
+#endif /* UFS_FIXED_LAYOUT */
+    assert_true( sizes.numNodes >= ufsDefaultSizeRequest.numNodes );
+
+    /* What was estimated holds the tree.                                     */
+    img = ufsHeaderInit( s -> img.name, sizes );
+    assert_non_null( img );
+    top = ufsStoreAddStorage( img, 0, "base", true );
+    assert_true( top > 0 );
+    loader = ufsScanLoaderCreate( img, top );
+    assert_non_null( loader );
+    assert_true( ufsScan( s -> root, options, ufsScanLoad, loader, NULL ) );
+    assert_true( ufsStoreGetStorage( img, top, "link" ) > 0 );
+    ufsScanLoaderFree( loader );
+    ufsImageFree( img );
+
+    assert_false( ufsHeaderEstimateSizes( "/nonexistent/ufs", 0, &sizes ) );
+}
+
+static const struct CMUnitTest scan_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_scan_walk, scanSetup, scanTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_scan_load, scanSetup, scanTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_scan_estimate, scanSetup, scanTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(scan_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
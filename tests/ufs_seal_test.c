@@ -0,0 +1,411 @@
+/******************************************************************************\
+*  ufs_seal_test.c                                                             *
+*                                                                              *
+*  Tests for sealed ufs images.                                                *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_seal.h"
+#include "ufs_store.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define NUM_DIRS (8)
+#define NUM_FILES (200)
+
+struct sealStateStruct {
+    struct ufsTestUtilsFileNameStruct source, sealed;
+};
+
+/* A fixed layout build swaps these for its own, see ufsTestUtilsLayoutSizes. */
+static const struct ufsHeaderSizeRequestStruct sealSizeRequest = {
+    .numFiles = 4096,
+    .numAreas = 64,
+    .numNodes = 2048,
+    .numStrBytes = 65536
+};
+
+static int sealSetup( void **state ) {
+    struct sealStateStruct *s;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s || !ufsTestUtilsGetTmpFileName( &s -> source ) ||
+         !ufsTestUtilsGetTmpFileName( &s -> sealed ) )
+        return -1;
+
+    *state = s;
+    return 0;
+}
+
+static int sealTeardown( void **state ) {
+    struct sealStateStruct *s;
+
+    s = *state;
+    unlink( s -> source.name );
+    unlink( s -> sealed.name );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+static bool collectIter( ufsIdType id, void *userData ) {
+    ufsIdType **out = userData;
+    *(*out)++ = id;
+    return true;
+}
+
+static void eytzingerWalk( ufsImagePtr img, ufsIdType *children,
+                           uint64_t count, uint64_t k, char *prev ) {
+    char curr[ UFS_SEAL_NAME_MAX ];
+
+    if ( k > count )
+        return;
+
+    eytzingerWalk( img, children, count, 2 * k, prev );
+    assert_true( ufsSealGetName( img, UFS_TYPES_FILE, children[ k - 1 ],
+                                 curr, sizeof( curr ) ) );
+    assert_true( strcmp( prev, curr ) < 0 );
+    strcpy( prev, curr );
+    eytzingerWalk( img, children, count, 2 * k + 1, prev );
+}
+
+/* A toolchain like tree: directories of files, two areas mapping them.       */
+static ufsImagePtr buildSource( const char *path ) {
+    struct ufsHeaderSizeRequestStruct sizes = sealSizeRequest;
+    ufsImagePtr img;
+    ufsIdType dir, file, lib, bin;
+    char name[ 64 ];
+    int i, j;
+
+    if ( !ufsTestUtilsLayoutSizes( &sizes ) )
+        skip();
+
+    img = ufsHeaderInit( path, sizes );
+    assert_non_null( img );
+
+    lib = ufsStoreAddArea( img, "lib" );
+    bin = ufsStoreAddArea( img, "bin" );
+
+    for ( i = 0; i < NUM_DIRS; i++ ) {
+        snprintf( name, sizeof( name ), "/opt/toolchain/dir%d", i );
+        dir = ufsStoreAddStorage( img, 0, name, true );
+        assert_true( dir > 0 );
+
+        for ( j = 0; j < NUM_FILES; j++ ) {
+            snprintf( name, sizeof( name ), "libtool-%d.so.%d", j, i );
+            file = ufsStoreAddStorage( img, dir, name, false );
+            assert_true( file > 0 );
+            assert_true( ufsStoreAddMapping( img, j % 2 ? lib : bin, file ) );
+            if ( j % 3 == 0 )
+                assert_true( ufsStoreAddMapping( img, j % 2 ? bin : lib, file ) );
+        }
+    }
+
+    /* Leave some holes behind, sealing should not keep them.                */
+    ufsStoreRemoveStorage( img, ufsStoreGetStorage( img,
+        ufsStoreGetStorage( img, 0, "/opt/toolchain/dir0" ), "libtool-1.so.0" ) );
+    ufsStoreRemoveArea( img, ufsStoreAddArea( img, "scratch" ) );
+
+    return img;
+}
+
+/* ----- ufs_seal tests ----                                                  */
+
+static void test_ufs_seal_bad_args( void **state ) {
+    struct sealStateStruct *s;
+    ufsImagePtr img;
+
+    s = *state;
+
+    assert_false( ufsSeal( NULL, s -> sealed.name ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    img = ufsHeaderInit( s -> source.name, ufsDefaultSizeRequest );
+    assert_non_null( img );
+
+    assert_false( ufsSeal( img, NULL ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* Sealing never overwrites.                                             */
+    assert_false( ufsSeal( img, s -> source.name ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_seal_lookups( void **state ) {
+    struct sealStateStruct *s;
+    ufsImagePtr img, sealed;
+    ufsIdType dir, file, sealedDir, sealedFile, area;
+    char name[ 64 ], decoded[ UFS_SEAL_NAME_MAX ];
+    int i, j;
+
+    s = *state;
+    img = buildSource( s -> source.name );
+
+    assert_true( ufsSeal( img, s -> sealed.name ) );
+    assert_int_equal( ufsErrno, UFS_NO_ERROR );
+
+    sealed = ufsHeaderValidate( ufsImageOpenReadOnly( s -> sealed.name ) );
+    assert_non_null( sealed );
+
+    for ( i = 0; i < NUM_DIRS; i++ ) {
+        snprintf( name, sizeof( name ), "/opt/toolchain/dir%d", i );
+        dir = ufsStoreGetStorage( img, 0, name );
+        sealedDir = ufsStoreGetStorage( sealed, 0, name );
+        assert_true( sealedDir > 0 );
+        assert_true( ufsStoreIsDirectory( sealed, sealedDir ) );
+
+        assert_true( ufsSealGetName( sealed, UFS_TYPES_FILE, sealedDir,
+                                     decoded, sizeof( decoded ) ) );
+        assert_string_equal( decoded, name );
+
+        for ( j = 0; j < NUM_FILES; j++ ) {
+            snprintf( name, sizeof( name ), "libtool-%d.so.%d", j, i );
+            file = ufsStoreGetStorage( img, dir, name );
+            sealedFile = ufsStoreGetStorage( sealed, sealedDir, name );
+
+            if ( file < 0 ) {
+                assert_int_equal( sealedFile, -1 );
+                assert_int_equal( ufsErrno, UFS_FILE_DOES_NOT_EXIST );
+                continue;
+            }
+
+            assert_true( sealedFile > 0 );
+            assert_false( ufsStoreIsDirectory( sealed, sealedFile ) );
+            assert_int_equal( ufsStoreGetParent( sealed, sealedFile ),
+                              sealedDir );
+            assert_true( ufsSealGetName( sealed, UFS_TYPES_FILE, sealedFile,
+                                         decoded, sizeof( decoded ) ) );
+            assert_string_equal( decoded, name );
+
+            area = ufsStoreGetArea( sealed, j % 2 ? "lib" : "bin" );
+            assert_true( ufsStoreProbeMapping( sealed, area, sealedFile ) );
+            area = ufsStoreGetArea( sealed, j % 2 ? "bin" : "lib" );
+            assert_int_equal( ufsStoreProbeMapping( sealed, area, sealedFile ),
+                              j % 3 == 0 );
+        }
+
+        /* Names that were never added miss after a single probe.            */
+        assert_int_equal( ufsStoreGetStorage( sealed, sealedDir, "nope" ), -1 );
+        assert_int_equal( ufsStoreGetStorage( sealed, 0, "libtool-2.so.0" ), -1 );
+    }
+
+    assert_int_equal( ufsStoreGetArea( sealed, "scratch" ), -1 );
+    assert_int_equal( ufsErrno, UFS_AREA_DOES_NOT_EXIST );
+
+    ufsImageFree( sealed );
+    ufsImageFree( img );
+}
+
+static void test_ufs_seal_children_are_dense_and_sorted( void **state ) {
+    struct sealStateStruct *s;
+    ufsImagePtr img, sealed;
+    ufsIdType dir, children[ NUM_FILES ], *end;
+    char prev[ UFS_SEAL_NAME_MAX ];
+    uint64_t count, i;
+
+    s = *state;
+    img = buildSource( s -> source.name );
+    assert_true( ufsSeal( img, s -> sealed.name ) );
+    ufsImageFree( img );
+
+    sealed = ufsHeaderValidate( ufsImageOpenReadOnly( s -> sealed.name ) );
+    assert_non_null( sealed );
+
+    dir = ufsStoreGetStorage( sealed, 0, "/opt/toolchain/dir3" );
+    end = children;
+    assert_true( ufsStoreIterateChildren( sealed, dir, collectIter, &end ) );
+    count = end - children;
+    assert_int_equal( count, NUM_FILES );
+
+    for ( i = 1; i < count; i++ )
+        assert_int_equal( children[i], children[0] + i );
+
+    /* An in order walk of the Eytzinger layout gives the names sorted.      */
+    prev[0] = '\0';
+    eytzingerWalk( sealed, children, count, 1, prev );
+
+    ufsImageFree( sealed );
+}
+
+static void test_ufs_seal_is_immutable( void **state ) {
+    struct sealStateStruct *s;
+    ufsImagePtr img, sealed;
+    ufsIdType dir;
+
+    s = *state;
+    img = buildSource( s -> source.name );
+    assert_true( ufsSeal( img, s -> sealed.name ) );
+    ufsImageFree( img );
+
+    /* Even through a writable mapping the header flag refuses mutation.     */
+    sealed = ufsHeaderValidate( ufsImageOpen( s -> sealed.name ) );
+    assert_non_null( sealed );
+
+    dir = ufsStoreGetStorage( sealed, 0, "/opt/toolchain/dir1" );
+    assert_true( dir > 0 );
+
+    assert_int_equal( ufsStoreAddStorage( sealed, dir, "new", false ), -1 );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_SEALED );
+    assert_int_equal( ufsStoreAddArea( sealed, "new" ), -1 );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_SEALED );
+    assert_false( ufsStoreRemoveStorage( sealed, dir ) );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_SEALED );
+    assert_false( ufsStoreAddMapping( sealed, 1, dir ) );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_SEALED );
+    assert_false( ufsStoreRemoveArea( sealed, 1 ) );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_SEALED );
+
+    /* Re-sealing makes no sense.                                            */
+    assert_false( ufsSeal( sealed, s -> source.name ) );
+
+    ufsImageFree( sealed );
+}
+
+static void test_ufs_seal_is_smaller( void **state ) {
+    struct sealStateStruct *s;
+    ufsImagePtr img, sealed;
+    uint64_t sourceSize;
+
+    s = *state;
+    img = buildSource( s -> source.name );
+    sourceSize = *(uint64_t*)img;
+    assert_true( ufsSeal( img, s -> sealed.name ) );
+    ufsImageFree( img );
+
+    sealed = ufsHeaderValidate( ufsImageOpenReadOnly( s -> sealed.name ) );
+    assert_non_null( sealed );
+    assert_true( *(uint64_t*)sealed * 2 <= sourceSize );
+    ufsImageFree( sealed );
+}
+
+static void test_ufs_seal_empty( void **state ) {
+    struct sealStateStruct *s;
+    ufsImagePtr img, sealed;
+
+    s = *state;
+    img = ufsHeaderInit( s -> source.name, ufsDefaultSizeRequest );
+    assert_true( ufsSeal( img, s -> sealed.name ) );
+    ufsImageFree( img );
+
+    sealed = ufsHeaderValidate( ufsImageOpenReadOnly( s -> sealed.name ) );
+    assert_non_null( sealed );
+    assert_int_equal( ufsStoreGetStorage( sealed, 0, "x" ), -1 );
+    assert_int_equal( ufsStoreGetArea( sealed, "x" ), -1 );
+    ufsImageFree( sealed );
+}
+
+static void test_ufs_seal_refuses_foreign_references( void **state ) {
+    struct sealStateStruct *s;
+    ufsImagePtr img;
+
+    s = *state;
+    img = ufsHeaderInit( s -> source.name, ufsDefaultSizeRequest );
+
+    /* A parent that lives in some other image.                              */
+    assert_true( ufsStoreAddStorage( img, 12345, "orphan", false ) > 0 );
+    assert_false( ufsSeal( img, s -> sealed.name ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_seal_corrupted( void **state ) {
+    struct sealStateStruct *s;
+    ufsImagePtr img;
+
+    s = *state;
+    img = buildSource( s -> source.name );
+    assert_true( ufsSeal( img, s -> sealed.name ) );
+    ufsImageFree( img );
+
+    img = ufsImageOpen( s -> sealed.name );
+    assert_non_null( img );
+    ufsHeaderGet( img ) -> offsets[ UFS_TYPES_STRING ] = UINT32_MAX;
+    assert_null( ufsHeaderValidate( img ) );
+    assert_int_equal( ufsErrno, UFS_IMAGE_BAD_SIZE );
+}
+
+static void test_ufs_seal_corrupted_mappings( void **state ) {
+    struct sealStateStruct *s;
+    struct ufsSealHeaderStruct *seal;
+    ufsImagePtr img;
+    uint64_t *offsets;
+
+    s = *state;
+    img = buildSource( s -> source.name );
+    assert_true( ufsSeal( img, s -> sealed.name ) );
+    ufsImageFree( img );
+
+    /* An offset going backwards.                                            */
+    img = ufsImageOpen( s -> sealed.name );
+    assert_non_null( img );
+    seal = (struct ufsSealHeaderStruct*)( (uint8_t*)img +
+        ufsHeaderGet( img ) -> offsets[ UFS_TYPES_NODE ] );
+    offsets = (uint64_t*)( (uint8_t*)img +
+        seal -> offsets[ UFS_SEAL_MAPPING_OFFSETS ] );
+    offsets[2] = offsets[1] - 1;
+    assert_null( ufsHeaderValidate( img ) );
+    assert_int_equal( ufsErrno, UFS_IMAGE_BAD_SIZE );
+
+    /* The last offset past the end of the table.                            */
+    unlink( s -> source.name );
+    unlink( s -> sealed.name );
+    img = buildSource( s -> source.name );
+    assert_true( ufsSeal( img, s -> sealed.name ) );
+    ufsImageFree( img );
+
+    img = ufsImageOpen( s -> sealed.name );
+    assert_non_null( img );
+    seal = (struct ufsSealHeaderStruct*)( (uint8_t*)img +
+        ufsHeaderGet( img ) -> offsets[ UFS_TYPES_NODE ] );
+    offsets = (uint64_t*)( (uint8_t*)img +
+        seal -> offsets[ UFS_SEAL_MAPPING_OFFSETS ] );
+    offsets[ seal -> sizes[ UFS_SEAL_MAPPING_OFFSETS ] - 1 ] =
+        seal -> sizes[ UFS_SEAL_MAPPING_AREAS ] + 1;
+    assert_null( ufsHeaderValidate( img ) );
+    assert_int_equal( ufsErrno, UFS_IMAGE_BAD_SIZE );
+}
+
+static const struct CMUnitTest seal_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_seal_bad_args, sealSetup, sealTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_seal_lookups, sealSetup, sealTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_seal_children_are_dense_and_sorted, sealSetup, sealTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_seal_is_immutable, sealSetup, sealTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_seal_is_smaller, sealSetup, sealTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_seal_empty, sealSetup, sealTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_seal_refuses_foreign_references, sealSetup, sealTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_seal_corrupted, sealSetup, sealTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_seal_corrupted_mappings, sealSetup, sealTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(seal_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
@@ -0,0 +1,458 @@
+/******************************************************************************\
+*  ufs_send_test.c                                                             *
+*                                                                              *
+*  Tests for the ufs replication streams.                                      *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_send.h"
+#include "ufs_store.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define NUM_DIRS (16)
+#define NUM_FILES (2000)
+
+struct sendStateStruct {
+    struct ufsTestUtilsFileNameStruct source, replica, stream;
+};
+
+struct mappingCheckStruct {
+    ufsImagePtr other;
+    ufsIdType area;
+    uint64_t count;
+};
+
+struct senderArgsStruct {
+    ufsImagePtr img;
+    ufsIdType snapshot;
+    int fd;
+    bool ret;
+};
+
+static const struct ufsHeaderSizeRequestStruct sendSizeRequest = {
+    .numFiles = 4096,
+    .numAreas = 64,
+    .numNodes = 4096,
+    .numStrBytes = 131072
+};
+
+/* The sizes every image here is made with, a fixed layout build swaps in    */
+/* its own and skips the test when they hold less.                           */
+static struct ufsHeaderSizeRequestStruct sendSizes( void ) {
+    struct ufsHeaderSizeRequestStruct sizes = sendSizeRequest;
+
+    if ( !ufsTestUtilsLayoutSizes( &sizes ) )
+        skip();
+
+    return sizes;
+}
+
+static int sendSetup( void **state ) {
+    struct sendStateStruct *s;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s || !ufsTestUtilsGetTmpFileName( &s -> source ) ||
+         !ufsTestUtilsGetTmpFileName( &s -> replica ) ||
+         !ufsTestUtilsGetTmpFileName( &s -> stream ) )
+        return -1;
+
+    *state = s;
+    return 0;
+}
+
+static int sendTeardown( void **state ) {
+    struct sendStateStruct *s;
+
+    s = *state;
+    unlink( s -> source.name );
+    unlink( s -> replica.name );
+    unlink( s -> stream.name );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+static bool probeIter( ufsIdType id, void *userData ) {
+    struct mappingCheckStruct *check = userData;
+
+    assert_true( ufsStoreProbeMapping( check -> other, check -> area, id ) );
+    check -> count++;
+    return true;
+}
+
+/* Every record and mapping of a is in b under the same identifier, and     */
+/* the other way around.                                                      */
+static void assertSameStore( ufsImagePtr a, ufsImagePtr b ) {
+    struct mappingCheckStruct checkA, checkB;
+    ufsIdType id;
+
+    for ( id = 1; id <= ufsHeaderGet( a ) -> sizes[ UFS_TYPES_FILE ]; id++ ) {
+        assert_int_equal( ufsStoreHasStorage( a, id ),
+                          ufsStoreHasStorage( b, id ) );
+        if ( !ufsStoreHasStorage( a, id ) )
+            continue;
+
+        assert_int_equal( ufsStoreIsDirectory( a, id ),
+                          ufsStoreIsDirectory( b, id ) );
+        assert_int_equal( ufsStoreGetParent( a, id ),
+                          ufsStoreGetParent( b, id ) );
+        assert_string_equal( ufsStoreGetName( a, UFS_TYPES_FILE, id ),
+                             ufsStoreGetName( b, UFS_TYPES_FILE, id ) );
+        assert_int_equal( ufsStoreGetStorage( b, ufsStoreGetParent( b, id ),
+                                              ufsStoreGetName( b,
+                                                               UFS_TYPES_FILE,
+                                                               id ) ), id );
+    }
+
+    for ( id = 1; id <= ufsHeaderGet( a ) -> sizes[ UFS_TYPES_AREA ]; id++ ) {
+        assert_int_equal( ufsStoreHasArea( a, id ), ufsStoreHasArea( b, id ) );
+        if ( !ufsStoreHasArea( a, id ) )
+            continue;
+
+        assert_string_equal( ufsStoreGetName( a, UFS_TYPES_AREA, id ),
+                             ufsStoreGetName( b, UFS_TYPES_AREA, id ) );
+        assert_int_equal( ufsStoreGetArea( b, ufsStoreGetName( b,
+                                                                UFS_TYPES_AREA,
+                                                                id ) ), id );
+
+        checkA = ( struct mappingCheckStruct ){ .other = b, .area = id };
+        checkB = ( struct mappingCheckStruct ){ .other = a, .area = id };
+        ufsStoreIterateAreaMappings( a, id, probeIter, &checkA );
+        ufsStoreIterateAreaMappings( b, id, probeIter, &checkB );
+        assert_int_equal( checkA.count, checkB.count );
+    }
+}
+
+static void populate( ufsImagePtr img, ufsIdType *dirs, ufsIdType *files,
+                      ufsIdType *areas ) {
+    char name[ 64 ];
+    int i;
+
+    for ( i = 0; i < 4; i++ ) {
+        snprintf( name, sizeof( name ), "area-%d", i );
+        areas[i] = ufsStoreAddArea( img, name );
+        assert_true( areas[i] > 0 );
+    }
+
+    for ( i = 0; i < NUM_DIRS; i++ ) {
+        snprintf( name, sizeof( name ), "/src/dir-%d", i );
+        dirs[i] = ufsStoreAddStorage( img, 0, name, true );
+        assert_true( dirs[i] > 0 );
+        assert_true( ufsStoreAddMapping( img, areas[ i % 4 ], dirs[i] ) );
+    }
+
+    for ( i = 0; i < NUM_FILES; i++ ) {
+        snprintf( name, sizeof( name ), "file-%d.c", i );
+        files[i] = ufsStoreAddStorage( img, dirs[ i % NUM_DIRS ], name, false );
+        assert_true( files[i] > 0 );
+        assert_true( ufsStoreAddMapping( img, areas[ i % 4 ], files[i] ) );
+    }
+}
+
+static uint64_t fileSize( const char *path ) {
+    struct stat st;
+
+    assert_int_equal( stat( path, &st ), 0 );
+    return st.st_size;
+}
+
+static void *senderThread( void *arg ) {
+    struct senderArgsStruct *args = arg;
+
+    args -> ret = ufsSend( args -> img, 0, args -> snapshot, args -> fd );
+    close( args -> fd );
+    return NULL;
+}
+
+/* ----- ufs_send tests ----                                                  */
+
+static void test_ufs_send_full_and_incremental( void **state ) {
+    struct sendStateStruct *s;
+    ufsIdType dirs[ NUM_DIRS ], files[ NUM_FILES ], areas[4], first, second;
+    ufsIdType spare, added;
+    ufsImagePtr source, replica;
+    uint64_t fullSize;
+    int fd, i;
+
+    s = *state;
+
+    source = ufsHeaderInit( s -> source.name, sendSizes() );
+    replica = ufsHeaderInit( s -> replica.name, sendSizes() );
+    assert_non_null( source );
+    assert_non_null( replica );
+
+    populate( source, dirs, files, areas );
+    spare = ufsStoreAddArea( source, "spare" );
+    assert_true( spare > 0 );
+    first = ufsStoreSnapshot( source );
+    assert_true( first > 0 );
+
+    assert_false( ufsSend( source, 0, first + 1, 1 ) );
+    assert_int_equal( ufsErrno, UFS_SNAPSHOT_DOES_NOT_EXIST );
+
+    fd = open( s -> stream.name, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    assert_true( fd >= 0 );
+    assert_true( ufsSend( source, 0, first, fd ) );
+    fullSize = fileSize( s -> stream.name );
+
+    assert_int_equal( lseek( fd, 0, SEEK_SET ), 0 );
+    assert_true( ufsReceive( replica, fd ) );
+    close( fd );
+    assertSameStore( source, replica );
+
+    /* A handful of changes touching every index.                            */
+    for ( i = 0; i < 10; i++ )
+        assert_true( ufsStoreRemoveStorage( source, files[ i * 7 ] ) );
+    assert_true( ufsStoreRemoveMapping( source, areas[1], files[1] ) );
+    assert_true( ufsStoreAddMapping( source, areas[2], files[1] ) );
+    assert_true( ufsStoreRemoveArea( source, spare ) );
+    added = ufsStoreAddArea( source, "fresh" );
+    assert_true( added > 0 );
+    assert_true( ufsStoreAddStorage( source, dirs[0], "new.c", false ) > 0 );
+
+    second = ufsStoreSnapshot( source );
+    assert_true( second > 0 );
+
+    fd = open( s -> stream.name, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    assert_true( fd >= 0 );
+    assert_true( ufsSend( source, first, second, fd ) );
+    assert_true( fileSize( s -> stream.name ) * 20 < fullSize );
+
+    assert_int_equal( lseek( fd, 0, SEEK_SET ), 0 );
+    assert_true( ufsReceive( replica, fd ) );
+    assertSameStore( source, replica );
+
+    /* The replica moved on, the same stream doesn't apply twice.            */
+    assert_int_equal( lseek( fd, 0, SEEK_SET ), 0 );
+    assert_false( ufsReceive( replica, fd ) );
+    assert_int_equal( ufsErrno, UFS_STREAM_DOES_NOT_APPLY );
+    close( fd );
+
+    /* Records of a replica only change through streams.                     */
+    assert_int_equal( ufsStoreAddStorage( replica, 0, "/local", true ), -1 );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_REPLICA );
+    assert_false( ufsStoreRemoveStorage( replica, dirs[1] ) );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_REPLICA );
+    assert_int_equal( ufsStoreAddArea( replica, "local" ), -1 );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_REPLICA );
+
+    ufsImageFree( source );
+    ufsImageFree( replica );
+
+    /* The replica keeps its place across a reopen.                          */
+    replica = ufsHeaderValidate( ufsImageOpen( s -> replica.name ) );
+    assert_non_null( replica );
+    source = ufsHeaderValidate( ufsImageOpen( s -> source.name ) );
+    assert_non_null( source );
+    assertSameStore( source, replica );
+
+    ufsImageFree( source );
+    ufsImageFree( replica );
+}
+
+static void test_ufs_send_pipe( void **state ) {
+    struct sendStateStruct *s;
+    struct senderArgsStruct args;
+    ufsIdType dirs[ NUM_DIRS ], files[ NUM_FILES ], areas[4];
+    ufsImagePtr source, replica;
+    pthread_t thread;
+    int fds[2];
+
+    s = *state;
+
+    source = ufsHeaderInit( s -> source.name, sendSizes() );
+    replica = ufsHeaderInit( s -> replica.name, sendSizes() );
+    assert_non_null( source );
+    assert_non_null( replica );
+
+    populate( source, dirs, files, areas );
+
+    /* The stream is far larger than a pipe buffer.                          */
+    assert_int_equal( pipe( fds ), 0 );
+    args = ( struct senderArgsStruct ){
+        .img = source,
+        .snapshot = ufsStoreSnapshot( source ),
+        .fd = fds[1]
+    };
+    assert_int_equal( pthread_create( &thread, NULL, senderThread, &args ), 0 );
+
+    assert_true( ufsReceive( replica, fds[0] ) );
+    assert_int_equal( pthread_join( thread, NULL ), 0 );
+    assert_true( args.ret );
+    close( fds[0] );
+
+    assertSameStore( source, replica );
+
+    ufsImageFree( source );
+    ufsImageFree( replica );
+}
+
+static void test_ufs_send_corrupted( void **state ) {
+    struct sendStateStruct *s;
+    ufsIdType dirs[ NUM_DIRS ], files[ NUM_FILES ], areas[4], snapshot;
+    ufsImagePtr source, replica;
+    uint64_t size;
+    uint8_t byte;
+    int fd;
+
+    s = *state;
+
+    source = ufsHeaderInit( s -> source.name, sendSizes() );
+    replica = ufsHeaderInit( s -> replica.name, sendSizes() );
+    assert_non_null( source );
+    assert_non_null( replica );
+
+    populate( source, dirs, files, areas );
+    snapshot = ufsStoreSnapshot( source );
+
+    fd = open( s -> stream.name, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    assert_true( fd >= 0 );
+    assert_true( ufsSend( source, 0, snapshot, fd ) );
+    size = fileSize( s -> stream.name );
+
+    /* A flipped bit in the last chunk, after most changes were read.        */
+    assert_int_equal( pread( fd, &byte, 1, size - 64 ), 1 );
+    byte ^= 0x10;
+    assert_int_equal( pwrite( fd, &byte, 1, size - 64 ), 1 );
+
+    assert_int_equal( lseek( fd, 0, SEEK_SET ), 0 );
+    assert_false( ufsReceive( replica, fd ) );
+    assert_int_equal( ufsErrno, UFS_STREAM_IS_CORRUPTED );
+
+    /* A stream cut short.                                                   */
+    byte ^= 0x10;
+    assert_int_equal( pwrite( fd, &byte, 1, size - 64 ), 1 );
+    assert_int_equal( ftruncate( fd, size - 1 ), 0 );
+    assert_int_equal( lseek( fd, 0, SEEK_SET ), 0 );
+    assert_false( ufsReceive( replica, fd ) );
+    assert_int_equal( ufsErrno, UFS_STREAM_IS_CORRUPTED );
+    close( fd );
+
+    /* Nothing was applied.                                                  */
+    assert_int_equal( ufsHeaderGet( replica ) -> used[ UFS_TYPES_FILE ], 0 );
+    assert_int_equal( ufsHeaderGet( replica ) -> flags &
+                      UFS_HEADER_FLAG_REPLICA, 0 );
+    assert_int_equal( ufsStoreAddStorage( replica, 0, "/local", true ), 1 );
+
+    ufsImageFree( source );
+    ufsImageFree( replica );
+}
+
+static void test_ufs_send_corrupted_incremental( void **state ) {
+    struct sendStateStruct *s;
+    ufsIdType dirs[ NUM_DIRS ], files[ NUM_FILES ], areas[4], first, second;
+    ufsImagePtr source, replica, before;
+    uint64_t size, strings;
+    char name[ 64 ];
+    uint8_t byte;
+    int fd, i;
+
+    s = *state;
+
+    source = ufsHeaderInit( s -> source.name, sendSizes() );
+    replica = ufsHeaderInit( s -> replica.name, sendSizes() );
+    assert_non_null( source );
+    assert_non_null( replica );
+
+    populate( source, dirs, files, areas );
+    first = ufsStoreSnapshot( source );
+    assert_true( first > 0 );
+
+    fd = open( s -> stream.name, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    assert_true( fd >= 0 );
+    assert_true( ufsSend( source, 0, first, fd ) );
+    assert_int_equal( lseek( fd, 0, SEEK_SET ), 0 );
+    assert_true( ufsReceive( replica, fd ) );
+    close( fd );
+
+    /* Enough changes of every kind for several chunks.                      */
+    for ( i = 0; i < NUM_FILES / 2; i++ )
+        assert_true( ufsStoreRemoveStorage( source, files[i] ) );
+    for ( i = 0; i < NUM_FILES / 2; i++ ) {
+        snprintf( name, sizeof( name ), "new-%d.c", i );
+        files[i] = ufsStoreAddStorage( source, dirs[ i % NUM_DIRS ], name,
+                                       false );
+        assert_true( files[i] > 0 );
+        assert_true( ufsStoreAddMapping( source, areas[ i % 4 ], files[i] ) );
+    }
+    second = ufsStoreSnapshot( source );
+    assert_true( second > 0 );
+
+    fd = open( s -> stream.name, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    assert_true( fd >= 0 );
+    assert_true( ufsSend( source, first, second, fd ) );
+    size = fileSize( s -> stream.name );
+    assert_true( size > UFS_SEND_CHUNK_BYTES );
+
+    /* The chunks before the damaged one were applied and are rolled back.   */
+    assert_int_equal( pread( fd, &byte, 1, size - 64 ), 1 );
+    byte ^= 0x10;
+    assert_int_equal( pwrite( fd, &byte, 1, size - 64 ), 1 );
+
+    strings = ufsHeaderGet( replica ) -> used[ UFS_TYPES_STRING ] -
+              ufsHeaderGet( replica ) -> numFree[ UFS_TYPES_STRING ];
+    assert_int_equal( lseek( fd, 0, SEEK_SET ), 0 );
+    assert_false( ufsReceive( replica, fd ) );
+    assert_int_equal( ufsErrno, UFS_STREAM_IS_CORRUPTED );
+
+    before = ufsStoreOpenSnapshot( s -> source.name, first );
+    assert_non_null( before );
+    assertSameStore( before, replica );
+    ufsImageFree( before );
+    assert_int_equal( ufsHeaderGet( replica ) -> used[ UFS_TYPES_STRING ] -
+                      ufsHeaderGet( replica ) -> numFree[ UFS_TYPES_STRING ],
+                      strings );
+    assert_int_equal( ufsHeaderGet( replica ) -> numSnapshots, 0 );
+
+    /* The replica is still at the first snapshot and takes the stream.      */
+    byte ^= 0x10;
+    assert_int_equal( pwrite( fd, &byte, 1, size - 64 ), 1 );
+    assert_int_equal( lseek( fd, 0, SEEK_SET ), 0 );
+    assert_true( ufsReceive( replica, fd ) );
+    close( fd );
+    assertSameStore( source, replica );
+
+    ufsImageFree( source );
+    ufsImageFree( replica );
+}
+
+static const struct CMUnitTest send_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_send_full_and_incremental, sendSetup, sendTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_send_pipe, sendSetup, sendTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_send_corrupted, sendSetup, sendTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_send_corrupted_incremental, sendSetup, sendTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(send_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
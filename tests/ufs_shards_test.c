@@ -0,0 +1,332 @@
+/******************************************************************************\
+*  ufs_shards_test.c                                                           *
+*                                                                              *
+*  Tests for ufs instances sharded by area.                                    *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+#define _GNU_SOURCE
+
+#include <ftw.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ufs.h"
+#include "ufs_backend.h"
+#include "ufs_defs.h"
+#include "ufs_shards.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define NUM_SHARDS (4)
+#define NUM_AREAS (32)
+#define NUM_WRITERS (4)
+#define FILES_PER_WRITER (256)
+#define MAX_COLLAPSE (1024)
+
+struct shardsStateStruct {
+    struct ufsTestUtilsFileNameStruct path;
+    char opts[ UFS_TEST_UTILS_BUFF_SIZE + 64 ];
+};
+
+struct countStruct {
+    uint64_t count;
+    uint64_t numEntries;
+};
+
+struct writerStruct {
+    ufsType ufs;
+    ufsIdentifierType area;
+    ufsIdentifierType files[ FILES_PER_WRITER ];
+    bool failed;
+};
+
+static int removeEntry( const char *path, const struct stat *sb, int flag,
+                        struct FTW *ftw ) {
+    (void) sb; (void) flag; (void) ftw;
+    return remove( path );
+}
+
+static int shardsSetup( void **state ) {
+    struct shardsStateStruct *s;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s || !ufsTestUtilsGetTmpFileName( &s -> path ) )
+        return -1;
+
+    snprintf( s -> opts, sizeof( s -> opts ),
+              "path=%s,files=2048,nodes=2048,strbytes=65536", s -> path.name );
+    *state = s;
+    return 0;
+}
+
+static int shardsTeardown( void **state ) {
+    struct shardsStateStruct *s;
+
+    s = *state;
+    nftw( s -> path.name, removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+static ufsStatusType countDirIter( ufsIdentifierType storage,
+                                   uint64_t currEntry,
+                                   uint64_t numEntries,
+                                   void *userData ) {
+    struct countStruct *c = userData;
+
+    assert_true( storage > 0 );
+    assert_int_equal( currEntry, c -> count );
+    c -> count++;
+    c -> numEntries = numEntries;
+    return UFS_NO_ERROR;
+}
+
+#ifndef UFS_FIXED_LAYOUT
+
+static void *writerThread( void *arg ) {
+    struct writerStruct *w;
+    uint64_t i;
+
+    w = arg;
+    for ( i = 0; i < FILES_PER_WRITER; i++ ) {
+        if ( ufsAddMapping( w -> ufs, w -> area, w -> files[i] ) !=
+             UFS_NO_ERROR ||
+             ufsProbeMapping( w -> ufs, w -> area, w -> files[i] ) !=
+             UFS_NO_ERROR )
+            w -> failed = true;
+    }
+
+    return NULL;
+}
+
+#endif /* UFS_FIXED_LAYOUT */
+
+/* ----- ufs_shards tests ----                                                */
+
+static void test_ufs_shards_spread( void **state ) {
+    struct shardsStateStruct *s;
+    struct countStruct c = { 0 };
+    ufsIdentifierType dir, file, areas[ NUM_AREAS ];
+    ufsViewType view = { UFS_VIEW_TERMINATOR };
+    ufsType ufs;
+    char name[ 32 ];
+    uint64_t i, used;
+
+    s = *state;
+
+    assert_null( ufsInitSharded( s -> path.name, 0 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_null( ufsInitSharded( s -> path.name, UFS_SHARDS_MAX + 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    ufs = ufsInitSharded( s -> path.name, NUM_SHARDS );
+    assert_non_null( ufs );
+
+    dir = ufsAddDirectory( ufs, "/d" );
+    file = ufsAddFile( ufs, dir, "f" );
+    assert_true( dir > 0 && file > 0 );
+
+    /* Areas land in every shard, each one maps the file.                   */
+    used = 0;
+    for ( i = 0; i < NUM_AREAS; i++ ) {
+        snprintf( name, sizeof( name ), "area%lu", i );
+        areas[i] = ufsAddArea( ufs, name );
+        assert_true( areas[i] > 0 );
+        assert_true( areas[i] >> UFS_SHARDS_SHIFT >= 1 );
+        assert_true( areas[i] >> UFS_SHARDS_SHIFT <= NUM_SHARDS );
+        used |= 1 << ( ( areas[i] >> UFS_SHARDS_SHIFT ) - 1 );
+        assert_int_equal( ufsAddMapping( ufs, areas[i], file ), UFS_NO_ERROR );
+    }
+    assert_int_equal( used, ( 1 << NUM_SHARDS ) - 1 );
+
+    view[0] = areas[3]; view[1] = areas[7]; view[2] = 0;
+    view[3] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsResolveStorageInView( ufs, view, file ), areas[3] );
+    assert_int_equal( ufsIterateDirInView( ufs, view, dir, countDirIter, &c ),
+                      UFS_NO_ERROR );
+    assert_int_equal( c.count, 1 );
+
+    /* Removing the file drops its mappings in every shard, so BASE holds    */
+    /* the next file to get its identifier.                                  */
+    assert_int_equal( ufsRemoveFile( ufs, file ), UFS_NO_ERROR );
+    file = ufsAddFile( ufs, dir, "g" );
+    for ( i = 0; i < NUM_AREAS; i++ )
+        assert_int_equal( ufsProbeMapping( ufs, areas[i], file ),
+                          UFS_MAPPING_DOES_NOT_EXIST );
+    assert_int_equal( ufsResolveStorageInView( ufs, view, file ), 0 );
+    ufsDestroy( ufs );
+
+    /* The number of shards comes with the directory.                        */
+    snprintf( s -> opts, sizeof( s -> opts ), "path=%s,shards=%d",
+              s -> path.name, NUM_SHARDS + 1 );
+    assert_null( ufsInitWithBackend( "sharded", s -> opts ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    snprintf( s -> opts, sizeof( s -> opts ), "path=%s", s -> path.name );
+    ufs = ufsInitWithBackend( "sharded", s -> opts );
+    assert_non_null( ufs );
+    for ( i = 0; i < NUM_AREAS; i++ ) {
+        snprintf( name, sizeof( name ), "area%lu", i );
+        assert_int_equal( ufsGetArea( ufs, name ), areas[i] );
+    }
+    ufsDestroy( ufs );
+}
+
+#ifndef UFS_FIXED_LAYOUT
+
+static void test_ufs_shards_parallel( void **state ) {
+    struct shardsStateStruct *s;
+    struct writerStruct writers[ NUM_WRITERS ];
+    struct countStruct c = { 0 };
+    pthread_t threads[ NUM_WRITERS ];
+    ufsIdentifierType dir;
+    ufsViewType view = { UFS_VIEW_TERMINATOR };
+    ufsType ufs;
+    char name[ 32 ];
+    uint64_t i, j;
+
+    s = *state;
+
+    ufs = ufsInitWithBackend( "sharded", s -> opts );
+    assert_non_null( ufs );
+    dir = ufsAddDirectory( ufs, "/d" );
+
+    for ( i = 0; i < NUM_WRITERS; i++ ) {
+        writers[i].ufs = ufs;
+        writers[i].failed = false;
+        snprintf( name, sizeof( name ), "sandbox%lu", i );
+        writers[i].area = ufsAddArea( ufs, name );
+        assert_true( writers[i].area > 0 );
+
+        for ( j = 0; j < FILES_PER_WRITER; j++ ) {
+            snprintf( name, sizeof( name ), "f%lu-%lu", i, j );
+            writers[i].files[j] = ufsAddFile( ufs, dir, name );
+            assert_true( writers[i].files[j] > 0 );
+        }
+    }
+
+    /* Writers of different areas run at once, listings run alongside.       */
+    for ( i = 0; i < NUM_WRITERS; i++ )
+        assert_int_equal( pthread_create( &threads[i], NULL, writerThread,
+                                          &writers[i] ), 0 );
+
+    for ( i = 0; i < NUM_WRITERS; i++ )
+        view[i] = writers[i].area;
+    view[ NUM_WRITERS ] = UFS_VIEW_TERMINATOR;
+    for ( i = 0; i < 8; i++ ) {
+        c.count = 0;
+        assert_int_equal( ufsIterateDirInView( ufs, view, dir, countDirIter,
+                                               &c ), UFS_NO_ERROR );
+        assert_true( c.count <= NUM_WRITERS * FILES_PER_WRITER );
+    }
+
+    for ( i = 0; i < NUM_WRITERS; i++ ) {
+        assert_int_equal( pthread_join( threads[i], NULL ), 0 );
+        assert_false( writers[i].failed );
+    }
+
+    c.count = 0;
+    assert_int_equal( ufsIterateDirInView( ufs, view, dir, countDirIter, &c ),
+                      UFS_NO_ERROR );
+    assert_int_equal( c.count, NUM_WRITERS * FILES_PER_WRITER );
+
+    for ( i = 0; i < NUM_WRITERS; i++ ) {
+        view[0] = writers[i].area; view[1] = UFS_VIEW_TERMINATOR;
+        assert_int_equal( ufsResolveStorageInView( ufs, view,
+                                                   writers[i].files[0] ),
+                          writers[i].area );
+        c.count = 0;
+        assert_int_equal( ufsIterateDirInView( ufs, view, dir, countDirIter,
+                                               &c ), UFS_NO_ERROR );
+        assert_int_equal( c.count, FILES_PER_WRITER );
+    }
+
+    ufsDestroy( ufs );
+}
+
+/* Nodes for a few hundred mappings, a fixed layout build refuses the sizes. */
+static void test_ufs_shards_collapse_all_or_nothing( void **state ) {
+    struct shardsStateStruct *s;
+    char opts[ UFS_TEST_UTILS_BUFF_SIZE + 64 ], name[ 32 ];
+    ufsIdentifierType dir, src, dst, files[ MAX_COLLAPSE ];
+    ufsViewType view = { UFS_VIEW_TERMINATOR };
+    ufsType ufs;
+    int i, n;
+
+    s = *state;
+    snprintf( opts, sizeof( opts ),
+              "path=%s,shards=1,files=4096,strbytes=65536,nodes=64",
+              s -> path.name );
+    ufs = ufsInitWithBackend( "sharded", opts );
+    assert_non_null( ufs );
+
+    dir = ufsAddDirectory( ufs, "/d" );
+    src = ufsAddArea( ufs, "src" );
+    dst = ufsAddArea( ufs, "dst" );
+    assert_true( dir > 0 && src > 0 && dst > 0 );
+
+    /* Map until the nodes of the shard run out, then make room for some of  */
+    /* them only.                                                            */
+    for ( n = 0; n < MAX_COLLAPSE; n++ ) {
+        snprintf( name, sizeof( name ), "f%d", n );
+        files[n] = ufsAddFile( ufs, dir, name );
+        if ( files[n] < 0 ||
+             ufsAddMapping( ufs, src, files[n] ) != UFS_NO_ERROR )
+            break;
+    }
+    assert_true( n > 0 && n < MAX_COLLAPSE );
+
+    for ( i = n - n / 4; i < n; i++ )
+        assert_int_equal( ufsRemoveFile( ufs, files[i] ), UFS_NO_ERROR );
+    n -= n / 4;
+
+    view[0] = src; view[1] = dst; view[2] = UFS_VIEW_TERMINATOR;
+    assert_int_not_equal( ufsCollapse( ufs, view ), UFS_NO_ERROR );
+
+    /* The mappings dst got before the failure went back.                    */
+    for ( i = 0; i < n; i++ ) {
+        assert_int_equal( ufsProbeMapping( ufs, src, files[i] ),
+                          UFS_NO_ERROR );
+        assert_int_equal( ufsProbeMapping( ufs, dst, files[i] ),
+                          UFS_MAPPING_DOES_NOT_EXIST );
+    }
+    assert_int_equal( ufsAddMapping( ufs, dst, files[0] ), UFS_NO_ERROR );
+
+    ufsDestroy( ufs );
+}
+
+#endif /* UFS_FIXED_LAYOUT */
+
+static const struct CMUnitTest shards_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_shards_spread, shardsSetup, shardsTeardown),
+#ifndef UFS_FIXED_LAYOUT
+    cmocka_unit_test_setup_teardown(test_ufs_shards_parallel, shardsSetup, shardsTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_shards_collapse_all_or_nothing, shardsSetup, shardsTeardown),
+#endif /* UFS_FIXED_LAYOUT */
+};
+
+int main(void) {
+    return cmocka_run_group_tests(shards_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
@@ -0,0 +1,687 @@
+/******************************************************************************\
+*  ufs_store_test.c                                                            *
+*                                                                              *
+*  Tests for the ufs record store.                                             *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_store.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define STRESS_COUNT (2000)
+
+/* A fixed layout build swaps these for its own, see ufsTestUtilsLayoutSizes. */
+static const struct ufsHeaderSizeRequestStruct bigSizeRequest = {
+    .numFiles = 4096,
+    .numAreas = 64,
+    .numNodes = 4096,
+    .numStrBytes = 65536
+};
+
+static bool countIter( ufsIdType id, void *userData ) {
+    (void) id;
+    (*(uint64_t*)userData)++;
+    return true;
+}
+
+/* ----- ufs_store tests ----                                                 */
+
+static void test_ufs_store_bad_args( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+
+    fn = *state;
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, ufsDefaultSizeRequest );
+    assert_non_null( img );
+
+    assert_int_equal( ufsStoreAddStorage( NULL, 0, "a", true ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsStoreAddStorage( img, 0, NULL, true ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsStoreAddStorage( img, 0, "", true ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsStoreAddStorage( img, -1, "a", true ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsStoreAddArea( img, NULL ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsStoreAddMapping( img, 0, 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_store_storage( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    ufsIdType dir, file;
+
+    fn = *state;
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, ufsDefaultSizeRequest );
+    assert_non_null( img );
+
+    dir = ufsStoreAddStorage( img, 0, "/usr/lib", true );
+    assert_true( dir > 0 );
+    assert_int_equal( ufsErrno, UFS_NO_ERROR );
+
+    file = ufsStoreAddStorage( img, dir, "libc.so", false );
+    assert_true( file > 0 );
+    assert_true( file != dir );
+
+    assert_int_equal( ufsStoreAddStorage( img, dir, "libc.so", false ), -1 );
+    assert_int_equal( ufsErrno, UFS_FILE_ALREADY_EXISTS );
+
+    /* The same name under another parent is another storage.                */
+    assert_true( ufsStoreAddStorage( img, 0, "libc.so", false ) > 0 );
+
+    assert_int_equal( ufsStoreGetStorage( img, 0, "/usr/lib" ), dir );
+    assert_int_equal( ufsStoreGetStorage( img, dir, "libc.so" ), file );
+    assert_int_equal( ufsStoreGetStorage( img, dir, "libm.so" ), -1 );
+    assert_int_equal( ufsErrno, UFS_FILE_DOES_NOT_EXIST );
+
+    assert_true( ufsStoreIsDirectory( img, dir ) );
+    assert_false( ufsStoreIsDirectory( img, file ) );
+    assert_int_equal( ufsStoreGetParent( img, file ), dir );
+    assert_string_equal( ufsStoreGetName( img, UFS_TYPES_FILE, file ),
+                         "libc.so" );
+
+    assert_false( ufsStoreRemoveStorage( img, dir ) );
+    assert_int_equal( ufsErrno, UFS_DIRECTORY_IS_NOT_EMPTY );
+
+    assert_true( ufsStoreRemoveStorage( img, file ) );
+    assert_false( ufsStoreHasStorage( img, file ) );
+    assert_int_equal( ufsStoreGetStorage( img, dir, "libc.so" ), -1 );
+
+    assert_true( ufsStoreRemoveStorage( img, dir ) );
+    assert_false( ufsStoreRemoveStorage( img, dir ) );
+    assert_int_equal( ufsErrno, UFS_FILE_DOES_NOT_EXIST );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_store_areas_and_mappings( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    ufsIdType area, other, dir, file;
+    uint64_t count;
+
+    fn = *state;
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, ufsDefaultSizeRequest );
+    assert_non_null( img );
+
+    area = ufsStoreAddArea( img, "sandbox" );
+    other = ufsStoreAddArea( img, "toolchain" );
+    assert_true( area > 0 && other > 0 && area != other );
+    assert_int_equal( ufsStoreAddArea( img, "sandbox" ), -1 );
+    assert_int_equal( ufsErrno, UFS_AREA_ALREADY_EXISTS );
+    assert_int_equal( ufsStoreGetArea( img, "toolchain" ), other );
+
+    dir = ufsStoreAddStorage( img, 0, "/src", true );
+    file = ufsStoreAddStorage( img, dir, "main.c", false );
+
+    assert_true( ufsStoreAddMapping( img, area, file ) );
+    assert_true( ufsStoreAddMapping( img, other, file ) );
+    assert_true( ufsStoreAddMapping( img, area, dir ) );
+    assert_false( ufsStoreAddMapping( img, area, file ) );
+    assert_int_equal( ufsErrno, UFS_MAPPING_ALREADY_EXISTS );
+
+    assert_true( ufsStoreProbeMapping( img, area, file ) );
+    assert_false( ufsStoreProbeMapping( img, other, dir ) );
+    assert_int_equal( ufsErrno, UFS_MAPPING_DOES_NOT_EXIST );
+
+    count = 0;
+    assert_true( ufsStoreIterateMappings( img, file, countIter, &count ) );
+    assert_int_equal( count, 2 );
+
+    count = 0;
+    assert_true( ufsStoreIterateAreaMappings( img, area, countIter, &count ) );
+    assert_int_equal( count, 2 );
+
+    /* Removing an area takes its mappings along.                            */
+    assert_true( ufsStoreRemoveArea( img, area ) );
+    assert_false( ufsStoreHasArea( img, area ) );
+    assert_false( ufsStoreProbeMapping( img, area, file ) );
+    assert_true( ufsStoreProbeMapping( img, other, file ) );
+
+    /* So does removing storage.                                             */
+    assert_true( ufsStoreRemoveStorage( img, file ) );
+    count = 0;
+    assert_true( ufsStoreIterateAreaMappings( img, other, countIter, &count ) );
+    assert_int_equal( count, 0 );
+
+    assert_true( ufsStoreRemoveMapping( img, other, file ) == false );
+    assert_int_equal( ufsErrno, UFS_MAPPING_DOES_NOT_EXIST );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_store_out_of_memory( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsHeaderSizeRequestStruct sizes = {
+        .numFiles = 2,
+        .numAreas = 1,
+        .numNodes = 8,
+        .numStrBytes = 64
+    };
+    char name[ 32 ];
+    int count;
+
+    fn = *state;
+
+    /* A fixed layout holds more, the first section to run out stops it.     */
+    ufsTestUtilsLayoutSizes( &sizes );
+    ufsImagePtr img = ufsHeaderInit( fn -> name, sizes );
+    assert_non_null( img );
+
+    for ( count = 0; ; count++ ) {
+        snprintf( name, sizeof( name ), "d%d", count );
+        if ( ufsStoreAddStorage( img, 0, name, true ) < 0 )
+            break;
+    }
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+    assert_true( count > 0 && count <= sizes.numFiles );
+
+    /* Freed records are handed out again.                                   */
+    assert_true( ufsStoreRemoveStorage( img, ufsStoreGetStorage( img, 0, "d0" ) ) );
+    assert_true( ufsStoreAddStorage( img, 0, "d0", true ) > 0 );
+    assert_int_equal( ufsStoreAddStorage( img, 0, "full", true ), -1 );
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_store_many( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsHeaderSizeRequestStruct sizes = bigSizeRequest;
+    ufsIdType dir, ids[ STRESS_COUNT ], area;
+    char name[ 64 ];
+    uint64_t count, i;
+
+    fn = *state;
+    if ( !ufsTestUtilsLayoutSizes( &sizes ) )
+        skip();
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, sizes );
+    assert_non_null( img );
+
+    dir = ufsStoreAddStorage( img, 0, "/out", true );
+    area = ufsStoreAddArea( img, "build" );
+
+    srand( 42 );
+    for ( i = 0; i < STRESS_COUNT; i++ ) {
+        snprintf( name, sizeof( name ), "obj-%d-%lu.o", rand() % 1000, i );
+        ids[i] = ufsStoreAddStorage( img, dir, name, false );
+        assert_true( ids[i] > 0 );
+        assert_true( ufsStoreAddMapping( img, area, ids[i] ) );
+    }
+
+    count = 0;
+    ufsStoreIterateChildren( img, dir, countIter, &count );
+    assert_int_equal( count, STRESS_COUNT );
+
+    /* Remove every other storage, which rebalances the trees a lot.         */
+    for ( i = 0; i < STRESS_COUNT; i += 2 )
+        assert_true( ufsStoreRemoveStorage( img, ids[i] ) );
+
+    for ( i = 0; i < STRESS_COUNT; i++ ) {
+        assert_int_equal( ufsStoreHasStorage( img, ids[i] ), i % 2 );
+        assert_int_equal( ufsStoreProbeMapping( img, area, ids[i] ), i % 2 );
+        if ( i % 2 )
+            assert_int_equal( ufsStoreGetStorage( img, dir,
+                ufsStoreGetName( img, UFS_TYPES_FILE, ids[i] ) ), ids[i] );
+    }
+
+    count = 0;
+    ufsStoreIterateAreaMappings( img, area, countIter, &count );
+    assert_int_equal( count, STRESS_COUNT / 2 );
+
+    for ( i = 1; i < STRESS_COUNT; i += 2 )
+        assert_true( ufsStoreRemoveStorage( img, ids[i] ) );
+
+    count = 0;
+    ufsStoreIterateChildren( img, dir, countIter, &count );
+    assert_int_equal( count, 0 );
+    assert_true( ufsStoreRemoveStorage( img, dir ) );
+
+    /* Every index is empty again, so every node went back to the free list. */
+    for ( i = 0; i < UFS_INDEX_COUNT; i++ ) {
+        if ( i != UFS_INDEX_AREA_NAME )
+            assert_int_equal( ufsHeaderGet( img ) -> roots[i], 0 );
+    }
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_store_name_churn( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsHeaderStruct *header;
+    ufsIdType dir, file, area, big, *fills;
+    char name[ 1024 ];
+    uint64_t i, len, used, numFills;
+    int prefix;
+
+    fn = *state;
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, ufsDefaultSizeRequest );
+    assert_non_null( img );
+    header = ufsHeaderGet( img );
+    fills = malloc( header -> sizes[ UFS_TYPES_FILE ] * sizeof( *fills ) );
+    assert_non_null( fills );
+
+    dir = ufsStoreAddStorage( img, 0, "/sandbox", true );
+    assert_true( dir > 0 );
+
+    /* Once the section is full a big freed chunk is split for a small name. */
+    /* Names get shorter as they stop fitting, down to a single granule, so  */
+    /* the section fills before the files run out whatever the sizes.        */
+    memset( name, 'x', 60 );
+    name[ 60 ] = 0;
+    big = ufsStoreAddStorage( img, dir, name, false );
+    assert_true( big > 0 );
+    for ( numFills = 0, len = sizeof( name ) - 1; ; ) {
+        prefix = snprintf( name, sizeof( name ), "f%lu-", numFills );
+        if ( prefix > len )
+            break;
+
+        memset( name + prefix, 'y', len - prefix );
+        name[ len ] = 0;
+        fills[ numFills ] = ufsStoreAddStorage( img, dir, name, false );
+        if ( fills[ numFills ] > 0 ) {
+            numFills++;
+            continue;
+        }
+
+        assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+        len--;
+    }
+    used = header -> used[ UFS_TYPES_STRING ];
+    assert_int_equal( used, header -> sizes[ UFS_TYPES_STRING ] );
+    assert_int_equal( header -> numFree[ UFS_TYPES_STRING ], 0 );
+
+    assert_true( ufsStoreRemoveStorage( img, big ) );
+    assert_true( ufsStoreAddStorage( img, dir, "small", false ) > 0 );
+    assert_int_equal( header -> used[ UFS_TYPES_STRING ], used );
+    assert_int_equal( header -> numFree[ UFS_TYPES_STRING ],
+                      64 - UFS_STRING_GRANULE );
+
+    for ( i = 0; i < numFills; i++ )
+        assert_true( ufsStoreRemoveStorage( img, fills[i] ) );
+    assert_true( ufsStoreRemoveStorage( img,
+                     ufsStoreGetStorage( img, dir, "small" ) ) );
+    free( fills );
+
+    /* Many times what the section holds, in names of every size.            */
+    for ( i = 0; i < 50 * ufsDefaultSizeRequest.numStrBytes / 16; i++ ) {
+        snprintf( name, sizeof( name ), "out-%lu.%.*s", i, (int)( i % 40 ),
+                  "oooooooooooooooooooooooooooooooooooooooo" );
+        file = ufsStoreAddStorage( img, dir, name, false );
+        assert_true( file > 0 );
+        area = ufsStoreAddArea( img, name );
+        assert_true( area > 0 );
+        assert_true( ufsStoreAddMapping( img, area, file ) );
+        assert_string_equal( ufsStoreGetName( img, UFS_TYPES_FILE, file ),
+                             name );
+        assert_true( ufsStoreRemoveArea( img, area ) );
+        assert_true( ufsStoreRemoveStorage( img, file ) );
+    }
+
+    /* Only the name of the directory is still taken.                        */
+    assert_int_equal( header -> used[ UFS_TYPES_STRING ] -
+                      header -> numFree[ UFS_TYPES_STRING ],
+                      2 * UFS_STRING_GRANULE );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_store_persists( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    ufsIdType dir;
+
+    fn = *state;
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, ufsDefaultSizeRequest );
+    assert_non_null( img );
+
+    dir = ufsStoreAddStorage( img, 0, "/etc", true );
+    assert_true( ufsImageSync( img ) );
+    ufsImageFree( img );
+
+    img = ufsHeaderValidate( ufsImageOpen( fn -> name ) );
+    assert_non_null( img );
+    assert_int_equal( ufsStoreGetStorage( img, 0, "/etc" ), dir );
+    ufsImageFree( img );
+}
+
+static void test_ufs_store_snapshot( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsHeaderSizeRequestStruct sizes = bigSizeRequest;
+    struct ufsHeaderStruct *header;
+    ufsIdType dir, ids[ STRESS_COUNT ], area, snapshot, added;
+    ufsImagePtr view;
+    char name[ 64 ];
+    uint64_t count, i;
+
+    fn = *state;
+    if ( !ufsTestUtilsLayoutSizes( &sizes ) )
+        skip();
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, sizes );
+    assert_non_null( img );
+    header = ufsHeaderGet( img );
+
+    dir = ufsStoreAddStorage( img, 0, "/out", true );
+    area = ufsStoreAddArea( img, "build" );
+
+    for ( i = 0; i < STRESS_COUNT / 2; i++ ) {
+        snprintf( name, sizeof( name ), "obj-%lu.o", i );
+        ids[i] = ufsStoreAddStorage( img, dir, name, false );
+        assert_true( ids[i] > 0 );
+        assert_true( ufsStoreAddMapping( img, area, ids[i] ) );
+    }
+
+    snapshot = ufsStoreSnapshot( img );
+    assert_true( snapshot > 0 );
+
+    /* Change every index behind the snapshot's back.                        */
+    for ( i = 0; i < STRESS_COUNT / 2; i += 2 )
+        assert_true( ufsStoreRemoveStorage( img, ids[i] ) );
+    for ( i = STRESS_COUNT / 2; i < STRESS_COUNT; i++ ) {
+        snprintf( name, sizeof( name ), "obj-%lu.o", i );
+        ids[i] = ufsStoreAddStorage( img, dir, name, false );
+        assert_true( ids[i] > 0 );
+        assert_true( ufsStoreAddMapping( img, area, ids[i] ) );
+    }
+    assert_true( ufsStoreRemoveArea( img, area ) );
+    added = ufsStoreAddArea( img, "fresh" );
+    assert_true( added > 0 );
+
+    view = ufsStoreOpenSnapshot( fn -> name, snapshot );
+    assert_non_null( view );
+
+    count = 0;
+    ufsStoreIterateChildren( view, dir, countIter, &count );
+    assert_int_equal( count, STRESS_COUNT / 2 );
+    count = 0;
+    ufsStoreIterateAreaMappings( view, area, countIter, &count );
+    assert_int_equal( count, STRESS_COUNT / 2 );
+
+    for ( i = 0; i < STRESS_COUNT; i++ ) {
+        snprintf( name, sizeof( name ), "obj-%lu.o", i );
+        assert_int_equal( ufsStoreHasStorage( view, ids[i] ),
+                          i < STRESS_COUNT / 2 );
+        assert_int_equal( ufsStoreProbeMapping( view, area, ids[i] ),
+                          i < STRESS_COUNT / 2 );
+        if ( i < STRESS_COUNT / 2 )
+            assert_int_equal( ufsStoreGetStorage( view, dir, name ), ids[i] );
+    }
+
+    assert_true( ufsStoreHasArea( view, area ) );
+    assert_int_equal( ufsStoreGetArea( view, "build" ), area );
+    assert_int_equal( ufsStoreGetArea( view, "fresh" ), -1 );
+    assert_string_equal( ufsStoreGetName( view, UFS_TYPES_AREA, area ),
+                         "build" );
+
+    /* Snapshots are read only.                                              */
+    assert_int_equal( ufsStoreAddStorage( view, 0, "x", true ), -1 );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_SNAPSHOT );
+    assert_false( ufsStoreRemoveStorage( view, dir ) );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_SNAPSHOT );
+    assert_int_equal( ufsStoreSnapshot( view ), -1 );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_SNAPSHOT );
+
+    /* The live image moved on.                                              */
+    count = 0;
+    ufsStoreIterateChildren( img, dir, countIter, &count );
+    assert_int_equal( count, STRESS_COUNT - STRESS_COUNT / 4 );
+    assert_false( ufsStoreHasStorage( img, ids[0] ) );
+    assert_false( ufsStoreHasArea( img, area ) );
+
+    /* Writers keep going while the snapshot is open.                        */
+    assert_true( ufsStoreRemoveStorage( img, ids[1] ) );
+    assert_true( ufsStoreHasStorage( view, ids[1] ) );
+
+    ufsImageFree( view );
+
+    /* Dropping the snapshot frees everything only it held on to.            */
+    assert_true( ufsStoreDropSnapshot( img, snapshot ) );
+    assert_false( ufsStoreDropSnapshot( img, snapshot ) );
+    assert_int_equal( ufsErrno, UFS_SNAPSHOT_DOES_NOT_EXIST );
+    assert_null( ufsStoreOpenSnapshot( fn -> name, snapshot ) );
+    assert_int_equal( ufsErrno, UFS_SNAPSHOT_DOES_NOT_EXIST );
+
+    for ( i = 3; i < STRESS_COUNT; i++ ) {
+        if ( i >= STRESS_COUNT / 2 || i % 2 )
+            assert_true( ufsStoreRemoveStorage( img, ids[i] ) );
+    }
+    assert_true( ufsStoreRemoveStorage( img, dir ) );
+    assert_true( ufsStoreRemoveArea( img, added ) );
+
+    for ( i = 0; i < UFS_INDEX_COUNT; i++ )
+        assert_int_equal( header -> roots[i], 0 );
+    assert_int_equal( header -> numFree[ UFS_TYPES_NODE ],
+                      header -> used[ UFS_TYPES_NODE ] );
+    assert_int_equal( header -> numFree[ UFS_TYPES_FILE ],
+                      header -> used[ UFS_TYPES_FILE ] );
+    assert_int_equal( header -> numFree[ UFS_TYPES_AREA ],
+                      header -> used[ UFS_TYPES_AREA ] );
+
+    ufsImageFree( img );
+}
+
+static void test_ufs_store_snapshot_limits( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsHeaderSizeRequestStruct sizes = {
+        .numFiles = 1024,
+        .numAreas = 1,
+        .numNodes = 8,
+        .numStrBytes = 8192
+    };
+    ufsIdType snapshots[ UFS_SNAPSHOTS_MAX ], dir;
+    char name[ 16 ];
+    int i, numFiles;
+
+    fn = *state;
+
+    /* A fixed layout may run out of files before nodes, either will do.      */
+    ufsTestUtilsLayoutSizes( &sizes );
+    ufsImagePtr img = ufsHeaderInit( fn -> name, sizes );
+    assert_non_null( img );
+
+    assert_int_equal( ufsStoreSnapshot( NULL ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_false( ufsStoreDropSnapshot( img, 0 ) );
+    assert_int_equal( ufsErrno, UFS_SNAPSHOT_DOES_NOT_EXIST );
+    assert_null( ufsStoreOpenSnapshot( NULL, 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    dir = ufsStoreAddStorage( img, 0, "/", true );
+    assert_true( dir > 0 );
+
+    for ( i = 0; i < UFS_SNAPSHOTS_MAX; i++ ) {
+        snapshots[i] = ufsStoreSnapshot( img );
+        assert_true( snapshots[i] > 0 );
+    }
+    assert_int_equal( ufsStoreSnapshot( img ), -1 );
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+
+    /* Copying shared nodes needs room, running out must not tear indices.   */
+    for ( numFiles = 0; ; numFiles++ ) {
+        snprintf( name, sizeof( name ), "f%d", numFiles );
+        if ( ufsStoreAddStorage( img, dir, name, false ) < 0 )
+            break;
+    }
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+    assert_true( numFiles > 0 && numFiles < sizes.numFiles );
+
+    for ( i = 0; i < UFS_SNAPSHOTS_MAX; i++ )
+        assert_true( ufsStoreDropSnapshot( img, snapshots[i] ) );
+
+    /* Only the live indices hold on to nodes again.                        */
+    for ( i = 0; i < numFiles; i++ ) {
+        snprintf( name, sizeof( name ), "f%d", i );
+        assert_true( ufsStoreRemoveStorage( img,
+                                            ufsStoreGetStorage( img, dir, name ) ) );
+    }
+    assert_true( ufsStoreRemoveStorage( img, dir ) );
+    assert_int_equal( ufsHeaderGet( img ) -> numFree[ UFS_TYPES_NODE ],
+                      ufsHeaderGet( img ) -> used[ UFS_TYPES_NODE ] );
+
+    ufsImageFree( img );
+}
+
+static bool collectChange( const struct ufsStoreChangeStruct *change,
+                           void *userData ) {
+    uint64_t *counts = userData;
+    counts[ change -> type ]++;
+    return true;
+}
+
+static bool stopChange( const struct ufsStoreChangeStruct *change,
+                        void *userData ) {
+    (void)change;
+    (*(uint64_t*)userData)++;
+    ufsErrno = UFS_OUT_OF_MEMORY;
+    return false;
+}
+
+static void test_ufs_store_diff_and_apply( void **state ) {
+    struct ufsTestUtilsFileNameStruct *fn;
+    struct ufsHeaderSizeRequestStruct sizes = bigSizeRequest;
+    uint64_t counts[ UFS_STORE_CHANGE_COUNT ] = { 0 };
+    ufsIdType dir, file, area, first, second;
+    uint64_t used, calls;
+    int i;
+
+    struct ufsStoreChangeStruct changes[] = {
+        { .type = UFS_STORE_ADD_STORAGE, .isDirectory = 1, .id = 3,
+          .name = "/bin" },
+        { .type = UFS_STORE_ADD_STORAGE, .id = 7, .other = 3, .name = "ls" },
+        { .type = UFS_STORE_ADD_AREA, .id = 2, .name = "base" },
+        { .type = UFS_STORE_ADD_MAPPING, .id = 7, .other = 2 },
+    };
+    struct ufsStoreChangeStruct clash[] = {
+        { .type = UFS_STORE_REMOVE_MAPPING, .id = 7, .other = 2 },
+        { .type = UFS_STORE_ADD_STORAGE, .id = 9, .other = 3, .name = "cat" },
+        { .type = UFS_STORE_ADD_STORAGE, .id = 9, .other = 3, .name = "cp" },
+    };
+
+    fn = *state;
+    if ( !ufsTestUtilsLayoutSizes( &sizes ) )
+        skip();
+
+    ufsImagePtr img = ufsHeaderInit( fn -> name, sizes );
+    assert_non_null( img );
+
+    dir = ufsStoreAddStorage( img, 0, "/etc", true );
+    area = ufsStoreAddArea( img, "top" );
+    first = ufsStoreSnapshot( img );
+
+    for ( i = 0; i < STRESS_COUNT; i++ ) {
+        char name[ 32 ];
+
+        snprintf( name, sizeof( name ), "conf-%d", i );
+        file = ufsStoreAddStorage( img, dir, name, false );
+        assert_true( file > 0 );
+        if ( i == 0 )
+            assert_true( ufsStoreAddMapping( img, area, file ) );
+    }
+    assert_true( ufsStoreRemoveArea( img, area ) );
+    second = ufsStoreSnapshot( img );
+
+    assert_false( ufsStoreDiff( img, first, second + 1, collectChange,
+                                counts ) );
+    assert_int_equal( ufsErrno, UFS_SNAPSHOT_DOES_NOT_EXIST );
+
+    /* Stopping the walk fails it with the error the iterator set.          */
+    calls = 0;
+    assert_false( ufsStoreDiff( img, first, second, stopChange, &calls ) );
+    assert_int_equal( ufsErrno, UFS_OUT_OF_MEMORY );
+    assert_int_equal( calls, 1 );
+
+    assert_true( ufsStoreDiff( img, first, second, collectChange, counts ) );
+    assert_int_equal( counts[ UFS_STORE_ADD_STORAGE ], STRESS_COUNT );
+    assert_int_equal( counts[ UFS_STORE_REMOVE_AREA ], 1 );
+    assert_int_equal( counts[ UFS_STORE_ADD_MAPPING ], 0 );
+    assert_int_equal( counts[ UFS_STORE_REMOVE_MAPPING ], 0 );
+
+    /* An image with records of its own can't become a replica.             */
+    assert_false( ufsStoreApply( img, changes, 4 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    ufsImageFree( img );
+
+    unlink( fn -> name );
+    img = ufsHeaderInit( fn -> name, sizes );
+    assert_non_null( img );
+
+    assert_true( ufsStoreApply( img, changes, 4 ) );
+    assert_int_equal( ufsStoreGetStorage( img, 0, "/bin" ), 3 );
+    assert_int_equal( ufsStoreGetStorage( img, 3, "ls" ), 7 );
+    assert_int_equal( ufsStoreGetArea( img, "base" ), 2 );
+    assert_true( ufsStoreProbeMapping( img, 2, 7 ) );
+    assert_int_equal( ufsStoreAddStorage( img, 3, "sh", false ), -1 );
+    assert_int_equal( ufsErrno, UFS_IMAGE_IS_REPLICA );
+
+    /* The clash only shows when applying, everything is rolled back, names  */
+    /* placed meanwhile go back to the free lists.                           */
+    used = ufsHeaderGet( img ) -> used[ UFS_TYPES_STRING ] -
+           ufsHeaderGet( img ) -> numFree[ UFS_TYPES_STRING ];
+    assert_false( ufsStoreApply( img, clash, 3 ) );
+    assert_int_equal( ufsErrno, UFS_STREAM_DOES_NOT_APPLY );
+    assert_true( ufsStoreProbeMapping( img, 2, 7 ) );
+    assert_false( ufsStoreHasStorage( img, 9 ) );
+    assert_int_equal( ufsStoreGetStorage( img, 3, "cat" ), -1 );
+    assert_int_equal( ufsHeaderGet( img ) -> used[ UFS_TYPES_STRING ] -
+                      ufsHeaderGet( img ) -> numFree[ UFS_TYPES_STRING ], used );
+    assert_int_equal( ufsHeaderGet( img ) -> numSnapshots, 0 );
+
+    /* Removing what isn't there is caught before anything changes.         */
+    assert_true( ufsStoreApply( img, clash, 1 ) );
+    assert_false( ufsStoreApply( img, clash, 1 ) );
+    assert_int_equal( ufsErrno, UFS_STREAM_DOES_NOT_APPLY );
+    assert_false( ufsStoreProbeMapping( img, 2, 7 ) );
+
+    ufsImageFree( img );
+}
+
+static const struct CMUnitTest store_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_store_bad_args, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_store_storage, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_store_areas_and_mappings, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_store_out_of_memory, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_store_many, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_store_name_churn, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_store_persists, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_store_snapshot, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_store_snapshot_limits, getFileNameSetup, cleanUpTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_store_diff_and_apply, getFileNameSetup, cleanUpTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(store_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
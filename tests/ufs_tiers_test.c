@@ -0,0 +1,387 @@
+/******************************************************************************\
+*  ufs_tiers_test.c                                                            *
+*                                                                              *
+*  Tests for ufs instances over tiers of images.                               *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ufs.h"
+#include "ufs_backend.h"
+#include "ufs_defs.h"
+#include "ufs_header.h"
+#include "ufs_image.h"
+#include "ufs_seal.h"
+#include "ufs_tiers.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define MAX_COLLAPSE (1024)
+
+struct tiersStateStruct {
+    struct ufsTestUtilsFileNameStruct base, sealed, top;
+};
+
+struct countStruct {
+    uint64_t count;
+    uint64_t numEntries;
+};
+
+static int tiersSetup( void **state ) {
+    struct tiersStateStruct *s;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s || !ufsTestUtilsGetTmpFileName( &s -> base ) ||
+         !ufsTestUtilsGetTmpFileName( &s -> sealed ) ||
+         !ufsTestUtilsGetTmpFileName( &s -> top ) )
+        return -1;
+
+    *state = s;
+    return 0;
+}
+
+static int tiersTeardown( void **state ) {
+    struct tiersStateStruct *s;
+
+    s = *state;
+    unlink( s -> base.name );
+    unlink( s -> sealed.name );
+    unlink( s -> top.name );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+static ufsStatusType countDirIter( ufsIdentifierType storage,
+                                   uint64_t currEntry,
+                                   uint64_t numEntries,
+                                   void *userData ) {
+    struct countStruct *c = userData;
+
+    assert_true( storage > 0 );
+    assert_int_equal( currEntry, c -> count );
+    c -> count++;
+    c -> numEntries = numEntries;
+    return UFS_NO_ERROR;
+}
+
+/* Base: /usr holding a, b and c, the area lib maps a and b.                  */
+static void buildSealedBase( struct tiersStateStruct *s ) {
+    ufsType ufs;
+    ufsIdentifierType usr, lib;
+    ufsImagePtr img;
+
+    ufs = ufsInitTiered( s -> base.name, NULL, 0 );
+    assert_non_null( ufs );
+
+    usr = ufsAddDirectory( ufs, "/usr" );
+    lib = ufsAddArea( ufs, "lib" );
+    assert_int_equal( ufsAddMapping( ufs, lib, ufsAddFile( ufs, usr, "a" ) ),
+                      UFS_NO_ERROR );
+    assert_int_equal( ufsAddMapping( ufs, lib, ufsAddFile( ufs, usr, "b" ) ),
+                      UFS_NO_ERROR );
+    assert_true( ufsAddFile( ufs, usr, "c" ) > 0 );
+    ufsDestroy( ufs );
+
+    img = ufsHeaderValidate( ufsImageOpen( s -> base.name ) );
+    assert_non_null( img );
+    assert_true( ufsSeal( img, s -> sealed.name ) );
+    ufsImageFree( img );
+}
+
+/* ----- ufs tests ----                                                       */
+
+static void test_ufs_tiers_bad_init( void **state ) {
+    struct tiersStateStruct *s;
+    const char *paths[1];
+
+    s = *state;
+    buildSealedBase( s );
+
+    assert_null( ufsInitTiered( NULL, NULL, 0 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_null( ufsInitTiered( s -> top.name, NULL, 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* The mutable base is not sealed and can't be a lower tier.             */
+    paths[0] = s -> base.name;
+    assert_null( ufsInitTiered( s -> top.name, paths, 1 ) );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* And the sealed one can't be the top, it is not even writable.         */
+    assert_null( ufsInitTiered( s -> sealed.name, NULL, 0 ) );
+
+    paths[0] = "/nonexistent/ufs/image";
+    assert_null( ufsInitTiered( s -> top.name, paths, 1 ) );
+}
+
+static void test_ufs_tiers_lookups( void **state ) {
+    struct tiersStateStruct *s;
+    struct countStruct c = { 0 };
+    const char *paths[1];
+    ufsType ufs;
+    ufsIdentifierType usr, a, b, cFile, d, lib, sandbox;
+    ufsViewType view = { UFS_VIEW_TERMINATOR };
+
+    s = *state;
+    buildSealedBase( s );
+
+    paths[0] = s -> sealed.name;
+    ufs = ufsInitTiered( s -> top.name, paths, 1 );
+    assert_non_null( ufs );
+
+    usr = ufsGetDirectory( ufs, "/usr" );
+    assert_true( usr > 0 );
+    assert_int_equal( usr >> UFS_TIERS_SHIFT, 1 );
+    assert_int_equal( ufsAddDirectory( ufs, "/usr" ), -1 );
+    assert_int_equal( ufsErrno, UFS_ALREADY_EXISTS );
+
+    a = ufsGetFile( ufs, usr, "a" );
+    b = ufsGetFile( ufs, usr, "b" );
+    cFile = ufsGetFile( ufs, usr, "c" );
+    assert_true( a > 0 && b > 0 && cFile > 0 );
+    assert_int_equal( ufsAddFile( ufs, usr, "a" ), -1 );
+    assert_int_equal( ufsErrno, UFS_ALREADY_EXISTS );
+
+    /* New files in sealed directories land in the top image.                */
+    d = ufsAddFile( ufs, usr, "d" );
+    assert_true( d > 0 );
+    assert_int_equal( d >> UFS_TIERS_SHIFT, 0 );
+    assert_int_equal( ufsGetFile( ufs, usr, "d" ), d );
+
+    lib = ufsGetArea( ufs, "lib" );
+    assert_true( lib > 0 );
+    assert_int_equal( ufsAddArea( ufs, "lib" ), -1 );
+    assert_int_equal( ufsErrno, UFS_ALREADY_EXISTS );
+    sandbox = ufsAddArea( ufs, "sandbox" );
+    assert_true( sandbox > 0 );
+
+    assert_int_equal( ufsProbeMapping( ufs, lib, a ), UFS_NO_ERROR );
+    assert_int_equal( ufsAddMapping( ufs, lib, a ), UFS_ALREADY_EXISTS );
+    assert_int_equal( ufsAddMapping( ufs, sandbox, d ), UFS_NO_ERROR );
+    /* Sealed areas can be extended from the top image.                      */
+    assert_int_equal( ufsAddMapping( ufs, lib, cFile ), UFS_NO_ERROR );
+
+    view[0] = sandbox; view[1] = lib; view[2] = 0;
+    view[3] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsResolveStorageInView( ufs, view, a ), lib );
+    assert_int_equal( ufsResolveStorageInView( ufs, view, cFile ), lib );
+    assert_int_equal( ufsResolveStorageInView( ufs, view, d ), sandbox );
+
+    assert_int_equal( ufsIterateDirInView( ufs, view, usr, countDirIter, &c ),
+                      UFS_NO_ERROR );
+    assert_int_equal( c.count, 4 );
+
+    view[0] = sandbox; view[1] = UFS_VIEW_TERMINATOR;
+    c.count = 0;
+    assert_int_equal( ufsIterateDirInView( ufs, view, usr, countDirIter, &c ),
+                      UFS_NO_ERROR );
+    assert_int_equal( c.count, 1 );
+
+    view[0] = lib; view[1] = UFS_VIEW_TERMINATOR;
+    c.count = 0;
+    assert_int_equal( ufsIterateDirInView( ufs, view, usr, countDirIter, &c ),
+                      UFS_NO_ERROR );
+    assert_int_equal( c.count, 3 );
+
+    /* Records of the sealed image stay put.                                 */
+    assert_int_equal( ufsRemoveFile( ufs, a ), UFS_BAD_CALL );
+    assert_int_equal( ufsRemoveArea( ufs, lib ), UFS_BAD_CALL );
+    view[0] = lib; view[1] = sandbox; view[2] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsCollapse( ufs, view ), UFS_BAD_CALL );
+
+    ufsDestroy( ufs );
+
+    /* The delta persists in the top image.                                  */
+    ufs = ufsInitTiered( s -> top.name, paths, 1 );
+    assert_non_null( ufs );
+    assert_int_equal( ufsGetFile( ufs, usr, "d" ), d );
+    assert_int_equal( ufsProbeMapping( ufs, lib, cFile ), UFS_NO_ERROR );
+    assert_int_equal( ufsRemoveFile( ufs, d ), UFS_NO_ERROR );
+    ufsDestroy( ufs );
+}
+
+static void test_ufs_tiers_scratch( void **state ) {
+    struct tiersStateStruct *s;
+    struct countStruct c = { 0 };
+    const char *paths[1];
+    ufsType ufs;
+    ufsIdentifierType usr, a, b, cFile, lib, tmp, gone, kept, tmpDir, file;
+    ufsViewType view = { UFS_VIEW_TERMINATOR };
+    char name[ 32 ];
+    int i;
+
+    s = *state;
+    buildSealedBase( s );
+
+    paths[0] = s -> sealed.name;
+    ufs = ufsInitTiered( s -> top.name, paths, 1 );
+    assert_non_null( ufs );
+
+    usr = ufsGetDirectory( ufs, "/usr" );
+    a = ufsGetFile( ufs, usr, "a" );
+    b = ufsGetFile( ufs, usr, "b" );
+    cFile = ufsGetFile( ufs, usr, "c" );
+    lib = ufsGetArea( ufs, "lib" );
+
+    tmp = ufsAddScratchArea( ufs, "tmp" );
+    assert_true( tmp > 0 );
+    assert_int_equal( ufsGetArea( ufs, "tmp" ), tmp );
+    assert_int_equal( ufsAddScratchArea( ufs, "tmp" ), -1 );
+    assert_int_equal( ufsErrno, UFS_ALREADY_EXISTS );
+    assert_int_equal( ufsAddArea( ufs, "tmp" ), -1 );
+    assert_int_equal( ufsErrno, UFS_ALREADY_EXISTS );
+    assert_int_equal( ufsAddScratchArea( ufs, "lib" ), -1 );
+    assert_int_equal( ufsErrno, UFS_ALREADY_EXISTS );
+    assert_int_equal( ufsAddScratchArea( ufs, "BASE" ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* Storage of both tiers, the read-write one in bulk.                    */
+    tmpDir = ufsAddDirectory( ufs, "/tmp" );
+    for ( i = 0; i < 100; i++ ) {
+        snprintf( name, sizeof( name ), "t%d", i );
+        file = ufsAddFile( ufs, tmpDir, name );
+        assert_int_equal( ufsAddMapping( ufs, tmp, file ), UFS_NO_ERROR );
+    }
+    assert_int_equal( ufsAddMapping( ufs, tmp, a ), UFS_NO_ERROR );
+    assert_int_equal( ufsAddMapping( ufs, tmp, a ), UFS_ALREADY_EXISTS );
+    assert_int_equal( ufsProbeMapping( ufs, tmp, b ),
+                      UFS_MAPPING_DOES_NOT_EXIST );
+
+    view[0] = tmp; view[1] = lib; view[2] = 0; view[3] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsResolveStorageInView( ufs, view, a ), tmp );
+    assert_int_equal( ufsResolveStorageInView( ufs, view, b ), lib );
+    assert_int_equal( ufsResolveStorageInView( ufs, view, cFile ), 0 );
+    assert_int_equal( ufsResolveStorageInView( ufs, view, file ), tmp );
+
+    view[0] = tmp; view[1] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsIterateDirInView( ufs, view, usr, countDirIter, &c ),
+                      UFS_NO_ERROR );
+    assert_int_equal( c.count, 1 );
+
+    /* Mapped storage leaves BASE, removed storage leaves the area.          */
+    view[0] = 0;
+    assert_int_equal( ufsResolveStorageInView( ufs, view, file ), -1 );
+    assert_int_equal( ufsRemoveFile( ufs, file ), UFS_NO_ERROR );
+    file = ufsAddFile( ufs, tmpDir, "again" );
+    assert_int_equal( ufsResolveStorageInView( ufs, view, file ), 0 );
+    assert_int_equal( ufsProbeMapping( ufs, tmp, file ),
+                      UFS_MAPPING_DOES_NOT_EXIST );
+
+    /* Collapsing into a scratch area keeps it in memory.                    */
+    gone = ufsAddScratchArea( ufs, "gone" );
+    assert_int_equal( ufsAddMapping( ufs, gone, b ), UFS_NO_ERROR );
+    view[0] = gone; view[1] = tmp; view[2] = UFS_VIEW_TERMINATOR;
+    assert_int_equal( ufsCollapse( ufs, view ), UFS_NO_ERROR );
+    assert_int_equal( ufsProbeMapping( ufs, tmp, b ), UFS_NO_ERROR );
+    assert_int_equal( ufsProbeMapping( ufs, gone, b ),
+                      UFS_MAPPING_DOES_NOT_EXIST );
+
+    assert_int_equal( ufsPersistArea( ufs, lib ), -1 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    kept = ufsPersistArea( ufs, tmp );
+    assert_true( kept > 0 );
+    assert_int_equal( ufsGetArea( ufs, "tmp" ), kept );
+    assert_int_equal( ufsProbeMapping( ufs, tmp, a ), UFS_DOES_NOT_EXIST );
+    assert_int_equal( ufsProbeMapping( ufs, kept, a ), UFS_NO_ERROR );
+    assert_int_equal( ufsProbeMapping( ufs, kept, b ), UFS_NO_ERROR );
+    assert_int_equal( ufsPersistArea( ufs, tmp ), -1 );
+    assert_int_equal( ufsErrno, UFS_DOES_NOT_EXIST );
+    ufsDestroy( ufs );
+
+    /* Only the persisted area outlives the instance.                        */
+    ufs = ufsInitTiered( s -> top.name, paths, 1 );
+    assert_non_null( ufs );
+    assert_int_equal( ufsGetArea( ufs, "gone" ), -1 );
+    assert_int_equal( ufsGetArea( ufs, "tmp" ), kept );
+    assert_int_equal( ufsProbeMapping( ufs, kept, a ), UFS_NO_ERROR );
+    ufsDestroy( ufs );
+}
+
+#ifndef UFS_FIXED_LAYOUT
+
+/* Nodes for a few hundred mappings, a fixed layout build refuses the sizes. */
+static void test_ufs_tiers_collapse_all_or_nothing( void **state ) {
+    struct tiersStateStruct *s;
+    char opts[ UFS_TEST_UTILS_BUFF_SIZE + 64 ], name[ 32 ];
+    ufsIdentifierType dir, src, dst, files[ MAX_COLLAPSE ];
+    ufsViewType view = { UFS_VIEW_TERMINATOR };
+    ufsType ufs;
+    int i, n;
+
+    s = *state;
+    snprintf( opts, sizeof( opts ),
+              "path=%s,files=4096,strbytes=65536,nodes=64", s -> top.name );
+    ufs = ufsInitWithBackend( "image", opts );
+    assert_non_null( ufs );
+
+    dir = ufsAddDirectory( ufs, "/d" );
+    src = ufsAddArea( ufs, "src" );
+    dst = ufsAddArea( ufs, "dst" );
+    assert_true( dir > 0 && src > 0 && dst > 0 );
+
+    /* Map until the nodes run out, then make room for some of them only.    */
+    for ( n = 0; n < MAX_COLLAPSE; n++ ) {
+        snprintf( name, sizeof( name ), "f%d", n );
+        files[n] = ufsAddFile( ufs, dir, name );
+        if ( files[n] < 0 ||
+             ufsAddMapping( ufs, src, files[n] ) != UFS_NO_ERROR )
+            break;
+    }
+    assert_true( n > 0 && n < MAX_COLLAPSE );
+
+    for ( i = n - n / 4; i < n; i++ )
+        assert_int_equal( ufsRemoveFile( ufs, files[i] ), UFS_NO_ERROR );
+    n -= n / 4;
+
+    view[0] = src; view[1] = dst; view[2] = UFS_VIEW_TERMINATOR;
+    assert_int_not_equal( ufsCollapse( ufs, view ), UFS_NO_ERROR );
+
+    /* The mappings dst got before the failure went back.                    */
+    for ( i = 0; i < n; i++ ) {
+        assert_int_equal( ufsProbeMapping( ufs, src, files[i] ),
+                          UFS_NO_ERROR );
+        assert_int_equal( ufsProbeMapping( ufs, dst, files[i] ),
+                          UFS_MAPPING_DOES_NOT_EXIST );
+    }
+    assert_int_equal( ufsAddMapping( ufs, dst, files[0] ), UFS_NO_ERROR );
+
+    ufsDestroy( ufs );
+}
+
+#endif /* UFS_FIXED_LAYOUT */
+
+static const struct CMUnitTest tiers_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_tiers_bad_init, tiersSetup, tiersTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_tiers_lookups, tiersSetup, tiersTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_tiers_scratch, tiersSetup, tiersTeardown),
+#ifndef UFS_FIXED_LAYOUT
+    cmocka_unit_test_setup_teardown(test_ufs_tiers_collapse_all_or_nothing, tiersSetup, tiersTeardown),
+#endif /* UFS_FIXED_LAYOUT */
+};
+
+int main(void) {
+    return cmocka_run_group_tests(tiers_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
@@ -0,0 +1,185 @@
+/******************************************************************************\
+*  ufs_uring_test.c                                                            *
+*                                                                              *
+*  Tests for batches of metadata calls on io_uring.                            *
+*                                                                              *
+*              Written by A.N.                                  18-10-2026     *
+*                                                                              *
+\******************************************************************************/
+
+#ifndef UFS_TEST_DISABLE
+
+#define UFS_TESTING
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ufs_defs.h"
+#include "ufs_uring.h"
+#include <unistd.h>
+#include "utils.h"
+
+#include <cmocka.h>
+
+#define NUM_FILES (100)
+#define DEPTH (8)
+
+struct uringStateStruct {
+    char root[ UFS_TEST_UTILS_BUFF_SIZE ];
+    int rootFd;
+};
+
+static int removeEntry( const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw ) {
+    (void) st;
+    (void) flag;
+    (void) ftw;
+    return remove( path );
+}
+
+static int uringSetup( void **state ) {
+    struct uringStateStruct *s;
+    char name[ 16 ];
+    int i, fd;
+
+    s = malloc( sizeof( *s ) );
+    if ( !s )
+        return -1;
+
+    snprintf( s -> root, sizeof( s -> root ), "/tmp/ufs_uring_XXXXXX" );
+    if ( !mkdtemp( s -> root ) )
+        return -1;
+
+    s -> rootFd = open( s -> root, O_RDONLY | O_DIRECTORY );
+    if ( s -> rootFd < 0 )
+        return -1;
+
+    /* File i is i bytes long.                                                */
+    for ( i = 0; i < NUM_FILES; i++ ) {
+        snprintf( name, sizeof( name ), "f%d", i );
+        fd = openat( s -> rootFd, name, O_WRONLY | O_CREAT, 0600 );
+        if ( fd < 0 || ftruncate( fd, i ) )
+            return -1;
+        close( fd );
+    }
+
+    *state = s;
+    return 0;
+}
+
+static int uringTeardown( void **state ) {
+    struct uringStateStruct *s;
+
+    s = *state;
+    close( s -> rootFd );
+    nftw( s -> root, removeEntry, 16, FTW_DEPTH | FTW_PHYS );
+    free( s );
+    *state = NULL;
+    return 0;
+}
+
+/* Stats and opens every file and a missing one on ring.                      */
+static uint64_t runAll( struct uringStateStruct *s, ufsUringPtr ring ) {
+    struct ufsUringOpStruct ops[ 2 * NUM_FILES + 1 ];
+    struct statx stxs[ NUM_FILES + 1 ];
+    char names[ NUM_FILES + 1 ][ 16 ];
+    uint64_t enters;
+    int i;
+
+    for ( i = 0; i <= NUM_FILES; i++ ) {
+        if ( i < NUM_FILES )
+            snprintf( names[i], sizeof( names[i] ), "f%d", i );
+        else
+            strcpy( names[i], "missing" );
+        ops[ 2 * i ] = (struct ufsUringOpStruct) {
+            .op = UFS_URING_STATX, .dirFd = s -> rootFd, .path = names[i],
+            .flags = AT_SYMLINK_NOFOLLOW, .mask = STATX_SIZE,
+            .stx = &stxs[i]
+        };
+        if ( i < NUM_FILES )
+            ops[ 2 * i + 1 ] = (struct ufsUringOpStruct) {
+                .op = UFS_URING_OPENAT, .dirFd = s -> rootFd,
+                .path = names[i], .flags = O_RDONLY | O_CLOEXEC
+            };
+    }
+
+    enters = ufsUringRun( ring, ops, 2 * NUM_FILES + 1 );
+    assert_int_equal( ufsErrno, UFS_NO_ERROR );
+
+    for ( i = 0; i < NUM_FILES; i++ ) {
+        assert_int_equal( ops[ 2 * i ].result, 0 );
+        assert_int_equal( stxs[i].stx_size, i );
+        assert_true( ops[ 2 * i + 1 ].result >= 0 );
+        assert_int_equal( lseek( ops[ 2 * i + 1 ].result, 0, SEEK_END ), i );
+        close( ops[ 2 * i + 1 ].result );
+    }
+    assert_int_equal( ops[ 2 * NUM_FILES ].result, -ENOENT );
+
+    return enters;
+}
+
+/* ----- ufs_uring tests ----                                                 */
+
+static void test_ufs_uring_async( void **state ) {
+    ufsUringPtr ring;
+    uint64_t enters;
+
+    ring = ufsUringCreate( DEPTH );
+    assert_non_null( ring );
+    assert_int_equal( ufsUringRun( ring, NULL, 0 ), 0 );
+    assert_int_equal( ufsErrno, UFS_NO_ERROR );
+    assert_int_equal( ufsUringRun( ring, NULL, 1 ), 0 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+    assert_int_equal( ufsUringRun( NULL, NULL, 0 ), 0 );
+    assert_int_equal( ufsErrno, UFS_BAD_CALL );
+
+    /* Kernels without io_uring run the batch synchronously.                  */
+    enters = runAll( *state, ring );
+    if ( ufsUringIsAsync( ring ) ) {
+        assert_true( enters >= ( 2 * NUM_FILES + 1 ) / DEPTH );
+        assert_true( enters < 2 * NUM_FILES / 4 );
+    } else {
+        assert_int_equal( enters, 0 );
+    }
+
+    /* The ring is reused across batches.                                     */
+    runAll( *state, ring );
+    ufsUringFree( ring );
+}
+
+static void test_ufs_uring_sync( void **state ) {
+    ufsUringPtr ring;
+
+    ring = ufsUringCreate( 0 );
+    assert_non_null( ring );
+    assert_false( ufsUringIsAsync( ring ) );
+    assert_int_equal( runAll( *state, ring ), 0 );
+    ufsUringFree( ring );
+    ufsUringFree( NULL );
+}
+
+static const struct CMUnitTest uring_tests[] = {
+    cmocka_unit_test_setup_teardown(test_ufs_uring_async, uringSetup, uringTeardown),
+    cmocka_unit_test_setup_teardown(test_ufs_uring_sync, uringSetup, uringTeardown),
+};
+
+int main(void) {
+    return cmocka_run_group_tests(uring_tests, NULL, NULL);
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif /* UFS_TEST_DISABLE */
@@ -52,6 +52,27 @@ bool ufsTestUtilsGetTmpFile( struct ufsTestUtilsFileNameStruct *fn )
     return true;
 }
 
+bool ufsTestUtilsLayoutSizes( struct ufsHeaderSizeRequestStruct *sizes )
+{
+#ifdef UFS_FIXED_LAYOUT
+    bool holds;
+
+    holds = sizes -> numFiles <= ufsDefaultSizeRequest.numFiles &&
+            sizes -> numAreas <= ufsDefaultSizeRequest.numAreas &&
+            sizes -> numNodes <= ufsDefaultSizeRequest.numNodes &&
+            sizes -> numStrBytes <= ufsDefaultSizeRequest.numStrBytes;
+
+    sizes -> numFiles = ufsDefaultSizeRequest.numFiles;
+    sizes -> numAreas = ufsDefaultSizeRequest.numAreas;
+    sizes -> numNodes = ufsDefaultSizeRequest.numNodes;
+    sizes -> numStrBytes = ufsDefaultSizeRequest.numStrBytes;
+    return holds;
+#else
+    (void)sizes;
+    return true;
+#endif /* UFS_FIXED_LAYOUT */
+}
+
 int getFileNameSetup( void **state )
 {
     struct ufsTestUtilsFileNameStruct *fn;
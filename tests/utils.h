@@ -17,6 +17,7 @@
 
 #define UFS_TEST_UTILS_BUFF_SIZE (1024)
 #include <stdbool.h>
+#include "ufs_header.h"
 
 struct ufsTestUtilsFileNameStruct {
     char name[ UFS_TEST_UTILS_BUFF_SIZE ];
@@ -27,6 +28,11 @@ bool ufsTestUtilsGetTmpFileName( struct ufsTestUtilsFileNameStruct *fn );
 
 bool ufsTestUtilsGetTmpFile( struct ufsTestUtilsFileNameStruct *fn );
 
+/* A fixed layout build takes no sizes but its own. There the sections of    */
+/* sizes are swapped for those of the layout, false means one of them holds  */
+/* less than sizes asks for. Other builds leave sizes as they are.           */
+bool ufsTestUtilsLayoutSizes( struct ufsHeaderSizeRequestStruct *sizes );
+
 int getFileNameSetup( void **state );
 
 int getFileSetup( void **state );